@@ -0,0 +1,210 @@
+#include "accuracy/evaluate.h"
+#include "game/sgf.h"
+#include "game/iterator.h"
+#include "utils/format.h"
+#include "utils/log.h"
+#include "utils/time.h"
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct EvalGame {
+    std::string sgf;
+
+    // Evaluate the all positions if it is negative.
+    int move_number;
+};
+
+bool EndsWith(const std::string &str, const std::string &suffix) {
+    return str.size() >= suffix.size() &&
+               str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::vector<EvalGame> LoadGames(const std::string &input_name) {
+    auto games = std::vector<EvalGame>{};
+    const auto AddFile = [&games](const std::string &sgf_name, int move_number) {
+        SgfParser::Get().ChopFile(sgf_name, 0,
+            [&](std::string &sgf, size_t) {
+                games.emplace_back(EvalGame{std::move(sgf), move_number});
+                return true;
+            });
+    };
+
+    if (EndsWith(input_name, ".sgf")) {
+        AddFile(input_name, -1);
+        return games;
+    }
+
+    auto file = std::ifstream{input_name};
+    auto line = std::string{};
+    while (std::getline(file, line)) {
+        auto iss = std::istringstream{line};
+        auto sgf_name = std::string{};
+        int move_number = -1;
+        if (!(iss >> sgf_name)) {
+            continue;
+        }
+        if (!(iss >> move_number)) {
+            move_number = -1;
+        }
+        AddFile(sgf_name, move_number);
+    }
+    return games;
+}
+
+// Fill the position part of the record.
+EvalRecord MakeRecord(const GameState &state, std::uint32_t game_index) {
+    auto record = EvalRecord{};
+    record.game_index = game_index;
+    record.move_number = state.GetMoveNumber();
+    record.board_size = state.GetBoardSize();
+    record.to_move = state.GetToMove();
+    record.komi = state.GetKomi();
+    return record;
+}
+
+void AppendRecord(std::vector<char> &buffer,
+                      EvalRecord record,
+                      const Network::Result &result) {
+    const int num_intersections = record.board_size * record.board_size;
+
+    std::copy(std::begin(result.wdl), std::end(result.wdl), record.wdl);
+    record.stm_winrate = result.stm_winrate;
+    record.final_score = result.final_score;
+    record.pass_probability = result.pass_probability;
+
+    const auto *p = reinterpret_cast<const char *>(&record);
+    buffer.insert(std::end(buffer), p, p + sizeof(EvalRecord));
+
+    p = reinterpret_cast<const char *>(result.probabilities.data());
+    buffer.insert(std::end(buffer), p, p + num_intersections * sizeof(float));
+    p = reinterpret_cast<const char *>(result.ownership.data());
+    buffer.insert(std::end(buffer), p, p + num_intersections * sizeof(float));
+}
+
+} // namespace
+
+std::string EvaluatePositions(Network &network,
+                                  int board_size,
+                                  std::string input_name,
+                                  std::string output_name) {
+    const auto games = LoadGames(input_name);
+    if (games.empty()) {
+        return "no game is loaded";
+    }
+
+    std::FILE *file = std::fopen(output_name.c_str(), "wb");
+    if (!file) {
+        return "fail to open the output file";
+    }
+
+    auto header = EvalHeader{};
+    std::copy_n("SAYEVAL1", 8, header.magic);
+    header.version = 1;
+    header.reserved = 0;
+    std::fwrite(&header, sizeof(EvalHeader), 1, file);
+
+    // Every thread keeps this many positions in the pipe, so the
+    // threads together fill the batches.
+    const int num_threads = std::max(1, GetOption<int>("threads"));
+    const int window = std::max({1, GetOption<int>("batch_size"),
+                                     GetOption<int>("async_leaves")});
+
+    std::atomic<size_t> next_game{0};
+    std::atomic<int> num_positions{0};
+    std::atomic<int> num_skipped{0};
+    std::mutex file_mutex;
+    bool write_error = false;
+    auto timer = Timer{};
+
+    auto Worker = [&]() {
+        auto buffer = std::vector<char>{};
+        auto pending = std::vector<std::pair<EvalRecord, std::future<Network::Result>>>{};
+        const auto Flush = [&]() {
+            for (auto &p : pending) {
+                AppendRecord(buffer, p.first, p.second.get());
+            }
+            num_positions.fetch_add(pending.size());
+            pending.clear();
+        };
+
+        while (true) {
+            const auto g = next_game.fetch_add(1);
+            if (g >= games.size()) {
+                break;
+            }
+
+            GameState state;
+            try {
+                state = Sgf::Get().FromString(games[g].sgf, 9999);
+            } catch (const char *err) {
+                LOGGING << "Fail to load the SGF file! Discard it." << std::endl
+                            << Format("\tCause: %s.", err) << std::endl;
+                num_skipped.fetch_add(1);
+                continue;
+            }
+            if (state.GetBoardSize() > board_size) {
+                num_skipped.fetch_add(1);
+                continue;
+            }
+
+            const int move_number = games[g].move_number;
+            auto game_ite = GameStateIterator(state);
+
+            do {
+                const auto &curr_state = game_ite.GetState();
+                if (move_number >= 0 && curr_state.GetMoveNumber() != move_number) {
+                    continue;
+                }
+                // The inputs are already encoded, so the state may
+                // go on.
+                pending.emplace_back(MakeRecord(curr_state, g),
+                                         network.GetOutputAsync(curr_state, Network::kNone,
+                                                                    1.f, -1, false, false));
+                if ((int)pending.size() >= window) {
+                    Flush();
+                }
+            } while (game_ite.Next());
+            Flush();
+
+            std::lock_guard<std::mutex> lock(file_mutex);
+            if (!buffer.empty() &&
+                    std::fwrite(buffer.data(), buffer.size(), 1, file) != 1) {
+                write_error = true;
+            }
+            buffer.clear();
+        }
+    };
+
+    auto threads = std::vector<std::thread>{};
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(Worker);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    if (std::fclose(file) != 0) {
+        write_error = true;
+    }
+
+    const auto seconds = timer.GetDuration();
+    auto out = std::ostringstream{};
+    out << Format("games: %zu, skipped: %d\n", games.size(), num_skipped.load());
+    out << Format("positions: %d in %.2f sec, %.1f positions per second",
+                      num_positions.load(), seconds,
+                      num_positions.load() / std::max(seconds, 1e-3f));
+    if (write_error) {
+        out << "\nfail to write the output file";
+    }
+    return out.str();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "neural/network.h"
+
+#include <cstdint>
+#include <string>
+
+// The binary file of the raw network outputs. It is the header and then
+// the records. Every record is the EvalRecord, the policy and the
+// ownership of all intersections in float. They are in the order of the
+// raw-nn command, the index is x + y * board size. All parts are in the
+// native byte order. The records of one game are together, but the games
+// are in the order they are finished, so use the game index to sort them.
+struct EvalHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+};
+
+struct EvalRecord {
+    // The game index in the input, from 0, and the move number of
+    // the position.
+    std::uint32_t game_index;
+    std::uint16_t move_number;
+    std::uint8_t board_size;
+    std::uint8_t to_move;
+    float komi;
+
+    float wdl[3];
+    float stm_winrate;
+    float final_score;
+    float pass_probability;
+};
+
+// Evaluate the positions by the network and write the raw outputs
+// into the binary file. The input is one SGF file, and then every
+// position of every game is evaluated. Or it is the list file with
+// "<sgf file> [move number]" lines, and then only the position of
+// the move number is evaluated if it is given. The positions are
+// forwarded in the threads without the cache, so the pipe is full.
+// The positions larger than the board size are skipped. Return the
+// report.
+std::string EvaluatePositions(Network &network,
+                                  int board_size,
+                                  std::string input_name,
+                                  std::string output_name);
@@ -3,6 +3,18 @@
 #include "game/iterator.h"
 #include "utils/format.h"
 #include "utils/log.h"
+#include "utils/time.h"
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <future>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 float PredictSgfAccuracy(Search &search, GameState &main_state, std::string sgf_name) {
     auto sgfs = SgfParser::Get().ChopAll(sgf_name);
@@ -46,3 +58,315 @@ float PredictSgfAccuracy(Search &search, GameState &main_state, std::string sgf_
 
     return (double)num_correct/num_positions;
 }
+
+std::string PredictSgfPrecisionDrift(Network &network, std::string sgf_name) {
+    auto sgfs = SgfParser::Get().ChopAll(sgf_name);
+    int num_positions = 0;
+    int num_same_best = 0;
+
+    double sum_policy_tv = 0;
+    double sum_winrate_diff = 0;
+    double sum_score_diff = 0;
+    float max_policy_tv = 0;
+    float max_winrate_diff = 0;
+    float max_score_diff = 0;
+
+    for (const auto &sgfstring: sgfs) {
+        GameState state;
+        try {
+            state = Sgf::Get().FromString(sgfstring, 9999);
+        } catch (const char *err) {
+            LOGGING << "Fail to load the SGF file! Discard it." << std::endl
+                        << Format("\tCause: %s.", err) << std::endl;
+            continue;
+        }
+
+        auto game_ite = GameStateIterator(state);
+
+        if (game_ite.MaxMoveNumber() == 0) {
+            continue;
+        }
+
+        do {
+            num_positions++;
+
+            const auto &curr_state = game_ite.GetState();
+            const auto reduced = network.GetOutput(curr_state, Network::kNone,
+                                                       1.f, -1, false, false);
+            const auto full = network.GetFullPrecisionOutput(curr_state);
+            const auto num_intersections = full.board_size * full.board_size;
+
+            // The total variation distance of the policy, including
+            // the pass move.
+            float policy_tv = std::abs(full.pass_probability - reduced.pass_probability);
+            int reduced_best = num_intersections;
+            int full_best = num_intersections;
+            for (int idx = 0; idx < num_intersections; ++idx) {
+                policy_tv += std::abs(full.probabilities[idx] - reduced.probabilities[idx]);
+                if (reduced_best == num_intersections ||
+                        reduced.probabilities[idx] > reduced.probabilities[reduced_best]) {
+                    reduced_best = idx;
+                }
+                if (full_best == num_intersections ||
+                        full.probabilities[idx] > full.probabilities[full_best]) {
+                    full_best = idx;
+                }
+            }
+            policy_tv /= 2.f;
+
+            if (reduced_best == full_best) {
+                num_same_best++;
+            }
+
+            const auto winrate_diff = std::abs(full.stm_winrate - reduced.stm_winrate);
+            const auto score_diff = std::abs(full.final_score - reduced.final_score);
+
+            sum_policy_tv += policy_tv;
+            sum_winrate_diff += winrate_diff;
+            sum_score_diff += score_diff;
+            max_policy_tv = std::max(max_policy_tv, policy_tv);
+            max_winrate_diff = std::max(max_winrate_diff, winrate_diff);
+            max_score_diff = std::max(max_score_diff, score_diff);
+
+            if (num_positions % 1000 == 0) {
+                LOGGING << Format("Checked %d positions\n", num_positions);
+            }
+        } while (game_ite.Next());
+    }
+
+    auto out = std::ostringstream{};
+    const auto n = std::max(num_positions, 1);
+
+    out << Format("positions: %d\n", num_positions);
+    out << Format("same best policy move: %.2f%\n", 100.0 * num_same_best / n);
+    out << Format("policy total variation: mean %.6f, max %.6f\n", sum_policy_tv / n, max_policy_tv);
+    out << Format("winrate difference: mean %.6f, max %.6f\n", sum_winrate_diff / n, max_winrate_diff);
+    out << Format("final score difference: mean %.6f, max %.6f", sum_score_diff / n, max_score_diff);
+
+    return out.str();
+}
+
+namespace {
+
+struct AccuracyStats {
+    int positions{0};
+    int top1{0};
+    int topk{0};
+
+    int values{0};
+    double value_se{0};
+
+    int scores{0};
+    double score_ae{0};
+
+    void Merge(const AccuracyStats &other) {
+        positions += other.positions;
+        top1 += other.top1;
+        topk += other.topk;
+        values += other.values;
+        value_se += other.value_se;
+        scores += other.scores;
+        score_ae += other.score_ae;
+    }
+};
+
+// Read the score of the result, e.g. "B+3.5". Return false if the game
+// is finished by resigning or the time.
+bool ParseBlackScore(const std::string &sgfstring, float &black_score) {
+    const auto pos = sgfstring.find("RE[");
+    if (pos == std::string::npos) {
+        return false;
+    }
+    const auto end = sgfstring.find(']', pos);
+    const auto result = sgfstring.substr(pos + 3, end - pos - 3);
+
+    if (result == "0" || result == "Draw" || result == "D") {
+        black_score = 0.f;
+        return true;
+    }
+    if (result.size() < 3 || result[1] != '+' ||
+            (result[0] != 'B' && result[0] != 'W') ||
+            !std::isdigit(static_cast<unsigned char>(result[2]))) {
+        return false;
+    }
+    try {
+        black_score = std::stof(result.substr(2));
+    } catch (...) {
+        return false;
+    }
+    if (result[0] == 'W') {
+        black_score = -black_score;
+    }
+    return true;
+}
+
+} // namespace
+
+std::string PredictSgfRawAccuracy(Network &network,
+                                      int board_size,
+                                      std::string sgf_name) {
+    constexpr int kTopK = 5;
+    constexpr int kBucketSize = 50;
+    constexpr int kNumBuckets = 8;
+
+    const auto sgfs = SgfParser::Get().ChopAll(sgf_name);
+    const int num_threads = std::max(1, GetOption<int>("threads"));
+    const int window = std::max({1, GetOption<int>("batch_size"),
+                                     GetOption<int>("async_leaves")});
+
+    std::atomic<size_t> next_game{0};
+    std::mutex mutex;
+    auto total = std::vector<AccuracyStats>(kNumBuckets);
+    auto timer = Timer{};
+
+    auto Worker = [&]() {
+        struct Pending {
+            int bucket;
+            int played;
+            float value_target; // negative if unknown
+            bool has_score;
+            float score_target;
+            std::future<Network::Result> result;
+        };
+        auto stats = std::vector<AccuracyStats>(kNumBuckets);
+        auto pending = std::vector<Pending>{};
+
+        const auto Flush = [&]() {
+            for (auto &p : pending) {
+                const auto result = p.result.get();
+                const int num_intersections = result.board_size * result.board_size;
+                const auto Prob = [&](int idx) {
+                    return idx == num_intersections ?
+                               result.pass_probability : result.probabilities[idx];
+                };
+
+                // The rank of the played move, the pass move included.
+                const auto played_prob = Prob(p.played);
+                int rank = 0;
+                for (int idx = 0; idx <= num_intersections; ++idx) {
+                    if (Prob(idx) > played_prob) {
+                        rank++;
+                    }
+                }
+
+                auto &s = stats[p.bucket];
+                s.positions++;
+                s.top1 += (rank == 0);
+                s.topk += (rank < kTopK);
+                if (p.value_target >= 0.f) {
+                    const auto diff = result.stm_winrate - p.value_target;
+                    s.values++;
+                    s.value_se += diff * diff;
+                }
+                if (p.has_score) {
+                    s.scores++;
+                    s.score_ae += std::abs(result.final_score - p.score_target);
+                }
+            }
+            pending.clear();
+        };
+
+        while (true) {
+            const auto g = next_game.fetch_add(1);
+            if (g >= sgfs.size()) {
+                break;
+            }
+
+            GameState state;
+            try {
+                state = Sgf::Get().FromString(sgfs[g], 9999);
+            } catch (const char *err) {
+                LOGGING << "Fail to load the SGF file! Discard it." << std::endl
+                            << Format("\tCause: %s.", err) << std::endl;
+                continue;
+            }
+            if (state.GetBoardSize() > board_size) {
+                continue;
+            }
+
+            const auto winner = state.GetWinner();
+            float black_score = 0.f;
+            const bool has_score = ParseBlackScore(sgfs[g], black_score);
+
+            auto game_ite = GameStateIterator(state);
+            if (game_ite.MaxMoveNumber() == 0) {
+                continue;
+            }
+
+            do {
+                const auto &curr_state = game_ite.GetState();
+                const auto vertex = game_ite.GetVertex();
+                const auto to_move = curr_state.GetToMove();
+
+                auto p = Pending{};
+                p.bucket = std::min(curr_state.GetMoveNumber() / kBucketSize, kNumBuckets - 1);
+                p.played = vertex == kPass ?
+                               curr_state.GetNumIntersections() :
+                               curr_state.GetIndex(curr_state.GetX(vertex), curr_state.GetY(vertex));
+                if (winner == kUndecide) {
+                    p.value_target = -1.f;
+                } else if (winner == kDraw) {
+                    p.value_target = 0.5f;
+                } else {
+                    p.value_target = (int)winner == to_move ? 1.f : 0.f;
+                }
+                p.has_score = has_score;
+                p.score_target = to_move == kBlack ? black_score : -black_score;
+                p.result = network.GetOutputAsync(curr_state, Network::kNone,
+                                                      1.f, -1, false, false);
+                pending.emplace_back(std::move(p));
+
+                if ((int)pending.size() >= window) {
+                    Flush();
+                }
+            } while (game_ite.Next());
+            Flush();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int b = 0; b < kNumBuckets; ++b) {
+            total[b].Merge(stats[b]);
+        }
+    };
+
+    auto threads = std::vector<std::thread>{};
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(Worker);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    auto out = std::ostringstream{};
+    auto all = AccuracyStats{};
+    const auto DumpStats = [&out](const std::string &name, const AccuracyStats &s) {
+        out << Format("%-10s positions %7d, top-1 %6.2f%, top-%d %6.2f%",
+                          name.c_str(),
+                          s.positions,
+                          100.0 * s.top1 / std::max(s.positions, 1),
+                          kTopK,
+                          100.0 * s.topk / std::max(s.positions, 1));
+
+        // The games without the result or the score are not counted.
+        out << (s.values > 0 ? Format(", value MSE %.4f", s.value_se / s.values) : ", value MSE -")
+                << (s.scores > 0 ? Format(", score MAE %.2f", s.score_ae / s.scores) : ", score MAE -")
+                << '\n';
+    };
+
+    for (int b = 0; b < kNumBuckets; ++b) {
+        if (total[b].positions == 0) {
+            continue;
+        }
+        const auto name = b == kNumBuckets - 1 ?
+                              Format("%d+", b * kBucketSize) :
+                              Format("%d-%d", b * kBucketSize, (b+1) * kBucketSize - 1);
+        DumpStats(name, total[b]);
+        all.Merge(total[b]);
+    }
+    DumpStats("all", all);
+    out << Format("%zu games in %.2f sec, %.1f positions per second",
+                      sgfs.size(), timer.GetDuration(),
+                      all.positions / std::max(timer.GetDuration(), 1e-3f));
+
+    return out.str();
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "mcts/search.h"
+#include "neural/network.h"
 #include "game/game_state.h"
 
 #include <string>
@@ -8,3 +9,17 @@
 float PredictSgfAccuracy(Search &search,
                              GameState &main_state,
                              std::string sgf_name);
+
+// Compare the reduced precision outputs with the full precision
+// outputs on every position of the SGF file. Return the report.
+std::string PredictSgfPrecisionDrift(Network &network,
+                                         std::string sgf_name);
+
+// Evaluate the raw network outputs on every position of the SGF file.
+// The games are split across the threads and the positions are sent
+// to the pipe together. Report the top-1 and top-k accuracy of the
+// policy, the value MSE and the score error per move number bucket.
+// The positions larger than the board size are skipped.
+std::string PredictSgfRawAccuracy(Network &network,
+                                      int board_size,
+                                      std::string sgf_name);
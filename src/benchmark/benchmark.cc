@@ -0,0 +1,180 @@
+#include "benchmark/benchmark.h"
+#include "utils/threadpool.h"
+#include "utils/random.h"
+#include "utils/format.h"
+#include "utils/json.h"
+#include "utils/log.h"
+#include "config.h"
+#include "version.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+constexpr int BenchmarkSuite::kDefaultPlayouts;
+
+BenchmarkSuite::BenchmarkSuite() {
+    const auto positions = std::vector<Position>{
+        {"9x9-opening",   9,   0}, {"9x9-middle",   9,  30}, {"9x9-endgame",   9,  60},
+        {"13x13-opening", 13,  0}, {"13x13-middle", 13, 60}, {"13x13-endgame", 13, 130},
+        {"19x19-opening", 19,  0}, {"19x19-middle", 19, 120}, {"19x19-endgame", 19, 250}
+    };
+
+    int playouts = GetOption<int>("playouts");
+    if (playouts >= Search::kMaxPlayouts) {
+        playouts = kDefaultPlayouts;
+    }
+
+    repeats_ = GetOption<int>("benchmark_repeat");
+    seed_ = GetOption<int>("benchmark_seed");
+
+    network_.Initialize(GetOption<std::string>("weights_file"));
+    ThreadPool::Get(GetOption<int>("threads"));
+    search_ = std::make_unique<Search>(state_, network_);
+
+    auto results = std::vector<std::string>{};
+    for (const auto &p : positions) {
+        if (p.board_size > kBoardSize) {
+            continue;
+        }
+        LOGGING << Format("Benchmark %s...\n", p.name.c_str());
+        results.emplace_back(RunPosition(p, playouts));
+    }
+
+    auto out = std::ostringstream{};
+    out << '{'
+            << Format("\"version\":%s,", Json::Quote(GetProgramVersion()).c_str())
+            << Format("\"weights\":%s,", Json::Quote(GetOption<std::string>("weights_file")).c_str())
+            << Format("\"threads\":%d,\"batch_size\":%d,\"playouts\":%d,\"repeats\":%d,\"seed\":%llu,",
+                          GetOption<int>("threads"), GetOption<int>("batch_size"), playouts,
+                          repeats_, (unsigned long long)seed_)
+            << "\"positions\":[";
+    for (size_t i = 0; i < results.size(); ++i) {
+        out << (i == 0 ? "" : ",") << results[i];
+    }
+    out << "],"
+            << Format("\"total\":{\"playouts\":%d,\"seconds\":%.3f,\"playouts_per_second\":%.1f,\"nn_evals\":%lld,\"nn_evals_per_second\":%.1f,\"cache_hit_rate\":%.4f}",
+                          total_playouts_,
+                          total_seconds_,
+                          total_playouts_ / std::max(total_seconds_, 1e-3),
+                          (long long)total_forwards_,
+                          total_forwards_ / std::max(total_seconds_, 1e-3),
+                          (double)total_hits_ / std::max<std::int64_t>(total_lookups_, 1))
+            << '}';
+    std::cout << out.str() << std::endl;
+
+    search_.reset();
+    network_.Destroy();
+}
+
+GameState BenchmarkSuite::MakePosition(const Position &position) {
+    auto state = GameState{};
+    state.Reset(position.board_size, kDefaultKomi);
+
+    auto rng = std::mt19937{static_cast<std::uint32_t>(
+                                1000 * position.board_size + position.moves)};
+    auto candidates = std::vector<int>{};
+
+    for (int m = 0; m < position.moves && !state.IsGameOver(); ++m) {
+        const auto color = state.GetToMove();
+        candidates.clear();
+        for (int y = 0; y < position.board_size; ++y) {
+            for (int x = 0; x < position.board_size; ++x) {
+                const auto vtx = state.GetVertex(x, y);
+                if (state.IsLegalMove(vtx, color) &&
+                        !state.board_.IsSimpleEye(vtx, color)) {
+                    candidates.emplace_back(vtx);
+                }
+            }
+        }
+        if (candidates.empty()) {
+            state.PlayMove(kPass);
+        } else {
+            const auto idx = std::uniform_int_distribution<size_t>{
+                                 0, candidates.size() - 1}(rng);
+            state.PlayMove(candidates[idx]);
+        }
+    }
+    return state;
+}
+
+BenchmarkSuite::Run BenchmarkSuite::SearchOnce(int playouts) {
+    // Start from the empty tree, the empty cache and the same seeds.
+    search_->ReleaseTree();
+    search_->ClearTranspositionTable();
+    network_.ClearCache();
+    network_.ResetStats();
+    FixedSeed::Set(seed_);
+
+    auto run = Run{};
+    run.result = search_->Computation(playouts, Search::kNullTag);
+    run.stats = network_.GetStats();
+    run.tree_mib = (double)search_->GetTreeMemoryUsed() / (1024.0 * 1024.0);
+    return run;
+}
+
+std::string BenchmarkSuite::RunPosition(const Position &position, int playouts) {
+    state_ = MakePosition(position);
+    network_.Reload(position.board_size);
+
+    const auto Speed = [](const Run &run) {
+        return run.result.playouts / std::max((double)run.result.seconds, 1e-3);
+    };
+
+    auto runs = std::vector<Run>{};
+    for (int i = 0; i < repeats_; ++i) {
+        runs.emplace_back(SearchOnce(playouts));
+    }
+    std::sort(std::begin(runs), std::end(runs),
+                  [&Speed](const Run &a, const Run &b) { return Speed(a) < Speed(b); });
+
+    // The speed spread of all runs.
+    double mean = 0.0;
+    for (const auto &run : runs) {
+        mean += Speed(run);
+    }
+    mean /= runs.size();
+    double var = 0.0;
+    for (const auto &run : runs) {
+        var += (Speed(run) - mean) * (Speed(run) - mean);
+    }
+    var /= runs.size();
+
+    // The other statistics are of the median run.
+    const auto &median = runs[runs.size() / 2];
+    const auto &result = median.result;
+    const auto &stats = median.stats;
+    const auto seconds = std::max((double)result.seconds, 1e-3);
+
+    total_playouts_ += result.playouts;
+    total_seconds_ += result.seconds;
+    total_forwards_ += stats.forwards;
+    total_lookups_ += stats.lookups;
+    total_hits_ += stats.hits;
+
+    auto out = std::ostringstream{};
+    out << Format("{\"name\":%s,\"board_size\":%d,\"move_number\":%d,",
+                      Json::Quote(position.name).c_str(),
+                      position.board_size,
+                      state_.GetMoveNumber())
+        << Format("\"best_move\":%s,\"root_winrate\":%.4f,",
+                      Json::Quote(state_.VertexToText(result.best_move)).c_str(),
+                      result.root_eval)
+        << Format("\"playouts\":%d,\"seconds\":%.3f,\"playouts_per_second\":%.1f,",
+                      result.playouts, result.seconds, result.playouts / seconds)
+        << Format("\"playouts_per_second_min\":%.1f,\"playouts_per_second_max\":%.1f,\"playouts_per_second_stddev\":%.1f,",
+                      Speed(runs.front()), Speed(runs.back()), std::sqrt(var))
+        << Format("\"nn_evals\":%lld,\"deep_nn_evals\":%lld,\"nn_evals_per_second\":%.1f,\"cache_hit_rate\":%.4f,",
+                      (long long)stats.forwards,
+                      (long long)stats.deep_forwards,
+                      stats.forwards / seconds,
+                      (double)stats.hits / std::max<std::int64_t>(stats.lookups, 1))
+        << (stats.batch_fill < 0.f ?
+                std::string{"\"batch_fill\":null,"} :
+                Format("\"batch_fill\":%.4f,", stats.batch_fill))
+        << Format("\"p50_latency_us\":%.1f,\"p99_latency_us\":%.1f,\"tree_memory_mib\":%.2f}",
+                      stats.p50_latency_us, stats.p99_latency_us, median.tree_mib);
+    return out.str();
+}
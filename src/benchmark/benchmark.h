@@ -0,0 +1,62 @@
+#pragma once
+
+#include "game/game_state.h"
+#include "mcts/search.h"
+#include "neural/network.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Search a fixed set of positions and write the speed report in JSON
+// to stdout. The positions are the opening, the middle game and the
+// end game of 9x9, 13x13 and 19x19. They are played by a fixed seed,
+// so they do not depend on the weights, and the reports of different
+// builds and weights are comparable.
+//
+// Every run fixes the seeds of all threads by --benchmark-seed, so the
+// noise and the random choices of the search are the same in every
+// run. With --benchmark-repeat, every position is searched many times
+// and the report keeps the median run and the spread of the speed.
+class BenchmarkSuite {
+public:
+    BenchmarkSuite();
+
+private:
+    struct Position {
+        std::string name;
+        int board_size;
+        int moves;
+    };
+
+    // Play the random moves which do not fill the own eyes.
+    static GameState MakePosition(const Position &position);
+
+    struct Run {
+        ComputationResult result;
+        Network::Stats stats;
+        double tree_mib;
+    };
+
+    // Search the position from the empty tree once.
+    Run SearchOnce(int playouts);
+
+    // Search the position by all repeats and return its JSON object.
+    std::string RunPosition(const Position &position, int playouts);
+
+    static constexpr int kDefaultPlayouts = 3200;
+
+    GameState state_;
+    Network network_;
+    std::unique_ptr<Search> search_;
+
+    int repeats_;
+    std::uint64_t seed_;
+
+    // The sums of all positions.
+    int total_playouts_{0};
+    double total_seconds_{0};
+    std::int64_t total_forwards_{0};
+    std::int64_t total_lookups_{0};
+    std::int64_t total_hits_{0};
+};
@@ -0,0 +1,437 @@
+// The micro benchmarks of the hot functions. Every case is run in the
+// samples of at least kSampleTime, and the report is the median, the
+// minimum and the median absolute deviation in ns/op, so one noisy
+// sample does not move the result. Build it with the sayuri-bench
+// target. The usual options are accepted, e.g. --board-size.
+
+#include "game/game_state.h"
+#include "mcts/node.h"
+#include "mcts/parameters.h"
+#include "mcts/edge_table.h"
+#include "neural/encoder.h"
+#include "neural/network.h"
+#include "neural/winograd_helper.h"
+#include "neural/blas/batchnorm.h"
+#include "neural/blas/biases.h"
+#include "neural/blas/convolution.h"
+#include "neural/blas/fullyconnect.h"
+#include "neural/blas/int8_convolution.h"
+#include "neural/blas/bf16_convolution.h"
+#include "neural/blas/se_unit.h"
+#include "neural/blas/winograd_convolution3.h"
+#include "utils/cache.h"
+#include "utils/format.h"
+#include "utils/text_buffer.h"
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr double kSampleTime = 0.05; // seconds
+constexpr int kNumSamples = 9;
+
+// The results are added here, so the compiler can not remove the
+// benchmarked calls.
+volatile std::uint64_t g_sink = 0;
+
+// Run the function in the samples and print the statistics. The
+// function does ops_per_call operations in one call.
+void Bench(const std::string &name, int ops_per_call,
+               const std::function<void()> &func) {
+    const auto Run = [&func](std::int64_t iterations) {
+        const auto start = Clock::now();
+        for (std::int64_t i = 0; i < iterations; ++i) {
+            func();
+        }
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+
+    // Double the iterations until one sample is long enough. It is
+    // also the warm-up.
+    auto iterations = std::int64_t{1};
+    while (Run(iterations) < kSampleTime) {
+        iterations *= 2;
+    }
+
+    auto ns_per_op = std::vector<double>{};
+    for (int i = 0; i < kNumSamples; ++i) {
+        const auto seconds = Run(iterations);
+        ns_per_op.emplace_back(1e9 * seconds / (iterations * ops_per_call));
+    }
+    std::sort(std::begin(ns_per_op), std::end(ns_per_op));
+    const auto median = ns_per_op[kNumSamples / 2];
+
+    auto deviations = std::vector<double>{};
+    for (const auto v : ns_per_op) {
+        deviations.emplace_back(std::abs(v - median));
+    }
+    std::sort(std::begin(deviations), std::end(deviations));
+    const auto mad = deviations[kNumSamples / 2];
+
+    std::cout << Format("%-36s %14.1f %14.1f %7.2f%% %10lld\n",
+                            name.c_str(), median, ns_per_op[0],
+                            100.0 * mad / std::max(median, 1e-9),
+                            (long long)iterations * ops_per_call);
+}
+
+// Play the random moves which do not fill the own eyes. The played
+// vertices are saved in the moves.
+GameState MakePosition(int board_size, int num_moves, std::vector<int> &moves) {
+    auto state = GameState{};
+    state.Reset(board_size, kDefaultKomi);
+
+    auto rng = std::mt19937{static_cast<std::uint32_t>(1000 * board_size + num_moves)};
+    auto candidates = std::vector<int>{};
+
+    for (int m = 0; m < num_moves && !state.IsGameOver(); ++m) {
+        const auto color = state.GetToMove();
+        candidates.clear();
+        for (int y = 0; y < board_size; ++y) {
+            for (int x = 0; x < board_size; ++x) {
+                const auto vtx = state.GetVertex(x, y);
+                if (state.IsLegalMove(vtx, color) &&
+                        !state.board_.IsSimpleEye(vtx, color)) {
+                    candidates.emplace_back(vtx);
+                }
+            }
+        }
+        if (candidates.empty()) {
+            break;
+        }
+        const auto vtx = candidates[std::uniform_int_distribution<size_t>{
+                                        0, candidates.size() - 1}(rng)];
+        state.PlayMove(vtx);
+        moves.emplace_back(vtx);
+    }
+    return state;
+}
+
+std::vector<float> RandomVector(size_t size, std::mt19937 &rng,
+                                    float lo = -1.f, float hi = 1.f) {
+    auto dist = std::uniform_real_distribution<float>{lo, hi};
+    auto out = std::vector<float>(size);
+    for (auto &v : out) {
+        v = dist(rng);
+    }
+    return out;
+}
+
+void BenchBoard(int board_size) {
+    auto moves = std::vector<int>{};
+    const auto state = MakePosition(board_size, board_size * board_size / 3, moves);
+    const auto &board = state.board_;
+    const int num_intersections = board_size * board_size;
+
+    auto empty_state = GameState{};
+    empty_state.Reset(board_size, kDefaultKomi);
+    const auto empty_board = empty_state.board_;
+
+    Bench("Board::PlayMoveAssumeLegal", moves.size(), [&]() {
+        auto b = empty_board;
+        int color = kBlack;
+        for (const auto vtx : moves) {
+            b.PlayMoveAssumeLegal(vtx, color);
+            color = !color;
+        }
+        g_sink += b.GetHash();
+    });
+
+    Bench("Board::IsLegalMove", num_intersections, [&]() {
+        const auto color = state.GetToMove();
+        auto legal = 0;
+        for (int idx = 0; idx < num_intersections; ++idx) {
+            const auto x = idx % board_size;
+            const auto y = idx / board_size;
+            legal += board.IsLegalMove(board.GetVertex(x, y), color);
+        }
+        g_sink += legal;
+    });
+
+    Bench("Board::GetLadderMap", 1, [&]() {
+        g_sink += board.GetLadderMap().size();
+    });
+
+    auto safe_area = std::vector<bool>{};
+    Bench("Board::ComputeSafeArea", 1, [&]() {
+        board.ComputeSafeArea(safe_area, false);
+        g_sink += safe_area.size();
+    });
+
+    Bench("Encoder::GetPlanes", 1, [&]() {
+        g_sink += Encoder::Get().GetPlanes(state).size();
+    });
+}
+
+// Expand the node of the middle game position. The analysis config
+// avoids one move, so every legal move check calls it. The network
+// has no weights, and the result is in the cache after the first call,
+// so it is the time of linking the children.
+void BenchExpandChildren(int board_size) {
+    auto moves = std::vector<int>{};
+    auto state = MakePosition(board_size, board_size * board_size / 3, moves);
+
+    Network network;
+    network.Initialize(std::string{});
+
+    auto param = Parameters{};
+    param.Reset();
+
+    auto config = AnalysisConfig{};
+    auto avoid = AnalysisConfig::MoveToAvoid{};
+    avoid.vertex = state.GetVertex(0, 0);
+    avoid.color = state.GetToMove();
+    avoid.until_move = state.GetMoveNumber() + 1;
+    config.avoid_moves.emplace_back(avoid);
+
+    Bench("Node::ExpandChildren", 1, [&]() {
+        Node node(kNullVertex, 1.f);
+        auto node_evals = NodeEvals{};
+        node.SetParameters(&param);
+        node.ExpandChildren(network, state, node_evals, config, false);
+        g_sink += node.GetChildren().Size();
+    });
+    network.Destroy();
+}
+
+void BenchCache() {
+    using Cache = HashKeyCache<Network::CompactResult>;
+
+    constexpr size_t kCapacity = 1 << 14;
+    constexpr int kBatch = 1024;
+
+    // The keys are mixed like the Zobrist hashes.
+    const auto MixKey = [](std::uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    };
+
+    auto cache = Cache(kCapacity);
+    auto value = Network::CompactResult{};
+    auto next_key = std::uint64_t{0};
+
+    Bench("HashKeyCache::Insert", kBatch, [&]() {
+        for (int i = 0; i < kBatch; ++i) {
+            cache.Insert(MixKey(next_key++), value);
+        }
+    });
+
+    // Look up the latest inserted keys, so all of them hit.
+    cache.Clear();
+    for (int i = 0; i < kBatch; ++i) {
+        cache.Insert(MixKey(i), value);
+    }
+    Bench("HashKeyCache::Lookup", kBatch, [&]() {
+        auto hits = 0;
+        for (int i = 0; i < kBatch; ++i) {
+            hits += cache.Lookup(MixKey(i), value);
+        }
+        g_sink += hits;
+    });
+}
+
+void BenchEdgeTable() {
+    constexpr int kBatch = 256;
+    EdgeTable<Node> edges;
+    for (int i = 0; i < kBatch; ++i) {
+        edges.Append(i, 1.f / kBatch);
+    }
+
+    Bench("EdgeTable::Inflate+Release", kBatch, [&]() {
+        for (auto edge : edges) {
+            edge.Inflate();
+        }
+        for (auto edge : edges) {
+            edge.Release();
+        }
+    });
+}
+
+// Format the ownership of one move like the analysis output, with
+// snprintf and with the reused buffer.
+void BenchAnalysisFormat(int board_size) {
+    const int num_intersections = board_size * board_size;
+    auto rng = std::mt19937{static_cast<std::uint32_t>(board_size)};
+    auto dist = std::uniform_real_distribution<float>{-1.f, 1.f};
+    auto ownership = std::vector<float>(num_intersections);
+    for (auto &v : ownership) {
+        v = dist(rng);
+    }
+
+    Bench("Format ownership", num_intersections, [&]() {
+        auto out = std::string{};
+        for (const auto v : ownership) {
+            out += Format("%.6f ", v);
+        }
+        g_sink += out.size();
+    });
+
+    auto buffer = TextBuffer{};
+    Bench("TextBuffer ownership", num_intersections, [&]() {
+        buffer.Clear();
+        for (const auto v : ownership) {
+            buffer.AppendFixed(v, 6).Append(' ');
+        }
+        g_sink += buffer.Size();
+    });
+}
+
+void BenchBlasLayers(int board_size, int channels) {
+    auto rng = std::mt19937{static_cast<std::uint32_t>(board_size * channels)};
+    const size_t spatial = board_size * board_size;
+    const size_t se_size = channels / 4;
+    const size_t policy_channels = 32;
+    const auto shape = Format("%dx%d", board_size, channels);
+
+    // The activations after ReLU are positive.
+    const auto input = RandomVector(channels * spatial, rng, 0.f, 1.f);
+    auto output = std::vector<float>(channels * spatial);
+
+    const auto weights3 = RandomVector(channels * channels * 9, rng);
+    {
+        auto col = std::vector<float>(
+                       Convolution<3>::GetWorkspaceSize(board_size, channels));
+        Bench("Convolution3::Forward " + shape, 1, [&]() {
+            Convolution<3>::Forward(board_size, channels, channels,
+                                        input, weights3, col, output);
+        });
+    }
+
+    for (const int batch_size : {1, 8}) {
+        const auto U = WinogradTransformF(weights3, channels, channels);
+        const auto workspace_size =
+            WinogradConvolution3::GetWorkspaceSize(board_size, channels, batch_size);
+        auto V = std::vector<float>(workspace_size);
+        auto M = std::vector<float>(workspace_size);
+        auto inputs = std::vector<std::vector<float>>(batch_size, input);
+        auto outputs = std::vector<std::vector<float>>(batch_size, output);
+
+        Bench(Format("WinogradConvolution3::Forward %s b%d", shape.c_str(), batch_size),
+                  batch_size, [&]() {
+            WinogradConvolution3::Forward(board_size, channels, channels,
+                                              inputs, U, V, M, outputs);
+        });
+
+        auto bf16_U = std::vector<std::uint16_t>{};
+        WinogradConvolution3::ConvertBf16Weights(channels, channels, U, bf16_U);
+        Bench(Format("WinogradConvolution3::ForwardBf16 %s b%d", shape.c_str(), batch_size),
+                  batch_size, [&]() {
+            WinogradConvolution3::ForwardBf16(board_size, channels, channels,
+                                                  inputs, bf16_U, V, M, outputs);
+        });
+    }
+
+    {
+        // Same as the loader, one scale per output channel.
+        const size_t padded_dim = (channels * 9 + 3) / 4 * 4;
+        auto int8_weights = std::vector<std::int8_t>(channels * padded_dim);
+        auto dist = std::uniform_int_distribution<int>{-127, 127};
+        for (auto &w : int8_weights) {
+            w = dist(rng);
+        }
+        const auto scales = RandomVector(channels, rng, 1e-3f, 1e-2f);
+        Bench("Int8Convolution3::Forward " + shape, 1, [&]() {
+            Int8Convolution3::Forward(board_size, channels, channels,
+                                          input, int8_weights, scales, output);
+        });
+    }
+
+    {
+        const auto weights1 = RandomVector(policy_channels * channels, rng);
+        auto col = std::vector<float>(
+                       Convolution<1>::GetWorkspaceSize(board_size, channels));
+        Bench(Format("Convolution1::Forward %s->%zu", shape.c_str(), policy_channels), 1, [&]() {
+            Convolution<1>::Forward(board_size, channels, policy_channels,
+                                        input, weights1, col, output);
+        });
+    }
+
+    // The layers below write the input in place. The zero means, the
+    // unit deviations and the zero biases keep the values unchanged,
+    // so the samples are not drifting.
+    {
+        auto buffer = input;
+        const auto means = std::vector<float>(channels, 0.f);
+        const auto stddevs = std::vector<float>(channels, 1.f);
+        Bench("Batchnorm::Forward " + shape, 1, [&]() {
+            Batchnorm::Forward(board_size, channels, buffer, means, stddevs);
+        });
+
+        const auto biases = std::vector<float>(channels, 0.f);
+        Bench("AddSpatialBiases::Forward " + shape, 1, [&]() {
+            AddSpatialBiases::Forward(board_size, channels, buffer, biases, true);
+        });
+    }
+
+    {
+        auto pool = std::vector<float>(3 * channels);
+        Bench("GlobalPooling::Forward " + shape, 1, [&]() {
+            GlobalPooling<false>::Forward(board_size, channels, input, pool);
+        });
+
+        // The identity batchnorm keeps the input unchanged.
+        const auto means = std::vector<float>(channels, 0.f);
+        const auto stddevs = std::vector<float>(channels, 1.f);
+        auto buffer = input;
+        Bench("GlobalPooling::ForwardBatchnorm " + shape, 1, [&]() {
+            GlobalPooling<false>::ForwardBatchnorm(board_size, channels, buffer,
+                                                       means, stddevs, pool, false);
+        });
+
+        const auto fc_weights = RandomVector(3 * channels * channels, rng);
+        const auto fc_biases = RandomVector(channels, rng);
+        auto fc_out = std::vector<float>(channels);
+        Bench(Format("FullyConnect::Forward %d->%d", 3 * channels, channels), 1, [&]() {
+            FullyConnect::Forward(3 * channels, channels, pool,
+                                      fc_weights, fc_biases, fc_out, true);
+        });
+    }
+
+    {
+        const auto residual = RandomVector(channels * spatial, rng);
+        const auto w1 = RandomVector(3 * channels * se_size, rng);
+        const auto b1 = RandomVector(se_size, rng);
+        const auto w2 = RandomVector(se_size * 2 * channels, rng);
+        const auto b2 = RandomVector(2 * channels, rng);
+        auto buffer = input;
+
+        // The unit adds the residual in place, so reset the input in
+        // every call. The copy is small beside the unit.
+        Bench("SEUnit::Forward " + shape, 1, [&]() {
+            std::copy(std::begin(input), std::end(input), std::begin(buffer));
+            SEUnit::Forward(board_size, channels, se_size,
+                                buffer, residual, w1, b1, w2, b2);
+        });
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    ArgsParser(argc, argv);
+
+    const int board_size = GetOption<int>("defualt_boardsize");
+
+    std::cout << Format("%-36s %14s %14s %8s %10s\n",
+                            "case", "median ns/op", "min ns/op", "mad", "ops");
+
+    BenchBoard(board_size);
+    BenchExpandChildren(board_size);
+    BenchCache();
+    BenchEdgeTable();
+    BenchAnalysisFormat(board_size);
+    for (const int channels : {128, 256}) {
+        BenchBlasLayers(board_size, channels);
+    }
+    return 0;
+}
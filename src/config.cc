@@ -1,17 +1,22 @@
 #include "utils/option.h"
 #include "utils/log.h"
 #include "utils/mutex.h"
+#include "utils/time.h"
 #include "game/zobrist.h"
 #include "game/symmetry.h"
 #include "game/types.h"
 #include "game/board.h"
 #include "pattern/pattern.h"
 #include "mcts/lcb.h"
+#include "selfplay/client.h"
 #include "config.h"
 
+#include <cctype>
+#include <future>
 #include <limits>
 #include <sstream>
 #include <fstream>
+#include <vector>
 
 std::unordered_map<std::string, Option> kOptionsMap;
 
@@ -48,11 +53,14 @@ void ArgsParser::InitOptionsMap() const {
     kOptionsMap["ponder"] << Option::setoption(false);
     kOptionsMap["reuse_tree"] << Option::setoption(false);
     kOptionsMap["friendly_pass"] << Option::setoption(false);
+    kOptionsMap["dynamic_time"] << Option::setoption(false);
+    kOptionsMap["futile_search_stop"] << Option::setoption(false);
     kOptionsMap["analysis_verbose"] << Option::setoption(false);
     kOptionsMap["quiet"] << Option::setoption(false);
     kOptionsMap["rollout"] << Option::setoption(false);
     kOptionsMap["no_dcnn"] << Option::setoption(false);
     kOptionsMap["root_dcnn"] << Option::setoption(false);
+    kOptionsMap["root_symm_average"] << Option::setoption(false);
     kOptionsMap["winograd"] << Option::setoption(true);
 
     kOptionsMap["search_mode"] << Option::setoption(std::string{});
@@ -61,20 +69,76 @@ void ArgsParser::InitOptionsMap() const {
     kOptionsMap["defualt_komi"] << Option::setoption(kDefaultKomi);
 
     kOptionsMap["cache_memory_mib"] << Option::setoption(400);
+    kOptionsMap["opening_cache_plies"] << Option::setoption(0);
+    kOptionsMap["opening_cache_memory_mib"] << Option::setoption(32);
+    kOptionsMap["shared_cache"] << Option::setoption(std::string{});
+    kOptionsMap["shared_cache_memory_mib"] << Option::setoption(1024);
+    kOptionsMap["disk_cache"] << Option::setoption(std::string{});
+    kOptionsMap["disk_cache_mib"] << Option::setoption(1024);
+    kOptionsMap["tree_memory_mib"] << Option::setoption(0);
+    kOptionsMap["transposition_memory_mib"] << Option::setoption(0);
+    kOptionsMap["async_leaves"] << Option::setoption(1);
+    kOptionsMap["root_trees"] << Option::setoption(1);
+    kOptionsMap["search_workers"] << Option::setoption(std::string{});
+    kOptionsMap["remote_job_playouts"] << Option::setoption(800);
+    kOptionsMap["ownership_depth"] << Option::setoption(-1);
+    kOptionsMap["dead_stone_playouts"] << Option::setoption(0);
+    kOptionsMap["scoring_playouts"] << Option::setoption(400);
     kOptionsMap["playouts"] << Option::setoption(-1);
     kOptionsMap["ponder_factor"] << Option::setoption(100);
+    kOptionsMap["ponder_replies"] << Option::setoption(0);
     kOptionsMap["const_time"] << Option::setoption(0);
     kOptionsMap["batch_size"] << Option::setoption(0);
     kOptionsMap["threads"] << Option::setoption(0);
+    kOptionsMap["thread_affinity"] << Option::setoption(false);
+    kOptionsMap["numa_cache"] << Option::setoption(false);
+    kOptionsMap["numa_gpus"] << Option::setoption(false);
+    kOptionsMap["huge_pages"] << Option::setoption(false);
+
+    kOptionsMap["remote_server"] << Option::setoption(std::string{});
+    kOptionsMap["server_port"] << Option::setoption(9898);
+    kOptionsMap["metrics_port"] << Option::setoption(0);
+    kOptionsMap["analysis_sessions"] << Option::setoption(16);
+    kOptionsMap["eval_input"] << Option::setoption(std::string{});
+    kOptionsMap["eval_output"] << Option::setoption(std::string{});
+    kOptionsMap["benchmark_repeat"] << Option::setoption(1, 1000, 1);
+    kOptionsMap["benchmark_seed"] << Option::setoption(0);
 
     kOptionsMap["kgs_hint"] << Option::setoption(std::string{});
     kOptionsMap["weights_file"] << Option::setoption(std::string{});
+    kOptionsMap["weights_watch"] << Option::setoption(false);
+    kOptionsMap["policy_weights_file"] << Option::setoption(std::string{});
+    kOptionsMap["opponent_weights_file"] << Option::setoption(std::string{});
+    kOptionsMap["sprt"] << Option::setoption(false);
+    kOptionsMap["sprt_elo0"] << Option::setoption(0.f);
+    kOptionsMap["sprt_elo1"] << Option::setoption(35.f);
+    kOptionsMap["sprt_alpha"] << Option::setoption(0.05f, 0.5f, 1e-6f);
+    kOptionsMap["sprt_beta"] << Option::setoption(0.05f, 0.5f, 1e-6f);
+    kOptionsMap["deep_weights_file"] << Option::setoption(std::string{});
+    kOptionsMap["deep_net_plies"] << Option::setoption(4, 1000, 1);
     kOptionsMap["book_file"] << Option::setoption(std::string{});
     kOptionsMap["patterns_file"] << Option::setoption(std::string{});
 
     kOptionsMap["use_gpu"] << Option::setoption(false);
     kOptionsMap["gpus"] << Option::setoption(std::string{});
     kOptionsMap["gpu_waittime"] << Option::setoption(2);
+    kOptionsMap["gpu_pipeline"] << Option::setoption(1);
+    kOptionsMap["gpu_workers_per_device"] << Option::setoption(1);
+    kOptionsMap["use_fp16"] << Option::setoption(false);
+    kOptionsMap["use_int8"] << Option::setoption(false);
+    kOptionsMap["use_bf16"] << Option::setoption(false);
+    kOptionsMap["gpu_balance"] << Option::setoption(true);
+    kOptionsMap["gpu_warmup"] << Option::setoption(1);
+    kOptionsMap["lazy_gpus"] << Option::setoption(false);
+    kOptionsMap["cuda_graph_batches"] << Option::setoption(0);
+    kOptionsMap["resident_boardsizes"] << Option::setoption(std::string{});
+    kOptionsMap["cudnn_tuning_cache"] << Option::setoption(std::string{});
+    kOptionsMap["use_tensorrt"] << Option::setoption(false);
+    kOptionsMap["tensorrt_cache"] << Option::setoption(std::string{});
+    kOptionsMap["opencl_tuning_cache"] << Option::setoption(std::string{});
+    kOptionsMap["cpu_batch_size"] << Option::setoption(1);
+    kOptionsMap["cpu_batch_workers"] << Option::setoption(0);
+    kOptionsMap["intra_op_threads"] << Option::setoption(1);
 
     kOptionsMap["resign_threshold"] << Option::setoption(0.1f, 1.f, 0.f);
 
@@ -96,7 +160,13 @@ void ArgsParser::InitOptionsMap() const {
     kOptionsMap["policy_temp"] << Option::setoption(1.f, 1.f, 0.f);
     kOptionsMap["lag_buffer"] << Option::setoption(0);
     kOptionsMap["early_symm_cache"] << Option::setoption(false);
+    kOptionsMap["canonical_cache"] << Option::setoption(false);
+    kOptionsMap["komi_free_cache"] << Option::setoption(false);
+    kOptionsMap["multi_pv_share"] << Option::setoption(0.1f, 1.f, 0.f);
     kOptionsMap["symm_pruning"] << Option::setoption(false);
+    kOptionsMap["compact_child_stats"] << Option::setoption(false);
+    kOptionsMap["partial_expansion"] << Option::setoption(0);
+    kOptionsMap["local_virtual_loss"] << Option::setoption(false);
     kOptionsMap["use_stm_winrate"] << Option::setoption(false);
 
     // self-play options
@@ -107,6 +177,7 @@ void ArgsParser::InitOptionsMap() const {
     kOptionsMap["gumbel_considered_moves"] << Option::setoption(16);
     kOptionsMap["gumbel_playouts"] << Option::setoption(400);
     kOptionsMap["gumbel"] << Option::setoption(false);
+    kOptionsMap["sequential_halving"] << Option::setoption(false);
     kOptionsMap["always_completed_q_policy"] << Option::setoption(false);
 
     kOptionsMap["dirichlet_noise"] << Option::setoption(false);
@@ -115,22 +186,42 @@ void ArgsParser::InitOptionsMap() const {
     kOptionsMap["dirichlet_factor"] << Option::setoption(361.f);
 
     kOptionsMap["resign_playouts"] << Option::setoption(0);
+    kOptionsMap["resign_target_rate"] << Option::setoption(0.f, 1.f, 0.f);
     kOptionsMap["reduce_playouts"] << Option::setoption(0);
     kOptionsMap["reduce_playouts_prob"] << Option::setoption(0.f, 1.f, 0.f);
+    kOptionsMap["playout_cap_randomization"] << Option::setoption(false);
     kOptionsMap["first_pass_bonus"] << Option::setoption(false);
 
     kOptionsMap["num_games"] << Option::setoption(0);
     kOptionsMap["parallel_games"] << Option::setoption(1);
+    kOptionsMap["games_per_worker"] << Option::setoption(1);
     kOptionsMap["komi_variance"] << Option::setoption(0.f);
     kOptionsMap["target_directory"] << Option::setoption(std::string{});
+    kOptionsMap["binary_chunk"] << Option::setoption(false);
+    kOptionsMap["write_symmetry"] << Option::setoption(false);
+    kOptionsMap["overflow_games"] << Option::setoption(false);
+    kOptionsMap["compact_game_record"] << Option::setoption(false);
+    kOptionsMap["indexed_chunk"] << Option::setoption(false);
+    kOptionsMap["coordinator"] << Option::setoption(std::string{});
+    kOptionsMap["client_config"] << Option::setoption(std::string{});
 }
 
 void ArgsParser::InitBasicParameters() const {
-    PatternHashAndCoordsInit();
-    Board::InitPattern3();
-    Zobrist::Initialize();
-    Symmetry::Get().Initialize();
-    LcbEntries::Get().Initialize(GetOption<float>("ci_alpha"));
+    // The tables are independent, so build them at the same time.
+    auto &profile = StartupProfile::Get();
+    auto tasks = std::vector<std::future<void>>{};
+    tasks.emplace_back(profile.Launch("patterns", []() {
+        PatternHashAndCoordsInit();
+        Board::InitPattern3();
+    }));
+    tasks.emplace_back(profile.Launch("zobrist", []() { Zobrist::Initialize(); }));
+    tasks.emplace_back(profile.Launch("symmetry", []() { Symmetry::Get().Initialize(); }));
+    tasks.emplace_back(profile.Launch("lcb", []() {
+        LcbEntries::Get().Initialize(GetOption<float>("ci_alpha"));
+    }));
+    for (auto &t : tasks) {
+        t.get();
+    }
     LogOptions::Get().SetQuiet(GetOption<bool>("quiet"));
 
     bool already_set_thread = GetOption<int>("threads") > 0;
@@ -164,6 +255,21 @@ void ArgsParser::InitBasicParameters() const {
     SetOption("threads", std::max(select_threads, 1));
     SetOption("batch_size", std::max(select_batchsize, 1));
 
+    if (GetOption<int>("async_leaves") <= 0) {
+        // Let the search threads fill all batches. The devices are
+        // unknown here, so count the selected GPUs only.
+        auto num_gpus = 0;
+        auto gpus_stream = std::istringstream{GetOption<std::string>("gpus")};
+        for (auto gpu = std::string{}; gpus_stream >> gpu;) {
+            num_gpus += 1;
+        }
+        const int max_batch = use_gpu ?
+                                  GetOption<int>("batch_size") * std::max(num_gpus, 1) :
+                                  GetOption<int>("cpu_batch_size");
+        const int threads = GetOption<int>("threads");
+        SetOption("async_leaves", std::max((max_batch + threads - 1) / threads, 1));
+    }
+
     // Try to select a reasonable number for const time and playouts.
     bool already_set_time = GetOption<int>("const_time") > 0;
     bool already_set_playouts = GetOption<int>("playouts") > -1;
@@ -211,6 +317,11 @@ bool IsParameter(const std::string &param) {
     return param[0] != '-';
 };
 
+bool IsNegativeNumber(const std::string &param) {
+    return param.size() >= 2 && param[0] == '-' &&
+               (std::isdigit(param[1]) || param[1] == '.');
+};
+
 std::string RemoveComment(std::string line) {
     auto out = std::string{};
     for (auto c : line) {
@@ -220,6 +331,20 @@ std::string RemoveComment(std::string line) {
     return out;
 }
 
+// Join the lines of the config file without the comments.
+std::string ReadConfigLines(std::istream &in) {
+    auto lines = std::string{};
+    auto line = std::string{};
+
+    while(std::getline(in, line)) {
+        line = RemoveComment(line);
+        if (!line.empty()) {
+            lines += (line + ' ');
+        }
+    }
+    return lines;
+}
+
 std::string SplitterToString(Splitter &spt) {
     auto out = std::string{};
     const auto cnt = spt.GetCount();
@@ -254,15 +379,7 @@ ArgsParser::ArgsParser(int argc, char** argv) {
 
         file.open(config);
         if (file.is_open()) {
-            auto lines = std::string{};
-            auto line = std::string{};
-
-            while(std::getline(file, line)) {
-                line = RemoveComment(line);
-                if (!line.empty()) {
-                    lines += (line + ' ');
-                }
-            }
+            auto lines = ReadConfigLines(file);
             file.close();
 
             auto cspt = Splitter(lines);
@@ -270,6 +387,20 @@ ArgsParser::ArgsParser(int argc, char** argv) {
         }
     }
 
+    // The self-play client takes the settings of the coordinator like
+    // the config file. The command line is parsed later, so the local
+    // arguments override them.
+    if (const auto res = spt.FindNext("--coordinator")) {
+        auto settings = std::string{};
+        if (IsParameter(res->Get<>()) &&
+                SelfPlayClient(res->Get<>()).FetchSettings(settings)) {
+            auto iss = std::istringstream{settings};
+            auto lines = ReadConfigLines(iss);
+            auto cspt = Splitter(lines);
+            Parse(cspt);
+        }
+    }
+
     Parse(spt);
     SetOption("inputs", inputs_);
 }
@@ -335,16 +466,62 @@ void ArgsParser::Parse(Splitter &spt) {
         spt.RemoveWord(res->Index());
     }
 
+    if (const auto res = spt.Find("--dynamic-time")) {
+        SetOption("dynamic_time", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--futile-search-stop")) {
+        SetOption("futile_search_stop", true);
+        spt.RemoveWord(res->Index());
+    }
+
     if (const auto res = spt.Find("--early-symm-cache")) {
         SetOption("early_symm_cache", true);
         spt.RemoveWord(res->Index());
     }
 
+    if (const auto res = spt.Find("--canonical-cache")) {
+        SetOption("canonical_cache", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.FindNext("--multi-pv-share")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("multi_pv_share", res->Get<float>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.Find("--komi-free-cache")) {
+        SetOption("komi_free_cache", true);
+        spt.RemoveWord(res->Index());
+    }
+
     if (const auto res = spt.Find("--symm-pruning")) {
         SetOption("symm_pruning", true);
         spt.RemoveWord(res->Index());
     }
 
+    if (const auto res = spt.Find("--compact-child-stats")) {
+        SetOption("compact_child_stats", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.FindNext("--partial-expansion")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("partial_expansion", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.Find("--local-virtual-loss")) {
+        // The local counters are read by the compact kernel.
+        SetOption("local_virtual_loss", true);
+        SetOption("compact_child_stats", true);
+        spt.RemoveWord(res->Index());
+    }
+
     if (const auto res = spt.FindNext("--search-mode")) {
         if (IsParameter(res->Get<>())) {
             SetOption("search_mode", res->Get<>());
@@ -362,11 +539,91 @@ void ArgsParser::Parse(Splitter &spt) {
         spt.RemoveWord(res->Index());
     }
 
+    if (const auto res = spt.Find("--fp16")) {
+        SetOption("use_fp16", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--weights-watch")) {
+        SetOption("weights_watch", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--int8")) {
+        SetOption("use_int8", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--bf16")) {
+        SetOption("use_bf16", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--no-gpu-balance")) {
+        SetOption("gpu_balance", false);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--lazy-gpus")) {
+        SetOption("lazy_gpus", true);
+        spt.RemoveWord(res->Index());
+    }
+
     if (const auto res = spt.Find("--no-dcnn")) {
         SetOption("no_dcnn", true);
         spt.RemoveWord(res->Index());
     }
 
+    if (const auto res = spt.Find("--root-symm-average")) {
+        SetOption("root_symm_average", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--thread-affinity")) {
+        SetOption("thread_affinity", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--numa-cache")) {
+        SetOption("numa_cache", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--numa-gpus")) {
+        SetOption("numa_gpus", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--huge-pages")) {
+        SetOption("huge_pages", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--binary-chunk")) {
+        SetOption("binary_chunk", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--write-symmetry")) {
+        SetOption("write_symmetry", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--indexed-chunk")) {
+        SetOption("indexed_chunk", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--overflow-games")) {
+        SetOption("overflow_games", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.Find("--compact-game-record")) {
+        SetOption("compact_game_record", true);
+        spt.RemoveWord(res->Index());
+    }
+
     if (const auto res = spt.Find("--no-winograd")) {
         SetOption("winograd", false);
         spt.RemoveWord(res->Index());
@@ -422,6 +679,11 @@ void ArgsParser::Parse(Splitter &spt) {
         spt.RemoveWord(res->Index());
     }
 
+    if (const auto res = spt.Find("--sequential-halving")) {
+        SetOption("sequential_halving", true);
+        spt.RemoveWord(res->Index());
+    }
+
     if (const auto res = spt.Find("--always-completed-q-policy")) {
         SetOption("always_completed_q_policy", true);
         spt.RemoveWord(res->Index());
@@ -462,6 +724,90 @@ void ArgsParser::Parse(Splitter &spt) {
         }
     }
 
+    if (const auto res = spt.FindNext("--cuda-graph-batches")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("cuda_graph_batches", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--cpu-batch-size")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("cpu_batch_size", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--cpu-batch-workers")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("cpu_batch_workers", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--intra-op-threads")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("intra_op_threads", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--gpu-pipeline")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("gpu_pipeline", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--gpu-workers-per-device")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("gpu_workers_per_device", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--gpu-warmup")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("gpu_warmup", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--cudnn-tuning-cache")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("cudnn_tuning_cache", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.Find("--use-tensorrt")) {
+        SetOption("use_tensorrt", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.FindNext("--tensorrt-cache")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("tensorrt_cache", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--opencl-tuning-cache")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("opencl_tuning_cache", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    while (const auto res = spt.FindNext("--resident-boardsize")) {
+        if (IsParameter(res->Get<>())) {
+            auto sizes = GetOption<std::string>("resident_boardsizes");
+            sizes += (res->Get<>() + " ");
+            SetOption("resident_boardsizes", sizes);
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
     while (const auto res = spt.FindNext({"--gpu", "-g"})) {
         if (IsParameter(res->Get<>())) {
             auto gpus = GetOption<std::string>("gpus");
@@ -492,6 +838,167 @@ void ArgsParser::Parse(Splitter &spt) {
         }
     }
 
+    if (const auto res = spt.FindNext("--opening-cache-plies")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("opening_cache_plies", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--opening-cache-memory-mib")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("opening_cache_memory_mib", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--shared-cache")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("shared_cache", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--shared-cache-memory-mib")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("shared_cache_memory_mib", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--disk-cache")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("disk_cache", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--disk-cache-mib")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("disk_cache_mib", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--remote-server")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("remote_server", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--server-port")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("server_port", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--metrics-port")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("metrics_port", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--analysis-sessions")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("analysis_sessions", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--eval-input")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("eval_input", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--eval-output")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("eval_output", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--benchmark-repeat")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("benchmark_repeat", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--benchmark-seed")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("benchmark_seed", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--tree-memory-mib")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("tree_memory_mib", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--transposition-memory-mib")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("transposition_memory_mib", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--async-leaves")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("async_leaves", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--root-trees")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("root_trees", std::max(res->Get<int>(), 1));
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--search-workers")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("search_workers", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--remote-job-playouts")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("remote_job_playouts", std::max(res->Get<int>(), 1));
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--ownership-depth")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("ownership_depth", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--dead-stone-playouts")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("dead_stone_playouts", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--scoring-playouts")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("scoring_playouts", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
     if (const auto res = spt.FindNext({"--playouts", "-p"})) {
         if (IsParameter(res->Get<>())) {
             SetOption("playouts", res->Get<int>());
@@ -506,6 +1013,13 @@ void ArgsParser::Parse(Splitter &spt) {
        }
     }
 
+    if (const auto res = spt.FindNext("--ponder-replies")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("ponder_replies", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
     if (const auto res = spt.FindNext("--const-time")) {
         if (IsParameter(res->Get<>())) {
             SetOption("const_time", res->Get<int>());
@@ -556,6 +1070,67 @@ void ArgsParser::Parse(Splitter &spt) {
         }
     }
 
+    if (const auto res = spt.FindNext("--opponent-weights")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("opponent_weights_file", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.Find("--sprt")) {
+        SetOption("sprt", true);
+        spt.RemoveWord(res->Index());
+    }
+
+    if (const auto res = spt.FindNext("--sprt-elo0")) {
+        if (IsParameter(res->Get<>()) || IsNegativeNumber(res->Get<>())) {
+            SetOption("sprt_elo0", res->Get<float>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--sprt-elo1")) {
+        if (IsParameter(res->Get<>()) || IsNegativeNumber(res->Get<>())) {
+            SetOption("sprt_elo1", res->Get<float>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--sprt-alpha")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("sprt_alpha", res->Get<float>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--sprt-beta")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("sprt_beta", res->Get<float>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--policy-weights")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("policy_weights_file", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--deep-weights")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("deep_weights_file", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--deep-net-plies")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("deep_net_plies", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
     if (const auto res = spt.FindNext("--book")) {
         if (IsParameter(res->Get<>())) {
             SetOption("book_file", res->Get<>());
@@ -669,6 +1244,13 @@ void ArgsParser::Parse(Splitter &spt) {
         }
     }
 
+    if (const auto res = spt.FindNext("--resign-target-rate")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("resign_target_rate", res->Get<float>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
     if (const auto res = spt.FindNext("--reduce-playouts")) {
         if (IsParameter(res->Get<>())) {
             SetOption("reduce_playouts", res->Get<int>());
@@ -676,6 +1258,11 @@ void ArgsParser::Parse(Splitter &spt) {
         }
     }
 
+    if (const auto res = spt.Find("--playout-cap-randomization")) {
+        SetOption("playout_cap_randomization", true);
+        spt.RemoveWord(res->Index());
+    }
+
     if (const auto res = spt.FindNext("--reduce-playouts-prob")) {
         if (IsParameter(res->Get<>())) {
             SetOption("reduce_playouts_prob", res->Get<float>());
@@ -704,6 +1291,13 @@ void ArgsParser::Parse(Splitter &spt) {
         }
     }
 
+    if (const auto res = spt.FindNext("--games-per-worker")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("games_per_worker", res->Get<int>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
     if (const auto res = spt.FindNext("--komi-variance")) {
         if (IsParameter(res->Get<>())) {
             SetOption("komi_variance", res->Get<float>());
@@ -711,6 +1305,20 @@ void ArgsParser::Parse(Splitter &spt) {
         }
     }
 
+    if (const auto res = spt.FindNext("--coordinator")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("coordinator", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
+    if (const auto res = spt.FindNext("--client-config")) {
+        if (IsParameter(res->Get<>())) {
+            SetOption("client_config", res->Get<>());
+            spt.RemoveSlice(res->Index()-1, res->Index()+1);
+        }
+    }
+
     if (const auto res = spt.FindNext("--target-directory")) {
         if (IsParameter(res->Get<>())) {
             SetOption("target_directory", res->Get<>());
@@ -727,7 +1335,7 @@ void ArgsParser::Parse(Splitter &spt) {
         }
     }
 
-#ifdef USE_CUDA
+#if defined(USE_CUDA) || defined(USE_METAL) || defined(USE_OPENCL)
     SetOption("use_gpu", true);
 #endif
 
@@ -750,33 +1358,205 @@ void ArgsParser::DumpHelper() const {
                 << "\t--ponder\n"
                 << "\t\tThinking on opponent's time.\n\n"
 
+                << "\t--ponder-replies <integer>\n"
+                << "\t\tOnly ponder on the opponent's best replies by the visits and the policy, in proportion to their policy. Their sub-trees are reused if the opponent plays one of them. Default is 0, ponder on all replies.\n\n"
+
                 << "\t--reuse-tree\n"
                 << "\t\tWill reuse the sub-tree.\n\n"
 
                 << "\t--early-symm-cache\n"
                 << "\t\tAccelerate the search on the opening stage.\n\n"
 
+                << "\t--canonical-cache\n"
+                << "\t\tStore the NN results under the minimal symmetry hash, so the symmetric positions share the same entry in all stages.\n\n"
+
+                << "\t--multi-pv-share <float>\n"
+                << "\t\tThe minimum share of the root visits of each best line in the multi-PV analysis. The\n"
+                << "\t\tanalysis takes it with the 'multipv <k>' tag, or the 'multiPV' field of the analysis\n"
+                << "\t\tserver. Default is 0.1.\n\n"
+
+                << "\t--komi-free-cache\n"
+                << "\t\tStore the NN results without the komi, so the same position shares the entry across the komi. The\n"
+                << "\t\tresult of the other komi keeps its policy and ownership, and shifts its score and winrate.\n\n"
+
                 << "\t--friendly-pass\n"
                 << "\t\tDo pass move if the engine wins the game.\n\n"
 
+                << "\t--compact-child-stats\n"
+                << "\t\tStore the children statistics in the contiguous arrays. Speed up the PUCT selection.\n\n"
+
+                << "\t--partial-expansion <integer>\n"
+                << "\t\tOnly the best <integer> children of the inner nodes are sorted and selectable after the expansion. The next child is added when its PUCT value could be the best. Disable it if it is zero. Not used with --compact-child-stats or --no-dcnn.\n\n"
+
+                << "\t--local-virtual-loss\n"
+                << "\t\tEvery search thread only counts the virtual loss of its own pending leaves, so the shared counters of the nodes are never written. Use it with --async-leaves. It implies --compact-child-stats.\n\n"
+
                 << "\t--no-dcnn\n"
                 << "\t\tDisable the Neural Network forwarding pipe. Very weak.\n\n"
 
+                << "\t--root-symm-average\n"
+                << "\t\tEvaluate the new root with the average of all 8 symmetries. They are computed in one batch.\n\n"
+
                 << "\t--cache-memory-mib <integer>\n"
                 << "\t\tSet the NN cache size in MiB.\n\n"
 
+                << "\t--opening-cache-plies <integer>\n"
+                << "\t\tKeep the NN results of the first plies of the games in their own cache, so the other positions never evict them. The parallel self-play games share the opening positions. Default is 0, disabled.\n\n"
+
+                << "\t--opening-cache-memory-mib <integer>\n"
+                << "\t\tSet the opening cache size in MiB.\n\n"
+
+                << "\t--shared-cache <string>\n"
+                << "\t\tAttach to the named NN cache in the shared memory. All engines on the host with the same name share the results. The keys include the weights, so the different networks never mix. Default is disabled.\n\n"
+
+                << "\t--shared-cache-memory-mib <integer>\n"
+                << "\t\tSet the shared NN cache size in MiB. Only the first engine creating the cache uses it. Default is 1024.\n\n"
+
+                << "\t--remote-server <host:port>\n"
+                << "\t\tSend the NN inputs to the inference server instead of computing them here. The weights file is not required.\n\n"
+
+                << "\t--server-port <integer>\n"
+                << "\t\tThe port of the inference server, started with --mode inference-server, the self-play coordinator, started with --mode selfplay-coordinator, or the search worker, started with --mode search-worker. Default is 9898.\n\n"
+
+                << "\t--coordinator <host:port>\n"
+                << "\t\tThe self-play coordinator of --mode selfplay-client. The client takes its settings and weights, then uploads the chunks and the SGFs to it. The new weights are swapped in between the games.\n\n"
+
+                << "\t--client-config <config file>\n"
+                << "\t\tThe settings which --mode selfplay-coordinator hands out to the clients, in the format of the config file. The local arguments of the client override them.\n\n"
+
+                << "\t--metrics-port <integer>\n"
+                << "\t\tServe the counters of the search and the network by HTTP on the port in the Prometheus text format. The GTP command sayuri-stats shows them too. Default is 0, disabled.\n\n"
+
+                << "\t--eval-input <file name>\n"
+                << "\t\tThe positions of --mode evaluate. It is one SGF file, then every position is evaluated, or the list of \"<sgf file> [move number]\" lines.\n\n"
+
+                << "\t--eval-output <file name>\n"
+                << "\t\tThe binary file of the raw network outputs written by --mode evaluate. See accuracy/evaluate.h for the format.\n\n"
+
+                << "\t--benchmark-repeat <integer>\n"
+                << "\t\tSearch every position of --mode benchmark this many times. The report keeps the median run and the spread of the speed. Default is 1.\n\n"
+
+                << "\t--benchmark-seed <integer>\n"
+                << "\t\tThe fixed seed of --mode benchmark. Every run restarts the random generators of every thread from it, so the runs are reproducible. Default is 0.\n\n"
+
+                << "\t--analysis-sessions <integer>\n"
+                << "\t\tThe number of positions every thread searches by turns in --mode analysis-server. The server reads the JSON requests from stdin and writes one JSON result for each. Default is 16.\n\n"
+
+                << "\t--disk-cache <file name>\n"
+                << "\t\tKeep the NN results in the file between the runs. The keys include the weights. Analyzing the known games again skips most forwarding. Default is disabled.\n\n"
+
+                << "\t--disk-cache-mib <integer>\n"
+                << "\t\tSet the size limit of the NN cache file in MiB. The least recently used results are dropped by the compaction. Default is 1024.\n\n"
+
+                << "\t--tree-memory-mib <integer>\n"
+                << "\t\tSet the search tree memory limit in MiB. The small sub-trees will be pruned if exceed it. Set 0 to disable it.\n\n"
+
+                << "\t--transposition-memory-mib <integer>\n"
+                << "\t\tSet the transposition table memory in MiB. The new leaf uses the value of same position searched by other move orders. Set 0 to disable it.\n\n"
+
+                << "\t--async-leaves <integer>\n"
+                << "\t\tNumber of leaves every search thread submits to the network before waiting for the results. The larger value lets few threads fill the large batch. Set 0 to fill the batches of all selected devices with the threads.\n\n"
+
+                << "\t--root-trees <integer>\n"
+                << "\t\tSplit the search threads into the independent trees of the same root. Their root statistics are merged for the move selection and the analysis. It helps the very large number of threads, which contend on one root. Default is 1.\n\n"
+
+                << "\t--search-workers <host:port,...>\n"
+                << "\t\tThe search workers of the other hosts, started with --mode search-worker. The match search keeps the top of the tree and hands the sub-trees of the root children to them. Their statistics are merged into the tree.\n\n"
+
+                << "\t--remote-job-playouts <integer>\n"
+                << "\t\tThe playouts of one sub-tree job of the search workers. The idle worker takes the next root child after the job. Default is 800.\n\n"
+
+                << "\t--ownership-depth <integer>\n"
+                << "\t\tThe deepest leaf which computes the ownership head. The deeper leaves only compute the policy and the value, which saves the convolution and the device copy. The root ownership then only averages the shallow leaves. Set -1 to compute it on all leaves.\n\n"
+
+                << "\t--dead-stone-playouts <integer>\n"
+                << "\t\tThe random playouts for the strings whose ownership is uncertain, used by final_status_list and the friendly pass. The playouts are split over the threads. Set 0 to only use the network ownership.\n\n"
+
+                << "\t--scoring-playouts <integer>\n"
+                << "\t\tThe playouts of final_score and final_status_list if the ownership of the root can not\n"
+                << "\t\ttell the status of some stones. Otherwise they use the root at once. Default is 400.\n\n"
+
                 << "\t--playouts, -p <integer>\n"
                 << "\t\tThe number of maximum playouts.\n\n"
 
                 << "\t--const-time <integer>\n"
                 << "\t\tConst time of search in seconds.\n\n"
 
+                << "\t--futile-search-stop\n"
+                << "\t\tStop the search if the most visited move can not be overtaken by the remaining playouts or time. It is not used by the pondering, the analysis and Gumbel.\n\n"
+
+                << "\t--dynamic-time\n"
+                << "\t\tWith the game clock, think shorter if the best move is stable and clear, and longer if it is changing or close. Stop if the best move can not be overtaken in the remaining time.\n\n"
+
                 << "\t--gpu, -g <integer>\n"
                 << "\t\tSelect a specific GPU device. Default is all devices.\n\n"
 
+                << "\t--fp16\n"
+                << "\t\tCompute the convolutions with the half precision on the GPU. It is much faster on the tensor core devices.\n\n"
+
+                << "\t--int8\n"
+                << "\t\tCompute the residual tower with the INT8 weights and activations on the CPU. Use precision_drift to check the accuracy.\n\n"
+
+                << "\t--bf16\n"
+                << "\t\tCompute the residual tower and the head extractors with the bfloat16 weights and activations on the CPU. It is fast on the AVX-512 BF16 devices.\n\n"
+
+                << "\t--no-gpu-balance\n"
+                << "\t\tSplit the batch size evenly between the GPUs. Default, the batch size of every GPU is proportional to its measured throughput.\n\n"
+
+                << "\t--gpu-pipeline <integer>\n"
+                << "\t\tNumber of in-flight batches per GPU. The memory copy of one batch overlaps with the computation of other batches.\n\n"
+
+                << "\t--gpu-workers-per-device <integer>\n"
+                << "\t\tNumber of workers per GPU. Every worker has its own graphs and streams, so one worker assembles its batch while the batch of the other one is computed. Every worker takes the full batch size of its GPU. Default is 1.\n\n"
+
+                << "\t--gpu-warmup <integer>\n"
+                << "\t\tRun this many dummy batches of the smallest and the largest batch size on every GPU graph before the GPU takes any request, so the first search does not pay the first kernel latency. Default is 1. Set 0 to disable it.\n\n"
+
+                << "\t--lazy-gpus\n"
+                << "\t\tStart with the first GPU only. The next GPU is built and brought online when a full batch is still waiting after a dispatch. It disables the GPU balance calibration.\n\n"
+
+                << "\t--cuda-graph-batches <integer>\n"
+                << "\t\tCapture the forward pass into the CUDA graphs for the batch buckets 1, 2, 4, ... up to this value. A batch replays the graph of the smallest bucket which fits it. It reduces the latency of small batches. Default is 0, disabled.\n\n"
+
+                << "\t--cudnn-tuning-cache <string>\n"
+                << "\t\tStore the convolution algorithms chosen by the cuDNN benchmark in this file. The later startups on the same GPU model skip the benchmark.\n\n"
+
+                << "\t--use-tensorrt\n"
+                << "\t\tCompute the network with the TensorRT engine built from the ONNX model of the weights. It runs on the first GPU of --gpus and uses the half precision with --fp16. It needs the build flag -DUSE_TENSORRT=ON.\n\n"
+
+                << "\t--tensorrt-cache <string>\n"
+                << "\t\tStore the built TensorRT engines in this directory. The later startups with the same weights, GPU model and settings skip the building.\n\n"
+
+                << "\t--opencl-tuning-cache <string>\n"
+                << "\t\tStore the SGEMM parameters tuned by the OpenCL backend in this file. The later startups on the same device skip the tuning.\n\n"
+
+                << "\t--resident-boardsize <integer>\n"
+                << "\t\tKeep the network graph of this board size on the GPU. Use it multiple times for several sizes. Every batch is computed by the graph of its board size, and the batch of mixed sizes is padded to the largest graph, so changing the board size does not rebuild the graphs.\n\n"
+
+                << "\t--cpu-batch-size <integer>\n"
+                << "\t\tThe max batch size of the CPU backend. The threads push their inputs into one queue and the workers compute them in one batch. Default is 1, disabled.\n\n"
+
+                << "\t--cpu-batch-workers <integer>\n"
+                << "\t\tNumber of the batch forwarding workers of the CPU backend. Default is 0, select it by the threads and the CPU batch size.\n\n"
+
+                << "\t--intra-op-threads <integer>\n"
+                << "\t\tSplit the Winograd GEMMs of one convolution over this number of threads on the CPU backend. They are apart from the search threads. It lowers the latency of one position, e.g. the -t 1 analysis. Default is 1, disabled.\n\n"
+
                 << "\t--threads, -t <integer>\n"
                 << "\t\tThe number of threads used. Set 0 will select a reasonable number.\n\n"
 
+                << "\t--thread-affinity\n"
+                << "\t\tPin every worker thread on its own CPU core. Only works on Linux.\n\n"
+
+                << "\t--numa-cache\n"
+                << "\t\tSplit the NN cache by the NUMA nodes. The threads of one node only use its local part. It implies --thread-affinity.\n\n"
+
+                << "\t--numa-gpus\n"
+                << "\t\tSend the positions of every NUMA node to the GPUs attached to that node. Only for the CUDA backend.\n\n"
+
+                << "\t--huge-pages\n"
+                << "\t\tAllocate the NN cache and the tree nodes on the huge pages. Use the reserved 1 GiB or 2 MiB pages if there are, or else the transparent huge pages. Only works on Linux.\n\n"
+
                 << "\t--batch-size, -b <integer>\n"
                 << "\t\tThe number of batches for a single evaluation. Set 0 will select a reasonable number.\n\n"
 
@@ -792,11 +1572,62 @@ void ArgsParser::DumpHelper() const {
                 << "\t--resign-threshold, -r <float>\n"
                 << "\t\tResign when winrate is less than x. Default is 0.1.\n\n"
 
+                << "\t--resign-target-rate <float>\n"
+                << "\t\tThe self-play calibrates the resign threshold, so that about this\n"
+                << "\t\trate of the winners would resign. Zero keeps the threshold. Default\n"
+                << "\t\tis 0.\n\n"
+
                 << "\t--weights, -w <weight file name>\n"
                 << "\t\tFile with network weights.\n\n"
 
+                << "\t--opponent-weights <weight file name>\n"
+                << "\t\tThe opponent network of --mode match. It plays --num-games games against\n"
+                << "\t\tthe --weights network in one process, and the networks take black by\n"
+                << "\t\tturns. The SGFs are saved in --target-directory if it is given.\n\n"
+
+                << "\t--sprt\n"
+                << "\t\tStop --mode match by the sequential probability ratio test. It stops\n"
+                << "\t\tas soon as the results are significant, or after --num-games games.\n\n"
+
+                << "\t--sprt-elo0 <float>, --sprt-elo1 <float>\n"
+                << "\t\tThe Elo differences of H0 and H1 of the test. Default is 0 and 35.\n\n"
+
+                << "\t--sprt-alpha <float>, --sprt-beta <float>\n"
+                << "\t\tThe false positive and the false negative rates of the test. Default\n"
+                << "\t\tis 0.05.\n\n"
+
+                << "\t--policy-weights <weight file name>\n"
+                << "\t\tThe smaller network for the policy only moves. Only its policy head is\n"
+                << "\t\tcomputed. Default uses the main network.\n\n"
+
+                << "\t--deep-weights <weight file name>\n"
+                << "\t\tThe small fast network of the deep leaves. The main network still\n"
+                << "\t\tevaluates the leaves near the root.\n\n"
+
+                << "\t--deep-net-plies <integer>\n"
+                << "\t\tThe deep network evaluates the leaves from this many plies below the\n"
+                << "\t\troot. Default is 4.\n\n"
+
+                << "\t--weights-watch\n"
+                << "\t\tReload the weights file in the background when it is changed. The new network is used from the next game.\n\n"
+
+                << "\t--binary-chunk\n"
+                << "\t\tSave the training data in the fixed width binary records instead of the text records. It is much smaller and faster to load.\n\n"
+
+                << "\t--write-symmetry\n"
+                << "\t\tTransform every training record with a random symmetry when saving it. The binary records store the symmetry, so the training loaders skip their own augmentation.\n\n"
+
+                << "\t--indexed-chunk\n"
+                << "\t\tSave the training data in the indexed shards. Every binary record is compressed alone and the shard ends with the offset table, so the loaders sample any record without decompressing the whole chunk.\n\n"
+
+                << "\t--overflow-games\n"
+                << "\t\tKeep the finished slots playing the extra games until the last self-play game is over, so the network batches stay full at the tail. The extra games are discarded.\n\n"
+
+                << "\t--compact-game-record\n"
+                << "\t\tSave the self-play games in the compact one line records instead of SGF. See Sgf::ToRecordString for the format.\n\n"
+
                 << "\t--book <book file name>\n"
-                << "\t\tFile with opening book.\n\n"
+                << "\t\tFile with opening book. The binary book is memory mapped.\n\n"
 
                 << "\t--logfile, -l <log file name>\n"
                 << "\t\tFile to log input/output to.\n\n"
@@ -0,0 +1,368 @@
+#include "game/analysis_server.h"
+#include "utils/threadpool.h"
+#include "utils/log.h"
+#include "utils/format.h"
+#include "utils/time.h"
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+constexpr int AnalysisServer::kDefaultVisits;
+constexpr int AnalysisServer::kMaxWeight;
+
+AnalysisServer::AnalysisServer() {
+    if (Initialize()) {
+        Loop();
+    }
+    network_.Destroy();
+}
+
+bool AnalysisServer::Initialize() {
+    auto &profile = StartupProfile::Get();
+    profile.Run("network", [this]() {
+        network_.Initialize(GetOption<std::string>("weights_file"));
+    });
+    if (!network_.Valid() && !GetOption<bool>("no_dcnn")) {
+        LOGGING << "The analysis server requires the weights file.\n";
+        return false;
+    }
+
+    // The smaller boards are masked in the network board size.
+    board_size_ = std::max(GetOption<int>("defualt_boardsize"),
+                               GetOption<int>("fixed_nn_boardsize"));
+    network_.Reload(board_size_);
+
+    num_workers_ = std::max(1, GetOption<int>("threads"));
+    sessions_per_worker_ = std::max(1, GetOption<int>("analysis_sessions"));
+
+    // The workers do not use the search threads. The pool only
+    // releases the trees.
+    ThreadPool::Get(num_workers_);
+
+    LOGGING << profile.ToString() << '\n';
+    LOGGING << Format("The analysis server is ready, %d workers, %d sessions per worker.\n",
+                          num_workers_, sessions_per_worker_);
+    return true;
+}
+
+void AnalysisServer::Loop() {
+    auto workers = std::vector<std::thread>{};
+    for (int i = 0; i < num_workers_; ++i) {
+        workers.emplace_back([this]() { Worker(); });
+    }
+
+    auto line = std::string{};
+    while (std::getline(std::cin, line)) {
+        Request(line);
+    }
+
+    // Finish all queued sessions before leaving.
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+    }
+    cv_.notify_all();
+
+    for (auto &t : workers) {
+        t.join();
+    }
+}
+
+void AnalysisServer::Request(const std::string &line) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+        return;
+    }
+
+    auto request = Json{};
+    try {
+        request = Json::Parse(line);
+    } catch (const char *err) {
+        WriteError(std::string{}, err);
+        return;
+    }
+    if (!request.IsObject()) {
+        WriteError(std::string{}, "The request must be an object.");
+        return;
+    }
+
+    auto id = std::string{};
+    if (const auto *v = request.Find("id")) {
+        if (v->IsString()) {
+            id = v->GetString();
+        } else if (v->IsNumber()) {
+            id = Format("%.0f", v->GetNumber());
+        }
+    }
+    if (id.empty()) {
+        WriteError(std::string{}, "The request requires the id.");
+        return;
+    }
+
+    if (const auto *v = request.Find("action")) {
+        if (v->IsString() && v->GetString() == "terminate") {
+            Terminate(request, id);
+        } else {
+            WriteError(id, "Unknown action.");
+        }
+        return;
+    }
+
+    auto session = SessionPtr{};
+    try {
+        session = BuildSession(request, id);
+    } catch (const char *err) {
+        WriteError(id, err);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (sessions_.count(id)) {
+            WriteError(id, "The id is already in use.");
+            return;
+        }
+        session->order = next_order_++;
+        sessions_[id] = session;
+        queue_.emplace_back(session);
+    }
+    cv_.notify_one();
+}
+
+void AnalysisServer::Terminate(const Json &request, const std::string &id) {
+    const auto *v = request.Find("terminateId");
+    if (!v || !v->IsString()) {
+        WriteError(id, "The terminate action requires the terminateId.");
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(v->GetString());
+    if (it != std::end(sessions_)) {
+        it->second->terminated.store(true, std::memory_order_relaxed);
+    }
+}
+
+AnalysisServer::SessionPtr AnalysisServer::BuildSession(const Json &request,
+                                                            const std::string &id) {
+    const auto GetNumber = [&request](const char *key, double def) -> double {
+        const auto *v = request.Find(key);
+        if (!v || v->IsNull()) {
+            return def;
+        }
+        if (!v->IsNumber() || !std::isfinite(v->GetNumber())) {
+            throw "The value must be a number.";
+        }
+        return v->GetNumber();
+    };
+    const auto GetMoves = [&request](const char *key) {
+        auto moves = std::vector<std::pair<std::string, std::string>>{};
+        const auto *v = request.Find(key);
+        if (!v || v->IsNull()) {
+            return moves;
+        }
+        if (!v->IsArray()) {
+            throw "The moves must be an array.";
+        }
+        for (const auto &m : v->GetArray()) {
+            if (!m.IsArray() || m.GetArray().size() != 2 ||
+                    !m.GetArray()[0].IsString() || !m.GetArray()[1].IsString()) {
+                throw "The move must be the pair of color and vertex.";
+            }
+            moves.emplace_back(m.GetArray()[0].GetString(), m.GetArray()[1].GetString());
+        }
+        return moves;
+    };
+
+    auto session = std::make_shared<Session>();
+    session->id = id;
+
+    const int board_size = GetNumber("boardSize", GetOption<int>("defualt_boardsize"));
+    if (board_size < kMinGTPBoardSize || board_size > board_size_) {
+        throw "The board size is not supported.";
+    }
+    const float komi = GetNumber("komi", GetOption<float>("defualt_komi"));
+
+    int playouts = GetOption<int>("playouts");
+    if (playouts >= Search::kMaxPlayouts) {
+        playouts = kDefaultVisits;
+    }
+    const double visits = GetNumber("maxVisits", playouts);
+    if (visits < 1) {
+        throw "The maxVisits must be positive.";
+    }
+
+    // Clamp the values before converting them to the integers.
+    session->playouts = std::min(visits, double(Search::kMaxPlayouts));
+    session->priority = std::max(-1e6, std::min(GetNumber("priority", 0), 1e6));
+    session->max_moves = std::max(1.0, std::min(GetNumber("maxMoves", kNumIntersections + 1), 1e6));
+    session->multi_pv = std::max(0.0, std::min(GetNumber("multiPV", 0), double(kNumIntersections + 1)));
+    session->ownership = false;
+    if (const auto *v = request.Find("includeOwnership")) {
+        session->ownership = v->IsBool() && v->GetBool();
+    }
+    session->policy_only = false;
+    if (const auto *v = request.Find("policyOnly")) {
+        session->policy_only = v->IsBool() && v->GetBool();
+    }
+
+    auto &state = session->state;
+    state.Reset(board_size, komi);
+
+    for (const auto &m : GetMoves("initialStones")) {
+        const int color = state.TextToColor(m.first);
+        const int vtx = state.TextToVertex(m.second);
+        if (color == kInvalid || vtx == kNullVertex ||
+                vtx == kPass || vtx == kResign ||
+                !state.AppendMove(vtx, color)) {
+            throw "The initial stone is invalid.";
+        }
+    }
+    for (const auto &m : GetMoves("moves")) {
+        const int color = state.TextToColor(m.first);
+        const int vtx = state.TextToVertex(m.second);
+        if (color == kInvalid || vtx == kNullVertex ||
+                vtx == kResign || !state.PlayMove(vtx, color)) {
+            throw "The move is illegal.";
+        }
+    }
+    return session;
+}
+
+AnalysisServer::SessionPtr AnalysisServer::PopSession(bool blocking) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (blocking) {
+        cv_.wait(lock, [this]() { return closed_ || !queue_.empty(); });
+    }
+    if (queue_.empty()) {
+        return nullptr;
+    }
+
+    // The higher priority first, then the earlier.
+    auto it = std::min_element(std::begin(queue_), std::end(queue_),
+                                   [](const SessionPtr &a, const SessionPtr &b) {
+                                       if (a->priority != b->priority) {
+                                           return a->priority > b->priority;
+                                       }
+                                       return a->order < b->order;
+                                   });
+    auto session = *it;
+    queue_.erase(it);
+    return session;
+}
+
+int AnalysisServer::GetWeight(const Session &session) const {
+    return std::min(std::max(session.priority, 0) + 1, kMaxWeight);
+}
+
+void AnalysisServer::Worker() {
+    auto searching = std::vector<SessionPtr>{};
+    auto next_searching = std::vector<SessionPtr>{};
+
+    // The policy only sessions of this step. They are answered after
+    // one forwarding, which is batched with the leaves of the searches.
+    auto policy = std::vector<std::pair<SessionPtr, std::future<int>>>{};
+
+    while (true) {
+        // Fill the free slots. Only wait for the new session if there
+        // is nothing to search.
+        while ((int)(searching.size() + policy.size()) < sessions_per_worker_) {
+            auto session = PopSession(searching.empty() && policy.empty());
+            if (!session) {
+                break;
+            }
+            if (session->terminated.load(std::memory_order_relaxed)) {
+                Finish(*session, false);
+                continue;
+            }
+            if (session->policy_only) {
+                policy.emplace_back(session,
+                    network_.GetBestPolicyVertexAsync(session->state, true));
+                continue;
+            }
+            session->search = std::make_unique<Search>(session->state, network_);
+            if (!session->search->BeginAnalysisSteps(session->playouts, session->multi_pv)) {
+                Finish(*session, true);
+                continue;
+            }
+            searching.emplace_back(session);
+        }
+        if (searching.empty() && policy.empty()) {
+            // The input is closed and the queue is empty.
+            break;
+        }
+
+        for (auto &session : searching) {
+            session->search->SubmitAnalysisStep(GetWeight(*session));
+        }
+
+        for (auto &p : policy) {
+            p.first->policy_move = p.second.get();
+            Finish(*p.first, true);
+        }
+        policy.clear();
+
+        next_searching.clear();
+        for (auto &session : searching) {
+            if (session->search->CollectAnalysisStep() &&
+                    !session->terminated.load(std::memory_order_relaxed)) {
+                next_searching.emplace_back(session);
+            } else {
+                Finish(*session, true);
+            }
+        }
+        std::swap(searching, next_searching);
+    }
+}
+
+void AnalysisServer::Finish(Session &session, bool searched) {
+    auto &state = session.state;
+    const int color = state.GetToMove();
+    auto out = std::ostringstream{};
+
+    out << Format("{\"id\":%s,\"turnNumber\":%d,\"terminated\":%s",
+                      Json::Quote(session.id).c_str(),
+                      state.GetMoveNumber(),
+                      session.terminated.load(std::memory_order_relaxed) ? "true" : "false");
+
+    if (searched && session.policy_only) {
+        out << Format(",\"rootInfo\":{\"currentPlayer\":\"%s\"},\"bestMove\":\"%s\"",
+                          color == kBlack ? "B" : "W",
+                          state.VertexToText(session.policy_move).c_str());
+    } else if (searched) {
+        auto result = session.search->EndAnalysisSteps();
+        out << Format(",\"rootInfo\":{\"currentPlayer\":\"%s\",\"visits\":%d,\"winrate\":%.6f,\"scoreLead\":%.6f}",
+                          color == kBlack ? "B" : "W",
+                          result.playouts,
+                          result.root_eval,
+                          result.root_final_score)
+            << Format(",\"bestMove\":\"%s\",\"seconds\":%.3f",
+                          state.VertexToText(result.best_move).c_str(),
+                          result.seconds)
+            << ",\"moveInfos\":" << session.search->GetAnalysisJson(session.max_moves);
+        if (session.ownership) {
+            out << ",\"ownership\":" << session.search->GetOwnershipJson();
+        }
+        session.search.reset();
+    }
+    out << '}';
+
+    WriteLine(out.str());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_.erase(session.id);
+}
+
+void AnalysisServer::WriteError(const std::string &id, const std::string &error) {
+    WriteLine(Format("{\"id\":%s,\"error\":%s}",
+                         Json::Quote(id).c_str(), Json::Quote(error).c_str()));
+}
+
+void AnalysisServer::WriteLine(const std::string &line) {
+    std::lock_guard<std::mutex> lock(out_mutex_);
+    std::cout << line << std::endl;
+}
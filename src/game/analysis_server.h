@@ -0,0 +1,101 @@
+#pragma once
+
+#include "game/game_state.h"
+#include "mcts/search.h"
+#include "neural/network.h"
+#include "utils/json.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Analyze many positions in one process. The requests and the results
+// are JSON lines on stdin and stdout. All sessions share one network.
+// Every worker thread steps its sessions by turns, like the self-play
+// games, so the leaves of all sessions fill the same network batch.
+//
+// One request is
+//     {"id":"a1","moves":[["B","Q16"],["W","D4"]],"komi":7.5,
+//      "boardSize":19,"maxVisits":400,"priority":0}
+// and the optional keys are "initialStones", "maxMoves" and
+// "includeOwnership". The request with "policyOnly":true is answered
+// by the best move of the policy head without the search. It is much
+// cheaper, so one process serves many weak bot games. The request
+// {"id":"t1","action":"terminate","terminateId":"a1"} stops the
+// session early, and it still answers with what it has searched.
+class AnalysisServer {
+public:
+    AnalysisServer();
+
+private:
+    struct Session {
+        std::string id;
+        int priority;
+        int playouts;
+        int max_moves;
+        int multi_pv;
+        bool ownership;
+        bool policy_only;
+
+        // The answer of the policy only session.
+        int policy_move{kNullVertex};
+
+        // The order of arrival. The earlier goes first if the
+        // priorities are equal.
+        std::uint64_t order;
+
+        std::atomic<bool> terminated{false};
+        GameState state;
+        std::unique_ptr<Search> search;
+    };
+    using SessionPtr = std::shared_ptr<Session>;
+
+    // Load the network. Return false if fail.
+    bool Initialize();
+    void Loop();
+    void Worker();
+
+    // Parse one line and queue the session.
+    void Request(const std::string &line);
+    void Terminate(const Json &request, const std::string &id);
+
+    // Build the session from the request. Throw the const char* if
+    // the request is invalid.
+    SessionPtr BuildSession(const Json &request, const std::string &id);
+
+    // Pop the session of the highest priority. Wait for it if the
+    // blocking is set. Return nullptr if there is no session, or if
+    // the input is closed.
+    SessionPtr PopSession(bool blocking);
+
+    // Answer the session and release its tree.
+    void Finish(Session &session, bool searched);
+
+    void WriteError(const std::string &id, const std::string &error);
+    void WriteLine(const std::string &line);
+
+    // The number of leaves of the session in one step.
+    int GetWeight(const Session &session) const;
+
+    static constexpr int kDefaultVisits = 400;
+    static constexpr int kMaxWeight = 8;
+
+    Network network_;
+    int board_size_;
+    int num_workers_;
+    int sessions_per_worker_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<SessionPtr> queue_;
+    std::unordered_map<std::string, SessionPtr> sessions_;
+    std::uint64_t next_order_{0};
+    bool closed_{false};
+
+    std::mutex out_mutex_;
+};
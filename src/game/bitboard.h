@@ -0,0 +1,191 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "game/types.h"
+
+// The set of vertices on the letter box board. One bit is one vertex,
+// so the neighbors of every stone are the shifts by one bit and by one
+// row. The board borders are never in the set, so nothing wraps around
+// the rows. The number of words follows the BOARD_SIZE of building.
+class BitBoard {
+public:
+    static constexpr int kNumWords = (kNumVertices + 63) / 64;
+
+    BitBoard() {
+        Clear();
+    }
+
+    void Clear() {
+        words_.fill(0);
+    }
+
+    void Set(const int vtx) {
+        words_[vtx >> 6] |= std::uint64_t{1} << (vtx & 63);
+    }
+
+    void Reset(const int vtx) {
+        words_[vtx >> 6] &= ~(std::uint64_t{1} << (vtx & 63));
+    }
+
+    bool Test(const int vtx) const {
+        return (words_[vtx >> 6] >> (vtx & 63)) & 1;
+    }
+
+    bool Empty() const {
+        std::uint64_t any = 0;
+        for (int i = 0; i < kNumWords; ++i) {
+            any |= words_[i];
+        }
+        return any == 0;
+    }
+
+    // Return the number of vertices in the set.
+    int Count() const;
+
+    BitBoard &operator|=(const BitBoard &other) {
+        for (int i = 0; i < kNumWords; ++i) {
+            words_[i] |= other.words_[i];
+        }
+        return *this;
+    }
+
+    BitBoard &operator&=(const BitBoard &other) {
+        for (int i = 0; i < kNumWords; ++i) {
+            words_[i] &= other.words_[i];
+        }
+        return *this;
+    }
+
+    friend BitBoard operator|(BitBoard a, const BitBoard &b) {
+        return a |= b;
+    }
+
+    friend BitBoard operator&(BitBoard a, const BitBoard &b) {
+        return a &= b;
+    }
+
+    // Return the vertices in this set but not in the other set.
+    BitBoard AndNot(const BitBoard &other) const {
+        auto out = *this;
+        for (int i = 0; i < kNumWords; ++i) {
+            out.words_[i] &= ~other.words_[i];
+        }
+        return out;
+    }
+
+    bool operator==(const BitBoard &other) const {
+        return words_ == other.words_;
+    }
+
+    bool operator!=(const BitBoard &other) const {
+        return words_ != other.words_;
+    }
+
+    // Add the four neighbors of every vertex. The row is the letter
+    // box size.
+    BitBoard Dilate(const int row) const {
+        auto out = *this;
+        out.OrShiftUp(*this, 1);
+        out.OrShiftDown(*this, 1);
+        out.OrShiftUp(*this, row);
+        out.OrShiftDown(*this, row);
+        return out;
+    }
+
+    // Return the vertices which are next to a vertex in this set. The
+    // set itself is not included.
+    BitBoard Neighbors(const int row) const {
+        auto out = BitBoard{};
+        out.OrShiftUp(*this, 1);
+        out.OrShiftDown(*this, 1);
+        out.OrShiftUp(*this, row);
+        out.OrShiftDown(*this, row);
+        return out;
+    }
+
+    // Grow this set inside the region until it stops growing.
+    BitBoard FloodFill(const BitBoard &region, const int row) const {
+        auto curr = *this & region;
+        while (true) {
+            const auto next = curr.Dilate(row) & region;
+            if (next == curr) {
+                break;
+            }
+            curr = next;
+        }
+        return curr;
+    }
+
+    // Call the function with every vertex in the set, from the lowest
+    // vertex.
+    template<typename F>
+    void ForEach(F func) const {
+        for (int i = 0; i < kNumWords; ++i) {
+            auto v = words_[i];
+            while (v) {
+                func((i << 6) + LowestBit(v));
+                v &= v - 1;
+            }
+        }
+    }
+
+private:
+    static int LowestBit(std::uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(v);
+#else
+        int n = 0;
+        while (!(v & 1)) {
+            v >>= 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    // Or the set shifted to the higher vertices.
+    void OrShiftUp(const BitBoard &src, const int n) {
+        const int word = n >> 6;
+        const int bit = n & 63;
+        for (int i = kNumWords-1; i >= word; --i) {
+            auto v = src.words_[i - word] << bit;
+            if (bit != 0 && i - word - 1 >= 0) {
+                v |= src.words_[i - word - 1] >> (64 - bit);
+            }
+            words_[i] |= v;
+        }
+    }
+
+    // Or the set shifted to the lower vertices.
+    void OrShiftDown(const BitBoard &src, const int n) {
+        const int word = n >> 6;
+        const int bit = n & 63;
+        for (int i = 0; i + word < kNumWords; ++i) {
+            auto v = src.words_[i + word] >> bit;
+            if (bit != 0 && i + word + 1 < kNumWords) {
+                v |= src.words_[i + word + 1] << (64 - bit);
+            }
+            words_[i] |= v;
+        }
+    }
+
+    std::array<std::uint64_t, kNumWords> words_;
+};
+
+inline int BitBoard::Count() const {
+    int cnt = 0;
+    for (int i = 0; i < kNumWords; ++i) {
+#if defined(__GNUC__) || defined(__clang__)
+        cnt += __builtin_popcountll(words_[i]);
+#else
+        auto v = words_[i];
+        v = v - ((v >> 1) & 0x5555555555555555ULL);
+        v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+        v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        cnt += (int)((v * 0x0101010101010101ULL) >> 56);
+#endif
+    }
+    return cnt;
+}
@@ -5,12 +5,14 @@
 
 #include "game/board.h"
 #include "game/symmetry.h"
+#include "utils/cache.h"
 
 void Board::Reset(const int boardsize) {
     SetBoardSize(boardsize);
 
     ResetBoard();
     ResetBasicData();
+    UpdateLegalBits();
 }
 
 void Board::ResetBoard() {
@@ -18,14 +20,19 @@ void Board::ResetBoard() {
     for (int vtx = 0; vtx < kNumVertices; ++vtx) {
         state_[vtx] = kInvalid;
         neighbours_[vtx] = 0;
+        pattern3_[vtx] = 0;
     }
 
     empty_cnt_ = 0;
+    stone_bits_[kBlack].Clear();
+    stone_bits_[kWhite].Clear();
+    board_bits_.Clear();
 
     for (int y = 0; y < boardsize; ++y) {
         for (int x = 0; x < boardsize; ++x) {
             const auto vtx = GetVertex(x, y);
             state_[vtx] = kEmpty;
+            board_bits_.Set(vtx);
             empty_idx_[vtx] = empty_cnt_;
             empty_[empty_cnt_++] = vtx;
 
@@ -46,6 +53,13 @@ void Board::ResetBoard() {
             }
         }
     }
+
+    for (int y = 0; y < boardsize; ++y) {
+        for (int x = 0; x < boardsize; ++x) {
+            const auto vtx = GetVertex(x, y);
+            pattern3_[vtx] = ComputePattern3Hash(vtx);
+        }
+    }
 }
 
 void Board::ResetBasicData() {
@@ -72,6 +86,12 @@ void Board::ResetBasicData() {
 
     hash_ = ComputeHash(GetKoMove());
     ko_hash_ = ComputeKoHash();
+    const auto &symmetry = Symmetry::Get();
+    for (int symm = 0; symm < Symmetry::kNumSymmetris; ++symm) {
+        symm_hash_[symm] = ComputeHashWith(GetKoMove(), [&](const int vertex) {
+                               return symmetry.TransformVertex(board_size_, symm, vertex);
+                           });
+    }
 }
 
 bool Board::IsStar(const int x, const int y) const {
@@ -208,31 +228,6 @@ bool Board::IsLegalMove(const int vtx, const int color) const {
     return IsLegalMove(vtx, color, [](int /* vtx */, int /* color */) { return false; });
 }
 
-bool Board::IsLegalMove(const int vtx, const int color,
-                            std::function<bool(int, int)> AvoidToMove) const {
-    if (vtx == kPass || vtx == kResign) {
-        return true;
-    }
-
-    if (state_[vtx] != kEmpty) {
-        return false;
-    }
-
-    if (AvoidToMove(vtx, color)) {
-        return false;
-    }
-
-    if (IsSuicide(vtx, color)) {
-        return false;
-    }
-
-    if (vtx == ko_move_) {
-        return false;
-    }
-
-    return true;
-}
-
 void Board::SetBoardSize(int boardsize) {
     if (boardsize > kBoardSize) {
         boardsize = kBoardSize;
@@ -262,132 +257,143 @@ void Board::RemoveMarkedStrings(std::vector<int> &marked) {
 
     IncrementPrisoner(kBlack, removed_stones[kBlack]);
     IncrementPrisoner(kWhite, removed_stones[kWhite]);
+    UpdateLegalBits();
 }
 
-int Board::ComputeReachGroup(int start_vertex, int spread_color, std::vector<bool> &buf) const {
-    auto PeekState = [&](int vtx) -> int {
-        return state_[vtx];
-    };
+void Board::UpdateLegalBits() {
+    // The empty point next to another empty point is never the
+    // suicide, so only the closed points need the full check.
+    const auto empty = board_bits_.AndNot(
+                           stone_bits_[kBlack] | stone_bits_[kWhite]);
+    const auto open = empty & empty.Neighbors(letter_box_size_);
 
-    return ComputeReachColor(start_vertex, spread_color, buf, PeekState);
-}
+    legal_bits_[kBlack] = open;
+    legal_bits_[kWhite] = open;
+    closed_bits_ = empty.AndNot(open);
 
-int Board::ComputeReachGroup(int start_vertex, int spread_color,
-                                 std::vector<bool> &buf, std::function<int(int)> Peek) const {
-    if (buf.size() != (size_t)num_vertices_) {
-        buf.resize(num_vertices_);
-    }
-    int reachable = 0;
-    auto open = std::queue<int>();
+    closed_bits_.ForEach([this](const int vtx) {
+        UpdateLegalBit(vtx);
+    });
 
-    buf[start_vertex] = true;
-    open.emplace(start_vertex);
-    ++reachable;
+    if (ko_move_ != kNullVertex) {
+        legal_bits_[kBlack].Reset(ko_move_);
+        legal_bits_[kWhite].Reset(ko_move_);
+    }
+}
 
-    while (!open.empty()) {
-        const auto vertex = open.front();
-        open.pop();
+void Board::UpdateLegalBits(const int vtx, const int color, const int old_ko_move) {
+    legal_bits_[kBlack].Reset(vtx);
+    legal_bits_[kWhite].Reset(vtx);
+    closed_bits_.Reset(vtx);
 
-        for (int k = 0; k < 4; ++k) {
-            const auto neighbor = vertex + directions_[k];
-            const auto peek = Peek(neighbor);
+    // The suicide check of a closed point only asks whether its
+    // neighbor strings have one liberty, and only the strings next
+    // to the move lost a liberty or are merged. The own strings which
+    // had one liberty had no liberty but the move, so only the new
+    // atari changes the other closed points.
+    bool atari = strings_.GetLiberty(strings_.GetParent(vtx)) <= 1;
 
-            if (!buf[neighbor] && peek == spread_color) {
-                ++reachable;
-                buf[neighbor] = true;
-                open.emplace(neighbor);
+    for (int k = 0; k < 4; ++k) {
+        const auto avtx = vtx + directions_[k];
+        const auto state = state_[avtx];
+        if (state == kEmpty) {
+            // The open points are always legal.
+            if (CountPliberties(avtx) == 0) {
+                closed_bits_.Set(avtx);
+                UpdateLegalBit(avtx);
             }
+        } else if (state == !color) {
+            atari |= strings_.GetLiberty(strings_.GetParent(avtx)) <= 1;
+        }
+    }
+
+    if (atari) {
+        closed_bits_.ForEach([this](const int cvtx) {
+            UpdateLegalBit(cvtx);
+        });
+    }
+    if (old_ko_move != kNullVertex) {
+        UpdateLegalBit(old_ko_move);
+    }
+}
+
+void Board::UpdateLegalBit(const int vtx) {
+    for (const auto color : {kBlack, kWhite}) {
+        if (state_[vtx] == kEmpty &&
+                vtx != ko_move_ &&
+                !IsSuicide(vtx, color)) {
+            legal_bits_[color].Set(vtx);
+        } else {
+            legal_bits_[color].Reset(vtx);
         }
     }
-    return reachable;
 }
 
-int Board::ComputeReachColor(int color) const {
-    auto buf = std::vector<bool>(num_vertices_, false);
+int Board::ComputeReachGroup(int start_vertex, int spread_color, std::vector<bool> &buf) const {
     auto PeekState = [&](int vtx) -> int {
         return state_[vtx];
     };
 
-    return ComputeReachColor(color, kEmpty, buf, PeekState);
+    return ComputeReachGroup(start_vertex, spread_color, buf, PeekState);
 }
 
-int Board::ComputeReachColor(int color, int spread_color,
-                                 std::vector<bool> &buf,
-                                 std::function<int(int)> Peek) const {
-    if (buf.size() != (size_t)num_vertices_) {
-        buf.resize(num_vertices_);
-    }
-
-    int reachable = 0;
-    auto open = std::queue<int>();
-    for (int y = 0; y < board_size_; ++y) {
-        for (int x = 0; x < board_size_; ++x) {
-            const auto vertex = GetVertex(x, y);
-            const auto peek = Peek(vertex);
-
-            if (peek == color) {
-                ++reachable;
-                buf[vertex] = true;
-                open.emplace(vertex);
-            } else {
-                buf[vertex] = false;
-            }
-        }
-    }
-    while (!open.empty()) {
-        const auto vertex = open.front();
-        open.pop();
-
-        for (int k = 0; k < 4; ++k) {
-            const auto neighbor = vertex + directions_[k];
-            const auto peek = Peek(neighbor);
-
-            if (!buf[neighbor] && peek == spread_color) {
-                ++reachable;
-                buf[neighbor] = true;
-                open.emplace(neighbor);
-            }
-        }
-    }
-    return reachable;
+int Board::ComputeReachColor(int color) const {
+    return ComputeReachBits(color).Count();
 }
 
+BitBoard Board::ComputeReachBits(int color) const {
+    const auto &stones = stone_bits_[color];
+    const auto empty = board_bits_.AndNot(
+                           stone_bits_[kBlack] | stone_bits_[kWhite]);
+    return stones.FloodFill(stones | empty, letter_box_size_);
+}
 
 std::uint64_t Board::ComputeHash(int komove) const {
-    return ComputeHash(komove, [](const auto vertex) { return vertex; });
+    return ComputeHashWith(komove, [](const int vertex) { return vertex; });
 }
 
 std::uint64_t Board::ComputeSymmetryHash(int komove, int symmetry) const {
-    return ComputeHash(komove, [this, symmetry](const auto vertex) {
-        return Symmetry::Get().TransformVertex(board_size_, symmetry, vertex);
-    });
+    // Only the ko move is different from the incremental hashing.
+    const auto &symm = Symmetry::Get();
+    return symm_hash_[symmetry] ^
+               Zobrist::kKoMove[symm.TransformVertex(board_size_, symmetry, GetKoMove())] ^
+               Zobrist::kKoMove[symm.TransformVertex(board_size_, symmetry, komove)];
 }
 
 std::uint64_t Board::ComputeKoHash() const {
-    return ComputeKoHash([](const auto vertex) { return vertex; });
+    return ComputeKoHashWith([](const int vertex) { return vertex; });
 }
 
 std::uint64_t Board::ComputeKoHash(int symmetry) const {
-    return ComputeKoHash([this, symmetry](const auto vertex) {
-        return Symmetry::Get().TransformVertex(board_size_, symmetry, vertex);
-    });
+    // Remove the keys which are not the stones.
+    const auto &symm = Symmetry::Get();
+    return symm_hash_[symmetry] ^ GetNonStoneHash() ^
+               Zobrist::kKoMove[symm.TransformVertex(board_size_, symmetry, GetKoMove())];
 }
 
-std::uint64_t Board::ComputeHash(int komove, std::function<int(int)> transform) const {
-    auto res = ComputeKoHash(transform);
-
+std::uint64_t Board::GetNonStoneHash() const {
+    auto res = std::uint64_t{0};
     if (to_move_ == kBlack) {
         res ^= Zobrist::kBlackToMove;
     }
     res ^= Zobrist::kPrisoner[kBlack][GetPrisoner(kBlack)];
     res ^= Zobrist::kPrisoner[kWhite][GetPrisoner(kWhite)];
     res ^= Zobrist::KPass[GetPasses()];
+    return res;
+}
+
+template <typename F>
+std::uint64_t Board::ComputeHashWith(int komove, const F &transform) const {
+    auto res = ComputeKoHashWith(transform);
+
+    res ^= GetNonStoneHash();
     res ^= Zobrist::kKoMove[transform(komove)];
 
     return res;
 }
 
-std::uint64_t Board::ComputeKoHash(std::function<int(int)> transform) const {
+template <typename F>
+std::uint64_t Board::ComputeKoHashWith(const F &transform) const {
     auto res = Zobrist::kEmpty;
     for (int v = 0; v < num_vertices_; ++v) {
         if (state_[v] != kInvalid) {
@@ -655,7 +661,8 @@ LadderType Board::HunterSelections(const int prey_color,
 
 LadderType Board::PreyMove(Board* board,
                                const int hunter_vtx, const int prey_color,
-                               const int ladder_vtx, size_t& ladder_nodes, bool fork) const {
+                               const int ladder_vtx, size_t& ladder_nodes, bool fork,
+                               BitBoard &played) const {
 
     if ((++ladder_nodes) >= kMaxLadderNodes) {
         // If hit the limit, assume prey have escaped. 
@@ -673,6 +680,7 @@ LadderType Board::PreyMove(Board* board,
     if (hunter_vtx != kNullVertex) {
         // Hunter play move first.
         ladder_board->PlayMoveAssumeLegal(hunter_vtx, !prey_color);
+        played.Set(hunter_vtx);
     }
     // Search possible move(s) for prey.
     auto selections = std::vector<int>{};
@@ -698,7 +706,7 @@ LadderType Board::PreyMove(Board* board,
         const int vtx = selections[i];
         auto next_res = HunterMove(ladder_board, vtx,
                                    prey_color, ladder_vtx,
-                                   ladder_nodes, next_fork);
+                                   ladder_nodes, next_fork, played);
 
         assert(next_res != LadderType::kGoodForNeither);
 
@@ -716,7 +724,8 @@ LadderType Board::PreyMove(Board* board,
 
 LadderType Board::HunterMove(Board* board,
                                  const int prey_vtx, const int prey_color,
-                                 const int ladder_vtx, size_t& ladder_nodes, bool fork) const {
+                                 const int ladder_vtx, size_t& ladder_nodes, bool fork,
+                                 BitBoard &played) const {
     if ((++ladder_nodes) >= kMaxLadderNodes) {
         // If hit the limit, assume prey have escaped. 
         return LadderType::kGoodForPrey;
@@ -733,6 +742,7 @@ LadderType Board::HunterMove(Board* board,
     if (prey_vtx != kNullVertex) {
         // Prey play move first.
         ladder_board->PlayMoveAssumeLegal(prey_vtx, prey_color);
+        played.Set(prey_vtx);
     }
 
     // Search possible move(s) for hunter.
@@ -759,7 +769,7 @@ LadderType Board::HunterMove(Board* board,
         const int vtx = selections[i];
         auto next_res = PreyMove(ladder_board, vtx, 
                                  prey_color, ladder_vtx, 
-                                 ladder_nodes, next_fork);
+                                 ladder_nodes, next_fork, played);
 
         assert(next_res != LadderType::kGoodForNeither);
 
@@ -775,6 +785,27 @@ LadderType Board::HunterMove(Board* board,
     return best;
 }
 
+namespace {
+
+// The ladder result of one string. It is valid for any position which
+// has the same contents in the region.
+struct LadderCacheEntry {
+    BitBoard region;
+    std::uint64_t region_hash;
+    std::int16_t num_vital_moves;
+    std::array<std::int16_t, 2> vital_moves;
+};
+
+// The ladder cache is shared by all threads.
+constexpr size_t kLadderCacheSize = 64 * 1024;
+
+HashKeyCache<LadderCacheEntry> &GetLadderCache() {
+    static HashKeyCache<LadderCacheEntry> cache(kLadderCacheSize);
+    return cache;
+}
+
+} // namespace
+
 bool Board::IsLadder(const int vtx, std::vector<int> &vital_moves) const {
     if (vtx == kPass) {
         return false;
@@ -787,6 +818,50 @@ bool Board::IsLadder(const int vtx, std::vector<int> &vital_moves) const {
 
     vital_moves.clear();
 
+    if (GetLiberties(vtx) >= 3) {
+        // It is not a ladder. Skip the cache, it is cheap.
+        return false;
+    }
+
+    // The key is the prey string. The entry is checked with the
+    // hash of its region, so the same ladder is found in the other
+    // positions which differ far from it.
+    auto key = std::uint64_t{0x9e3779b97f4a7c15ULL} * board_size_;
+    auto next = vtx;
+    do {
+        key ^= Zobrist::kState[prey_color][next];
+        next = strings_.GetNext(next);
+    } while (next != vtx);
+
+    auto &cache = GetLadderCache();
+    auto entry = LadderCacheEntry{};
+    if (cache.Lookup(key, entry) &&
+            ComputeRegionHash(entry.region) == entry.region_hash) {
+        for (int i = 0; i < entry.num_vital_moves; ++i) {
+            vital_moves.emplace_back(entry.vital_moves[i]);
+        }
+        return !vital_moves.empty();
+    }
+
+    auto played = BitBoard{};
+    ReadLadder(vtx, vital_moves, played);
+
+    assert(vital_moves.size() <= 2);
+    entry.region = ComputeLadderRegion(vtx, played);
+    entry.region_hash = ComputeRegionHash(entry.region);
+    entry.num_vital_moves = vital_moves.size();
+    for (int i = 0; i < entry.num_vital_moves; ++i) {
+        entry.vital_moves[i] = vital_moves[i];
+    }
+    cache.Insert(key, entry);
+
+    return !vital_moves.empty();
+}
+
+void Board::ReadLadder(const int vtx, std::vector<int> &vital_moves,
+                           BitBoard &played) const {
+    const int prey_color = GetState(vtx);
+
     auto buf = std::vector<int>{};
     const int libs = FindStringLiberties(vtx, buf);
     const int ladder_vtx = vtx;
@@ -797,7 +872,7 @@ bool Board::IsLadder(const int vtx, std::vector<int> &vital_moves) const {
         auto ladder_board = new Board(*this);
         res = PreyMove(ladder_board,
                        kNullVertex, prey_color,
-                       ladder_vtx, searched_nodes, false);
+                       ladder_vtx, searched_nodes, false, played);
 
         if (res == LadderType::kGoodForHunter) {
             vital_moves.emplace_back(buf[0]);
@@ -811,7 +886,7 @@ bool Board::IsLadder(const int vtx, std::vector<int> &vital_moves) const {
                 // force the hunter do atari move first
                 res = PreyMove(ladder_board,
                                  vvtx, prey_color,
-                                 ladder_vtx, searched_nodes, false);
+                                 ladder_vtx, searched_nodes, false, played);
                 if (res == LadderType::kGoodForHunter) {
                     vital_moves.emplace_back(vvtx);
                 }
@@ -823,7 +898,40 @@ bool Board::IsLadder(const int vtx, std::vector<int> &vital_moves) const {
     }
 
     assert(res != LadderType::kGoodForNeither);
-    return !vital_moves.empty();
+#ifdef NDEBUG
+    (void) res;
+#endif
+}
+
+BitBoard Board::ComputeLadderRegion(const int vtx, const BitBoard &played) const {
+    const int row = letter_box_size_;
+    auto region = played;
+
+    auto next = vtx;
+    do {
+        region.Set(next);
+        next = strings_.GetNext(next);
+    } while (next != vtx);
+
+    // The moves only read their neighbors and the strings next to
+    // them, so take two steps around and then the whole strings
+    // with their liberties.
+    region = region.Dilate(row).Dilate(row) & board_bits_;
+    for (int c = kBlack; c <= kWhite; ++c) {
+        region |= (region & stone_bits_[c]).FloodFill(stone_bits_[c], row);
+    }
+    return region.Dilate(row) & board_bits_;
+}
+
+std::uint64_t Board::ComputeRegionHash(const BitBoard &region) const {
+    auto res = std::uint64_t{0};
+    region.ForEach([&](int v) {
+        res ^= Zobrist::kState[state_[v]][v];
+    });
+    if (ko_move_ != kNullVertex && region.Test(ko_move_)) {
+        res ^= Zobrist::kKoMove[ko_move_];
+    }
+    return res;
 }
 
 bool Board::IsSelfAtariMove(const int vtx, const int color) const {
@@ -1284,6 +1392,8 @@ void Board::AddStone(const int vtx, const int color) {
 
     // Set board content.
     state_[vtx] = static_cast<VertexType>(color);
+    stone_bits_[color].Set(vtx);
+    UpdatePattern3(vtx, color);
 
     // Update zobrist key.
     UpdateZobrist(vtx, color, kEmpty);
@@ -1317,6 +1427,8 @@ void Board::RemoveStone(const int vtx, const int color) {
 
     // Set board content.
     state_[vtx] = kEmpty;
+    stone_bits_[color].Reset(vtx);
+    UpdatePattern3(vtx, kEmpty);
 
     // Update zobrist key.
     UpdateZobrist(vtx, kEmpty, color);
@@ -1485,6 +1597,7 @@ void Board::PlayMoveAssumeLegal(const int vtx, const int color) {
 
     SetToMove(color);
     const int old_ko_move = ko_move_;
+    const int old_empty_cnt = empty_cnt_;
 
     if (vtx == kPass) {
         IncrementPasses();
@@ -1502,6 +1615,17 @@ void Board::PlayMoveAssumeLegal(const int vtx, const int color) {
     last_move_2_ = last_move_;
     last_move_ = vtx;
 
+    if (vtx == kPass) {
+        if (old_ko_move != kNullVertex) {
+            UpdateLegalBit(old_ko_move);
+        }
+    } else if (empty_cnt_ == old_empty_cnt - 1) {
+        UpdateLegalBits(vtx, color, old_ko_move);
+    } else {
+        // Some stones are captured.
+        UpdateLegalBits();
+    }
+
     ExchangeToMove();
 }
 
@@ -1548,28 +1672,24 @@ void Board::ComputeReachArea(std::vector<int> &result) const {
     if (result.size() != (size_t) num_intersections_) {
         result.resize(num_intersections_);
     }
-    auto black = std::vector<bool>(num_intersections_, false);
-    auto white = std::vector<bool>(num_intersections_, false);
-
-    auto PeekState = [&](int vtx) -> int {
-        return state_[vtx];
-    };
 
     // Compute black area.
-    ComputeReachColor(kBlack, kEmpty, black, PeekState);
+    const auto black = ComputeReachBits(kBlack);
 
     // Compute white area.
-    ComputeReachColor(kWhite, kEmpty, white, PeekState);
+    const auto white = ComputeReachBits(kWhite);
 
     for (int y = 0; y < board_size_; ++y) {
         for (int x = 0; x < board_size_; ++x) {
             const auto idx = GetIndex(x, y);
             const auto vtx = GetVertex(x, y);
+            const bool is_black = black.Test(vtx);
+            const bool is_white = white.Test(vtx);
 
-            if (black[vtx] && !white[vtx]) {
+            if (is_black && !is_white) {
                 // The point is black.
                 result[idx] = kBlack;  
-            } else if (white[vtx] && !black[vtx]) {
+            } else if (is_white && !is_black) {
                 // The white is white.
                 result[idx] = kWhite;
             } else {
@@ -1583,18 +1703,11 @@ void Board::ComputeReachArea(std::vector<int> &result) const {
 void Board::ComputeScoreArea(std::vector<int> &result) const {
 
     ComputeReachArea(result);
-    auto pass_alive = std::vector<bool>(num_intersections_);
 
     for (int c = 0; c < 2; ++c) {
-
-        std::fill(std::begin(pass_alive), std::end(pass_alive), false);
-        ComputePassAliveArea(pass_alive, c, true, true);
-
-        for (int i = 0; i < num_intersections_; ++i) {
-            if (pass_alive[i]) {
-                result[i] = c;
-            }
-        }
+        GetPassAliveBits(c).ForEach([&](int vtx) {
+            result[GetIndex(GetX(vtx), GetY(vtx))] = c;
+        });
     }
 }
 
@@ -1693,13 +1806,70 @@ void Board::ComputeSafeArea(std::vector<bool> &result, bool mark_seki) const {
 
     std::fill(std::begin(result), std::end(result), false);
 
-    ComputePassAliveArea(result, kBlack, true, true);
-    ComputePassAliveArea(result, kWhite, true, true);
+    const auto safe_bits = GetPassAliveBits(kBlack) | GetPassAliveBits(kWhite);
+    safe_bits.ForEach([&](int vtx) {
+        result[GetIndex(GetX(vtx), GetY(vtx))] = true;
+    });
     if (mark_seki) {
         ComputeSekiPoints(result);
     }
 }
 
+namespace {
+
+struct PassAliveCacheEntry {
+    BitBoard area;
+};
+
+// The pass-alive cache is shared by all threads.
+constexpr size_t kPassAliveCacheSize = 64 * 1024;
+
+HashKeyCache<PassAliveCacheEntry> &GetPassAliveCache() {
+    static HashKeyCache<PassAliveCacheEntry> cache(kPassAliveCacheSize);
+    return cache;
+}
+
+} // namespace
+
+BitBoard Board::GetPassAliveBits(const int color) const {
+    // The ko hash only depends on the stones. The area does not
+    // depend on the others.
+    const auto key = ko_hash_ ^
+                         (std::uint64_t{0x9e3779b97f4a7c15ULL} * (2 * board_size_ + color + 1));
+
+    auto &cache = GetPassAliveCache();
+    auto entry = PassAliveCacheEntry{};
+    const bool hit = cache.Lookup(key, entry);
+
+#ifdef NDEBUG
+    if (hit) {
+        return entry.area;
+    }
+#endif
+
+    auto area = std::vector<bool>(num_intersections_, false);
+    ComputePassAliveArea(area, color, true, true);
+
+    auto bits = BitBoard{};
+    for (int y = 0; y < board_size_; ++y) {
+        for (int x = 0; x < board_size_; ++x) {
+            if (area[GetIndex(x, y)]) {
+                bits.Set(GetVertex(x, y));
+            }
+        }
+    }
+
+    // The debug build always computes it again and checks the
+    // cached result.
+    assert(!hit || bits == entry.area);
+
+    if (!hit) {
+        entry.area = bits;
+        cache.Insert(key, entry);
+    }
+    return bits;
+}
+
 void Board::ComputePassAliveArea(std::vector<bool> &result,
                                      const int color,
                                      bool mark_vitals,
@@ -2095,41 +2265,46 @@ std::vector<int> Board::ClassifyGroups(const int target,
     std::fill(std::begin(regions_next), std::end(regions_next), kNullVertex);
 
     // All invalid strings (groups) 's index is 0.
+    auto targets = BitBoard{};
     for (int y = 0; y < board_size_; ++y) {
         for (int x = 0; x < board_size_; ++x) {
             const auto vtx = GetVertex(x, y);
             regions_index[vtx] = 0;
             regions_next[vtx] = vtx;
+            if (features[vtx] == target) {
+                targets.Set(vtx);
+            }
         }
     }
 
     auto head_list = std::vector<int>{}; // all string heads vertex postion
-    auto marked = std::vector<bool>(num_vertices_, false); // true if the vertex is usesd.
     auto groups_index = 1; // valid index is from 1.
 
     for (int y = 0; y < board_size_; ++y) {
         for (int x = 0; x < board_size_; ++x) {
             const auto vtx = GetVertex(x, y);
 
-            if (!marked[vtx] && features[vtx] == target) {
-                auto buf = std::vector<bool>(num_vertices_, false);
+            if (targets.Test(vtx)) {
+                auto seed = BitBoard{};
+                seed.Set(vtx);
 
                 // Gather all vertices which connect with head vertex.
-                ComputeReachGroup(vtx, target, buf, [&](int v){ return features[v]; });
+                const auto group = seed.FloodFill(targets, letter_box_size_);
+                targets = targets.AndNot(group);
 
-                auto vertices = GatherVertices(buf);
+                auto first_vertex = kNullVertex;
                 auto next_vertex = kNullVertex;
 
                 // Link this string.
-                for (const auto v : vertices) {
+                group.ForEach([&](int v) {
                     regions_next[v] = next_vertex;
                     regions_index[v] = groups_index;
-                    marked[v] = true;
                     next_vertex = v;
-                }
-                if (!vertices.empty()) {
-                    regions_next[vertices[0]] = next_vertex;
-                }
+                    if (first_vertex == kNullVertex) {
+                        first_vertex = v;
+                    }
+                });
+                regions_next[first_vertex] = next_vertex;
 
                 // Gather this string head.
                 groups_index += 1;
@@ -2140,21 +2315,10 @@ std::vector<int> Board::ClassifyGroups(const int target,
     return head_list;
 }
 
-std::vector<int> Board::GatherVertices(std::vector<bool> &buf) const {
-    auto result = std::vector<int>{};
-
-    for (auto vtx = size_t{0}; vtx < buf.size(); ++vtx) {
-        if (buf[vtx]) {
-            result.emplace_back(vtx);
-        }
-    }
-
-    return result;
-}
-
 void Board::GenerateCandidateMoves(std::vector<int> &moves_set, int color) const {
     moves_set.clear();
-    auto buf = std::vector<int>{};
+    thread_local auto buf = std::vector<int>{};
+    buf.clear();
 
     for (const auto vtx : {last_move_, last_move_2_}) {
         if (vtx != kPass && vtx != kNullVertex) {
@@ -2185,7 +2349,7 @@ void Board::GenerateCandidateMoves(std::vector<int> &moves_set, int color) const
                   std::end(buf));
 
     for (const auto vtx : buf) {
-        if (IsLegalMove(vtx, color) &&
+        if (legal_bits_[color].Test(vtx) &&
                 !(IsSimpleEye(vtx, color) &&
                      !IsCaptureMove(vtx, color)&&
                      !IsEscapeMove(vtx, color))) {
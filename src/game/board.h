@@ -6,11 +6,14 @@
 #include <cassert>
 #include <functional>
 #include <algorithm>
+#include <queue>
 
 #include "game/types.h"
 #include "game/strings.h"
 #include "game/types.h"
+#include "game/bitboard.h"
 #include "game/zobrist.h"
+#include "game/symmetry.h"
 
 class Board {
 public:
@@ -95,8 +98,17 @@ public:
 
     // Reture true if the move is legal.
     bool IsLegalMove(const int vertex, const int color) const;
+
+    // Return the empty points where the color can play, without the
+    // pass. It is updated after every move, so the move generation
+    // only visits the set bits.
+    const BitBoard &GetLegalBits(const int color) const;
+
+    // The AvoidToMove(vertex, color) returns true if the move is
+    // forbidden. It is a template, so the call is inlined.
+    template <typename F>
     bool IsLegalMove(const int vertex, const int color,
-                         std::function<bool(int, int)> AvoidToMove) const;
+                         const F &AvoidToMove) const;
 
     // Return true if the move is self-atari. Notice that
     // it is not full implement. We do not consider the 
@@ -136,17 +148,32 @@ public:
     // Get the current board states and informations, for GTP showboard.
     std::string GetBoardString(const int last_move, bool y_invert) const;
 
-    // Compute the symmetry Zobrist hashing.
+    // Compute the symmetry Zobrist hashing. It is derived from the
+    // incremental symmetry hashing in O(1).
     std::uint64_t ComputeSymmetryHash(int komove, int symmetry) const;
 
-    // Compute the symmetry Zobrist ko hashing.
+    // Compute the symmetry Zobrist ko hashing. It is derived from the
+    // incremental symmetry hashing in O(1).
     std::uint64_t ComputeKoHash(int symmetry) const;
 
+    // Get the symmetry Zobrist hashing. It is same as
+    // ComputeSymmetryHash() with current ko move, but it is
+    // updated incrementally.
+    std::uint64_t GetSymmetryHash(int symmetry) const;
+
+    // Get the minimal symmetry Zobrist hashing and its symmetry.
+    std::uint64_t GetCanonicalHash(int &symmetry) const;
+
+    // Get the mask of the symmetries which keep the position
+    // unchanged. The bit i is the symmetry i.
+    int GetSymmetryMask() const;
+
     std::uint64_t GetMoveHash(const int vtx, const int color) const;
 
+    template <typename F>
     int ComputeReachGroup(int start_vertex, int spread_color,
                               std::vector<bool> &buf,
-                              std::function<int(int)> Peek) const;
+                              const F &Peek) const;
     int ComputeReachGroup(int start_vertex, int spread_color, std::vector<bool> &buf) const;
 
 
@@ -183,7 +210,14 @@ public:
 
     // For patterns...
     static void InitPattern3();
+
+    // The 3x3 pattern hash is kept up to date by AddStone and
+    // RemoveStone, so it is only one load.
     std::uint16_t GetPattern3Hash(const int vtx) const;
+
+    // The 3x3 pattern hash with the atari bits of the four adjacent
+    // strings above the 16 bits.
+    std::uint32_t GetPattern3AtariHash(const int vtx) const;
     std::uint16_t GetSymmetryPattern3Hash(const int vtx,
                                               const int color,
                                               const int symmetry) const;
@@ -214,13 +248,26 @@ private:
     // Compute the Zobrist hashing.
     std::uint64_t ComputeHash(int komove = kNullVertex) const;
 
+    // Compute the 3x3 pattern hash from the neighbors.
+    std::uint16_t ComputePattern3Hash(const int vtx) const;
+
+    // Set the color of the vertex in the pattern hashes of its eight
+    // neighbors.
+    void UpdatePattern3(const int vtx, const int color);
+
     // Compute the Zobrist ko hashing.
     std::uint64_t ComputeKoHash() const;
 
     int ComputeReachColor(int color) const;
+
+    // Return the stones of the color and the empty points they can
+    // reach.
+    BitBoard ComputeReachBits(int color) const;
+
+    template <typename F>
     int ComputeReachColor(int color, int spread_color,
                           std::vector<bool> &buf,
-                          std::function<int(int)> Peek) const;
+                          const F &Peek) const;
 
     // The movement directions eight way.
     std::array<int, 8> directions_;
@@ -231,6 +278,9 @@ private:
     // The counts of neighboring stones.
     std::array<std::uint16_t, kNumVertices> neighbours_;
 
+    // The 3x3 pattern hashes of the intersections.
+    std::array<std::uint16_t, kNumVertices> pattern3_;
+
     // The empty intersections.
     std::array<std::uint16_t, kNumVertices> empty_;
 
@@ -240,6 +290,19 @@ private:
     // The board strings.
     Strings strings_;
 
+    // The stones per color as the bit sets.
+    std::array<BitBoard, 2> stone_bits_;
+
+    // All intersections on the board as the bit set.
+    BitBoard board_bits_;
+
+    // The legal moves per color as the bit sets.
+    std::array<BitBoard, 2> legal_bits_;
+
+    // The empty points without empty neighbor. Only they may be the
+    // suicide moves.
+    BitBoard closed_bits_;
+
     // The Prisoners per color
     std::array<int, 2> prisoners_;
 
@@ -249,6 +312,9 @@ private:
     // The Zobrist ko hash of board position.
     std::uint64_t ko_hash_;
 
+    // The Zobrist hashes of all symmetry board positions.
+    std::array<std::uint64_t, Symmetry::kNumSymmetris> symm_hash_;
+
     // The board size.
     int board_size_;
 
@@ -320,21 +386,43 @@ private:
     LadderType HunterSelections(const int prey_color,
                                 const int ladder_vtx, std::vector<int>& selections) const;
 
-    // Prey do move to try to escape from hunter.
+    // Prey do move to try to escape from hunter. The played moves
+    // are marked in the played set.
     LadderType PreyMove(Board* board,
                         const int hunter_vtx, const int prey_color,
-                        const int ladder_vtx, size_t& ladder_nodes, bool fork) const;
+                        const int ladder_vtx, size_t& ladder_nodes, bool fork,
+                        BitBoard &played) const;
 
     // Hunter do move to try to capture the prey.
     LadderType HunterMove(Board* board,
                           const int prey_vtx, const int prey_color,
-                          const int ladder_vtx, size_t& ladder_nodes, bool fork) const;
+                          const int ladder_vtx, size_t& ladder_nodes, bool fork,
+                          BitBoard &played) const;
+
+    // Read the ladder without the cache.
+    void ReadLadder(const int vtx, std::vector<int> &vital_moves,
+                        BitBoard &played) const;
+
+    // Return the region which the ladder reading may depend on, the
+    // prey string and the played moves with their nearby strings
+    // and liberties.
+    BitBoard ComputeLadderRegion(const int vtx, const BitBoard &played) const;
 
-    // The Generally function compute the Zobrist hashing.
-    std::uint64_t ComputeHash(int komove, std::function<int(int)> transform) const;
+    // Compute the Zobrist hashing of the points in the region.
+    std::uint64_t ComputeRegionHash(const BitBoard &region) const;
+
+    // The Generally function compute the Zobrist hashing. The
+    // transform maps the vertex to the hashed vertex.
+    template <typename F>
+    std::uint64_t ComputeHashWith(int komove, const F &transform) const;
 
     // The Generally function compute the Zobrist ko hashing.
-    std::uint64_t ComputeKoHash(std::function<int(int)> transform) const;
+    template <typename F>
+    std::uint64_t ComputeKoHashWith(const F &transform) const;
+
+    // The hash of the side to move, the prisoners and the passes. They
+    // are same in all symmetries.
+    std::uint64_t GetNonStoneHash() const;
 
     // About to display the board information.
     bool IsStar(const int x, const int y) const;
@@ -364,12 +452,27 @@ private:
     // Update the board after doing a legal move.
     int UpdateBoard(const int vtx, const int color);
 
+    // Recompute all legal moves after the stones or the ko move
+    // changed.
+    void UpdateLegalBits();
+
+    // Update the legal moves after the move at the vertex which
+    // captured nothing. Only the neighbors and the old ko move may
+    // change, unless the move makes an atari, then all closed points
+    // are checked.
+    void UpdateLegalBits(const int vtx, const int color, const int old_ko_move);
+    void UpdateLegalBit(const int vtx);
+
     void SetPasses(int val);
     void IncrementPasses();
 
     // Update Zobrist key for board position.
     void UpdateZobrist(const int vtx, const int new_color, const int old_color);
 
+    // Update the Zobrist keys of all symmetries with the symmetry
+    // invariant key.
+    void UpdateZobristAll(const std::uint64_t key);
+
     // Update Zobrist key for prisoner.
     void UpdateZobristPrisoner(const int color, const int new_pris,
                                const int old_pris);
@@ -391,6 +494,12 @@ private:
                                   bool mark_vitals,
                                   bool mark_pass_dead) const;
 
+    // Same as ComputePassAliveArea() with marking the vitals and the
+    // pass-dead regions. The results are cached by the stones of
+    // position, so the encoder, the search and the scoring of the
+    // same position compute it only once.
+    BitBoard GetPassAliveBits(const int color) const;
+
     // Compute black area and white area.
     void ComputeReachArea(std::vector<int> &result) const;
 
@@ -411,9 +520,6 @@ private:
                                std::vector<int> &features,
                                const std::vector<int> &regions_next) const;
 
-    // Gather the vertex if it is true on the buffer.
-    std::vector<int> GatherVertices(std::vector<bool> &buf) const;
-
     // The 'target' is the string type. We will split all strings (groups) then
     // store the string (group) index in the 'regions_index' and store next
     // vertex postion in the 'regions_next'. Becare that the string (group) index
@@ -460,19 +566,34 @@ inline void Board::UpdateZobrist(const int vtx,
     hash_ ^= Zobrist::kState[new_color][vtx];
     ko_hash_ ^= Zobrist::kState[old_color][vtx];
     ko_hash_ ^= Zobrist::kState[new_color][vtx];
+
+    const auto &symmetry = Symmetry::Get();
+    const auto &key_old = Zobrist::kState[old_color];
+    const auto &key_new = Zobrist::kState[new_color];
+    for (int symm = 0; symm < Symmetry::kNumSymmetris; ++symm) {
+        const auto symm_vtx = symmetry.TransformVertex(board_size_, symm, vtx);
+        symm_hash_[symm] ^= key_old[symm_vtx] ^ key_new[symm_vtx];
+    }
+}
+
+inline void Board::UpdateZobristAll(const std::uint64_t key) {
+    hash_ ^= key;
+    for (auto &h : symm_hash_) {
+        h ^= key;
+    }
 }
 
 inline void Board::UpdateZobristPrisoner(const int color,
                                              const int new_pris,
                                              const int old_pris) {
-    hash_ ^= Zobrist::kPrisoner[color][old_pris];
-    hash_ ^= Zobrist::kPrisoner[color][new_pris];
+    UpdateZobristAll(Zobrist::kPrisoner[color][old_pris] ^
+                         Zobrist::kPrisoner[color][new_pris]);
 }
 
 inline void Board::UpdateZobristToMove(const int new_color,
                                            const int old_color) {
     if (old_color != new_color) {
-        hash_ ^= Zobrist::kBlackToMove;
+        UpdateZobristAll(Zobrist::kBlackToMove);
     }
 }
 
@@ -480,12 +601,41 @@ inline void Board::UpdateZobristKo(const int new_komove,
                                        const int old_komove) {
     hash_ ^= Zobrist::kKoMove[old_komove];
     hash_ ^= Zobrist::kKoMove[new_komove];
+
+    const auto &symmetry = Symmetry::Get();
+    for (int symm = 0; symm < Symmetry::kNumSymmetris; ++symm) {
+        symm_hash_[symm] ^= Zobrist::kKoMove[symmetry.TransformVertex(board_size_, symm, old_komove)];
+        symm_hash_[symm] ^= Zobrist::kKoMove[symmetry.TransformVertex(board_size_, symm, new_komove)];
+    }
 }
 
 inline void Board::UpdateZobristPass(const int new_pass,
                                          const int old_pass) {
-    hash_ ^= Zobrist::KPass[old_pass];
-    hash_ ^= Zobrist::KPass[new_pass];
+    UpdateZobristAll(Zobrist::KPass[old_pass] ^ Zobrist::KPass[new_pass]);
+}
+
+inline std::uint64_t Board::GetSymmetryHash(int symmetry) const {
+    return symm_hash_[symmetry];
+}
+
+inline std::uint64_t Board::GetCanonicalHash(int &symmetry) const {
+    symmetry = Symmetry::kIdentitySymmetry;
+    for (int symm = 1; symm < Symmetry::kNumSymmetris; ++symm) {
+        if (symm_hash_[symm] < symm_hash_[symmetry]) {
+            symmetry = symm;
+        }
+    }
+    return symm_hash_[symmetry];
+}
+
+inline int Board::GetSymmetryMask() const {
+    int mask = 0;
+    for (int symm = 0; symm < Symmetry::kNumSymmetris; ++symm) {
+        if (symm_hash_[symm] == symm_hash_[Symmetry::kIdentitySymmetry]) {
+            mask |= 1 << symm;
+        }
+    }
+    return mask;
 }
 
 inline int Board::GetPrisoner(const int color) const {
@@ -520,6 +670,10 @@ inline int Board::GetKoMove() const {
     return ko_move_;
 }
 
+inline const BitBoard &Board::GetLegalBits(const int color) const {
+    return legal_bits_[color];
+}
+
 inline int Board::GetPasses() const {
     return passes_;
 }
@@ -563,3 +717,90 @@ inline int Board::GetEmptyCount() const {
 inline int Board::GetEmpty(const int idx) const {
     return empty_[idx];
 }
+
+template <typename F>
+inline bool Board::IsLegalMove(const int vtx, const int color,
+                                   const F &AvoidToMove) const {
+    if (vtx == kPass || vtx == kResign) {
+        return true;
+    }
+
+    if (!legal_bits_[color].Test(vtx)) {
+        return false;
+    }
+
+    return !AvoidToMove(vtx, color);
+}
+
+template <typename F>
+int Board::ComputeReachGroup(int start_vertex, int spread_color,
+                                 std::vector<bool> &buf, const F &Peek) const {
+    if (buf.size() != (size_t)num_vertices_) {
+        buf.resize(num_vertices_);
+    }
+    int reachable = 0;
+    auto open = std::queue<int>();
+
+    buf[start_vertex] = true;
+    open.emplace(start_vertex);
+    ++reachable;
+
+    while (!open.empty()) {
+        const auto vertex = open.front();
+        open.pop();
+
+        for (int k = 0; k < 4; ++k) {
+            const auto neighbor = vertex + directions_[k];
+            const auto peek = Peek(neighbor);
+
+            if (!buf[neighbor] && peek == spread_color) {
+                ++reachable;
+                buf[neighbor] = true;
+                open.emplace(neighbor);
+            }
+        }
+    }
+    return reachable;
+}
+
+template <typename F>
+int Board::ComputeReachColor(int color, int spread_color,
+                                 std::vector<bool> &buf,
+                                 const F &Peek) const {
+    if (buf.size() != (size_t)num_vertices_) {
+        buf.resize(num_vertices_);
+    }
+
+    int reachable = 0;
+    auto open = std::queue<int>();
+    for (int y = 0; y < board_size_; ++y) {
+        for (int x = 0; x < board_size_; ++x) {
+            const auto vertex = GetVertex(x, y);
+            const auto peek = Peek(vertex);
+
+            if (peek == color) {
+                ++reachable;
+                buf[vertex] = true;
+                open.emplace(vertex);
+            } else {
+                buf[vertex] = false;
+            }
+        }
+    }
+    while (!open.empty()) {
+        const auto vertex = open.front();
+        open.pop();
+
+        for (int k = 0; k < 4; ++k) {
+            const auto neighbor = vertex + directions_[k];
+            const auto peek = Peek(neighbor);
+
+            if (!buf[neighbor] && peek == spread_color) {
+                ++reachable;
+                buf[neighbor] = true;
+                open.emplace(neighbor);
+            }
+        }
+    }
+    return reachable;
+}
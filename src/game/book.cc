@@ -2,6 +2,11 @@
 #include <sstream>
 #include <utility>
 #include <algorithm>
+#include <cmath>
+#include <thread>
+#include <deque>
+#include <map>
+#include <unordered_set>
 
 #include "utils/log.h"
 #include "utils/random.h"
@@ -11,6 +16,10 @@
 #include "game/book.h"
 #include "game/symmetry.h"
 #include "game/iterator.h"
+#include "config.h"
+
+constexpr char Book::kMagic[8];
+constexpr char Book::kMagicV1[8];
 
 Book &Book::Get() {
     static Book book;
@@ -18,18 +27,98 @@ Book &Book::Get() {
 }
 
 void Book::GenerateBook(std::string sgf_name, std::string filename) const {
+    const int threads = GetOption<int>("threads") > 0 ?
+                            GetOption<int>("threads") : std::thread::hardware_concurrency();
+    const int num_workers = std::max(threads, 1);
+
+    // Every worker fills its own book data, so they never wait for
+    // each other. The games are streamed from the file by chunks.
+    auto workers_data = std::vector<BookData>(num_workers);
+    auto chunk = std::vector<std::string>{};
+    int games = 0;
 
-    auto sgfs = SgfParser::Get().ChopAll(sgf_name);
-    std::unordered_map<std::uint64_t, VertexFrequencyList> book_data;
+    const auto ProcessChunk = [&]() {
+        auto workers = std::vector<std::thread>{};
+        for (int t = 0; t < num_workers; ++t) {
+            workers.emplace_back([&, t]() {
+                for (size_t i = t; i < chunk.size(); i += num_workers) {
+                    BookDataProcess(chunk[i], workers_data[t]);
+                }
+            });
+        }
+        for (auto &w : workers) {
+            w.join();
+        }
+        games += chunk.size();
+        chunk.clear();
+        LOGGING << Format("parsed %d games\n", games);
+    };
+
+    SgfParser::Get().ChopFile(sgf_name, 0,
+        [&](std::string &sgf_string, size_t) {
+            chunk.emplace_back(std::move(sgf_string));
+            if ((int)chunk.size() >= kChunkGames) {
+                ProcessChunk();
+            }
+            return true;
+        });
+    if (!chunk.empty()) {
+        ProcessChunk();
+    }
 
-    int games = 0;
-    for (const auto &sgf: sgfs) {
-        BookDataProcess(sgf, book_data);
-        if (++games % 1000 == 0) {
-            LOGGING << Format("parsed %d games\n", games);
+    // Merge the data of all workers into the first one.
+    auto &book_data = workers_data[0];
+    for (int t = 1; t < num_workers; ++t) {
+        for (const auto &it: workers_data[t]) {
+            auto &vfreq_list = book_data[it.first];
+            for (const auto &vfreq: it.second) {
+                auto vfreq_it = std::find_if(std::begin(vfreq_list), std::end(vfreq_list),
+                                                 [&vfreq](auto &element) { return element.first == vfreq.first; });
+                if (vfreq_it == std::end(vfreq_list)) {
+                    vfreq_list.emplace_back(vfreq);
+                } else {
+                    vfreq_it->second += vfreq.second;
+                }
+            }
         }
+        BookData{}.swap(workers_data[t]);
+    }
+
+    const auto ext = std::string{".bin"};
+    if (filename.size() >= ext.size() &&
+            filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0) {
+        WriteBinaryBook(book_data, filename);
+    } else {
+        WriteTextBook(book_data, filename);
     }
+}
 
+Book::VertexProbabilityList Book::ToProbabilityList(const VertexFrequencyList &vfreq_list) const {
+    VertexProbabilityList vprob_list;
+    VertexFrequencyList filtered_vfreq_list;
+
+    int acc = 0;
+    for (const auto &vfreq: vfreq_list) {
+        if (vfreq.second > kFilterThreshold) {
+            filtered_vfreq_list.emplace_back(vfreq);
+            acc += vfreq.second;
+        }
+    }
+
+    // The most frequent move first, so that the order does not
+    // depend on the workers.
+    std::sort(std::begin(filtered_vfreq_list), std::end(filtered_vfreq_list),
+                  [](const auto &a, const auto &b) {
+                      return a.second != b.second ? a.second > b.second : a.first < b.first;
+                  });
+
+    for (const auto &vfreq: filtered_vfreq_list) {
+        vprob_list.emplace_back(vfreq.first, (float)vfreq.second / acc);
+    }
+    return vprob_list;
+}
+
+void Book::WriteTextBook(const BookData &book_data, std::string filename) const {
     auto file = std::ofstream{};
 
     file.open(filename, std::ios_base::app);
@@ -41,39 +130,167 @@ void Book::GenerateBook(std::string sgf_name, std::string filename) const {
     int idx = 0;
 
     for (const auto &it: book_data) {
-        VertexProbabilityList filtered_vprob_list;
-        VertexFrequencyList filtered_vfreq_list;
+        const auto vprob_list = ToProbabilityList(it.second);
 
-        int acc = 0;
-        auto &vfreq_list = it.second;
-
-        for (const auto &vfreq: vfreq_list) {
-            if (vfreq.second > kFilterThreshold) {
-                filtered_vfreq_list.emplace_back(vfreq);
-                acc += vfreq.second;
-            }
-        }
-
-        if (acc != 0) {
+        if (!vprob_list.empty()) {
             if (idx++ != 0) {
                 file << '\n';
             }
             file << it.first << ' ';
 
-            for (const auto &vfreq: filtered_vfreq_list) {
-                int vertex = vfreq.first;
-                float prob = (float)vfreq.second / acc;
-                file << vertex << ' ' << prob << ' ';
+            for (const auto &vprob: vprob_list) {
+                file << vprob.first << ' ' << vprob.second << ' ';
             }
         }
     }
 
+    file.close();
+}
+
+void Book::WriteBinaryBook(const BookData &book_data, std::string filename) const {
+    auto keys = std::vector<std::uint64_t>{};
+    for (const auto &it: book_data) {
+        keys.emplace_back(it.first);
+    }
+    std::sort(std::begin(keys), std::end(keys));
+
+    auto sorted_keys = std::vector<std::uint64_t>{};
+    auto offsets = std::vector<std::uint32_t>{0};
+    auto entries = std::vector<BookEntry>{};
+
+    for (const auto key: keys) {
+        const auto vprob_list = ToProbabilityList(book_data.at(key));
+        if (vprob_list.empty()) {
+            continue;
+        }
+        for (const auto &vprob: vprob_list) {
+            // Keep the rare move in the book.
+            const int prob = std::max((int)std::round(vprob.second * kProbScale), 1);
+            entries.emplace_back(BookEntry{(std::uint16_t)vprob.first,
+                                           (std::uint16_t)std::min(prob, (int)kProbScale), 0});
+        }
+        sorted_keys.emplace_back(key);
+        offsets.emplace_back(entries.size());
+    }
+
+    WritePackedBook(sorted_keys, offsets, entries, filename);
+}
+
+void Book::WritePackedBook(const std::vector<std::uint64_t> &keys,
+                           const std::vector<std::uint32_t> &offsets,
+                           const std::vector<BookEntry> &entries,
+                           std::string filename) const {
+    auto file = std::ofstream{};
+
+    file.open(filename, std::ios_base::binary | std::ios_base::trunc);
+    if (!file.is_open()) {
+        LOGGING << "Fail to create the file: " << filename << '!' << std::endl; 
+        return;
+    }
 
+    BookHeader header;
+    std::copy(std::begin(kMagic), std::end(kMagic), header.magic);
+    header.num_keys = keys.size();
+    header.num_entries = entries.size();
+
+    file.write((const char*)&header, sizeof(BookHeader));
+    file.write((const char*)keys.data(), keys.size() * sizeof(std::uint64_t));
+    file.write((const char*)offsets.data(), offsets.size() * sizeof(std::uint32_t));
+    file.write((const char*)entries.data(), entries.size() * sizeof(BookEntry));
     file.close();
+
+    LOGGING << Format("wrote %zu positions and %zu moves\n",
+                          keys.size(), entries.size());
+}
+
+std::uint64_t Book::GetCanonicalHash(const GameState &state) const {
+    auto hash = state.ComputeSymmetryKoHash(0);
+    for (int symm = 1; symm < Symmetry::kNumSymmetris; ++symm) {
+        hash = std::min(hash, state.ComputeSymmetryKoHash(symm));
+    }
+    return hash;
+}
+
+std::vector<GameState> Book::GetFrontier(const GameState &root, int max_positions) const {
+    auto frontier = std::vector<GameState>{};
+    if (num_keys_ == 0 || root.GetBoardSize() != kBookBoardSize) {
+        return frontier;
+    }
+
+    auto visited = std::unordered_set<std::uint64_t>{};
+    auto queue = std::deque<GameState>{};
+    visited.insert(GetCanonicalHash(root));
+    queue.emplace_back(root);
+
+    while (!queue.empty() && (int)frontier.size() < max_positions) {
+        auto state = std::move(queue.front());
+        queue.pop_front();
+
+        size_t size;
+        const auto entries = Find(state.GetKoHash(), size);
+        if (size == 0) {
+            frontier.emplace_back(std::move(state));
+            continue;
+        }
+        if (state.GetMoveNumber() >= kMaxBookMoves) {
+            // Probe never reaches the next moves.
+            continue;
+        }
+        for (size_t i = 0; i < size; ++i) {
+            auto next = state;
+            if (!next.PlayMove(entries[i].vertex) ||
+                    !visited.insert(GetCanonicalHash(next)).second) {
+                continue;
+            }
+            queue.emplace_back(std::move(next));
+        }
+    }
+    return frontier;
+}
+
+void Book::WriteExpandedBook(const std::vector<GameState> &positions,
+                             const std::vector<SearchedMoveList> &searched,
+                             std::string filename) const {
+    // The ordered map keeps the keys sorted.
+    auto book = std::map<std::uint64_t, std::vector<BookEntry>>{};
+    for (size_t i = 0; i < num_keys_; ++i) {
+        book[keys_[i]].assign(entries_ + offsets_[i], entries_ + offsets_[i+1]);
+    }
+
+    for (size_t p = 0; p < positions.size() && p < searched.size(); ++p) {
+        const auto &state = positions[p];
+        if (searched[p].empty()) {
+            continue;
+        }
+        // Every symmetry is in the book like the generated book.
+        for (int symm = 0; symm < Symmetry::kNumSymmetris; ++symm) {
+            auto &entries = book[state.ComputeSymmetryKoHash(symm)];
+            entries.clear();
+            for (const auto &move : searched[p]) {
+                const int prob = std::max((int)std::round(move.prob * kProbScale), 1);
+                const float value = std::min(std::max(move.value, 0.f), 1.f);
+                const int vertex = Symmetry::Get().TransformVertex(
+                                       state.GetBoardSize(), symm, move.vertex);
+                entries.emplace_back(BookEntry{(std::uint16_t)vertex,
+                                               (std::uint16_t)std::min(prob, (int)kProbScale),
+                                               (std::uint16_t)(1 + std::round(value * (kProbScale - 1)))});
+            }
+        }
+    }
+
+    auto keys = std::vector<std::uint64_t>{};
+    auto offsets = std::vector<std::uint32_t>{0};
+    auto entries = std::vector<BookEntry>{};
+    for (const auto &it : book) {
+        keys.emplace_back(it.first);
+        entries.insert(std::end(entries), std::begin(it.second), std::end(it.second));
+        offsets.emplace_back(entries.size());
+    }
+    WritePackedBook(keys, offsets, entries, filename);
 }
 
 void Book::BookDataProcess(std::string sgfstring,
-                               std::unordered_map<std::uint64_t, VertexFrequencyList> &book_data) const {
+                               BookData &book_data) const {
 
     GameState state;
     try {
@@ -89,7 +306,7 @@ void Book::BookDataProcess(std::string sgfstring,
     }
 
     auto game_ite = GameStateIterator(state);
-    int book_move_num = std::min(kMaxBookMoves, (int)game_ite.MaxMoveNumber());
+    int book_move_num = std::min((int)kMaxBookMoves, (int)game_ite.MaxMoveNumber());
 
     // TODO: Same postion may have variant paths. We should 
     //       consider it. But if we direct use transposition
@@ -133,17 +350,86 @@ void Book::BookDataProcess(std::string sgfstring,
     } while (game_ite.Next());
 }
 
+void Book::ClearBook() {
+    mapped_.Close();
+    owned_keys_.clear();
+    owned_offsets_.clear();
+    owned_entries_.clear();
+
+    keys_ = nullptr;
+    offsets_ = nullptr;
+    entries_ = nullptr;
+    num_keys_ = 0;
+}
+
 void Book::LoadBook(std::string book_name) {
     if (book_name.empty()) return;
 
+    ClearBook();
+    if (!LoadBinaryBook(book_name) && !LoadTextBook(book_name)) {
+        ClearBook();
+    }
+}
+
+bool Book::LoadBinaryBook(std::string book_name) {
+    if (!mapped_.Open(book_name)) {
+        return false;
+    }
+
+    const char *data = mapped_.Data();
+    const size_t size = mapped_.Size();
+
+    BookHeader header;
+    if (size < sizeof(BookHeader)) {
+        mapped_.Close();
+        return false;
+    }
+    std::copy(data, data + sizeof(BookHeader), (char*)&header);
+    const bool v1 = std::equal(std::begin(kMagicV1), std::end(kMagicV1), header.magic);
+    if (!v1 && !std::equal(std::begin(kMagic), std::end(kMagic), header.magic)) {
+        // Not the binary book, may be the text book.
+        mapped_.Close();
+        return false;
+    }
+
+    const size_t keys_size = header.num_keys * sizeof(std::uint64_t);
+    const size_t offsets_size = (header.num_keys + 1) * sizeof(std::uint32_t);
+    const size_t entries_size = header.num_entries *
+                                    (v1 ? sizeof(BookEntryV1) : sizeof(BookEntry));
+
+    if (size != sizeof(BookHeader) + keys_size + offsets_size + entries_size) {
+        LOGGING << "The book file is broken: " << book_name << '!' << std::endl;
+        mapped_.Close();
+        return true;
+    }
+
+    // The parts are aligned because the header is 24 bytes and the
+    // mapping starts at one page.
+    keys_ = (const std::uint64_t*)(data + sizeof(BookHeader));
+    offsets_ = (const std::uint32_t*)(data + sizeof(BookHeader) + keys_size);
+    entries_ = (const BookEntry*)(data + sizeof(BookHeader) + keys_size + offsets_size);
+    num_keys_ = header.num_keys;
+
+    if (v1) {
+        // The old entries have no values. Unpack them.
+        const auto old_entries = (const BookEntryV1*)entries_;
+        for (size_t i = 0; i < header.num_entries; ++i) {
+            owned_entries_.emplace_back(BookEntry{old_entries[i].vertex, old_entries[i].prob, 0});
+        }
+        entries_ = owned_entries_.data();
+    }
+    return true;
+}
+
+bool Book::LoadTextBook(std::string book_name) {
     std::ifstream file;
     file.open(book_name);
     if (!file.is_open()) {
         LOGGING << "Fail to load the file: " << book_name << '!' << std::endl; 
-        return;
+        return false;
     }
 
-    data_.clear();
+    auto data = std::vector<std::pair<std::uint64_t, VertexProbabilityList>>{};
 
     auto line = std::string{};
     while(std::getline(file, line)) {
@@ -162,13 +448,87 @@ void Book::LoadBook(std::string book_name) {
             vprob.emplace_back(vertex, prob);
         }
 
-        data_.insert({hash, vprob});
+        data.emplace_back(hash, vprob);
     }
     file.close();
+
+    // Pack it as the binary book. The first one wins if the same
+    // position is in the file twice.
+    std::stable_sort(std::begin(data), std::end(data),
+                         [](const auto &a, const auto &b) { return a.first < b.first; });
+
+    owned_offsets_.emplace_back(0);
+    for (size_t i = 0; i < data.size(); ++i) {
+        if (i > 0 && data[i].first == data[i-1].first) {
+            continue;
+        }
+        for (const auto &vprob: data[i].second) {
+            const int prob = std::max((int)std::round(vprob.second * kProbScale), 1);
+            owned_entries_.emplace_back(BookEntry{(std::uint16_t)vprob.first,
+                                                  (std::uint16_t)std::min(prob, (int)kProbScale), 0});
+        }
+        owned_keys_.emplace_back(data[i].first);
+        owned_offsets_.emplace_back(owned_entries_.size());
+    }
+
+    keys_ = owned_keys_.data();
+    offsets_ = owned_offsets_.data();
+    entries_ = owned_entries_.data();
+    num_keys_ = owned_keys_.size();
+    return true;
+}
+
+const Book::BookEntry *Book::Find(std::uint64_t hash, size_t &size) const {
+    size = 0;
+    if (num_keys_ == 0) {
+        return nullptr;
+    }
+
+    // The keys are the uniform hashes, so guess the position by the
+    // key value. Fall back to the binary search if the guesses are
+    // bad.
+    size_t lo = 0;
+    size_t hi = num_keys_ - 1;
+    for (int step = 0; step < 8 && lo < hi; ++step) {
+        const auto lo_key = keys_[lo];
+        const auto hi_key = keys_[hi];
+        if (hash < lo_key || hash > hi_key) {
+            return nullptr;
+        }
+        const double ratio = (double)(hash - lo_key) / (double)(hi_key - lo_key);
+        const size_t mid = std::min(lo + (size_t)(ratio * (hi - lo)), hi);
+        if (keys_[mid] < hash) {
+            lo = mid + 1;
+        } else if (keys_[mid] > hash) {
+            hi = mid - 1;
+        } else {
+            lo = hi = mid;
+        }
+    }
+
+    const auto it = std::lower_bound(keys_ + lo, keys_ + hi + 1, hash);
+    if (it == keys_ + hi + 1 || *it != hash) {
+        return nullptr;
+    }
+    const size_t idx = it - keys_;
+    size = offsets_[idx+1] - offsets_[idx];
+    return entries_ + offsets_[idx];
+}
+
+Book::VertexProbabilityList Book::GetProbabilityList(std::uint64_t hash) const {
+    auto vprob_list = VertexProbabilityList{};
+    size_t size;
+    const auto entries = Find(hash, size);
+
+    for (size_t i = 0; i < size; ++i) {
+        vprob_list.emplace_back(entries[i].vertex,
+                                    (float)entries[i].prob / kProbScale);
+    }
+    return vprob_list;
 }
 
 bool Book::Probe(const GameState &state, int &book_move) const {
-    if (data_.empty() ||
+    if (num_keys_ == 0 ||
             state.GetBoardSize() != kBookBoardSize ||
             state.GetMoveNumber() > kMaxBookMoves) {
         return false;
@@ -177,20 +537,28 @@ bool Book::Probe(const GameState &state, int &book_move) const {
     auto acc_score = 0;
     auto candidate_moves = std::vector<std::pair<int, int>>{};
 
+    size_t size;
+    const auto entries = Find(state.GetKoHash(), size);
 
-    auto hash = state.GetKoHash();
-    auto it = data_.find(hash);
-
-    if (it != std::end(data_)) {
-        auto &vprob_list = it->second;
+    // The searched position only chooses the moves which are about
+    // as good as the best one. The other moves are chosen by their
+    // frequency.
+    int best_value = 0;
+    for (size_t i = 0; i < size; ++i) {
+        best_value = std::max(best_value, (int)entries[i].value);
+    }
 
-        for (auto &vprob : vprob_list) {
-            int vtx = vprob.first;
-            int score = (int)(vprob.second * 10000);
+    for (size_t i = 0; i < size; ++i) {
+        int vtx = entries[i].vertex;
+        int score = entries[i].prob;
 
-            candidate_moves.emplace_back(score, vtx);
-            acc_score += score;
+        if (best_value > 0 &&
+                (int)entries[i].value + kValueMargin < best_value) {
+            continue;
         }
+
+        candidate_moves.emplace_back(score, vtx);
+        acc_score += score;
     }
 
     if (candidate_moves.empty()) return false;
@@ -198,7 +566,7 @@ bool Book::Probe(const GameState &state, int &book_move) const {
     std::stable_sort(std::rbegin(candidate_moves), std::rend(candidate_moves));
 
     const auto rand = Random<kXoroShiro128Plus>::Get().Generate() % acc_score;
-    int choice;
+    int choice = 0;
     acc_score = 0;
 
     for (int i = 0; i < (int)candidate_moves.size(); ++i) {
@@ -215,18 +583,13 @@ bool Book::Probe(const GameState &state, int &book_move) const {
 
 std::vector<std::pair<float, int>> Book::GetCandidateMoves(const GameState &state) const {
     auto candidate_moves = std::vector<std::pair<float, int>>{};
-    auto hash = state.GetKoHash();
-    auto it = data_.find(hash);
-
-    if (it != std::end(data_)) {
-        auto &vprob_list = it->second;
+    const auto vprob_list = GetProbabilityList(state.GetKoHash());
 
-        for (auto &vprob : vprob_list) {
-            int vtx = vprob.first;
-            float score = vprob.second;
+    for (auto &vprob : vprob_list) {
+        int vtx = vprob.first;
+        float score = vprob.second;
 
-            candidate_moves.emplace_back(score, vtx);
-        }
+        candidate_moves.emplace_back(score, vtx);
     }
 
     std::stable_sort(std::rbegin(candidate_moves), std::rend(candidate_moves));
@@ -1,20 +1,27 @@
 #pragma once
 
+#include <cstdint>
 #include <unordered_map>
 #include <string>
 #include <vector>
 #include <utility>
 
 #include "game/game_state.h"
+#include "utils/mapped_file.h"
 
 class Book {
 public:
     static Book &Get();
 
-    // Generate the new opening book.
+    // Generate the new opening book. The games are parsed in the
+    // threads. Write the binary book if the file name ends with
+    // ".bin", else append the text book to the file.
     void GenerateBook(std::string sgf_name, std::string filename) const;
 
-    // Load the opening book.
+    // Load the opening book. The binary book is mapped into the
+    // memory, so the processes on the same host share it by the
+    // page cache. The text book is parsed and packed in the same
+    // layout.
     void LoadBook(std::string book_name);
 
     // Try to find the opening moves. Return kPass if there is
@@ -23,17 +30,103 @@ public:
 
     std::vector<std::pair<float, int>> GetCandidateMoves(const GameState &state) const;
 
+    // The move of the searched position. The prob is the visits share
+    // and the value is the win-loss of the side to move.
+    struct SearchedMove {
+        int vertex;
+        float prob;
+        float value;
+    };
+    using SearchedMoveList = std::vector<SearchedMove>;
+
+    // Return the positions which are one book move out of the book.
+    // They are reached by the book moves from the root, the shallow
+    // ones first. The symmetric positions are only returned once.
+    std::vector<GameState> GetFrontier(const GameState &root, int max_positions) const;
+
+    // Write the loaded book and the searched moves of the positions
+    // into the new binary book. The searched moves replace the moves
+    // of the same position.
+    void WriteExpandedBook(const std::vector<GameState> &positions,
+                           const std::vector<SearchedMoveList> &searched,
+                           std::string filename) const;
+
 private:
     using VertexFrequencyList = std::vector<std::pair<int ,int>>;
     using VertexProbabilityList = std::vector<std::pair<int ,float>>;
+    using BookData = std::unordered_map<std::uint64_t, VertexFrequencyList>;
+
+    // One packed move. The probability is scaled to kProbScale. The
+    // value is the searched win-loss of the move, scaled to kProbScale
+    // and plus one. It is zero if the move is not searched.
+    struct BookEntry {
+        std::uint16_t vertex;
+        std::uint16_t prob;
+        std::uint16_t value;
+    };
+
+    // The entry of the first binary book, which has no values.
+    struct BookEntryV1 {
+        std::uint16_t vertex;
+        std::uint16_t prob;
+    };
+
+    // The binary book is the header, the sorted keys, the offsets
+    // and the entries. All parts are in the native byte order.
+    struct BookHeader {
+        char magic[8];
+        std::uint64_t num_keys;
+        std::uint64_t num_entries;
+    };
+
+    void BookDataProcess(std::string sgfstring, BookData &book_data) const;
 
-    std::unordered_map<std::uint64_t, VertexProbabilityList> data_;
+    // Filter the rare moves and normalize the frequencies.
+    VertexProbabilityList ToProbabilityList(const VertexFrequencyList &vfreq_list) const;
 
-    void BookDataProcess(std::string sgfstring,
-                             std::unordered_map<std::uint64_t, VertexFrequencyList> &book_data) const;
+    void WriteTextBook(const BookData &book_data, std::string filename) const;
+    void WriteBinaryBook(const BookData &book_data, std::string filename) const;
+    void WritePackedBook(const std::vector<std::uint64_t> &keys,
+                         const std::vector<std::uint32_t> &offsets,
+                         const std::vector<BookEntry> &entries,
+                         std::string filename) const;
 
+    // Return the smallest ko hash of all symmetries.
+    std::uint64_t GetCanonicalHash(const GameState &state) const;
+
+    bool LoadBinaryBook(std::string book_name);
+    bool LoadTextBook(std::string book_name);
+    void ClearBook();
+
+    // Return the moves of the position. Return nullptr if it is
+    // not in the book.
+    const BookEntry *Find(std::uint64_t hash, size_t &size) const;
+
+    VertexProbabilityList GetProbabilityList(std::uint64_t hash) const;
+
+    // The moves of keys_[i] are from entries_[offsets_[i]] to
+    // entries_[offsets_[i+1]]. They point into the mapped file or
+    // into the owned vectors.
+    const std::uint64_t *keys_{nullptr};
+    const std::uint32_t *offsets_{nullptr};
+    const BookEntry *entries_{nullptr};
+    size_t num_keys_{0};
+
+    MappedFile mapped_;
+    std::vector<std::uint64_t> owned_keys_;
+    std::vector<std::uint32_t> owned_offsets_;
+    std::vector<BookEntry> owned_entries_;
 
     static constexpr int kBookBoardSize = 19;
     static constexpr int kMaxBookMoves = 30;
     static constexpr int kFilterThreshold = 25;
+    static constexpr int kProbScale = 65535;
+    static constexpr int kChunkGames = 1000;
+
+    // Probe only chooses the searched moves which are this close to
+    // the best value.
+    static constexpr int kValueMargin = kProbScale / 50;
+
+    static constexpr char kMagic[8] = {'S', 'A', 'Y', 'B', 'O', 'O', 'K', '2'};
+    static constexpr char kMagicV1[8] = {'S', 'A', 'Y', 'B', 'O', 'O', 'K', '1'};
 };
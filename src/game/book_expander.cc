@@ -0,0 +1,122 @@
+#include "game/book_expander.h"
+#include "game/book.h"
+#include "mcts/search.h"
+#include "utils/log.h"
+#include "utils/format.h"
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Keep the searched moves whose visits share is at least this.
+static constexpr float kMinVisitsShare = 0.05f;
+
+static Book::SearchedMoveList GetSearchedMoves(const GameState &state,
+                                               const ComputationResult &result) {
+    auto moves = Book::SearchedMoveList{};
+    const int board_size = state.GetBoardSize();
+    const int num_intersections = state.GetNumIntersections();
+
+    // The pass is never the book move.
+    int best_idx = -1;
+    for (int idx = 0; idx < num_intersections; ++idx) {
+        if (result.root_visits[idx] > 0 &&
+                (best_idx < 0 || result.root_visits[idx] > result.root_visits[best_idx])) {
+            best_idx = idx;
+        }
+    }
+    if (best_idx < 0) {
+        return moves;
+    }
+
+    auto acc_prob = 0.f;
+    for (int idx = 0; idx < num_intersections; ++idx) {
+        const auto prob = result.root_playouts_dist[idx];
+        if (idx != best_idx && prob < kMinVisitsShare) {
+            continue;
+        }
+        const int vertex = state.GetVertex(idx % board_size, idx / board_size);
+        moves.emplace_back(Book::SearchedMove{vertex, prob, result.root_evals[idx]});
+        acc_prob += prob;
+    }
+    for (auto &move : moves) {
+        move.prob /= acc_prob;
+    }
+    return moves;
+}
+
+void ExpandBook(Network &network, const GameState &root,
+                int playouts, int max_positions, std::string filename) {
+    const auto frontier = Book::Get().GetFrontier(root, max_positions);
+    LOGGING << Format("expand %zu frontier positions\n", frontier.size());
+
+    const int num_workers = std::max(GetOption<int>("threads"), 1);
+    const int sessions_per_worker = std::max(GetOption<int>("analysis_sessions"), 1);
+
+    auto searched = std::vector<Book::SearchedMoveList>(frontier.size());
+    std::atomic<size_t> next_position{0};
+    std::atomic<int> finished{0};
+
+    // Like the analysis server, every worker steps its searches by
+    // turns without the search threads.
+    const auto Worker = [&]() {
+        struct Slot {
+            size_t index;
+            GameState state;
+            std::unique_ptr<Search> search;
+        };
+        auto slots = std::vector<std::unique_ptr<Slot>>{};
+        auto next_slots = std::vector<std::unique_ptr<Slot>>{};
+
+        while (true) {
+            while ((int)slots.size() < sessions_per_worker) {
+                const auto index = next_position.fetch_add(1);
+                if (index >= frontier.size()) {
+                    break;
+                }
+                auto slot = std::make_unique<Slot>();
+                slot->index = index;
+                slot->state = frontier[index];
+                slot->search = std::make_unique<Search>(slot->state, network);
+                if (slot->search->BeginAnalysisSteps(playouts)) {
+                    slots.emplace_back(std::move(slot));
+                }
+            }
+            if (slots.empty()) {
+                break;
+            }
+
+            for (auto &slot : slots) {
+                slot->search->SubmitAnalysisStep(1);
+            }
+
+            next_slots.clear();
+            for (auto &slot : slots) {
+                if (slot->search->CollectAnalysisStep()) {
+                    next_slots.emplace_back(std::move(slot));
+                    continue;
+                }
+                const auto result = slot->search->EndAnalysisSteps();
+                searched[slot->index] = GetSearchedMoves(slot->state, result);
+
+                const auto done = finished.fetch_add(1) + 1;
+                if (done % 100 == 0) {
+                    LOGGING << Format("searched %d positions\n", done);
+                }
+            }
+            std::swap(slots, next_slots);
+        }
+    };
+
+    auto workers = std::vector<std::thread>{};
+    for (int t = 0; t < num_workers; ++t) {
+        workers.emplace_back(Worker);
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    Book::Get().WriteExpandedBook(frontier, searched, filename);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "game/game_state.h"
+#include "neural/network.h"
+
+#include <string>
+
+// Deepen the loaded opening book by the search. The frontier positions,
+// which are one book move out of the book from the root, are searched
+// and their visits shares and values are written into the new binary
+// book with the loaded book. Every thread searches many positions by
+// turns, so their leaves fill the same network batch of all GPUs.
+// Expand the new book again to go one move deeper.
+void ExpandBook(Network &network, const GameState &root,
+                int playouts, int max_positions, std::string filename);
@@ -66,6 +66,10 @@ static std::vector<std::string> kGtpCommandsList = {
 
     "clear_cache",
 
+    "save_tree",
+
+    "load_tree",
+
     "selfplay-genmove",      // For self-play debug.
 
     "selfplay",              // For self-play debug.
@@ -104,13 +108,34 @@ static std::vector<std::string> kGtpCommandsList = {
 
     "raw-nn",
 
+    "raw-nn-batch",
+
+    "raw-nn-komi",
+
+    "batch_stats",
+    "sayuri-stats",
+    "sayuri-trace",
+    "sayuri-memory",
+    "sayuri-memory-plan",
+
     "benchmark",
 
+    "benchmark_selection",
+    "benchmark_update",
+    "benchmark_gammas",
+
     "genbook",
 
+    "expandbook",
+
     "genpatterns",
 
     "prediction_accuracy",
+    "raw-nn-accuracy",
+    "precision_drift",
+    "convert_weights",
+    "export_onnx",
+    "load_weights",
 
     "gogui-analyze_commands",
 
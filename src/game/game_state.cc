@@ -6,25 +6,25 @@
 #include "utils/komi.h"
 #include "pattern/pattern.h"
 #include "pattern/gammas_dict.h"
+#include "utils/threadpool.h"
 
+#include <atomic>
+#include <mutex>
 #include <random>
+#include <thread>
 
 void GameState::Reset(const int boardsize, const float komi) {
     board_.Reset(boardsize);
     SetKomi(komi);
-    ko_hash_history_.clear();
-    game_history_.clear();
     append_moves_.clear();
-    comments_.clear();
 
-    ko_hash_history_.emplace_back(GetKoHash());
-    game_history_.emplace_back(std::make_shared<Board>(board_));
-    comments_.emplace_back(std::string{});
+    last_comment_.clear();
+    history_.reset();
+    PushHistory();
 
     winner_ = kUndecide;
     handicap_ = 0;
     move_number_ = 0;
-    last_comment_.clear();
 }
 
 void GameState::ClearBoard() {
@@ -54,14 +54,9 @@ bool GameState::AppendMove(const int vtx, const int color) {
         last_comment_.clear();
         move_number_ = 0;
 
-        ko_hash_history_.clear();
-        game_history_.clear();
-        comments_.clear();
-
-        ko_hash_history_.emplace_back(GetKoHash());
-        game_history_.emplace_back(std::make_shared<Board>(board_));
+        history_.reset();
+        PushHistory();
         append_moves_.emplace_back(vtx, color);
-        comments_.emplace_back(std::string{});
 
         return true;
     }
@@ -85,15 +80,7 @@ bool GameState::PlayMove(const int vtx, const int color) {
     if (IsLegalMove(vtx, color)) {
         board_.PlayMoveAssumeLegal(vtx, color);
         move_number_++;
-
-        // Cut off unused history.
-        ko_hash_history_.resize(move_number_);
-        game_history_.resize(move_number_);
-        comments_.resize(move_number_);
-
-        ko_hash_history_.emplace_back(GetKoHash());
-        game_history_.emplace_back(std::make_shared<Board>(board_));
-        PushComment();
+        PushHistory();
 
         return true;
     }
@@ -101,13 +88,9 @@ bool GameState::PlayMove(const int vtx, const int color) {
 }
 
 bool GameState::UndoMove() {
-    if (move_number_ >= 1) {
-        // Cut off unused history.
-        ko_hash_history_.resize(move_number_);
-        game_history_.resize(move_number_);
-        comments_.resize(move_number_);
-
-        board_ = *game_history_[move_number_-1];
+    if (move_number_ >= 1 && history_->prev) {
+        PopHistory();
+        board_ = history_->board;
 
         winner_ = kUndecide;
         move_number_--;
@@ -117,6 +100,25 @@ bool GameState::UndoMove() {
     return false;
 }
 
+void GameState::UnmakeMoves(const int count) {
+    const int undo_count = std::min(count, move_number_);
+    if (undo_count <= 0) {
+        return;
+    }
+    for (int i = 0; i < undo_count && history_->prev; ++i) {
+        PopHistory();
+    }
+    board_ = history_->board;
+
+    winner_ = kUndecide;
+    move_number_ -= undo_count;
+}
+
+bool GameState::IsSameHistory(const GameState &other) const {
+    return history_ == other.history_ &&
+               GetHash() == other.GetHash();
+}
+
 int GameState::TextToVertex(std::string text) const {
     if (text.size() < 2) {
         return kNullVertex;
@@ -334,12 +336,19 @@ bool GameState::IsGameOver() const {
 }
 
 bool GameState::IsSuperko() const {
-    auto first = std::crbegin(ko_hash_history_);
-    auto last = std::crend(ko_hash_history_);
-
-    auto res = std::find(++first, last, GetKoHash());
-
-    return res != last;
+    const auto ko_hash = GetKoHash();
+    const auto prev = history_->prev.get();
+    if (!prev || !MayRepeat(ko_hash)) {
+        // Most moves are rejected by the filter, so they never walk
+        // the history.
+        return false;
+    }
+    for (auto node = prev; node; node = node->prev.get()) {
+        if (node->ko_hash == ko_hash) {
+            return true;
+        }
+    }
+    return false;
 }
 
 bool GameState::IsLegalMove(const int vertex) const {
@@ -350,9 +359,8 @@ bool GameState::IsLegalMove(const int vertex, const int color) const {
     return board_.IsLegalMove(vertex, color);
 }
 
-bool GameState::IsLegalMove(const int vertex, const int color,
-                            std::function<bool(int, int)> AvoidToMove) const {
-    return board_.IsLegalMove(vertex, color, AvoidToMove);
+const BitBoard &GameState::GetLegalBits(const int color) const {
+    return board_.GetLegalBits(color);
 }
 
 bool GameState::SetFixdHandicap(int handicap) {
@@ -458,6 +466,31 @@ std::vector<int> GameState::GetOwnership() const {
     return res;
 }
 
+const std::vector<int> &GameState::GetCachedOwnership() const {
+    // The direct mapped table. The key is the position without the
+    // side to move and the passes, so every end of the same position
+    // hits it.
+    static constexpr size_t kCacheSize = 64;
+    struct Entry {
+        std::uint64_t hash{0};
+        int board_size{0};
+        std::vector<int> ownership;
+    };
+    thread_local auto table = std::vector<Entry>(kCacheSize);
+
+    const auto hash = board_.GetKoHash();
+    const auto board_size = GetBoardSize();
+    auto &entry = table[hash % kCacheSize];
+
+    if (entry.board_size != board_size || entry.hash != hash) {
+        entry.hash = hash;
+        entry.board_size = board_size;
+        entry.ownership.assign(GetNumIntersections(), kInvalid);
+        board_.ComputeScoreArea(entry.ownership);
+    }
+    return entry.ownership;
+}
+
 void GameState::FillRandomMove() {
     const int color = GetToMove();
     const int empty_cnt = board_.GetEmptyCount();
@@ -528,7 +561,10 @@ void GameState::FillRandomMove() {
 }
 
 void GameState::PlayRandomMove() {
-    auto candidate_moves = std::vector<int>{};
+    // The rollout plays this function at every move. Reuse the buffers
+    // of this thread.
+    thread_local auto candidate_moves = std::vector<int>{};
+    thread_local auto empty_moves = std::vector<int>{};
     const int color = GetToMove();
 
     board_.GenerateCandidateMoves(candidate_moves, color);
@@ -576,29 +612,32 @@ void GameState::PlayRandomMove() {
         }
     }
 
-    // gather the legal moves
+    // Select one legal move uniformly. Draw the empty points in the
+    // random order and stop at the first legal one, so that we do not
+    // test every empty point. The result has the same distribution as
+    // picking from the full list of legal moves.
     const int empty_cnt = board_.GetEmptyCount();
-    auto legal_moves = std::vector<int>{};
-
+    empty_moves.resize(empty_cnt);
     for (int i = 0; i < empty_cnt; ++i) {
-        const auto vtx = board_.GetEmpty(i);
+        empty_moves[i] = board_.GetEmpty(i);
+    }
+
+    for (int remaining = empty_cnt; remaining > 0; --remaining) {
+        const int selected = Random<>::Get().Generate() % remaining;
+        const auto vtx = empty_moves[selected];
 
         if (IsLegalMove(vtx, color) &&
                 !(board_.IsSimpleEye(vtx, color) &&
                      !board_.IsCaptureMove(vtx, color)&&
                      !board_.IsEscapeMove(vtx, color))) {
-            legal_moves.emplace_back(vtx);
+            PlayMoveFast(vtx, color);
+            return;
         }
+        empty_moves[selected] = empty_moves[remaining-1];
     }
 
     // there is no legal moves
-    if (legal_moves.empty()) {
-        PlayMoveFast(kPass, color);
-        return;
-    }
-
-    int selected = Random<>::Get().Generate() % legal_moves.size();
-    PlayMoveFast(legal_moves[selected], color);
+    PlayMoveFast(kPass, color);
 }
 
 float GameState::GetGammaValue(const int vtx, const int color) const {
@@ -632,20 +671,17 @@ float GameState::GetGammaValue(const int vtx, const int color) const {
 
 std::vector<float> GameState::GetGammasPolicy(const int color) const {
     auto num_intersections = GetNumIntersections();
-    auto board_size = GetBoardSize();
 
     auto policy = std::vector<float>(num_intersections, 0);
     auto acc = 0.f;
 
-    for (int idx = 0; idx < num_intersections; ++idx) {
-        const auto x = idx % board_size;
-        const auto y = idx / board_size;
-        const auto vtx = GetVertex(x,y);
-
+    // The illegal moves keep the zero.
+    GetLegalBits(color).ForEach([&](const int vtx) {
+        const auto idx = GetIndex(GetX(vtx), GetY(vtx));
         const auto gval = GetGammaValue(vtx, color);
         policy[idx] = gval;
         acc += gval;
-    }
+    });
 
     for (int idx = 0; idx < num_intersections; ++idx) {
         policy[idx] /= acc;
@@ -660,59 +696,128 @@ std::vector<int> GameState::GetOwnershipAndRemovedDeadStrings(int playouts) cons
     return fork_state.GetOwnership();
 }
 
-std::vector<int> GameState::MarKDeadStrings(int playouts) const {
-    auto num_intersections = GetNumIntersections();
-    auto buffer = std::vector<int>(num_intersections, 0);
+bool GameState::PlayDeadStringsPlayout(const int p, std::vector<int> &buffer) const {
+    const auto num_intersections = GetNumIntersections();
+    auto fork_state = *this;
+    int moves = 0;
+    bool already_removed = false;
+
+    if (p%2==0) {
+        fork_state.board_.SetToMove(!GetToMove());
+    }
+    while(true) {
+        fork_state.FillRandomMove();
+
+        if (p == 0 &&
+                moves == 0 &&
+                fork_state.GetLastMove() == kPass) {
+            // The first move is pass. That means all dead strings
+            // are removed.
+            already_removed = true;
+            break;
+        }
+
+        if (fork_state.GetPasses() >= 4) {
+            break;
+        }
+
+        if (moves++ >= 2 * num_intersections) {
+            // too many moves
+            break;
+        }
+    }
+
+    auto final_ownership = fork_state.GetOwnership();
 
+    for (int idx = 0; idx < num_intersections; ++idx) {
+        auto owner = final_ownership[idx];
+        if (owner == kBlack) {
+            buffer[idx] += 1;
+        } else if (owner == kWhite) {
+            buffer[idx] -= 1;
+        }
+    }
+    return !already_removed;
+}
+
+int GameState::ComputeDeadStringsOwnership(int playouts, std::vector<int> &buffer) const {
     static constexpr int kMaxPlayoutsCount = 32 * 16384;
 
+    // The playouts of one task.
+    static constexpr int kChunkPlayouts = 256;
+
     playouts = std::min(playouts, kMaxPlayoutsCount);
-    bool already_removed = false;
+    if (playouts <= 0) {
+        return playouts;
+    }
 
-    for (int p = 0; p < playouts; ++p) {
-        int moves = 0;
-        auto fork_state = *this;
-        if (p%2==0) {
-            fork_state.board_.SetToMove(!GetToMove());
-        }
-        while(true) {
-            fork_state.FillRandomMove();
-
-            if (p == 0 &&
-                    moves == 0 &&
-                    fork_state.GetLastMove() == kPass) {
-                // The first move is pass. That means all dead strings
-                // are removed.
-                p = kMaxPlayoutsCount+1; // stop the playouts
-                already_removed = true;
-                break;
-            }
+    // The first playout tells whether the dead strings are already
+    // removed, so play it before the others.
+    if (!PlayDeadStringsPlayout(0, buffer)) {
+        return 1; // in order to resize the thes
+    }
 
-            if (fork_state.GetPasses() >= 4) {
-                break;
+    // Every thread claims the chunks of the playouts from the shared
+    // counter and sums every chunk in its own buffer. The calling thread
+    // claims them too, and then only waits for the chunks which are
+    // already running. So it never waits for the tasks queued behind
+    // a busy pool. The unstarted tasks find nothing to do later.
+    struct Work {
+        std::atomic<int> next_chunk{0};
+        std::atomic<int> finished_chunks{0};
+        int num_chunks;
+        std::mutex mutex;
+        std::vector<int> buffer;
+    };
+    const auto num_intersections = GetNumIntersections();
+    auto work = std::make_shared<Work>();
+    work->num_chunks = (playouts - 1 + kChunkPlayouts - 1) / kChunkPlayouts;
+    work->buffer.assign(num_intersections, 0);
+
+    const auto run_chunks = [this, work, playouts, num_intersections]() {
+        auto local = std::vector<int>{};
+        int chunk;
+        while ((chunk = work->next_chunk.fetch_add(1)) < work->num_chunks) {
+            local.assign(num_intersections, 0);
+            const int begin = 1 + chunk * kChunkPlayouts;
+            const int end = std::min(begin + kChunkPlayouts, playouts);
+            for (int p = begin; p < end; ++p) {
+                PlayDeadStringsPlayout(p, local);
             }
 
-            if (moves++ >= 2 * num_intersections) {
-                // too many moves
-                break;
+            // Reduce it before it is counted as finished.
+            {
+                std::lock_guard<std::mutex> lock(work->mutex);
+                for (int idx = 0; idx < num_intersections; ++idx) {
+                    work->buffer[idx] += local[idx];
+                }
             }
+            work->finished_chunks.fetch_add(1);
         }
+    };
 
-        auto final_ownership = fork_state.GetOwnership();
-
-        for (int idx = 0; idx < num_intersections; ++idx) {
-            auto owner = final_ownership[idx];
-            if (owner == kBlack) {
-                buffer[idx] += 1;
-            } else if (owner == kWhite) {
-                buffer[idx] -= 1;
-            }
-        }
+    auto &pool = ThreadPool::Get();
+    const auto num_tasks = std::min((int)pool.GetNumThreads(), work->num_chunks - 1);
+    for (int t = 0; t < num_tasks; ++t) {
+        pool.AddTask(run_chunks);
+    }
+    run_chunks();
+    while (work->finished_chunks.load() < work->num_chunks) {
+        std::this_thread::yield();
     }
 
-    if (already_removed) {
-        playouts = 1; // in order to resize the thes
+    std::lock_guard<std::mutex> lock(work->mutex);
+    for (int idx = 0; idx < num_intersections; ++idx) {
+        buffer[idx] += work->buffer[idx];
     }
+    return playouts;
+}
+
+std::vector<int> GameState::MarKDeadStrings(int playouts) const {
+    auto num_intersections = GetNumIntersections();
+    auto buffer = std::vector<int>(num_intersections, 0);
+
+    playouts = ComputeDeadStringsOwnership(playouts, buffer);
 
     const auto board_size = GetBoardSize();
     const auto thes = (int)(0.7 * playouts);
@@ -734,6 +839,64 @@ std::vector<int> GameState::MarKDeadStrings(int playouts) const {
     return dead;
 }
 
+std::vector<int> GameState::MarKDeadStrings(int playouts,
+                                            const std::vector<float> &black_ownership,
+                                            const float threshold) const {
+    const auto num_intersections = GetNumIntersections();
+    const auto board_size = GetBoardSize();
+
+    auto dead = std::vector<int>{};
+    auto uncertain = std::vector<int>{};
+    auto visited = std::vector<bool>(num_intersections, false);
+
+    // Decide the strings with the average ownership of their stones.
+    for (int idx = 0; idx < num_intersections; ++idx) {
+        const auto x = idx % board_size;
+        const auto y = idx / board_size;
+        const auto state = GetState(x, y);
+        if (visited[idx] || (state != kBlack && state != kWhite)) {
+            continue;
+        }
+        const auto string = GetStringList(GetVertex(x, y));
+        auto owner = 0.f;
+        for (const auto vtx : string) {
+            const auto sidx = GetIndex(GetX(vtx), GetY(vtx));
+            visited[sidx] = true;
+            owner += black_ownership[sidx];
+        }
+        owner /= string.size();
+
+        if (owner > threshold || owner < -threshold) {
+            const auto owner_color = owner > 0.f ? kBlack : kWhite;
+            if (owner_color != state) {
+                dead.insert(std::end(dead), std::begin(string), std::end(string));
+            }
+        } else {
+            uncertain.insert(std::end(uncertain), std::begin(string), std::end(string));
+        }
+    }
+
+    if (uncertain.empty()) {
+        return dead;
+    }
+
+    // Only the uncertain strings use the Monte-Carlo result.
+    auto buffer = std::vector<int>(num_intersections, 0);
+    playouts = ComputeDeadStringsOwnership(playouts, buffer);
+
+    const auto thes = (int)(0.7 * playouts);
+    for (const auto vtx : uncertain) {
+        const auto idx = GetIndex(GetX(vtx), GetY(vtx));
+        const auto state = GetState(vtx);
+        if (buffer[idx] >= thes) {
+            if (state == kWhite) dead.emplace_back(vtx);
+        } else if (buffer[idx] <= -thes) {
+            if (state == kBlack) dead.emplace_back(vtx);
+        }
+    }
+    return dead;
+}
+
 void GameState::RemoveDeadStrings(int playouts) {
     auto dead = MarKDeadStrings(playouts);
     board_.RemoveMarkedStrings(dead);
@@ -820,6 +983,10 @@ std::uint64_t GameState::GetHash() const {
     return board_.GetHash() ^ komi_hash_;
 }
 
+std::uint64_t GameState::GetKomiHash() const {
+    return komi_hash_;
+}
+
 std::uint64_t GameState::GetMoveHash(const int vtx, const int color) const {
     return board_.GetMoveHash(vtx, color);
 }
@@ -846,11 +1013,20 @@ std::vector<int> GameState::GetAppendMoves(int color) const {
 
 std::shared_ptr<const Board> GameState::GetPastBoard(unsigned int p) const {
     assert(p <= (unsigned)move_number_);
-    return game_history_[(unsigned)move_number_ - p];
+    const HistoryNodePtr *node = &history_;
+    for (unsigned int i = 0; i < p && (*node)->prev; ++i) {
+        node = &(*node)->prev;
+    }
+    return std::shared_ptr<const Board>(*node, &(*node)->board);
 }
 
-const std::vector<std::shared_ptr<const Board>>& GameState::GetHistory() const {
-    return game_history_;
+std::vector<std::shared_ptr<const Board>> GameState::GetHistory() const {
+    auto history = std::vector<std::shared_ptr<const Board>>{};
+    for (auto node = &history_; *node; node = &(*node)->prev) {
+        history.emplace_back(*node, &(*node)->board);
+    }
+    std::reverse(std::begin(history), std::end(history));
+    return history;
 }
 
 std::vector<int> GameState::GetStringList(const int vtx) const {
@@ -864,18 +1040,32 @@ std::vector<bool> GameState::GetStrictSafeArea() const {
 }
 
 int GameState::GetFirstPassColor() const {
-    for (auto &board : game_history_) {
-        if (board->GetLastMove() == kPass) {
-            return !(board->GetToMove());
+    // Walk from the newest move, so the last found is the first pass.
+    int color = kInvalid;
+    for (auto node = history_.get(); node; node = node->prev.get()) {
+        if (node->board.GetLastMove() == kPass) {
+            color = !(node->board.GetToMove());
         }
     }
-    return kInvalid;
+    return color;
 }
 
 std::uint64_t GameState::ComputeSymmetryHash(const int symm) const {
     return board_.ComputeSymmetryHash(board_.GetKoMove(), symm) ^ komi_hash_;
 }
 
+std::uint64_t GameState::GetSymmetryHash(const int symm) const {
+    return board_.GetSymmetryHash(symm) ^ komi_hash_;
+}
+
+std::uint64_t GameState::GetCanonicalHash(int &symm) const {
+    return board_.GetCanonicalHash(symm) ^ komi_hash_;
+}
+
+int GameState::GetSymmetryMask() const {
+    return board_.GetSymmetryMask();
+}
+
 std::uint64_t GameState::ComputeSymmetryKoHash(const int symm) const {
     return board_.ComputeKoHash(symm);
 }
@@ -889,13 +1079,98 @@ void GameState::AppendComment(std::string c) {
 }
 
 std::string GameState::GetComment(size_t i) const {
-    if (i >= comments_.size()) {
+    auto node = history_.get();
+    while (node && (size_t)node->move_number > i) {
+        node = node->prev.get();
+    }
+    if (!node || (size_t)node->move_number != i) {
         return std::string{};
     }
-    return comments_[i];
+    return node->comment;
+}
+
+constexpr int GameState::kKoBloomBits;
+
+std::array<int, 2> GameState::GetKoBloomBits(std::uint64_t hash) {
+    // The Zobrist hash is random, so its bits are the independent
+    // indices.
+    return {static_cast<int>(hash % kKoBloomBits),
+            static_cast<int>((hash >> 32) % kKoBloomBits)};
+}
+
+bool GameState::MayRepeat(std::uint64_t hash) const {
+    // The bits set by the newest node are not of the older nodes.
+    for (const auto i : GetKoBloomBits(hash)) {
+        if (!((ko_bloom_[i / 64] >> (i % 64)) & 1) ||
+                i == history_->ko_bits[0] || i == history_->ko_bits[1]) {
+            return false;
+        }
+    }
+    return true;
 }
 
-void GameState::PushComment() {
-    comments_.emplace_back(last_comment_);
+std::vector<std::shared_ptr<GameState::HistoryNode>> &GameState::GetNodePool() {
+    thread_local auto pool = std::vector<std::shared_ptr<HistoryNode>>{};
+    return pool;
+}
+
+void GameState::PushHistory() {
+    auto &pool = GetNodePool();
+    auto node = std::shared_ptr<HistoryNode>{};
+
+    if (pool.empty()) {
+        node = std::make_shared<HistoryNode>();
+    } else {
+        node = std::move(pool.back());
+        pool.pop_back();
+    }
+    node->board = board_;
+    node->ko_hash = GetKoHash();
+    if (!history_) {
+        ko_bloom_.fill(0);
+    }
+    node->ko_bits.fill(-1);
+    const auto bits = GetKoBloomBits(node->ko_hash);
+    for (int b = 0; b < 2; ++b) {
+        const auto i = bits[b];
+        const auto mask = std::uint64_t{1} << (i % 64);
+        if (!(ko_bloom_[i / 64] & mask)) {
+            ko_bloom_[i / 64] |= mask;
+            node->ko_bits[b] = i;
+        }
+    }
+    node->move_number = move_number_;
+    node->comment = last_comment_;
+    node->prev = std::move(history_);
+
+    history_ = std::move(node);
     last_comment_.clear();
 }
+
+void GameState::PopHistory() {
+    // Keep the pool small. The search rarely plays more moves than
+    // this in one playout.
+    constexpr size_t kMaxPoolSize = 256;
+
+    auto node = std::move(history_);
+    history_ = node->prev;
+
+    // Clear the filter bits of this node. The older nodes did not
+    // set them.
+    for (const auto i : node->ko_bits) {
+        if (i >= 0) {
+            ko_bloom_[i / 64] &= ~(std::uint64_t{1} << (i % 64));
+        }
+    }
+
+    if (node.use_count() == 1) {
+        auto &pool = GetNodePool();
+        if (pool.size() < kMaxPoolSize) {
+            // No one else can see this node now, it is safe to
+            // change it.
+            auto reused = std::const_pointer_cast<HistoryNode>(node);
+            reused->prev.reset();
+            pool.emplace_back(std::move(reused));
+        }
+    }
+}
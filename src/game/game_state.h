@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <memory>
 #include <string>
@@ -24,6 +25,16 @@ public:
 
     bool UndoMove();
 
+    // Undo the last moves played by PlayMove. The board is restored
+    // once and the unshared history nodes are kept for the next moves
+    // of this thread, so the search can reuse one game state for every
+    // playout without allocating.
+    void UnmakeMoves(const int count);
+
+    // Return true if the both game states are at the same node of
+    // the same history.
+    bool IsSameHistory(const GameState &other) const;
+
     void SetKomi(float komi);
 
     void SetToMove(const int color);
@@ -67,14 +78,35 @@ public:
     bool IsSuperko() const;
     bool IsLegalMove(const int vertex) const;
     bool IsLegalMove(const int vertex, const int color) const;
+    template <typename F>
     bool IsLegalMove(const int vertex, const int color,
-                     std::function<bool(int, int)> AvoidToMove) const;
+                     const F &AvoidToMove) const {
+        return board_.IsLegalMove(vertex, color, AvoidToMove);
+    }
+
+    // The legal moves of the color without the pass, see
+    // Board::GetLegalBits().
+    const BitBoard &GetLegalBits(const int color) const;
 
     // Compute ownership with Tromp Taylor rule.
     std::vector<int> GetOwnership() const;
 
+    // Same as GetOwnership(), but the recent positions are cached in
+    // the small table of this thread. The search scores the same end
+    // positions many times. The reference is valid until the next
+    // call in this thread.
+    const std::vector<int> &GetCachedOwnership() const;
+
     std::vector<int> GetOwnershipAndRemovedDeadStrings(int playouts) const;
     std::vector<int> MarKDeadStrings(int playouts) const;
+
+    // Decide the strings with the black side ownership first. Only the
+    // strings whose average ownership is not larger than the threshold
+    // are decided by the random playouts. The playouts are skipped if
+    // there is no such string.
+    std::vector<int> MarKDeadStrings(int playouts,
+                                     const std::vector<float> &black_ownership,
+                                     const float threshold) const;
     void RemoveDeadStrings(int playouts);
     void RemoveDeadStrings(std::vector<int> &dead_list);
 
@@ -95,6 +127,9 @@ public:
     int GetPasses() const;
     std::uint64_t GetKoHash() const;
     std::uint64_t GetHash() const;
+
+    // The part of the hashes which is of the komi.
+    std::uint64_t GetKomiHash() const;
     int GetPrisoner(const int color) const;
     int GetState(const int vtx) const;
     int GetState(const int x, const int y) const;
@@ -104,9 +139,21 @@ public:
     std::uint64_t ComputeSymmetryHash(const int symm) const;
     std::uint64_t ComputeSymmetryKoHash(const int symm) const;
 
+    // The incrementally updated symmetry hashing. Same as
+    // ComputeSymmetryHash().
+    std::uint64_t GetSymmetryHash(const int symm) const;
+
+    // Get the minimal symmetry hashing and its symmetry.
+    std::uint64_t GetCanonicalHash(int &symm) const;
+
+    // Get the mask of the symmetries which keep the position unchanged.
+    int GetSymmetryMask() const;
+
     std::vector<int> GetAppendMoves(int color) const;
     std::shared_ptr<const Board> GetPastBoard(unsigned int p) const;
-    const std::vector<std::shared_ptr<const Board>>& GetHistory() const;
+
+    // Return all boards from the first move to the current move.
+    std::vector<std::shared_ptr<const Board>> GetHistory() const;
 
     void PlayRandomMove();
     float GetGammaValue(const int vtx, const int color) const;
@@ -130,15 +177,64 @@ private:
     // try to remove the dead string.
     void FillRandomMove();
 
-    void PushComment();
+    // Play the p-th random playout of the dead strings estimation and
+    // add its ownership into the buffer. Return false if the first
+    // playout passes at once, it means no dead strings is left.
+    bool PlayDeadStringsPlayout(const int p, std::vector<int> &buffer) const;
+
+    // Sum the ownership of the random playouts into the buffer. The
+    // playouts are split over the thread pool. Return the number of
+    // the counted playouts.
+    int ComputeDeadStringsOwnership(int playouts, std::vector<int> &buffer) const;
+
+    // Push the current board and the last comment to the history.
+    void PushHistory();
 
     std::string GetStateString() const;
 
-    std::vector<std::shared_ptr<const Board>> game_history_;
+    // The node of game history. The nodes are never changed after
+    // they are created, so the copied game states share the same
+    // nodes. Copying the game state only copies the newest node.
+    struct HistoryNode {
+        Board board;
+        std::uint64_t ko_hash;
+
+        // The bits of the ko filter which are set by this node. It
+        // is -1 if the bit was set by the older nodes.
+        std::array<std::int16_t, 2> ko_bits;
+
+        int move_number;
+        std::string comment;
+        std::shared_ptr<const HistoryNode> prev;
+    };
+
+    using HistoryNodePtr = std::shared_ptr<const HistoryNode>;
+
+    // The Bloom filter of the ko hashes in the history. Every hash
+    // sets two bits. The popped node clears the bits it set, so the
+    // filter always matches the history without copying it into the
+    // nodes.
+    static constexpr int kKoBloomBits = 4096;
+    using KoBloomFilter = std::array<std::uint64_t, kKoBloomBits / 64>;
+
+    // Return the two bits of the hash in the filter.
+    static std::array<int, 2> GetKoBloomBits(std::uint64_t hash);
+
+    // Return false if the hash is not in the history before the newest
+    // node.
+    bool MayRepeat(std::uint64_t hash) const;
+
+    // The recycled nodes of this thread.
+    static std::vector<std::shared_ptr<HistoryNode>> &GetNodePool();
+
+    // Pop the newest node. Give it back to the node pool of this thread
+    // if no one else holds it.
+    void PopHistory();
 
-    std::vector<std::string> comments_;
+    // The newest node, it is the current move.
+    HistoryNodePtr history_;
 
-    std::vector<std::uint64_t> ko_hash_history_;
+    KoBloomFilter ko_bloom_;
 
     std::vector<VertexColor> append_moves_;
 
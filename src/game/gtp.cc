@@ -1,68 +1,185 @@
 #include "game/gtp.h"
 #include "game/sgf.h"
 #include "game/commands_list.h"
+#include "game/book_expander.h"
 #include "utils/log.h"
 #include "utils/komi.h"
 #include "utils/gogui_helper.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
 #include "pattern/mm_trainer.h"
 #include "neural/supervised.h"
 #include "neural/encoder.h"
+#include "neural/loader.h"
+#include "neural/onnx_export.h"
 #include "accuracy/predict.h"
+#include "accuracy/evaluate.h"
 
 #include <iomanip>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <vector>
 #include <array>
 
-void GtpLoop::Loop() {
-    while (true) {
+GtpReader::GtpReader() {
+    shared_ = std::make_shared<Shared>();
+
+    auto shared = shared_;
+    std::thread([shared]() {
         auto input = std::string{};
-        if (std::getline(std::cin, input)) {
+        while (std::getline(std::cin, input)) {
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            shared->lines.emplace_back(input);
+            shared->pending.store(true, std::memory_order_release);
+            shared->cv.notify_one();
+        }
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        shared->closed = true;
+        shared->pending.store(true, std::memory_order_release);
+        shared->cv.notify_one();
+    }).detach();
+}
 
-            auto spt = Splitter(input);
-            WRITING << ">>" << ' ' << input << std::endl;
+bool GtpReader::Pop(std::string &line) {
+    std::unique_lock<std::mutex> lock(shared_->mutex);
+    shared_->cv.wait(lock, [this]() {
+                         return !shared_->lines.empty() || shared_->closed;
+                     });
+    if (shared_->lines.empty()) {
+        return false;
+    }
+    line = std::move(shared_->lines.front());
+    shared_->lines.pop_front();
+    shared_->pending.store(!shared_->lines.empty() || shared_->closed,
+                               std::memory_order_release);
+    return true;
+}
 
-            curr_id_ = -1;
+bool GtpReader::Peek(std::string &line) {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    if (shared_->lines.empty()) {
+        return false;
+    }
+    line = shared_->lines.front();
+    return true;
+}
 
-            // check the command id here
-            if (const auto token = spt.GetWord(0)) {
-                if (token->IsDigit()) {
-                    curr_id_ = token->Get<int>();
-                    spt.RemoveWord(token->Index());
-                }
-            }
+bool GtpReader::Pending() const {
+    return shared_->pending.load(std::memory_order_acquire);
+}
 
-            if (!spt.Valid()) {
-                continue;
-            }
+void GtpLoop::Loop() {
+    auto input = std::string{};
+    while (reader_.Pop(input)) {
+        auto spt = Splitter(input);
+        WRITING << ">>" << ' ' << input << std::endl;
 
-            auto out = std::string{};
-            auto stop = false;
-            auto try_ponder = false;
+        curr_id_ = ParseCommandId(spt);
 
-            if (spt.GetCount() == 1 && spt.Find("quit")) {
-                agent_->Quit();
-                out = GtpSuccess("");
-                stop = true;
-            }
+        if (!spt.Valid()) {
+            continue;
+        }
 
-            if (out.empty()) {
-                out = Execute(spt, try_ponder);
-            }
-            prev_pondering_ = try_ponder; // save the last pondering status
+        auto out = std::string{};
+        auto stop = false;
+        auto try_ponder = false;
 
-            if (!out.empty()) {
-                DUMPING << out;
-            }
+        if (spt.GetCount() == 1 && spt.Find("quit")) {
+            agent_->Quit();
+            out = GtpSuccess("");
+            stop = true;
+        }
 
-            if (stop) {
-                break;
-            }
-            if (try_ponder) {
-                agent_->GetSearch().TryPonder();
-            }
+        if (out.empty()) {
+            out = Execute(spt, try_ponder);
+        }
+        prev_pondering_ = try_ponder; // save the last pondering status
+
+        if (!out.empty()) {
+            DUMPING << out;
+        }
+
+        if (stop) {
+            return;
+        }
+        if (try_ponder) {
+            agent_->GetSearch().TryPonder();
+        }
+    }
+
+    // The stdin is closed.
+    agent_->Quit();
+}
+
+int GtpLoop::ParseCommandId(Splitter &spt) const {
+    if (const auto token = spt.GetWord(0)) {
+        if (token->IsDigit()) {
+            const auto id = token->Get<int>();
+            spt.RemoveWord(token->Index());
+            return id;
+        }
+    }
+    return -1;
+}
+
+bool GtpLoop::HandlePendingInput() {
+    auto input = std::string{};
+    if (!reader_.Peek(input)) {
+        return false;
+    }
+
+    auto spt = Splitter(input);
+    const auto id = ParseCommandId(spt);
+    auto &state = agent_->GetState();
+
+    if (const auto res = spt.Find("play", 0)) {
+        if (spt.GetCount() != 3) {
+            return false;
+        }
+        const auto color = state.TextToColor(spt.GetWord(1)->Get<>());
+        const auto vertex = state.TextToVertex(spt.GetWord(2)->Get<>());
+        if (color == kInvalid || vertex == kNullVertex ||
+                !agent_->GetSearch().PlayWhilePondering(vertex, color)) {
+            return false;
+        }
+    } else if (const auto res = spt.Find({"analyze",
+                                              "lz-analyze",
+                                              "kata-analyze",
+                                              "sayuri-analyze"}, 0)) {
+        auto color = state.GetToMove();
+        auto config = ParseAnalysisConfig(spt, color);
+        if (color != state.GetToMove() ||
+                !agent_->GetSearch().ContinueAnalysis(config)) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    // The command is taken by the search.
+    reader_.Pop(input);
+    WRITING << ">>" << ' ' << input << std::endl;
+
+    CloseAnalysis();
+    curr_id_ = id;
+    if (spt.Find("play", 0)) {
+        DUMPING << GtpSuccess("");
+    } else {
+        if (curr_id_ >= 0) {
+            DUMPING << "=" << curr_id_ << "\n";
+        } else {
+            DUMPING << "=\n";
         }
+        analysis_open_ = true;
+    }
+    return true;
+}
+
+void GtpLoop::CloseAnalysis() {
+    if (analysis_open_) {
+        DUMPING << "\n";
+        analysis_open_ = false;
     }
 }
 
@@ -99,7 +216,9 @@ std::string GtpLoop::Execute(Splitter &spt, bool &try_ponder) {
         }
     } else if (const auto res = spt.Find("clear_board", 0)){
         agent_->GetSearch().ReleaseTree();
+        agent_->GetSearch().ClearTranspositionTable();
         agent_->GetNetwork().ClearCache();
+        agent_->GetNetwork().UpdateWeights();
         agent_->GetState().ClearBoard();
         out << GtpSuccess("");
     } else if (const auto res = spt.Find("komi", 0)) {
@@ -274,12 +393,33 @@ std::string GtpLoop::Execute(Splitter &spt, bool &try_ponder) {
         out << GtpSuccess(std::to_string(agent_->GetState().GetHandicap()));
     } else if (const auto res = spt.Find("query_boardsize", 0)) {
         out << GtpSuccess(std::to_string(agent_->GetState().GetBoardSize()));
+    } else if (const auto res = spt.Find({"save_tree", "load_tree"}, 0)) {
+        auto filename = std::string{};
+        if (const auto input = spt.GetWord(1)) {
+            filename = input->Get<>();
+        }
+        if (filename.empty()) {
+            out << GtpFail("invalid file name");
+        } else if (res->Get<>() == "save_tree") {
+            if (agent_->GetSearch().SaveTree(filename)) {
+                out << GtpSuccess("");
+            } else {
+                out << GtpFail("fail to save the tree");
+            }
+        } else {
+            if (agent_->GetSearch().LoadTree(filename)) {
+                out << GtpSuccess("");
+            } else {
+                out << GtpFail("fail to load the tree of current position");
+            }
+        }
     } else if (const auto res = spt.Find("clear_cache", 0)) {
         agent_->GetSearch().ReleaseTree();
+        agent_->GetSearch().ClearTranspositionTable();
         agent_->GetNetwork().ClearCache();
         out << GtpSuccess("");
     } else if (const auto res = spt.Find("final_score", 0)) {
-        auto result = agent_->GetSearch().Computation(400, Search::kForced);
+        auto result = agent_->GetSearch().ScoringComputation();
         auto color = agent_->GetState().GetToMove();
         auto final_score = result.root_final_score;
 
@@ -377,8 +517,9 @@ std::string GtpLoop::Execute(Splitter &spt, bool &try_ponder) {
         }
 
         agent_->GetState().SetToMove(color);
+        analysis_open_ = true;
         agent_->GetSearch().Analyze(true, config);
-        DUMPING << "\n";
+        CloseAnalysis();
     } else if (const auto res = spt.Find({"genmove_analyze",
                                              "lz-genmove_analyze",
                                              "kata-genmove_analyze",
@@ -474,7 +615,7 @@ std::string GtpLoop::Execute(Splitter &spt, bool &try_ponder) {
         }
         try_ponder = true;
     } else if (const auto res = spt.Find("final_status_list", 0)) {
-        auto result = agent_->GetSearch().Computation(400, Search::kForced);
+        auto result = agent_->GetSearch().ScoringComputation();
         auto vtx_list = std::ostringstream{};
 
         // TODO: support seki option.
@@ -595,18 +736,114 @@ std::string GtpLoop::Execute(Splitter &spt, bool &try_ponder) {
         } else {
             out << GtpFail("symmetry must be from 0 to 7");
         }
+    } else if (const auto res = spt.Find("batch_stats", 0)) {
+        const auto stats = agent_->GetNetwork().GetPipeStats();
+        if (stats.empty()) {
+            out << GtpFail("the backend does not batch the inputs");
+        } else {
+            out << GtpSuccess("Batch Statistics:\n" + stats);
+        }
+    } else if (const auto res = spt.Find("sayuri-stats", 0)) {
+        auto stats = Metrics::GetPrometheusString();
+
+        // The empty line ends the GTP response.
+        if (!stats.empty() && stats.back() == '\n') {
+            stats.pop_back();
+        }
+        out << GtpSuccess(stats);
+    } else if (const auto res = spt.Find("sayuri-memory", 0)) {
+        out << GtpSuccess(agent_->GetSearch().GetMemoryReport());
+    } else if (const auto res = spt.Find("sayuri-memory-plan", 0)) {
+        int ram_mib = 0;
+        int vram_mib = 0;
+
+        if (const auto input = spt.GetWord(1)) {
+            ram_mib = input->Get<int>();
+        }
+        if (const auto input = spt.GetWord(2)) {
+            vram_mib = input->Get<int>();
+        }
+
+        if (ram_mib <= 0 || vram_mib < 0) {
+            out << GtpFail("the budget must be positive MiB");
+        } else {
+            out << GtpSuccess(agent_->GetSearch().GetMemoryPlan(ram_mib, vram_mib));
+        }
+    } else if (const auto res = spt.Find("sayuri-trace", 0)) {
+        auto trace_file = std::string{};
+        if (const auto input = spt.GetWord(1)) {
+            trace_file = input->Get<>();
+        }
+
+        if (!Trace::Enabled()) {
+            out << GtpFail("build it with -DUSE_TRACE=1 to record the trace");
+        } else if (trace_file.empty()) {
+            out << GtpFail("file name is empty");
+        } else if (!Trace::DumpChromeJson(trace_file)) {
+            out << GtpFail("fail to write the trace file");
+        } else {
+            Trace::Clear();
+            out << GtpSuccess("");
+        }
     } else if (const auto res = spt.Find("raw-nn", 0)) {
         int symmetry = Symmetry::kIdentitySymmetry;
+        bool average = false;
 
         if (const auto symm = spt.GetWord(1)) {
-            symmetry = symm->Get<int>();
+            if (symm->Get<>() == "average") {
+                average = true;
+            } else {
+                symmetry = symm->Get<int>();
+            }
         }
 
-        if (symmetry <= 8 && symmetry >= 0) {
+        if (average) {
+            out << GtpSuccess(agent_->GetNetwork().GetOutputString(agent_->GetState(), Network::kAverage));
+        } else if (symmetry < 8 && symmetry >= 0) {
             out << GtpSuccess(agent_->GetNetwork().GetOutputString(agent_->GetState(), Network::kDirect, symmetry));   
         } else {
             out << GtpFail("symmetry must be from 0 to 7");
         }
+    } else if (const auto res = spt.Find("raw-nn-batch", 0)) {
+        auto input_file = std::string{};
+        auto output_file = std::string{};
+
+        if (const auto input = spt.GetWord(1)) {
+            input_file = input->Get<>();
+        }
+        if (const auto output = spt.GetWord(2)) {
+            output_file = output->Get<>();
+        }
+
+        if (input_file.empty() || output_file.empty()) {
+            out << GtpFail("file name is empty");
+        } else {
+            auto report = EvaluatePositions(agent_->GetNetwork(),
+                                                agent_->GetState().GetBoardSize(),
+                                                input_file, output_file);
+            out << GtpSuccess(report);
+        }
+    } else if (const auto res = spt.Find("raw-nn-komi", 0)) {
+        auto komis = std::vector<float>{};
+        for (int i = 1; i < (int)spt.GetCount(); ++i) {
+            komis.emplace_back(spt.GetWord(i)->Get<float>());
+        }
+
+        if (komis.empty()) {
+            out << GtpFail("komi list is empty");
+        } else {
+            const auto results = agent_->GetNetwork().GetKomiOutputs(agent_->GetState(), komis);
+            auto lines = std::string{};
+            for (const auto &result : results) {
+                lines += Format("komi %.1f: wdl winrate %.6f, draw %.6f, stm winrate %.6f, final score %.4f\n",
+                                    result.komi, result.wdl_winrate, result.wdl[1],
+                                    result.stm_winrate, result.final_score);
+            }
+
+            // The empty line ends the GTP response.
+            lines.pop_back();
+            out << GtpSuccess(lines);
+        }
     } else if (const auto res = spt.Find("benchmark", 0)) {
         int playouts = 3200;
 
@@ -624,10 +861,50 @@ std::string GtpLoop::Execute(Splitter &spt, bool &try_ponder) {
         benchmark_out <<  "Benchmark Result:\n"
                           << Format("Use %d threads, the batch size is %d.\n",
                                         result.threads, result.batch_size)
-                          << Format("Do %d playouts in %.2f sec.",
-                                        result.playouts, result.seconds);
+                          << Format("Do %d playouts in %.2f sec, %.1f playouts per second.",
+                                        result.playouts, result.seconds,
+                                        result.playouts / std::max(result.seconds, 1e-3f));
 
         out << GtpSuccess(benchmark_out.str());
+    } else if (const auto res = spt.Find("benchmark_selection", 0)) {
+        int playouts = 3200;
+        int iterations = 1000;
+
+        if (const auto p = spt.GetWord(1)) {
+            playouts = std::max(p->Get<int>(), 1);
+        }
+        if (const auto i = spt.GetWord(2)) {
+            iterations = std::max(i->Get<int>(), 1);
+        }
+
+        agent_->GetNetwork().ClearCache();
+        auto result = agent_->GetSearch().BenchmarkSelection(playouts, iterations);
+
+        out << GtpSuccess("Selection Benchmark Result:\n" + result);
+    } else if (const auto res = spt.Find("benchmark_update", 0)) {
+        int threads = 16;
+        int updates = 100000;
+
+        if (const auto t = spt.GetWord(1)) {
+            threads = std::max(t->Get<int>(), 1);
+        }
+        if (const auto u = spt.GetWord(2)) {
+            updates = std::max(u->Get<int>(), 1);
+        }
+
+        auto result = agent_->GetSearch().BenchmarkUpdate(threads, updates);
+
+        out << GtpSuccess("Update Benchmark Result:\n" + result);
+    } else if (const auto res = spt.Find("benchmark_gammas", 0)) {
+        int rounds = 1000;
+
+        if (const auto r = spt.GetWord(1)) {
+            rounds = std::max(r->Get<int>(), 1);
+        }
+
+        auto result = GammasDict::Get().Benchmark(agent_->GetState(), rounds);
+
+        out << GtpSuccess("Gammas Benchmark Result:\n" + result);
     } else if (const auto res = spt.Find("genbook", 0)) {
         auto sgf_file = std::string{};
         auto data_file = std::string{};
@@ -645,6 +922,28 @@ std::string GtpLoop::Execute(Splitter &spt, bool &try_ponder) {
         } else {
             out << GtpFail("file name is empty");
         }
+    } else if (const auto res = spt.Find("expandbook", 0)) {
+        auto book_file = std::string{};
+        int playouts = 800;
+        int max_positions = 1000;
+
+        if (const auto book = spt.GetWord(1)) {
+            book_file = book->Get<>();
+        }
+        if (const auto p = spt.GetWord(2)) {
+            playouts = std::max(p->Get<int>(), 1);
+        }
+        if (const auto m = spt.GetWord(3)) {
+            max_positions = std::max(m->Get<int>(), 1);
+        }
+
+        if (!book_file.empty()) {
+            ExpandBook(agent_->GetNetwork(), agent_->GetState(),
+                           playouts, max_positions, book_file);
+            out << GtpSuccess("");
+        } else {
+            out << GtpFail("file name is empty");
+        }
     } else if (const auto res = spt.Find("genpatterns", 0)) {
         auto sgf_file = std::string{};
         auto data_file = std::string{};
@@ -682,6 +981,98 @@ std::string GtpLoop::Execute(Splitter &spt, bool &try_ponder) {
             predict_out << Format("the accuracy %.2f%", acc * 100);
             out << GtpSuccess(predict_out.str());
         }
+    } else if (const auto res = spt.Find("raw-nn-accuracy", 0)) {
+        auto sgf_file = std::string{};
+
+        if (const auto sgf = spt.GetWord(1)) {
+            sgf_file = sgf->Get<>();
+        }
+
+        if (sgf_file.empty()) {
+            out << GtpFail("file name is empty");
+        } else {
+            auto report = PredictSgfRawAccuracy(agent_->GetNetwork(),
+                                                    agent_->GetState().GetBoardSize(),
+                                                    sgf_file);
+            out << GtpSuccess("Raw Network Accuracy:\n" + report);
+        }
+    } else if (const auto res = spt.Find("load_weights", 0)) {
+        auto weights_file = std::string{};
+        if (const auto input = spt.GetWord(1)) {
+            weights_file = input->Get<>();
+        }
+
+        if (weights_file.empty()) {
+            out << GtpFail("file name is empty");
+        } else if (!agent_->GetNetwork().LoadWeightsAsync(weights_file)) {
+            out << GtpFail("the other weights are loading");
+        } else {
+            // The new weights are swapped in at the next clear_board.
+            out << GtpSuccess("");
+        }
+    } else if (const auto res = spt.Find("convert_weights", 0)) {
+        auto input_file = std::string{};
+        auto output_file = std::string{};
+
+        if (const auto input = spt.GetWord(1)) {
+            input_file = input->Get<>();
+        }
+        if (const auto output = spt.GetWord(2)) {
+            output_file = output->Get<>();
+        }
+
+        if (input_file.empty() || output_file.empty()) {
+            out << GtpFail("file name is empty");
+        } else {
+            const auto err = DNNLoder::Get().ConvertToMapped(input_file, output_file);
+            if (err.empty()) {
+                out << GtpSuccess("");
+            } else {
+                out << GtpFail(err);
+            }
+        }
+    } else if (const auto res = spt.Find("export_onnx", 0)) {
+        auto input_file = std::string{};
+        auto output_file = std::string{};
+        int board_size = agent_->GetState().GetBoardSize();
+
+        if (const auto input = spt.GetWord(1)) {
+            input_file = input->Get<>();
+        }
+        if (const auto output = spt.GetWord(2)) {
+            output_file = output->Get<>();
+        }
+        if (const auto size = spt.GetWord(3)) {
+            board_size = size->Get<int>();
+        }
+
+        if (input_file.empty() || output_file.empty()) {
+            out << GtpFail("file name is empty");
+        } else if (board_size < kMinGTPBoardSize || board_size > kBoardSize) {
+            out << GtpFail("invalid board size");
+        } else {
+            const auto err = ExportOnnx(input_file, output_file, board_size);
+            if (err.empty()) {
+                out << GtpSuccess("");
+            } else {
+                out << GtpFail(err);
+            }
+        }
+    } else if (const auto res = spt.Find("precision_drift", 0)) {
+        auto sgf_file = std::string{};
+
+        if (const auto sgf = spt.GetWord(1)) {
+            sgf_file = sgf->Get<>();
+        }
+
+        if (sgf_file.empty()) {
+            out << GtpFail("file name is empty");
+        } else if (!agent_->GetNetwork().ReducedPrecision()) {
+            out << GtpFail("the network computes with the full precision");
+        } else {
+            auto drift = PredictSgfPrecisionDrift(agent_->GetNetwork(), sgf_file);
+            out << GtpSuccess("Precision Drift:\n" + drift);
+        }
     } else if (const auto res = spt.Find("gogui-analyze_commands", 0)) {
         auto gogui_cmds = std::ostringstream{};
 
@@ -1132,6 +1523,16 @@ AnalysisConfig GtpLoop::ParseAnalysisConfig(Splitter &spt, int &color) {
             continue;
         }
 
+        if (token->Lower() == "binary") {
+            if (auto true_token = spt.GetWord(curr_idx)) {
+                if (true_token->Lower() == "true") {
+                    config.binary = true;
+                    curr_idx += 1;
+                }
+            }
+            continue;
+        }
+
         if (token->Lower() == "minmoves") {
             // Current the analysis mode do not support this tag.
             if (auto num_token = spt.GetWord(curr_idx)) {
@@ -1143,6 +1544,16 @@ AnalysisConfig GtpLoop::ParseAnalysisConfig(Splitter &spt, int &color) {
             continue;
         }
 
+        if (token->Lower() == "multipv") {
+            if (auto num_token = spt.GetWord(curr_idx)) {
+                if (num_token->IsDigit()) {
+                    config.multi_pv = num_token->Get<int>();
+                    curr_idx += 1;
+                }
+            }
+            continue;
+        }
+
         if (token->Lower() == "maxmoves") {
             if (auto num_token = spt.GetWord(curr_idx)) {
                 if (num_token->IsDigit()) {
@@ -9,13 +9,51 @@
 #include "utils/splitter.h"
 #include "utils/threadpool.h"
 #include "utils/format.h"
+#include "utils/log.h"
+#include "utils/time.h"
 #include "pattern/gammas_dict.h"
 #include "version.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <string>
 
 class Search;
 
+// Read the GTP commands from stdin on its own thread. The search can
+// check the pending commands without polling stdin, and take some of
+// them without stopping.
+class GtpReader {
+public:
+    GtpReader();
+
+    // Wait for the next line. Return false if stdin is closed and
+    // all lines are taken.
+    bool Pop(std::string &line);
+
+    // Copy the next line without taking it. Return false if there
+    // is no line now.
+    bool Peek(std::string &line);
+
+    // Return true if there is a line, or stdin is closed.
+    bool Pending() const;
+
+private:
+    // The reader thread is detached because it may block on stdin
+    // forever. It shares these with the reader.
+    struct Shared {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::string> lines;
+        bool closed{false};
+        std::atomic<bool> pending{false};
+    };
+    std::shared_ptr<Shared> shared_;
+};
+
 class GtpLoop {
 public:
     class Agent {
@@ -54,13 +92,29 @@ public:
         agent_ = std::make_unique<Agent>();
         agent_->GetState().Reset(GetOption<int>("defualt_boardsize"),
                                      GetOption<float>("defualt_komi"));
-        agent_->GetNetwork().Initialize(GetOption<std::string>("weights_file"));
+        // The book and the patterns are loaded while the network
+        // loads the weights.
+        auto &profile = StartupProfile::Get();
+        auto book = profile.Launch("book", []() {
+            Book::Get().LoadBook(GetOption<std::string>("book_file"));
+        });
+        auto gammas = profile.Launch("gammas", []() {
+            GammasDict::Get().Initialize(GetOption<std::string>("patterns_file"));
+        });
+        profile.Run("network", [this]() {
+            agent_->GetNetwork().Initialize(GetOption<std::string>("weights_file"));
+        });
         agent_->ApplySearch();
+        agent_->GetSearch().SetInputHooks(
+            [this]() { return reader_.Pending(); },
+            [this]() { return HandlePendingInput(); });
 
         ThreadPool::Get(GetOption<int>("threads"));
 
-        Book::Get().LoadBook(GetOption<std::string>("book_file"));
-        GammasDict::Get().Initialize(GetOption<std::string>("patterns_file"));
+        book.get();
+        gammas.get();
+        LOGGING << profile.ToString() << '\n';
+        LOGGING << "Memory:\n" << agent_->GetSearch().GetMemoryReport() << '\n';
 
         auto kgs_hint = GetOption<std::string>("kgs_hint");
         if (kgs_hint.empty()) {
@@ -77,6 +131,7 @@ public:
         }
         curr_id_ = -1;
         prev_pondering_ = false;
+        analysis_open_ = false;
 
         Loop();
     }
@@ -93,9 +148,27 @@ private:
 
     std::string Execute(Splitter &spt, bool &try_ponder);
 
+    // Remove the command id from the command and return it. Return -1
+    // if there is no id.
+    int ParseCommandId(Splitter &spt) const;
+
+    // Take the pending play or analysis command while pondering, so the
+    // search goes on with the reused tree. It is called by the search
+    // with all workers stopped. Return false if the search should stop
+    // and the command is executed as usual.
+    bool HandlePendingInput();
+
+    // End the response of the running analysis command.
+    void CloseAnalysis();
+
     std::unique_ptr<Agent> agent_{nullptr};
 
+    GtpReader reader_;
+
     int curr_id_;
     bool prev_pondering_;
+
+    // True if the analysis response is not ended.
+    bool analysis_open_;
     std::string version_verbose_;
 };
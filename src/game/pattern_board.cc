@@ -270,6 +270,44 @@ bool Board::MatchPattern3(const int vtx) const {
 }
 
 std::uint16_t Board::GetPattern3Hash(const int vtx) const {
+    assert(pattern3_[vtx] == ComputePattern3Hash(vtx));
+    return pattern3_[vtx];
+}
+
+std::uint32_t Board::GetPattern3AtariHash(const int vtx) const {
+    auto hash = std::uint32_t{pattern3_[vtx]};
+
+    for (int k = 0; k < 4; ++k) {
+        const auto avtx = vtx + directions_[k];
+        const auto color = state_[avtx];
+        if ((color == kBlack || color == kWhite) &&
+                GetLiberties(avtx) == 1) {
+            hash |= std::uint32_t{1} << (16 + k);
+        }
+    }
+    return hash;
+}
+
+void Board::UpdatePattern3(const int vtx, const int color) {
+    const int size = letter_box_size_;
+
+    // The vertex is at this position of the neighbor's pattern,
+    // see ComputePattern3Hash().
+    const int offsets[8] = {
+        -size+1, -size, -size-1,
+        +1,             -1,
+        +size+1, +size, +size-1
+    };
+    for (int i = 0; i < 8; ++i) {
+        const int shift = 2 * i;
+        const int nvtx = vtx + offsets[i];
+        if (state_[nvtx] != kInvalid) {
+            pattern3_[nvtx] = (pattern3_[nvtx] & ~(3 << shift)) | (color << shift);
+        }
+    }
+}
+
+std::uint16_t Board::ComputePattern3Hash(const int vtx) const {
     int size = letter_box_size_;
     int buf[9];
 
@@ -2,8 +2,11 @@
 #include "game/types.h"
 #include "utils/log.h"
 #include "utils/time.h"
+#include "utils/mapped_file.h"
 
 #include <ctype.h>
+#include <fstream>
+#include <iterator>
 #include <limits>
 
 void SgfNode::AddProperty(std::string property, std::string value) {
@@ -40,30 +43,33 @@ void SgfNode::InitState() {
     GetState().ClearBoard();
 }
 
-int SgfNode::GetVertexFromString(const std::string& movestring) {
-    if (movestring.empty()) {
+namespace {
+
+// Convert the SGF coordinate to the vertex of the state's board.
+int SgfCoordToVertex(const GameState &state, const char *str, size_t len) {
+    if (len == 0) {
         return kPass;
     }
 
-    int bsize = GetState().GetBoardSize();
+    int bsize = state.GetBoardSize();
 
     if (bsize <= 0) {
         throw "Node has 0 sized board";
     }
 
-    if (movestring.size() != 2) {
+    if (len != 2) {
         throw "Illegal SGF move format";
     }
 
+    char c1 = str[0];
+    char c2 = str[1];
+
     if (bsize <= 19) {
-        if (movestring.find("tt") == 0) {
+        if (c1 == 't' && c2 == 't') {
             return kPass;
         }
     }
 
-    char c1 = movestring[0];
-    char c2 = movestring[1];
-
     int cc1;
     int cc2;
 
@@ -84,9 +90,13 @@ int SgfNode::GetVertexFromString(const std::string& movestring) {
         throw "Illegal SGF move format";
     }
 
-    int vtx = GetState().GetVertex(cc1, cc2);
+    return state.GetVertex(cc1, cc2);
+}
+
+} // namespace
 
-    return vtx;
+int SgfNode::GetVertexFromString(const std::string& movestring) {
+    return SgfCoordToVertex(GetState(), movestring.data(), movestring.size());
 }
 
 void SgfNode::PopulateState(GameState currstate) {
@@ -242,81 +252,66 @@ GameState SgfNode::GetMainLineState(unsigned int movenum) {
     return main_state;
 }
 
-std::string SgfParser::ParsePropertyName(std::istringstream & strm) const {
-    auto result = std::ostringstream{};
+std::string SgfParser::ParsePropertyName(const char *&ptr, const char *end) const {
+    auto result = std::string{};
 
-    auto c = char{};
-    while (strm >> c) {
-        // SGF property names are guaranteed to be uppercase,
-        // except that some implementations like IGS are retarded
-        // and don't folow the spec. So allow both upper/lowercase.
-        if (!std::isupper(c) && !std::islower(c)) {
-            strm.unget();
-            break;
-        } else {
-            result << c;
-        }
+    // SGF property names are guaranteed to be uppercase,
+    // except that some implementations like IGS are retarded
+    // and don't folow the spec. So allow both upper/lowercase.
+    while (ptr < end && std::isalpha((unsigned char)*ptr)) {
+        result.push_back(*ptr++);
     }
-
-    return result.str();
+    return result;
 }
 
-std::string SgfParser::ParsePropertyValue(std::istringstream &strm, bool &success) const {
-    strm >> std::noskipws;
-    auto c = char{};
-
-    while (strm >> c) {
-        if (!std::isspace(c)) {
-            strm.unget();
-            break;
-        }
+std::string SgfParser::ParsePropertyValue(const char *&ptr, const char *end, bool &success) const {
+    while (ptr < end && std::isspace((unsigned char)*ptr)) {
+        ++ptr;
     }
 
-    strm >> c;
-
-    if (c != '[') {
-        strm.unget();
+    if (ptr >= end || *ptr != '[') {
         success = false;
         return std::string{};
     }
+    ++ptr;
 
-    auto result = std::ostringstream{};
+    auto result = std::string{};
 
-    while (strm >> c) {
+    while (ptr < end) {
+        auto c = *ptr++;
         if (c == ']') {
             break;
         } else if (c == '\\') {
-            strm >> c;
+            if (ptr >= end) {
+                break;
+            }
+            c = *ptr++;
         }
-        result << c;
+        result.push_back(c);
     }
 
-    strm >> std::skipws;
     success = true;
-    return result.str();
+    return result;
 }
 
-void SgfParser::Parse(std::istringstream &strm, SgfNode* node) const {
+void SgfParser::Parse(const char *&ptr, const char *end, SgfNode* node) const {
     auto splitpoint = false;
-    auto c = char{};
 
-    while (strm >> c) {
-        if (strm.fail()) {
-            return;
-        }
+    while (ptr < end) {
+        const auto c = *ptr++;
 
-        if (std::isspace(c)) {
+        if (std::isspace((unsigned char)c)) {
             continue;
         }
 
         // parse a property
-        if (std::isalpha(c) && std::isupper(c)) {
-            strm.unget();
+        if (std::isupper((unsigned char)c)) {
+            --ptr;
 
-            auto propname = ParsePropertyName(strm);
+            auto propname = ParsePropertyName(ptr, end);
             do {
                 auto success = false;
-                auto propval = ParsePropertyValue(strm, success);
+                auto propval = ParsePropertyValue(ptr, end, success);
                 if (success) {
                     node->AddProperty(propname, propval);
                 } else {
@@ -329,12 +324,11 @@ void SgfParser::Parse(std::istringstream &strm, SgfNode* node) const {
 
         if (c == '(') {
             // eat first ;
-            auto cc = char{};
-            do {
-                strm >> cc;
-            } while (std::isspace(cc));
-            if (cc != ';') {
-                strm.unget();
+            while (ptr < end && std::isspace((unsigned char)*ptr)) {
+                ++ptr;
+            }
+            if (ptr < end && *ptr == ';') {
+                ++ptr;
             }
 
             // start a variation here
@@ -342,14 +336,14 @@ void SgfParser::Parse(std::istringstream &strm, SgfNode* node) const {
 
             // new node
             auto newptr = node->AddChild();
-            Parse(strm, newptr);
+            Parse(ptr, end, newptr);
         } else if (c == ')') {
             // variation ends, go back
             // if the variation didn't start here, then
             // push the "variation ends" mark back
             // and try again one level up the tree
             if (!splitpoint) {
-                strm.unget();
+                --ptr;
                 return;
             } else {
                 splitpoint = false;
@@ -364,25 +358,34 @@ void SgfParser::Parse(std::istringstream &strm, SgfNode* node) const {
     }
 }
 
-std::vector<std::string> SgfParser::ChopStream(std::istream& ins, size_t stopat) const {
-    auto result = std::vector<std::string>{};
+size_t SgfParser::ChopBuffer(const char *data, size_t size, size_t offset,
+                                 std::function<bool(std::string &, size_t)> func) const {
     auto gamebuff = std::string{};
 
-    ins >> std::noskipws;
-
     int nesting = 0;      // parentheses
     bool intag = false;   // brackets
     int line = 0;
+    bool found = false;
+
+    size_t pos = offset;
+    const auto Next = [&](char &c) -> bool {
+        if (pos >= size) {
+            return false;
+        }
+        c = data[pos++];
+        return true;
+    };
 
     auto c = char{};
-    while (ins >> c && result.size() <= stopat) {
+    while (Next(c)) {
         if (c == '\n') line++;
 
         gamebuff.push_back(c);
         if (c == '\\') {
             // read literal char
-            ins >> c;
-            gamebuff.push_back(c);
+            if (Next(c)) {
+                gamebuff.push_back(c);
+            }
             // Skip special char parsing
             continue;
         }
@@ -391,7 +394,9 @@ std::vector<std::string> SgfParser::ChopStream(std::istream& ins, size_t stopat)
             if (nesting == 0) {
                 // eat ; too
                 do {
-                    ins >> c;
+                    if (!Next(c)) {
+                        break;
+                    }
                 } while (std::isspace(c) && c != ';');
                 gamebuff.clear();
             }
@@ -400,7 +405,11 @@ std::vector<std::string> SgfParser::ChopStream(std::istream& ins, size_t stopat)
             nesting--;
 
             if (nesting == 0) {
-                result.push_back(gamebuff);
+                found = true;
+                if (!func(gamebuff, pos)) {
+                    return pos;
+                }
+                gamebuff.clear();
             }
         } else if (c == '[' && !intag) {
             intag = true;
@@ -413,24 +422,39 @@ std::vector<std::string> SgfParser::ChopStream(std::istream& ins, size_t stopat)
     }
 
     // No game found? Assume closing tag was missing (OGS)
-    if (result.empty()) {
-        result.push_back(gamebuff);
+    if (!found && offset == 0) {
+        func(gamebuff, pos);
     }
 
-    return result;
+    return pos;
 }
 
-std::vector<std::string> SgfParser::ChopAll(std::string filename,
-                                            size_t stopat) const {
-    std::ifstream ins(filename.c_str(), std::ifstream::binary | std::ifstream::in);
+size_t SgfParser::ChopFile(std::string filename, size_t offset,
+                               std::function<bool(std::string &, size_t)> func) const {
+    MappedFile mapped;
+    if (mapped.Open(filename)) {
+        return ChopBuffer(mapped.Data(), mapped.Size(), offset, func);
+    }
 
+    // Fail to map it, may be an empty file. Read it into the
+    // memory instead.
+    std::ifstream ins(filename.c_str(), std::ifstream::binary | std::ifstream::in);
     if (ins.fail()) {
         throw "Error opening file";
     }
+    auto buf = std::string(std::istreambuf_iterator<char>(ins),
+                               std::istreambuf_iterator<char>());
+    return ChopBuffer(buf.data(), buf.size(), offset, func);
+}
 
-    auto result = ChopStream(ins, stopat);
-    ins.close();
-
+std::vector<std::string> SgfParser::ChopAll(std::string filename,
+                                            size_t stopat) const {
+    auto result = std::vector<std::string>{};
+    ChopFile(filename, 0,
+        [&](std::string &sgf, size_t) {
+            result.emplace_back(std::move(sgf));
+            return result.size() <= stopat;
+        });
     return result;
 }
 
@@ -457,25 +481,260 @@ std::unique_ptr<SgfNode> SgfParser::ParseFromFile(std::string filename, size_t i
 
 std::unique_ptr<SgfNode> SgfParser::ParseFromString(std::string sgfstring) const {
     auto rootnode = std::make_unique<SgfNode>();
-    auto gamebuff = std::istringstream{sgfstring};
-    Parse(gamebuff, rootnode.get());
+    const char *ptr = sgfstring.data();
+    Parse(ptr, ptr + sgfstring.size(), rootnode.get());
     rootnode->StartPopulateState();
     return rootnode;
 }
 
+namespace {
+
+// The root properties which the main line needs. Only the first value
+// is kept, except the setup stones.
+struct SgfRootProperties {
+    bool has_gm{false}, has_sz{false}, has_km{false};
+    bool has_ha{false}, has_re{false}, has_pl{false};
+    std::string gm, sz, km, ha, re, pl;
+    std::vector<std::string> ab, aw;
+};
+
+// Set up the state from the root properties. It is the same as
+// SgfNode::PopulateState().
+void ApplyRootProperties(GameState &state, const SgfRootProperties &root) {
+    if (root.has_gm) {
+        if (std::stoi(root.gm) != 1) {
+            throw "SGF Game is not a Go game";
+        }
+    }
+
+    if (root.has_sz) {
+        for (const char c : root.sz) {
+            if (!std::isspace(c) && !std::isdigit(c)) throw "It is not a square board";
+        }
+
+        const auto bsize = std::stoi(root.sz);
+        state.Reset(bsize, state.GetKomi());
+    }
+
+    if (root.has_km) {
+        state.SetKomi(std::stof(root.km));
+    }
+
+    if (root.has_ha) {
+        const auto handicap = std::stoi(root.ha);
+        const auto is_free_handicap = !root.ab.empty() || !root.aw.empty();
+        if (!is_free_handicap) {
+            state.SetFixdHandicap(handicap);
+        } else {
+            state.SetHandicap(handicap);
+        }
+    }
+
+    for (const auto &move : root.ab) {
+        const auto vtx = SgfCoordToVertex(state, move.data(), move.size());
+        state.AppendMove(vtx, kBlack);
+    }
+    for (const auto &move : root.aw) {
+        const auto vtx = SgfCoordToVertex(state, move.data(), move.size());
+        state.AppendMove(vtx, kWhite);
+    }
+
+    if (root.has_re) {
+        if (root.re.find("B+") != std::string::npos) {
+            state.SetWinner(kBlackWon);
+        } else if (root.re.find("W+") != std::string::npos) {
+            state.SetWinner(kWhiteWon);
+        } else if (root.re.find("0") != std::string::npos) {
+            state.SetWinner(kDraw);
+        } else {
+            state.SetWinner(kUndecide);
+        }
+    }
+
+    if (root.has_pl) {
+        if (root.pl == "B") {
+            state.SetToMove(kBlack);
+        } else if (root.pl == "W") {
+            state.SetToMove(kWhite);
+        }
+    }
+}
+
+} // namespace
+
+GameState SgfParser::ParseMainLine(const std::string &sgfstring, unsigned int movenum) const {
+    const char *ptr = sgfstring.data();
+    const char *const end = ptr + sgfstring.size();
+
+    auto state = GameState{};
+    state.ClearBoard();
+
+    auto root = SgfRootProperties{};
+    auto in_root = true;
+    auto played = 0u;
+
+    // The buffers are reused by every node, so the short values
+    // never allocate.
+    auto name = std::string{};
+    auto value = std::string{};
+    auto black_move = std::string{};
+    auto white_move = std::string{};
+    auto has_black = false;
+    auto has_white = false;
+
+    // Finish the current node. Return false if the main line stops.
+    const auto EndNode = [&]() -> bool {
+        auto color = kInvalid;
+        const std::string *move = nullptr;
+        if (has_black) {
+            color = kBlack;
+            move = &black_move;
+        } else if (has_white) {
+            color = kWhite;
+            move = &white_move;
+        }
+        has_black = has_white = false;
+
+        if (in_root) {
+            in_root = false;
+            ApplyRootProperties(state, root);
+            if (move) {
+                const auto vtx = SgfCoordToVertex(state, move->data(), move->size());
+                state.PlayMove(vtx, color);
+            }
+            return movenum > 0;
+        }
+
+        if (!move) {
+            // The node without the move ends the main line.
+            return false;
+        }
+        const auto vtx = SgfCoordToVertex(state, move->data(), move->size());
+        if (!state.PlayMove(vtx, color)) {
+            throw "Illegal SGF move";
+        }
+        return ++played < movenum;
+    };
+
+    // Read the value after the '['. Copy it to the buffer if it
+    // is not null.
+    const auto ReadValue = [&](std::string *buf) {
+        if (buf) {
+            buf->clear();
+        }
+        while (ptr < end) {
+            auto c = *ptr++;
+            if (c == ']') {
+                break;
+            } else if (c == '\\') {
+                if (ptr >= end) {
+                    break;
+                }
+                c = *ptr++;
+            }
+            if (buf) {
+                buf->push_back(c);
+            }
+        }
+    };
+
+    const auto SkipSpace = [&]() {
+        while (ptr < end && std::isspace((unsigned char)*ptr)) {
+            ++ptr;
+        }
+    };
+
+    while (ptr < end) {
+        const auto c = *ptr++;
+
+        if (std::isupper((unsigned char)c)) {
+            // SGF property names are guaranteed to be uppercase, but
+            // some implementations write the lowercase letters too.
+            name.assign(1, c);
+            while (ptr < end && std::isalpha((unsigned char)*ptr)) {
+                name.push_back(*ptr++);
+            }
+
+            SkipSpace();
+            while (ptr < end && *ptr == '[') {
+                ++ptr;
+
+                std::string *buf = nullptr;
+                if (name == "B") {
+                    buf = has_black ? nullptr : &black_move;
+                    has_black = true;
+                } else if (name == "W") {
+                    buf = has_white ? nullptr : &white_move;
+                    has_white = true;
+                } else if (in_root) {
+                    const auto Take = [&](bool &has, std::string &out) {
+                        buf = has ? nullptr : &out;
+                        has = true;
+                    };
+                    if (name == "GM") {
+                        Take(root.has_gm, root.gm);
+                    } else if (name == "SZ") {
+                        Take(root.has_sz, root.sz);
+                    } else if (name == "KM") {
+                        Take(root.has_km, root.km);
+                    } else if (name == "HA") {
+                        Take(root.has_ha, root.ha);
+                    } else if (name == "RE") {
+                        Take(root.has_re, root.re);
+                    } else if (name == "PL") {
+                        Take(root.has_pl, root.pl);
+                    } else if (name == "AB") {
+                        root.ab.emplace_back();
+                        buf = &root.ab.back();
+                    } else if (name == "AW") {
+                        root.aw.emplace_back();
+                        buf = &root.aw.back();
+                    }
+                }
+                ReadValue(buf);
+                SkipSpace();
+            }
+        } else if (c == '[') {
+            // The value without the name, skip it.
+            ReadValue(nullptr);
+        } else if (c == ';' || c == '(') {
+            if (!EndNode()) {
+                return state;
+            }
+            if (c == '(') {
+                // eat first ;
+                SkipSpace();
+                if (ptr < end && *ptr == ';') {
+                    ++ptr;
+                }
+            }
+        } else if (c == ')') {
+            // The first variation ends, so does the main line.
+            break;
+        }
+    }
+
+    EndNode();
+    return state;
+}
+
 Sgf& Sgf::Get() {
     static Sgf sgf;
     return sgf;
 }
 
 GameState Sgf::FromFile(std::string filename, unsigned int movenum) {
-    auto node = SgfParser::Get().ParseFromFile(filename);
-    return node->GetMainLineState(movenum);
+    auto sgfstring = std::string{};
+    SgfParser::Get().ChopFile(filename, 0,
+        [&](std::string &sgf, size_t) {
+            sgfstring = std::move(sgf);
+            return false;
+        });
+    return FromString(sgfstring, movenum);
 }
 
 GameState Sgf::FromString(std::string sgfstring, unsigned int movenum) {
-    auto node = SgfParser::Get().ParseFromString(sgfstring);
-    return node->GetMainLineState(movenum);
+    return SgfParser::Get().ParseMainLine(sgfstring, movenum);
 }
 
 template<typename T>
@@ -498,7 +757,7 @@ std::string MakePropertyVetexListString(std::string property, std::vector<int> v
 
 std::string Sgf::ToString(GameState &state) {
     auto out = std::ostringstream{};
-    auto &history = state.GetHistory();
+    const auto history = state.GetHistory();
 
     out << '(' <<';';
     out << MakePropertyString("GM", 1);
@@ -570,6 +829,65 @@ std::string Sgf::ToString(GameState &state) {
     return out.str();
 }
 
+std::string Sgf::ToRecordString(GameState &state) {
+    auto out = std::ostringstream{};
+    const auto history = state.GetHistory();
+
+    const auto VertexString = [&state](const int vtx) -> std::string {
+        if (vtx == kPass || vtx == kResign) {
+            return "..";
+        }
+        return state.VertexToSgf(vtx);
+    };
+    const auto VertexListString = [&](const std::vector<int> &vertex_list) -> std::string {
+        auto list = std::string{};
+        for (const auto vtx : vertex_list) {
+            list += VertexString(vtx);
+        }
+        return list.empty() ? std::string{"-"} : list;
+    };
+
+    out << state.GetBoardSize() << ' '
+            << state.GetKomi() << ' '
+            << state.GetHandicap() << ' ';
+
+    const auto score = state.GetFinalScore();
+    if (state.GetPasses() >= 2) {
+        if (score > 1e-4) {
+            out << "B+" << score;
+        } else if (score < -1e-4) {
+            out << "W+" << -score;
+        } else {
+            out << '0';
+        }
+    } else if (state.GetWinner() == kBlackWon) {
+        out << "B+R";
+    } else if (state.GetWinner() == kWhiteWon) {
+        out << "W+R";
+    } else {
+        out << '?';
+    }
+
+    out << ' ' << VertexListString(state.GetAppendMoves(kBlack))
+            << ' ' << VertexListString(state.GetAppendMoves(kWhite))
+            << ' ';
+
+    auto moves = std::string{};
+    for (const auto &board : history) {
+        const auto lastmove = board->GetLastMove();
+        if (lastmove == kNullVertex) {
+            continue;
+        }
+        if (moves.empty()) {
+            const auto color = !board->GetToMove();
+            moves += color == kBlack ? 'B' : 'W';
+        }
+        moves += VertexString(lastmove);
+    }
+    out << (moves.empty() ? std::string{"-"} : moves);
+    return out.str();
+}
+
 void Sgf::ToFile(std::string filename, GameState &state) {
     std::ofstream out(filename.c_str(), std::ofstream::app | std::ofstream::out);
     if (out.is_open()) {
@@ -2,6 +2,7 @@
 
 #include "game/game_state.h"
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <sstream>
@@ -42,15 +43,30 @@ public:
     std::unique_ptr<SgfNode> ParseFromFile(std::string filename, size_t index=0) const;
     std::unique_ptr<SgfNode> ParseFromString(std::string sgfstring) const;
 
+    // Read the root setup and the first movenum moves of the main line in
+    // one pass. It does not build the node tree and skips the properties
+    // it does not need, so the side variations are never parsed.
+    GameState ParseMainLine(const std::string &sgfstring, unsigned int movenum) const;
+
     std::vector<std::string> ChopAll(std::string filename) const;
 
+    // Scan the games in the file one by one from the byte offset. The
+    // file is memory mapped, so it is never loaded at once. The function
+    // gets every game string and the offset after it. Stop scanning if
+    // it returns false. Return the offset where the scanning stops.
+    size_t ChopFile(std::string filename, size_t offset,
+                        std::function<bool(std::string &, size_t)> func) const;
+
 private:
-    void Parse(std::istringstream &strm, SgfNode* node) const;
+    // Parse the string between the ptr and the end. The ptr is moved
+    // to where it stops.
+    void Parse(const char *&ptr, const char *end, SgfNode* node) const;
 
-    std::string ParsePropertyValue(std::istringstream &strm, bool &success) const;
-    std::string ParsePropertyName(std::istringstream &strm) const;
+    std::string ParsePropertyValue(const char *&ptr, const char *end, bool &success) const;
+    std::string ParsePropertyName(const char *&ptr, const char *end) const;
 
-    std::vector<std::string> ChopStream(std::istream& ins, size_t stopat) const;
+    size_t ChopBuffer(const char *data, size_t size, size_t offset,
+                          std::function<bool(std::string &, size_t)> func) const;
     std::vector<std::string> ChopAll(std::string filename, size_t stopat) const;
     std::string ChopFromFile(std::string filename, size_t index) const;
 };
@@ -71,6 +87,14 @@ public:
     // Import the game state as SGF file.
     void ToFile(std::string filename, GameState &state);
 
+    // Import the game state to the compact game record. It is one
+    // line of the fields split by the space,
+    //     <size> <komi> <handicap> <result> <black setup> <white setup> <moves>
+    // The vertices are the two letters of SGF and the pass is "..". The
+    // moves start with the color of the first move, then the colors
+    // alternate. The empty list is "-".
+    std::string ToRecordString(GameState &state);
+
     // Remove unused SGF elements for this program and save it.
     void CleanSgf(std::string in, std::string out);
 };
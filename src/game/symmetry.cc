@@ -1,11 +1,13 @@
 #include <cassert>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
 
 #include "game/symmetry.h"
 
 constexpr int Symmetry::kNumSymmetris;
 constexpr int Symmetry::kIdentitySymmetry;
+constexpr int Symmetry::kNumSubgroups;
 
 Symmetry& Symmetry::Get() {
     static Symmetry symmetry;
@@ -18,9 +20,67 @@ void Symmetry::Initialize() {
     for (int bsize = kMinGTPBoardSize; bsize <= kBoardSize; ++bsize) {
         PartInitialize(bsize);
     }
+    InitializeSubgroups();
     initialized_ = true;
 }
 
+void Symmetry::InitializeSubgroups() {
+    // Compose the symmetries on the largest board. The symmetry of
+    // 'compose[a][b]' is the symmetry b after the symmetry a.
+    int compose[kNumSymmetris][kNumSymmetris];
+    for (int a = 0; a < kNumSymmetris; ++a) {
+        for (int b = 0; b < kNumSymmetris; ++b) {
+            compose[a][b] = -1;
+            for (int c = 0; c < kNumSymmetris && compose[a][b] < 0; ++c) {
+                bool same = true;
+                for (int idx = 0; idx < kNumIntersections && same; ++idx) {
+                    same = TransformIndex(kBoardSize, b, TransformIndex(kBoardSize, a, idx)) ==
+                               TransformIndex(kBoardSize, c, idx);
+                }
+                if (same) {
+                    compose[a][b] = c;
+                }
+            }
+            assert(compose[a][b] >= 0);
+        }
+    }
+
+    int num_subgroups = 0;
+    for (int mask = 0; mask < (1 << kNumSymmetris); ++mask) {
+        bool group = (mask & (1 << kIdentitySymmetry)) != 0;
+        for (int a = 0; a < kNumSymmetris && group; ++a) {
+            for (int b = 0; b < kNumSymmetris && group; ++b) {
+                if ((mask & (1 << a)) && (mask & (1 << b))) {
+                    group = (mask & (1 << compose[a][b])) != 0;
+                }
+            }
+        }
+        subgroup_ids_[mask] = -1;
+        if (group) {
+            assert(num_subgroups < kNumSubgroups);
+            subgroup_masks_[num_subgroups] = mask;
+            subgroup_ids_[mask] = num_subgroups++;
+        }
+    }
+    assert(num_subgroups == kNumSubgroups);
+
+    // The smallest index of every orbit.
+    for (int bsize = kMinGTPBoardSize; bsize <= kBoardSize; ++bsize) {
+        const auto num_intersections = bsize * bsize;
+        for (int id = 0; id < kNumSubgroups; ++id) {
+            for (int idx = 0; idx < num_intersections; ++idx) {
+                auto min_idx = idx;
+                for (int symm = 0; symm < kNumSymmetris; ++symm) {
+                    if (subgroup_masks_[id] & (1 << symm)) {
+                        min_idx = std::min(min_idx, TransformIndex(bsize, symm, idx));
+                    }
+                }
+                symmetry_class_tables_[bsize][id][idx] = min_idx;
+            }
+        }
+    }
+}
+
 void Symmetry::PartInitialize(int boardsize) {
     assert(boardsize >= kMinGTPBoardSize);
     assert(boardsize <= kBoardSize);
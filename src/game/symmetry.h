@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <string>
 
 #include "game/types.h"
@@ -16,19 +17,38 @@ public:
 
     int TransformIndex(int boardsize, int symmetry, int idx) const;
     int TransformVertex(int boardsize, int symmetry, int vtx) const;
+
+    // Return the smallest index which is equivalent to the index under
+    // the symmetries of the mask. The bit i of the mask is the symmetry
+    // i. The mask must be a group, like the symmetries which keep a
+    // position unchanged. Other masks return the index itself.
+    int GetSymmetryClass(int boardsize, int mask, int idx) const;
+
     std::string GetDebugString(int boardsize) const;
 
 private:
     static constexpr int kTableSize = kBoardSize + 1; // Allocate the big enough tables.
 
+    // The dihedral group of the square has ten subgroups.
+    static constexpr int kNumSubgroups = 10;
+
     void PartInitialize(int boardsize);
 
+    // Find the masks which are the subgroups.
+    void InitializeSubgroups();
+
     std::pair<int, int> GetSymmetry(const int x, const int y,
                                         const int symmetry, const int boardsize) const;
 
     int symmetry_nn_vtx_tables_[kTableSize][kNumSymmetris][kNumVertices];
     int symmetry_nn_idx_tables_[kTableSize][kNumSymmetris][kNumIntersections];
 
+    // The subgroup of every mask, or -1 if it is not a group.
+    std::array<int, 1 << kNumSymmetris> subgroup_ids_;
+    std::array<int, kNumSubgroups> subgroup_masks_;
+
+    int symmetry_class_tables_[kTableSize][kNumSubgroups][kNumIntersections];
+
     bool initialized_{false};
 };
 
@@ -39,3 +59,8 @@ inline int Symmetry::TransformIndex(int boardsize, int symmetry, int idx) const
 inline int Symmetry::TransformVertex(int boardsize, int symmetry, int vtx) const {
     return symmetry_nn_vtx_tables_[boardsize][symmetry][vtx];
 }
+
+inline int Symmetry::GetSymmetryClass(int boardsize, int mask, int idx) const {
+    const auto id = subgroup_ids_[mask & ((1 << kNumSymmetris) - 1)];
+    return id < 0 ? idx : symmetry_class_tables_[boardsize][id][idx];
+}
@@ -1,8 +1,17 @@
 #pragma once
 
 #include "game/gtp.h"
+#include "game/analysis_server.h"
 #include "selfplay/pipe.h"
+#include "selfplay/match_pipe.h"
+#include "selfplay/coordinator.h"
+#include "neural/inference_server.h"
+#include "mcts/search_worker.h"
+#include "accuracy/evaluate.h"
+#include "benchmark/benchmark.h"
 #include "utils/threadpool.h"
+#include "utils/metrics.h"
+#include "utils/huge_pages.h"
 #include "utils/log.h"
 #include "utils/format.h"
 #include "config.h"
@@ -23,17 +23,83 @@ void StartSelfplayLoop() {
     auto loop = std::make_unique<SelfPlayPipe>();
 }
 
+void StartSelfplayCoordinator() {
+    auto coordinator = std::make_unique<SelfPlayCoordinator>();
+}
+
+void StartInferenceServer() {
+    auto server = std::make_unique<InferenceServer>();
+}
+
+void StartMatch() {
+    auto match = std::make_unique<MatchPipe>();
+}
+
+void StartSearchWorker() {
+    auto worker = std::make_unique<SearchWorker>();
+}
+
+void StartAnalysisServer() {
+    auto server = std::make_unique<AnalysisServer>();
+}
+
+void StartBenchmark() {
+    auto suite = std::make_unique<BenchmarkSuite>();
+}
+
+void StartEvaluate() {
+    auto network = std::make_unique<Network>();
+    network->Initialize(GetOption<std::string>("weights_file"));
+
+    // The smaller boards are masked in the network board size.
+    const int board_size = std::max(GetOption<int>("defualt_boardsize"),
+                                        GetOption<int>("fixed_nn_boardsize"));
+    network->Reload(board_size);
+
+    LOGGING << EvaluatePositions(*network, board_size,
+                                     GetOption<std::string>("eval_input"),
+                                     GetOption<std::string>("eval_output"))
+                << '\n';
+    network->Destroy();
+}
+
 int main(int argc, char **argv) {
     ArgsParser(argc, argv);
 
     DumpLicense();
 
-    ThreadPool::Get(0);
+    ThreadPool::Get(0).SetThreadAffinity(GetOption<bool>("thread_affinity") ||
+                                             GetOption<bool>("numa_cache"));
+
+    if (GetOption<bool>("huge_pages")) {
+        HugePages::SetEnabled(true);
+        LOGGING << Format("Enabled the huge pages: %s.\n", HugePages::GetSystemInfo().c_str());
+    }
+
+    const int metrics_port = GetOption<int>("metrics_port");
+    if (metrics_port > 0 && !Metrics::StartHttpServer(metrics_port)) {
+        LOGGING << Format("Fail to listen on the metrics port %d.\n", metrics_port);
+    }
 
     if (GetOption<std::string>("mode") == "gtp") {
         StartGtpLoop();
-    } else if (GetOption<std::string>("mode") == "selfplay") {
+    } else if (GetOption<std::string>("mode") == "selfplay" ||
+                   GetOption<std::string>("mode") == "selfplay-client") {
         StartSelfplayLoop();
+    } else if (GetOption<std::string>("mode") == "selfplay-coordinator") {
+        StartSelfplayCoordinator();
+    } else if (GetOption<std::string>("mode") == "inference-server") {
+        StartInferenceServer();
+    } else if (GetOption<std::string>("mode") == "match") {
+        StartMatch();
+    } else if (GetOption<std::string>("mode") == "search-worker") {
+        StartSearchWorker();
+    } else if (GetOption<std::string>("mode") == "analysis-server") {
+        StartAnalysisServer();
+    } else if (GetOption<std::string>("mode") == "evaluate") {
+        StartEvaluate();
+    } else if (GetOption<std::string>("mode") == "benchmark") {
+        StartBenchmark();
     }
     return 0;
 }
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "utils/atomic.h"
+
+// The structure-of-arrays statistics of all children of one node. The
+// parent selects the child by scanning these arrays linearly instead
+// of dereferencing every child node. The child node mirrors its values
+// into this block when it is updated.
+class ChildStats {
+public:
+    // The arrays are padded to a multiple of this value so that the
+    // vectorized scan can read full lanes.
+    static constexpr int kPadding = 8;
+
+    // The status bits of child node. The child is active if
+    // there is no pruned bit and invalid bit.
+    static constexpr std::uint8_t kPrunedBit    = 1 << 0;
+    static constexpr std::uint8_t kInvalidBit   = 1 << 1;
+    static constexpr std::uint8_t kExpandingBit = 1 << 2;
+
+    // The fixed-point formats of the accumulated values. They are same
+    // as the node's accumulators, so the mirrored values are the raw
+    // fixed-point sums and they never drift from the node's values.
+    using EvalFixed = AtomicFixedPoint<32>;
+    using ScoreFixed = AtomicFixedPoint<24>;
+
+    explicit ChildStats(int size);
+
+    int Size() const { return size_; }
+    int PaddedSize() const { return padded_size_; }
+
+    // Reset the slot to uninflated state.
+    void ResetSlot(int idx, std::int16_t vertex, float policy);
+
+    // The mirrored black win-loss value of the child. It is computed
+    // same as the node's one.
+    float GetBlackWL(int idx) const;
+
+    // Plain values. Do not change them during the search.
+    std::unique_ptr<float[]> policy;
+    std::unique_ptr<float[]> score_bonus;
+    std::unique_ptr<std::int16_t[]> vertex;
+
+    // Accumulated values. They are updated by the search threads.
+    std::unique_ptr<std::atomic<int>[]> visits;
+    std::unique_ptr<std::atomic<int>[]> threads;
+    // The raw fixed-point sums. The black_wl and draw are in EvalFixed
+    // format and the black_fs is in ScoreFixed format.
+    std::unique_ptr<std::atomic<std::int64_t>[]> black_wl;
+    std::unique_ptr<std::atomic<std::int64_t>[]> draw;
+    std::unique_ptr<std::atomic<std::int64_t>[]> black_fs;
+
+    // The status bits of child nodes.
+    std::unique_ptr<std::atomic<std::uint8_t>[]> flags;
+
+private:
+    int size_;
+    int padded_size_;
+};
+
+inline ChildStats::ChildStats(int size) {
+    size_ = size;
+    padded_size_ = (size + kPadding - 1) / kPadding * kPadding;
+
+    policy = std::make_unique<float[]>(padded_size_);
+    score_bonus = std::make_unique<float[]>(padded_size_);
+    vertex = std::make_unique<std::int16_t[]>(padded_size_);
+
+    visits = std::unique_ptr<std::atomic<int>[]>(new std::atomic<int>[padded_size_]);
+    threads = std::unique_ptr<std::atomic<int>[]>(new std::atomic<int>[padded_size_]);
+    black_wl = std::unique_ptr<std::atomic<std::int64_t>[]>(new std::atomic<std::int64_t>[padded_size_]);
+    draw = std::unique_ptr<std::atomic<std::int64_t>[]>(new std::atomic<std::int64_t>[padded_size_]);
+    black_fs = std::unique_ptr<std::atomic<std::int64_t>[]>(new std::atomic<std::int64_t>[padded_size_]);
+
+    flags = std::unique_ptr<std::atomic<std::uint8_t>[]>(new std::atomic<std::uint8_t>[padded_size_]);
+
+    for (int idx = 0; idx < padded_size_; ++idx) {
+        ResetSlot(idx, 0, 0.f);
+
+        if (idx >= size_) {
+            // The padding slots are never selected.
+            flags[idx].store(kInvalidBit, std::memory_order_relaxed);
+        }
+    }
+}
+
+inline void ChildStats::ResetSlot(int idx, std::int16_t v, float p) {
+    policy[idx] = p;
+    score_bonus[idx] = 0.f;
+    vertex[idx] = v;
+
+    visits[idx].store(0, std::memory_order_relaxed);
+    threads[idx].store(0, std::memory_order_relaxed);
+    black_wl[idx].store(0, std::memory_order_relaxed);
+    draw[idx].store(0, std::memory_order_relaxed);
+    black_fs[idx].store(0, std::memory_order_relaxed);
+
+    flags[idx].store(0, std::memory_order_relaxed);
+}
+
+inline float ChildStats::GetBlackWL(int idx) const {
+    const auto accumulated_wl = EvalFixed::FromFixed(
+                                    black_wl[idx].load(std::memory_order_relaxed));
+    return accumulated_wl / visits[idx].load(std::memory_order_relaxed);
+}
@@ -0,0 +1,380 @@
+#pragma once
+
+#include "utils/half.h"
+#include "utils/prefetch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The children edges of one node. Every edge is one 4 bytes entry, the
+// half precision policy and the vertex. The node pointers are stored
+// in the separate blocks. The block is allocated only after one of its
+// edges is inflated, so the many nodes whose children are never
+// inflated only pay for the entries.
+template<typename NodeType>
+class EdgeTable {
+public:
+    // The pointer slots per block.
+    static constexpr int kBlockSize = 8;
+
+    // The bytes of one entry and of one pointer slot.
+    static constexpr size_t kEntryBytes = sizeof(std::uint32_t);
+    static constexpr size_t kSlotBytes = sizeof(std::uint64_t);
+
+    // The handle of one edge. It is like the reference to the edge and
+    // is cheap to copy.
+    template<typename Table>
+    class BasicEdge {
+    public:
+        BasicEdge(Table *table, int idx) : table_(table), idx_(idx) {}
+
+        NodeType *Get() const { return table_->Get(idx_); }
+        bool IsPointer() const { return Get() != nullptr; }
+        int GetVertex() const { return table_->GetVertex(idx_); }
+        float GetPolicy() const { return table_->GetPolicy(idx_); }
+        int Index() const { return idx_; }
+
+        // Inflate the pointer and call the initializer with the new
+        // node before other threads can see it.
+        template<typename Initializer>
+        bool Inflate(Initializer init) const { return table_->Inflate(idx_, init); }
+        bool Inflate() const { return table_->Inflate(idx_, [](NodeType *){}); }
+        bool Release() const { return table_->Release(idx_); }
+
+    private:
+        Table *table_;
+        int idx_;
+    };
+
+    using Edge = BasicEdge<EdgeTable>;
+    using ConstEdge = BasicEdge<const EdgeTable>;
+
+    template<typename Table, typename Handle>
+    class BasicIterator {
+    public:
+        BasicIterator(Table *table, int idx) : table_(table), idx_(idx) {}
+
+        Handle operator*() const { return Handle(table_, idx_); }
+        BasicIterator &operator++() { ++idx_; return *this; }
+        bool operator==(const BasicIterator &other) const { return idx_ == other.idx_; }
+        bool operator!=(const BasicIterator &other) const { return idx_ != other.idx_; }
+
+    private:
+        Table *table_;
+        int idx_;
+    };
+
+    using Iterator = BasicIterator<EdgeTable, Edge>;
+    using ConstIterator = BasicIterator<const EdgeTable, ConstEdge>;
+
+    EdgeTable() = default;
+    ~EdgeTable();
+
+    EdgeTable(const EdgeTable &) = delete;
+    EdgeTable &operator=(const EdgeTable &) = delete;
+
+    // Append the edge. Only call it before other threads can see the
+    // table.
+    void Reserve(int size);
+    void Append(std::int16_t vertex, float policy);
+
+    int Size() const;
+    bool Empty() const;
+
+    Edge operator[](int idx) { return Edge(this, idx); }
+    ConstEdge operator[](int idx) const { return ConstEdge(this, idx); }
+
+    Iterator begin() { return Iterator(this, 0); }
+    Iterator end() { return Iterator(this, Size()); }
+    ConstIterator begin() const { return ConstIterator(this, 0); }
+    ConstIterator end() const { return ConstIterator(this, Size()); }
+
+    // Return NULL if the edge is not inflated.
+    NodeType *Get(int idx) const;
+    int GetVertex(int idx) const;
+    float GetPolicy(int idx) const;
+
+    template<typename Initializer>
+    bool Inflate(int idx, Initializer init);
+
+    // Delete the node and keep its vertex and policy so that the edge
+    // can be inflated again. Only one thread can release it.
+    bool Release(int idx);
+
+    // Remove the edges which the predicate returns true without
+    // releasing them. The order of the others is kept. Only call it if
+    // no other thread is reading the table.
+    template<typename Predicate>
+    void RemoveIf(Predicate pred);
+
+    // Return the allocated bytes, without this object.
+    size_t GetMemoryUsed() const;
+
+    // Prefetch the first entries and the list of the blocks.
+    void Prefetch() const;
+
+private:
+    static constexpr std::uint64_t kUninflated = 0ULL;
+    static constexpr std::uint64_t kInflating  = 1ULL;
+
+    struct Block {
+        std::atomic<std::uint64_t> slots[kBlockSize];
+    };
+
+    static std::uint32_t MakeEntry(std::int16_t vertex, float policy);
+
+    // Return the slot, or NULL if its block is not allocated.
+    std::atomic<std::uint64_t> *PeekSlot(int idx) const;
+
+    // Return the slot. Allocate the blocks if needed.
+    std::atomic<std::uint64_t> &AcquireSlot(int idx);
+
+    void FreeBlocks();
+
+    // The low 16 bits are the vertex. The high 16 bits are the
+    // policy.
+    std::vector<std::uint32_t> entries_;
+
+    // The blocks of the node pointers. NULL until some edge is
+    // inflated.
+    std::atomic<std::atomic<Block *> *> blocks_{nullptr};
+};
+
+template<typename NodeType>
+constexpr int EdgeTable<NodeType>::kBlockSize;
+
+template<typename NodeType>
+constexpr size_t EdgeTable<NodeType>::kEntryBytes;
+
+template<typename NodeType>
+constexpr size_t EdgeTable<NodeType>::kSlotBytes;
+
+template<typename NodeType>
+constexpr std::uint64_t EdgeTable<NodeType>::kUninflated;
+
+template<typename NodeType>
+constexpr std::uint64_t EdgeTable<NodeType>::kInflating;
+
+template<typename NodeType>
+inline EdgeTable<NodeType>::~EdgeTable() {
+    FreeBlocks();
+}
+
+template<typename NodeType>
+inline void EdgeTable<NodeType>::Reserve(int size) {
+    entries_.reserve(size);
+}
+
+template<typename NodeType>
+inline void EdgeTable<NodeType>::Append(std::int16_t vertex, float policy) {
+    assert(blocks_.load(std::memory_order_relaxed) == nullptr);
+    entries_.emplace_back(MakeEntry(vertex, policy));
+}
+
+template<typename NodeType>
+inline int EdgeTable<NodeType>::Size() const {
+    return entries_.size();
+}
+
+template<typename NodeType>
+inline bool EdgeTable<NodeType>::Empty() const {
+    return entries_.empty();
+}
+
+template<typename NodeType>
+inline void EdgeTable<NodeType>::Prefetch() const {
+    PrefetchRead(entries_.data(), std::min<size_t>(entries_.size() * kEntryBytes, 128));
+    const auto blocks = blocks_.load(std::memory_order_relaxed);
+    if (blocks) {
+        PrefetchRead(blocks);
+    }
+}
+
+template<typename NodeType>
+inline std::uint32_t EdgeTable<NodeType>::MakeEntry(std::int16_t vertex, float policy) {
+    return ((std::uint32_t)Half::FromFloat(policy) << 16) |
+               (std::uint32_t)(std::uint16_t)vertex;
+}
+
+template<typename NodeType>
+inline std::atomic<std::uint64_t> *EdgeTable<NodeType>::PeekSlot(int idx) const {
+    const auto blocks = blocks_.load(std::memory_order_acquire);
+    if (!blocks) {
+        return nullptr;
+    }
+    const auto block = blocks[idx / kBlockSize].load(std::memory_order_acquire);
+    if (!block) {
+        return nullptr;
+    }
+    return &block->slots[idx % kBlockSize];
+}
+
+template<typename NodeType>
+inline std::atomic<std::uint64_t> &EdgeTable<NodeType>::AcquireSlot(int idx) {
+    auto blocks = blocks_.load(std::memory_order_acquire);
+    if (!blocks) {
+        const int num_blocks = (Size() + kBlockSize - 1) / kBlockSize;
+        auto new_blocks = new std::atomic<Block *>[num_blocks];
+        for (int i = 0; i < num_blocks; ++i) {
+            new_blocks[i].store(nullptr, std::memory_order_relaxed);
+        }
+        if (blocks_.compare_exchange_strong(blocks, new_blocks,
+                                                std::memory_order_acq_rel)) {
+            blocks = new_blocks;
+        } else {
+            // Another thread allocated them first.
+            delete[] new_blocks;
+        }
+    }
+
+    auto &block_ptr = blocks[idx / kBlockSize];
+    auto block = block_ptr.load(std::memory_order_acquire);
+    if (!block) {
+        auto new_block = new Block;
+        for (auto &slot : new_block->slots) {
+            slot.store(kUninflated, std::memory_order_relaxed);
+        }
+        if (block_ptr.compare_exchange_strong(block, new_block,
+                                                  std::memory_order_acq_rel)) {
+            block = new_block;
+        } else {
+            delete new_block;
+        }
+    }
+    return block->slots[idx % kBlockSize];
+}
+
+template<typename NodeType>
+inline NodeType *EdgeTable<NodeType>::Get(int idx) const {
+    const auto slot = PeekSlot(idx);
+    if (!slot) {
+        return nullptr;
+    }
+    const auto v = slot->load(std::memory_order_acquire);
+    if (v == kUninflated || v == kInflating) {
+        return nullptr;
+    }
+    return reinterpret_cast<NodeType *>(v);
+}
+
+template<typename NodeType>
+inline int EdgeTable<NodeType>::GetVertex(int idx) const {
+    // The vertex is never changed, so the inflated node is not read.
+    return (std::int16_t)(entries_[idx] & 0xffff);
+}
+
+template<typename NodeType>
+inline float EdgeTable<NodeType>::GetPolicy(int idx) const {
+    // The policy of the node may be changed, e.g. by the noise.
+    const auto node = Get(idx);
+    if (node) {
+        return node->GetPolicy();
+    }
+    return Half::ToFloat(entries_[idx] >> 16);
+}
+
+template<typename NodeType>
+template<typename Initializer>
+inline bool EdgeTable<NodeType>::Inflate(int idx, Initializer init) {
+    auto &slot = AcquireSlot(idx);
+
+    while (true) {
+        auto v = slot.load(std::memory_order_acquire);
+        if (v != kUninflated && v != kInflating) {
+            // Another thread had already inflated the pointer yet.
+            return false;
+        }
+        if (v == kUninflated &&
+                slot.compare_exchange_weak(v, kInflating, std::memory_order_acquire)) {
+            break;
+        }
+    }
+
+    // Success to get the owner. Now allocate new memory.
+    auto node = new NodeType(GetVertex(idx),
+                                 Half::ToFloat(entries_[idx] >> 16));
+    init(node);
+    slot.store(reinterpret_cast<std::uint64_t>(node), std::memory_order_release);
+    return true;
+}
+
+template<typename NodeType>
+inline bool EdgeTable<NodeType>::Release(int idx) {
+    const auto slot = PeekSlot(idx);
+    if (!slot) {
+        return false;
+    }
+    const auto v = slot->load(std::memory_order_acquire);
+    if (v == kUninflated || v == kInflating) {
+        return false;
+    }
+
+    // Keep the last policy so that the edge can be inflated again
+    // after that.
+    auto node = reinterpret_cast<NodeType *>(v);
+    entries_[idx] = MakeEntry(GetVertex(idx), node->GetPolicy());
+
+    delete node;
+    slot->store(kUninflated, std::memory_order_release);
+    return true;
+}
+
+template<typename NodeType>
+template<typename Predicate>
+inline void EdgeTable<NodeType>::RemoveIf(Predicate pred) {
+    const int size = Size();
+    auto nodes = std::vector<NodeType *>{};
+    auto entries = std::vector<std::uint32_t>{};
+
+    for (int idx = 0; idx < size; ++idx) {
+        if (!pred(ConstEdge(this, idx))) {
+            nodes.emplace_back(Get(idx));
+            entries.emplace_back(entries_[idx]);
+        }
+    }
+
+    // Rebuild the blocks for the new positions.
+    FreeBlocks();
+    entries_ = std::move(entries);
+    for (int idx = 0; idx < (int)nodes.size(); ++idx) {
+        if (nodes[idx]) {
+            AcquireSlot(idx).store(reinterpret_cast<std::uint64_t>(nodes[idx]),
+                                       std::memory_order_relaxed);
+        }
+    }
+}
+
+template<typename NodeType>
+inline size_t EdgeTable<NodeType>::GetMemoryUsed() const {
+    auto bytes = entries_.capacity() * sizeof(std::uint32_t);
+    const auto blocks = blocks_.load(std::memory_order_acquire);
+    if (blocks) {
+        const int num_blocks = (Size() + kBlockSize - 1) / kBlockSize;
+        bytes += num_blocks * sizeof(std::atomic<Block *>);
+        for (int i = 0; i < num_blocks; ++i) {
+            if (blocks[i].load(std::memory_order_relaxed)) {
+                bytes += sizeof(Block);
+            }
+        }
+    }
+    return bytes;
+}
+
+template<typename NodeType>
+inline void EdgeTable<NodeType>::FreeBlocks() {
+    // Free the pointer storage only. The nodes are released by the
+    // owner.
+    const auto blocks = blocks_.exchange(nullptr, std::memory_order_acq_rel);
+    if (!blocks) {
+        return;
+    }
+    const int num_blocks = (Size() + kBlockSize - 1) / kBlockSize;
+    for (int i = 0; i < num_blocks; ++i) {
+        delete blocks[i].load(std::memory_order_relaxed);
+    }
+    delete[] blocks;
+}
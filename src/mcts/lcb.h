@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <sstream>
 #include <stdexcept>
@@ -52,6 +53,16 @@ public:
  
     float CachedTQuantile(int v);
 
+    // Compute the lower confidence bounds of many children in one
+    // pass. It is same as the scalar one, including the large negative
+    // value (policy - 1e6) of the children with one visit only.
+    void ComputeLcbs(const int size,
+                     const int *visits,
+                     const float *mean,
+                     const float *variance,
+                     const float *policy,
+                     float *lcb) const;
+
     static LcbEntries& Get();
 
 private:
@@ -85,3 +96,21 @@ inline float LcbEntries::CachedTQuantile(int v) {
     // can just return the last entry for all v bigger than it.
     return z_lookup_table_[kEntrySize - 1];
 }
+
+inline void LcbEntries::ComputeLcbs(const int size,
+                                    const int *visits,
+                                    const float *mean,
+                                    const float *variance,
+                                    const float *policy,
+                                    float *lcb) const {
+    // The quantile index of CachedTQuantile(visits - 1) is clamped
+    // instead of branching, so the compiler can vectorize the loop.
+    for (int i = 0; i < size; ++i) {
+        const int v = visits[i];
+        const int idx = std::min(std::max(v - 2, 0), kEntrySize - 1);
+        const float z = z_lookup_table_[idx];
+        const float stddev = std::sqrt(variance[i] / float(v));
+        const float bound = mean[i] - z * stddev;
+        lcb[i] = v > 1 ? bound : policy[i] - 1e6f;
+    }
+}
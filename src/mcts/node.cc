@@ -1,9 +1,14 @@
 #include "mcts/node.h"
+#include "mcts/node_arena.h"
+#include "mcts/puct_kernel.h"
 #include "mcts/lcb.h"
 #include "mcts/rollout.h"
 #include "utils/atomic.h"
 #include "utils/random.h"
 #include "utils/format.h"
+#include "utils/metrics.h"
+#include "utils/prefetch.h"
+#include "utils/half.h"
 #include "game/symmetry.h"
 
 #include <cassert>
@@ -11,6 +16,8 @@
 #include <cmath>
 #include <sstream>
 #include <iomanip>
+#include <istream>
+#include <ostream>
 #include <stack>
 
 #define VIRTUAL_LOSS_COUNT (3)
@@ -21,8 +28,41 @@ Node::Node(std::int16_t vertex, float policy) {
 }
 
 Node::~Node() {
-    assert(GetThreads() == 0);
+    assert(running_threads_.load(std::memory_order_relaxed) == 0);
     ReleaseAllChildren();
+    delete ownership_.load(std::memory_order_relaxed);
+}
+
+Node::OwnershipStats::OwnershipStats() {
+    for (auto &owner : accumulated_black_ownership) {
+        owner.Store(0.0);
+    }
+    visits.store(0, std::memory_order_relaxed);
+}
+
+void Node::AllocateOwnership() {
+    if (ownership_.load(std::memory_order_acquire)) {
+        return;
+    }
+    auto stats = new OwnershipStats;
+    auto expected = static_cast<OwnershipStats *>(nullptr);
+    if (!ownership_.compare_exchange_strong(expected, stats,
+                                                std::memory_order_acq_rel)) {
+        // Another thread had already allocated it.
+        delete stats;
+    }
+}
+
+void *Node::operator new(std::size_t size) {
+    assert(size == sizeof(Node));
+#ifdef NDEBUG
+    (void) size;
+#endif
+    return NodeArena<sizeof(Node)>::Allocate();
+}
+
+void Node::operator delete(void *ptr) {
+    NodeArena<sizeof(Node)>::Free(ptr);
 }
 
 bool Node::PrepareRootNode(Network &network,
@@ -30,13 +70,23 @@ bool Node::PrepareRootNode(Network &network,
                                NodeEvals &node_evals,
                                AnalysisConfig &config) {
     const auto is_root = true;
+    AllocateOwnership();
+
     const auto success = ExpandChildren(network, state, node_evals, config, is_root);
     assert(HaveChildren());
 
+    // The root may be an inner node of the last search. It selects
+    // from all children.
+    order_.reset();
+    visible_children_.store(0, std::memory_order_relaxed);
+
     InflateAllChildren();
+    for (auto child : children_) {
+        child.Get()->AllocateOwnership();
+    }
     if (param_->dirichlet_noise) {
         // Generate the dirichlet noise and gather it.
-        const auto legal_move = children_.size();
+        const auto legal_move = children_.Size();
         const auto factor = param_->dirichlet_factor;
         const auto init = param_->dirichlet_init;
         const auto alpha = init * factor / static_cast<float>(legal_move);
@@ -50,7 +100,7 @@ bool Node::PrepareRootNode(Network &network,
 
     // Reset the bouns.
     SetScoreBouns(0.f);
-    for (auto &child : children_) {
+    for (auto child : children_) {
         auto node = child.Get();
         if (param_->first_pass_bonus &&
                 child.GetVertex() == kPass) {
@@ -68,7 +118,8 @@ bool Node::ExpandChildren(Network &network,
                               GameState &state,
                               NodeEvals &node_evals,
                               AnalysisConfig &config,
-                              const bool is_root) {
+                              const bool is_root,
+                              const bool need_ownership) {
     // The node must be the first time to expand and is not the terminate node.
     assert(state.GetPasses() < 2);
     if (HaveChildren()) {
@@ -90,9 +141,43 @@ bool Node::ExpandChildren(Network &network,
             !(param_->root_dcnn && is_root)) {
         ApplyNoDcnnPolicy(state, color_, raw_netlist);
     } else {
-        raw_netlist = network.GetOutput(state, Network::kRandom, temp);
+        const auto ensemble = is_root && param_->root_symm_average ?
+                                  Network::kAverage : Network::kRandom;
+        raw_netlist = network.GetOutput(state, ensemble, temp,
+                                            -1, true, true, need_ownership);
     }
 
+    FinishExpanding(state, raw_netlist, node_evals, config);
+
+    return true;
+}
+
+bool Node::SubmitExpanding(Network &network,
+                               GameState &state,
+                               std::future<Network::Result> &result,
+                               const bool need_ownership) {
+    assert(state.GetPasses() < 2);
+    if (HaveChildren()) {
+        return false;
+    }
+
+    // Try to acquire the owner. We keep it until the result
+    // is linked.
+    if (!AcquireExpanding()) {
+        return false;
+    }
+
+    color_ = state.GetToMove();
+    result = network.GetOutputAsync(state, Network::kRandom, param_->policy_temp,
+                                        -1, true, true, need_ownership);
+
+    return true;
+}
+
+void Node::FinishExpanding(GameState &state,
+                               Network::Result &raw_netlist,
+                               NodeEvals &node_evals,
+                               AnalysisConfig &config) {
     // Store the network reuslt.
     ApplyNetOutput(state, raw_netlist, node_evals, color_);
 
@@ -105,64 +190,44 @@ bool Node::ExpandChildren(Network &network,
     const auto num_intersections = state.GetNumIntersections();
     const auto safe_area = state.GetStrictSafeArea();
 
-    // For symmetry pruning.
-    bool apply_symm_pruning = param_->symm_pruning &&
-                                  board_size >= state.GetMoveNumber();
-    auto moves_hash = std::vector<std::uint64_t>{};
-    auto symm_base_hash = std::vector<std::uint64_t>(Symmetry::kNumSymmetris, 0ULL);
-
-    for (int symm = Symmetry::kIdentitySymmetry;
-             apply_symm_pruning && symm < Symmetry::kNumSymmetris; ++symm) {
-        symm_base_hash[symm] = state.ComputeSymmetryHash(symm);
-    }
-
-    // Prune the illegal moves or some bad move.
-    for (int idx = 0; idx < num_intersections; ++idx) {
-        const auto x = idx % board_size;
-        const auto y = idx / board_size;
-        const auto vtx = state.GetVertex(x, y);
+    // For symmetry pruning. The mask is the symmetries which keep
+    // the position unchanged. The equivalent moves under them share
+    // one class in the precomputed table.
+    const bool apply_symm_pruning = param_->symm_pruning &&
+                                        board_size >= state.GetMoveNumber();
+    const auto symm_mask = apply_symm_pruning ?
+                               state.GetSymmetryMask() : 1 << Symmetry::kIdentitySymmetry;
+    auto class_slots = std::vector<int>(symm_mask == 1 << Symmetry::kIdentitySymmetry ?
+                                            0 : num_intersections, -1);
+
+    // Prune the illegal moves or some bad move. Only the legal
+    // moves are visited.
+    const int movenum = state.GetMoveNumber();
+    state.GetLegalBits(color_).ForEach([&](const int vtx) {
+        const auto idx = state.GetIndex(state.GetX(vtx), state.GetY(vtx));
         const auto policy = raw_netlist.probabilities[idx];
 
-        // Prune the illegal, unwise and forbidden move.
-        int movenum = state.GetMoveNumber();
-        if (!state.IsLegalMove(vtx, color_,
-                [movenum, &config](int vtx, int color){
-                    return !config.IsLegal(vtx, color, movenum);
-                }) 
-                    || safe_area[idx]) {
-            continue;
+        // Prune the unwise and forbidden move.
+        if (!config.IsLegal(vtx, color_, movenum) || safe_area[idx]) {
+            return;
         }
 
-        // Prune the symmetry moves. May reduce some perfomance.
-        if (apply_symm_pruning) {
-            bool hash_found = false;
-            for (int symm = Symmetry::kIdentitySymmetry+1;
-                     symm < Symmetry::kNumSymmetris && !hash_found; ++symm) {
-                const auto symm_vtx = Symmetry::Get().TransformVertex(board_size, symm, vtx);
-                const auto symm_hash = symm_base_hash[symm] ^ state.GetMoveHash(symm_vtx, color_);
-                hash_found = std::end(moves_hash) !=
-                                 std::find(std::begin(moves_hash),
-                                               std::end(moves_hash), symm_hash);
-            }
-
-            if (!hash_found) {
-                // Get next game state hash. Is is not correct if the
-                // move is capture move. It is ok because we only need
-                // move hash in the opening stage. The capture move is
-                // unusual in the opening stage.
-                moves_hash.emplace_back(
-                    state.GetHash() ^ state.GetMoveHash(vtx, color_));
-            } else {
-                // The pruned node is a legal move. We need accumulate
-                // the all legal moves policy.
+        // Prune the symmetry moves. The kept move takes the policy of
+        // all equivalent moves, so it stands for them.
+        if (!class_slots.empty()) {
+            const auto rep = Symmetry::Get().GetSymmetryClass(board_size, symm_mask, idx);
+            auto &slot = class_slots[rep];
+            if (slot >= 0) {
+                nodelist[slot].first += policy;
                 legal_accumulate += policy;
-                continue;
+                return;
             }
+            slot = nodelist.size();
         }
 
         nodelist.emplace_back(policy, vtx);
         legal_accumulate += policy;
-    }
+    });
 
     // There ara too many legal moves. Disable the pass move.
     if ((int)nodelist.size() > 3*num_intersections/4) {
@@ -193,20 +258,94 @@ bool Node::ExpandChildren(Network &network,
 
     // Release the owner.
     ExpandDone();
-
-    return true;
 }
 
 void Node::LinkNodeList(std::vector<Network::PolicyVertexPair> &nodelist) {
-    // Besure that the best policy is on the top.
-    std::stable_sort(std::rbegin(nodelist), std::rend(nodelist));
+    const int width = param_->partial_expansion;
+    const int size = nodelist.size();
+    const bool partial = width > 0 && size > width &&
+                             !param_->compact_child_stats && !param_->no_dcnn;
+
+    if (partial) {
+        // Only the selectable children need the order. The first
+        // hidden child is the largest of the rest, so it bounds all
+        // hidden children.
+        const auto greater = [](const Network::PolicyVertexPair &a,
+                                    const Network::PolicyVertexPair &b) {
+                                 return a > b;
+                             };
+        std::nth_element(std::begin(nodelist), std::begin(nodelist) + width,
+                             std::end(nodelist), greater);
+        std::sort(std::begin(nodelist), std::begin(nodelist) + width, greater);
+
+        order_ = std::make_unique<std::uint16_t[]>(size);
+        for (int i = 0; i < size; ++i) {
+            order_[i] = i;
+        }
+        visible_children_.store(width, std::memory_order_relaxed);
+    } else {
+        // Besure that the best policy is on the top.
+        std::stable_sort(std::rbegin(nodelist), std::rend(nodelist));
+    }
 
+    children_.Reserve(size);
     for (const auto &node : nodelist) {
         const auto vertex = (std::uint16_t)node.second;
         const auto policy = node.first;
-        children_.emplace_back(vertex, policy);
+        children_.Append(vertex, policy);
+    }
+    assert(!children_.Empty());
+
+    if (param_->compact_child_stats) {
+        BuildChildStats();
+    }
+}
+
+void Node::BuildChildStats() {
+    const int size = children_.Size();
+    child_stats_ = std::make_unique<ChildStats>(size);
+
+    for (int idx = 0; idx < size; ++idx) {
+        const auto child = children_[idx];
+        child_stats_->ResetSlot(idx, child.GetVertex(), child.GetPolicy());
+
+        const auto node = child.Get();
+        if (node) {
+            node->LinkParentStats(child_stats_.get(), idx);
+        }
+    }
+}
+
+void Node::LinkParentStats(ChildStats *stats, const int idx) {
+    parent_stats_ = stats;
+    parent_index_ = idx;
+
+    if (!stats) {
+        return;
+    }
+
+    // Copy current values into the parent's block.
+    stats->visits[idx].store(GetVisits(), std::memory_order_relaxed);
+    stats->threads[idx].store(
+        running_threads_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    stats->black_wl[idx].store(
+        accumulated_black_wl_.LoadRaw(), std::memory_order_relaxed);
+    stats->draw[idx].store(
+        accumulated_draw_.LoadRaw(), std::memory_order_relaxed);
+    stats->black_fs[idx].store(
+        accumulated_black_fs_.LoadRaw(), std::memory_order_relaxed);
+    auto flags = std::uint8_t{0};
+    if (IsPruned()) {
+        flags |= ChildStats::kPrunedBit;
+    }
+    if (!IsValid()) {
+        flags |= ChildStats::kInvalidBit;
+    }
+    if (IsExpanding()) {
+        flags |= ChildStats::kExpandingBit;
     }
-    assert(!children_.empty());
+    stats->flags[idx].store(flags, std::memory_order_relaxed);
+    stats->score_bonus[idx] = score_bouns_;
 }
 
 void Node::ApplyNetOutput(GameState &state,
@@ -241,7 +380,6 @@ void Node::ApplyNetOutput(GameState &state,
             owner = 0.f - owner;
         }
         black_ownership[idx] = owner;
-        avg_black_ownership_[idx] = 0.f;
     }
 
     // Do rollout if we disable the DCNN or the DCNN does not
@@ -262,6 +400,9 @@ void Node::ApplyNetOutput(GameState &state,
     node_evals.black_wl = black_wl_;
     node_evals.draw = draw;
     node_evals.black_final_score = black_fs;
+    node_evals.has_ownership = raw_netlist.has_ownership ||
+                                   param_->use_rollout || param_->no_dcnn;
+    node_evals.deep_net = raw_netlist.deep_net;
 
     for (int idx = 0; idx < kNumIntersections; ++idx) {
         node_evals.black_ownership[idx] = black_ownership[idx];
@@ -306,7 +447,7 @@ float Node::ComputeKlDivergence() {
     int parentvisits = 0;
     int best_visits = 0;
 
-    for (const auto &child : children_) {
+    for (const auto child : children_) {
         const auto node = child.Get();
         if (node && node->IsActive()) {
             const auto visits = node->GetVisits();
@@ -344,10 +485,10 @@ Node *Node::ProbSelectChild() {
     WaitExpanded();
     assert(HaveChildren());
 
-    Edge* best_node = nullptr;
+    int best_idx = -1;
     float best_prob = std::numeric_limits<float>::lowest();
 
-    for (auto &child : children_) {
+    for (auto child : children_) {
         const auto node = child.Get();
         const bool is_pointer = node != nullptr;
 
@@ -365,12 +506,13 @@ Node *Node::ProbSelectChild() {
 
         if (prob > best_prob) {
             best_prob = prob;
-            best_node = &child;
+            best_idx = child.Index();
         }
     }
 
-    Inflate(*best_node);
-    return best_node->Get();
+    const auto best_node = children_[best_idx];
+    Inflate(best_node);
+    return best_node.Get();
 }
 
 Node *Node::PuctSelectChild(const int color, const bool is_root) {
@@ -385,10 +527,55 @@ Node *Node::PuctSelectChild(const int color, const bool is_root) {
         return GumbelSelectChild(color, false);
     }
 
+    const auto best_node = child_stats_ && param_->compact_child_stats ?
+                               PuctSelectEdgeCompact(color, is_root) :
+                               PuctSelectEdge(color, is_root);
+
+    Inflate(best_node);
+    return best_node.Get();
+}
+
+Node *Node::PuctSelectChild(const int color, const bool is_root,
+                                std::vector<int> &local_threads) {
+    WaitExpanded();
+    assert(HaveChildren());
+
+    if ((is_root && ShouldApplyGumbel()) ||
+            !(child_stats_ && param_->compact_child_stats)) {
+        // Only the compact statistics take the local counters.
+        return PuctSelectChild(color, is_root);
+    }
+
+    local_threads.resize(child_stats_->PaddedSize(), 0);
+    const auto best_node = PuctSelectEdgeCompact(color, is_root, local_threads.data());
+    local_threads[best_node.Index()] += 1;
+
+    Inflate(best_node);
+    return best_node.Get();
+}
+
+Node::Edge Node::PuctSelectEdge(const int color, const bool is_root) {
+    const int size = GetVisibleSize();
+    const auto order = order_.get();
+    const auto GetEdge = [this, order](const int i) {
+        return children_[order ? order[i] : i];
+    };
+
+    // The children are scattered in the arena. Prefetch the ones a few
+    // steps ahead, so both loops below find them in the cache.
+    constexpr int kPrefetchDistance = 4;
+    for (int i = 0; i < std::min(size, kPrefetchDistance); ++i) {
+        PrefetchRead(GetEdge(i).Get());
+    }
+
     // Gather all parent's visits.
     int parentvisits = 0;
     float total_visited_policy = 0.0f;
-    for (auto &child : children_) {
+    for (int i = 0; i < size; ++i) {
+        if (i + kPrefetchDistance < size) {
+            PrefetchRead(GetEdge(i + kPrefetchDistance).Get());
+        }
+        const auto child = GetEdge(i);
         const auto node = child.Get();
         const bool is_pointer = node != nullptr;
 
@@ -418,10 +605,11 @@ Node *Node::PuctSelectChild(const int color, const bool is_root) {
     const float fpu_value     = GetNetWL(color) - fpu_reduction;
     const float parent_score  = GetFinalScore(color);
 
-    Edge* best_node = nullptr;
+    int best_idx = -1;
     float best_value = std::numeric_limits<float>::lowest();
 
-    for (auto &child : children_) {
+    for (int i = 0; i < size; ++i) {
+        const auto child = GetEdge(i);
         const auto node = child.Get();
         const bool is_pointer = node != nullptr;
 
@@ -469,12 +657,161 @@ Node *Node::PuctSelectChild(const int color, const bool is_root) {
 
         if (value > best_value) {
             best_value = value;
-            best_node = &child;
+            best_idx = child.Index();
         }
     }
 
-    Inflate(*best_node);
-    return best_node->Get();
+    if (order && size < children_.Size()) {
+        // The hidden children are not visited. The first one has the
+        // largest PUCT value of them.
+        const auto child = GetEdge(size);
+        const float value = fpu_value + cpuct * child.GetPolicy() * numerator;
+        if (value > best_value) {
+            RevealChild(size);
+            best_idx = child.Index();
+        }
+    }
+
+    return children_[best_idx];
+}
+
+void Node::PrefetchChildren() const {
+    children_.Prefetch();
+
+    const auto stats = child_stats_.get();
+    if (stats) {
+        // The first lines of the arrays which the compact selection
+        // scans.
+        const auto size = std::min(stats->PaddedSize(), 32);
+        PrefetchRead(stats->policy.get(), size * sizeof(float));
+        PrefetchRead(stats->visits.get(), size * sizeof(int));
+        PrefetchRead(stats->black_wl.get(), size * sizeof(std::int64_t));
+    }
+}
+
+int Node::CountMismatchedChildStats() const {
+    const auto stats = child_stats_.get();
+    if (!stats) {
+        return 0;
+    }
+
+    int mismatched = 0;
+    for (int idx = 0; idx < stats->Size(); ++idx) {
+        const auto node = children_[idx].Get();
+        if (!node) {
+            continue;
+        }
+        const auto visits = node->GetVisits();
+        if (stats->visits[idx].load(std::memory_order_relaxed) != visits ||
+                (visits > 0 && stats->GetBlackWL(idx) != node->GetWL(kBlack, false))) {
+            mismatched += 1;
+        }
+    }
+    return mismatched;
+}
+
+int Node::GetVisibleSize() const {
+    const int visible = visible_children_.load(std::memory_order_acquire);
+    return visible == 0 ? children_.Size() : visible;
+}
+
+void Node::RevealChild(const int width) {
+    while (revealing_.exchange(true, std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+
+    // Another thread may have revealed it.
+    const int size = children_.Size();
+    if (visible_children_.load(std::memory_order_relaxed) == width) {
+        // Only the hidden part of the order is changed. The other
+        // threads read the selectable part and the first hidden child.
+        if (width + 1 < size) {
+            std::nth_element(order_.get() + width + 1,
+                                 order_.get() + width + 1,
+                                 order_.get() + size,
+                                 [this](const std::uint16_t a, const std::uint16_t b) {
+                                     const auto pa = children_[a].GetPolicy();
+                                     const auto pb = children_[b].GetPolicy();
+                                     return pa > pb || (pa == pb &&
+                                                 children_[a].GetVertex() > children_[b].GetVertex());
+                                 });
+        }
+        visible_children_.store(width + 1 == size ? 0 : width + 1,
+                                    std::memory_order_release);
+    }
+    revealing_.store(false, std::memory_order_release);
+}
+
+Node::Edge Node::PuctSelectEdgeCompact(const int color, const bool is_root,
+                                            const int *local_threads) {
+    const auto &stats = *child_stats_;
+    const int size = stats.Size();
+
+    // Gather all parent's visits.
+    int parentvisits = 0;
+    float total_visited_policy = 0.0f;
+    for (int idx = 0; idx < size; ++idx) {
+        if (!(stats.flags[idx].load(std::memory_order_relaxed) & ChildStats::kInvalidBit)) {
+            // The node status is pruned or active.
+            const auto visits = stats.visits[idx].load(std::memory_order_relaxed);
+            parentvisits += visits;
+            if (visits > 0) {
+                total_visited_policy += stats.policy[idx];
+            }
+        }
+    }
+
+    const auto cpuct_init           = param_->cpuct_init;
+    const auto cpuct_base_factor    = param_->cpuct_base_factor;
+    const auto cpuct_base           = param_->cpuct_base;
+    const auto draw_factor          = param_->draw_factor;
+    const auto score_utility_factor = param_->score_utility_factor;
+    const auto score_utility_div    = param_->score_utility_div;
+    const auto noise                = is_root ? param_->dirichlet_noise  : false;
+    const auto fpu_reduction_factor = is_root ? param_->fpu_root_reduction : param_->fpu_reduction;
+    const auto epsilon              = param_->dirichlet_epsilon;
+
+    const float cpuct         = cpuct_init + cpuct_base_factor *
+                                                 std::log((float(parentvisits) + cpuct_base + 1) / cpuct_base);
+    const float numerator     = std::sqrt(float(parentvisits));
+    const float fpu_reduction = fpu_reduction_factor * std::sqrt(total_visited_policy);
+    const float fpu_value     = GetNetWL(color) - fpu_reduction;
+    const float parent_score  = GetFinalScore(color);
+
+    // Same as PuctSelectEdge(). But score all children by the
+    // vectorized kernel.
+    auto inputs = PuctInputs{};
+    inputs.stats = &stats;
+    inputs.policy = stats.policy.get();
+    inputs.cpuct = cpuct;
+    inputs.numerator = numerator;
+    inputs.fpu_value = fpu_value;
+    inputs.expanding_value = -1.0f - fpu_reduction;
+    inputs.parent_score = parent_score;
+    inputs.draw_factor = draw_factor;
+    inputs.score_utility_factor = score_utility_factor;
+    inputs.score_utility_div = score_utility_div;
+    inputs.virtual_loss_count = VIRTUAL_LOSS_COUNT;
+    inputs.threads = local_threads;
+    inputs.is_white = color == kWhite;
+
+    thread_local std::vector<float> noise_policy;
+    if (noise) {
+        // Mix the noise into the policy before scoring.
+        noise_policy.assign(stats.PaddedSize(), 0.f);
+        for (int idx = 0; idx < size; ++idx) {
+            const auto eta_a = param_->dirichlet_buffer[stats.vertex[idx]];
+            noise_policy[idx] = stats.policy[idx] * (1 - epsilon) + epsilon * eta_a;
+        }
+        inputs.policy = noise_policy.data();
+    }
+
+    const int best_idx = param_->scalar_puct_kernel ?
+                             PuctKernel::SelectBestScalar(inputs) :
+                             PuctKernel::SelectBest(inputs);
+
+    assert(best_idx >= 0);
+    return children_[best_idx];
 }
 
 Node *Node::UctSelectChild(const int color, const bool is_root, const GameState &state) {
@@ -488,20 +825,20 @@ Node *Node::UctSelectChild(const int color, const bool is_root, const GameState
     const float cpuct = param_->cpuct_init;
     const float parent_qvalue = GetWL(color, false);
 
-    std::vector<Edge*> edge_buf;
+    std::vector<Edge> edge_buf;
 
-    for (auto &child : children_) {
+    for (auto child : children_) {
         const auto node = child.Get();
         const bool is_pointer = node != nullptr;
         if (is_pointer && node->IsValid()) {
             // The node status is pruned or active.
             parentvisits += node->GetVisits();
         }
-        edge_buf.emplace_back(&child);
+        edge_buf.emplace_back(child);
     }
     const float numerator = std::log((float)parentvisits + 1);
 
-    Edge* best_node = nullptr;
+    int best_idx = -1;
     float best_value = std::numeric_limits<float>::lowest();
 
     int width = std::max(ComputeWidth(parentvisits), 1);
@@ -509,10 +846,8 @@ Node *Node::UctSelectChild(const int color, const bool is_root, const GameState
 
     //TODO: Sort the 'edge_buf' according to priority value.
 
-    for (auto edge_ptr : edge_buf) {
-        auto &child = *edge_ptr;
-
-        if (state.board_.IsCaptureMove(edge_ptr->GetVertex(), color)) {
+    for (const auto child : edge_buf) {
+        if (state.board_.IsCaptureMove(child.GetVertex(), color)) {
             width += 1;
         }
 
@@ -551,12 +886,13 @@ Node *Node::UctSelectChild(const int color, const bool is_root, const GameState
 
         if (value > best_value) {
             best_value = value;
-            best_node = edge_ptr;
+            best_idx = child.Index();
         }
     }
 
-    Inflate(*best_node);
-    return best_node->Get();
+    const auto best_node = children_[best_idx];
+    Inflate(best_node);
+    return best_node.Get();
 }
 
 int Node::RandomizeFirstProportionally(float temp, int min_visits) {
@@ -564,7 +900,7 @@ int Node::RandomizeFirstProportionally(float temp, int min_visits) {
     auto accum = float{0.0f};
     auto accum_vector = std::vector<std::pair<float, int>>{};
 
-    for (const auto &child : children_) {
+    for (const auto child : children_) {
         auto node = child.Get();
         const auto visits = node->GetVisits();
         const auto vertex = node->GetVertex();
@@ -611,7 +947,7 @@ void Node::Update(const NodeEvals *evals) {
     const double eval = evals->black_wl;
     const double draw = evals->draw;
     const double black_final_score = evals->black_final_score;
-    const double old_acc_eval = accumulated_black_wl_.load(std::memory_order_relaxed);
+    const double old_acc_eval = accumulated_black_wl_.Load();
 
     const int old_visits = visits_.load(std::memory_order_relaxed);
 
@@ -622,20 +958,61 @@ void Node::Update(const NodeEvals *evals) {
     const double delta = WelfordDelta(eval, old_acc_eval, old_visits);
 
     visits_.fetch_add(1, std::memory_order_relaxed);
-    AtomicFetchAdd(squared_eval_diff_   , delta);
-    AtomicFetchAdd(accumulated_black_wl_, eval);
-    AtomicFetchAdd(accumulated_draw_    , draw);
-    AtomicFetchAdd(accumulated_black_fs_, black_final_score);
-
-    {
-        std::lock_guard<std::mutex> lock(os_mtx_);
+    squared_eval_diff_.Add(delta);
+    accumulated_black_wl_.Add(eval);
+    accumulated_draw_.Add(draw);
+    accumulated_black_fs_.Add(black_final_score);
+
+    if (parent_stats_) {
+        // Mirror the values into parent's compact statistics.
+        const auto idx = parent_index_;
+        parent_stats_->visits[idx].fetch_add(1, std::memory_order_relaxed);
+        parent_stats_->black_wl[idx].fetch_add(
+            EvalAccumulator::ToFixed(eval), std::memory_order_relaxed);
+        parent_stats_->draw[idx].fetch_add(
+            EvalAccumulator::ToFixed(draw), std::memory_order_relaxed);
+        parent_stats_->black_fs[idx].fetch_add(
+            ScoreAccumulator::ToFixed(black_final_score), std::memory_order_relaxed);
+    }
+
+    auto stats = ownership_.load(std::memory_order_acquire);
+    if (stats && evals->has_ownership) {
         for (int idx = 0; idx < kNumIntersections; ++idx) {
-            const double eval_owner = evals->black_ownership[idx];
-            const double avg_owner  = avg_black_ownership_[idx];
-            const double diff_owner = (eval_owner - avg_owner) / (old_visits+1);
-
-            avg_black_ownership_[idx] += diff_owner;
+            stats->accumulated_black_ownership[idx].Add(evals->black_ownership[idx]);
         }
+        stats->visits.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Node::Stats Node::GetStats() const {
+    auto stats = Stats{};
+    stats.visits = visits_.load(std::memory_order_relaxed);
+    stats.black_wl = accumulated_black_wl_.Load();
+    stats.draw = accumulated_draw_.Load();
+    stats.black_fs = accumulated_black_fs_.Load();
+    stats.squared_eval_diff = squared_eval_diff_.Load();
+    return stats;
+}
+
+void Node::AddStats(const Stats &stats) {
+    if (stats.visits <= 0) {
+        return;
+    }
+    visits_.fetch_add(stats.visits, std::memory_order_relaxed);
+    squared_eval_diff_.Add(stats.squared_eval_diff);
+    accumulated_black_wl_.Add(stats.black_wl);
+    accumulated_draw_.Add(stats.draw);
+    accumulated_black_fs_.Add(stats.black_fs);
+
+    if (parent_stats_) {
+        const auto idx = parent_index_;
+        parent_stats_->visits[idx].fetch_add(stats.visits, std::memory_order_relaxed);
+        parent_stats_->black_wl[idx].fetch_add(
+            EvalAccumulator::ToFixed(stats.black_wl), std::memory_order_relaxed);
+        parent_stats_->draw[idx].fetch_add(
+            EvalAccumulator::ToFixed(stats.draw), std::memory_order_relaxed);
+        parent_stats_->black_fs[idx].fetch_add(
+            ScoreAccumulator::ToFixed(stats.black_fs), std::memory_order_relaxed);
     }
 }
 
@@ -644,11 +1021,17 @@ void Node::ApplyEvals(const NodeEvals *evals) {
 }
 
 std::array<float, kNumIntersections> Node::GetOwnership(int color) {
-    std::lock_guard<std::mutex> lock(os_mtx_);
-
     auto out = std::array<float, kNumIntersections>{};
+    auto stats = ownership_.load(std::memory_order_acquire);
+    if (!stats) {
+        out.fill(0.f);
+        return out;
+    }
+
+    const auto visits = std::max(1, stats->visits.load(std::memory_order_relaxed));
     for (int idx = 0; idx < kNumIntersections; ++idx) {
-        auto owner = avg_black_ownership_[idx];
+        auto owner = static_cast<float>(
+                         stats->accumulated_black_ownership[idx].Load() / visits);
         if (color == kWhite) {
             owner = 0.f - owner;
         }
@@ -667,7 +1050,7 @@ float Node::GetScoreUtility(const int color,
 
 float Node::GetLcbVariance(const float default_var, const int visits) const {
     return visits > 1 ?
-               squared_eval_diff_.load(std::memory_order_relaxed) / (visits - 1) :
+               squared_eval_diff_.Load() / (visits - 1) :
                default_var;
 }
 
@@ -745,12 +1128,13 @@ std::string Node::ToVerboseString(GameState &state, const int color) {
     auto edges = size_t{0};
     ComputeNodeCount(nodes, edges);
 
-    const auto node_mem = sizeof(Node) + sizeof(Edge);
-    const auto edge_mem = sizeof(Edge);
+    const auto node_mem = sizeof(Node) + Edges::kEntryBytes + Edges::kSlotBytes;
+    const auto edge_mem = Edges::kEntryBytes;
 
     // There is some error to compute memory used. It is because that
     // we may not collect all node conut. 
     const auto mem_used = static_cast<double>(nodes * node_mem + edges * edge_mem) / (1024.f * 1024.f);
+    const auto arena_used = static_cast<double>(NodeArena<sizeof(Node)>::GetAllocatedBytes()) / (1024.f * 1024.f);
 
     const auto space2 = 10;
     out << " * Tree Status:" << std::endl
@@ -759,38 +1143,61 @@ std::string Node::ToVerboseString(GameState &state, const int color) {
             << std::setw(space2) << "root C:"  << ' ' << ComputeTreeComplexity() << std::endl
             << std::setw(space2) << "nodes:"   << ' ' << nodes    << std::endl
             << std::setw(space2) << "edges:"   << ' ' << edges    << std::endl
-            << std::setw(space2) << "memory:"  << ' ' << mem_used << ' ' << "(MiB)" << std::endl;
+            << std::setw(space2) << "memory:"  << ' ' << mem_used << ' ' << "(MiB)" << std::endl
+            << std::setw(space2) << "arena:"   << ' ' << arena_used << ' ' << "(MiB)";
+    const auto arena_page = NodeArena<sizeof(Node)>::GetPageSize();
+    if (HugePages::Enabled() && arena_page > 0) {
+        out << ' ' << "on the " << HugePages::GetPageSizeString(arena_page) << " pages";
+    }
+    out << std::endl;
 
     return out.str();
 }
 
-std::string Node::OwnershipToString(GameState &state, const int color, std::string name, Node *node) {
-    auto out = std::ostringstream{};
+// Same as GameState::VertexToText, but without the string stream.
+static void AppendVertexText(TextBuffer &out, GameState &state, const int vtx) {
+    if (vtx == kPass) {
+        out.Append("pass");
+        return;
+    }
+    if (vtx == kResign) {
+        out.Append("resign");
+        return;
+    }
+    const auto x = state.GetX(vtx);
+    const auto y = state.GetY(vtx);
+    const auto offset = static_cast<char>(x + 'A') >= 'I' ? 1 : 0;
+
+    out.Append(static_cast<char>(x + offset + 'A'));
+    out.AppendInt(y + 1);
+}
+
+void Node::OwnershipToString(GameState &state, const int color,
+                             const char *name, Node *node, TextBuffer &out) {
     const auto board_size = state.GetBoardSize();
 
     auto ownership = node->GetOwnership(color);
 
-    out << name << ' ';
+    out.Append(name).Append(' ');
     for (int y = board_size-1; y >= 0; --y) {
         for (int x = 0; x < board_size; ++x) {
-            out << Format("%.6f ", ownership[state.GetIndex(x,y)]);
+            out.AppendFixed(ownership[state.GetIndex(x,y)], 6).Append(' ');
         }
     }
-
-    return out.str();
 }
 
-std::string Node::ToAnalysisString(GameState &state,
-                                       const int color,
-                                       AnalysisConfig &config) {
+void Node::ToAnalysisString(GameState &state,
+                                const int color,
+                                AnalysisConfig &config,
+                                TextBuffer &out) {
     // Gather the analysis string. You can see the detail here
     // https://github.com/SabakiHQ/Sabaki/blob/master/docs/guides/engine-analysis-integration.md
 
-    auto out = std::ostringstream{};
+    out.Clear();
     const auto lcblist = GetLcbUtilityList(color);
 
     if (lcblist.empty()) {
-        return std::string{};
+        return;
     }
 
     const auto root_visits = static_cast<float>(GetVisits() - 1);
@@ -814,85 +1221,250 @@ std::string Node::ToAnalysisString(GameState &state,
         const auto winrate = child->GetWL(color, false);
         const auto visits = child->GetVisits();
         const auto prior = child->GetPolicy();
-        const auto pv_string = state.VertexToText(vertex) + ' ' + child->GetPvString(state);
 
         if (param_->no_dcnn &&
                 visits/root_visits < 0.01f) { // cut off < 1% children...
             continue;
         }
 
-        if (is_sayuri) {
-            const auto kl = child->ComputeKlDivergence();
-            const auto complexity = child->ComputeTreeComplexity();
-            out << Format("info move %s visits %d winrate %.6f scorelead %.6f prior %.6f lcb %.6f kl %.6f complexity %.6f order %d pv %s",
-                             state.VertexToText(vertex).c_str(),
-                             visits,
-                             winrate,
-                             final_score,
-                             prior,
-                             lcb,
-                             kl,
-                             complexity,
-                             order,
-                             pv_string.c_str()
-                         );
-        } else if (is_kata) {
-            out << Format("info move %s visits %d winrate %.6f scoreLead %.6f prior %.6f lcb %.6f order %d pv %s",
-                             state.VertexToText(vertex).c_str(),
-                             visits,
-                             winrate,
-                             final_score,
-                             prior,
-                             lcb,
-                             order,
-                             pv_string.c_str()
-                         );
+        out.Append("info move ");
+        AppendVertexText(out, state, vertex);
+        out.Append(" visits ").AppendInt(visits);
+
+        if (is_sayuri || is_kata) {
+            out.Append(" winrate ").AppendFixed(winrate, 6);
+            out.Append(is_sayuri ? " scorelead " : " scoreLead ").AppendFixed(final_score, 6);
+            out.Append(" prior ").AppendFixed(prior, 6);
+            out.Append(" lcb ").AppendFixed(lcb, 6);
+            if (is_sayuri) {
+                out.Append(" kl ").AppendFixed(child->ComputeKlDivergence(), 6);
+                out.Append(" complexity ").AppendFixed(child->ComputeTreeComplexity(), 6);
+            }
         } else {
-            out << Format("info move %s visits %d winrate %d scoreLead %.6f prior %d lcb %d order %d pv %s",
-                             state.VertexToText(vertex).c_str(),
-                             visits,
-                             std::min(10000, (int)(10000 * winrate)),
-                             final_score,
-                             std::min(10000, (int)(10000 * prior)),
-                             std::min(10000, (int)(10000 * lcb)),
-                             order,
-                             pv_string.c_str()
-                         );
+            out.Append(" winrate ").AppendInt(std::min(10000, (int)(10000 * winrate)));
+            out.Append(" scoreLead ").AppendFixed(final_score, 6);
+            out.Append(" prior ").AppendInt(std::min(10000, (int)(10000 * prior)));
+            out.Append(" lcb ").AppendInt(std::min(10000, (int)(10000 * lcb)));
         }
+        out.Append(" order ").AppendInt(order);
+        out.Append(" pv ");
+        AppendVertexText(out, state, vertex);
+        out.Append(' ');
+        child->GetPvString(state, out);
+
         if (use_moves_ownership) {
             if (is_sayuri) {
-                out << OwnershipToString(state, color, "movesownership", child);
+                OwnershipToString(state, color, "movesownership", child, out);
             } else {
-                out << OwnershipToString(state, color, "movesOwnership", child);
+                OwnershipToString(state, color, "movesOwnership", child, out);
             }
         }
         order += 1;
     }
 
     if (use_ownership) {
-        out << OwnershipToString(state, color, "ownership", this->Get());
+        OwnershipToString(state, color, "ownership", this->Get(), out);
+    }
+
+    out.Append('\n');
+}
+
+// The binary record is the text header "binfo <size>" and the new line,
+// then the payload of <size> bytes and the new line. All numbers are in
+// the native byte order. The vertex is the index x + y * board_size, or
+// -1 for pass.
+//
+//   int16  board size
+//   int16  number of moves
+//   every move:
+//     int16   vertex
+//     int32   visits
+//     float   winrate, score lead, prior, lcb
+//     int16   length of pv, then the pv vertices
+//     uint8   1 if the move ownership follows
+//     float   ownership of every intersection, top row first
+//   uint8  1 if the root ownership follows
+//   float  ownership of every intersection, top row first
+void Node::ToAnalysisBinary(GameState &state,
+                                const int color,
+                                AnalysisConfig &config,
+                                TextBuffer &out) {
+    thread_local auto payload = TextBuffer{};
+
+    out.Clear();
+    payload.Clear();
+    const auto lcblist = GetLcbUtilityList(color);
+
+    if (lcblist.empty()) {
+        return;
     }
 
-    out << std::endl;
+    const auto root_visits = static_cast<float>(GetVisits() - 1);
+    const auto board_size = state.GetBoardSize();
+
+    const auto ToIndex = [&state, board_size](const int vtx) -> std::int16_t {
+        if (vtx == kPass || vtx == kResign) {
+            return -1;
+        }
+        return state.GetX(vtx) + state.GetY(vtx) * board_size;
+    };
+    const auto AppendOwnership = [&state, board_size, color](Node *node) {
+        const auto ownership = node->GetOwnership(color);
+        for (int y = board_size-1; y >= 0; --y) {
+            for (int x = 0; x < board_size; ++x) {
+                payload.AppendBinary<float>(ownership[state.GetIndex(x,y)]);
+            }
+        }
+    };
+
+    payload.AppendBinary<std::int16_t>(board_size);
+    payload.AppendBinary<std::int16_t>(0); // filled later
+
+    auto pvlist = std::vector<int>{};
+    int order = 0;
+    for (auto &lcb_pair : lcblist) {
+        if (order+1 > config.max_moves) {
+            break;
+        }
+
+        const auto lcb = lcb_pair.first > 0.0f ? lcb_pair.first : 0.0f;
+        const auto vertex = lcb_pair.second;
+
+        auto child = GetChild(vertex);
+        const auto visits = child->GetVisits();
+
+        if (param_->no_dcnn &&
+                visits/root_visits < 0.01f) { // cut off < 1% children...
+            continue;
+        }
+
+        payload.AppendBinary<std::int16_t>(ToIndex(vertex));
+        payload.AppendBinary<std::int32_t>(visits);
+        payload.AppendBinary<float>(child->GetWL(color, false));
+        payload.AppendBinary<float>(child->GetFinalScore(color));
+        payload.AppendBinary<float>(child->GetPolicy());
+        payload.AppendBinary<float>(lcb);
+
+        pvlist.clear();
+        pvlist.emplace_back(vertex);
+        auto *next = child;
+        while (next->HaveChildren()) {
+            const auto vtx = next->GetBestMove();
+            pvlist.emplace_back(vtx);
+            next = next->GetChild(vtx);
+        }
+        payload.AppendBinary<std::int16_t>(pvlist.size());
+        for (const auto vtx : pvlist) {
+            payload.AppendBinary<std::int16_t>(ToIndex(vtx));
+        }
+
+        payload.AppendBinary<std::uint8_t>(config.moves_ownership);
+        if (config.moves_ownership) {
+            AppendOwnership(child);
+        }
+        order += 1;
+    }
+
+    payload.AppendBinary<std::uint8_t>(config.ownership);
+    if (config.ownership) {
+        AppendOwnership(this->Get());
+    }
+
+    payload.WriteBinary<std::int16_t>(sizeof(std::int16_t), order);
+
+    out.Append("binfo ").AppendInt(payload.Size()).Append('\n');
+    out.Append(payload.Get()).Append('\n');
+}
+
+std::string Node::ToAnalysisJson(GameState &state,
+                                     const int color,
+                                     const int max_moves) {
+    auto out = std::ostringstream{};
+    const auto lcblist = GetLcbUtilityList(color);
+    const auto root_visits = static_cast<float>(GetVisits() - 1);
+
+    out << '[';
+
+    int order = 0;
+    for (auto &lcb_pair : lcblist) {
+        if (order+1 > max_moves) {
+            break;
+        }
+
+        const auto lcb = lcb_pair.first > 0.0f ? lcb_pair.first : 0.0f;
+        const auto vertex = lcb_pair.second;
+
+        auto child = GetChild(vertex);
+        const auto visits = child->GetVisits();
+
+        if (param_->no_dcnn &&
+                visits/root_visits < 0.01f) { // cut off < 1% children...
+            continue;
+        }
+
+        auto pv = std::ostringstream{};
+        pv << '"' << state.VertexToText(vertex) << '"';
+        auto *next = child;
+        while (next->HaveChildren()) {
+            const auto vtx = next->GetBestMove();
+            pv << ",\"" << state.VertexToText(vtx) << '"';
+            next = next->GetChild(vtx);
+        }
+
+        if (order > 0) {
+            out << ',';
+        }
+        out << Format("{\"move\":\"%s\",\"visits\":%d,\"winrate\":%.6f,\"scoreLead\":%.6f,\"prior\":%.6f,\"lcb\":%.6f,\"order\":%d,\"pv\":[%s]}",
+                         state.VertexToText(vertex).c_str(),
+                         visits,
+                         child->GetWL(color, false),
+                         child->GetFinalScore(color),
+                         child->GetPolicy(),
+                         lcb,
+                         order,
+                         pv.str().c_str()
+                     );
+        order += 1;
+    }
+
+    out << ']';
+
+    return out.str();
+}
+
+std::string Node::OwnershipToJson(GameState &state, const int color) {
+    auto out = std::ostringstream{};
+    const auto board_size = state.GetBoardSize();
+    const auto ownership = GetOwnership(color);
+
+    out << '[';
+    for (int y = board_size-1; y >= 0; --y) {
+        for (int x = 0; x < board_size; ++x) {
+            if (y != board_size-1 || x != 0) {
+                out << ',';
+            }
+            out << Format("%.6f", ownership[state.GetIndex(x,y)]);
+        }
+    }
+    out << ']';
 
     return out.str();
 }
 
 std::string Node::GetPvString(GameState &state) {
-    auto pvlist = std::vector<int>{};
+    auto out = TextBuffer{};
+    GetPvString(state, out);
+    return out.Get();
+}
+
+void Node::GetPvString(GameState &state, TextBuffer &out) {
     auto *next = this;
     while (next->HaveChildren()) {
         const auto vtx = next->GetBestMove();
-        pvlist.emplace_back(vtx);
+        AppendVertexText(out, state, vtx);
+        out.Append(' ');
         next = next->GetChild(vtx);
     }
-  
-    auto res = std::string{};
-    for (const auto &vtx : pvlist) {
-        res += state.VertexToText(vtx);
-        res += " ";
-    }
-    return res;
 }
 
 Node *Node::Get() {
@@ -900,7 +1472,7 @@ Node *Node::Get() {
 }
 
 Node *Node::GetChild(const int vertex) {
-    for (auto & child : children_) {
+    for (auto child : children_) {
         if (vertex == child.GetVertex()) {
             Inflate(child);
             return child.Get();
@@ -912,11 +1484,16 @@ Node *Node::GetChild(const int vertex) {
 Node *Node::PopChild(const int vertex) {
     auto node = GetChild(vertex);
     if (node) {
-        auto ite = std::remove_if(std::begin(children_), std::end(children_),
-                                  [node](Edge &ele) {
-                                      return ele.Get() == node;
-                                  });
-        children_.erase(ite, std::end(children_));
+        // The node will be the new root. It has no parent.
+        node->LinkParentStats(nullptr, -1);
+
+        children_.RemoveIf([node](const Edges::ConstEdge ele) {
+                               return ele.Get() == node;
+                           });
+
+        if (child_stats_) {
+            BuildChildStats();
+        }
     }
     return node;
 }
@@ -932,18 +1509,24 @@ std::vector<std::pair<float, int>> Node::GetLcbUtilityList(const int color) {
     const auto score = GetFinalScore(color);
     const auto score_utility_div = param_->score_utility_div;
 
-    auto list = std::vector<std::pair<float, int>>{};
-
-    for (const auto & child : children_) {
-        const auto node = child.Get();
-        const bool is_pointer = node != nullptr;
-
-        if (is_pointer && node->IsActive()) {
-            parentvisits += node->GetVisits();
-        }
-    }
-
-    for (const auto & child : children_) {
+    // Gather the statistics of the visited children into the flat
+    // arrays first, then compute all bounds in the batched passes.
+    thread_local auto visits = std::vector<int>{};
+    thread_local auto vertices = std::vector<int>{};
+    thread_local auto means = std::vector<float>{};
+    thread_local auto variances = std::vector<float>{};
+    thread_local auto policies = std::vector<float>{};
+    thread_local auto scores = std::vector<float>{};
+    thread_local auto lcbs = std::vector<float>{};
+
+    visits.clear();
+    vertices.clear();
+    means.clear();
+    variances.clear();
+    policies.clear();
+    scores.clear();
+
+    for (const auto child : children_) {
         const auto node = child.Get();
         const bool is_pointer = node != nullptr;
 
@@ -952,18 +1535,38 @@ std::vector<std::pair<float, int>> Node::GetLcbUtilityList(const int color) {
             continue;
         }
 
-        const auto visits = node->GetVisits();
-        if (visits > 0) {
-            auto lcb = node->GetLcb(color);
-            auto utility = lcb_utility_factor *
-                               node->GetScoreUtility(
-                                   color, score_utility_div, score);
-            const auto ulcb = (lcb + utility) * (1.f - lcb_reduction) + 
-                                  lcb_reduction * ((float)visits/parentvisits);
-            list.emplace_back(ulcb, node->GetVertex());
+        const auto node_visits = node->GetVisits();
+        parentvisits += node_visits;
+        if (node_visits > 0) {
+            visits.emplace_back(node_visits);
+            vertices.emplace_back(node->GetVertex());
+            means.emplace_back(node->GetWL(color, false));
+            variances.emplace_back(node->GetLcbVariance(1.0f, node_visits));
+            policies.emplace_back(node->GetPolicy());
+            scores.emplace_back(node->GetFinalScore(color) + node->score_bouns_);
         }
     }
 
+    const int size = visits.size();
+    lcbs.resize(size);
+    LcbEntries::Get().ComputeLcbs(size,
+                                  visits.data(),
+                                  means.data(),
+                                  variances.data(),
+                                  policies.data(),
+                                  lcbs.data());
+
+    auto list = std::vector<std::pair<float, int>>{};
+    list.reserve(size);
+
+    for (int i = 0; i < size; ++i) {
+        const auto utility = lcb_utility_factor *
+                                 std::tanh((scores[i] - score)/score_utility_div);
+        const auto ulcb = (lcbs[i] + utility) * (1.f - lcb_reduction) + 
+                              lcb_reduction * ((float)visits[i]/parentvisits);
+        list.emplace_back(ulcb, vertices[i]);
+    }
+
     std::stable_sort(std::rbegin(list), std::rend(list));
     return list;
 }
@@ -993,7 +1596,7 @@ int Node::GetBestMove() {
     return best_move;
 }
 
-const std::vector<Node::Edge> &Node::GetChildren() const {
+const Node::Edges &Node::GetChildren() const {
     return children_;
 }
 
@@ -1018,8 +1621,12 @@ int Node::GetVisits() const {
     return visits_.load(std::memory_order_relaxed);
 }
 
+int Node::GetRunningThreads() const {
+    return running_threads_.load(std::memory_order_relaxed);
+}
+
 float Node::GetFinalScore(const int color) const {
-    auto score = accumulated_black_fs_.load(std::memory_order_relaxed) / GetVisits();
+    auto score = accumulated_black_fs_.Load() / GetVisits();
 
     if (color == kBlack) {
         return score;
@@ -1028,7 +1635,7 @@ float Node::GetFinalScore(const int color) const {
 }
 
 float Node::GetDraw() const {
-    return accumulated_draw_.load(std::memory_order_relaxed) / GetVisits();
+    return accumulated_draw_.Load() / GetVisits();
 }
 
 float Node::GetNetWL(const int color) const {
@@ -1048,7 +1655,7 @@ float Node::GetWL(const int color, const bool use_virtual_loss) const {
     }
 
     auto visits = GetVisits() + virtual_loss;
-    auto accumulated_wl = accumulated_black_wl_.load(std::memory_order_relaxed);
+    auto accumulated_wl = accumulated_black_wl_.Load();
     if (color == kWhite && use_virtual_loss) {
         accumulated_wl += static_cast<double>(virtual_loss);
     }
@@ -1061,26 +1668,38 @@ float Node::GetWL(const int color, const bool use_virtual_loss) const {
 }
 
 void Node::InflateAllChildren() {
-    for (auto &child : children_) {
+    for (auto child : children_) {
          Inflate(child);
     }
 }
 
 void Node::ReleaseAllChildren() {
-    for (auto &child : children_) {
+    for (auto child : children_) {
          Release(child);
     }
 }
 
-void Node::Inflate(Edge& child) {
-    if (child.Inflate()) {
-        child.Get()->SetParameters(param_);
-    }
+void Node::Inflate(const Edge child) {
+    auto stats = child_stats_.get();
+    const int idx = child.Index();
+
+    child.Inflate(
+        [this, stats, idx](Node *node) {
+            Metrics::Add(Metrics::kNodesInflated);
+            node->SetParameters(param_);
+            if (stats) {
+                node->LinkParentStats(stats, idx);
+            }
+        });
 }
 
-void Node::Release(Edge& child) {
+void Node::Release(const Edge child) {
     if (child.Release()) {
-        // do nothing...
+        if (child_stats_) {
+            // The edge is uninflated now. Reset the slot.
+            const int idx = child.Index();
+            child_stats_->ResetSlot(idx, child.GetVertex(), child.GetPolicy());
+        }
     }
 }
 
@@ -1090,22 +1709,40 @@ bool Node::HaveChildren() const {
 
 void Node::IncrementThreads() {
     running_threads_.fetch_add(1, std::memory_order_relaxed);
+    if (parent_stats_) {
+        parent_stats_->threads[parent_index_].fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
 void Node::DecrementThreads() {
     running_threads_.fetch_sub(1, std::memory_order_relaxed);
+    if (parent_stats_) {
+        parent_stats_->threads[parent_index_].fetch_sub(1, std::memory_order_relaxed);
+    }
 }
 
 void Node::SetActive(const bool active) {
     if (IsValid()) {
         StatusType v = active ? StatusType::kActive : StatusType::kPruned;
         status_.store(v, std::memory_order_relaxed);
+        if (parent_stats_) {
+            auto &flags = parent_stats_->flags[parent_index_];
+            if (active) {
+                flags.fetch_and(~ChildStats::kPrunedBit, std::memory_order_relaxed);
+            } else {
+                flags.fetch_or(ChildStats::kPrunedBit, std::memory_order_relaxed);
+            }
+        }
     }
 }
 
 void Node::Invalidate() {
     if (IsValid()) {
         status_.store(StatusType::kInvalid, std::memory_order_relaxed);
+        if (parent_stats_) {
+            parent_stats_->flags[parent_index_].fetch_or(
+                ChildStats::kInvalidBit, std::memory_order_relaxed);
+        }
     }
 }
 
@@ -1124,7 +1761,13 @@ bool Node::IsValid() const {
 bool Node::AcquireExpanding() {
     auto expected = ExpandState::kInitial;
     auto newval = ExpandState::kExpanding;
-    return expand_state_.compare_exchange_strong(expected, newval, std::memory_order_acquire);
+    const auto success =
+        expand_state_.compare_exchange_strong(expected, newval, std::memory_order_acquire);
+    if (success && parent_stats_) {
+        parent_stats_->flags[parent_index_].fetch_or(
+            ChildStats::kExpandingBit, std::memory_order_relaxed);
+    }
+    return success;
 }
 
 void Node::ExpandDone() {
@@ -1133,6 +1776,10 @@ void Node::ExpandDone() {
     (void) v;
 #endif
     assert(v == ExpandState::kExpanding);
+    if (parent_stats_) {
+        parent_stats_->flags[parent_index_].fetch_and(
+            ~ChildStats::kExpandingBit, std::memory_order_relaxed);
+    }
 }
 
 void Node::ExpandCancel() {
@@ -1141,6 +1788,10 @@ void Node::ExpandCancel() {
     (void) v;
 #endif
     assert(v == ExpandState::kExpanding);
+    if (parent_stats_) {
+        parent_stats_->flags[parent_index_].fetch_and(
+            ~ChildStats::kExpandingBit, std::memory_order_relaxed);
+    }
 }
 
 void Node::WaitExpanded() const {
@@ -1168,12 +1819,9 @@ bool Node::IsExpanded() const {
 }
 
 void Node::ApplyDirichletNoise(const float alpha) {
-    auto child_cnt = children_.size();
+    auto child_cnt = children_.Size();
     auto buffer = std::vector<float>(child_cnt);
-    auto gamma = std::gamma_distribution<float>(alpha, 1.0f);
-
-    std::generate(std::begin(buffer), std::end(buffer),
-                      [&gamma] () { return gamma(Random<>::Get()); });
+    RandomBatch::FillGamma(buffer.data(), child_cnt, alpha);
 
     auto sample_sum =
         std::accumulate(std::begin(buffer), std::end(buffer), 0.0f);
@@ -1192,13 +1840,13 @@ void Node::ApplyDirichletNoise(const float alpha) {
         v /= sample_sum;
     }
 
-    for (auto i = size_t{0}; i < child_cnt; ++i) {
+    for (int i = 0; i < child_cnt; ++i) {
         const auto vertex = children_[i].GetVertex();
         dirichlet[vertex] = buffer[i];
     }
 }
 
-float Node::GetSearchPolicy(Node::Edge& child, bool noise) {
+float Node::GetSearchPolicy(const Node::Edge child, bool noise) {
     auto policy = child.GetPolicy();
     if (noise) {
         const auto vertex = child.GetVertex();
@@ -1251,6 +1899,258 @@ void Node::ComputeNodeCount(size_t &nodes, size_t &edges) {
     }
 }
 
+size_t Node::GetTreeMemoryUsed() {
+    auto nodes = size_t{0};
+    auto edges = size_t{0};
+    ComputeNodeCount(nodes, edges);
+
+    // Only the root node and its children own the ownership storage.
+    // It is too small to be count.
+    return nodes * GetNodeMemory() + edges * GetEdgeMemory();
+}
+
+size_t Node::GetNodeMemory() {
+    return sizeof(Node) + Edges::kEntryBytes + Edges::kSlotBytes;
+}
+
+size_t Node::GetEdgeMemory() {
+    return Edges::kEntryBytes;
+}
+
+size_t Node::ReleaseSmallSubtrees(const int min_visits) {
+    // Use DFS to search all nodes. Be sure that there is no
+    // other thread in the tree.
+    auto stk = std::stack<Node *>{};
+    auto released = size_t{0};
+
+    // Always keep the children of root node because the analysis
+    // and the best move need them.
+    for (auto child : children_) {
+        const auto node = child.Get();
+        if (node && node->IsExpanded()) {
+            stk.emplace(node);
+        }
+    }
+
+    while (!stk.empty()) {
+        Node *node = stk.top();
+        stk.pop();
+
+        for (auto child : node->children_) {
+            const auto next = child.Get();
+            if (!next) {
+                continue;
+            }
+            if (next->GetVisits() < min_visits &&
+                    !next->IsExpanding()) {
+                // Prune the sub-tree. The edge goes back to uninflated
+                // state and keeps the vertex and policy.
+                node->Release(child);
+                released++;
+            } else if (next->IsExpanded()) {
+                stk.emplace(next);
+            }
+        }
+    }
+    return released;
+}
+
+// The tree record of one node, in the pre-order of the tree:
+//
+//   int16 vertex, float policy, uint8 status, uint8 flags, int8 color,
+//   float net black win-loss, int32 visits, double black win-loss,
+//   double draw, double black final score, double squared eval diff,
+//   int32 number of children,
+//   (uint16 vertex, uint16 half policy) for every edge, the top bit
+//     of the vertex is set if the edge is inflated,
+//   int32 visible children and uint16 order for every edge, if the
+//     order flag is set,
+//   int32 ownership visits and float black ownership for every
+//     intersection, if the ownership flag is set,
+//
+// and then the records of the inflated children in the edge order.
+// The values are in the native byte order.
+static constexpr std::uint8_t kTreeExpandedFlag = 1 << 0;
+static constexpr std::uint8_t kTreeOwnershipFlag = 1 << 1;
+static constexpr std::uint8_t kTreeOrderFlag = 1 << 2;
+static constexpr std::uint16_t kTreeInflatedBit = 1 << 15;
+
+template<typename T>
+static void WriteTreeValue(std::ostream &out, const T value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template<typename T>
+static bool ReadTreeValue(std::istream &in, T &value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+
+void Node::SaveTree(std::ostream &out) {
+    const auto ownership = ownership_.load(std::memory_order_relaxed);
+    const int size = children_.Size();
+
+    auto flags = std::uint8_t{0};
+    if (IsExpanded()) {
+        flags |= kTreeExpandedFlag;
+    }
+    if (ownership) {
+        flags |= kTreeOwnershipFlag;
+    }
+    if (order_) {
+        flags |= kTreeOrderFlag;
+    }
+
+    WriteTreeValue(out, std::int16_t(vertex_));
+    WriteTreeValue(out, policy_);
+    WriteTreeValue(out, std::uint8_t(status_.load(std::memory_order_relaxed)));
+    WriteTreeValue(out, flags);
+    WriteTreeValue(out, std::int8_t(color_));
+    WriteTreeValue(out, black_wl_);
+    const auto stats = GetStats();
+    WriteTreeValue(out, std::int32_t(stats.visits));
+    WriteTreeValue(out, stats.black_wl);
+    WriteTreeValue(out, stats.draw);
+    WriteTreeValue(out, stats.black_fs);
+    WriteTreeValue(out, stats.squared_eval_diff);
+
+    WriteTreeValue(out, std::int32_t(size));
+    for (const auto child : children_) {
+        WriteTreeValue(out, std::uint16_t(child.GetVertex() |
+                                              (child.IsPointer() ? kTreeInflatedBit : 0)));
+        WriteTreeValue(out, Half::FromFloat(child.GetPolicy()));
+    }
+    if (order_) {
+        WriteTreeValue(out, std::int32_t(visible_children_.load(std::memory_order_relaxed)));
+        for (int i = 0; i < size; ++i) {
+            WriteTreeValue(out, order_[i]);
+        }
+    }
+    if (ownership) {
+        WriteTreeValue(out, std::int32_t(ownership->visits.load(std::memory_order_relaxed)));
+        for (const auto &owner : ownership->accumulated_black_ownership) {
+            WriteTreeValue(out, static_cast<float>(owner.Load()));
+        }
+    }
+
+    for (const auto child : children_) {
+        const auto node = child.Get();
+        if (node) {
+            node->SaveTree(out);
+        }
+    }
+}
+
+bool Node::LoadTree(std::istream &in) {
+    auto vertex = std::int16_t{0};
+    auto status = std::uint8_t{0};
+    auto flags = std::uint8_t{0};
+    auto color = std::int8_t{0};
+    auto visits = std::int32_t{0};
+    auto stats = Stats{};
+    auto size = std::int32_t{0};
+
+    if (!ReadTreeValue(in, vertex) ||
+            !ReadTreeValue(in, policy_) ||
+            !ReadTreeValue(in, status) ||
+            !ReadTreeValue(in, flags) ||
+            !ReadTreeValue(in, color) ||
+            !ReadTreeValue(in, black_wl_) ||
+            !ReadTreeValue(in, visits) ||
+            !ReadTreeValue(in, stats.black_wl) ||
+            !ReadTreeValue(in, stats.draw) ||
+            !ReadTreeValue(in, stats.black_fs) ||
+            !ReadTreeValue(in, stats.squared_eval_diff) ||
+            !ReadTreeValue(in, size)) {
+        return false;
+    }
+    if (status > std::uint8_t(StatusType::kActive) ||
+            visits < 0 || size < 0 || size > kNumVertices + 10) {
+        return false;
+    }
+    vertex_ = vertex;
+    color_ = color;
+    status_.store(StatusType(status), std::memory_order_relaxed);
+    visits_.store(visits, std::memory_order_relaxed);
+    accumulated_black_wl_.Store(stats.black_wl);
+    accumulated_draw_.Store(stats.draw);
+    accumulated_black_fs_.Store(stats.black_fs);
+    squared_eval_diff_.Store(stats.squared_eval_diff);
+
+    auto inflated = std::vector<bool>(size);
+    if (size > 0) {
+        children_.Reserve(size);
+    }
+    for (int i = 0; i < size; ++i) {
+        auto child_vertex = std::uint16_t{0};
+        auto child_policy = std::uint16_t{0};
+        if (!ReadTreeValue(in, child_vertex) ||
+                !ReadTreeValue(in, child_policy)) {
+            return false;
+        }
+        inflated[i] = child_vertex & kTreeInflatedBit;
+        children_.Append(child_vertex & ~kTreeInflatedBit, Half::ToFloat(child_policy));
+    }
+
+    if (flags & kTreeOrderFlag) {
+        auto visible = std::int32_t{0};
+        auto order = std::make_unique<std::uint16_t[]>(size);
+        if (!ReadTreeValue(in, visible) || visible < 0 || visible > size) {
+            return false;
+        }
+        for (int i = 0; i < size; ++i) {
+            if (!ReadTreeValue(in, order[i]) || order[i] >= size) {
+                return false;
+            }
+        }
+        // Keep the order only if the partial expansion is still on.
+        // Otherwise all children are selectable.
+        if (param_->partial_expansion > 0 &&
+                !param_->compact_child_stats && !param_->no_dcnn) {
+            order_ = std::move(order);
+            visible_children_.store(visible, std::memory_order_relaxed);
+        }
+    }
+
+    if (flags & kTreeOwnershipFlag) {
+        AllocateOwnership();
+        auto ownership = ownership_.load(std::memory_order_relaxed);
+        auto ownership_visits = std::int32_t{0};
+        if (!ReadTreeValue(in, ownership_visits)) {
+            return false;
+        }
+        ownership->visits.store(ownership_visits, std::memory_order_relaxed);
+        for (auto &owner : ownership->accumulated_black_ownership) {
+            auto value = 0.f;
+            if (!ReadTreeValue(in, value)) {
+                return false;
+            }
+            owner.Store(value);
+        }
+    }
+
+    for (int i = 0; i < size; ++i) {
+        if (!inflated[i]) {
+            continue;
+        }
+        const auto child = children_[i];
+        Inflate(child);
+        const auto node = child.Get();
+        if (!node->LoadTree(in) ||
+                node->GetVertex() != child.GetVertex()) {
+            return false;
+        }
+    }
+
+    // Link the loaded children with their values.
+    if (size > 0 && param_->compact_child_stats) {
+        BuildChildStats();
+    }
+    expand_state_.store((flags & kTreeExpandedFlag) ?
+                            ExpandState::kExpanded : ExpandState::kInitial,
+                            std::memory_order_release);
+    return true;
+}
+
 float Node::GetGumbelQValue(int color, float parent_score) const {
     // Get non-normalized complete Q value. In the original
     // paper, it is Q value. We mixe Q value and score lead
@@ -1277,7 +2177,7 @@ std::vector<float> Node::GetProbLogitsCompletedQ(GameState &state) {
     auto prob = std::vector<float>(num_intersections+1, 0.f);
     float acc = 0.f;
 
-    for (auto & child : children_) {
+    for (auto child : children_) {
         const auto vtx = child.GetVertex();
         int idx = num_intersections; // pass move
         if (vtx != kPass) {
@@ -1313,7 +2213,7 @@ void Node::MixLogitsCompletedQ(GameState &state, std::vector<float> &prob) {
     float weighted_pi = 0.f;
 
     // Gather some basic informations.
-    for (auto & child : children_) {
+    for (auto child : children_) {
         const auto node = child.Get();
         const bool is_pointer = node != nullptr;
 
@@ -1337,7 +2237,7 @@ void Node::MixLogitsCompletedQ(GameState &state, std::vector<float> &prob) {
     float min_completed_q = std::numeric_limits<float>::max();
     float raw_value = this->GetGumbelQValue(color, parent_score);
 
-    for (auto & child : children_) {
+    for (auto child : children_) {
         const auto node = child.Get();
         const bool is_pointer = node != nullptr;
 
@@ -1369,7 +2269,7 @@ void Node::MixLogitsCompletedQ(GameState &state, std::vector<float> &prob) {
 
     // Apply the completed Q with policy.
     int completed_q_idx = 0;
-    for (auto & child : children_) {
+    for (auto child : children_) {
         const auto vtx = child.GetVertex();
         int idx = num_intersections; // pass move
         if (vtx != kPass) {
@@ -1471,7 +2371,7 @@ void Node::ProcessGumbelLogits(std::vector<float> &gumbel_logits,
             table[idx] * rounds + height + 
                 (visits_this_round - m*adj_considered_moves)/width;
 
-    for (auto &child : children_) {
+    for (auto child : children_) {
         const auto node = child.Get();
         const bool is_pointer = node != nullptr;
 
@@ -1506,18 +2406,22 @@ Node *Node::GumbelSelectChild(int color, bool only_max_visit) {
     WaitExpanded();
     assert(HaveChildren());
 
-    auto gumbel_type1 = std::extreme_value_distribution<float>(0, 1);
     auto gumbel_logits = std::vector<float>(kNumVertices+10, -1e6f);
     int parentvisits = 0;
     int max_visits = 0;
 
+    // Draw the noise of all children at once.
+    thread_local auto gumbel_noise = std::vector<float>{};
+    gumbel_noise.resize(children_.Size());
+    RandomBatch::FillGumbel(gumbel_noise.data(), gumbel_noise.size());
+
     // Gather all parent's visits.
-    for (auto &child : children_) {
+    for (auto child : children_) {
         const auto node = child.Get();
         const bool is_pointer = node != nullptr;
 
         gumbel_logits[child.GetVertex()] =
-            gumbel_type1(Random<>::Get()) +
+            gumbel_noise[child.Index()] +
                 std::log((double)(child.GetPolicy()) + 1e-8f);
 
         if (is_pointer && node->IsValid()) {
@@ -1529,24 +2433,25 @@ Node *Node::GumbelSelectChild(int color, bool only_max_visit) {
     }
 
     const int considered_moves =
-        std::min(param_->gumbel_considered_moves, (int)children_.size());
+        std::min(param_->gumbel_considered_moves, (int)children_.Size());
     ProcessGumbelLogits(gumbel_logits, color,
                             parentvisits, max_visits,
                             considered_moves, -1e6f,
                             only_max_visit);
 
-    Edge* best_node = nullptr;
+    int best_idx = -1;
     float best_value = std::numeric_limits<float>::lowest();
 
-    for (auto &child : children_) {
+    for (auto child : children_) {
         const auto value = gumbel_logits[child.GetVertex()];
         if (value > best_value) {
             best_value = value;
-            best_node = &child;
+            best_idx = child.Index();
         }
     }
-    Inflate(*best_node);
-    return best_node->Get();
+    const auto best_node = children_[best_idx];
+    Inflate(best_node);
+    return best_node.Get();
 }
 
 int Node::GetGumbelMove() {
@@ -1557,10 +2462,13 @@ int Node::GetGumbelMove() {
 
 void Node::SetScoreBouns(float val) {
     score_bouns_ = val;
+    if (parent_stats_) {
+        parent_stats_->score_bonus[parent_index_] = val;
+    }
 }
 
 void Node::KillRootSuperkos(GameState &state) {
-    for (const auto &child : children_) {
+    for (const auto child : children_) {
         const auto vtx = child.GetVertex();
 
         auto fork_state = state;
@@ -1573,9 +2481,12 @@ void Node::KillRootSuperkos(GameState &state) {
         }
     }
 
-    auto ite = std::remove_if(std::begin(children_), std::end(children_),
-                              [](Edge &ele) {
-                                  return !ele.Get()->IsValid();
-                              });
-    children_.erase(ite, std::end(children_));
+    children_.RemoveIf([](const Edges::ConstEdge ele) {
+                           return !ele.Get()->IsValid();
+                       });
+
+    if (child_stats_) {
+        // The children are reordered. Rebuild the compact statistics.
+        BuildChildStats();
+    }
 }
@@ -2,21 +2,31 @@
 
 #include "game/game_state.h"
 #include "game/types.h"
-#include "mcts/node_pointer.h"
+#include "mcts/edge_table.h"
+#include "mcts/child_stats.h"
 #include "mcts/parameters.h"
+#include "utils/atomic.h"
+#include "utils/text_buffer.h"
 #include "neural/network.h"
 
 #include <array>
 #include <vector>
 #include <atomic>
+#include <future>
+#include <iosfwd>
 #include <string>
-#include <mutex>
 
 struct NodeEvals {
     float black_final_score{0.0f};
     float black_wl{0.0f};
     float draw{0.0f};
     std::array<float, kNumIntersections> black_ownership;
+
+    // False if the network skipped the ownership head.
+    bool has_ownership{true};
+
+    // True if the small deep network evaluated the leaf.
+    bool deep_net{false};
 };
 
 struct AnalysisConfig {
@@ -34,17 +44,22 @@ struct AnalysisConfig {
     bool is_leelaz{false};
     bool ownership{false};
     bool moves_ownership{false};
+    bool binary{false};
 
     int interval{0};
     int min_moves{0};
     int max_moves{kNumIntersections+1};
 
+    // Keep the minimum visit share of the best multi_pv root moves,
+    // so their values are accurate. Zero is the plain PUCT.
+    int multi_pv{0};
+
     std::vector<MoveToAvoid> avoid_moves;
     std::vector<MoveToAvoid> allow_moves;
 
     bool MoveRestrictions() const {
         return !avoid_moves.empty() ||
-                   !avoid_moves.empty();
+                   !allow_moves.empty();
     }
 
     void Clear() {
@@ -52,9 +67,11 @@ struct AnalysisConfig {
             is_kata =
             is_leelaz =
             ownership =
-            moves_ownership = false;
+            moves_ownership =
+            binary = false;
         min_moves = 0;
         max_moves = kNumIntersections+1;
+        multi_pv = 0;
         avoid_moves.clear();
         allow_moves.clear();
         interval = 0;
@@ -86,17 +103,39 @@ struct AnalysisConfig {
 
 class Node {
 public:
-    using Edge = NodePointer<Node>;
+    using Edges = EdgeTable<Node>;
+    using Edge = Edges::Edge;
 
     explicit Node(std::int16_t vertex, float policy);
     ~Node();
 
-    // Expand this node.
+    // All nodes are allocated from the node arena.
+    static void *operator new(std::size_t size);
+    static void operator delete(void *ptr);
+
+    // Expand this node. The network may skip the ownership head if
+    // need_ownership is false.
     bool ExpandChildren(Network &network,
                             GameState &state,
                             NodeEvals& node_evals,
                             AnalysisConfig &config,
-                            const bool is_root);
+                            const bool is_root,
+                            const bool need_ownership = true);
+
+    // Acquire the expanding owner and submit the network evaluation
+    // without waiting for it. Return false if the node can not be
+    // expanded now. FinishExpanding() must be called after it.
+    bool SubmitExpanding(Network &network,
+                             GameState &state,
+                             std::future<Network::Result> &result,
+                             const bool need_ownership = true);
+
+    // Link the children with the network result and release the
+    // expanding owner.
+    void FinishExpanding(GameState &state,
+                             Network::Result &raw_netlist,
+                             NodeEvals& node_evals,
+                             AnalysisConfig &config);
 
     // Expand root node children before starting tree search.
     bool PrepareRootNode(Network &network,
@@ -110,6 +149,21 @@ public:
     // Select the best PUCT value node.
     Node *PuctSelectChild(const int color, const bool is_root);
 
+    // Same as PuctSelectChild(), but the virtual loss comes from the
+    // pending counters of current thread instead of the shared counters.
+    // The selected child is added to the counters.
+    Node *PuctSelectChild(const int color, const bool is_root,
+                              std::vector<int> &local_threads);
+
+    // Prefetch the memory which the selection of this node reads
+    // first. Call it before playing the move of this node, so the
+    // loads overlap with the move.
+    void PrefetchChildren() const;
+
+    // Return the number of children whose mirrored statistics in the
+    // compact block are different from their own values.
+    int CountMismatchedChildStats() const;
+
     // Select the best UCT value node. For no-dcnn mode.
     Node *UctSelectChild(const int color, const bool is_root, const GameState &state);
 
@@ -119,6 +173,20 @@ public:
     // Update the node.
     void Update(const NodeEvals *evals);
 
+    // The accumulated values of the node. The root parallelization
+    // adds the values of the other trees into the main tree.
+    struct Stats {
+        int visits{0};
+        double black_wl{0.0};
+        double draw{0.0};
+        double black_fs{0.0};
+        double squared_eval_diff{0.0};
+    };
+    Stats GetStats() const;
+
+    // Add the accumulated values, like many Update() at once.
+    void AddStats(const Stats &stats);
+
     // Get children's LCB values. 
     std::vector<std::pair<float, int>> GetLcbUtilityList(const int color);
 
@@ -128,7 +196,7 @@ public:
     // Get best move(vertex) with Gumbel-Top-k trick.
     int GetGumbelMove();
 
-    const std::vector<Edge> &GetChildren() const;
+    const Edges &GetChildren() const;
 
     bool HaveChildren() const;
     bool SetTerminal();
@@ -149,6 +217,9 @@ public:
     // Get the visit number of this node.
     int GetVisits() const;
 
+    // Get the number of threads searching this node now.
+    int GetRunningThreads() const;
+
     // Get the vertex move of this node.
     int GetVertex() const;
 
@@ -174,6 +245,12 @@ public:
     void ApplyEvals(const NodeEvals *evals);
 
     bool ShouldApplyGumbel() const;
+
+    // The mixed Q value of the Gumbel search, and its scale by the
+    // max visits of the children.
+    float GetGumbelQValue(int color, float parent_score) const;
+    float NormalizeCompletedQ(const float completed_q,
+                                  const int max_visits) const;
     std::vector<float> GetProbLogitsCompletedQ(GameState &state);
 
     void SetScoreBouns(float val);
@@ -191,13 +268,51 @@ public:
     bool IsActive() const;
     bool IsValid() const;
 
+    // Compute the memory used of this sub-tree.
+    size_t GetTreeMemoryUsed();
+
+    // Count the expanded nodes and the edges which are not inflated
+    // of this sub-tree.
+    void ComputeNodeCount(size_t &nodes, size_t &edges);
+
+    // The memory of one node and of one edge.
+    static size_t GetNodeMemory();
+    static size_t GetEdgeMemory();
+
+    // Release the sub-trees whose visits are less than 'min_visits'.
+    // Only call it if no thread is searching the tree.
+    size_t ReleaseSmallSubtrees(const int min_visits);
+
+    // Write the sub-tree in the compact binary records, the node values,
+    // the children edges and the ownership. Only call it if no thread
+    // is searching the tree. See the format in node.cc.
+    void SaveTree(std::ostream &out);
+
+    // Read the sub-tree written by SaveTree() into this new node. The
+    // parameters must be set first. Return false if the data is broken.
+    bool LoadTree(std::istream &in);
+
     float ComputeKlDivergence();
     float ComputeTreeComplexity();
 
-    std::string ToAnalysisString(GameState &state, const int color, AnalysisConfig &config);
-    std::string OwnershipToString(GameState &state, const int color, std::string name, Node *node);
+    // Write the analysis output into the buffer. The buffer is cleared
+    // first, so the caller can reuse it for every interval.
+    void ToAnalysisString(GameState &state, const int color,
+                          AnalysisConfig &config, TextBuffer &out);
+
+    // Same as ToAnalysisString, but in the binary record. See the
+    // format in node.cc.
+    void ToAnalysisBinary(GameState &state, const int color,
+                          AnalysisConfig &config, TextBuffer &out);
+
+    // Return the candidate moves, or the ownership, in the JSON array.
+    std::string ToAnalysisJson(GameState &state, const int color, const int max_moves);
+    std::string OwnershipToJson(GameState &state, const int color);
+    void OwnershipToString(GameState &state, const int color,
+                           const char *name, Node *node, TextBuffer &out);
     std::string ToVerboseString(GameState &state, const int color);
     std::string GetPvString(GameState &state);
+    void GetPvString(GameState &state, TextBuffer &out);
 
 private:
     void ApplyNoDcnnPolicy(GameState &state,
@@ -212,22 +327,39 @@ private:
 
     void LinkNodeList(std::vector<Network::PolicyVertexPair> &nodelist);
 
-    float GetSearchPolicy(Edge& child, bool noise);
+    // Select the best PUCT value edge.
+    Edge PuctSelectEdge(const int color, const bool is_root);
+
+    // Return the number of selectable children with partial
+    // expansion.
+    int GetVisibleSize() const;
+
+    // Make the child at the position of order visible. The next
+    // hidden child becomes the largest policy of the rest.
+    void RevealChild(const int width);
+
+    // Same as PuctSelectEdge() but use the compact statistics.
+    Edge PuctSelectEdgeCompact(const int color, const bool is_root,
+                                   const int *local_threads = nullptr);
+
+    // Allocate the compact statistics of children and link them.
+    void BuildChildStats();
+
+    // Link this node to parent's compact statistics.
+    void LinkParentStats(ChildStats *stats, const int idx);
+
+    float GetSearchPolicy(const Edge child, bool noise);
     float GetScoreUtility(const int color, float div, float parent_score) const;
     float GetLcbVariance(const float default_var, const int visits) const;
     float GetLcb(const int color) const;
 
-    void Inflate(Edge& child);
-    void Release(Edge& child);
+    void Inflate(const Edge child);
+    void Release(const Edge child);
 
     void InflateAllChildren();
     void ReleaseAllChildren();
     int GetVirtualLoss() const;
 
-    float GetGumbelQValue(int color, float parent_score) const;
-    float NormalizeCompletedQ(const float completed_q,
-                                  const int max_visits) const;
-    void ComputeNodeCount(size_t &nodes, size_t &edges);
     void ProcessGumbelLogits(std::vector<float> &gumbel_logits,
                                  const int color,
                                  const int root_visits,
@@ -285,19 +417,38 @@ private:
     // The network win-loss value.
     float black_wl_{0.5f};
 
+    // The accumulated values are fixed-point numbers so that many
+    // threads can update the root node without the compare-exchange
+    // loop. The final score needs the larger range.
+    using EvalAccumulator = ChildStats::EvalFixed;
+    using ScoreAccumulator = ChildStats::ScoreFixed;
+
     // The accumulated squared difference value.
-    std::atomic<double> squared_eval_diff_{1e-4f};
+    EvalAccumulator squared_eval_diff_{1e-4f};
 
     // The black accumulated values.
-    std::atomic<double> accumulated_black_fs_{0.0f};
-    std::atomic<double> accumulated_black_wl_{0.0f};
-    std::atomic<double> accumulated_draw_{0.0f};
+    ScoreAccumulator accumulated_black_fs_{0.0f};
+    EvalAccumulator accumulated_black_wl_{0.0f};
+    EvalAccumulator accumulated_draw_{0.0f};
+
+    struct OwnershipStats {
+        OwnershipStats();
+
+        // The black accumulated ownership value. It is fixed-point too
+        // because the float sum loses the small values after many visits.
+        std::array<EvalAccumulator, kNumIntersections> accumulated_black_ownership;
+
+        // The visits number since the storage was allocated.
+        std::atomic<int> visits;
+    };
 
-    // The black average ownership value.
-    std::array<float, kNumIntersections> avg_black_ownership_;
+    // Allocate the ownership storage. Only the root node and its
+    // children need it so we don't allocate it for the others.
+    void AllocateOwnership();
 
-    // The ownership lock.
-    std::mutex os_mtx_;
+    // The ownership storage. It is NULL if this node does not
+    // collect the ownership.
+    std::atomic<OwnershipStats *> ownership_{nullptr};
 
     // The visits number of this node.
     std::atomic<int> visits_{0};
@@ -306,7 +457,24 @@ private:
     std::atomic<int> running_threads_{0};
 
     // The children of this node.
-    std::vector<Edge> children_;
+    Edges children_;
+
+    // The children order of partial expansion. The first children in
+    // it are selectable, and the first hidden child has the largest
+    // policy of the hidden ones. It is NULL if all children are
+    // selectable.
+    std::unique_ptr<std::uint16_t[]> order_;
+    std::atomic<int> visible_children_{0};
+    std::atomic<bool> revealing_{false};
+
+    // The compact statistics of children. It is NULL if we
+    // disable it.
+    std::unique_ptr<ChildStats> child_stats_;
+
+    // Parent's compact statistics and the index of this node
+    // in it.
+    ChildStats *parent_stats_{nullptr};
+    int parent_index_{-1};
 
     // The played move.
     std::int16_t vertex_;
@@ -0,0 +1,262 @@
+#pragma once
+
+#include "utils/mutex.h"
+#include "utils/huge_pages.h"
+#include "utils/numa.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+// A fixed size memory pool for the tree nodes. Every thread owns a
+// local free list, so the allocation and the deallocation do not need
+// any global lock. The free blocks are moved between the local lists
+// and the shared lists in batches. The memory is never returned to the
+// system. The released sub-trees are recycled by the next search.
+//
+// The slabs are 2 MiB and aligned to 2 MiB, so every slab can be one
+// huge page and its header is found from any block address. The slab
+// is first touched by the thread which allocates it, so its pages are
+// on the NUMA node of that thread, and the header remembers the node.
+// The freed blocks always go back to the lists of their own node, so
+// a thread only allocates the blocks of its node, even if the sub-tree
+// was released by the thread of the other node.
+template<std::size_t kSize>
+class NodeArena {
+public:
+    static void *Allocate();
+    static void Free(void *p);
+
+    // Return the total allocated bytes of all slabs.
+    static std::size_t GetAllocatedBytes();
+
+    // Return the page size of the last slab. It is zero if there are
+    // no slabs.
+    static std::size_t GetPageSize();
+
+private:
+    // Round up the block size so that the tagged pointer bits
+    // of EdgeTable are always zero.
+    static constexpr std::size_t kAlignment = 16;
+    static constexpr std::size_t kBlockSize =
+        (kSize + kAlignment - 1) / kAlignment * kAlignment;
+
+    // Number of blocks moved between the local list and the
+    // shared list at once.
+    static constexpr std::size_t kBatchBlocks = 256;
+    static constexpr std::size_t kSlabBytes = 2 * 1024 * 1024;
+
+    // The header of the slab keeps its node. It fills one cache line.
+    static constexpr std::size_t kHeaderBytes = 64;
+    static constexpr std::size_t kSlabBlocks = (kSlabBytes - kHeaderBytes) / kBlockSize;
+
+    struct Block {
+        Block *next;
+    };
+
+    struct Batch {
+        Block *head{nullptr};
+        std::size_t size{0};
+    };
+
+    struct SlabHeader {
+        int node;
+    };
+
+    struct SlabDeleter {
+        void operator()(char *p) const { HugePages::Free(p); }
+    };
+    using Slab = std::unique_ptr<char[], SlabDeleter>;
+
+    // The free batches of one NUMA node.
+    struct NodeList {
+        SpinLock lock;
+        std::vector<Batch> batches;
+    };
+
+    struct Shared {
+        Shared();
+
+        std::unique_ptr<NodeList[]> nodes;
+        int num_nodes;
+
+        SpinLock lock;
+        std::vector<Slab> slabs;
+        std::size_t allocated_bytes{0};
+        std::size_t page_size{0};
+    };
+
+    // The free blocks of every node.
+    struct Local {
+        std::vector<Batch> lists;
+        ~Local();
+    };
+
+    static Shared &GetShared();
+    static Local &GetLocal();
+
+    // Return the node of current thread, and of the block.
+    static int GetNode();
+    static int GetNode(const void *p);
+
+    static Batch TakeBatch(int node);
+    static void GiveBatch(int node, Batch batch);
+};
+
+template<std::size_t kSize>
+inline NodeArena<kSize>::Shared::Shared() {
+    num_nodes = std::max(Numa::Get().GetNumNodes(), 1);
+    nodes.reset(new NodeList[num_nodes]);
+}
+
+template<std::size_t kSize>
+inline typename NodeArena<kSize>::Shared &NodeArena<kSize>::GetShared() {
+    // Never destroy it. The thread local lists may give their blocks
+    // back after the static objects are destroyed.
+    static Shared *shared = new Shared;
+    return *shared;
+}
+
+template<std::size_t kSize>
+inline typename NodeArena<kSize>::Local &NodeArena<kSize>::GetLocal() {
+    static thread_local Local local;
+    if (local.lists.empty()) {
+        local.lists.resize(GetShared().num_nodes);
+    }
+    return local;
+}
+
+template<std::size_t kSize>
+inline NodeArena<kSize>::Local::~Local() {
+    // Give the remaining blocks back to the shared lists before
+    // the thread exits.
+    for (int node = 0; node < static_cast<int>(lists.size()); ++node) {
+        if (lists[node].size > 0) {
+            GiveBatch(node, lists[node]);
+        }
+    }
+}
+
+template<std::size_t kSize>
+inline int NodeArena<kSize>::GetNode() {
+    return Numa::GetCurrentNode() % GetShared().num_nodes;
+}
+
+template<std::size_t kSize>
+inline int NodeArena<kSize>::GetNode(const void *p) {
+    const auto addr = reinterpret_cast<std::uintptr_t>(p);
+    const auto slab = addr & ~static_cast<std::uintptr_t>(kSlabBytes - 1);
+    return reinterpret_cast<const SlabHeader *>(slab)->node;
+}
+
+template<std::size_t kSize>
+inline typename NodeArena<kSize>::Batch NodeArena<kSize>::TakeBatch(int node) {
+    auto &shared = GetShared();
+    {
+        auto &list = shared.nodes[node];
+        SpinLock::Lock lock(list.lock);
+        if (!list.batches.empty()) {
+            auto batch = list.batches.back();
+            list.batches.pop_back();
+            return batch;
+        }
+    }
+
+    // There is no free batch. Allocate a new slab out of the lock
+    // and split it into the batches. Building the lists here touches
+    // all pages by this thread.
+    auto slab = Slab(static_cast<char *>(HugePages::Allocate(kSlabBytes, kSlabBytes)));
+    if (!slab) {
+        throw std::bad_alloc();
+    }
+    const auto page_size = HugePages::GetPageSize(slab.get());
+    reinterpret_cast<SlabHeader *>(slab.get())->node = node;
+
+    std::vector<Batch> batches((kSlabBlocks + kBatchBlocks - 1) / kBatchBlocks);
+    for (std::size_t i = 0; i < kSlabBlocks; ++i) {
+        auto &batch = batches[i / kBatchBlocks];
+        auto block = reinterpret_cast<Block *>(slab.get() + kHeaderBytes + i * kBlockSize);
+        block->next = batch.head;
+        batch.head = block;
+        batch.size += 1;
+    }
+
+    {
+        SpinLock::Lock lock(shared.lock);
+        shared.slabs.emplace_back(std::move(slab));
+        shared.allocated_bytes += kSlabBytes;
+        shared.page_size = page_size;
+    }
+
+    auto &list = shared.nodes[node];
+    SpinLock::Lock lock(list.lock);
+    list.batches.insert(std::end(list.batches),
+                        std::begin(batches) + 1, std::end(batches));
+    return batches[0];
+}
+
+template<std::size_t kSize>
+inline void NodeArena<kSize>::GiveBatch(int node, Batch batch) {
+    auto &list = GetShared().nodes[node];
+    SpinLock::Lock lock(list.lock);
+    list.batches.emplace_back(batch);
+}
+
+template<std::size_t kSize>
+inline void *NodeArena<kSize>::Allocate() {
+    const auto node = GetNode();
+    auto &list = GetLocal().lists[node];
+    if (list.size == 0) {
+        list = TakeBatch(node);
+    }
+    auto block = list.head;
+    list.head = block->next;
+    list.size -= 1;
+    return block;
+}
+
+template<std::size_t kSize>
+inline void NodeArena<kSize>::Free(void *p) {
+    if (!p) {
+        return;
+    }
+    const auto node = GetNode(p);
+    auto &list = GetLocal().lists[node];
+    auto block = static_cast<Block *>(p);
+    block->next = list.head;
+    list.head = block;
+    list.size += 1;
+
+    if (list.size >= 2 * kBatchBlocks) {
+        // Too many free blocks in this thread. Split one batch
+        // and give it to the other threads of the node.
+        Batch batch;
+        for (std::size_t i = 0; i < kBatchBlocks; ++i) {
+            auto next = list.head->next;
+            list.head->next = batch.head;
+            batch.head = list.head;
+            list.head = next;
+        }
+        batch.size = kBatchBlocks;
+        list.size -= kBatchBlocks;
+        GiveBatch(node, batch);
+    }
+}
+
+template<std::size_t kSize>
+inline std::size_t NodeArena<kSize>::GetAllocatedBytes() {
+    auto &shared = GetShared();
+    SpinLock::Lock lock(shared.lock);
+    return shared.allocated_bytes;
+}
+
+template<std::size_t kSize>
+inline std::size_t NodeArena<kSize>::GetPageSize() {
+    auto &shared = GetShared();
+    SpinLock::Lock lock(shared.lock);
+    return shared.page_size;
+}
@@ -4,6 +4,7 @@
 #include "config.h"
 
 #include <array>
+#include <string>
 
 class Parameters {
 public:
@@ -14,8 +15,18 @@ public:
         batch_size = GetOption<int>("batch_size");
         playouts = GetOption<int>("playouts");
         ponder_factor = GetOption<int>("ponder_factor");
+        ponder_replies = GetOption<int>("ponder_replies");
         const_time = GetOption<int>("const_time");
         expand_threshold = GetOption<int>("expand_threshold");
+        tree_memory_mib = GetOption<int>("tree_memory_mib");
+        transposition_memory_mib = GetOption<int>("transposition_memory_mib");
+        async_leaves = GetOption<int>("async_leaves");
+        root_trees = GetOption<int>("root_trees");
+        search_workers = GetOption<std::string>("search_workers");
+        remote_job_playouts = GetOption<int>("remote_job_playouts");
+        ownership_depth = GetOption<int>("ownership_depth");
+        dead_stone_playouts = GetOption<int>("dead_stone_playouts");
+        scoring_playouts = GetOption<int>("scoring_playouts");
 
         resign_threshold = GetOption<float>("resign_threshold");
         lcb_utility_factor = GetOption<float>("lcb_utility_factor");
@@ -33,6 +44,7 @@ public:
         gumbel_considered_moves = GetOption<int>("gumbel_considered_moves");
         gumbel_playouts = GetOption<int>("gumbel_playouts");
         gumbel = GetOption<bool>("gumbel");
+        sequential_halving = GetOption<bool>("sequential_halving");
         always_completed_q_policy = GetOption<bool>("always_completed_q_policy");
 
         dirichlet_noise = GetOption<bool>("dirichlet_noise");
@@ -46,19 +58,28 @@ public:
         resign_playouts = GetOption<float>("resign_playouts");
         reduce_playouts = GetOption<float>("reduce_playouts");
         reduce_playouts_prob = GetOption<float>("reduce_playouts_prob"); 
+        playout_cap_randomization = GetOption<bool>("playout_cap_randomization");
 
         lag_buffer = GetOption<int>("lag_buffer");
         ponder = GetOption<bool>("ponder");
         reuse_tree = GetOption<bool>("reuse_tree");
         friendly_pass = GetOption<bool>("friendly_pass");
+        dynamic_time = GetOption<bool>("dynamic_time");
+        futile_search_stop = GetOption<bool>("futile_search_stop");
+
+        multi_pv_share = GetOption<float>("multi_pv_share");
 
         root_policy_temp = GetOption<float>("root_policy_temp");
         policy_temp = GetOption<float>("policy_temp");
         use_rollout = GetOption<bool>("rollout");
         no_dcnn = GetOption<bool>("no_dcnn");
         root_dcnn = GetOption<bool>("root_dcnn");
+        root_symm_average = GetOption<bool>("root_symm_average");
         first_pass_bonus = GetOption<bool>("first_pass_bonus");
         symm_pruning = GetOption<bool>("symm_pruning");
+        compact_child_stats = GetOption<bool>("compact_child_stats");
+        partial_expansion = GetOption<int>("partial_expansion");
+        local_virtual_loss = GetOption<bool>("local_virtual_loss");
         use_stm_winrate = GetOption<bool>("use_stm_winrate");
         analysis_verbose = GetOption<bool>("analysis_verbose");
     }
@@ -67,6 +88,7 @@ public:
     int batch_size;
     int playouts;
     int ponder_factor;
+    int ponder_replies;
     int const_time;
     int random_min_visits;
     float random_moves_factor;
@@ -77,6 +99,7 @@ public:
     float lcb_reduction;
     float fpu_reduction;
     float fpu_root_reduction;
+    float multi_pv_share;
     float cpuct_init;
     float cpuct_base_factor;
     float cpuct_base;
@@ -85,6 +108,7 @@ public:
     int gumbel_considered_moves;
     int gumbel_playouts;
     bool gumbel;
+    bool sequential_halving;
 
     bool dirichlet_noise;
     float dirichlet_epsilon;
@@ -101,17 +125,37 @@ public:
     int resign_playouts;
     int reduce_playouts;
     float reduce_playouts_prob;
+    bool playout_cap_randomization;
     int lag_buffer;
     int expand_threshold;
+    int tree_memory_mib;
+    int transposition_memory_mib;
+    int async_leaves;
+    int root_trees;
+    std::string search_workers;
+    int remote_job_playouts;
+    int ownership_depth;
+    int dead_stone_playouts;
+    int scoring_playouts;
 
     bool ponder;
     bool reuse_tree;
     bool friendly_pass;
+    bool dynamic_time;
+    bool futile_search_stop;
     bool use_rollout;
     bool no_dcnn;
     bool root_dcnn;
+    bool root_symm_average;
     bool first_pass_bonus;
     bool symm_pruning;
+    bool compact_child_stats;
+    int partial_expansion;
+    bool local_virtual_loss;
+
+    // Force to use the scalar PUCT kernel. It is not an option. Only
+    // for benchmark.
+    bool scalar_puct_kernel{false};
     bool use_stm_winrate;
     bool analysis_verbose;
     bool always_completed_q_policy;
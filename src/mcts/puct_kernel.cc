@@ -0,0 +1,457 @@
+#include "mcts/puct_kernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PUCT_KERNEL_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define PUCT_KERNEL_NEON
+#include <arm_neon.h>
+#endif
+
+// The vectorized kernels read the atomic arrays directly.
+static_assert(sizeof(std::atomic<float>) == sizeof(float), "");
+static_assert(sizeof(std::atomic<int>) == sizeof(int), "");
+static_assert(sizeof(std::atomic<std::int64_t>) == sizeof(std::int64_t), "");
+static_assert(sizeof(std::atomic<std::uint8_t>) == sizeof(std::uint8_t), "");
+
+// The rational approximation of tanh. It is same as Eigen's fast
+// tanh. The max error is about 1e-7 in the range.
+constexpr float kTanhClamp = 7.90531110763549805f;
+constexpr float kTanhTiny  = 0.0004f;
+
+constexpr float kAlpha1  =  4.89352455891786e-03f;
+constexpr float kAlpha3  =  6.37261928875436e-04f;
+constexpr float kAlpha5  =  1.48572235717979e-05f;
+constexpr float kAlpha7  =  5.12229709037114e-08f;
+constexpr float kAlpha9  = -8.60467152213735e-11f;
+constexpr float kAlpha11 =  2.00018790482477e-13f;
+constexpr float kAlpha13 = -2.76076847742355e-16f;
+
+constexpr float kBeta0 = 4.89352518554385e-03f;
+constexpr float kBeta2 = 2.26843463243900e-03f;
+constexpr float kBeta4 = 1.18534705686654e-04f;
+constexpr float kBeta6 = 1.19825839466702e-06f;
+
+constexpr float kLowest = std::numeric_limits<float>::lowest();
+
+constexpr std::uint8_t kInactiveBits = ChildStats::kPrunedBit | ChildStats::kInvalidBit;
+
+// The scales to convert the raw fixed-point sum to float. The sum is
+// split into the high word and the top 24 bits of low word, because
+// the vectorized kernels can only convert the 32-bit integers. The
+// lowest 8 bits are dropped, so the error is below 2^(8-kFracBits).
+template <typename Fixed>
+struct FixedScale {
+    static constexpr float kHigh =
+        static_cast<float>(std::int64_t{1} << (32 - Fixed::kFractionBits));
+    static constexpr float kLow =
+        1.f / static_cast<float>(std::int64_t{1} << (Fixed::kFractionBits - 8));
+};
+
+template <typename Fixed>
+static float FixedToFloat(const std::int64_t raw) {
+    const float high = static_cast<float>(static_cast<std::int32_t>(raw >> 32));
+    const float low = static_cast<float>(static_cast<std::int32_t>((raw >> 8) & 0xffffff));
+    return high * FixedScale<Fixed>::kHigh + low * FixedScale<Fixed>::kLow;
+}
+
+float PuctKernel::Tanh(float a) {
+    if (std::abs(a) < kTanhTiny) {
+        return a;
+    }
+    const float x = std::max(std::min(a, kTanhClamp), -kTanhClamp);
+    const float x2 = x * x;
+
+    float p = x2 * kAlpha13 + kAlpha11;
+    p = x2 * p + kAlpha9;
+    p = x2 * p + kAlpha7;
+    p = x2 * p + kAlpha5;
+    p = x2 * p + kAlpha3;
+    p = x2 * p + kAlpha1;
+    p = x * p;
+
+    float q = x2 * kBeta6 + kBeta4;
+    q = x2 * q + kBeta2;
+    q = x2 * q + kBeta0;
+
+    return p / q;
+}
+
+static float ComputeValue(const PuctInputs &in, const int idx) {
+    const auto &stats = *in.stats;
+    const auto flags = stats.flags[idx].load(std::memory_order_relaxed);
+
+    if (flags & kInactiveBits) {
+        // The node is pruned or invalid. Never select it.
+        return kLowest;
+    }
+
+    const float visits = static_cast<float>(
+                             stats.visits[idx].load(std::memory_order_relaxed));
+    float q_value = in.fpu_value;
+    float utility = 0.f;
+
+    if (flags & ChildStats::kExpandingBit) {
+        q_value = in.expanding_value;
+    } else if (visits > 0.f) {
+        const int threads = in.threads ? in.threads[idx] :
+                                stats.threads[idx].load(std::memory_order_relaxed);
+        const float virtual_loss = in.virtual_loss_count * static_cast<float>(threads);
+        const float accumulated_wl = FixedToFloat<ChildStats::EvalFixed>(
+                                         stats.black_wl[idx].load(std::memory_order_relaxed)) +
+                                         (in.is_white ? virtual_loss : 0.f);
+        float eval = accumulated_wl / (visits + virtual_loss);
+        float final_score = FixedToFloat<ChildStats::ScoreFixed>(
+                                stats.black_fs[idx].load(std::memory_order_relaxed)) / visits;
+        if (in.is_white) {
+            eval = 1.f - eval;
+            final_score = 0.f - final_score;
+        }
+        const float draw_value = (FixedToFloat<ChildStats::EvalFixed>(
+                                      stats.draw[idx].load(std::memory_order_relaxed)) / visits) *
+                                     in.draw_factor;
+        const float score = final_score + stats.score_bonus[idx];
+
+        q_value = eval + draw_value;
+        utility = in.score_utility_factor *
+                      PuctKernel::Tanh((score - in.parent_score) / in.score_utility_div);
+    }
+
+    const float denom = 1.f + visits;
+    const float puct = (in.cpuct * in.policy[idx]) * (in.numerator / denom);
+    return (q_value + puct) + utility;
+}
+
+int PuctKernel::SelectBestScalar(const PuctInputs &in) {
+    const int size = in.stats->Size();
+    int best_idx = -1;
+    float best_value = kLowest;
+
+    for (int idx = 0; idx < size; ++idx) {
+        const float value = ComputeValue(in, idx);
+        if (value > best_value) {
+            best_value = value;
+            best_idx = idx;
+        }
+    }
+    return best_idx;
+}
+
+// Pick the best lane. The smaller index wins if the values are
+// equal, so that the result is same as the scalar scan.
+template<int kLanes>
+static int ReduceLanes(const float *values, const int *indices) {
+    int best_idx = -1;
+    float best_value = kLowest;
+
+    for (int i = 0; i < kLanes; ++i) {
+        if (indices[i] < 0) {
+            continue;
+        }
+        if (values[i] > best_value ||
+                (values[i] == best_value && indices[i] < best_idx)) {
+            best_value = values[i];
+            best_idx = indices[i];
+        }
+    }
+    return best_idx;
+}
+
+#ifdef PUCT_KERNEL_AVX2
+__attribute__((target("avx2")))
+static __m256 Tanh8(__m256 a) {
+    const __m256 sign_mask = _mm256_set1_ps(-0.f);
+    const __m256 abs_a = _mm256_andnot_ps(sign_mask, a);
+    const __m256 tiny_mask = _mm256_cmp_ps(abs_a, _mm256_set1_ps(kTanhTiny), _CMP_LT_OQ);
+
+    const __m256 x = _mm256_max_ps(
+                         _mm256_min_ps(a, _mm256_set1_ps(kTanhClamp)),
+                         _mm256_set1_ps(-kTanhClamp));
+    const __m256 x2 = _mm256_mul_ps(x, x);
+
+    __m256 p = _mm256_add_ps(_mm256_mul_ps(x2, _mm256_set1_ps(kAlpha13)), _mm256_set1_ps(kAlpha11));
+    p = _mm256_add_ps(_mm256_mul_ps(x2, p), _mm256_set1_ps(kAlpha9));
+    p = _mm256_add_ps(_mm256_mul_ps(x2, p), _mm256_set1_ps(kAlpha7));
+    p = _mm256_add_ps(_mm256_mul_ps(x2, p), _mm256_set1_ps(kAlpha5));
+    p = _mm256_add_ps(_mm256_mul_ps(x2, p), _mm256_set1_ps(kAlpha3));
+    p = _mm256_add_ps(_mm256_mul_ps(x2, p), _mm256_set1_ps(kAlpha1));
+    p = _mm256_mul_ps(x, p);
+
+    __m256 q = _mm256_add_ps(_mm256_mul_ps(x2, _mm256_set1_ps(kBeta6)), _mm256_set1_ps(kBeta4));
+    q = _mm256_add_ps(_mm256_mul_ps(x2, q), _mm256_set1_ps(kBeta2));
+    q = _mm256_add_ps(_mm256_mul_ps(x2, q), _mm256_set1_ps(kBeta0));
+
+    return _mm256_blendv_ps(_mm256_div_ps(p, q), a, tiny_mask);
+}
+
+// Same as FixedToFloat() but for eight lanes.
+template <typename Fixed>
+__attribute__((target("avx2")))
+static __m256 FixedToFloat8(const std::int64_t *ptr) {
+    // Gather the high words into the lower half and the low words
+    // into the upper half of each vector.
+    const __m256i split = _mm256_setr_epi32(1, 3, 5, 7, 0, 2, 4, 6);
+    const __m256i a = _mm256_permutevar8x32_epi32(
+                          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr)), split);
+    const __m256i b = _mm256_permutevar8x32_epi32(
+                          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + 4)), split);
+    const __m256 high = _mm256_cvtepi32_ps(_mm256_permute2x128_si256(a, b, 0x20));
+    const __m256 low = _mm256_cvtepi32_ps(
+                           _mm256_srli_epi32(_mm256_permute2x128_si256(a, b, 0x31), 8));
+    return _mm256_add_ps(_mm256_mul_ps(high, _mm256_set1_ps(FixedScale<Fixed>::kHigh)),
+                         _mm256_mul_ps(low, _mm256_set1_ps(FixedScale<Fixed>::kLow)));
+}
+
+__attribute__((target("avx2")))
+static int SelectBestAvx2(const PuctInputs &in) {
+    const auto &stats = *in.stats;
+    const int padded_size = stats.PaddedSize();
+
+    const auto flags_ptr  = reinterpret_cast<const std::uint8_t *>(stats.flags.get());
+    const auto visits_ptr = reinterpret_cast<const int *>(stats.visits.get());
+    const auto threads_ptr = in.threads ? in.threads :
+                                          reinterpret_cast<const int *>(stats.threads.get());
+    const auto wl_ptr     = reinterpret_cast<const std::int64_t *>(stats.black_wl.get());
+    const auto draw_ptr   = reinterpret_cast<const std::int64_t *>(stats.draw.get());
+    const auto fs_ptr     = reinterpret_cast<const std::int64_t *>(stats.black_fs.get());
+    const auto bonus_ptr  = stats.score_bonus.get();
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 lowest = _mm256_set1_ps(kLowest);
+    const __m256 fpu_value = _mm256_set1_ps(in.fpu_value);
+    const __m256 expanding_value = _mm256_set1_ps(in.expanding_value);
+    const __m256 cpuct = _mm256_set1_ps(in.cpuct);
+    const __m256 numerator = _mm256_set1_ps(in.numerator);
+    const __m256 parent_score = _mm256_set1_ps(in.parent_score);
+    const __m256 draw_factor = _mm256_set1_ps(in.draw_factor);
+    const __m256 utility_factor = _mm256_set1_ps(in.score_utility_factor);
+    const __m256 utility_div = _mm256_set1_ps(in.score_utility_div);
+    const __m256 vl_count = _mm256_set1_ps(in.virtual_loss_count);
+
+    const __m256i zero_i = _mm256_setzero_si256();
+    const __m256i inactive_bits = _mm256_set1_epi32(kInactiveBits);
+    const __m256i expanding_bit = _mm256_set1_epi32(ChildStats::kExpandingBit);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256 best_value = lowest;
+    __m256i best_idx = _mm256_set1_epi32(-1);
+
+    for (int base = 0; base < padded_size; base += 8) {
+        const __m256i flags = _mm256_cvtepu8_epi32(
+                                  _mm_loadl_epi64(reinterpret_cast<const __m128i *>(flags_ptr + base)));
+        const __m256 inactive = _mm256_castsi256_ps(
+                                    _mm256_cmpgt_epi32(_mm256_and_si256(flags, inactive_bits), zero_i));
+        const __m256 expanding = _mm256_castsi256_ps(
+                                     _mm256_cmpgt_epi32(_mm256_and_si256(flags, expanding_bit), zero_i));
+
+        const __m256 visits = _mm256_cvtepi32_ps(
+                                  _mm256_loadu_si256(reinterpret_cast<const __m256i *>(visits_ptr + base)));
+        const __m256 visited = _mm256_cmp_ps(visits, zero, _CMP_GT_OQ);
+
+        __m256 q_value = fpu_value;
+        __m256 utility = zero;
+
+        // Most children are unvisited. Skip the Q value and utility
+        // if there is no visited child in these lanes.
+        if (_mm256_movemask_ps(visited) != 0) {
+            const __m256 virtual_loss = _mm256_mul_ps(vl_count,
+                                            _mm256_cvtepi32_ps(
+                                                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(threads_ptr + base))));
+            const __m256 accumulated_wl = _mm256_add_ps(FixedToFloat8<ChildStats::EvalFixed>(wl_ptr + base),
+                                                            in.is_white ? virtual_loss : zero);
+            __m256 eval = _mm256_div_ps(accumulated_wl, _mm256_add_ps(visits, virtual_loss));
+            __m256 final_score = _mm256_div_ps(FixedToFloat8<ChildStats::ScoreFixed>(fs_ptr + base), visits);
+            if (in.is_white) {
+                eval = _mm256_sub_ps(one, eval);
+                final_score = _mm256_sub_ps(zero, final_score);
+            }
+            const __m256 draw_value = _mm256_mul_ps(
+                                          _mm256_div_ps(FixedToFloat8<ChildStats::EvalFixed>(draw_ptr + base), visits),
+                                          draw_factor);
+            const __m256 score = _mm256_add_ps(final_score, _mm256_loadu_ps(bonus_ptr + base));
+
+            const __m256 visited_q = _mm256_add_ps(eval, draw_value);
+            const __m256 visited_utility = _mm256_mul_ps(utility_factor,
+                                               Tanh8(_mm256_div_ps(_mm256_sub_ps(score, parent_score), utility_div)));
+
+            q_value = _mm256_blendv_ps(fpu_value, visited_q, visited);
+            utility = _mm256_blendv_ps(zero, visited_utility, visited);
+        }
+        q_value = _mm256_blendv_ps(q_value, expanding_value, expanding);
+        utility = _mm256_blendv_ps(utility, zero, expanding);
+
+        const __m256 denom = _mm256_add_ps(one, visits);
+        const __m256 puct = _mm256_mul_ps(
+                                _mm256_mul_ps(cpuct, _mm256_loadu_ps(in.policy + base)),
+                                _mm256_div_ps(numerator, denom));
+        __m256 value = _mm256_add_ps(_mm256_add_ps(q_value, puct), utility);
+        value = _mm256_blendv_ps(value, lowest, inactive);
+
+        const __m256 greater = _mm256_cmp_ps(value, best_value, _CMP_GT_OQ);
+        best_value = _mm256_blendv_ps(best_value, value, greater);
+        best_idx = _mm256_castps_si256(
+                       _mm256_blendv_ps(_mm256_castsi256_ps(best_idx),
+                                        _mm256_castsi256_ps(_mm256_add_epi32(lanes, _mm256_set1_epi32(base))),
+                                        greater));
+    }
+
+    alignas(32) float values[8];
+    alignas(32) int indices[8];
+    _mm256_store_ps(values, best_value);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(indices), best_idx);
+
+    return ReduceLanes<8>(values, indices);
+}
+#endif
+
+#ifdef PUCT_KERNEL_NEON
+static float32x4_t Tanh4(float32x4_t a) {
+    const uint32x4_t tiny_mask = vcltq_f32(vabsq_f32(a), vdupq_n_f32(kTanhTiny));
+    const float32x4_t x = vmaxq_f32(
+                              vminq_f32(a, vdupq_n_f32(kTanhClamp)),
+                              vdupq_n_f32(-kTanhClamp));
+    const float32x4_t x2 = vmulq_f32(x, x);
+
+    float32x4_t p = vaddq_f32(vmulq_f32(x2, vdupq_n_f32(kAlpha13)), vdupq_n_f32(kAlpha11));
+    p = vaddq_f32(vmulq_f32(x2, p), vdupq_n_f32(kAlpha9));
+    p = vaddq_f32(vmulq_f32(x2, p), vdupq_n_f32(kAlpha7));
+    p = vaddq_f32(vmulq_f32(x2, p), vdupq_n_f32(kAlpha5));
+    p = vaddq_f32(vmulq_f32(x2, p), vdupq_n_f32(kAlpha3));
+    p = vaddq_f32(vmulq_f32(x2, p), vdupq_n_f32(kAlpha1));
+    p = vmulq_f32(x, p);
+
+    float32x4_t q = vaddq_f32(vmulq_f32(x2, vdupq_n_f32(kBeta6)), vdupq_n_f32(kBeta4));
+    q = vaddq_f32(vmulq_f32(x2, q), vdupq_n_f32(kBeta2));
+    q = vaddq_f32(vmulq_f32(x2, q), vdupq_n_f32(kBeta0));
+
+    return vbslq_f32(tiny_mask, a, vdivq_f32(p, q));
+}
+
+// Same as FixedToFloat() but for four lanes.
+template <typename Fixed>
+static float32x4_t FixedToFloat4(const std::int64_t *ptr) {
+    const int64x2_t a = vld1q_s64(ptr);
+    const int64x2_t b = vld1q_s64(ptr + 2);
+    const int32x4_t high = vcombine_s32(vshrn_n_s64(a, 32), vshrn_n_s64(b, 32));
+    const int32x4_t low = vandq_s32(
+                              vcombine_s32(vmovn_s64(vshrq_n_s64(a, 8)), vmovn_s64(vshrq_n_s64(b, 8))),
+                              vdupq_n_s32(0xffffff));
+    return vaddq_f32(vmulq_f32(vcvtq_f32_s32(high), vdupq_n_f32(FixedScale<Fixed>::kHigh)),
+                     vmulq_f32(vcvtq_f32_s32(low), vdupq_n_f32(FixedScale<Fixed>::kLow)));
+}
+
+static int SelectBestNeon(const PuctInputs &in) {
+    const auto &stats = *in.stats;
+    const int padded_size = stats.PaddedSize();
+
+    const auto flags_ptr  = reinterpret_cast<const std::uint8_t *>(stats.flags.get());
+    const auto visits_ptr = reinterpret_cast<const std::int32_t *>(stats.visits.get());
+    const auto threads_ptr = in.threads ? reinterpret_cast<const std::int32_t *>(in.threads) :
+                                          reinterpret_cast<const std::int32_t *>(stats.threads.get());
+    const auto wl_ptr     = reinterpret_cast<const std::int64_t *>(stats.black_wl.get());
+    const auto draw_ptr   = reinterpret_cast<const std::int64_t *>(stats.draw.get());
+    const auto fs_ptr     = reinterpret_cast<const std::int64_t *>(stats.black_fs.get());
+    const auto bonus_ptr  = stats.score_bonus.get();
+
+    const float32x4_t zero = vdupq_n_f32(0.f);
+    const float32x4_t one = vdupq_n_f32(1.f);
+    const float32x4_t lowest = vdupq_n_f32(kLowest);
+    const uint32x4_t inactive_bits = vdupq_n_u32(kInactiveBits);
+    const uint32x4_t expanding_bit = vdupq_n_u32(ChildStats::kExpandingBit);
+    const int32_t lane_init[4] = {0, 1, 2, 3};
+    const int32x4_t lanes = vld1q_s32(lane_init);
+
+    float32x4_t best_value = lowest;
+    int32x4_t best_idx = vdupq_n_s32(-1);
+
+    for (int base = 0; base < padded_size; base += 4) {
+        const std::uint32_t flags_buf[4] = {
+            flags_ptr[base+0], flags_ptr[base+1], flags_ptr[base+2], flags_ptr[base+3]};
+        const uint32x4_t flags = vld1q_u32(flags_buf);
+        const uint32x4_t inactive = vtstq_u32(flags, inactive_bits);
+        const uint32x4_t expanding = vtstq_u32(flags, expanding_bit);
+
+        const float32x4_t visits = vcvtq_f32_s32(vld1q_s32(visits_ptr + base));
+        const uint32x4_t visited = vcgtq_f32(visits, zero);
+
+        const float32x4_t virtual_loss = vmulq_f32(vdupq_n_f32(in.virtual_loss_count),
+                                                       vcvtq_f32_s32(vld1q_s32(threads_ptr + base)));
+        const float32x4_t accumulated_wl = vaddq_f32(FixedToFloat4<ChildStats::EvalFixed>(wl_ptr + base),
+                                                         in.is_white ? virtual_loss : zero);
+        float32x4_t eval = vdivq_f32(accumulated_wl, vaddq_f32(visits, virtual_loss));
+        float32x4_t final_score = vdivq_f32(FixedToFloat4<ChildStats::ScoreFixed>(fs_ptr + base), visits);
+        if (in.is_white) {
+            eval = vsubq_f32(one, eval);
+            final_score = vsubq_f32(zero, final_score);
+        }
+        const float32x4_t draw_value = vmulq_f32(
+                                           vdivq_f32(FixedToFloat4<ChildStats::EvalFixed>(draw_ptr + base), visits),
+                                           vdupq_n_f32(in.draw_factor));
+        const float32x4_t score = vaddq_f32(final_score, vld1q_f32(bonus_ptr + base));
+
+        const float32x4_t visited_q = vaddq_f32(eval, draw_value);
+        const float32x4_t visited_utility = vmulq_f32(vdupq_n_f32(in.score_utility_factor),
+                                                Tanh4(vdivq_f32(vsubq_f32(score, vdupq_n_f32(in.parent_score)),
+                                                                vdupq_n_f32(in.score_utility_div))));
+
+        float32x4_t q_value = vbslq_f32(visited, visited_q, vdupq_n_f32(in.fpu_value));
+        float32x4_t utility = vbslq_f32(visited, visited_utility, zero);
+        q_value = vbslq_f32(expanding, vdupq_n_f32(in.expanding_value), q_value);
+        utility = vbslq_f32(expanding, zero, utility);
+
+        const float32x4_t denom = vaddq_f32(one, visits);
+        const float32x4_t puct = vmulq_f32(
+                                     vmulq_f32(vdupq_n_f32(in.cpuct), vld1q_f32(in.policy + base)),
+                                     vdivq_f32(vdupq_n_f32(in.numerator), denom));
+        float32x4_t value = vaddq_f32(vaddq_f32(q_value, puct), utility);
+        value = vbslq_f32(inactive, lowest, value);
+
+        const uint32x4_t greater = vcgtq_f32(value, best_value);
+        best_value = vbslq_f32(greater, value, best_value);
+        best_idx = vbslq_s32(greater, vaddq_s32(lanes, vdupq_n_s32(base)), best_idx);
+    }
+
+    float values[4];
+    int indices[4];
+    vst1q_f32(values, best_value);
+    vst1q_s32(indices, best_idx);
+
+    return ReduceLanes<4>(values, indices);
+}
+#endif
+
+using SelectFunc = int (*)(const PuctInputs &);
+
+static SelectFunc ChooseKernel(std::string &name) {
+#ifdef PUCT_KERNEL_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        name = "avx2";
+        return SelectBestAvx2;
+    }
+#endif
+#ifdef PUCT_KERNEL_NEON
+    name = "neon";
+    return SelectBestNeon;
+#endif
+    name = "scalar";
+    return PuctKernel::SelectBestScalar;
+}
+
+static std::string kKernelName;
+static const SelectFunc kSelectBest = ChooseKernel(kKernelName);
+
+int PuctKernel::SelectBest(const PuctInputs &in) {
+    return kSelectBest(in);
+}
+
+std::string PuctKernel::GetName() {
+    return kKernelName;
+}
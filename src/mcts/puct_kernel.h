@@ -0,0 +1,48 @@
+#pragma once
+
+#include "mcts/child_stats.h"
+
+#include <string>
+
+struct PuctInputs {
+    const ChildStats *stats{nullptr};
+
+    // The policy of every child. May be mixed with the noise.
+    const float *policy{nullptr};
+
+    float cpuct{0.f};
+    float numerator{0.f};
+    float fpu_value{0.f};
+    float expanding_value{0.f};
+    float parent_score{0.f};
+    float draw_factor{0.f};
+    float score_utility_factor{0.f};
+    float score_utility_div{1.f};
+    float virtual_loss_count{0.f};
+
+    // The pending threads of every child, padded like the stats. Use
+    // the shared counters of the stats if it is null.
+    const int *threads{nullptr};
+
+    bool is_white{false};
+};
+
+// The PUCT scoring kernel over the compact child statistics. The
+// vectorized kernels and the scalar kernel evaluate the same formula
+// with the same operation order, so they always select the same
+// child. The kernels are compiled without fast-math for this reason.
+class PuctKernel {
+public:
+    // Return the index of best child. Use the fastest kernel
+    // supported by this CPU.
+    static int SelectBest(const PuctInputs &in);
+
+    // Return the index of best child by the scalar kernel.
+    static int SelectBestScalar(const PuctInputs &in);
+
+    // Return the name of kernel used by SelectBest().
+    static std::string GetName();
+
+    // The tanh approximation used by all kernels.
+    static float Tanh(float x);
+};
@@ -0,0 +1,256 @@
+#include "mcts/remote_search.h"
+#include "game/sgf.h"
+#include "utils/log.h"
+#include "utils/format.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+constexpr int RemoteSearch::kJobVirtualLoss;
+
+// Refuse the broken header instead of allocating its size.
+static constexpr std::uint64_t kMaxPayloadSize = std::uint64_t{1} << 24;
+
+// Wait for the last statistics of the stopped jobs at most this long.
+static constexpr int kStopTimeoutMs = 2000;
+
+RemoteSearch::Hello RemoteSearch::GetHello() {
+    auto hello = Hello{};
+    hello.magic = 0x53595357; // "SYSW"
+    hello.version = 1;
+    return hello;
+}
+
+bool RemoteSearch::MatchHello(const Hello &a, const Hello &b) {
+    return a.magic == b.magic &&
+               a.version == b.version;
+}
+
+bool RemoteSearch::SendMessage(Socket &socket, std::uint32_t type,
+                               std::uint32_t job, const std::string &payload) {
+    auto header = MessageHeader{};
+    header.type = type;
+    header.job = job;
+    header.size = payload.size();
+    return socket.SendAll(&header, sizeof(header)) &&
+               socket.SendAll(payload.data(), payload.size());
+}
+
+bool RemoteSearch::RecvMessage(Socket &socket, std::uint32_t &type,
+                               std::uint32_t &job, std::string &payload) {
+    auto header = MessageHeader{};
+    if (!socket.RecvAll(&header, sizeof(header)) ||
+            header.size > kMaxPayloadSize) {
+        return false;
+    }
+    type = header.type;
+    job = header.job;
+    payload.resize(header.size);
+    return socket.RecvAll(&payload[0], payload.size());
+}
+
+RemoteSearch::RemoteSearch(const std::string &workers, int job_playouts)
+    : job_playouts_(std::max(job_playouts, 1)) {
+    auto iss = std::istringstream{workers};
+    auto address = std::string{};
+
+    while (std::getline(iss, address, ',')) {
+        auto host = std::string{};
+        int port = 0;
+        if (!SplitAddress(address, host, port)) {
+            LOGGING << Format("The search worker %s has no port.\n", address.c_str());
+            continue;
+        }
+
+        auto conn = std::make_unique<Connection>();
+        const auto hello = GetHello();
+        auto worker_hello = Hello{};
+        if (!conn->socket.Connect(host, port) ||
+                !conn->socket.SendAll(&hello, sizeof(hello)) ||
+                !conn->socket.RecvAll(&worker_hello, sizeof(worker_hello)) ||
+                !MatchHello(hello, worker_hello)) {
+            LOGGING << Format("Fail to connect the search worker %s.\n", address.c_str());
+            continue;
+        }
+        auto &ref = *conn;
+        conn->reader = std::thread([this, &ref]() { ReadReports(ref); });
+        connections_.emplace_back(std::move(conn));
+    }
+    if (!connections_.empty()) {
+        LOGGING << Format("Connect %zu search workers.\n", connections_.size());
+    }
+}
+
+RemoteSearch::~RemoteSearch() {
+    for (auto &conn : connections_) {
+        conn->socket.Shutdown();
+    }
+    for (auto &conn : connections_) {
+        conn->reader.join();
+        conn->socket.Close();
+    }
+}
+
+bool RemoteSearch::Valid() const {
+    return !connections_.empty();
+}
+
+void RemoteSearch::ReadReports(Connection &conn) {
+    auto type = std::uint32_t{0};
+    auto job = std::uint32_t{0};
+    auto payload = std::string{};
+
+    while (RecvMessage(conn.socket, type, job, payload)) {
+        if ((type != kStats && type != kDone) ||
+                payload.size() != sizeof(Node::Stats)) {
+            break;
+        }
+        auto stats = Node::Stats{};
+        std::memcpy(&stats, payload.data(), sizeof(stats));
+
+        std::lock_guard<std::mutex> lock(conn.mutex);
+        if (job != conn.job) {
+            // The report of the old job.
+            continue;
+        }
+        conn.reported = stats;
+        conn.done = type == kDone;
+    }
+
+    std::lock_guard<std::mutex> lock(conn.mutex);
+    conn.alive = false;
+    conn.done = true;
+}
+
+bool RemoteSearch::AssignJob(Connection &conn, Node *root, GameState &root_state) {
+    const auto node = root->PuctSelectChild(root_state.GetToMove(), true);
+    if (!node) {
+        return false;
+    }
+    const auto vertex = node->GetVertex();
+
+    auto state = root_state;
+    state.PlayMove(vertex);
+    const std::int32_t playouts = job_playouts_;
+    auto payload = std::string(sizeof(playouts), '\0');
+    std::memcpy(&payload[0], &playouts, sizeof(playouts));
+    payload += Sgf::Get().ToString(state);
+
+    const auto job = next_job_++;
+    {
+        std::lock_guard<std::mutex> lock(conn.mutex);
+        if (!conn.alive) {
+            return false;
+        }
+        conn.job = job;
+        conn.reported = Node::Stats{};
+        conn.done = false;
+    }
+    if (!SendMessage(conn.socket, kSearch, job, payload)) {
+        std::lock_guard<std::mutex> lock(conn.mutex);
+        conn.done = true;
+        return false;
+    }
+
+    for (int i = 0; i < kJobVirtualLoss; ++i) {
+        node->IncrementThreads();
+    }
+    conn.running_job = job;
+    conn.vertex = vertex;
+    conn.merged = Node::Stats{};
+    return true;
+}
+
+int RemoteSearch::Sync(Node *root, GameState &root_state, bool assign) {
+    int merged_visits = 0;
+
+    for (auto &conn : connections_) {
+        auto reported = Node::Stats{};
+        bool done;
+        bool alive;
+        {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            reported = conn->reported;
+            done = conn->done;
+            alive = conn->alive;
+        }
+
+        if (conn->running_job != 0) {
+            const auto node = root->GetChild(conn->vertex);
+            if (node && reported.visits > conn->merged.visits) {
+                auto delta = Node::Stats{};
+                delta.visits = reported.visits - conn->merged.visits;
+                delta.black_wl = reported.black_wl - conn->merged.black_wl;
+                delta.draw = reported.draw - conn->merged.draw;
+                delta.black_fs = reported.black_fs - conn->merged.black_fs;
+                delta.squared_eval_diff = reported.squared_eval_diff - conn->merged.squared_eval_diff;
+
+                // The statistics are of the black side, so the root
+                // takes the same values.
+                node->AddStats(delta);
+                root->AddStats(delta);
+                conn->merged = reported;
+                merged_visits += delta.visits;
+            }
+            if (done) {
+                if (node) {
+                    for (int i = 0; i < kJobVirtualLoss; ++i) {
+                        node->DecrementThreads();
+                    }
+                }
+                conn->running_job = 0;
+            }
+        }
+        if (assign && alive &&
+                conn->running_job == 0 &&
+                root->HaveChildren()) {
+            AssignJob(*conn, root, root_state);
+        }
+    }
+    return merged_visits;
+}
+
+int RemoteSearch::StopAll(Node *root, GameState &root_state) {
+    for (auto &conn : connections_) {
+        if (conn->running_job != 0) {
+            SendMessage(conn->socket, kStop, conn->running_job, std::string{});
+        }
+    }
+
+    int merged_visits = 0;
+    const auto start = std::chrono::steady_clock::now();
+    while (true) {
+        merged_visits += Sync(root, root_state, false);
+
+        bool finished = true;
+        for (auto &conn : connections_) {
+            finished &= conn->running_job == 0;
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                 std::chrono::steady_clock::now() - start).count();
+        if (finished || elapsed > kStopTimeoutMs) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // Give up the jobs which are not answered. Their late reports
+    // are dropped by the next job id.
+    for (auto &conn : connections_) {
+        if (conn->running_job != 0) {
+            const auto node = root->GetChild(conn->vertex);
+            if (node) {
+                for (int i = 0; i < kJobVirtualLoss; ++i) {
+                    node->DecrementThreads();
+                }
+            }
+            conn->running_job = 0;
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            conn->job = 0;
+            conn->done = true;
+        }
+    }
+    return merged_visits;
+}
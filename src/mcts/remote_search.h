@@ -0,0 +1,99 @@
+#pragma once
+
+#include "mcts/node.h"
+#include "game/game_state.h"
+#include "utils/socket.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The distributed search of the match play. The master search keeps
+// the top of the tree, and hands the sub-trees of the root children to
+// the search workers of the other hosts, started with --mode
+// search-worker. Every worker searches one job at a time and reports
+// the statistics of its root, which are merged into the root child of
+// the master tree. The running jobs put the virtual loss on their
+// children, so the next jobs go to the other good children.
+class RemoteSearch {
+public:
+    enum MessageType : std::uint32_t {
+        kSearch = 1, // the playouts and the SGF of the job position
+        kStop,       // stop the job
+        kStats,      // the statistics of the job so far
+        kDone        // the last statistics of the job
+    };
+
+    struct Hello {
+        std::uint32_t magic;
+        std::uint32_t version;
+    };
+
+    struct MessageHeader {
+        std::uint32_t type;
+        std::uint32_t job;
+        std::uint64_t size;
+    };
+
+    static Hello GetHello();
+    static bool MatchHello(const Hello &a, const Hello &b);
+
+    static bool SendMessage(Socket &socket, std::uint32_t type,
+                            std::uint32_t job, const std::string &payload);
+    static bool RecvMessage(Socket &socket, std::uint32_t &type,
+                            std::uint32_t &job, std::string &payload);
+
+    // Connect the workers of the comma separated "host:port" list. The
+    // unreachable workers are skipped.
+    RemoteSearch(const std::string &workers, int job_playouts);
+    ~RemoteSearch();
+
+    // Return true if any worker is connected.
+    bool Valid() const;
+
+    // Merge the new statistics of the jobs into the root children and
+    // the root, then give the idle workers the new jobs if assign is
+    // true. Only the main search thread calls it. Return the merged
+    // visits.
+    int Sync(Node *root, GameState &root_state, bool assign);
+
+    // Stop all jobs and merge their last statistics. It must be called
+    // before the root or its children are changed or released. Return
+    // the merged visits.
+    int StopAll(Node *root, GameState &root_state);
+
+private:
+    // Every remote job puts this many threads of virtual loss on its
+    // child.
+    static constexpr int kJobVirtualLoss = 4;
+
+    struct Connection {
+        Socket socket;
+        std::thread reader;
+
+        // The reader thread writes the reports of the current job.
+        std::mutex mutex;
+        std::uint32_t job{0};
+        Node::Stats reported;
+        bool done{true};
+        bool alive{true};
+
+        // The job of the main search thread. The job id is zero if it
+        // is idle.
+        std::uint32_t running_job{0};
+        int vertex{kNullVertex};
+        Node::Stats merged;
+    };
+
+    // Read the reports of the worker until it is disconnected.
+    void ReadReports(Connection &conn);
+
+    bool AssignJob(Connection &conn, Node *root, GameState &root_state);
+
+    std::vector<std::unique_ptr<Connection>> connections_;
+    std::uint32_t next_job_{1};
+    int job_playouts_;
+};
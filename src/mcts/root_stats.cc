@@ -0,0 +1,64 @@
+#include "mcts/root_stats.h"
+#include "mcts/node.h"
+
+#include <cmath>
+
+RootStats::RootStats() {
+    Reset(nullptr);
+}
+
+void RootStats::Reset(Node *root) {
+    for (auto &v : visits_) {
+        v.store(0, std::memory_order_relaxed);
+    }
+    if (!root) {
+        return;
+    }
+    for (const auto &child : root->GetChildren()) {
+        const auto node = child.Get();
+        if (node && node->IsActive() && node->GetVisits() > 0) {
+            visits_[node->GetVertex()].store(
+                node->GetVisits(), std::memory_order_relaxed);
+        }
+    }
+}
+
+RootStats::Snapshot RootStats::Get() const {
+    auto s = Snapshot{};
+    s.visits = 0;
+    s.best_move = kNullVertex;
+    s.best_visits = 0;
+    s.second_visits = 0;
+
+    // The sum of n * log(n) of all children. The entropy is
+    // log(N) - sum / N.
+    auto sum_nlogn = 0.0;
+    const int size = visits_.size();
+    for (int vtx = 0; vtx < size; ++vtx) {
+        const auto n = visits_[vtx].load(std::memory_order_relaxed);
+        if (n <= 0) {
+            continue;
+        }
+        s.visits += n;
+        sum_nlogn += n * std::log(static_cast<double>(n));
+        if (n > s.best_visits) {
+            s.second_visits = s.best_visits;
+            s.best_visits = n;
+            s.best_move = vtx;
+        } else if (n > s.second_visits) {
+            s.second_visits = n;
+        }
+    }
+
+    s.entropy = s.visits > 0 ?
+                    static_cast<float>(std::log(s.visits) - sum_nlogn / s.visits) : 0.f;
+
+    if (s.visits == s.best_visits) {
+        s.kl_divergence = 0.f;
+    } else if (s.best_visits == 0) {
+        s.kl_divergence = -1.f;
+    } else {
+        s.kl_divergence = -std::log((float)s.best_visits / s.visits);
+    }
+    return s;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "game/types.h"
+
+#include <array>
+#include <atomic>
+
+class Node;
+
+// The visits of the root children for the time control. The search
+// threads add the visit after backing up through the root with one
+// relaxed atomic add, so there is no lock on the hot path. The best
+// move, its visit share and the entropy of the visit distribution
+// are computed only when the time control reads them. The best move
+// here is the most visited child.
+class RootStats {
+public:
+    RootStats();
+
+    // Rebuild the visits from the children of the root. It is called
+    // when the visits of the children change without Add(), e.g. the
+    // new root, the pruned tree or the merged remote visits. The
+    // running threads may lose or count one visit twice around it,
+    // which the next rebuilding corrects.
+    void Reset(Node *root);
+
+    // The child of the vertex gets the visits.
+    void Add(int vertex, int visits) {
+        visits_[vertex].fetch_add(visits, std::memory_order_relaxed);
+    }
+
+    struct Snapshot {
+        int visits; // the sum of the children visits
+        int best_move;
+        int best_visits;
+        int second_visits;
+
+        // The entropy of the visit distribution in nats.
+        float entropy;
+
+        // The KL divergence between the visits and the best move,
+        // -log(best share). It is 0 if the best move has all visits,
+        // and -1 if there is no visit.
+        float kl_divergence;
+    };
+    Snapshot Get() const;
+
+private:
+    std::array<std::atomic<int>, kNumVertices + 10> visits_;
+};
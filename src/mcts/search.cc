@@ -6,11 +6,19 @@
 #include <stack>
 #include <random>
 #include <cmath>
+#include <functional>
+#include <unordered_map>
+#include <limits>
+#include <tuple>
 
 #include "mcts/search.h"
+#include "mcts/tree_collector.h"
+#include "mcts/puct_kernel.h"
 #include "neural/encoder.h"
 #include "utils/log.h"
 #include "utils/format.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
 #include "utils/random.h"
 #include "game/book.h"
 
@@ -39,12 +47,24 @@ void Search::Initialize() {
 
     max_playouts_ = param_->playouts;
     playouts_.store(0, std::memory_order_relaxed);
+
+    remote_search_.reset();
+    if (!param_->search_workers.empty()) {
+        remote_search_ = std::make_unique<RemoteSearch>(
+                             param_->search_workers, param_->remote_job_playouts);
+        if (!remote_search_->Valid()) {
+            remote_search_.reset();
+        }
+    }
 }
 
 void Search::PlaySimulation(GameState &currstate, Node *const node,
                             const int depth, SearchResult &search_result) {
-    node->IncrementThreads();
+    if (!param_->local_virtual_loss) {
+        node->IncrementThreads();
+    }
 
+    const auto hash = currstate.GetHash();
     const bool end_by_passes = currstate.GetPasses() >= 2;
     if (end_by_passes) {
         search_result.FromGameOver(currstate);
@@ -53,6 +73,10 @@ void Search::PlaySimulation(GameState &currstate, Node *const node,
     // Terminated node, try to expand it. 
     if (node->Expandable()) {
         const auto last_move = currstate.GetLastMove();
+        if (!param_->no_dcnn && !end_by_passes) {
+            // Load the cache slots while the superko is checked.
+            network_.PrefetchCache(currstate);
+        }
 
         if (end_by_passes) {
             if (node->SetTerminal() &&
@@ -76,42 +100,327 @@ void Search::PlaySimulation(GameState &currstate, Node *const node,
                 // If we can not expand the node, it means that another thread
                 // is expanding this node. Skip the simulation this time.
                 auto node_evals = NodeEvals{};
-                const bool success = node->ExpandChildren(network_, currstate,
-                                                              node_evals, analysis_config_, false);
+                auto success = false;
+                {
+                    TRACE_SCOPE("Expand");
+                    success = node->ExpandChildren(network_, currstate,
+                                                       node_evals, analysis_config_, false,
+                                                       NeedOwnership(depth));
+                }
 
                 if (!have_children && success) {
                     search_result.FromNetEvals(node_evals);
+                    ApplyTransposition(hash, search_result);
                 }
             }
         }
     }
 
     // Not the terminate node, search the next node.
+    Node *next = nullptr;
     if (node->HaveChildren() && !search_result.IsValid()) {
         auto color = currstate.GetToMove();
-        Node *next = nullptr;
 
         // Go to the next node by PUCT/UCT algoritim.
-        if (param_->no_dcnn) {
-            next = node->UctSelectChild(color, depth == 0, currstate);
-        } else {
-            next = node->PuctSelectChild(color, depth == 0);
+        {
+            TRACE_SCOPE("Select");
+            if (depth == 0 && node == root_node_.get()) {
+                if (!ponder_focus_.empty()) {
+                    next = SelectPonderReply();
+                } else if (analysis_config_.multi_pv > 0) {
+                    next = SelectMultiPvReply();
+                }
+            }
+            if (next) {
+                // It is the focused reply.
+            } else if (param_->no_dcnn) {
+                next = node->UctSelectChild(color, depth == 0, currstate);
+            } else {
+                next = node->PuctSelectChild(color, depth == 0);
+            }
         }
         auto vtx = next->GetVertex();
+        next->PrefetchChildren();
 
-        currstate.PlayMove(vtx, color);
+        {
+            TRACE_SCOPE("PlayMove");
+            currstate.PlayMove(vtx, color);
+        }
         PlaySimulation(currstate, next, depth+1, search_result);
     }
 
     // Now Update this node.
     if (search_result.IsValid()) {
+        TRACE_SCOPE("Backup");
         node->Update(search_result.GetEvals());
+        StoreTransposition(hash, node, depth);
+        if (param_->dynamic_time && next && node == root_node_.get()) {
+            root_stats_.Add(next->GetVertex(), 1);
+        }
+    }
+    if (!param_->local_virtual_loss) {
+        node->DecrementThreads();
+    }
+}
+
+void Search::PlayoutRound(Node *root) {
+    Network::SetCacheRoot(root_state_.GetMoveNumber());
+
+    if (param_->async_leaves > 1 && !param_->no_dcnn) {
+        PlayAsyncSimulations(root, param_->async_leaves);
+        return;
+    }
+
+    // Every thread keeps its own game state. It is unmade back to the
+    // root after the playout, so the next playout does not copy it.
+    thread_local auto currstate = GameState{};
+    if (!currstate.IsSameHistory(root_state_)) {
+        currstate = root_state_;
+    }
+    auto result = SearchResult{};
+
+    PlaySimulation(currstate, root, 0, result);
+    currstate.UnmakeMoves(currstate.GetMoveNumber() - root_state_.GetMoveNumber());
+
+    if (result.IsValid()) {
+        playouts_.fetch_add(1, std::memory_order_relaxed);
+        Metrics::Add(Metrics::kPlayouts);
+    }
+}
+
+bool Search::BeginSequentialHalving(const int playouts, Search::OptionTag tag) {
+    if (!param_->sequential_halving ||
+            !param_->gumbel ||
+            param_->no_dcnn ||
+            (tag & (kPonder | kAnalysis)) ||
+            !root_node_->HaveChildren() ||
+            !root_node_->ShouldApplyGumbel()) {
+        return false;
+    }
+
+    // Gumbel is only applied below the Gumbel playouts. The rest of
+    // playouts uses PUCT as before.
+    const auto budget = std::min(playouts,
+                                     param_->gumbel_playouts - (root_node_->GetVisits() - 1));
+    return halving_.Begin(root_node_.get(), root_state_.GetToMove(),
+                              param_->gumbel_considered_moves, budget);
+}
+
+void Search::PlayHalvingPhase() {
+    PlayAsyncSimulations(root_node_.get(), std::max(1, halving_.GetRemaining()));
+    if (halving_.GetRemaining() == 0) {
+        halving_.NextPhase(root_node_.get());
+    }
+}
+
+void Search::PlayAsyncSimulations(Node *root, const int leaves) {
+    auto playouts = std::vector<AsyncPlayout>{};
+
+    // Reuse the game states of this thread like PlayoutRound().
+    thread_local auto states = std::vector<GameState>{};
+
+    SubmitAsyncPlayouts(root, playouts, states, leaves);
+    CollectAsyncPlayouts(playouts);
+}
+
+void Search::BackupAsyncPlayout(AsyncPlayout &p) {
+    TRACE_SCOPE("Backup");
+    const bool valid = p.result.IsValid();
+    int depth = p.path.size();
+    for (auto it = std::rbegin(p.path); it != std::rend(p.path); ++it) {
+        const auto node = it->first;
+        depth -= 1;
+        if (valid) {
+            node->Update(p.result.GetEvals());
+            StoreTransposition(it->second, node, depth);
+        }
+        if (!param_->local_virtual_loss) {
+            node->DecrementThreads();
+        }
+    }
+    if (valid) {
+        if (param_->dynamic_time &&
+                p.path.size() >= 2 && p.path[0].first == root_node_.get()) {
+            root_stats_.Add(p.path[1].first->GetVertex(), 1);
+        }
+        playouts_.fetch_add(1, std::memory_order_relaxed);
+        Metrics::Add(Metrics::kPlayouts);
     }
-    node->DecrementThreads();
+}
+
+void Search::SubmitAsyncPlayouts(Node *root, std::vector<AsyncPlayout> &playouts,
+                                 std::vector<GameState> &states, const int leaves) {
+    playouts.clear();
+    playouts.resize(leaves);
+    if ((int)states.size() < leaves) {
+        states.resize(leaves);
+    }
+
+    // Descend the tree and submit the leaves one by one. The threads
+    // of every node on the pending path are still counted, so that the
+    // next descents see the virtual loss and select the other paths.
+    // In the local virtual loss mode, only this batch counts them, and
+    // the shared counters are never touched.
+    const bool local = param_->local_virtual_loss;
+    thread_local auto local_threads = std::unordered_map<const Node *, std::vector<int>>{};
+    local_threads.clear();
+
+    for (int i = 0; i < leaves; ++i) {
+        auto &p = playouts[i];
+        p.state = &states[i];
+        if (!p.state->IsSameHistory(root_state_)) {
+            *p.state = root_state_;
+        }
+        auto &currstate = *p.state;
+        auto node = root;
+        int depth = 0;
+
+        while (true) {
+            if (!local) {
+                node->IncrementThreads();
+            }
+            p.path.emplace_back(node, currstate.GetHash());
+
+            const bool end_by_passes = currstate.GetPasses() >= 2;
+            if (end_by_passes) {
+                p.result.FromGameOver(currstate);
+            }
+
+            if (node->Expandable()) {
+                const auto last_move = currstate.GetLastMove();
+                if (!end_by_passes) {
+                    network_.PrefetchCache(currstate);
+                }
+
+                if (end_by_passes) {
+                    if (node->SetTerminal() &&
+                            p.result.IsValid()) {
+                        node->ApplyEvals(p.result.GetEvals());
+                    }
+                } else if (last_move != kPass &&
+                               currstate.IsSuperko()) {
+                    node->Invalidate();
+                } else if (node->SubmitExpanding(network_, currstate, p.future,
+                                                     NeedOwnership(depth))) {
+                    // Wait for the result later.
+                    break;
+                }
+            }
+
+            if (!node->HaveChildren() || node->IsExpanding() ||
+                    p.result.IsValid()) {
+                // It is the terminal node or another leaf is expanding
+                // this node. The leaf may be in this batch, so never
+                // wait for it.
+                break;
+            }
+
+            const auto color = currstate.GetToMove();
+            {
+                TRACE_SCOPE("Select");
+                Node *reply = nullptr;
+                // The root schedulers only work on the main tree.
+                const bool main_root = depth == 0 && node == root_node_.get();
+                if (main_root && halving_.IsActive()) {
+                    reply = root_node_->GetChild(halving_.NextMove());
+                } else if (main_root && !ponder_focus_.empty()) {
+                    reply = SelectPonderReply();
+                } else if (main_root && analysis_config_.multi_pv > 0) {
+                    reply = SelectMultiPvReply();
+                }
+                if (reply) {
+                    node = reply;
+                } else {
+                    node = local ? node->PuctSelectChild(color, depth == 0, local_threads[node]) :
+                                       node->PuctSelectChild(color, depth == 0);
+                }
+            }
+            node->PrefetchChildren();
+            {
+                TRACE_SCOPE("PlayMove");
+                currstate.PlayMove(node->GetVertex(), color);
+            }
+            depth += 1;
+        }
+
+        if (!p.future.valid()) {
+            // Nothing to wait for.
+            BackupAsyncPlayout(p);
+        }
+    }
+}
+
+void Search::CollectAsyncPlayouts(std::vector<AsyncPlayout> &playouts) {
+    // Collect the network results and update the paths.
+    for (auto &p : playouts) {
+        if (!p.future.valid()) {
+            continue;
+        }
+        auto raw_netlist = p.future.get();
+        auto node_evals = NodeEvals{};
+        const auto leaf = p.path.back();
+
+        leaf.first->FinishExpanding(*p.state, raw_netlist, node_evals, analysis_config_);
+        p.result.FromNetEvals(node_evals);
+        ApplyTransposition(leaf.second, p.result);
+        BackupAsyncPlayout(p);
+    }
+
+    for (auto &p : playouts) {
+        p.state->UnmakeMoves(p.state->GetMoveNumber() - root_state_.GetMoveNumber());
+    }
+    playouts.clear();
+}
+
+void Search::ApplyTransposition(std::uint64_t hash, SearchResult &search_result) {
+    if (!transposition_table_.Enabled()) {
+        return;
+    }
+
+    auto entry = TranspositionEntry{};
+    if (transposition_table_.Lookup(hash, entry)) {
+        // The same position was searched by other move orders. Its
+        // sub-tree value is more accurate than the single network
+        // evaluation. Keep the ownership of network.
+        auto evals = search_result.GetEvals();
+        evals->black_wl = entry.black_wl;
+        evals->draw = entry.draw;
+        evals->black_final_score = entry.black_final_score;
+    }
+}
+
+void Search::StoreTransposition(std::uint64_t hash, Node *node, const int depth) {
+    // The positions near the root can not be reached by the other
+    // move orders in this search, and every playout goes through
+    // them. Storing them only makes the threads wait for the same
+    // buckets.
+    constexpr int kMinDepth = 3;
+
+    if (!transposition_table_.Enabled() || depth < kMinDepth) {
+        return;
+    }
+
+    const auto visits = node->GetVisits();
+    if (visits < 2) {
+        // It is only one network evaluation. The NN cache
+        // already keeps it.
+        return;
+    }
+
+    auto entry = TranspositionEntry{};
+    entry.key = hash;
+    entry.visits = visits;
+    entry.black_wl = node->GetWL(kBlack, false);
+    entry.draw = node->GetDraw();
+    entry.black_final_score = node->GetFinalScore(kBlack);
+    transposition_table_.Store(entry);
 }
 
 void Search::PrepareRootNode() {
+    halving_.Clear();
+
     bool reused = AdvanceToNewRootState();
+    RecordPonderHit(reused);
 
     if (!reused) {
         // Try release whole trees.
@@ -125,6 +434,16 @@ void Search::PrepareRootNode() {
     playouts_.store(0, std::memory_order_relaxed);
     running_.store(true, std::memory_order_relaxed);
 
+    transposition_table_.SetMemory(std::max(0, param_->transposition_memory_mib));
+
+    // The stored values of the other network, komi or board size
+    // are wrong for this search.
+    if (transposition_generation_ != network_.GetGeneration() ||
+            transposition_komi_hash_ != root_state_.GetKomiHash() ||
+            transposition_board_size_ != root_state_.GetBoardSize()) {
+        ClearTranspositionTable();
+    }
+
     auto node_evals = NodeEvals{};
     const bool success = root_node_->PrepareRootNode(
                              network_, root_state_, node_evals, analysis_config_);
@@ -132,13 +451,273 @@ void Search::PrepareRootNode() {
     if (!reused && success) {
         root_node_->Update(&node_evals);
     }
+    if (param_->dynamic_time) {
+        root_stats_.Reset(root_node_.get());
+    }
 }
 
 void Search::ReleaseTree() {
     if (root_node_) {
-        auto p = root_node_.release();
-        group_->AddTask([p](){ delete p; });
+        TreeCollector::Get().Collect(root_node_.release());
+    }
+    ReleaseRootTrees();
+}
+
+void Search::ClearTranspositionTable() {
+    transposition_table_.Clear();
+    transposition_generation_ = network_.GetGeneration();
+    transposition_komi_hash_ = root_state_.GetKomiHash();
+    transposition_board_size_ = root_state_.GetBoardSize();
+}
+
+// The header of the tree file. The node records of node.cc follow it.
+struct TreeFileHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::int32_t board_size;
+    float komi;
+    std::uint64_t hash;
+};
+
+static constexpr std::uint32_t kTreeFileMagic = 0x52545953; // "SYTR"
+static constexpr std::uint32_t kTreeFileVersion = 1;
+
+bool Search::SaveTree(const std::string &filename) {
+    if (!root_node_) {
+        return false;
+    }
+    auto file = std::ofstream{filename, std::ios_base::binary | std::ios_base::trunc};
+    if (!file.is_open()) {
+        return false;
+    }
+
+    // The tree is of the last searched position.
+    auto header = TreeFileHeader{};
+    header.magic = kTreeFileMagic;
+    header.version = kTreeFileVersion;
+    header.board_size = last_state_.GetBoardSize();
+    header.komi = last_state_.GetKomi();
+    header.hash = last_state_.GetHash();
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    root_node_->SaveTree(file);
+    file.close();
+    return !file.fail();
+}
+
+bool Search::LoadTree(const std::string &filename) {
+    auto file = std::ifstream{filename, std::ios_base::binary};
+    auto header = TreeFileHeader{};
+    if (!file.is_open() ||
+            !file.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+        return false;
+    }
+    if (header.magic != kTreeFileMagic ||
+            header.version != kTreeFileVersion ||
+            header.board_size != root_state_.GetBoardSize() ||
+            header.hash != root_state_.GetHash()) {
+        return false;
     }
+
+    auto root = std::make_unique<Node>(kPass, 1.0f);
+    root->SetParameters(param_.get());
+    if (!root->LoadTree(file) || !root->HaveChildren()) {
+        return false;
+    }
+
+    ReleaseTree();
+    root_node_ = std::move(root);
+    last_state_ = root_state_;
+    return true;
+}
+
+void Search::PrepareRootTrees() {
+    ReleaseRootTrees();
+
+    // Every tree needs one thread at least.
+    const int num_trees = std::min(param_->root_trees, param_->threads);
+    for (int i = 1; i < num_trees; ++i) {
+        auto tree = RootTree{};
+        tree.root = std::make_unique<Node>(kPass, 1.0f);
+        tree.root->SetParameters(param_.get());
+
+        // The root evaluation is in the NN cache already.
+        auto node_evals = NodeEvals{};
+        if (!tree.root->PrepareRootNode(
+                network_, root_state_, node_evals, analysis_config_)) {
+            break;
+        }
+        tree.root->Update(&node_evals);
+
+        // Only merge the visits of the search. The main tree has
+        // its own root evaluation.
+        tree.merged_root = tree.root->GetStats();
+        tree.merged_children.resize(kNumVertices + 10);
+        root_trees_.emplace_back(std::move(tree));
+    }
+}
+
+void Search::MergeRootTrees() {
+    const auto Delta = [](const Node::Stats &now, const Node::Stats &merged) {
+        auto delta = Node::Stats{};
+        delta.visits = now.visits - merged.visits;
+        delta.black_wl = now.black_wl - merged.black_wl;
+        delta.draw = now.draw - merged.draw;
+        delta.black_fs = now.black_fs - merged.black_fs;
+        delta.squared_eval_diff = now.squared_eval_diff - merged.squared_eval_diff;
+        return delta;
+    };
+
+    for (auto &tree : root_trees_) {
+        for (const auto &child : tree.root->GetChildren()) {
+            const auto node = child.Get();
+            if (!node) {
+                continue;
+            }
+            auto &merged = tree.merged_children[child.GetVertex()];
+            const auto now = node->GetStats();
+            if (now.visits <= merged.visits) {
+                continue;
+            }
+            const auto main_child = root_node_->GetChild(child.GetVertex());
+            if (main_child) {
+                main_child->AddStats(Delta(now, merged));
+                if (param_->dynamic_time) {
+                    root_stats_.Add(child.GetVertex(), now.visits - merged.visits);
+                }
+                merged = now;
+            }
+        }
+        const auto now = tree.root->GetStats();
+        if (now.visits > tree.merged_root.visits) {
+            root_node_->AddStats(Delta(now, tree.merged_root));
+            tree.merged_root = now;
+        }
+    }
+}
+
+void Search::ReleaseRootTrees() {
+    for (auto &tree : root_trees_) {
+        TreeCollector::Get().Collect(tree.root.release());
+    }
+    root_trees_.clear();
+}
+
+Node *Search::GetSearchRoot(int thread_index) const {
+    const int num_trees = root_trees_.size() + 1;
+    const int tree = thread_index % num_trees;
+    return tree == 0 ? root_node_.get() : root_trees_[tree - 1].root.get();
+}
+
+void Search::SyncRemoteSearch() {
+    const auto visits = remote_search_->Sync(root_node_.get(), root_state_, true);
+    playouts_.fetch_add(visits, std::memory_order_relaxed);
+    if (visits > 0 && param_->dynamic_time) {
+        root_stats_.Reset(root_node_.get());
+    }
+}
+
+void Search::StopRemoteSearch() {
+    const auto visits = remote_search_->StopAll(root_node_.get(), root_state_);
+    playouts_.fetch_add(visits, std::memory_order_relaxed);
+    if (visits > 0 && param_->dynamic_time) {
+        root_stats_.Reset(root_node_.get());
+    }
+}
+
+size_t Search::GetTreeMemoryUsed() const {
+    return root_node_ ? root_node_->GetTreeMemoryUsed() : 0;
+}
+
+std::string Search::GetMemoryReport() {
+    const auto ToMiB = [](size_t bytes) {
+        return static_cast<double>(bytes) / (1024.f * 1024.f);
+    };
+    auto nodes = size_t{0};
+    auto edges = size_t{0};
+    if (root_node_) {
+        root_node_->ComputeNodeCount(nodes, edges);
+    }
+    const auto tree = nodes * Node::GetNodeMemory() + edges * Node::GetEdgeMemory();
+    const auto tt = transposition_table_.GetMemory() * 1024 * 1024;
+    const auto usage = network_.GetMemoryUsage();
+    const auto host = tree + tt + usage.cache + usage.opening_cache + usage.deep_cache;
+
+    auto out = std::ostringstream{};
+    out << Format("tree: %.2f MiB, %zu nodes, %zu edges", ToMiB(tree), nodes, edges);
+    if (GetTreeMemoryLimit() > 0) {
+        out << Format(", limit %.2f MiB", ToMiB(GetTreeMemoryLimit()));
+    }
+    out << '\n'
+        << Format("nn cache: %.2f MiB, %zu of %zu entries used\n",
+                      ToMiB(usage.cache), usage.cache_used_entries, usage.cache_entries)
+        << Format("opening cache: %.2f MiB\n", ToMiB(usage.opening_cache))
+        << Format("deep cache: %.2f MiB\n", ToMiB(usage.deep_cache))
+        << Format("transposition table: %.2f MiB\n", ToMiB(tt))
+        << Format("host total: %.2f MiB\n", ToMiB(host))
+        << Format("device buffers: %.2f MiB", ToMiB(usage.device));
+    return out.str();
+}
+
+std::string Search::GetMemoryPlan(size_t ram_mib, size_t vram_mib) {
+    const auto ToMiB = [](size_t bytes) {
+        return static_cast<double>(bytes) / (1024.f * 1024.f);
+    };
+    auto nodes = size_t{0};
+    auto edges = size_t{0};
+    if (root_node_) {
+        root_node_->ComputeNodeCount(nodes, edges);
+    }
+    const auto usage = network_.GetMemoryUsage();
+    const auto tt = transposition_table_.GetMemory() * 1024 * 1024;
+    const auto fixed = usage.opening_cache + usage.deep_cache + tt;
+    const auto ram = ram_mib * 1024 * 1024;
+
+    auto out = std::ostringstream{};
+    if (ram <= fixed) {
+        out << Format("The RAM budget is smaller than the opening cache, the deep cache and the transposition table, %.2f MiB.",
+                          ToMiB(fixed));
+    } else {
+        // Every playout adds one node and the edges of its children,
+        // and evaluates about one position. So the cache keeps as many
+        // results as the nodes of the tree. The edges per node are of
+        // the current tree, or all intersections of the empty board.
+        const auto edges_per_node = nodes > 1 ?
+                                        static_cast<double>(edges) / nodes :
+                                        static_cast<double>(root_state_.GetNumIntersections());
+        const auto playout_bytes = Node::GetNodeMemory() + edges_per_node * Node::GetEdgeMemory();
+        const auto entry_bytes = network_.GetCacheEntrySize();
+        const auto avail = ram - fixed;
+        const auto cache = static_cast<size_t>(avail * entry_bytes / (entry_bytes + playout_bytes));
+        const auto tree = avail - cache;
+
+        out << Format("RAM %zu MiB, keep %.2f MiB for the other tables\n", ram_mib, ToMiB(fixed))
+            << Format("--cache-memory-mib %zu\n", std::max(cache / (1024 * 1024), size_t{5}))
+            << Format("--tree-memory-mib %zu, about %.0f playouts",
+                          tree / (1024 * 1024), tree / playout_bytes);
+    }
+
+    if (vram_mib > 0) {
+        const auto batch_size = std::max(GetOption<int>("batch_size"), 1);
+        out << '\n';
+        if (usage.device == 0) {
+            out << "The backend has no device buffers.";
+        } else {
+            // The buffers grow with the batch size. The weights are
+            // not counted, so keep some space for them.
+            const auto entry_bytes = static_cast<double>(usage.device) / batch_size;
+            const auto vram = static_cast<double>(vram_mib) * 1024 * 1024 * 0.9;
+            const auto batch = std::max(static_cast<int>(vram / entry_bytes), 1);
+            out << Format("VRAM %zu MiB, %.2f KiB of the buffers per batch entry\n",
+                              vram_mib, entry_bytes / 1024.0)
+                << Format("--batch-size %d", batch);
+        }
+    }
+    return out.str();
+}
+
+Node::Stats Search::GetRootStats() const {
+    return root_node_ ? root_node_->GetStats() : Node::Stats{};
 }
 
 void Search::TimeSettings(const int main_time,
@@ -154,9 +733,15 @@ void Search::TimeLeft(const int color, const int time, const int stones) {
 }
 
 bool Search::InputPending(Search::OptionTag tag) const {
+    if (tag & kRemote) {
+        return input_pending_ && input_pending_();
+    }
     if (!(tag & kPonder)) {
         return false;
     }
+    if (input_pending_) {
+        return input_pending_();
+    }
 #ifdef WIN32
     static int init = 0, pipe;
     static HANDLE inh;
@@ -196,6 +781,14 @@ bool Search::InputPending(Search::OptionTag tag) const {
 #endif
 }
 
+ComputationResult Search::ScoringComputation() {
+    auto result = Computation(1, kForced);
+    if (result.uncertain_stones > 0 && param_->scoring_playouts > 1) {
+        result = Computation(param_->scoring_playouts, kForced);
+    }
+    return result;
+}
+
 ComputationResult Search::Computation(int playouts, Search::OptionTag tag) {
     auto computation_result = ComputationResult{};
     playouts = std::min(playouts, kMaxPlayouts);
@@ -222,14 +815,7 @@ ComputationResult Search::Computation(int playouts, Search::OptionTag tag) {
     const auto board_size = root_state_.GetBoardSize();
     const auto move_num = root_state_.GetMoveNumber();
 
-    computation_result.to_move = static_cast<VertexType>(color);
-    computation_result.board_size = board_size;
-    computation_result.komi = root_state_.GetKomi();
-    computation_result.movenum = root_state_.GetMoveNumber();
-    computation_result.playouts = 0;
-    computation_result.seconds = 0.f;
-    computation_result.threads = param_->threads;
-    computation_result.batch_size = param_->batch_size;
+    InitComputationResult(computation_result);
 
     if (root_state_.IsGameOver()) {
         // Always reture pass move if the passese number is greater than two.
@@ -247,19 +833,21 @@ ComputationResult Search::Computation(int playouts, Search::OptionTag tag) {
     }
 
     // The SMP workers run on every threads except for the main thread.
-    const auto Worker = [this]() -> void {
-        while(running_.load(std::memory_order_relaxed)) {
-            auto currstate = std::make_unique<GameState>(root_state_);
-            auto result = SearchResult{};
-            PlaySimulation(*currstate, root_node_.get(), 0, result);
-            if (result.IsValid()) {
-                playouts_.fetch_add(1, std::memory_order_relaxed);
-            }
-        };
+    // Every worker searches the root of its tree.
+    const auto AddWorkers = [this]() -> void {
+        for (int t = 1; t < param_->threads; ++t) {
+            const auto root = GetSearchRoot(t);
+            group_->AddTask([this, root]() -> void {
+                while(running_.load(std::memory_order_relaxed)) {
+                    PlayoutRound(root);
+                };
+            });
+        }
     };
 
     Timer timer; // main timer
     Timer analysis_timer; // for analysis
+    Timer memory_timer; // for tree memory limit
 
     // Set the time control.
     time_control_.SetLagBuffer(param_->lag_buffer);
@@ -268,6 +856,7 @@ ComputationResult Search::Computation(int playouts, Search::OptionTag tag) {
     // Clean the timer.
     timer.Clock();
     analysis_timer.Clock();
+    memory_timer.Clock();
 
     // Compute the max thinking time. The bound time is
     // max const time if we already set it.
@@ -275,10 +864,23 @@ ComputationResult Search::Computation(int playouts, Search::OptionTag tag) {
                                  time_control_.IsInfiniteTime(color)) ?
                                      param_->const_time : std::numeric_limits<float>::max();
 
-    const auto thinking_time = std::min(
-                                   bound_time,
-                                   time_control_.GetThinkingTime(color, board_size, move_num));
+    auto thinking_time = std::min(
+                             bound_time,
+                             time_control_.GetThinkingTime(color, board_size, move_num));
     PrepareRootNode();
+    PrepareRootTrees();
+
+    const bool use_dynamic_time = param_->dynamic_time &&
+                                      (tag & kThinking) &&
+                                      !time_control_.IsInfiniteTime(color);
+    auto dynamic_time = DynamicTime{};
+    dynamic_time.nominal = thinking_time;
+    dynamic_time.max_time = time_control_.GetMaxThinkingTime(color, board_size, move_num);
+    dynamic_time.best_move = kNullVertex;
+    dynamic_time.best_since = 0.f;
+    if (tag & kPonder) {
+        SetPonderFocus();
+    }
 
     if (param_->analysis_verbose) {
         if (param_->no_dcnn) {
@@ -286,6 +888,9 @@ ComputationResult Search::Computation(int playouts, Search::OptionTag tag) {
         }
         LOGGING << Format("Reuse %d nodes\n", root_node_->GetVisits()-1);
         LOGGING << Format("Use %d threads for search\n", param_->threads);
+        if (!root_trees_.empty()) {
+            LOGGING << Format("Use %zu root trees\n", root_trees_.size() + 1);
+        }
         LOGGING << Format("Max thinking time: %.0f(sec)\n", thinking_time);
         LOGGING << Format("Max playouts number: %d\n", playouts);
     }
@@ -296,21 +901,65 @@ ComputationResult Search::Computation(int playouts, Search::OptionTag tag) {
         running_.store(false, std::memory_order_relaxed);
     }
 
-    for (int t = 1; t < param_->threads; ++t) {
-        // SMP thread is running.
-        group_->AddTask(Worker);
+    if (BeginSequentialHalving(playouts, tag)) {
+        // The phases are searched by the main thread only. Every phase
+        // is one batch.
+        while (halving_.IsActive() &&
+                   running_.load(std::memory_order_relaxed) &&
+                   !InputPending(tag)) {
+            PlayHalvingPhase();
+
+            const auto elapsed = (tag & kThinking) ?
+                                     timer.GetDuration() : std::numeric_limits<float>::lowest();
+            if (!KeepSearching(playouts, tag, elapsed, thinking_time)) {
+                running_.store(false, std::memory_order_relaxed);
+            }
+        }
     }
 
+    // SMP threads are running.
+    AddWorkers();
+
+    // The search workers of the other hosts search the root children.
+    // The remote job never hands out its own sub-trees.
+    const bool use_remote = remote_search_ && !(tag & kRemote);
+
     // Main thread is running.
     auto keep_running = running_.load(std::memory_order_relaxed);
+    Timer merge_timer;
+    if (use_remote && keep_running) {
+        SyncRemoteSearch();
+    }
+
+    while (keep_running) {
+        if (InputPending(tag)) {
+            // Stop all SMP workers, so the handler can change the
+            // root. Restart them if the search goes on.
+            running_.store(false, std::memory_order_release);
+            group_->WaitToJoin();
+            if (use_remote) {
+                StopRemoteSearch();
+            }
+
+            if (!HandleInput(tag)) {
+                break;
+            }
+
+            running_.store(true, std::memory_order_relaxed);
+            AddWorkers();
+        }
 
-    while (!InputPending(tag) && keep_running) {
-        auto currstate = std::make_unique<GameState>(root_state_);
-        auto result = SearchResult{};
+        PlayoutRound(root_node_.get());
 
-        PlaySimulation(*currstate, root_node_.get(), 0, result);
-        if (result.IsValid()) {
-            playouts_.fetch_add(1, std::memory_order_relaxed);
+        if ((!root_trees_.empty() || use_remote) &&
+                merge_timer.GetDurationMilliseconds() > 100) {
+            // The time control and the futile search check read the
+            // main tree, so keep it about up to date.
+            merge_timer.Clock();
+            MergeRootTrees();
+            if (use_remote) {
+                SyncRemoteSearch();
+            }
         }
 
         if ((tag & kAnalysis) &&
@@ -318,35 +967,41 @@ ComputationResult Search::Computation(int playouts, Search::OptionTag tag) {
                     analysis_timer.GetDurationMilliseconds()) {
             // Output the analysis string for GTP interface, like sabaki...
             analysis_timer.Clock();
-            if (root_node_->GetVisits() > 1) {
-                DUMPING << root_node_->ToAnalysisString(
-                                           root_state_, color, analysis_config_);
+            MergeRootTrees();
+            OutputAnalysis(root_state_.GetToMove());
+        }
+
+        if (param_->tree_memory_mib > 0 &&
+                memory_timer.GetDurationMilliseconds() > 1000) {
+            // Check the tree memory once per second. Computing the
+            // memory used needs to traverse the whole tree.
+            memory_timer.Clock();
+            if (root_node_->GetTreeMemoryUsed() > GetTreeMemoryLimit()) {
+                // Stop all SMP workers before pruning the tree. Nobody
+                // should touch the released nodes.
+                running_.store(false, std::memory_order_release);
+                group_->WaitToJoin();
+                if (use_remote) {
+                    StopRemoteSearch();
+                }
+
+                ReduceTreeMemory();
+
+                running_.store(true, std::memory_order_relaxed);
+                AddWorkers();
             }
         }
 
         const auto elapsed = (tag & kThinking) ?
                                  timer.GetDuration() : std::numeric_limits<float>::lowest();
 
-        // TODO: Stop running when there is no alternate move.
-        if (tag & kUnreused) {
-            // We simply limit the root visits instead of unreuse the tree. It is
-            // because that limiting the root node visits is equal to unreuse tree.
-            // Notice that the visits of root node start from one. We need to
-            // reduce it.
-            keep_running &= (root_node_->GetVisits() - 1 < playouts);
-        }
-        if (param_->resign_playouts > 0 &&
-                param_->resign_playouts <=
-                    playouts_.load(std::memory_order_relaxed)) {
-            // If someone already won the game, the Q value was not very effective
-            // in the MCTS. Low playouts with policy network is good enough. Just
-            // simply stop the tree search.
-            float wl = root_node_->GetWL(color, false);
-            keep_running &= !(wl < param_->resign_threshold ||
-                                wl > (1.f-param_->resign_threshold));
-        }
-        keep_running &= (elapsed < thinking_time);
-        keep_running &= (playouts_.load(std::memory_order_relaxed) < playouts);
+        if (use_dynamic_time) {
+            // The root statistics are running, so check them after
+            // every round.
+            thinking_time = AdjustThinkingTime(dynamic_time, elapsed);
+        }
+
+        keep_running &= KeepSearching(playouts, tag, elapsed, thinking_time);
         keep_running &= running_.load(std::memory_order_relaxed);
     };
 
@@ -354,6 +1009,23 @@ ComputationResult Search::Computation(int playouts, Search::OptionTag tag) {
 
     // Wait for all threads to join the main thread.
     group_->WaitToJoin();
+    MergeRootTrees();
+    if (use_remote) {
+        StopRemoteSearch();
+    }
+
+    if (tag & kPonder) {
+        // Check the replies at the next search.
+        last_ponder_.valid = true;
+        last_ponder_.hash = root_state_.GetHash();
+        last_ponder_.move_number = root_state_.GetMoveNumber();
+        last_ponder_.seconds = timer.GetDuration();
+        last_ponder_.replies.clear();
+        for (const auto &f : ponder_focus_) {
+            last_ponder_.replies.emplace_back(f.first);
+        }
+        ponder_focus_.clear();
+    }
 
     const auto played_playouts =
                    playouts_.load(std::memory_order_relaxed);
@@ -365,17 +1037,17 @@ ComputationResult Search::Computation(int playouts, Search::OptionTag tag) {
         // Output the last analysis verbose because the MCTS may
         // be finished in the short time. It can help the low playouts
         // MCTS to show current analysis graph in GUI.
-        if (root_node_->GetVisits() > 1) {
-            DUMPING << root_node_->ToAnalysisString(
-                           root_state_, color, analysis_config_);
-        }
+        OutputAnalysis(root_state_.GetToMove());
     }
 
     if (param_->analysis_verbose) {
-        LOGGING << root_node_->ToVerboseString(root_state_, color);
+        LOGGING << root_node_->ToVerboseString(root_state_, root_state_.GetToMove());
         LOGGING << " * Time Status:\n";
         LOGGING << "  " << time_control_.ToString();
         LOGGING << "  spent: " << timer.GetDuration() << "(sec)\n";
+        if (use_dynamic_time) {
+            LOGGING << "  planned: " << dynamic_time.nominal << "(sec)\n";
+        }
         LOGGING << "  speed: " << (float)played_playouts /
                                       timer.GetDuration() << "(p/sec)\n";
         LOGGING << "  playouts: " << played_playouts << "\n";
@@ -384,9 +1056,12 @@ ComputationResult Search::Computation(int playouts, Search::OptionTag tag) {
     // Record perfomance infomation.
     computation_result.seconds = timer.GetDuration();
     computation_result.playouts = played_playouts;
+    Metrics::SetSearch(played_playouts, computation_result.seconds,
+                           root_node_->GetTreeMemoryUsed());
 
     // Gather computation infomation and training data.
     GatherComputationResult(computation_result);
+    ReleaseRootTrees();
 
     // Save the last game state.
     last_state_ = root_state_;
@@ -405,6 +1080,154 @@ ComputationResult Search::Computation(int playouts, Search::OptionTag tag) {
     return computation_result;
 }
 
+float Search::AdjustThinkingTime(DynamicTime &dtime, const float elapsed) const {
+    // The thinking time is between the quarter of the nominal time and
+    // the max time.
+    constexpr float kMinFactor = 0.25f;
+    constexpr int kMinVisits = 100;
+
+    // The complexity, ten times of the root value deviation, which
+    // needs the nominal time.
+    constexpr float kNormalComplexity = 1.f;
+
+    // The running statistics of the root. The best move is the most
+    // visited move here.
+    const auto stats = root_stats_.Get();
+    if (stats.best_move != dtime.best_move) {
+        dtime.best_move = stats.best_move;
+        dtime.best_since = elapsed;
+    }
+    if (stats.visits < kMinVisits || elapsed <= 0.f) {
+        return dtime.nominal;
+    }
+
+    auto factor = 1.f;
+
+    // The KL divergence between the visits and the best move. It is
+    // about 0.1 if the best move has 90% visits, and 0.7 for 50%.
+    const auto kl = stats.kl_divergence;
+    if (kl >= 0.f) {
+        factor *= std::min(std::max(0.5f + kl, 0.5f), 1.5f);
+    }
+
+    // The part of the elapsed time which the best move is not changed.
+    const auto stability = (elapsed - dtime.best_since) / elapsed;
+    factor *= 1.3f - 0.6f * stability;
+
+    const auto complexity = root_node_->ComputeTreeComplexity();
+    factor *= std::min(std::max(complexity / kNormalComplexity, 0.75f), 1.25f);
+
+    const auto thinking_time = std::min(
+                                   std::max(factor * dtime.nominal,
+                                                kMinFactor * dtime.nominal),
+                                   dtime.max_time);
+
+    // The best move is the most visited move and the others can not
+    // catch up with it, even if all remaining playouts go to them.
+    // The final move is chosen by the LCB, so check it only then.
+    const auto speed = playouts_.load(std::memory_order_relaxed) / elapsed;
+    const auto remaining_playouts = speed * std::max(thinking_time - elapsed, 0.f);
+    if (stats.best_visits - stats.second_visits > remaining_playouts &&
+            root_node_->GetBestMove() == stats.best_move) {
+        return elapsed;
+    }
+    return thinking_time;
+}
+
+void Search::InitComputationResult(ComputationResult &result) const {
+    result.to_move = static_cast<VertexType>(root_state_.GetToMove());
+    result.board_size = root_state_.GetBoardSize();
+    result.komi = root_state_.GetKomi();
+    result.movenum = root_state_.GetMoveNumber();
+    result.playouts = 0;
+    result.seconds = 0.f;
+    result.threads = param_->threads;
+    result.batch_size = param_->batch_size;
+}
+
+bool Search::KeepSearching(const int playouts, Search::OptionTag tag,
+                           const float elapsed, const float thinking_time) const {
+    bool keep_running = true;
+
+    // TODO: Stop running when there is no alternate move.
+    if (tag & kUnreused) {
+        // We simply limit the root visits instead of unreuse the tree. It is
+        // because that limiting the root node visits is equal to unreuse tree.
+        // Notice that the visits of root node start from one. We need to
+        // reduce it.
+        keep_running &= (root_node_->GetVisits() - 1 < playouts);
+    }
+    if (param_->resign_playouts > 0 &&
+            param_->resign_playouts <=
+                playouts_.load(std::memory_order_relaxed)) {
+        // If someone already won the game, the Q value was not very effective
+        // in the MCTS. Low playouts with policy network is good enough. Just
+        // simply stop the tree search.
+        float wl = root_node_->GetWL(root_state_.GetToMove(), false);
+        keep_running &= !(wl < param_->resign_threshold ||
+                            wl > (1.f-param_->resign_threshold));
+    }
+    keep_running &= (elapsed < thinking_time);
+    keep_running &= (playouts_.load(std::memory_order_relaxed) < playouts);
+
+    if (keep_running &&
+            param_->futile_search_stop &&
+            !param_->gumbel &&
+            !(tag & (kPonder | kAnalysis | kRemote))) {
+        // The pondering, the analysis and the remote job want the whole
+        // tree. The sequential halving of Gumbel needs all playouts.
+        keep_running &= !IsSearchFutile(playouts, tag, elapsed, thinking_time);
+    }
+    return keep_running;
+}
+
+bool Search::IsSearchFutile(const int playouts, Search::OptionTag tag,
+                            const float elapsed, const float thinking_time) const {
+    const auto played = playouts_.load(std::memory_order_relaxed);
+    auto remaining = (float)(playouts - played);
+    if (tag & kUnreused) {
+        remaining = std::min(remaining,
+                                 (float)(playouts - (root_node_->GetVisits() - 1)));
+    }
+    if (elapsed > 0.f && played > 0) {
+        // Estimate the playouts of the remaining time by the
+        // current speed.
+        const auto speed = played / elapsed;
+        remaining = std::min(remaining, speed * (thinking_time - elapsed));
+    }
+    if (remaining >= root_node_->GetVisits()) {
+        // No gap can be so large. Skip the children traversal.
+        return false;
+    }
+
+    int most_visits = 0;
+    int second_visits = 0;
+    int most_move = kNullVertex;
+    for (const auto &child : root_node_->GetChildren()) {
+        const auto node = child.Get();
+        if (!node || !node->IsActive()) {
+            continue;
+        }
+        const auto visits = node->GetVisits();
+        if (visits > most_visits) {
+            second_visits = most_visits;
+            most_visits = visits;
+            most_move = node->GetVertex();
+        } else if (visits > second_visits) {
+            second_visits = visits;
+        }
+    }
+    if (most_visits - second_visits <= remaining) {
+        return false;
+    }
+
+    // The final move is chosen by the LCB. Stop only if the LCB agrees
+    // with the visits, otherwise the remaining playouts may still
+    // change the choice.
+    const auto lcblist = root_node_->GetLcbUtilityList(root_state_.GetToMove());
+    return !lcblist.empty() && lcblist[0].second == most_move;
+}
+
 void Search::GatherComputationResult(ComputationResult &result) const {
     const auto color = root_state_.GetToMove();
     const auto num_intersections = root_state_.GetNumIntersections();
@@ -415,7 +1238,9 @@ void Search::GatherComputationResult(ComputationResult &result) const {
     result.random_move = root_node_->
                              RandomizeFirstProportionally(
                                  1, param_->random_min_visits);
-    result.gumbel_move = root_node_->GetGumbelMove();
+    result.gumbel_move = halving_.HasResult() ?
+                             halving_.GetBestMove(root_node_.get()) :
+                             root_node_->GetGumbelMove();
     result.root_final_score = root_node_->GetFinalScore(color);
     result.root_eval = root_node_->GetWL(color, false);
     {
@@ -431,6 +1256,7 @@ void Search::GatherComputationResult(ComputationResult &result) const {
     result.root_ownership.resize(num_intersections);
     result.root_playouts_dist.resize(num_intersections+1);
     result.root_visits.resize(num_intersections+1);
+    result.root_evals.resize(num_intersections+1);
     result.target_playouts_dist.resize(num_intersections+1);
 
     // Fill ownership.
@@ -447,9 +1273,12 @@ void Search::GatherComputationResult(ComputationResult &result) const {
         const auto visits = node->GetVisits();
         const auto vertex = node->GetVertex();
 
+        const auto eval = visits > 0 ? node->GetWL(color, false) : 0.f;
+
         parentvisits += visits;
         if (vertex == kPass) {
             result.root_visits[num_intersections] = visits;
+            result.root_evals[num_intersections] = eval;
             continue;
         }
 
@@ -458,6 +1287,7 @@ void Search::GatherComputationResult(ComputationResult &result) const {
         const auto index = root_state_.GetIndex(x, y);
 
         result.root_visits[index] = visits;
+        result.root_evals[index] = eval;
     }
 
     // Fill raw probabilities.
@@ -527,6 +1357,7 @@ void Search::GatherComputationResult(ComputationResult &result) const {
 
     auto alive = std::vector<std::vector<int>>{};
     auto dead = std::vector<std::vector<int>>{};
+    auto black_ownership = std::vector<float>(num_intersections);
 
     for (int idx = 0; idx < num_intersections; ++idx) {
         const auto x = idx % board_size;
@@ -538,7 +1369,13 @@ void Search::GatherComputationResult(ComputationResult &result) const {
         const auto owner = safe_area[idx] == true ?
                                2 * (float)(safe_ownership[idx] == color) - 1 : result.root_ownership[idx];
         const auto state = root_state_.GetState(vtx);
+        black_ownership[idx] = color == kBlack ? owner : -owner;
+
 
+        if ((state == kBlack || state == kWhite) &&
+                std::abs(owner) <= kOwnshipThreshold) {
+            result.uncertain_stones += 1;
+        }
 
         if (owner > kOwnshipThreshold) {
             // It is my territory.
@@ -557,6 +1394,32 @@ void Search::GatherComputationResult(ComputationResult &result) const {
         }
     }
 
+    if (param_->dead_stone_playouts > 0) {
+        // The network can not decide some strings. Play the random
+        // playouts for them, then every string is alive or dead.
+        const auto dead_list = root_state_.MarKDeadStrings(
+                                   param_->dead_stone_playouts, black_ownership, kOwnshipThreshold);
+        auto is_dead = std::vector<bool>(num_intersections, false);
+        for (const auto vtx : dead_list) {
+            is_dead[root_state_.GetIndex(root_state_.GetX(vtx), root_state_.GetY(vtx))] = true;
+        }
+
+        alive.clear();
+        dead.clear();
+        for (int idx = 0; idx < num_intersections; ++idx) {
+            const auto vtx = root_state_.GetVertex(idx % board_size, idx / board_size);
+            const auto state = root_state_.GetState(vtx);
+            if (state != kBlack && state != kWhite) {
+                continue;
+            }
+            if (is_dead[idx]) {
+                dead.emplace_back(root_state_.GetStringList(vtx));
+            } else {
+                alive.emplace_back(root_state_.GetStringList(vtx));
+            }
+        }
+    }
+
     // Remove multiple mentions of the same string
     // unique reorders and returns new iterator, erase actually deletes
     std::sort(std::begin(alive), std::end(alive));
@@ -684,14 +1547,29 @@ int Search::ThinkBestMove() {
 }
 
 int Search::GetSelfPlayMove() {
+    bool fast_search = false;
+    const auto playouts = GetSelfPlayPlayouts(fast_search);
+
     auto tag = param_->reuse_tree ? kThinking : (kThinking | kUnreused);
+    if (fast_search) {
+        // The fast search always reuses the tree and has no noise.
+        tag = kThinking | kNoNoise;
+    }
+    auto result = Computation(playouts, tag);
+    result.fast_search = fast_search;
+    return SelectSelfPlayMove(result);
+}
 
+int Search::GetSelfPlayPlayouts(bool &fast_search) {
     int playouts = max_playouts_;
     int reduce_playouts = param_->reduce_playouts;
     float prob = param_->reduce_playouts_prob;
+
+    fast_search = false;
     if (reduce_playouts > 0 &&
             reduce_playouts < max_playouts_ &&
             Random<>::Get().Roulette<10000>(prob)) {
+        fast_search = param_->playout_cap_randomization;
 
         const auto diff = max_playouts_ - reduce_playouts;
         auto geometric = std::geometric_distribution<>(
@@ -714,8 +1592,10 @@ int Search::GetSelfPlayMove() {
     // There is at least one playout for the self-play move
     // because some move select functions need at least one.
     playouts = std::max(1, playouts);
+    return playouts;
+}
 
-    auto result = Computation(playouts, tag);
+int Search::SelectSelfPlayMove(ComputationResult &result) {
     int move = result.best_move;
     int random_moves_cnt = param_->random_moves_factor *
                                result.board_size * result.board_size;
@@ -727,8 +1607,8 @@ int Search::GetSelfPlayMove() {
     }
 
     // The Gumbel-Top-k trick holds more information, so we use it instead
-    // of random move.
-    if (root_node_->ShouldApplyGumbel()) {
+    // of random move. The fast search does not use Gumbel.
+    if (!result.fast_search && root_node_->ShouldApplyGumbel()) {
         move = result.gumbel_move;
     }
 
@@ -751,12 +1631,278 @@ int Search::GetSelfPlayMove() {
     return move;
 }
 
+bool Search::BeginSelfPlayMove() {
+    step_.playouts = GetSelfPlayPlayouts(step_.fast_search);
+    return BeginSteppedMove();
+}
+
+bool Search::BeginMatchMove() {
+    step_.playouts = std::max(1, std::min(max_playouts_, kMaxPlayouts));
+    step_.fast_search = false;
+    return BeginSteppedMove();
+}
+
+bool Search::BeginSteppedMove() {
+    step_.tag = param_->reuse_tree ? kThinking : (kThinking | kUnreused);
+    if (step_.fast_search) {
+        step_.tag = kThinking;
+    }
+    step_.searched = false;
+    step_.result = ComputationResult{};
+    InitComputationResult(step_.result);
+
+    if (root_state_.IsGameOver()) {
+        step_.result.best_move = kPass;
+        return false;
+    }
+
+    auto book_move = kNullVertex;
+    if (Book::Get().Probe(root_state_, book_move)) {
+        step_.result.best_move = book_move;
+        return false;
+    }
+
+    const auto color = root_state_.GetToMove();
+    time_control_.SetLagBuffer(param_->lag_buffer);
+    time_control_.Clock();
+    step_.timer.Clock();
+    step_.memory_timer.Clock();
+
+    const float bound_time = (param_->const_time > 0 &&
+                                 time_control_.IsInfiniteTime(color)) ?
+                                     param_->const_time : std::numeric_limits<float>::max();
+    step_.thinking_time = std::min(
+                              bound_time,
+                              time_control_.GetThinkingTime(
+                                  color, root_state_.GetBoardSize(), root_state_.GetMoveNumber()));
+
+    step_.gumbel = param_->gumbel;
+    step_.dirichlet_noise = param_->dirichlet_noise;
+    if (step_.fast_search) {
+        param_->gumbel = param_->dirichlet_noise = false;
+    }
+    PrepareRootNode();
+    BeginSequentialHalving(step_.playouts, step_.tag);
+    step_.searched = true;
+
+    if (step_.thinking_time < step_.timer.GetDuration()) {
+        running_.store(false, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void Search::SubmitSelfPlayStep() {
+    if (!running_.load(std::memory_order_relaxed) || param_->no_dcnn) {
+        return;
+    }
+    const auto leaves = halving_.IsActive() ?
+                            halving_.GetRemaining() : param_->async_leaves;
+    SubmitAsyncPlayouts(root_node_.get(), step_.pending, step_.states, std::max(1, leaves));
+}
+
+bool Search::CollectSelfPlayStep() {
+    return CollectStep();
+}
+
+bool Search::CollectStep() {
+    if (!running_.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    if (param_->no_dcnn) {
+        // The rollouts do not wait for the network.
+        PlayoutRound(root_node_.get());
+    } else {
+        CollectAsyncPlayouts(step_.pending);
+        if (halving_.IsActive() && halving_.GetRemaining() == 0) {
+            halving_.NextPhase(root_node_.get());
+        }
+    }
+
+    if (param_->tree_memory_mib > 0 &&
+            step_.memory_timer.GetDurationMilliseconds() > 1000) {
+        // Only this thread touches the tree, so prune it directly.
+        step_.memory_timer.Clock();
+        if (root_node_->GetTreeMemoryUsed() > GetTreeMemoryLimit()) {
+            ReduceTreeMemory();
+        }
+    }
+
+    if (!KeepSearching(step_.playouts, step_.tag,
+                           step_.timer.GetDuration(), step_.thinking_time)) {
+        running_.store(false, std::memory_order_relaxed);
+    }
+    return running_.load(std::memory_order_relaxed);
+}
+
+int Search::EndSelfPlayMove() {
+    EndSteppedMove();
+    return SelectSelfPlayMove(step_.result);
+}
+
+int Search::EndMatchMove() {
+    EndSteppedMove();
+    if (!step_.searched) {
+        // The book move or the end of the game.
+        return step_.result.best_move;
+    }
+    if (ShouldResign(root_state_, step_.result, param_->resign_threshold)) {
+        return kResign;
+    }
+    if (ShouldPass(root_state_, step_.result, param_->friendly_pass)) {
+        return kPass;
+    }
+    return step_.result.best_move;
+}
+
+void Search::EndSteppedMove() {
+    if (step_.searched) {
+        running_.store(false, std::memory_order_relaxed);
+
+        // Wait for releasing the old trees.
+        group_->WaitToJoin();
+        time_control_.TookTime(root_state_.GetToMove());
+
+        step_.result.seconds = step_.timer.GetDuration();
+        step_.result.playouts = playouts_.load(std::memory_order_relaxed);
+        step_.result.fast_search = step_.fast_search;
+        GatherComputationResult(step_.result);
+        last_state_ = root_state_;
+
+        param_->gumbel = step_.gumbel;
+        param_->dirichlet_noise = step_.dirichlet_noise;
+    }
+}
+
+bool Search::BeginAnalysisSteps(int playouts, int multi_pv) {
+    analysis_config_.multi_pv = multi_pv;
+    step_.tag = kUnreused;
+    step_.playouts = std::max(1, std::min(playouts, kMaxPlayouts));
+    step_.searched = false;
+    step_.result = ComputationResult{};
+    InitComputationResult(step_.result);
+
+    if (root_state_.IsGameOver()) {
+        step_.result.best_move = kPass;
+        return false;
+    }
+
+    step_.timer.Clock();
+    step_.memory_timer.Clock();
+    step_.thinking_time = std::numeric_limits<float>::max();
+
+    // Every request is the new position.
+    ReleaseTree();
+    PrepareRootNode();
+    step_.searched = true;
+    return true;
+}
+
+void Search::SubmitAnalysisStep(int weight) {
+    if (!running_.load(std::memory_order_relaxed) || param_->no_dcnn) {
+        return;
+    }
+    SubmitAsyncPlayouts(root_node_.get(), step_.pending, step_.states,
+                            std::max(1, param_->async_leaves) * std::max(1, weight));
+}
+
+bool Search::CollectAnalysisStep() {
+    return CollectStep();
+}
+
+ComputationResult Search::EndAnalysisSteps() {
+    if (step_.searched) {
+        running_.store(false, std::memory_order_relaxed);
+        group_->WaitToJoin();
+
+        step_.result.seconds = step_.timer.GetDuration();
+        step_.result.playouts = playouts_.load(std::memory_order_relaxed);
+        GatherComputationResult(step_.result);
+    }
+    return step_.result;
+}
+
+std::string Search::GetAnalysisJson(int max_moves) {
+    if (!step_.searched || !root_node_) {
+        return "[]";
+    }
+    return root_node_->ToAnalysisJson(
+               root_state_, root_state_.GetToMove(), max_moves);
+}
+
+std::string Search::GetOwnershipJson() {
+    if (!step_.searched || !root_node_) {
+        return "[]";
+    }
+    return root_node_->OwnershipToJson(root_state_, root_state_.GetToMove());
+}
+
 void Search::TryPonder() {
     if (param_->ponder) {
         Computation(GetPonderPlayouts(), kPonder);
     }
 }
 
+void Search::SetInputHooks(InputHook pending, InputHook handler) {
+    input_pending_ = pending;
+    input_handler_ = handler;
+}
+
+bool Search::HandleInput(OptionTag tag) {
+    if (!(tag & (kPonder | kRemote)) || !input_handler_) {
+        return false;
+    }
+    return input_handler_();
+}
+
+bool Search::PlayWhilePondering(const int vertex, const int color) {
+    if (!root_node_ || halving_.IsActive()) {
+        return false;
+    }
+
+    // The tree is the one of current root state.
+    last_state_ = root_state_;
+    if (!root_state_.PlayMove(vertex, color)) {
+        return false;
+    }
+
+    // Reuse the sub-tree of the move like a new search. The focused
+    // replies are for the old root.
+    PrepareRootNode();
+    PrepareRootTrees();
+    ponder_focus_.clear();
+    analysis_output_ = false;
+    return true;
+}
+
+bool Search::ContinueAnalysis(AnalysisConfig &analysis_config) {
+    if (!analysis_ponder_ ||
+            analysis_config_.interval <= 0 ||
+            analysis_config.interval <= 0 ||
+            analysis_config_.MoveRestrictions() ||
+            analysis_config.MoveRestrictions()) {
+        // The tags or the legal moves of the search are changed.
+        return false;
+    }
+    analysis_config_ = analysis_config;
+    analysis_output_ = true;
+    return true;
+}
+
+void Search::OutputAnalysis(const int color) {
+    if (!analysis_output_ || root_node_->GetVisits() <= 1) {
+        return;
+    }
+    if (analysis_config_.binary) {
+        root_node_->ToAnalysisBinary(
+            root_state_, color, analysis_config_, analysis_buffer_);
+    } else {
+        root_node_->ToAnalysisString(
+            root_state_, color, analysis_config_, analysis_buffer_);
+    }
+    DUMPING << analysis_buffer_.Get();
+}
+
 int Search::Analyze(bool ponder, AnalysisConfig &analysis_config) {
     // Do not dump the analysis string if we do not
     // send the interval value.
@@ -770,10 +1916,13 @@ int Search::Analyze(bool ponder, AnalysisConfig &analysis_config) {
 
     // Set the current analysis config.
     analysis_config_ = analysis_config;
+    analysis_ponder_ = ponder;
+    analysis_output_ = true;
 
     int playouts = ponder == true ? GetPonderPlayouts()
                                       : max_playouts_;
     auto result = Computation(playouts, tag);
+    analysis_ponder_ = false;
 
     // Disable the reusing the tree.
     if (analysis_config_.MoveRestrictions()) {
@@ -797,6 +1946,14 @@ void Search::ClearTrainingBuffer() {
     training_buffer_.clear();
 }
 
+ResignAnalysis Search::GetResignAnalysis() const {
+    return resign_analysis_;
+}
+
+void Search::SetResignThreshold(float threshold) {
+    param_->resign_threshold = threshold;
+}
+
 void Search::SaveTrainingBuffer(std::string filename, GameState &end_state) {
     auto file = std::ofstream{};
     file.open(filename, std::ios_base::app);
@@ -867,6 +2024,30 @@ void Search::GatherTrainingBuffer(std::vector<Training> &chunk, GameState &end_s
         }
     }
 
+    // Replay the root evals with the resign threshold.
+    resign_analysis_ = ResignAnalysis{};
+    resign_analysis_.num_moves = training_buffer_.size();
+    resign_analysis_.draw = winner == kDraw;
+
+    for (int i = 0; i < (int)training_buffer_.size(); ++i) {
+        const auto &buf = training_buffer_[i];
+        const float wl = (buf.q_value + 1.f) / 2.f;
+
+        if (winner != kDraw) {
+            const float winner_wl = buf.result == 1 ? wl : 1.f - wl;
+            resign_analysis_.winner_min_eval =
+                std::min(resign_analysis_.winner_min_eval, winner_wl);
+        }
+        if (resign_analysis_.decided_move < 0 &&
+                (wl < param_->resign_threshold ||
+                     wl > 1.f - param_->resign_threshold)) {
+            const bool to_move_lost = wl < param_->resign_threshold;
+            resign_analysis_.decided_move = i;
+            resign_analysis_.false_positive =
+                winner != kDraw && (buf.result == 1) == to_move_lost;
+        }
+    }
+
     // Set the auxiliary probablility in the buffer.
     auto aux_prob = std::vector<float>(num_intersections+1, 0);
 
@@ -884,7 +2065,11 @@ void Search::GatherTrainingBuffer(std::vector<Training> &chunk, GameState &end_s
     }
 
     // output the the data.
+    const auto write_symmetry = GetOption<bool>("write_symmetry");
     for (auto &buf : training_buffer_) {
+        if (write_symmetry) {
+            buf.ApplySymmetry(Random<>::Get().RandFix<Symmetry::kNumSymmetris>());
+        }
         chunk.emplace_back(buf);
     }
 
@@ -900,7 +2085,8 @@ void Search::GatherData(const GameState &state, ComputationResult &result) {
 
     auto data = Training{};
     data.version = GetTrainingVersion();
-    data.mode = GetTrainingMode();
+    data.mode = result.fast_search ?
+                    Training::kFastSearchMode : GetTrainingMode();
 
     data.board_size = result.board_size;
     data.komi = result.komi;
@@ -910,6 +2096,12 @@ void Search::GatherData(const GameState &state, ComputationResult &result) {
     data.q_value = 2 * result.root_eval - 1.f;
     data.planes = Encoder::Get().GetPlanes(state);
     data.probabilities = result.target_playouts_dist;
+    if (result.fast_search) {
+        // The visits of the fast search are too few for the policy
+        // target. The zero target has no policy loss.
+        std::fill(std::begin(data.probabilities),
+                      std::end(data.probabilities), 0.f);
+    }
 
     training_buffer_.emplace_back(data);
 }
@@ -952,12 +2144,10 @@ bool Search::AdvanceToNewRootState() {
         int vtx = move_list.top();
 
         auto next_node = root_node_->PopChild(vtx);
-        auto p = root_node_.release();
 
-        // Lazy tree destruction. May save a little of time when
-        // dealing with large trees. We will collect these future
-        // resuls after the search finished.
-        group_->AddTask([p](){ delete p; });
+        // Lazy tree destruction. The collector deletes the siblings
+        // in the background, so the next search starts at once.
+        TreeCollector::Get().Collect(root_node_.release());
 
         if (next_node) {
             root_node_.reset(next_node);
@@ -981,6 +2171,333 @@ bool Search::AdvanceToNewRootState() {
     return true;
 }
 
+std::string Search::BenchmarkSelection(int playouts, int iterations) {
+    // Build a fresh tree with the compact statistics so that both
+    // layouts can be measured on the same nodes.
+    const auto compact = param_->compact_child_stats;
+    param_->compact_child_stats = true;
+
+    ReleaseTree();
+    Computation(playouts, kNullTag);
+
+    param_->compact_child_stats = compact;
+
+    if (!root_node_ || !root_node_->HaveChildren()) {
+        return std::string{"There is no tree for benchmark."};
+    }
+
+    // Collect all expanded nodes in the tree. Scanning the whole
+    // tree is closer to the real memory access pattern than
+    // scanning a few hot nodes.
+    auto nodes = std::vector<std::pair<Node *, int>>{};
+    auto stk = std::stack<std::pair<Node *, int>>{};
+    stk.emplace(root_node_.get(), root_state_.GetToMove());
+
+    while (!stk.empty()) {
+        const auto p = stk.top();
+        stk.pop();
+        nodes.emplace_back(p);
+
+        const auto opp_color = p.second == kBlack ? kWhite : kBlack;
+        for (const auto &child : p.first->GetChildren()) {
+            const auto node = child.Get();
+            if (node && node->IsExpanded() && node->HaveChildren()) {
+                stk.emplace(node, opp_color);
+            }
+        }
+    }
+
+    // The compact statistics mirror the nodes after many updates. They
+    // should be exactly equal.
+    int mismatched_stats = 0;
+    for (const auto &p : nodes) {
+        mismatched_stats += p.first->CountMismatchedChildStats();
+    }
+
+    const auto RunSelection = [&](bool use_compact, bool use_scalar,
+                                      std::vector<Node *> &selected) -> double {
+        param_->compact_child_stats = use_compact;
+        param_->scalar_puct_kernel = use_scalar;
+        selected.clear();
+
+        Timer timer;
+        for (int i = 0; i < iterations; ++i) {
+            for (const auto &p : nodes) {
+                auto next = p.first->PuctSelectChild(p.second, false);
+                if (i == 0) {
+                    selected.emplace_back(next);
+                }
+            }
+        }
+        const auto elapsed = timer.GetDurationMicroseconds();
+        param_->compact_child_stats = compact;
+        param_->scalar_puct_kernel = false;
+
+        return 1000.0 * elapsed / (static_cast<double>(iterations) * nodes.size());
+    };
+
+    auto legacy_selected = std::vector<Node *>{};
+    auto scalar_selected = std::vector<Node *>{};
+    auto kernel_selected = std::vector<Node *>{};
+    const auto legacy_ns = RunSelection(false, false, legacy_selected);
+    const auto scalar_ns = RunSelection(true, true, scalar_selected);
+    const auto kernel_ns = RunSelection(true, false, kernel_selected);
+
+    const auto CountMismatched = [](const std::vector<Node *> &a,
+                                        const std::vector<Node *> &b) {
+        int mismatched = 0;
+        for (int i = 0; i < (int)a.size(); ++i) {
+            if (a[i] != b[i]) {
+                mismatched += 1;
+            }
+        }
+        return mismatched;
+    };
+
+    auto out = std::ostringstream{};
+    out << Format("Measure %zu nodes with %d iterations.\n", nodes.size(), iterations)
+            << Format("Node layout: %.1f ns per selection.\n", legacy_ns)
+            << Format("Compact layout (scalar): %.1f ns per selection.\n", scalar_ns)
+            << Format("Compact layout (%s): %.1f ns per selection.\n",
+                          PuctKernel::GetName().c_str(), kernel_ns)
+            << Format("Different Q values between node and compact: %d.\n",
+                          mismatched_stats)
+            << Format("Different selections between node and compact: %d.\n",
+                          CountMismatched(legacy_selected, scalar_selected))
+            << Format("Different selections between scalar and %s: %d.",
+                          PuctKernel::GetName().c_str(),
+                          CountMismatched(scalar_selected, kernel_selected));
+    return out.str();
+}
+
+std::string Search::BenchmarkUpdate(int threads, int updates) {
+    // The old accumulators. Every add is a compare-exchange loop.
+    struct FloatingAccumulators {
+        std::atomic<int> visits{0};
+        std::atomic<double> squared_eval_diff{1e-4f};
+        std::atomic<double> black_fs{0.0};
+        std::atomic<double> black_wl{0.0};
+        std::atomic<double> draw{0.0};
+    };
+
+    const auto MakeEvals = [](int i) {
+        NodeEvals evals;
+        evals.black_wl = static_cast<float>(i % 101) / 100.f;
+        evals.draw = static_cast<float>(i % 7) / 70.f;
+        evals.black_final_score = static_cast<float>(i % 61) - 30.f;
+        return evals;
+    };
+
+    const auto RunThreads = [&](std::function<void(int)> func) -> double {
+        auto workers = std::vector<std::thread>{};
+        Timer timer;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&func, t]() { func(t); });
+        }
+        for (auto &w : workers) {
+            w.join();
+        }
+        const auto elapsed = timer.GetDurationMicroseconds();
+        return 1000.0 * elapsed / (static_cast<double>(threads) * updates);
+    };
+
+    FloatingAccumulators floating;
+    const auto floating_ns = RunThreads([&](int t) {
+        for (int i = 0; i < updates; ++i) {
+            const auto evals = MakeEvals(t * updates + i);
+            const double eval = evals.black_wl;
+            const double old_acc_eval = floating.black_wl.load(std::memory_order_relaxed);
+            const int old_visits = floating.visits.load(std::memory_order_relaxed);
+            const double old_delta = old_visits > 0 ? eval - old_acc_eval / old_visits : 0.0f;
+            const double new_delta = eval - (old_acc_eval + eval) / (old_visits+1);
+
+            floating.visits.fetch_add(1, std::memory_order_relaxed);
+            AtomicFetchAdd(floating.squared_eval_diff, old_delta * new_delta);
+            AtomicFetchAdd(floating.black_wl, eval);
+            AtomicFetchAdd(floating.draw, static_cast<double>(evals.draw));
+            AtomicFetchAdd(floating.black_fs, static_cast<double>(evals.black_final_score));
+        }
+    });
+
+    auto node = std::make_unique<Node>(kPass, 1.0f);
+    const auto fixed_ns = RunThreads([&](int t) {
+        for (int i = 0; i < updates; ++i) {
+            const auto evals = MakeEvals(t * updates + i);
+            node->Update(&evals);
+        }
+    });
+
+    const auto visits = floating.visits.load();
+    const auto floating_wl =
+        floating.black_wl.load() / visits;
+    const auto floating_score =
+        floating.black_fs.load() / visits;
+
+    auto out = std::ostringstream{};
+    out << Format("Measure %d threads with %d updates per thread.\n", threads, updates)
+            << Format("Floating-point accumulators: %.1f ns per update.\n", floating_ns)
+            << Format("Fixed-point accumulators: %.1f ns per update.\n", fixed_ns)
+            << Format("Win-loss difference: %.3e.\n",
+                          std::abs(floating_wl - node->GetWL(kBlack, false)))
+            << Format("Final score difference: %.3e.",
+                          std::abs(floating_score - node->GetFinalScore(kBlack)));
+    return out.str();
+}
+
+void Search::SetPonderFocus() {
+    ponder_focus_.clear();
+
+    if (param_->ponder_replies <= 0 ||
+            !root_node_->HaveChildren() ||
+            param_->gumbel ||
+            param_->dirichlet_noise) {
+        // The tree is not reused after the noise or Gumbel, so
+        // focusing does not help.
+        return;
+    }
+
+    // The best replies by the reused visits, then by the policy.
+    auto candidates = std::vector<std::tuple<int, float, int>>{};
+    for (const auto &child : root_node_->GetChildren()) {
+        int visits = 0;
+        if (child.IsPointer()) {
+            const auto node = child.Get();
+            if (!node->IsActive()) {
+                continue;
+            }
+            visits = node->GetVisits();
+        }
+        candidates.emplace_back(visits, child.GetPolicy(), child.GetVertex());
+    }
+    std::sort(std::rbegin(candidates), std::rend(candidates));
+
+    const auto size = std::min(candidates.size(), (size_t)param_->ponder_replies);
+    auto policy_sum = 0.f;
+    for (auto i = size_t{0}; i < size; ++i) {
+        policy_sum += std::get<1>(candidates[i]);
+    }
+    for (auto i = size_t{0}; i < size; ++i) {
+        const auto share = policy_sum > 0.f ?
+                               std::get<1>(candidates[i]) / policy_sum : 1.f / size;
+        ponder_focus_.emplace_back(std::get<2>(candidates[i]),
+                                       std::max(share, 1e-3f));
+    }
+
+    if (param_->analysis_verbose) {
+        auto out = std::ostringstream{};
+        for (const auto &f : ponder_focus_) {
+            out << Format(" %s(%.2f)", root_state_.VertexToText(f.first).c_str(), f.second);
+        }
+        LOGGING << "Ponder on the replies:" << out.str() << '\n';
+    }
+}
+
+Node *Search::SelectPonderReply() {
+    Node *best = nullptr;
+    auto best_load = std::numeric_limits<float>::max();
+
+    for (const auto &f : ponder_focus_) {
+        const auto node = root_node_->GetChild(f.first);
+        if (!node || !node->IsActive()) {
+            continue;
+        }
+        const auto load = (node->GetVisits() + node->GetRunningThreads()) / f.second;
+        if (load < best_load) {
+            best_load = load;
+            best = node;
+        }
+    }
+    return best;
+}
+
+Node *Search::SelectMultiPvReply() {
+    struct Line {
+        int vertex;
+        int visits;
+        int load;
+        float policy;
+    };
+
+    const int num_lines = analysis_config_.multi_pv;
+    const auto share = std::min(param_->multi_pv_share, 1.f / num_lines);
+    const auto min_load = share * root_node_->GetVisits();
+
+    auto lines = std::vector<Line>{};
+    for (const auto &child : root_node_->GetChildren()) {
+        const auto node = child.Get();
+        if (node && !node->IsActive()) {
+            continue;
+        }
+        const int visits = node ? node->GetVisits() : 0;
+        const int load = node ? visits + node->GetRunningThreads() : 0;
+        lines.push_back({child.GetVertex(), visits, load, child.GetPolicy()});
+    }
+
+    // The best lines are of the most visits. The policy breaks the
+    // ties before they are visited.
+    const int size = std::min(num_lines, (int)lines.size());
+    std::partial_sort(std::begin(lines), std::begin(lines) + size, std::end(lines),
+                          [](const Line &a, const Line &b) {
+                              if (a.visits != b.visits) {
+                                  return a.visits > b.visits;
+                              }
+                              return a.policy > b.policy;
+                          });
+
+    const Line *behind = nullptr;
+    for (int i = 0; i < size; ++i) {
+        if (lines[i].load < min_load &&
+                (!behind || lines[i].load < behind->load)) {
+            behind = &lines[i];
+        }
+    }
+    return behind ? root_node_->GetChild(behind->vertex) : nullptr;
+}
+
+void Search::RecordPonderHit(bool reused) {
+    if (!last_ponder_.valid) {
+        return;
+    }
+    last_ponder_.valid = false;
+
+    if (root_state_.GetMoveNumber() != last_ponder_.move_number + 1) {
+        return;
+    }
+    auto prev_state = root_state_;
+    prev_state.UndoMove();
+    if (prev_state.GetHash() != last_ponder_.hash) {
+        return;
+    }
+
+    const auto reply = root_state_.GetLastMove();
+    const auto &replies = last_ponder_.replies;
+    const auto it = std::find(std::begin(replies), std::end(replies), reply);
+    const bool hit = replies.empty() ? reused : it != std::end(replies);
+    const int reused_visits = reused ? root_node_->GetVisits() : 0;
+
+    Metrics::Add(Metrics::kPonders);
+    Metrics::Add(Metrics::kPonderReusedVisits, reused_visits);
+    if (hit) {
+        Metrics::Add(Metrics::kPonderHits);
+        Metrics::Add(Metrics::kPonderHitMilliseconds, 1000 * last_ponder_.seconds);
+    }
+
+    if (param_->analysis_verbose) {
+        auto focus = std::string{"not focused"};
+        if (replies.empty()) {
+            focus = "unfocused";
+        } else if (it != std::end(replies)) {
+            focus = Format("focused %d of %zu", int(it - std::begin(replies)) + 1, replies.size());
+        }
+        LOGGING << Format("Ponder %s after %.2f(sec), the reply %s is %s, reuse %d visits\n",
+                              hit ? "hit" : "missed",
+                              last_ponder_.seconds,
+                              root_state_.VertexToText(reply).c_str(),
+                              focus.c_str(),
+                              reused_visits);
+    }
+}
+
 int Search::GetPonderPlayouts() const {
     // We don't need to consider the NN cache size to set number
     // of ponder playouts that because we apply lazy tree destruction
@@ -990,8 +2507,8 @@ int Search::GetPonderPlayouts() const {
     // The factor means 'ponder_playouts = playouts * div_factor'.
     const int div_factor = std::max(1, param_->ponder_factor);
 
-    // TODO: We should consider tree memory limit. Avoid to use
-    //       too many system memory.
+    // The tree memory limit is handled in the search loop. The
+    // small sub-trees are pruned if the tree exceeds it.
     const int ponder_playouts_base = std::min(param_->playouts,
                                                   kMaxPlayouts/div_factor);
     const int ponder_playouts =  ponder_playouts_base * div_factor;
@@ -999,6 +2516,37 @@ int Search::GetPonderPlayouts() const {
     return ponder_playouts;
 }
 
+size_t Search::GetTreeMemoryLimit() const {
+    return static_cast<size_t>(std::max(0, param_->tree_memory_mib)) * 1024 * 1024;
+}
+
+void Search::ReduceTreeMemory() {
+    const auto limit = GetTreeMemoryLimit();
+    const auto root_visits = root_node_->GetVisits();
+    auto used = root_node_->GetTreeMemoryUsed();
+    auto released = size_t{0};
+
+    // Prune the low visits sub-trees until the memory used is less
+    // than 3/4 of limit. Keep some space to avoid pruning the tree
+    // too frequently.
+    int min_visits = 2;
+    while (used > limit / 4 * 3 && min_visits <= root_visits) {
+        released += root_node_->ReleaseSmallSubtrees(min_visits);
+        used = root_node_->GetTreeMemoryUsed();
+        min_visits *= 2;
+    }
+
+    // The pruned root children lost their visits.
+    if (param_->dynamic_time) {
+        root_stats_.Reset(root_node_.get());
+    }
+
+    if (param_->analysis_verbose) {
+        LOGGING << Format("Pruned %zu sub-trees, tree memory: %.2f(MiB)\n",
+                              released, static_cast<double>(used) / (1024.f * 1024.f));
+    }
+}
+
 int Search::GetExpandThreshold(GameState &state) const {
     const auto board_size = state.GetBoardSize();
 
@@ -1011,3 +2559,8 @@ int Search::GetExpandThreshold(GameState &state) const {
     // select the little value becuase they apply RAVE method.
     return std::max(20 + 2 * (board_size-9), 20);
 }
+
+bool Search::NeedOwnership(const int depth) const {
+    return param_->ownership_depth < 0 ||
+               depth <= param_->ownership_depth;
+}
@@ -4,6 +4,10 @@
 #include "mcts/parameters.h"
 #include "mcts/node.h"
 #include "mcts/rollout.h"
+#include "mcts/transposition.h"
+#include "mcts/sequential_halving.h"
+#include "mcts/root_stats.h"
+#include "mcts/remote_search.h"
 #include "game/game_state.h"
 #include "neural/training.h"
 #include "utils/threadpool.h"
@@ -13,7 +17,10 @@
 #include <thread>
 #include <memory>
 #include <atomic>
+#include <functional>
+#include <future>
 #include <limits>
+#include <vector>
 
 struct SearchResult {
 public:
@@ -44,7 +51,7 @@ public:
         }
 
         auto black_score = 0;
-        auto ownership = state.GetOwnership();
+        const auto &ownership = state.GetCachedOwnership();
 
         for (int idx = 0; idx < (int)ownership.size(); ++idx) {
             auto owner = ownership[idx];
@@ -93,17 +100,49 @@ struct ComputationResult {
     std::vector<float> root_ownership;
     std::vector<int> root_visits;
 
+    // The win-loss of every root child for the side to move. It is
+    // zero if the child is not visited.
+    std::vector<float> root_evals;
+
     std::vector<float> root_playouts_dist;
     std::vector<float> target_playouts_dist;
 
     std::vector<std::vector<int>> alive_strings;
     std::vector<std::vector<int>> dead_strings;
 
+    // The stones whose ownership is too weak to tell the status. The
+    // random playouts decide them if they are enabled.
+    int uncertain_stones{0};
+
     int movenum;
     int playouts;
     int threads;
     int batch_size;
     float seconds;
+
+    // The cheap search of the playout cap randomization. Its training
+    // data has no policy target.
+    bool fast_search{false};
+};
+
+// How the resign threshold would have ended the finished self-play
+// game. The self-play games are always played out, so it tells how
+// many moves the resigning would save and how often it is wrong.
+struct ResignAnalysis {
+    int num_moves{0};
+
+    // The first move whose root eval crosses the resign threshold.
+    // It is -1 if the game is never decided.
+    int decided_move{-1};
+
+    // The player who looks lost at the decided move wins the game.
+    bool false_positive{false};
+
+    bool draw{false};
+
+    // The lowest root eval of the winner in the game. The winner
+    // would resign if the threshold was above it.
+    float winner_min_eval{1.f};
 };
 
 class Search {
@@ -117,7 +156,8 @@ public:
         kAnalysis = 1 << 3, // use the analysis mode
         kForced   = 1 << 4, // remove all pass move before search
         kUnreused = 1 << 5, // don't reuse the tree
-        kNoNoise  = 1 << 6  // disable any noise
+        kNoNoise  = 1 << 6, // disable any noise
+        kRemote   = 1 << 7  // search the job of the distributed master
     };
 
     // Enable OptionTag operations.
@@ -133,18 +173,74 @@ public:
     // Compute the result by monte carlo tree search.
     ComputationResult Computation(int playouts, OptionTag tag);
 
+    // Decide the dead strings and the score at the end of the game.
+    // The ownership of the root, or of the reused tree, decides most
+    // games at once. Only if some stones are uncertain, search up to
+    // the scoring playouts.
+    ComputationResult ScoringComputation();
+
     // Get the best move.
     int ThinkBestMove();
 
     // Get the self-play move.
     int GetSelfPlayMove();
 
+    // The stepped version of GetSelfPlayMove(). One thread can search
+    // many games by turns. BeginSelfPlayMove() prepares the search and
+    // returns false if the move is decided without searching. Then call
+    // SubmitSelfPlayStep() of every game before their CollectSelfPlayStep(),
+    // so the leaves of all games fill the same network batch. It returns
+    // false when the search is finished. EndSelfPlayMove() returns the
+    // move. The search must only be stepped by one thread, and it does
+    // not use the search threads.
+    bool BeginSelfPlayMove();
+    void SubmitSelfPlayStep();
+    bool CollectSelfPlayStep();
+    int EndSelfPlayMove();
+
+    // The stepped version of ThinkBestMove(). It is stepped with
+    // SubmitSelfPlayStep() and CollectSelfPlayStep() too, but it always
+    // searches the full playouts, and it may resign. The match games
+    // use it.
+    bool BeginMatchMove();
+    int EndMatchMove();
+
+    // The stepped analysis of the position. It is stepped like the
+    // self-play search, but searches the given playouts on a new tree
+    // without the time control and the book. Every step submits the
+    // leaves times the weight, so the heavy sessions get more of the
+    // batch. GetAnalysisJson() and GetOwnershipJson() return the JSON
+    // arrays after the search is finished.
+    bool BeginAnalysisSteps(int playouts, int multi_pv = 0);
+    void SubmitAnalysisStep(int weight);
+    bool CollectAnalysisStep();
+    ComputationResult EndAnalysisSteps();
+    std::string GetAnalysisJson(int max_moves);
+    std::string GetOwnershipJson();
+
     // Will dump analysis information.
     int Analyze(bool ponder, AnalysisConfig &analysis_config);
 
     // Try to do the pondor.
     void TryPonder();
 
+    // The input hooks of the GTP loop. If they are set, the pondering
+    // asks the pending hook instead of polling stdin. When the input is
+    // pending, the workers are stopped and the handler is called on the
+    // main search thread. The pondering goes on if it returns true, so
+    // it can take the commands without stopping the search.
+    using InputHook = std::function<bool()>;
+    void SetInputHooks(InputHook pending, InputHook handler);
+
+    // Play the move on the root state in the input handler, and move
+    // the root to its sub-tree. The analysis output is paused until
+    // ContinueAnalysis(). Return false if the move is illegal.
+    bool PlayWhilePondering(const int vertex, const int color);
+
+    // Take the new analysis config in the input handler. Return false
+    // if the running search can not be continued with it.
+    bool ContinueAnalysis(AnalysisConfig &analysis_config);
+
     // Set the time control.
     void TimeSettings(const int main_time,
                       const int byo_yomi_time,
@@ -163,9 +259,53 @@ public:
     // Clear the training data in the buffer.
     void ClearTrainingBuffer();
 
+    // The resign analysis of the last gathered game.
+    ResignAnalysis GetResignAnalysis() const;
+
+    // Override the resign threshold of the option. The self-play
+    // calibrates it between the games.
+    void SetResignThreshold(float threshold);
+
     // Release the whole trees.
     void ReleaseTree();
 
+    // Clear the transposition table, e.g. for the new game.
+    void ClearTranspositionTable();
+
+    // Save the current tree with the hash of its root position, so a
+    // long analysis can be resumed later. Return false if there is no
+    // tree or the file can not be written.
+    bool SaveTree(const std::string &filename);
+
+    // Load the tree of the file if its root is the current position.
+    // The next search reuses it like the tree of the last search.
+    // Return false if the file is broken or of the other position.
+    bool LoadTree(const std::string &filename);
+
+    // Return the memory used by the current tree in bytes.
+    size_t GetTreeMemoryUsed() const;
+
+    // Return the memory breakdown of the tree, the caches and the
+    // device buffers.
+    std::string GetMemoryReport();
+
+    // Suggest the cache size and the tree size for the RAM budget,
+    // and the batch size for the VRAM budget, in MiB. The VRAM plan
+    // is skipped if its budget is zero.
+    std::string GetMemoryPlan(size_t ram_mib, size_t vram_mib);
+
+    // Return the statistics of the current root. Only call it on the
+    // main search thread, e.g. in the input hooks.
+    Node::Stats GetRootStats() const;
+
+    // Compare the PUCT selection speed between the node layout
+    // and the compact statistics layout.
+    std::string BenchmarkSelection(int playouts, int iterations);
+
+    // Compare the speed of many threads updating one node between
+    // the floating-point accumulators and the fixed-point accumulators.
+    std::string BenchmarkUpdate(int threads, int updates);
+
 private:
     // Try to reuse the sub-tree.
     bool AdvanceToNewRootState();
@@ -179,18 +319,171 @@ private:
     void PlaySimulation(GameState &currstate, Node *const node,
                         const int depth, SearchResult &search_result);
 
+    // Play one playout from the root, or several playouts with the
+    // asynchronous network evaluation if it is enabled.
+    void PlayoutRound(Node *root);
+
+    // Submit the leaves of several descents before waiting for
+    // the network, and then update all of them.
+    void PlayAsyncSimulations(Node *root, const int leaves);
+
+    struct AsyncPlayout {
+        GameState *state;
+        std::vector<std::pair<Node *, std::uint64_t>> path;
+        std::future<Network::Result> future;
+        SearchResult result;
+    };
+
+    // Descend the tree and submit the leaves. Every playout uses one of
+    // the states.
+    void SubmitAsyncPlayouts(Node *root, std::vector<AsyncPlayout> &playouts,
+                             std::vector<GameState> &states, const int leaves);
+
+    // Wait for the submitted leaves, update the paths and unmake
+    // the states.
+    void CollectAsyncPlayouts(std::vector<AsyncPlayout> &playouts);
+
+    void BackupAsyncPlayout(AsyncPlayout &playout);
+
+    // Start the sequential halving of the root if Gumbel is applied
+    // now. Return false if it is not used.
+    bool BeginSequentialHalving(const int playouts, OptionTag tag);
+
+    // Search all leaves of current halving phase in one batch.
+    void PlayHalvingPhase();
+
+    // Fill the basic information of the root state.
+    void InitComputationResult(ComputationResult &result) const;
+
+    // Return false if the search should stop.
+    bool KeepSearching(const int playouts, OptionTag tag,
+                       const float elapsed, const float thinking_time) const;
+
+    // Return true if the most visited move can not be overtaken by the
+    // remaining playouts or time, and it is also the best LCB move.
+    bool IsSearchFutile(const int playouts, OptionTag tag,
+                        const float elapsed, const float thinking_time) const;
+
+    // The playouts of the next self-play move. The fast search is
+    // set if it is the reduced search of the playout cap randomization.
+    int GetSelfPlayPlayouts(bool &fast_search);
+
+    // Select the self-play move from the result and save the
+    // training data.
+    int SelectSelfPlayMove(ComputationResult &result);
+
+    // Collect one step of the stepped search. Return false if it
+    // is finished.
+    bool CollectStep();
+
+    // Begin and end the stepped self-play or match move. The playouts
+    // and the fast search of the step must be set before beginning.
+    bool BeginSteppedMove();
+    void EndSteppedMove();
+
     void PrepareRootNode();
     int GetPonderPlayouts() const;
 
+    // Allocate the other trees of the root parallelization on the
+    // current root state. Only the threaded search uses them.
+    void PrepareRootTrees();
+
+    // Add the new root children statistics of the other trees into
+    // the main tree. Only the main search thread calls it.
+    void MergeRootTrees();
+
+    void ReleaseRootTrees();
+
+    // Merge the statistics of the remote jobs and give the idle search
+    // workers the new jobs. Only the main search thread calls it.
+    void SyncRemoteSearch();
+
+    // Stop the remote jobs. Call it before the root or its children are
+    // changed or released.
+    void StopRemoteSearch();
+
+    // Return the root which the search thread of the index searches.
+    // The main thread is the index 0.
+    Node *GetSearchRoot(int thread_index) const;
+
+    // The thinking time which follows the root statistics. It is
+    // only used with the game clock.
+    struct DynamicTime {
+        float nominal; // the time given by the clock
+        float max_time; // never think longer than it
+        int best_move;
+        float best_since; // the elapsed time when the best move changed
+    };
+
+    // Return the new thinking time by the stability and the visit share
+    // of the best move and the tree complexity. Return the elapsed time
+    // if the best move can not be overtaken in the remaining time.
+    float AdjustThinkingTime(DynamicTime &dtime, const float elapsed) const;
+
+    // Choose the opponent's best replies before the pondering. The
+    // root only visits them, in proportion to their policy.
+    void SetPonderFocus();
+
+    // Return the focused reply which is the most behind its share.
+    // Return NULL if there is no focus.
+    Node *SelectPonderReply();
+
+    // Return the root move of the best analysis lines which is the
+    // most behind its minimum visit share. Return NULL if all lines
+    // have their shares, or there is no multi-PV.
+    Node *SelectMultiPvReply();
+
+    // Check whether the opponent played the pondered reply.
+    void RecordPonderHit(bool reused);
+
+    // Get the tree memory limit in bytes. Zero means no limit.
+    size_t GetTreeMemoryLimit() const;
+
+    // Prune the small sub-trees if the tree is too large.
+    void ReduceTreeMemory();
+
     int GetExpandThreshold(GameState &state) const;
 
+    // Return true if the leaf of this depth computes the ownership
+    // head. The root depth is zero.
+    bool NeedOwnership(const int depth) const;
+
+    // Replace the leaf values with the values of same position
+    // in the transposition table.
+    void ApplyTransposition(std::uint64_t hash, SearchResult &search_result);
+
+    // Save the node values into the transposition table. The root
+    // depth is zero.
+    void StoreTransposition(std::uint64_t hash, Node *node, const int depth);
+
+    // Output the analysis of the root for the GTP interface.
+    void OutputAnalysis(const int color);
+
+    // Call the input handler. Return false if the search should stop.
+    bool HandleInput(OptionTag tag);
+
+    InputHook input_pending_;
+    InputHook input_handler_;
+
+    // True if the running search is the analysis pondering.
+    bool analysis_ponder_{false};
+
+    // False after a move is played in the input handler, until the
+    // next analysis command continues the search.
+    bool analysis_output_{true};
+
     AnalysisConfig analysis_config_;
 
+    // Reused by every analysis output, so the output does not
+    // allocate at every interval.
+    TextBuffer analysis_buffer_;
+
     // Stop the search if current playouts greater this value.
     int max_playouts_; 
 
     // Self-play training data.
     std::vector<Training> training_buffer_;
+    ResignAnalysis resign_analysis_;
 
     // True if it is searhing.
     std::atomic<bool> running_; 
@@ -213,9 +506,72 @@ private:
     // The root node of tree.
     std::unique_ptr<Node> root_node_; 
 
+    // The other trees of the root parallelization. They search the
+    // same root state with their own threads and share the network and
+    // the caches. Only their root children are merged into the main
+    // tree, so the tree roots are never contended by all threads. The
+    // merged part is the statistics which are already added.
+    struct RootTree {
+        std::unique_ptr<Node> root;
+        Node::Stats merged_root;
+        std::vector<Node::Stats> merged_children;
+    };
+    std::vector<RootTree> root_trees_;
+
+    // The search workers of the other hosts. It is NULL if there are
+    // no workers.
+    std::unique_ptr<RemoteSearch> remote_search_;
+
     // The tree search parameters.
     std::unique_ptr<Parameters> param_;
 
+    // The sub-tree values of searched positions. They are only valid
+    // for the network, the komi and the board size of the last search.
+    TranspositionTable transposition_table_;
+    int transposition_generation_{-1};
+    std::uint64_t transposition_komi_hash_{0};
+    int transposition_board_size_{0};
+
+    // The visit distribution of the root children, for the time
+    // control.
+    RootStats root_stats_;
+
     // The tree search threads.
     std::unique_ptr<ThreadGroup<void>> group_;
+
+    // The focused replies of the current pondering, the vertex and
+    // the share of the root visits.
+    std::vector<std::pair<int, float>> ponder_focus_;
+
+    // The root scheduler of the low playouts Gumbel search.
+    SequentialHalving halving_;
+
+    // The last pondering. It is checked at the next search.
+    struct PonderRecord {
+        bool valid{false};
+        std::uint64_t hash;
+        int move_number;
+        float seconds;
+        std::vector<int> replies;
+    };
+    PonderRecord last_ponder_;
+
+    // The status of the stepped self-play or analysis search.
+    struct SelfPlayStep {
+        OptionTag tag;
+        int playouts;
+        bool searched;
+        bool fast_search{false};
+
+        // The noise switches before the fast search.
+        bool gumbel;
+        bool dirichlet_noise;
+        float thinking_time;
+        Timer timer;
+        Timer memory_timer;
+        ComputationResult result;
+        std::vector<AsyncPlayout> pending;
+        std::vector<GameState> states;
+    };
+    SelfPlayStep step_;
 };
@@ -0,0 +1,168 @@
+#include "mcts/search_worker.h"
+#include "mcts/remote_search.h"
+#include "mcts/search.h"
+#include "game/sgf.h"
+#include "pattern/gammas_dict.h"
+#include "utils/log.h"
+#include "utils/format.h"
+#include "utils/time.h"
+#include "config.h"
+
+#include <cstring>
+#include <thread>
+
+constexpr int SearchWorker::kReportIntervalMs;
+
+SearchWorker::SearchWorker() {
+    if (Initialize()) {
+        Loop();
+    }
+    network_.Destroy();
+}
+
+bool SearchWorker::Initialize() {
+    GammasDict::Get().Initialize(GetOption<std::string>("patterns_file"));
+    network_.Initialize(GetOption<std::string>("weights_file"));
+    if (!network_.Valid() && !GetOption<bool>("no_dcnn")) {
+        LOGGING << "The search worker requires the weights file.\n";
+        return false;
+    }
+
+    // The smaller boards are masked in the network board size.
+    board_size_ = std::max(GetOption<int>("defualt_boardsize"),
+                               GetOption<int>("fixed_nn_boardsize"));
+    network_.Reload(board_size_);
+
+    ThreadPool::Get(GetOption<int>("threads"));
+    return true;
+}
+
+void SearchWorker::Loop() {
+    const int port = GetOption<int>("server_port");
+    auto server = Socket{};
+
+    if (!server.Listen(port)) {
+        LOGGING << Format("Fail to listen on the port %d.\n", port);
+        return;
+    }
+    LOGGING << Format("The search worker is listening on the port %d, board size %d.\n",
+                          port, board_size_);
+
+    while (true) {
+        auto master = server.Accept();
+        if (!master.Valid()) {
+            continue;
+        }
+        std::thread([this, master = std::move(master)]() mutable {
+            ServeMaster(std::move(master));
+        }).detach();
+    }
+}
+
+void SearchWorker::ServeMaster(Socket socket) {
+    const auto hello = RemoteSearch::GetHello();
+    auto master_hello = RemoteSearch::Hello{};
+
+    if (!socket.RecvAll(&master_hello, sizeof(master_hello)) ||
+            !socket.SendAll(&hello, sizeof(hello)) ||
+            !RemoteSearch::MatchHello(hello, master_hello)) {
+        return;
+    }
+    LOGGING << Format("The master is connected, %d masters.\n", num_masters_.fetch_add(1) + 1);
+
+    auto state = GameState{};
+    state.Reset(board_size_, GetOption<float>("defualt_komi"));
+    auto search = std::make_unique<Search>(state, network_);
+
+    // Only the search thread sends the reports, and only this thread
+    // reads the messages.
+    std::atomic<bool> stop{false};
+    std::thread runner;
+    auto running_job = std::uint32_t{0};
+
+    const auto SendStats = [&socket](std::uint32_t type, std::uint32_t job,
+                                     const Node::Stats &now, const Node::Stats &base) {
+        auto delta = Node::Stats{};
+        delta.visits = now.visits - base.visits;
+        delta.black_wl = now.black_wl - base.black_wl;
+        delta.draw = now.draw - base.draw;
+        delta.black_fs = now.black_fs - base.black_fs;
+        delta.squared_eval_diff = now.squared_eval_diff - base.squared_eval_diff;
+
+        auto payload = std::string(sizeof(delta), '\0');
+        std::memcpy(&payload[0], &delta, sizeof(delta));
+        RemoteSearch::SendMessage(socket, type, job, payload);
+    };
+
+    const auto RunJob = [&](std::uint32_t job, int playouts) {
+        // Only report the statistics of this job. The root of the
+        // reused tree already has the visits of the last jobs, and the
+        // master merged them.
+        auto base = Node::Stats{};
+        bool started = false;
+        Timer report_timer;
+
+        search->SetInputHooks(
+            [&]() -> bool {
+                const auto now = search->GetRootStats();
+                if (!started) {
+                    base = now;
+                    started = true;
+                    report_timer.Clock();
+                } else if (report_timer.GetDurationMilliseconds() > kReportIntervalMs) {
+                    report_timer.Clock();
+                    SendStats(RemoteSearch::kStats, job, now, base);
+                }
+                return stop.load(std::memory_order_relaxed);
+            },
+            []() -> bool { return false; });
+
+        if (state.GetBoardSize() <= board_size_) {
+            search->Computation(playouts, Search::kRemote);
+        }
+        search->SetInputHooks(nullptr, nullptr);
+
+        const auto now = started ? search->GetRootStats() : base;
+        SendStats(RemoteSearch::kDone, job, now, base);
+    };
+
+    const auto StopJob = [&]() {
+        stop.store(true, std::memory_order_relaxed);
+        if (runner.joinable()) {
+            runner.join();
+        }
+    };
+
+    auto type = std::uint32_t{0};
+    auto job = std::uint32_t{0};
+    auto payload = std::string{};
+
+    while (RemoteSearch::RecvMessage(socket, type, job, payload)) {
+        if (type == RemoteSearch::kSearch) {
+            std::int32_t playouts = 0;
+            if (payload.size() < sizeof(playouts)) {
+                break;
+            }
+            std::memcpy(&playouts, payload.data(), sizeof(playouts));
+
+            StopJob();
+            try {
+                state = Sgf::Get().FromString(payload.substr(sizeof(playouts)), 9999);
+            } catch (const char *err) {
+                LOGGING << Format("Fail to load the job position, %s.\n", err);
+                break;
+            }
+            stop.store(false, std::memory_order_relaxed);
+            running_job = job;
+            runner = std::thread(RunJob, job, (int)playouts);
+        } else if (type == RemoteSearch::kStop) {
+            if (job == running_job) {
+                stop.store(true, std::memory_order_relaxed);
+            }
+        } else {
+            break;
+        }
+    }
+    StopJob();
+    LOGGING << Format("The master is disconnected, %d masters.\n", num_masters_.fetch_sub(1) - 1);
+}
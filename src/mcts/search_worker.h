@@ -0,0 +1,30 @@
+#pragma once
+
+#include "neural/network.h"
+#include "utils/socket.h"
+
+#include <atomic>
+
+// Search the jobs of the RemoteSearch master. Every master connection
+// has its own search, which keeps the tree between the jobs, so the
+// next job of the same position reuses it. All connections share one
+// network.
+class SearchWorker {
+public:
+    SearchWorker();
+
+private:
+    // Load the network. Return false if fail.
+    bool Initialize();
+    void Loop();
+
+    // Search the jobs of one master until it is disconnected.
+    void ServeMaster(Socket socket);
+
+    // Send the statistics of the job at most this often.
+    static constexpr int kReportIntervalMs = 100;
+
+    Network network_;
+    int board_size_;
+    std::atomic<int> num_masters_{0};
+};
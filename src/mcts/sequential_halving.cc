@@ -0,0 +1,182 @@
+#include "mcts/sequential_halving.h"
+#include "mcts/node.h"
+#include "game/types.h"
+#include "utils/random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+bool SequentialHalving::Begin(Node *root, int color, int considered_moves, int budget) {
+    Clear();
+    if (!root->HaveChildren()) {
+        return false;
+    }
+
+    const auto &children = root->GetChildren();
+    auto gumbel_noise = std::vector<float>(children.Size());
+    RandomBatch::FillGumbel(gumbel_noise.data(), gumbel_noise.size());
+
+    for (const auto &child : children) {
+        const auto node = child.Get();
+        if (node && !node->IsActive()) {
+            continue;
+        }
+        const auto logit = gumbel_noise[child.Index()] +
+                               std::log(child.GetPolicy() + 1e-8f);
+        candidates_.push_back({child.GetVertex(), logit});
+    }
+
+    // Every considered move needs one visit at least.
+    const int size = std::min(considered_moves, (int)candidates_.size());
+    if (size < 2 || budget < size) {
+        candidates_.clear();
+        return false;
+    }
+
+    // The Gumbel-Top-k trick. Sample the considered moves without
+    // replacement.
+    std::partial_sort(std::begin(candidates_),
+                          std::begin(candidates_) + size,
+                          std::end(candidates_),
+                          [](const Candidate &a, const Candidate &b) {
+                              return a.logit > b.logit;
+                          });
+    candidates_.resize(size);
+
+    color_ = color;
+    phases_left_ = std::ceil(std::log2((float)size));
+    budget_left_ = budget;
+    budget_per_phase_ = budget / phases_left_;
+    active_ = has_result_ = true;
+
+    PlanPhase();
+    return true;
+}
+
+void SequentialHalving::Clear() {
+    candidates_.clear();
+    plan_.clear();
+    next_ = 0;
+    phases_left_ = budget_left_ = budget_per_phase_ = 0;
+    active_ = has_result_ = false;
+}
+
+bool SequentialHalving::IsActive() const {
+    return active_;
+}
+
+bool SequentialHalving::HasResult() const {
+    return has_result_;
+}
+
+int SequentialHalving::NextMove() {
+    if (next_ < plan_.size()) {
+        return plan_[next_++];
+    }
+    return kNullVertex;
+}
+
+int SequentialHalving::GetRemaining() const {
+    return plan_.size() - next_;
+}
+
+void SequentialHalving::PlanPhase() {
+    plan_.clear();
+    next_ = 0;
+
+    // The last phase takes all remaining budget, so the rounding
+    // of the earlier phases is not lost.
+    const int size = candidates_.size();
+    const int phase_budget = phases_left_ == 1 ?
+                                 budget_left_ : std::min(budget_per_phase_, budget_left_);
+    const int visits = std::max(1, phase_budget / size);
+    if (visits * size > budget_left_) {
+        active_ = false;
+        return;
+    }
+
+    // Interleave the moves, so every part of the batch spreads
+    // over all moves.
+    for (int v = 0; v < visits; ++v) {
+        for (const auto &c : candidates_) {
+            plan_.emplace_back(c.vertex);
+        }
+    }
+    budget_left_ -= visits * size;
+}
+
+void SequentialHalving::NextPhase(Node *root) {
+    if (!active_) {
+        return;
+    }
+
+    phases_left_ -= 1;
+    if (phases_left_ <= 0 || candidates_.size() <= 1) {
+        plan_.clear();
+        next_ = 0;
+        active_ = false;
+        return;
+    }
+
+    const auto scores = GetScores(root);
+    auto order = std::vector<int>(candidates_.size());
+    for (int i = 0; i < (int)order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(std::begin(order), std::end(order),
+                         [&scores](int a, int b) {
+                             return scores[a] > scores[b];
+                         });
+
+    auto kept = std::vector<Candidate>{};
+    const auto size = (candidates_.size() + 1) / 2;
+    for (auto i = size_t{0}; i < size; ++i) {
+        kept.emplace_back(candidates_[order[i]]);
+    }
+    candidates_ = std::move(kept);
+
+    PlanPhase();
+}
+
+int SequentialHalving::GetBestMove(Node *root) const {
+    const auto scores = GetScores(root);
+    int best_move = kNullVertex;
+    float best_score = std::numeric_limits<float>::lowest();
+
+    for (int i = 0; i < (int)candidates_.size(); ++i) {
+        if (scores[i] > best_score) {
+            best_score = scores[i];
+            best_move = candidates_[i].vertex;
+        }
+    }
+    return best_move;
+}
+
+std::vector<float> SequentialHalving::GetScores(Node *root) const {
+    const auto parent_score = root->GetFinalScore(color_);
+
+    // The unvisited move uses the root value as its Q value.
+    const auto root_q = root->GetGumbelQValue(color_, parent_score);
+
+    auto nodes = std::vector<Node *>{};
+    int max_visits = 0;
+    for (const auto &c : candidates_) {
+        const auto node = root->GetChild(c.vertex);
+        nodes.emplace_back(node);
+        if (node) {
+            max_visits = std::max(max_visits, node->GetVisits());
+        }
+    }
+
+    auto scores = std::vector<float>{};
+    for (int i = 0; i < (int)candidates_.size(); ++i) {
+        const auto node = nodes[i];
+        const auto q = node && node->GetVisits() > 0 ?
+                           node->GetGumbelQValue(color_, parent_score) : root_q;
+        scores.emplace_back(candidates_[i].logit +
+                                root->NormalizeCompletedQ(q, max_visits));
+    }
+    return scores;
+}
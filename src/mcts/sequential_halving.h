@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+class Node;
+
+// The root scheduler of the Gumbel search for the low playouts. It
+// samples the Gumbel noise once, chooses the considered moves and plans
+// the visits of every phase before the phase starts. Every phase gives
+// the same visits to all remaining moves, and then the better half of
+// them is kept. The whole phase is known in advance, so its leaves can
+// be submitted as one network batch.
+//
+// See the paper, "Policy improvement by planning with Gumbel".
+class SequentialHalving {
+public:
+    // Sample the noise and plan the first phase. The color is the side
+    // to move of the root. The budget is the number of the root visits
+    // for all phases. Return false if there is nothing to choose, or
+    // the budget is too small.
+    bool Begin(Node *root, int color, int considered_moves, int budget);
+
+    void Clear();
+
+    // Return true if the phases are not finished.
+    bool IsActive() const;
+
+    // Return true if Begin() succeeded. The result is valid until
+    // Clear() even after the phases finished.
+    bool HasResult() const;
+
+    // Return the root move of the next leaf in current phase. Return
+    // NULL vertex if all leaves of the phase are taken.
+    int NextMove();
+
+    // Return the number of leaves which are not taken in current phase.
+    int GetRemaining() const;
+
+    // Keep the better half of the moves and plan the next phase. Call
+    // it after all leaves of the phase are finished.
+    void NextPhase(Node *root);
+
+    // Return the best remaining move.
+    int GetBestMove(Node *root) const;
+
+private:
+    struct Candidate {
+        int vertex;
+
+        // The sampled Gumbel noise plus the policy logit.
+        float logit;
+    };
+
+    // The noisy logit plus the normalized completed Q value.
+    std::vector<float> GetScores(Node *root) const;
+
+    void PlanPhase();
+
+    std::vector<Candidate> candidates_;
+    std::vector<int> plan_;
+    size_t next_{0};
+
+    int color_{0};
+    int phases_left_{0};
+    int budget_left_{0};
+    int budget_per_phase_{0};
+    bool active_{false};
+    bool has_result_{false};
+};
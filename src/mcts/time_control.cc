@@ -251,6 +251,32 @@ float TimeControl::GetThinkingTime(int color, int boardsize, int move_num) const
     return (float)(base_time + inc_time) / 100.f; // centisecond to second
 }
 
+float TimeControl::GetMaxThinkingTime(int color, int boardsize, int move_num) const {
+    // Never think longer than twice of the normal time.
+    constexpr float kMaxExtension = 2.f;
+
+    const auto thinking_time = GetThinkingTime(color, boardsize, move_num);
+    if (IsInfiniteTime(color) || IsTimeOver(color)) {
+        return thinking_time;
+    }
+
+    int spare = 0; // centiseconds
+    if (in_byo_[color]) {
+        if (byo_stones_ && !byo_periods_) {
+            // Canadian type. Borrow the half time of the other stones.
+            const auto base_time = (int)(100 * thinking_time);
+            spare = std::max(byotime_left_[color] - lag_buffer_ - base_time, 0) / 2;
+        }
+        // Byo-Yomi type can not borrow any time. The exceeded
+        // time loses one period.
+    } else {
+        // Borrow at most a quarter of the main time.
+        spare = std::max(maintime_left_[color] / 4 - lag_buffer_, 0);
+    }
+
+    return std::min(kMaxExtension * thinking_time,
+                        thinking_time + (float)spare / 100.f);
+}
 
 bool TimeControl::IsTimeOver(int color) const {
     if (maintime_left_[color] > 0 ||
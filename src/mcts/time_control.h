@@ -20,6 +20,10 @@ public:
 
     float GetThinkingTime(int color, int boardsize, int move_num) const;
 
+    // The upper bound if the search wants to think longer than the
+    // GetThinkingTime(). It borrows some time from the next moves.
+    float GetMaxThinkingTime(int color, int boardsize, int move_num) const;
+
     void Clock();
     void TookTime(int color);
 
@@ -0,0 +1,64 @@
+#include "mcts/transposition.h"
+
+void TranspositionTable::SetMemory(size_t MiB) {
+    if (MiB == memory_mib_) {
+        return;
+    }
+    memory_mib_ = MiB;
+
+    const auto size = MiB * 1024 * 1024 / sizeof(Bucket);
+    buckets_ = std::vector<Bucket>(size);
+}
+
+TranspositionTable::Bucket &TranspositionTable::GetBucket(std::uint64_t key) {
+    return buckets_[key % buckets_.size()];
+}
+
+void TranspositionTable::Store(const TranspositionEntry &entry) {
+    auto &bucket = GetBucket(entry.key);
+    SpinLock::Lock lock(bucket.lock);
+
+    for (auto &slot : bucket.slots) {
+        if (slot.visits > 0 && slot.key == entry.key) {
+            // The same position. Keep the one with more visits.
+            if (slot.visits <= entry.visits) {
+                slot = entry;
+            }
+            return;
+        }
+    }
+
+    auto &preferred = bucket.slots[0];
+    auto &always = bucket.slots[1];
+
+    if (preferred.visits <= entry.visits) {
+        // Move the old entry to the second slot. It is still
+        // useful before it is replaced.
+        always = preferred;
+        preferred = entry;
+    } else {
+        always = entry;
+    }
+}
+
+bool TranspositionTable::Lookup(std::uint64_t key, TranspositionEntry &entry) {
+    auto &bucket = GetBucket(key);
+    SpinLock::Lock lock(bucket.lock);
+
+    for (const auto &slot : bucket.slots) {
+        if (slot.visits > 0 && slot.key == key) {
+            entry = slot;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TranspositionTable::Clear() {
+    for (auto &bucket : buckets_) {
+        SpinLock::Lock lock(bucket.lock);
+        for (auto &slot : bucket.slots) {
+            slot = TranspositionEntry{};
+        }
+    }
+}
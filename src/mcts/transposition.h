@@ -0,0 +1,57 @@
+#pragma once
+
+#include "utils/mutex.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The statistics of one searched position.
+struct TranspositionEntry {
+    std::uint64_t key{0};
+    int visits{0};
+    float black_wl{0.f};
+    float draw{0.f};
+    float black_final_score{0.f};
+};
+
+// The transposition table shares the sub-tree values between the
+// positions reached by different move orders. Every bucket has two
+// slots. The first one keeps the entry with more visits and the second
+// one is always replaced, so that the deep and hot positions are not
+// evicted by the shallow ones.
+class TranspositionTable {
+public:
+    TranspositionTable() = default;
+
+    // Resize the table. Zero MiB disables it.
+    void SetMemory(size_t MiB);
+
+    // Return the table size in MiB.
+    size_t GetMemory() const { return memory_mib_; }
+
+    bool Enabled() const { return !buckets_.empty(); }
+
+    // Store the statistics of the position.
+    void Store(const TranspositionEntry &entry);
+
+    // Lookup the statistics of the position. Return false if there
+    // is no such position in the table.
+    bool Lookup(std::uint64_t key, TranspositionEntry &entry);
+
+    // Clear all the entries.
+    void Clear();
+
+private:
+    static constexpr int kBucketSize = 2;
+
+    struct Bucket {
+        SpinLock lock;
+        TranspositionEntry slots[kBucketSize];
+    };
+
+    Bucket &GetBucket(std::uint64_t key);
+
+    std::vector<Bucket> buckets_;
+    size_t memory_mib_{0};
+};
@@ -0,0 +1,65 @@
+#include "mcts/tree_collector.h"
+#include "mcts/node.h"
+
+#include <thread>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+constexpr size_t TreeCollector::kMaxBacklog;
+
+TreeCollector &TreeCollector::Get() {
+    // Never destroy it. The searches may be destroyed after the static
+    // objects, and the remaining trees are freed with the process.
+    static TreeCollector *collector = new TreeCollector;
+    return *collector;
+}
+
+TreeCollector::TreeCollector() {
+    std::thread([this]() { Worker(); }).detach();
+}
+
+void TreeCollector::Collect(Node *root) {
+    if (!root) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.size() < kMaxBacklog) {
+            queue_.emplace_back(root);
+            root = nullptr;
+        }
+    }
+    if (root) {
+        // The collector can not keep up with it.
+        delete root;
+    } else {
+        cv_.notify_one();
+    }
+}
+
+size_t TreeCollector::GetBacklog() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+void TreeCollector::Worker() {
+#if defined(__linux__)
+    // The nice value is per thread on Linux.
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+
+    while (true) {
+        Node *root = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return !queue_.empty(); });
+            root = queue_.front();
+            queue_.pop_front();
+        }
+        delete root;
+    }
+}
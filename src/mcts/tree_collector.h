@@ -0,0 +1,35 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+class Node;
+
+// Delete the discarded trees in one background thread. The thread runs
+// at the lowest priority, so the deletion does not take the CPU from
+// the next search, and the tasks of the search pool are only for the
+// search. The backlog is bounded. If it is full, the caller deletes
+// the tree by itself, so the memory does not grow without limit.
+class TreeCollector {
+public:
+    static TreeCollector &Get();
+
+    // Take over the tree and delete it later.
+    void Collect(Node *root);
+
+    // Return the number of trees waiting to be deleted.
+    size_t GetBacklog();
+
+private:
+    TreeCollector();
+
+    void Worker();
+
+    static constexpr size_t kMaxBacklog = 64;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Node *> queue_;
+};
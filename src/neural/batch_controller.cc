@@ -0,0 +1,106 @@
+#include "neural/batch_controller.h"
+#include "utils/format.h"
+
+#include <algorithm>
+#include <sstream>
+
+constexpr std::array<int, 6> BatchController::kWaitBuckets;
+
+void BatchController::Reset(int max_wait_us) {
+    SpinLock::Lock lock(lock_);
+    max_wait_us_ = std::max(max_wait_us, 0);
+    arrival_interval_us_ = 0.f;
+    has_arrival_ = false;
+
+    ResetStats();
+}
+
+void BatchController::ResetStats() {
+    batches_.store(0, std::memory_order_relaxed);
+    entries_.store(0, std::memory_order_relaxed);
+    capacity_.store(0, std::memory_order_relaxed);
+    for (auto &cnt : wait_histogram_) {
+        cnt.store(0, std::memory_order_relaxed);
+    }
+}
+
+float BatchController::GetFillRatio() const {
+    const auto entries = entries_.load(std::memory_order_relaxed);
+    const auto capacity = capacity_.load(std::memory_order_relaxed);
+    return capacity == 0 ? 0.f : (float)entries / capacity;
+}
+
+void BatchController::OnArrival() {
+    // The weight of newest interval in the moving average.
+    static constexpr float kAlpha = 0.1f;
+
+    const auto now = Clock::now();
+    SpinLock::Lock lock(lock_);
+
+    if (has_arrival_) {
+        const float interval = std::chrono::duration_cast<std::chrono::microseconds>(
+                                   now - last_arrival_).count();
+        arrival_interval_us_ = (1.f - kAlpha) * arrival_interval_us_ + kAlpha * interval;
+    }
+    last_arrival_ = now;
+    has_arrival_ = true;
+}
+
+int BatchController::GetWaitMicroseconds(int queue_size, int max_batch) const {
+    const int remaining = max_batch - queue_size;
+    if (remaining <= 0) {
+        return 0;
+    }
+
+    float interval;
+    {
+        SpinLock::Lock lock(lock_);
+        interval = arrival_interval_us_;
+    }
+
+    // Expected time to fill the batch.
+    const float fill_time = remaining * interval;
+    if (fill_time > max_wait_us_) {
+        return 0;
+    }
+    return std::max((int)fill_time, 1);
+}
+
+void BatchController::OnDispatch(int batch_size, int max_batch, int waited_us) {
+    batches_.fetch_add(1, std::memory_order_relaxed);
+    entries_.fetch_add(batch_size, std::memory_order_relaxed);
+    capacity_.fetch_add(max_batch, std::memory_order_relaxed);
+
+    auto bucket = kWaitBuckets.size();
+    for (auto i = size_t{0}; i < kWaitBuckets.size(); ++i) {
+        if (waited_us <= kWaitBuckets[i]) {
+            bucket = i;
+            break;
+        }
+    }
+    wait_histogram_[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+std::string BatchController::GetStatsString() const {
+    const auto batches = batches_.load(std::memory_order_relaxed);
+    const auto entries = entries_.load(std::memory_order_relaxed);
+    const auto capacity = capacity_.load(std::memory_order_relaxed);
+
+    auto out = std::ostringstream{};
+    out << Format("batches: %lld\n", (long long)batches);
+    out << Format("average batch size: %.2f\n",
+                      batches == 0 ? 0.f : (float)entries / batches);
+    out << Format("batch fill ratio: %.2f%%\n",
+                      capacity == 0 ? 0.f : 100.f * entries / capacity);
+
+    out << "wait histogram:\n";
+    for (auto i = size_t{0}; i < wait_histogram_.size(); ++i) {
+        const auto cnt = wait_histogram_[i].load(std::memory_order_relaxed);
+        if (i < kWaitBuckets.size()) {
+            out << Format("  <= %5d us: %lld\n", kWaitBuckets[i], (long long)cnt);
+        } else {
+            out << Format("   > %5d us: %lld\n", kWaitBuckets.back(), (long long)cnt);
+        }
+    }
+    return out.str();
+}
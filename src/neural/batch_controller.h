@@ -0,0 +1,58 @@
+#pragma once
+
+#include "utils/mutex.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Choose how long the batch worker waits for more entries. It tracks
+// the arrival rate of entries. If the batch can be filled soon, wait
+// for it. If it can not be filled in the maximum waiting time, for
+// example only few search threads are active, dispatch the current
+// entries right now.
+class BatchController {
+public:
+    // Set the maximum waiting time in microseconds.
+    void Reset(int max_wait_us);
+
+    // Called for every pushed entry.
+    void OnArrival();
+
+    // Return the time in microseconds to wait for the next entries.
+    // Return zero if the worker should dispatch the batch now.
+    int GetWaitMicroseconds(int queue_size, int max_batch) const;
+
+    // Record one dispatched batch and the time it waited.
+    void OnDispatch(int batch_size, int max_batch, int waited_us);
+
+    // Return the batch fill ratio and the wait histogram.
+    std::string GetStatsString() const;
+
+    // Return the batch fill ratio. It is zero if there is no batch.
+    float GetFillRatio() const;
+
+    // Clear the counters but keep the arrival rate.
+    void ResetStats();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // The upper bounds of the histogram buckets in microseconds. The
+    // last bucket counts the rest.
+    static constexpr std::array<int, 6> kWaitBuckets = {0, 100, 500, 1000, 2000, 5000};
+
+    int max_wait_us_{2000};
+
+    mutable SpinLock lock_;
+    Clock::time_point last_arrival_;
+    float arrival_interval_us_{0.f};
+    bool has_arrival_{false};
+
+    std::atomic<std::int64_t> batches_{0};
+    std::atomic<std::int64_t> entries_{0};
+    std::atomic<std::int64_t> capacity_{0};
+    std::array<std::atomic<std::int64_t>, kWaitBuckets.size() + 1> wait_histogram_{};
+};
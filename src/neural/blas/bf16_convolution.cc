@@ -0,0 +1,396 @@
+#include "neural/blas/bf16_convolution.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BF16_KERNEL_AVX512
+#include <immintrin.h>
+#endif
+
+#if defined(BF16_KERNEL_AVX512) && defined(__linux__) && defined(__x86_64__) && \
+        (__GNUC__ >= 11 || defined(__clang__))
+#define BF16_KERNEL_AMX
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Every float lane accumulates two products at once.
+constexpr int kDepth = 2;
+
+// The columns of one register.
+constexpr int kColumnBlock = 16;
+
+// The columns are padded to a multiple of this value. The kernels
+// compute two column blocks at once.
+constexpr int kColumnPadding = 2 * kColumnBlock;
+
+using DotKernel = void (*)(const int outputs,
+                           const int depth,
+                           const int columns,
+                           const std::uint16_t *weights,
+                           const std::uint16_t *col,
+                           float *acc);
+
+// Round the float to the nearest even bfloat16.
+static std::uint16_t FloatToBf16(const float val) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &val, sizeof(bits));
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return static_cast<std::uint16_t>(bits >> 16);
+}
+
+static float Bf16ToFloat(const std::uint16_t val) {
+    const std::uint32_t bits = static_cast<std::uint32_t>(val) << 16;
+    float out;
+    std::memcpy(&out, &bits, sizeof(out));
+    return out;
+}
+
+// weights: [outputs, depth * kDepth]
+// col:     [depth, columns, kDepth]
+// acc:     [outputs, columns]
+static void DotKernelScalar(const int outputs,
+                            const int depth,
+                            const int columns,
+                            const std::uint16_t *weights,
+                            const std::uint16_t *col,
+                            float *acc) {
+    for (int o = 0; o < outputs; ++o) {
+        float *acc_row = acc + o * columns;
+        std::fill(acc_row, acc_row + columns, 0.f);
+
+        for (int d = 0; d < depth; ++d) {
+            const float w0 = Bf16ToFloat(weights[(o * depth + d) * kDepth + 0]);
+            const float w1 = Bf16ToFloat(weights[(o * depth + d) * kDepth + 1]);
+            const std::uint16_t *c = col + d * columns * kDepth;
+            for (int n = 0; n < columns; ++n) {
+                acc_row[n] += w0 * Bf16ToFloat(c[n * kDepth + 0]) +
+                                  w1 * Bf16ToFloat(c[n * kDepth + 1]);
+            }
+        }
+    }
+}
+
+#ifdef BF16_KERNEL_AVX512
+// Compute the OB output channels x NB column blocks in the registers.
+// The outputs share the loaded inputs and the columns share the
+// broadcasted weights.
+template <int OB, int NB>
+__attribute__((target("avx512f,avx512bf16"), always_inline))
+static inline void DotBlockAvx512(const int depth,
+                                  const int columns,
+                                  const std::int32_t *weights,
+                                  const std::uint16_t *col,
+                                  float *acc) {
+    __m512 c[OB][NB];
+    for (int i = 0; i < OB; ++i) {
+        for (int j = 0; j < NB; ++j) {
+            c[i][j] = _mm512_setzero_ps();
+        }
+    }
+
+    for (int d = 0; d < depth; ++d) {
+        __m512bh in[NB];
+        for (int j = 0; j < NB; ++j) {
+            in[j] = (__m512bh)_mm512_loadu_si512(col + (d * columns + j * kColumnBlock) * kDepth);
+        }
+        for (int i = 0; i < OB; ++i) {
+            const __m512bh w = (__m512bh)_mm512_set1_epi32(weights[i * depth + d]);
+            for (int j = 0; j < NB; ++j) {
+                c[i][j] = _mm512_dpbf16_ps(c[i][j], in[j], w);
+            }
+        }
+    }
+
+    for (int i = 0; i < OB; ++i) {
+        for (int j = 0; j < NB; ++j) {
+            _mm512_storeu_ps(acc + i * columns + j * kColumnBlock, c[i][j]);
+        }
+    }
+}
+
+__attribute__((target("avx512f,avx512bf16")))
+static void DotKernelAvx512(const int outputs,
+                            const int depth,
+                            const int columns,
+                            const std::uint16_t *weights,
+                            const std::uint16_t *col,
+                            float *acc) {
+    // The weights of one output are the pairs of bfloat16.
+    const std::int32_t *w = reinterpret_cast<const std::int32_t *>(weights);
+
+    int o = 0;
+    for (; o + 8 <= outputs; o += 8) {
+        int n = 0;
+        for (; n + 2 * kColumnBlock <= columns; n += 2 * kColumnBlock) {
+            DotBlockAvx512<8, 2>(depth, columns, w + o * depth, col + n * kDepth, acc + o * columns + n);
+        }
+        for (; n < columns; n += kColumnBlock) {
+            DotBlockAvx512<8, 1>(depth, columns, w + o * depth, col + n * kDepth, acc + o * columns + n);
+        }
+    }
+    for (; o < outputs; ++o) {
+        for (int n = 0; n < columns; n += kColumnBlock) {
+            DotBlockAvx512<1, 1>(depth, columns, w + o * depth, col + n * kDepth, acc + o * columns + n);
+        }
+    }
+}
+#endif
+
+#ifdef BF16_KERNEL_AMX
+// The tile of AMX is 16 rows x 64 bytes.
+constexpr int kTileRows = 16;
+constexpr int kTileDepth = 16;
+
+struct TileConfig {
+    std::uint8_t palette_id;
+    std::uint8_t start_row;
+    std::uint8_t reserved[14];
+    std::uint16_t colsb[16];
+    std::uint8_t rows[16];
+};
+
+// Linux gives the AMX state only to the process which asks for it.
+static bool RequestAmxPermission() {
+    constexpr int kArchReqXcompPerm = 0x1023;
+    constexpr int kXfeatureXtiledata = 18;
+    return syscall(SYS_arch_prctl, kArchReqXcompPerm, kXfeatureXtiledata) == 0;
+}
+
+// The tiles 0-3 accumulate the 2 x 2 blocks of 16 x 16 outputs, the
+// tiles 4-5 are the weights and the tiles 6-7 are the inputs. The
+// weights tile is [16 outputs, 16 pairs] and the inputs tile is [16
+// pairs, 16 columns x 2], which are just the layouts of the AVX-512
+// kernel.
+__attribute__((target("amx-tile,amx-bf16,avx512f,avx512bf16")))
+static void DotKernelAmx(const int outputs,
+                         const int depth,
+                         const int columns,
+                         const std::uint16_t *weights,
+                         const std::uint16_t *col,
+                         float *acc) {
+    if (outputs % (2 * kTileRows) != 0 ||
+            columns % (2 * kColumnBlock) != 0 ||
+            depth % kTileDepth != 0) {
+        DotKernelAvx512(outputs, depth, columns, weights, col, acc);
+        return;
+    }
+
+    // Every thread has its own tile state.
+    static thread_local bool configured = false;
+    if (!configured) {
+        TileConfig config{};
+        config.palette_id = 1;
+        for (int t = 0; t < 8; ++t) {
+            config.rows[t] = kTileRows;
+            config.colsb[t] = 64;
+        }
+        _tile_loadconfig(&config);
+        configured = true;
+    }
+
+    const int w_stride = depth * kDepth * sizeof(std::uint16_t);
+    const int c_stride = columns * kDepth * sizeof(std::uint16_t);
+    const int acc_stride = columns * sizeof(float);
+
+    for (int o = 0; o < outputs; o += 2 * kTileRows) {
+        for (int n = 0; n < columns; n += 2 * kColumnBlock) {
+            _tile_zero(0);
+            _tile_zero(1);
+            _tile_zero(2);
+            _tile_zero(3);
+            for (int d = 0; d < depth; d += kTileDepth) {
+                const std::uint16_t *w = weights + (o * depth + d) * kDepth;
+                const std::uint16_t *c = col + (d * columns + n) * kDepth;
+                _tile_loadd(4, w, w_stride);
+                _tile_loadd(5, w + kTileRows * depth * kDepth, w_stride);
+                _tile_loadd(6, c, c_stride);
+                _tile_loadd(7, c + kColumnBlock * kDepth, c_stride);
+                _tile_dpbf16ps(0, 4, 6);
+                _tile_dpbf16ps(1, 4, 7);
+                _tile_dpbf16ps(2, 5, 6);
+                _tile_dpbf16ps(3, 5, 7);
+            }
+            float *a = acc + o * columns + n;
+            _tile_stored(0, a, acc_stride);
+            _tile_stored(1, a + kColumnBlock, acc_stride);
+            _tile_stored(2, a + kTileRows * columns, acc_stride);
+            _tile_stored(3, a + kTileRows * columns + kColumnBlock, acc_stride);
+        }
+    }
+}
+#endif
+
+static DotKernel ChooseKernel() {
+#ifdef BF16_KERNEL_AVX512
+    __builtin_cpu_init();
+#ifdef BF16_KERNEL_AMX
+    if (__builtin_cpu_supports("avx512bf16") &&
+            __builtin_cpu_supports("amx-bf16") &&
+            RequestAmxPermission()) {
+        return DotKernelAmx;
+    }
+#endif
+    if (__builtin_cpu_supports("avx512f") &&
+            __builtin_cpu_supports("avx512bf16")) {
+        return DotKernelAvx512;
+    }
+#endif
+    return DotKernelScalar;
+}
+
+static const DotKernel kDotKernel = ChooseKernel();
+
+std::string Bf16Convolution::GetName() {
+#ifdef BF16_KERNEL_AMX
+    if (kDotKernel == DotKernelAmx) {
+        return "amx-bf16";
+    }
+#endif
+#ifdef BF16_KERNEL_AVX512
+    if (kDotKernel == DotKernelAvx512) {
+        return "avx512-bf16";
+    }
+#endif
+    return "scalar";
+}
+
+size_t Bf16Convolution::GetWeightsSize(const size_t outputs, const size_t filter_dim) {
+    return outputs * ((filter_dim + kDepth - 1) / kDepth * kDepth);
+}
+
+void Bf16Convolution::Gemm(const int outputs,
+                           const int columns,
+                           const int depth_dim,
+                           const std::uint16_t *weights,
+                           const float *input,
+                           float *output) {
+    static thread_local std::vector<std::uint16_t> col;
+    static thread_local std::vector<float> acc;
+
+    const int padded_columns = (columns + kColumnPadding - 1) / kColumnPadding * kColumnPadding;
+    const int depth = (depth_dim + kDepth - 1) / kDepth;
+
+    // Convert the inputs into the [K/2, N, 2] layout.
+    col.resize(depth * padded_columns * kDepth);
+    if (depth_dim % kDepth != 0) {
+        std::uint16_t *last = col.data() + (depth - 1) * padded_columns * kDepth;
+        std::fill(last, last + padded_columns * kDepth, 0);
+    }
+    for (int k = 0; k < depth_dim; ++k) {
+        const float *src = input + k * columns;
+        std::uint16_t *dst = col.data() + (k / kDepth) * padded_columns * kDepth + k % kDepth;
+        for (int n = 0; n < columns; ++n) {
+            dst[n * kDepth] = FloatToBf16(src[n]);
+        }
+    }
+
+    acc.resize(outputs * padded_columns);
+    kDotKernel(outputs, depth, padded_columns,
+               weights, col.data(), acc.data());
+
+    for (int o = 0; o < outputs; ++o) {
+        std::copy(acc.data() + o * padded_columns,
+                  acc.data() + o * padded_columns + columns,
+                  output + o * columns);
+    }
+}
+
+void Bf16Convolution::ConvertWeights(const size_t outputs,
+                                     const size_t filter_dim,
+                                     const std::vector<float> &weights,
+                                     std::vector<std::uint16_t> &bf16_weights) {
+    // The dot product kernels read two weights at once.
+    const auto padded_dim = (filter_dim + kDepth - 1) / kDepth * kDepth;
+
+    bf16_weights.assign(outputs * padded_dim, 0);
+    for (auto o = size_t{0}; o < outputs; ++o) {
+        for (auto idx = size_t{0}; idx < filter_dim; ++idx) {
+            bf16_weights[o * padded_dim + idx] =
+                FloatToBf16(weights[o * filter_dim + idx]);
+        }
+    }
+}
+
+void Bf16Convolution::Im2col(const int board_size,
+                             const int filter_size,
+                             const int channels,
+                             const std::vector<float> &input,
+                             std::vector<std::uint16_t> &col) {
+    static thread_local std::vector<std::uint16_t> padded;
+
+    const int width = board_size;
+    const int height = board_size;
+    const int spatial_size = width * height;
+    const int columns = (spatial_size + kColumnPadding - 1) / kColumnPadding * kColumnPadding;
+    const int filter_len = filter_size * filter_size;
+    const int filter_dim = channels * filter_len;
+    const int depth = (filter_dim + kDepth - 1) / kDepth;
+
+    const int pad = filter_size / 2;
+    const int padded_width = width + 2 * pad;
+    const int padded_area = padded_width * (height + 2 * pad);
+
+    // Convert the inputs once into the zero padded planes.
+    padded.assign(channels * padded_area, 0);
+    for (int c = 0; c < channels; ++c) {
+        const float *plane = input.data() + c * spatial_size;
+        std::uint16_t *dst = padded.data() + c * padded_area + pad * padded_width + pad;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                dst[y * padded_width + x] = FloatToBf16(plane[y * width + x]);
+            }
+        }
+    }
+
+    // The padded depth meets the zero weights, but it must not be
+    // NaN. The padded columns are never read.
+    col.resize(depth * columns * kDepth);
+    if (filter_dim % kDepth != 0) {
+        std::uint16_t *last = col.data() + (depth - 1) * columns * kDepth;
+        std::fill(last, last + columns * kDepth, 0);
+    }
+
+    for (int k = 0; k < filter_dim; ++k) {
+        const int c = k / filter_len;
+        const int fy = (k % filter_len) / filter_size;
+        const int fx = k % filter_size;
+        const std::uint16_t *src = padded.data() + c * padded_area + fy * padded_width + fx;
+        std::uint16_t *dst = col.data() + (k / kDepth) * columns * kDepth + k % kDepth;
+
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                dst[(y * width + x) * kDepth] = src[y * padded_width + x];
+            }
+        }
+    }
+}
+
+void Bf16Convolution::Forward(const size_t board_size,
+                              const size_t filter_size,
+                              const size_t input_channels,
+                              const size_t output_channels,
+                              const std::vector<float> &input,
+                              const std::vector<std::uint16_t> &weights,
+                              std::vector<float> &output) {
+    static thread_local std::vector<std::uint16_t> col;
+    static thread_local std::vector<float> acc;
+
+    const int spatial_size = board_size * board_size;
+    const int columns = (spatial_size + kColumnPadding - 1) / kColumnPadding * kColumnPadding;
+    const int filter_dim = input_channels * filter_size * filter_size;
+    const int depth = (filter_dim + kDepth - 1) / kDepth;
+
+    Im2col(board_size, filter_size, input_channels, input, col);
+
+    acc.resize(output_channels * columns);
+    kDotKernel(output_channels, depth, columns,
+               weights.data(), col.data(), acc.data());
+
+    for (int o = 0; o < (int)output_channels; ++o) {
+        std::copy(acc.data() + o * columns,
+                  acc.data() + o * columns + spatial_size,
+                  output.data() + o * spatial_size);
+    }
+}
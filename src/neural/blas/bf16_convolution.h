@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The convolution with the bfloat16 weights and activations. The
+// products are accumulated in float. The weights layout is [outputs,
+// padded (inputs * filter * filter)], padded to a multiple of two.
+class Bf16Convolution {
+public:
+    Bf16Convolution() = delete;
+
+    static void Forward(const size_t board_size,
+                        const size_t filter_size,
+                        const size_t input_channels,
+                        const size_t output_channels,
+                        const std::vector<float> &input,
+                        const std::vector<std::uint16_t> &weights,
+                        std::vector<float> &output);
+
+    // Compute output[outputs, columns] = weights * input[depth_dim,
+    // columns]. The weights are in the above layout.
+    static void Gemm(const int outputs,
+                     const int columns,
+                     const int depth_dim,
+                     const std::uint16_t *weights,
+                     const float *input,
+                     float *output);
+
+    // Return the size of the converted weights.
+    static size_t GetWeightsSize(const size_t outputs, const size_t filter_dim);
+
+    // Convert the float weights [outputs, filter_dim] into the above
+    // layout.
+    static void ConvertWeights(const size_t outputs,
+                               const size_t filter_dim,
+                               const std::vector<float> &weights,
+                               std::vector<std::uint16_t> &bf16_weights);
+
+    // Return the name of the dot product kernel selected for this CPU.
+    static std::string GetName();
+
+private:
+    // Convert the inputs and rearrange them into the [K/2, N, 2]
+    // layout.
+    static void Im2col(const int board_size,
+                       const int filter_size,
+                       const int channels,
+                       const std::vector<float> &input,
+                       std::vector<std::uint16_t> &col);
+};
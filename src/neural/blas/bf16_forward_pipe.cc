@@ -0,0 +1,65 @@
+#include "neural/blas/bf16_forward_pipe.h"
+#include "neural/blas/bf16_convolution.h"
+#include "neural/blas/winograd_convolution3.h"
+#include "utils/log.h"
+
+void Bf16ForwardPipe::Initialize(std::shared_ptr<DNNWeights> weights) {
+    LOGGING << "BF16 Core:" << ' ' << Bf16Convolution::GetName() << std::endl;
+    BlasForwardPipe::Initialize(weights);
+}
+
+bool Bf16ForwardPipe::ReducedPrecision() {
+    return true;
+}
+
+OutputResult Bf16ForwardPipe::ForwardFullPrecision(const InputData &inpnt) {
+    auto result = OutputResult{};
+    SingleForward(inpnt, result, true);
+    return result;
+}
+
+void Bf16ForwardPipe::TowerConvolution(const int board_size,
+                                       ConvLayer &conv,
+                                       const BatchBuffer &input,
+                                       BatchBuffer &output,
+                                       std::vector<float> &workspace0,
+                                       std::vector<float> &workspace1,
+                                       const bool full_precision) {
+    if (full_precision || conv.GetBf16Weights().empty()) {
+        BlasForwardPipe::TowerConvolution(board_size, conv,
+                                          input, output,
+                                          workspace0, workspace1,
+                                          full_precision);
+        return;
+    }
+
+    if (weights_->winograd) {
+        WinogradConvolution3::ForwardBf16(board_size, conv.GetInputs(), conv.GetOutputs(),
+                                          input, conv.GetBf16Weights(),
+                                          workspace0, workspace1, output);
+        return;
+    }
+    for (auto b = size_t{0}; b < input.size(); ++b) {
+        Bf16Convolution::Forward(board_size, conv.GetFilter(),
+                                 conv.GetInputs(), conv.GetOutputs(),
+                                 input[b], conv.GetBf16Weights(), output[b]);
+    }
+}
+
+void Bf16ForwardPipe::HeadConvolution(const int board_size,
+                                      ConvLayer &conv,
+                                      const std::vector<float> &input,
+                                      std::vector<float> &output,
+                                      std::vector<float> &workspace,
+                                      const bool full_precision) {
+    if (full_precision || conv.GetBf16Weights().empty()) {
+        BlasForwardPipe::HeadConvolution(board_size, conv,
+                                         input, output,
+                                         workspace, full_precision);
+        return;
+    }
+
+    Bf16Convolution::Forward(board_size, conv.GetFilter(),
+                             conv.GetInputs(), conv.GetOutputs(),
+                             input, conv.GetBf16Weights(), output);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <memory>
+
+#include "neural/blas/blas_forward_pipe.h"
+#include "neural/description.h"
+
+// The CPU pipe which computes the residual tower and the head
+// extractors with the bfloat16 weights and activations. The other
+// layers are same as in the BlasForwardPipe.
+class Bf16ForwardPipe : public BlasForwardPipe {
+public:
+    virtual void Initialize(std::shared_ptr<DNNWeights> weights);
+
+    virtual bool ReducedPrecision();
+
+    virtual OutputResult ForwardFullPrecision(const InputData &inpnt);
+
+protected:
+    virtual void TowerConvolution(const int board_size,
+                                  ConvLayer &conv,
+                                  const BatchBuffer &input,
+                                  BatchBuffer &output,
+                                  std::vector<float> &workspace0,
+                                  std::vector<float> &workspace1,
+                                  const bool full_precision);
+
+    virtual void HeadConvolution(const int board_size,
+                                 ConvLayer &conv,
+                                 const std::vector<float> &input,
+                                 std::vector<float> &output,
+                                 std::vector<float> &workspace,
+                                 const bool full_precision);
+};
@@ -22,8 +22,18 @@ void Blas::ConvolutionSgemm(const int M, const int N, const int K,
                             const float *A, const int lda,
                             const float *B, const int ldb,
                             const float beta,
-                            float *C, const int ldc) {
+                            float *C, const int ldc,
+                            const float *packed_a) {
 #ifndef USE_BLAS
+    if (packed_a) {
+        Sgemm<false, false>::apply_packed(M, N, K,
+                                          alpha,
+                                          packed_a,
+                                          B, ldb,
+                                          beta,
+                                          C, ldc);
+        return;
+    }
     Sgemm<false, false>::apply(M, N, K,
                                alpha,
                                A, lda,
@@ -31,6 +41,7 @@ void Blas::ConvolutionSgemm(const int M, const int N, const int K,
                                beta,
                                C, ldc);
 #else
+    (void) packed_a;
 #ifdef USE_OPENBLAS
     cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
                 M, N, K,
@@ -62,9 +73,19 @@ void Blas::WinogradSgemm(const int offset_u, const int offset_v, const int offse
                          const float *A, const int lda,
                          const float *B, const int ldb,
                          const float beta,
-                         float *C, const int ldc) {
+                         float *C, const int ldc,
+                         const float *packed_a) {
 
 #ifndef USE_BLAS
+    if (packed_a) {
+        Sgemm<true, false>::apply_packed(M, N, K,
+                                         alpha,
+                                         packed_a,
+                                         B + offset_v, ldb,
+                                         beta,
+                                         C + offset_m, ldc);
+        return;
+    }
     Sgemm<true, false>::apply(M, N, K,
                               alpha,
                               A + offset_u, lda,
@@ -73,6 +94,7 @@ void Blas::WinogradSgemm(const int offset_u, const int offset_v, const int offse
                               C + offset_m, ldc);
 
 #else
+    (void) packed_a;
 #ifdef USE_OPENBLAS
     cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
                 M, N, K,
@@ -98,6 +120,28 @@ void Blas::WinogradSgemm(const int offset_u, const int offset_v, const int offse
 #endif
 }
 
+size_t Blas::GetPackedSize(const int M, const int K) {
+#ifndef USE_BLAS
+    return GetSgemmPackedSize(M, K);
+#else
+    (void) M;
+    (void) K;
+    return 0;
+#endif
+}
+
+void Blas::PackConvolutionA(const int M, const int K,
+                            const float *A, const int lda,
+                            float *packed) {
+    SgemmPackA<false>(M, K, A, lda, packed);
+}
+
+void Blas::PackWinogradA(const int M, const int K,
+                         const float *A, const int lda,
+                         float *packed) {
+    SgemmPackA<true>(M, K, A, lda, packed);
+}
+
 void Blas::DenseSgemm(const int input_size,
                       const int output_size,
                       const int batch_size,
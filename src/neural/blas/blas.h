@@ -24,7 +24,8 @@ public:
                                  const float *A, const int lda,
                                  const float *B, const int ldb,
                                  const float beta,
-                                 float *C, const int ldc);
+                                 float *C, const int ldc,
+                                 const float *packed_a = nullptr);
 
 
     // This is interface for Winograd. It is not the real general
@@ -35,7 +36,22 @@ public:
                               const float *A, const int lda,
                               const float *B, const int ldb,
                               const float beta,
-                              float *C, const int ldc);
+                              float *C, const int ldc,
+                              const float *packed_a = nullptr);
+
+    // Return the size of the packed A of the above interfaces. Return
+    // zero if the A should not be packed, e.g. the BLAS library packs
+    // it by itself. The packed A is given by the packed_a pointer, and
+    // the original A is not used then.
+    static size_t GetPackedSize(const int M, const int K);
+
+    static void PackConvolutionA(const int M, const int K,
+                                 const float *A, const int lda,
+                                 float *packed);
+
+    static void PackWinogradA(const int M, const int K,
+                              const float *A, const int lda,
+                              float *packed);
 
 
     // This is interface for fullyconnet. It is not the real general
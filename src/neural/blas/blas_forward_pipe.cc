@@ -6,13 +6,26 @@
 #include "neural/blas/biases.h"
 #include "neural/blas/winograd_convolution3.h"
 #include "neural/winograd_helper.h"
+#include "config.h"
+#include "utils/time.h"
+#include "utils/metrics.h"
 
 #include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <chrono>
 
 void BlasForwardPipe::Initialize(std::shared_ptr<DNNWeights> weights) {
     Load(weights);
     InitWinograd();
+    PackWeights();
+    WinogradConvolution3::SetIntraOpThreads(GetOption<int>("intra_op_threads"));
+
+    max_batch_ = std::max(GetOption<int>("cpu_batch_size"), 1);
+    if (max_batch_ > 1) {
+        batch_controller_.Reset(1000 * GetOption<int>("gpu_waittime"));
+        PrepareWorkers(); // Run the batch forwarding workers.
+    }
 }
 
 
@@ -43,79 +56,357 @@ void BlasForwardPipe::InitWinograd() {
     weights_->winograd_initialized = true;
 }
 
+// Return the packed weights for the GEMM, or null if the layer is not
+// packed.
+static const float *GetPackedWeights(ConvLayer &conv) {
+    const auto &packed = conv.GetPackedWeights();
+    return packed.empty() ? nullptr : packed.data();
+}
+
+void BlasForwardPipe::PackWeights() {
+    if (weights_ == nullptr ||
+            weights_->sgemm_packed) {
+        return;
+    }
+
+    // The tower convolutions are Winograd or im2col, and the heads
+    // are 1x1.
+    const auto pack_conv = [](ConvLayer &conv, const bool winograd) {
+        const int inputs = conv.GetInputs();
+        const int outputs = conv.GetOutputs();
+        const int filter_dim = inputs * conv.GetFilter() * conv.GetFilter();
+        auto &packed = conv.GetPackedWeights();
+
+        if (winograd) {
+            packed.resize(WinogradConvolution3::GetPackedSize(inputs, outputs));
+            if (!packed.empty()) {
+                WinogradConvolution3::PackWeights(inputs, outputs,
+                                                      conv.GetWeights(), packed.data());
+            }
+        } else {
+            packed.resize(Blas::GetPackedSize(outputs, filter_dim));
+            if (!packed.empty()) {
+                Blas::PackConvolutionA(outputs, filter_dim,
+                                           conv.GetWeights().data(), filter_dim,
+                                           packed.data());
+            }
+        }
+    };
+
+    const auto winograd = weights_->winograd;
+    pack_conv(weights_->input_conv, winograd);
+    for (auto &residual : weights_->tower) {
+        pack_conv(residual.conv1, winograd);
+        pack_conv(residual.conv2, winograd);
+    }
+    pack_conv(weights_->p_ex_conv, false);
+    pack_conv(weights_->prob_conv, false);
+    pack_conv(weights_->v_ex_conv, false);
+    pack_conv(weights_->v_ownership, false);
+
+    weights_->sgemm_packed = true;
+}
+
 void BlasForwardPipe::Load(std::shared_ptr<DNNWeights> weights) {
     weights_ = weights;
 }
 
 OutputResult BlasForwardPipe::Forward(const InputData &inpnts) {
+    if (worker_running_.load(std::memory_order_relaxed)) {
+        return ForwardAsync(inpnts).get();
+    }
+    auto result = OutputResult{};
+    SingleForward(inpnts, result);
+    return result;
+}
+
+std::future<OutputResult> BlasForwardPipe::ForwardAsync(const InputData &inpnts) {
+    if (!worker_running_.load(std::memory_order_relaxed)) {
+        auto promise = std::promise<OutputResult>{};
+        auto result = OutputResult{};
+        SingleForward(inpnts, result);
+        promise.set_value(result);
+        return promise.get_future();
+    }
+
+    auto entry = std::make_shared<ForwardEntry>(inpnts);
+    auto future = entry->promise.get_future();
+    auto queue_size = size_t{0};
+    {
+        // Push the entry.
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        entry_queue_.emplace_back(entry);
+        queue_size = entry_queue_.size();
+    }
+    batch_controller_.OnArrival();
+
+    if (queue_size == 1 || queue_size >= (size_t)max_batch_) {
+        // Wake up one worker if it is the first entry or there
+        // are enough batch size.
+        cv_.notify_one();
+    }
+
+    // The batch forwarding worker sets the result.
+    return future;
+}
 
+std::string BlasForwardPipe::GetStatsString() {
+    if (!worker_running_.load(std::memory_order_relaxed)) {
+        return std::string{};
+    }
+    return batch_controller_.GetStatsString();
+}
+
+float BlasForwardPipe::GetBatchFillRatio() {
+    if (!worker_running_.load(std::memory_order_relaxed)) {
+        return -1.f;
+    }
+    return batch_controller_.GetFillRatio();
+}
+
+void BlasForwardPipe::ResetStats() {
+    batch_controller_.ResetStats();
+}
+
+void BlasForwardPipe::TowerConvolution(const int board_size,
+                                       ConvLayer &conv,
+                                       const BatchBuffer &input,
+                                       BatchBuffer &output,
+                                       std::vector<float> &workspace0,
+                                       std::vector<float> &workspace1,
+                                       const bool) {
+    using Convolution3 = Convolution<3>;
+
+    const int input_channels = conv.GetInputs();
+    const int output_channels = conv.GetOutputs();
+
+    if (weights_->winograd) {
+        WinogradConvolution3::Forward(board_size, input_channels, output_channels,
+                                      input, conv.GetWeights(),
+                                      workspace0, workspace1, output,
+                                      GetPackedWeights(conv));
+    } else {
+        for (auto b = size_t{0}; b < input.size(); ++b) {
+            Convolution3::Forward(board_size, input_channels, output_channels,
+                                  input[b], conv.GetWeights(),
+                                  workspace0, output[b],
+                                  GetPackedWeights(conv));
+        }
+    }
+}
+
+void BlasForwardPipe::InputConvolution(const int board_size,
+                                       const BatchBuffer &planes,
+                                       BatchBuffer &output,
+                                       std::vector<float> &workspace0,
+                                       std::vector<float> &workspace1) {
     using Convolution3 = Convolution<3>;
-    using Convolution1 = Convolution<1>;
 
-    // Some useful information for network.
-    const auto board_size = inpnts.board_size;
-    const auto num_intersections = board_size * board_size;
     const auto output_channels = weights_->residual_channels;
+    auto &conv = weights_->input_conv;
+
+    if (weights_->winograd) {
+        WinogradConvolution3::Forward(board_size, kInputChannels, output_channels,
+                                      planes, conv.GetWeights(),
+                                      workspace0, workspace1, output,
+                                      GetPackedWeights(conv));
+    } else {
+        for (auto b = size_t{0}; b < planes.size(); ++b) {
+            Convolution3::Forward(board_size, kInputChannels, output_channels,
+                                  planes[b], conv.GetWeights(),
+                                  workspace0, output[b],
+                                  GetPackedWeights(conv));
+        }
+    }
+}
+
+void BlasForwardPipe::GetWorkspaceSizes(const int board_size, const int batch_size,
+                                        int &workspace0_size, int &workspace1_size) const {
+    using Convolution3 = Convolution<3>;
+
     const auto max_channels = std::max({kInputChannels,
-                                        output_channels,
+                                        weights_->residual_channels,
                                         weights_->policy_extract_channels,
                                         weights_->value_extract_channels});
-    const auto plane_size = kInputChannels * num_intersections;
-    const auto max_intermediates = std::max(weights_->policy_extract_channels,
-                                                weights_->value_extract_channels);
-
-    // Allocate the forward pipe buffers.
-    bool use_winograd = weights_->winograd;
-    int workspace0_size = 0;
-    int workspace1_size = 0;
-
-    if (use_winograd) {
+    if (weights_->winograd) {
         workspace0_size = 
             workspace1_size =
-            WinogradConvolution3::GetWorkspaceSize(board_size, max_channels);
+            WinogradConvolution3::GetWorkspaceSize(board_size, max_channels, batch_size);
     } else {
         workspace0_size = 
             Convolution3::GetWorkspaceSize(board_size, max_channels);
         workspace1_size = 1; // not used.
     }
-    auto workspace0 = std::vector<float>(workspace0_size);
-    auto workspace1 = std::vector<float>(workspace1_size);
-
-    auto conv_out = std::vector<float>(output_channels * num_intersections);
-    auto conv_in = std::vector<float>(output_channels * num_intersections);
-    auto res = std::vector<float>(output_channels * num_intersections);
-    auto intermediate = std::vector<float>(3 * max_intermediates);
-    auto pooling = std::vector<float>(3 * max_intermediates); 
-
-    // Copy input plane to buffer. 
-    auto planes = std::vector<float>(plane_size);
-    std::copy(std::begin(inpnts.planes),
-              std::begin(inpnts.planes) + plane_size,
-              std::begin(planes));
-
-    // Allocate the output buffers. 
-    auto output_prob = std::vector<float>(num_intersections);
-    auto output_pass = std::vector<float>(kOuputPassProbability);
-    auto output_ownership = std::vector<float>(num_intersections);
-    auto output_misc = std::vector<float>(kOuputValueMisc);
+}
+
+std::vector<OutputResult> BlasForwardPipe::ForwardKomis(const InputData &inpnt,
+                                                        const std::vector<float> &komis) {
+    const int batch_size = komis.size();
+    if (batch_size == 0) {
+        return std::vector<OutputResult>{};
+    }
+    const auto board_size = inpnt.board_size;
+    const auto num_intersections = board_size * board_size;
+    const auto conv_size = weights_->residual_channels * num_intersections;
+    const auto komi_begin = InputData::kKomiPlane * num_intersections;
+
+    // The board without the komi, and the planes of one komi point
+    // for black.
+    auto planes = BatchBuffer(2, std::vector<float>(kInputChannels * num_intersections, 0.f));
+    std::copy(std::begin(inpnt.planes),
+                  std::begin(inpnt.planes) + planes[0].size(),
+                  std::begin(planes[0]));
+    std::fill(std::begin(planes[0]) + komi_begin,
+                  std::begin(planes[0]) + komi_begin + 2 * num_intersections, 0.f);
+    std::fill(std::begin(planes[1]) + komi_begin,
+                  std::begin(planes[1]) + komi_begin + num_intersections, 1.f/20.f);
+    std::fill(std::begin(planes[1]) + komi_begin + num_intersections,
+                  std::begin(planes[1]) + komi_begin + 2 * num_intersections, -1.f/20.f);
+
+    auto parts = BatchBuffer(2, std::vector<float>(conv_size));
+    auto workspace0 = std::vector<float>{};
+    auto workspace1 = std::vector<float>{};
+    int workspace0_size, workspace1_size;
+    GetWorkspaceSizes(board_size, 2, workspace0_size, workspace1_size);
+    workspace0.resize(workspace0_size);
+    workspace1.resize(workspace1_size);
+    InputConvolution(board_size, planes, parts, workspace0, workspace1);
+
+    // Sum the parts for every komi.
+    auto inputs = std::vector<InputData>(batch_size, inpnt);
+    auto input_conv = BatchBuffer(batch_size, std::vector<float>(conv_size));
+    for (int b = 0; b < batch_size; ++b) {
+        inputs[b].SetKomi(komis[b]);
+        const auto stm_komi = inpnt.side_to_move == kWhite ? -komis[b] : komis[b];
+        for (int i = 0; i < conv_size; ++i) {
+            input_conv[b][i] = parts[0][i] + stm_komi * parts[1][i];
+        }
+    }
+
+    auto results = std::vector<OutputResult>(batch_size);
+    auto input_ptrs = std::vector<const InputData*>(batch_size);
+    auto result_ptrs = std::vector<OutputResult*>(batch_size);
+    for (int b = 0; b < batch_size; ++b) {
+        input_ptrs[b] = &inputs[b];
+        result_ptrs[b] = &results[b];
+    }
+    BatchForward(input_ptrs.data(), result_ptrs.data(), batch_size, false, &input_conv);
+    return results;
+}
+
+void BlasForwardPipe::HeadConvolution(const int board_size,
+                                      ConvLayer &conv,
+                                      const std::vector<float> &input,
+                                      std::vector<float> &output,
+                                      std::vector<float> &workspace,
+                                      const bool) {
+    Convolution<1>::Forward(board_size, conv.GetInputs(), conv.GetOutputs(),
+                            input, conv.GetWeights(),
+                            workspace, output,
+                            GetPackedWeights(conv));
+}
+
+// Resize the boards of the batch buffer. The planes of the removed
+// boards are kept in the spare, so they are reused by the next batch.
+static void ResizeBatch(std::vector<std::vector<float>> &buffer,
+                        std::vector<std::vector<float>> &spare,
+                        const int batch_size, const size_t plane_size) {
+    while ((int)buffer.size() > batch_size) {
+        spare.emplace_back(std::move(buffer.back()));
+        buffer.pop_back();
+    }
+    while ((int)buffer.size() < batch_size) {
+        if (spare.empty()) {
+            buffer.emplace_back();
+        } else {
+            buffer.emplace_back(std::move(spare.back()));
+            spare.pop_back();
+        }
+    }
+    for (auto &plane : buffer) {
+        plane.resize(plane_size);
+    }
+}
+
+void BlasForwardPipe::SingleForward(const InputData &inpnt,
+                                    OutputResult &result,
+                                    const bool full_precision) {
+    const InputData *input_ptr = &inpnt;
+    OutputResult *result_ptr = &result;
+    BatchForward(&input_ptr, &result_ptr, 1, full_precision);
+}
+
+void BlasForwardPipe::BatchForward(const InputData *const *inpnts,
+                                   OutputResult *const *results,
+                                   const int batch_size,
+                                   const bool full_precision,
+                                   const BatchBuffer *input_conv) {
+
+    using Convolution1 = Convolution<1>;
+
+    // Some useful information for network. All inputs must be
+    // in the same board size.
+    const auto board_size = inpnts[0]->board_size;
+    const auto num_intersections = board_size * board_size;
+    const auto output_channels = weights_->residual_channels;
+    const auto plane_size = kInputChannels * num_intersections;
+    const auto max_intermediates = std::max(weights_->policy_extract_channels,
+                                                weights_->value_extract_channels);
+
+    // Allocate the forward pipe buffers.
+    int workspace0_size = 0;
+    int workspace1_size = 0;
+    GetWorkspaceSizes(board_size, batch_size, workspace0_size, workspace1_size);
+
+    // The buffers of this thread. They keep their capacity, so the
+    // forwarding does not allocate after the first largest batch.
+    static thread_local Workspace buffers;
+    const auto conv_size = output_channels * num_intersections;
+
+    ResizeBatch(buffers.conv_out, buffers.spare, batch_size, conv_size);
+    ResizeBatch(buffers.conv_in, buffers.spare, batch_size, conv_size);
+    ResizeBatch(buffers.res, buffers.spare, batch_size, conv_size);
+    ResizeBatch(buffers.planes, buffers.spare, batch_size, plane_size);
+
+    auto &workspace0 = buffers.workspace0;
+    auto &workspace1 = buffers.workspace1;
+    auto &conv_out = buffers.conv_out;
+    auto &conv_in = buffers.conv_in;
+    auto &res = buffers.res;
+    auto &planes = buffers.planes;
+    auto &intermediate = buffers.intermediate;
+    auto &pooling = buffers.pooling;
+    auto &se_pooling = buffers.se_pooling;
+
+    workspace0.resize(workspace0_size);
+    workspace1.resize(workspace1_size);
+    intermediate.resize(3 * max_intermediates);
+    pooling.resize(3 * max_intermediates);
+    se_pooling.resize(3 * output_channels);
 
     // The input Layers.
-    if (use_winograd) {
-        WinogradConvolution3::Forward(board_size, kInputChannels, output_channels,
-                                      planes,
-                                      weights_->input_conv.GetWeights(),
-                                      workspace0, workspace1, conv_out);
+    if (input_conv) {
+        for (int b = 0; b < batch_size; ++b) {
+            std::copy(std::begin((*input_conv)[b]),
+                      std::end((*input_conv)[b]),
+                      std::begin(conv_out[b]));
+        }
     } else {
-        Convolution3::Forward(board_size, kInputChannels, output_channels,
-                              planes,
-                              weights_->input_conv.GetWeights(),
-                              workspace0, conv_out);
+        // Copy input plane to buffer. 
+        for (int b = 0; b < batch_size; ++b) {
+            std::copy(std::begin(inpnts[b]->planes),
+                      std::begin(inpnts[b]->planes) + plane_size,
+                      std::begin(planes[b]));
+        }
+        InputConvolution(board_size, planes, conv_out, workspace0, workspace1);
     }
 
-    Batchnorm::Forward(board_size, output_channels,
-                       conv_out,
-                       weights_->input_bn.GetMeans(),
-                       weights_->input_bn.GetStddevs());
+    for (int b = 0; b < batch_size; ++b) {
+        Batchnorm::Forward(board_size, output_channels,
+                           conv_out[b],
+                           weights_->input_bn.GetMeans(),
+                           weights_->input_bn.GetStddevs());
+    }
 
     // The residual tower.
     const auto residuals =  weights_->residual_blocks;
@@ -125,169 +416,340 @@ OutputResult BlasForwardPipe::Forward(const InputData &inpnts) {
         std::swap(conv_in, conv_out);
 
         // The first conv3.
-        if (use_winograd) {
-            WinogradConvolution3::Forward(board_size, tower_channels, tower_channels,
-                                          conv_in,
-                                          tower_ptr->conv1.GetWeights(),
-                                          workspace0, workspace1, conv_out);
-        } else {
-            Convolution3::Forward(board_size, tower_channels, tower_channels,
-                                  conv_in,
-                                  tower_ptr->conv1.GetWeights(),
-                                  workspace0, conv_out);
+        TowerConvolution(board_size, tower_ptr->conv1,
+                         conv_in, conv_out,
+                         workspace0, workspace1, full_precision);
+
+        for (int b = 0; b < batch_size; ++b) {
+            Batchnorm::Forward(board_size, tower_channels,
+                               conv_out[b],
+                               tower_ptr->bn1.GetMeans(),
+                               tower_ptr->bn1.GetStddevs());
         }
-        Batchnorm::Forward(board_size, tower_channels,
-                           conv_out,
-                           tower_ptr->bn1.GetMeans(),
-                           tower_ptr->bn1.GetStddevs());
 
         std::swap(conv_in, res);
         std::swap(conv_out, conv_in);
 
         // The second conv3.
-        if (use_winograd) {
-            WinogradConvolution3::Forward(board_size, tower_channels, tower_channels,
-                                          conv_in,
-                                          tower_ptr->conv2.GetWeights(),
-                                          workspace0, workspace1, conv_out);
-        } else {
-            Convolution3::Forward(board_size, tower_channels, tower_channels,
-                                  conv_in,
-                                  tower_ptr->conv2.GetWeights(),
-                                  workspace0, conv_out);
-        }
-
-        // The SE process.
-        if (tower_ptr->apply_se) {
-            Batchnorm::Forward(board_size, tower_channels,
-                               conv_out,
-                               tower_ptr->bn2.GetMeans(),
-                               tower_ptr->bn2.GetStddevs(),
-                               nullptr, false);
-
-            const size_t se_size = tower_ptr->se_size;
-            SEUnit::Forward(board_size, tower_channels, se_size,
-                            conv_out, res,
-                            tower_ptr->squeeze.GetWeights(),
-                            tower_ptr->squeeze.GetBiases(),
-                            tower_ptr->excite.GetWeights(),
-                            tower_ptr->excite.GetBiases());
-        
-        } else {
-             Batchnorm::Forward(board_size, tower_channels,
-                                conv_out,
-                                tower_ptr->bn2.GetMeans(),
-                                tower_ptr->bn2.GetStddevs(),
-                                res.data());
+        TowerConvolution(board_size, tower_ptr->conv2,
+                         conv_in, conv_out,
+                         workspace0, workspace1, full_precision);
+
+        for (int b = 0; b < batch_size; ++b) {
+            // The SE process.
+            if (tower_ptr->apply_se) {
+                // Pool the batchnorm outputs in the same pass.
+                GlobalPooling<false>::ForwardBatchnorm(board_size, tower_channels,
+                                                       conv_out[b],
+                                                       tower_ptr->bn2.GetMeans(),
+                                                       tower_ptr->bn2.GetStddevs(),
+                                                       se_pooling, false);
+
+                const size_t se_size = tower_ptr->se_size;
+                SEUnit::ForwardPooled(board_size, tower_channels, se_size,
+                                      conv_out[b], res[b], se_pooling,
+                                      tower_ptr->squeeze.GetWeights(),
+                                      tower_ptr->squeeze.GetBiases(),
+                                      tower_ptr->excite.GetWeights(),
+                                      tower_ptr->excite.GetBiases());
+            
+            } else {
+                 Batchnorm::Forward(board_size, tower_channels,
+                                    conv_out[b],
+                                    tower_ptr->bn2.GetMeans(),
+                                    tower_ptr->bn2.GetStddevs(),
+                                    res[b].data());
+            }
         }
     }
 
-    // The policy head.
+    // The output buffers. 
     const auto policy_extract_channels = weights_->policy_extract_channels;
-    auto policy_conv = std::vector<float>(policy_extract_channels * num_intersections);
+    const auto value_extract_channels = weights_->value_extract_channels;
 
-    Convolution1::Forward(board_size, output_channels, policy_extract_channels,
-                          conv_out,
-                          weights_->p_ex_conv.GetWeights(),
-                          workspace0, policy_conv);
+    auto &output_prob = buffers.output_prob;
+    auto &output_pass = buffers.output_pass;
+    auto &output_ownership = buffers.output_ownership;
+    auto &output_misc = buffers.output_misc;
+    auto &policy_conv = buffers.policy_conv;
+    auto &value_conv = buffers.value_conv;
+
+    output_prob.resize(num_intersections);
+    output_pass.resize(kOuputPassProbability);
+    output_ownership.resize(num_intersections);
+    output_misc.resize(kOuputValueMisc);
+    policy_conv.resize(policy_extract_channels * num_intersections);
+    value_conv.resize(value_extract_channels * num_intersections);
+
+    // The heads are small. Compute them board by board.
+    for (int b = 0; b < batch_size; ++b) {
+        // The policy head.
+        HeadConvolution(board_size, weights_->p_ex_conv,
+                        conv_out[b], policy_conv,
+                        workspace0, full_precision);
+
+        GlobalPooling<false>::ForwardBatchnorm(board_size, policy_extract_channels,
+                                               policy_conv,
+                                               weights_->p_ex_bn.GetMeans(),
+                                               weights_->p_ex_bn.GetStddevs(),
+                                               pooling);
+
+        FullyConnect::Forward(3 * policy_extract_channels, policy_extract_channels,
+                              pooling,
+                              weights_->p_inter_fc.GetWeights(),
+                              weights_->p_inter_fc.GetBiases(),
+                              intermediate, true);
+
+        AddSpatialBiases::Forward(board_size, policy_extract_channels,
+                                  policy_conv,
+                                  intermediate, false);    
+
+        // The policy outs.
+        Convolution1::Forward(board_size, policy_extract_channels, kOuputProbabilitiesChannels,
+                              policy_conv,
+                              weights_->prob_conv.GetWeights(),
+                              workspace0, output_prob,
+                              GetPackedWeights(weights_->prob_conv));
+
+        AddSpatialBiases::Forward(board_size, kOuputProbabilitiesChannels,
+                                  output_prob,
+                                  weights_->prob_conv.GetBiases(), false);
+
+        FullyConnect::Forward(policy_extract_channels, kOuputPassProbability,
+                              intermediate,
+                              weights_->pass_fc.GetWeights(),
+                              weights_->pass_fc.GetBiases(),
+                              output_pass, false);
+
+        // The value head. The policy only request skips it.
+        const auto need_value = inpnts[b]->need_value;
+        const auto need_ownership = need_value && inpnts[b]->need_ownership;
+        if (need_value) {
+            HeadConvolution(board_size, weights_->v_ex_conv,
+                            conv_out[b], value_conv,
+                            workspace0, full_precision);
+
+            GlobalPooling<true>::ForwardBatchnorm(board_size, value_extract_channels,
+                                                  value_conv,
+                                                  weights_->v_ex_bn.GetMeans(),
+                                                  weights_->v_ex_bn.GetStddevs(),
+                                                  pooling);
+
+            FullyConnect::Forward(3 * value_extract_channels, 3 * value_extract_channels,
+                                  pooling,
+                                  weights_->v_inter_fc.GetWeights(),
+                                  weights_->v_inter_fc.GetBiases(),
+                                  intermediate, true);
+
+            // The value outs. The ownership head is skipped if the
+            // search does not need it.
+            if (need_ownership) {
+                Convolution1::Forward(board_size, value_extract_channels, kOuputOwnershipChannels,
+                                      value_conv,
+                                      weights_->v_ownership.GetWeights(),
+                                      workspace0, output_ownership,
+                                      GetPackedWeights(weights_->v_ownership));
+
+                AddSpatialBiases::Forward(board_size, kOuputOwnershipChannels,
+                                          output_ownership,
+                                          weights_->v_ownership.GetBiases(), false);
+            }
+
+            FullyConnect::Forward(3 * value_extract_channels, kOuputValueMisc,
+                                  intermediate,
+                                  weights_->v_misc.GetWeights(),
+                                  weights_->v_misc.GetBiases(),
+                                  output_misc, false);
+        }
 
-    Batchnorm::Forward(board_size, policy_extract_channels,
-                       policy_conv,
-                       weights_->p_ex_bn.GetMeans(),
-                       weights_->p_ex_bn.GetStddevs());
+        // Now copy the result.
+        auto &result = *results[b];
+        if (!need_value) {
+            std::fill(std::begin(output_misc), std::end(output_misc), 0.f);
+        }
 
+        result.board_size = board_size;
+        result.komi = inpnts[b]->komi;
+        result.wdl[0] = output_misc[0];
+        result.wdl[1] = output_misc[1];
+        result.wdl[2] = output_misc[2];
+        result.stm_winrate = output_misc[3];
+        result.final_score = output_misc[4];
+        result.pass_probability = output_pass[0];
+        result.has_ownership = need_ownership;
+        result.has_value = need_value;
+
+        std::copy(std::begin(output_prob), std::end(output_prob), std::begin(result.probabilities));
+        if (need_ownership) {
+            std::copy(std::begin(output_ownership), std::end(output_ownership), std::begin(result.ownership));
+        } else {
+            std::fill(std::begin(result.ownership), std::end(result.ownership), 0.f);
+        }
+    }
+}
 
-    GlobalPooling<false>::Forward(board_size, policy_extract_channels,
-                                  policy_conv, pooling);
+bool BlasForwardPipe::Valid() {
+    return weights_ != nullptr;
+}
 
-    FullyConnect::Forward(3 * policy_extract_channels, policy_extract_channels,
-                          pooling,
-                          weights_->p_inter_fc.GetWeights(),
-                          weights_->p_inter_fc.GetBiases(),
-                          intermediate, true);
+void BlasForwardPipe::Release() {}
 
-    AddSpatialBiases::Forward(board_size, policy_extract_channels,
-                              policy_conv,
-                              intermediate, false);    
+void BlasForwardPipe::Destroy() {
+    QuitWorkers();
+}
 
-    // The policy outs.
-    Convolution1::Forward(board_size, policy_extract_channels, kOuputProbabilitiesChannels,
-                          policy_conv,
-                          weights_->prob_conv.GetWeights(),
-                          workspace0, output_prob);
+void BlasForwardPipe::Reload(int) {}
 
-    AddSpatialBiases::Forward(board_size, kOuputProbabilitiesChannels,
-                              output_prob,
-                              weights_->prob_conv.GetBiases(), false);
+void BlasForwardPipe::PrepareWorkers() {
+    auto num_workers = GetOption<int>("cpu_batch_workers");
+    if (num_workers <= 0) {
+        // Enough workers to keep all threads busy.
+        const auto threads = GetOption<int>("threads");
+        num_workers = (threads + max_batch_ - 1) / max_batch_;
+    }
+    num_workers = std::max(num_workers, 1);
 
-    FullyConnect::Forward(policy_extract_channels, kOuputPassProbability,
-                          intermediate,
-                          weights_->pass_fc.GetWeights(),
-                          weights_->pass_fc.GetBiases(),
-                          output_pass, false);
+    worker_running_.store(true);
+    if (workers_.empty()) {
+        for (int i = 0; i < num_workers; ++i) {
+            workers_.emplace_back([i, this](){ Worker(i); });
+        }
+    }
+}
 
-    // The value head.
-    const auto value_extract_channels = weights_->value_extract_channels;
-    auto value_conv = std::vector<float>(value_extract_channels * num_intersections);
-    
-    Convolution1::Forward(board_size, output_channels, value_extract_channels,
-                          conv_out,
-                          weights_->v_ex_conv.GetWeights(),
-                          workspace0, value_conv);
-
-    Batchnorm::Forward(board_size, value_extract_channels,
-                       value_conv,
-                       weights_->v_ex_bn.GetMeans(),
-                       weights_->v_ex_bn.GetStddevs());
-
-    GlobalPooling<true>::Forward(board_size, value_extract_channels,
-                                 value_conv, pooling);
-
-    FullyConnect::Forward(3 * value_extract_channels, 3 * value_extract_channels,
-                          pooling,
-                          weights_->v_inter_fc.GetWeights(),
-                          weights_->v_inter_fc.GetBiases(),
-                          intermediate, true);
-
-    // The value outs.
-    Convolution1::Forward(board_size, value_extract_channels, kOuputOwnershipChannels,
-                          value_conv,
-                          weights_->v_ownership.GetWeights(),
-                          workspace0, output_ownership);
-
-    AddSpatialBiases::Forward(board_size, kOuputOwnershipChannels,
-                              output_ownership,
-                              weights_->v_ownership.GetBiases(), false);
-
-    FullyConnect::Forward(3 * value_extract_channels, kOuputValueMisc,
-                          intermediate,
-                          weights_->v_misc.GetWeights(),
-                          weights_->v_misc.GetBiases(),
-                          output_misc, false);
-    // Now copy the result.
-    auto result = OutputResult{};
+void BlasForwardPipe::Worker(int worker) {
+    const auto waittime_base = GetOption<int>("gpu_waittime");
+    const int max_batch = max_batch_;
+
+    const auto gether_batches = [this, worker, waittime_base, max_batch](){
+        auto entries = std::vector<std::shared_ptr<ForwardEntry>>{};
+        auto timer = Timer{};
+        bool waiting = false;
+
+        // Running the loop until there are enough entry size or the
+        // controller decides to dispatch the current entries.
+        while(true) {
+            if (!worker_running_.load(std::memory_order_relaxed)) {
+                return entries;
+            }
+
+            const int queue_size = entry_queue_.size();
+            if (queue_size >= max_batch) {
+                break; // Finish the loop.
+            }
+
+            std::unique_lock<std::mutex> lock(worker_mutex_);
+            if (queue_size == 0) {
+                // Sleep until the first entry arrives.
+                cv_.wait_for(lock, std::chrono::milliseconds(std::max(waittime_base, 1)),
+                                 [this](){ return !entry_queue_.empty() ||
+                                                      !worker_running_.load(std::memory_order_relaxed); });
+                continue;
+            }
+
+            if (!waiting) {
+                timer.Clock();
+                waiting = true;
+            }
+            const int wait_us = batch_controller_.GetWaitMicroseconds(queue_size, max_batch) -
+                                    timer.GetDurationMicroseconds();
+            if (wait_us <= 0) {
+                break; // Finish the loop.
+            }
+            cv_.wait_for(lock, std::chrono::microseconds(wait_us),
+                             [this, max_batch](){ return !((int)entry_queue_.size() < max_batch) ||
+                                                             !worker_running_.load(std::memory_order_relaxed); });
+        }
 
-    result.board_size = board_size;
-    result.komi = inpnts.komi;
-    result.wdl[0] = output_misc[0];
-    result.wdl[1] = output_misc[1];
-    result.wdl[2] = output_misc[2];
-    result.stm_winrate = output_misc[3];
-    result.final_score = output_misc[4];
-    result.pass_probability = output_pass[0];
+        // Gather the entries.
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        auto count = entry_queue_.size();
+        if (count > (size_t)max_batch) {
+            count = max_batch;
+        }
 
-    std::copy(std::begin(output_prob), std::end(output_prob), std::begin(result.probabilities));
-    std::copy(std::begin(output_ownership), std::end(output_ownership), std::begin(result.ownership));
+        auto end = std::begin(entry_queue_);
+        std::advance(end, count);
+        std::move(std::begin(entry_queue_), end, std::back_inserter(entries));
+        entry_queue_.erase(std::begin(entry_queue_), end);
 
-    return result;
-}
+        batch_controller_.OnDispatch(entries.size(), max_batch,
+                                     waiting ? timer.GetDurationMicroseconds() : 0);
 
-bool BlasForwardPipe::Valid() {
-    return weights_ != nullptr;
-}
+        const auto now = std::chrono::steady_clock::now();
+        for (const auto &entry : entries) {
+            Metrics::AddQueueWait(std::chrono::duration_cast<std::chrono::microseconds>(
+                                      now - entry->pushed).count());
+        }
+        Metrics::AddBatch(worker, entries.size(), max_batch);
+        return entries;
+    };
+
+    // Reuse the batch lists of this worker.
+    auto group = std::vector<std::shared_ptr<ForwardEntry>>{};
+    auto remaining = std::vector<std::shared_ptr<ForwardEntry>>{};
+    auto inputs = std::vector<const InputData *>{};
+    auto outputs = std::vector<OutputResult>{};
+    auto output_ptrs = std::vector<OutputResult *>{};
+
+    while (true) {
+        if (!worker_running_.load(std::memory_order_relaxed)) {
+            return;
+        }
 
-void BlasForwardPipe::Release() {}
+        auto entries = gether_batches();
+        if (entries.empty()) {
+            continue;
+        }
 
-void BlasForwardPipe::Destroy() {}
+        // The batch forwarding needs the same board size. Compute
+        // every board size in its own batch. The entries own the
+        // inputs, so only their pointers are gathered.
+        while (!entries.empty()) {
+            const auto board_size = entries[0]->input.board_size;
+            group.clear();
+            remaining.clear();
+            for (auto &entry : entries) {
+                if (entry->input.board_size == board_size) {
+                    group.emplace_back(std::move(entry));
+                } else {
+                    remaining.emplace_back(std::move(entry));
+                }
+            }
+            std::swap(entries, remaining);
+
+            const int group_size = group.size();
+            inputs.resize(group_size);
+            outputs.resize(group_size);
+            output_ptrs.resize(group_size);
+            for (int b = 0; b < group_size; ++b) {
+                inputs[b] = &group[b]->input;
+                output_ptrs[b] = &outputs[b];
+            }
+
+            BatchForward(inputs.data(), output_ptrs.data(), group_size);
+            for (int b = 0; b < group_size; ++b) {
+                group[b]->promise.set_value(outputs[b]);
+            }
+        }
+    }
+}
 
-void BlasForwardPipe::Reload(int) {}
+void BlasForwardPipe::QuitWorkers() {
+    worker_running_.store(false);
+    cv_.notify_all();
+    for (auto &t : workers_) {
+        t.join();
+    }
+    workers_.clear();
+
+    // Compute the remaining entries so that no thread waits for
+    // them forever.
+    std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+    for (auto &entry : entry_queue_) {
+        auto result = OutputResult{};
+        SingleForward(entry->input, result);
+        entry->promise.set_value(result);
+    }
+    entry_queue_.clear();
+}
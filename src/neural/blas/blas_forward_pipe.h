@@ -1,8 +1,17 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <future>
+#include <string>
 
 #include "neural/network_basic.h"
+#include "neural/batch_controller.h"
 #include "neural/description.h"
 
 class BlasForwardPipe : public NetworkForwardPipe {
@@ -11,6 +20,20 @@ public:
 
     virtual OutputResult Forward(const InputData &inpnt);
 
+    virtual std::future<OutputResult> ForwardAsync(const InputData &inpnt);
+
+    // The komi only enters the input convolution, which is linear.
+    // Compute the board part and the komi part of it once, and the
+    // rest of the network of all komis in one batch.
+    virtual std::vector<OutputResult> ForwardKomis(const InputData &inpnt,
+                                                   const std::vector<float> &komis);
+
+    virtual std::string GetStatsString();
+
+    virtual float GetBatchFillRatio();
+
+    virtual void ResetStats();
+
     virtual bool Valid();
 
     virtual void Load(std::shared_ptr<DNNWeights> weights);
@@ -21,8 +44,114 @@ public:
 
     virtual void Destroy();
 
+protected:
+    using BatchBuffer = std::vector<std::vector<float>>;
+
+    // Compute the 3x3 convolution of the residual tower for all
+    // boards.
+    virtual void TowerConvolution(const int board_size,
+                                  ConvLayer &conv,
+                                  const BatchBuffer &input,
+                                  BatchBuffer &output,
+                                  std::vector<float> &workspace0,
+                                  std::vector<float> &workspace1,
+                                  const bool full_precision);
+
+    // Compute the 1x1 convolution of the head extractor for one
+    // board.
+    virtual void HeadConvolution(const int board_size,
+                                 ConvLayer &conv,
+                                 const std::vector<float> &input,
+                                 std::vector<float> &output,
+                                 std::vector<float> &workspace,
+                                 const bool full_precision);
+
+    // Compute the batch of inputs at once and write the outputs into
+    // the results. All inputs must be in the same board size. If the
+    // input convolution outputs are given, the planes are not used.
+    void BatchForward(const InputData *const *inpnts,
+                      OutputResult *const *results,
+                      const int batch_size,
+                      const bool full_precision = false,
+                      const BatchBuffer *input_conv = nullptr);
+
+    void SingleForward(const InputData &inpnt,
+                       OutputResult &result,
+                       const bool full_precision = false);
+
+    std::shared_ptr<DNNWeights> weights_{nullptr};
+
 private:
+    // The forwarding buffers of one thread.
+    struct Workspace {
+        std::vector<float> workspace0;
+        std::vector<float> workspace1;
+
+        BatchBuffer planes;
+        BatchBuffer conv_in;
+        BatchBuffer conv_out;
+        BatchBuffer res;
+
+        // The planes of the boards which are not in current batch.
+        BatchBuffer spare;
+
+        std::vector<float> intermediate;
+        std::vector<float> pooling;
+        std::vector<float> se_pooling;
+
+        std::vector<float> policy_conv;
+        std::vector<float> value_conv;
+        std::vector<float> output_prob;
+        std::vector<float> output_pass;
+        std::vector<float> output_ownership;
+        std::vector<float> output_misc;
+    };
+
+    struct ForwardEntry {
+        InputData input;
+        std::promise<OutputResult> promise;
+
+        // When it is pushed into the queue.
+        std::chrono::steady_clock::time_point pushed;
+
+        ForwardEntry(const InputData &in)
+            : input(in), pushed(std::chrono::steady_clock::now()) {}
+    };
+
+    // Compute the input convolution of all boards, before the
+    // batchnorm.
+    void InputConvolution(const int board_size,
+                          const BatchBuffer &planes,
+                          BatchBuffer &output,
+                          std::vector<float> &workspace0,
+                          std::vector<float> &workspace1);
+
+    // The workspace sizes of the 3x3 convolution of the batch.
+    void GetWorkspaceSizes(const int board_size, const int batch_size,
+                           int &workspace0_size, int &workspace1_size) const;
+
     void InitWinograd();
 
-    std::shared_ptr<DNNWeights> weights_{nullptr};
+    // Pack the convolution weights for the GEMM. Call it after
+    // InitWinograd().
+    void PackWeights();
+
+    void PrepareWorkers();
+    void Worker(int worker);
+    void QuitWorkers();
+
+    std::list<std::shared_ptr<ForwardEntry>> entry_queue_;
+    std::mutex worker_mutex_;
+    std::mutex queue_mutex_;
+
+    std::condition_variable cv_;
+
+    std::atomic<bool> worker_running_{false};
+
+    // Decide how long the workers wait for the entries.
+    BatchController batch_controller_;
+
+    std::vector<std::thread> workers_;
+
+    int max_batch_{1};
 };
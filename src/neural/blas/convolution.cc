@@ -7,7 +7,8 @@ void Convolution<1>::Forward(const size_t board_size,
                              const std::vector<float> &input,
                              const std::vector<float> &weights,
                              std::vector<float> &/* col */,
-                             std::vector<float> &output) {
+                             std::vector<float> &output,
+                             const float *packed_weights) {
     const unsigned int width = board_size;
     const unsigned int height = board_size;
     const unsigned int spatial_size = width * height;
@@ -22,7 +23,8 @@ void Convolution<1>::Forward(const size_t board_size,
                            (int)spatial_size,
                            0.0f,
                            output.data(),
-                           (int)spatial_size);
+                           (int)spatial_size,
+                           packed_weights);
 }
 
 template<>
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <cstddef>
 #include <cassert>
 #include "neural/blas/blas.h"
 
@@ -14,7 +15,8 @@ public:
                         const std::vector<float> &input,
                         const std::vector<float> &weights,
                         std::vector<float> &col,
-                        std::vector<float> &output);
+                        std::vector<float> &output,
+                        const float *packed_weights = nullptr);
 
     static size_t GetWorkspaceSize(const size_t board_size, const size_t input_channels);
 
@@ -33,7 +35,8 @@ void Convolution<FILTERS>::Forward(const size_t board_size,
                                    const std::vector<float> &input,
                                    const std::vector<float> &weights,
                                    std::vector<float> &col,
-                                   std::vector<float> &output) {
+                                   std::vector<float> &output,
+                                   const float *packed_weights) {
     constexpr unsigned int filter_size = FILTERS;
     const unsigned int width = board_size;
     const unsigned int height = board_size;
@@ -65,7 +68,8 @@ void Convolution<FILTERS>::Forward(const size_t board_size,
                            (int)spatial_size,
                            0.0f,
                            output.data(),
-                           (int)spatial_size);
+                           (int)spatial_size,
+                           packed_weights);
 }
 
 template<unsigned int FILTERS>
@@ -0,0 +1,241 @@
+#include "neural/blas/int8_convolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define INT8_KERNEL_VNNI
+#include <immintrin.h>
+#endif
+
+constexpr int kFilterSize = 3;
+constexpr int kFilterLen = kFilterSize * kFilterSize;
+
+// Every int32 lane accumulates four products at once.
+constexpr int kDepth = 4;
+
+// The columns are padded to a multiple of this value.
+constexpr int kColumnBlock = 16;
+
+using DotKernel = void (*)(const int outputs,
+                           const int depth,
+                           const int columns,
+                           const std::int8_t *weights,
+                           const std::uint8_t *col,
+                           std::int32_t *acc);
+
+// weights: [outputs, depth * kDepth]
+// col:     [depth, columns, kDepth]
+// acc:     [outputs, columns]
+static void DotKernelScalar(const int outputs,
+                            const int depth,
+                            const int columns,
+                            const std::int8_t *weights,
+                            const std::uint8_t *col,
+                            std::int32_t *acc) {
+    for (int o = 0; o < outputs; ++o) {
+        std::int32_t *acc_row = acc + o * columns;
+        std::fill(acc_row, acc_row + columns, 0);
+
+        for (int d = 0; d < depth; ++d) {
+            const std::int8_t *w = weights + (o * depth + d) * kDepth;
+            const std::uint8_t *c = col + d * columns * kDepth;
+            for (int n = 0; n < columns; ++n) {
+                acc_row[n] += w[0] * c[n * kDepth + 0] +
+                                  w[1] * c[n * kDepth + 1] +
+                                  w[2] * c[n * kDepth + 2] +
+                                  w[3] * c[n * kDepth + 3];
+            }
+        }
+    }
+}
+
+#ifdef INT8_KERNEL_VNNI
+__attribute__((target("avx512f,avx512vnni")))
+static void DotKernelVnni(const int outputs,
+                          const int depth,
+                          const int columns,
+                          const std::int8_t *weights,
+                          const std::uint8_t *col,
+                          std::int32_t *acc) {
+    // Compute four output channels at once so that they share the
+    // loaded inputs.
+    constexpr int kOutputBlock = 4;
+
+    int o = 0;
+    for (; o + kOutputBlock <= outputs; o += kOutputBlock) {
+        const std::int32_t *w0 = reinterpret_cast<const std::int32_t *>(weights + (o + 0) * depth * kDepth);
+        const std::int32_t *w1 = reinterpret_cast<const std::int32_t *>(weights + (o + 1) * depth * kDepth);
+        const std::int32_t *w2 = reinterpret_cast<const std::int32_t *>(weights + (o + 2) * depth * kDepth);
+        const std::int32_t *w3 = reinterpret_cast<const std::int32_t *>(weights + (o + 3) * depth * kDepth);
+
+        int n = 0;
+        for (; n + 2 * kColumnBlock <= columns; n += 2 * kColumnBlock) {
+            // Two column blocks at once hide the latency of the dot
+            // products.
+            __m512i acc00 = _mm512_setzero_si512(), acc01 = _mm512_setzero_si512();
+            __m512i acc10 = _mm512_setzero_si512(), acc11 = _mm512_setzero_si512();
+            __m512i acc20 = _mm512_setzero_si512(), acc21 = _mm512_setzero_si512();
+            __m512i acc30 = _mm512_setzero_si512(), acc31 = _mm512_setzero_si512();
+
+            for (int d = 0; d < depth; ++d) {
+                const std::uint8_t *c = col + (d * columns + n) * kDepth;
+                const __m512i in0 = _mm512_loadu_si512(c);
+                const __m512i in1 = _mm512_loadu_si512(c + kColumnBlock * kDepth);
+                const __m512i wv0 = _mm512_set1_epi32(w0[d]);
+                const __m512i wv1 = _mm512_set1_epi32(w1[d]);
+                const __m512i wv2 = _mm512_set1_epi32(w2[d]);
+                const __m512i wv3 = _mm512_set1_epi32(w3[d]);
+                acc00 = _mm512_dpbusd_epi32(acc00, in0, wv0);
+                acc01 = _mm512_dpbusd_epi32(acc01, in1, wv0);
+                acc10 = _mm512_dpbusd_epi32(acc10, in0, wv1);
+                acc11 = _mm512_dpbusd_epi32(acc11, in1, wv1);
+                acc20 = _mm512_dpbusd_epi32(acc20, in0, wv2);
+                acc21 = _mm512_dpbusd_epi32(acc21, in1, wv2);
+                acc30 = _mm512_dpbusd_epi32(acc30, in0, wv3);
+                acc31 = _mm512_dpbusd_epi32(acc31, in1, wv3);
+            }
+            _mm512_storeu_si512(acc + (o + 0) * columns + n, acc00);
+            _mm512_storeu_si512(acc + (o + 0) * columns + n + kColumnBlock, acc01);
+            _mm512_storeu_si512(acc + (o + 1) * columns + n, acc10);
+            _mm512_storeu_si512(acc + (o + 1) * columns + n + kColumnBlock, acc11);
+            _mm512_storeu_si512(acc + (o + 2) * columns + n, acc20);
+            _mm512_storeu_si512(acc + (o + 2) * columns + n + kColumnBlock, acc21);
+            _mm512_storeu_si512(acc + (o + 3) * columns + n, acc30);
+            _mm512_storeu_si512(acc + (o + 3) * columns + n + kColumnBlock, acc31);
+        }
+        for (; n < columns; n += kColumnBlock) {
+            __m512i acc0 = _mm512_setzero_si512();
+            __m512i acc1 = _mm512_setzero_si512();
+            __m512i acc2 = _mm512_setzero_si512();
+            __m512i acc3 = _mm512_setzero_si512();
+
+            for (int d = 0; d < depth; ++d) {
+                const __m512i in = _mm512_loadu_si512(col + (d * columns + n) * kDepth);
+                acc0 = _mm512_dpbusd_epi32(acc0, in, _mm512_set1_epi32(w0[d]));
+                acc1 = _mm512_dpbusd_epi32(acc1, in, _mm512_set1_epi32(w1[d]));
+                acc2 = _mm512_dpbusd_epi32(acc2, in, _mm512_set1_epi32(w2[d]));
+                acc3 = _mm512_dpbusd_epi32(acc3, in, _mm512_set1_epi32(w3[d]));
+            }
+            _mm512_storeu_si512(acc + (o + 0) * columns + n, acc0);
+            _mm512_storeu_si512(acc + (o + 1) * columns + n, acc1);
+            _mm512_storeu_si512(acc + (o + 2) * columns + n, acc2);
+            _mm512_storeu_si512(acc + (o + 3) * columns + n, acc3);
+        }
+    }
+
+    if (o < outputs) {
+        DotKernelScalar(outputs - o, depth, columns,
+                        weights + o * depth * kDepth, col, acc + o * columns);
+    }
+}
+#endif
+
+static DotKernel ChooseKernel() {
+#ifdef INT8_KERNEL_VNNI
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+            __builtin_cpu_supports("avx512vnni")) {
+        return DotKernelVnni;
+    }
+#endif
+    return DotKernelScalar;
+}
+
+static const DotKernel kDotKernel = ChooseKernel();
+
+std::string Int8Convolution3::GetName() {
+#ifdef INT8_KERNEL_VNNI
+    if (kDotKernel == DotKernelVnni) {
+        return "avx512-vnni";
+    }
+#endif
+    return "scalar";
+}
+
+float Int8Convolution3::Im2col(const int board_size,
+                               const int channels,
+                               const std::vector<float> &input,
+                               std::vector<std::uint8_t> &col) {
+    static thread_local std::vector<std::uint8_t> padded;
+
+    const int width = board_size;
+    const int height = board_size;
+    const int spatial_size = width * height;
+    const int columns = (spatial_size + kColumnBlock - 1) / kColumnBlock * kColumnBlock;
+    const int filter_dim = channels * kFilterLen;
+    const int depth = (filter_dim + kDepth - 1) / kDepth;
+
+    const int padded_width = width + 2;
+    const int padded_area = padded_width * (height + 2);
+
+    auto max_value = 0.f;
+    for (int idx = 0; idx < channels * spatial_size; ++idx) {
+        max_value = std::max(max_value, input[idx]);
+    }
+    const auto scale = max_value > 0.f ? max_value / 255.f : 1.f;
+    const auto inv_scale = 1.f / scale;
+
+    // Quantize the inputs once into the zero padded planes.
+    padded.assign(channels * padded_area, 0);
+    for (int c = 0; c < channels; ++c) {
+        const float *plane = input.data() + c * spatial_size;
+        std::uint8_t *dst = padded.data() + c * padded_area + padded_width + 1;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const auto v = std::round(plane[y * width + x] * inv_scale);
+                dst[y * padded_width + x] =
+                    static_cast<std::uint8_t>(std::max(0.f, std::min(255.f, v)));
+            }
+        }
+    }
+
+    // The padded depth meets the zero weights and the padded columns
+    // are never read, so they need not be cleared.
+    col.resize(depth * columns * kDepth);
+
+    for (int k = 0; k < filter_dim; ++k) {
+        const int c = k / kFilterLen;
+        const int fy = (k % kFilterLen) / kFilterSize;
+        const int fx = k % kFilterSize;
+        const std::uint8_t *src = padded.data() + c * padded_area + fy * padded_width + fx;
+        std::uint8_t *dst = col.data() + (k / kDepth) * columns * kDepth + k % kDepth;
+
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                dst[(y * width + x) * kDepth] = src[y * padded_width + x];
+            }
+        }
+    }
+    return scale;
+}
+
+void Int8Convolution3::Forward(const size_t board_size,
+                               const size_t input_channels,
+                               const size_t output_channels,
+                               const std::vector<float> &input,
+                               const std::vector<std::int8_t> &weights,
+                               const std::vector<float> &scales,
+                               std::vector<float> &output) {
+    static thread_local std::vector<std::uint8_t> col;
+    static thread_local std::vector<std::int32_t> acc;
+
+    const int spatial_size = board_size * board_size;
+    const int columns = (spatial_size + kColumnBlock - 1) / kColumnBlock * kColumnBlock;
+    const int depth = (input_channels * kFilterLen + kDepth - 1) / kDepth;
+
+    const auto input_scale = Im2col(board_size, input_channels, input, col);
+
+    acc.resize(output_channels * columns);
+    kDotKernel(output_channels, depth, columns,
+               weights.data(), col.data(), acc.data());
+
+    for (int o = 0; o < (int)output_channels; ++o) {
+        const auto scale = scales[o] * input_scale;
+        const std::int32_t *acc_row = acc.data() + o * columns;
+        float *out_row = output.data() + o * spatial_size;
+        for (int n = 0; n < spatial_size; ++n) {
+            out_row[n] = scale * acc_row[n];
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The 3x3 convolution with the INT8 weights and the UINT8 activations.
+// The inputs must be positive, like the outputs of ReLU. The inputs
+// are quantized with one scale per board and the weights with one
+// scale per output channel. The products are accumulated in int32.
+class Int8Convolution3 {
+public:
+    Int8Convolution3() = delete;
+
+    static void Forward(const size_t board_size,
+                        const size_t input_channels,
+                        const size_t output_channels,
+                        const std::vector<float> &input,
+                        const std::vector<std::int8_t> &weights,
+                        const std::vector<float> &scales,
+                        std::vector<float> &output);
+
+    // Return the name of the dot product kernel selected for this CPU.
+    static std::string GetName();
+
+private:
+    // Quantize the inputs and rearrange them into the [K/4, N, 4]
+    // layout. Return the scale of inputs.
+    static float Im2col(const int board_size,
+                        const int channels,
+                        const std::vector<float> &input,
+                        std::vector<std::uint8_t> &col);
+};
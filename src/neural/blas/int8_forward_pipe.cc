@@ -0,0 +1,40 @@
+#include "neural/blas/int8_forward_pipe.h"
+#include "neural/blas/int8_convolution.h"
+#include "utils/log.h"
+
+void Int8ForwardPipe::Initialize(std::shared_ptr<DNNWeights> weights) {
+    LOGGING << "INT8 Core:" << ' ' << Int8Convolution3::GetName() << std::endl;
+    BlasForwardPipe::Initialize(weights);
+}
+
+bool Int8ForwardPipe::ReducedPrecision() {
+    return true;
+}
+
+OutputResult Int8ForwardPipe::ForwardFullPrecision(const InputData &inpnt) {
+    auto result = OutputResult{};
+    SingleForward(inpnt, result, true);
+    return result;
+}
+
+void Int8ForwardPipe::TowerConvolution(const int board_size,
+                                       ConvLayer &conv,
+                                       const BatchBuffer &input,
+                                       BatchBuffer &output,
+                                       std::vector<float> &workspace0,
+                                       std::vector<float> &workspace1,
+                                       const bool full_precision) {
+    if (full_precision || conv.GetInt8Weights().empty()) {
+        BlasForwardPipe::TowerConvolution(board_size, conv,
+                                          input, output,
+                                          workspace0, workspace1,
+                                          full_precision);
+        return;
+    }
+
+    for (auto b = size_t{0}; b < input.size(); ++b) {
+        Int8Convolution3::Forward(board_size, conv.GetInputs(), conv.GetOutputs(),
+                                  input[b], conv.GetInt8Weights(),
+                                  conv.GetInt8Scales(), output[b]);
+    }
+}
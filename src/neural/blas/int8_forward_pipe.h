@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+
+#include "neural/blas/blas_forward_pipe.h"
+#include "neural/description.h"
+
+// The CPU pipe which computes the residual tower with the INT8
+// weights and activations. The other layers are same as in the
+// BlasForwardPipe.
+class Int8ForwardPipe : public BlasForwardPipe {
+public:
+    virtual void Initialize(std::shared_ptr<DNNWeights> weights);
+
+    virtual bool ReducedPrecision();
+
+    virtual OutputResult ForwardFullPrecision(const InputData &inpnt);
+
+protected:
+    virtual void TowerConvolution(const int board_size,
+                                  ConvLayer &conv,
+                                  const BatchBuffer &input,
+                                  BatchBuffer &output,
+                                  std::vector<float> &workspace0,
+                                  std::vector<float> &workspace1,
+                                  const bool full_precision);
+};
@@ -1,6 +1,7 @@
 #include "neural/blas/se_unit.h"
 #include "neural/blas/fullyconnect.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cassert>
 
@@ -65,6 +66,58 @@ void GlobalPooling<true>::Forward(const size_t board_size,
     }
 }
 
+template<bool kIsValueHead>
+void GlobalPooling<kIsValueHead>::ForwardBatchnorm(const size_t board_size,
+                                                   const size_t channels,
+                                                   std::vector<float> &input,
+                                                   const std::vector<float> &means,
+                                                   const std::vector<float> &stddevs,
+                                                   std::vector<float> &output,
+                                                   const bool ReLU) {
+    const auto width = board_size;
+    const auto height = board_size;
+    const auto spatial_size = width * height;
+    float *input_ptr = input.data();
+
+    const float b_diff = (float)board_size - kAvgBSize;
+    const float b_coeff0 = b_diff / 10.f;
+    const float b_coeff1 = b_diff * b_diff / 100.f - kBSizeVaraince;
+
+    for (auto c = size_t{0}; c < channels; ++c) {
+        const auto mean = means[c];
+        const auto scale_stddev = stddevs[c];
+
+        float sum = 0.0f;
+        float max = -5000.0f; // crazy negative value
+        for (auto b = size_t{0}; b < spatial_size; ++b) {
+            float val = scale_stddev * (*input_ptr - mean);
+            if (ReLU && val < 0.0f) {
+                val = 0.0f;
+            }
+            *input_ptr = val;
+
+            sum += val;
+            max = std::max(val, max);
+
+            input_ptr++;
+        }
+
+        const float avg = sum / (float)spatial_size;
+        output[c + 0 * channels] = avg;
+        output[c + 1 * channels] = avg * b_coeff0;
+        output[c + 2 * channels] = kIsValueHead ? avg * b_coeff1 : max;
+    }
+}
+
+template void GlobalPooling<false>::ForwardBatchnorm(
+    const size_t, const size_t, std::vector<float> &,
+    const std::vector<float> &, const std::vector<float> &,
+    std::vector<float> &, const bool);
+template void GlobalPooling<true>::ForwardBatchnorm(
+    const size_t, const size_t, std::vector<float> &,
+    const std::vector<float> &, const std::vector<float> &,
+    std::vector<float> &, const bool);
+
 void SEUnit::Forward(const size_t board_size,
                      const size_t channels,
                      const size_t se_size,
@@ -76,12 +129,28 @@ void SEUnit::Forward(const size_t board_size,
                      const std::vector<float> &weights_b2) {
     using pooling = GlobalPooling<false>;
     auto pool = std::vector<float>(3 * channels);
-    auto fc_out = std::vector<float>(se_size);
 
     pooling::Forward(board_size, channels, input, pool);
+    ForwardPooled(board_size, channels, se_size, input, residual, pool,
+                  weights_w1, weights_b1, weights_w2, weights_b2);
+}
+
+void SEUnit::ForwardPooled(const size_t board_size,
+                           const size_t channels,
+                           const size_t se_size,
+                           std::vector<float> &input,
+                           const std::vector<float> &residual,
+                           const std::vector<float> &pool,
+                           const std::vector<float> &weights_w1,
+                           const std::vector<float> &weights_b1,
+                           const std::vector<float> &weights_w2,
+                           const std::vector<float> &weights_b2) {
+    auto fc_out = std::vector<float>(se_size);
+    auto scale = std::vector<float>(2 * channels);
+
     FullyConnect::Forward(3*channels, se_size, pool, weights_w1, weights_b1, fc_out, true);
-    FullyConnect::Forward(se_size, 2*channels, fc_out, weights_w2, weights_b2, pool, false);
-    SEProcess(board_size, channels, input, residual, pool);
+    FullyConnect::Forward(se_size, 2*channels, fc_out, weights_w2, weights_b2, scale, false);
+    SEProcess(board_size, channels, input, residual, scale);
 }
 
 void SEUnit::SEProcess(const size_t board_size,
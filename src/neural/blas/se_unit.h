@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <cstddef>
 
 template<bool kIsValueHead>
 class GlobalPooling {
@@ -11,6 +12,16 @@ public:
                         const std::vector<float> &input,
                         std::vector<float> &output);
 
+    // Apply the batchnorm to the input and pool the results in the
+    // same pass, so the input is read only once.
+    static void ForwardBatchnorm(const size_t board_size,
+                                 const size_t channels,
+                                 std::vector<float> &input,
+                                 const std::vector<float> &means,
+                                 const std::vector<float> &stddevs,
+                                 std::vector<float> &output,
+                                 const bool ReLU = true);
+
 private:
     static constexpr size_t kMaxBSize = 19;
     static constexpr size_t kMinBSize = 9;
@@ -31,6 +42,19 @@ public:
                         const std::vector<float> &weights_w2,
                         const std::vector<float> &weights_b2);
 
+    // Same as Forward(), but the pooling of the input is already done,
+    // e.g. by GlobalPooling<false>::ForwardBatchnorm().
+    static void ForwardPooled(const size_t board_size,
+                              const size_t channels,
+                              const size_t se_size,
+                              std::vector<float> &input,
+                              const std::vector<float> &residual,
+                              const std::vector<float> &pool,
+                              const std::vector<float> &weights_w1,
+                              const std::vector<float> &weights_b1,
+                              const std::vector<float> &weights_w2,
+                              const std::vector<float> &weights_b2);
+
 private:
     static void SEProcess(const size_t board_size,
                           const size_t channels,
@@ -1,5 +1,266 @@
 #include "neural/blas/sgemm.h"
 
+#include <algorithm>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SGEMM_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+// The blocked SGEMM. The matrices are packed into the panels, so that
+// the micro kernel always reads the contiguous memory. The micro kernel
+// computes one kMR x kNR block of C in the registers.
+constexpr int kMR = 6;
+constexpr int kNR = 16;
+
+// The block sizes of the packed panels. The packed A block is kept in
+// the L2 cache and one packed B panel is kept in the L1 cache.
+constexpr int kMC = 120;
+constexpr int kKC = 256;
+constexpr int kNC = 2048;
+
+// The small problems are faster without packing.
+constexpr int kMinBlockedSize = 16 * 16 * 16;
+
+using MicroKernel = void (*)(const int kc,
+                             const float *a_panel,
+                             const float *b_panel,
+                             float *acc);
+
+// The acc is a kMR x kNR row major block.
+static void MicroKernelScalar(const int kc,
+                              const float *a_panel,
+                              const float *b_panel,
+                              float *acc) {
+    float c[kMR * kNR] = {0.f};
+    for (int k = 0; k < kc; ++k) {
+        const float *a = a_panel + k * kMR;
+        const float *b = b_panel + k * kNR;
+        for (int i = 0; i < kMR; ++i) {
+            const float a_val = a[i];
+            for (int j = 0; j < kNR; ++j) {
+                c[i * kNR + j] += a_val * b[j];
+            }
+        }
+    }
+    std::copy(c, c + kMR * kNR, acc);
+}
+
+#ifdef SGEMM_KERNEL_X86
+__attribute__((target("avx2,fma")))
+static void MicroKernelAvx2(const int kc,
+                            const float *a_panel,
+                            const float *b_panel,
+                            float *acc) {
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+    for (int k = 0; k < kc; ++k) {
+        const float *a = a_panel + k * kMR;
+        const __m256 b0 = _mm256_loadu_ps(b_panel + k * kNR);
+        const __m256 b1 = _mm256_loadu_ps(b_panel + k * kNR + 8);
+        __m256 a_val;
+
+        a_val = _mm256_broadcast_ss(a + 0);
+        c00 = _mm256_fmadd_ps(a_val, b0, c00);
+        c01 = _mm256_fmadd_ps(a_val, b1, c01);
+        a_val = _mm256_broadcast_ss(a + 1);
+        c10 = _mm256_fmadd_ps(a_val, b0, c10);
+        c11 = _mm256_fmadd_ps(a_val, b1, c11);
+        a_val = _mm256_broadcast_ss(a + 2);
+        c20 = _mm256_fmadd_ps(a_val, b0, c20);
+        c21 = _mm256_fmadd_ps(a_val, b1, c21);
+        a_val = _mm256_broadcast_ss(a + 3);
+        c30 = _mm256_fmadd_ps(a_val, b0, c30);
+        c31 = _mm256_fmadd_ps(a_val, b1, c31);
+        a_val = _mm256_broadcast_ss(a + 4);
+        c40 = _mm256_fmadd_ps(a_val, b0, c40);
+        c41 = _mm256_fmadd_ps(a_val, b1, c41);
+        a_val = _mm256_broadcast_ss(a + 5);
+        c50 = _mm256_fmadd_ps(a_val, b0, c50);
+        c51 = _mm256_fmadd_ps(a_val, b1, c51);
+    }
+
+    _mm256_storeu_ps(acc + 0 * kNR, c00); _mm256_storeu_ps(acc + 0 * kNR + 8, c01);
+    _mm256_storeu_ps(acc + 1 * kNR, c10); _mm256_storeu_ps(acc + 1 * kNR + 8, c11);
+    _mm256_storeu_ps(acc + 2 * kNR, c20); _mm256_storeu_ps(acc + 2 * kNR + 8, c21);
+    _mm256_storeu_ps(acc + 3 * kNR, c30); _mm256_storeu_ps(acc + 3 * kNR + 8, c31);
+    _mm256_storeu_ps(acc + 4 * kNR, c40); _mm256_storeu_ps(acc + 4 * kNR + 8, c41);
+    _mm256_storeu_ps(acc + 5 * kNR, c50); _mm256_storeu_ps(acc + 5 * kNR + 8, c51);
+}
+
+__attribute__((target("avx512f")))
+static void MicroKernelAvx512(const int kc,
+                              const float *a_panel,
+                              const float *b_panel,
+                              float *acc) {
+    // One row of the block fits in one register. Split the k loop
+    // into two chains to hide the latency of the FMA.
+    __m512 c0[kMR], c1[kMR];
+    for (int i = 0; i < kMR; ++i) {
+        c0[i] = _mm512_setzero_ps();
+        c1[i] = _mm512_setzero_ps();
+    }
+
+    int k = 0;
+    for (; k + 1 < kc; k += 2) {
+        const float *a = a_panel + k * kMR;
+        const __m512 b0 = _mm512_loadu_ps(b_panel + k * kNR);
+        const __m512 b1 = _mm512_loadu_ps(b_panel + (k + 1) * kNR);
+        for (int i = 0; i < kMR; ++i) {
+            c0[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[i]), b0, c0[i]);
+            c1[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[kMR + i]), b1, c1[i]);
+        }
+    }
+    if (k < kc) {
+        const float *a = a_panel + k * kMR;
+        const __m512 b0 = _mm512_loadu_ps(b_panel + k * kNR);
+        for (int i = 0; i < kMR; ++i) {
+            c0[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[i]), b0, c0[i]);
+        }
+    }
+
+    for (int i = 0; i < kMR; ++i) {
+        _mm512_storeu_ps(acc + i * kNR, _mm512_add_ps(c0[i], c1[i]));
+    }
+}
+#endif
+
+static MicroKernel ChooseKernel() {
+#ifdef SGEMM_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return MicroKernelAvx512;
+    }
+    if (__builtin_cpu_supports("avx2") &&
+            __builtin_cpu_supports("fma")) {
+        return MicroKernelAvx2;
+    }
+#endif
+    return MicroKernelScalar;
+}
+
+static const MicroKernel kMicroKernel = ChooseKernel();
+
+// Pack the mc x kc block of op(A) into the kMR row panels. The
+// tail panel is padded by zeros.
+template <bool TA>
+static void PackA(const int mc, const int kc,
+                  const float *A, const int lda,
+                  float *packed) {
+    for (int i = 0; i < mc; i += kMR) {
+        const int mr = std::min(kMR, mc - i);
+        for (int k = 0; k < kc; ++k) {
+            for (int r = 0; r < kMR; ++r) {
+                float val = 0.f;
+                if (r < mr) {
+                    val = TA ? A[k * lda + (i + r)] : A[(i + r) * lda + k];
+                }
+                *packed++ = val;
+            }
+        }
+    }
+}
+
+// Pack the kc x nc block of op(B) into the kNR column panels. The
+// tail panel is padded by zeros.
+template <bool TB>
+static void PackB(const int kc, const int nc,
+                  const float *B, const int ldb,
+                  float *packed) {
+    for (int j = 0; j < nc; j += kNR) {
+        const int nr = std::min(kNR, nc - j);
+        for (int k = 0; k < kc; ++k) {
+            if (!TB && nr == kNR) {
+                std::copy(B + k * ldb + j, B + k * ldb + j + kNR, packed);
+                packed += kNR;
+                continue;
+            }
+            for (int c = 0; c < kNR; ++c) {
+                float val = 0.f;
+                if (c < nr) {
+                    val = TB ? B[(j + c) * ldb + k] : B[k * ldb + (j + c)];
+                }
+                *packed++ = val;
+            }
+        }
+    }
+}
+
+// The rows of the packed A. Every pc block keeps all row panels, so the
+// ic block begins at ic * kc. The kMC is a multiple of kMR.
+static int GetPackedRows(const int M) {
+    return (M + kMR - 1) / kMR * kMR;
+}
+
+// C += alpha * op(A) * op(B). The C is already scaled by beta. The A
+// is skipped if the prepacked A is given.
+template <bool TA, bool TB>
+static void SgemmBlocked(const int M, const int N, const int K,
+                         const float alpha,
+                         const float *A, const int lda,
+                         const float *B, const int ldb,
+                         float *C, const int ldc,
+                         const float *prepacked_a = nullptr) {
+    static thread_local std::vector<float> packed_a;
+    static thread_local std::vector<float> packed_b;
+
+    const auto a_size = (kMC + kMR) * kKC;
+    const auto b_size = (kNC + kNR) * kKC;
+    if (packed_a.size() < (size_t)a_size) {
+        packed_a.resize(a_size);
+    }
+    if (packed_b.size() < (size_t)b_size) {
+        packed_b.resize(b_size);
+    }
+
+    float acc[kMR * kNR];
+
+    for (int jc = 0; jc < N; jc += kNC) {
+        const int nc = std::min(kNC, N - jc);
+        for (int pc = 0; pc < K; pc += kKC) {
+            const int kc = std::min(kKC, K - pc);
+            const float *b_block = TB ? B + jc * ldb + pc : B + pc * ldb + jc;
+            PackB<TB>(kc, nc, b_block, ldb, packed_b.data());
+
+            for (int ic = 0; ic < M; ic += kMC) {
+                const int mc = std::min(kMC, M - ic);
+                const float *a_packed = packed_a.data();
+                if (prepacked_a) {
+                    a_packed = prepacked_a + pc * GetPackedRows(M) + ic * kc;
+                } else {
+                    const float *a_block = TA ? A + pc * lda + ic : A + ic * lda + pc;
+                    PackA<TA>(mc, kc, a_block, lda, packed_a.data());
+                }
+
+                for (int jr = 0; jr < nc; jr += kNR) {
+                    const int nr = std::min(kNR, nc - jr);
+                    const float *b_panel = packed_b.data() + jr * kc;
+
+                    for (int ir = 0; ir < mc; ir += kMR) {
+                        const int mr = std::min(kMR, mc - ir);
+                        const float *a_panel = a_packed + ir * kc;
+
+                        kMicroKernel(kc, a_panel, b_panel, acc);
+
+                        float *c_block = C + (ic + ir) * ldc + (jc + jr);
+                        for (int i = 0; i < mr; ++i) {
+                            for (int j = 0; j < nr; ++j) {
+                                c_block[i * ldc + j] += alpha * acc[i * kNR + j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
 void sgemm_nn(int M, int N, int K, float alpha, const float *A, int lda,
               const float *B, int ldb, float *C, int ldc) {
     for (int i = 0; i < M; ++i) {
@@ -50,14 +311,21 @@ void sgemm_tt(int M, int N, int K, float alpha, const float *A, int lda,
     }
 }
 
-#define INITIALIZE_SGEMM(M, N, beta)  \
-    for (int i = 0; i < M; ++i) {     \
-        for (int j = 0; j < N; ++j) { \
-            C[i * ldc + j] *= beta;   \
-        }                             \
+#define INITIALIZE_SGEMM(M, N, beta)      \
+    for (int i = 0; i < M; ++i) {         \
+        for (int j = 0; j < N; ++j) {     \
+            if (beta == 0.f) {            \
+                C[i * ldc + j] = 0.f;     \
+            } else {                      \
+                C[i * ldc + j] *= beta;   \
+            }                             \
+        }                                 \
     }
 
-
+// The small matrices, like the fully connect layer of one
+// board, use the plain loops.
+#define USE_BLOCKED_SGEMM(M, N, K) \
+    (M >= kMR && (long)M * N * K >= kMinBlockedSize)
 
 template <>
 void Sgemm<false, false>::apply(int M, int N, int K,
@@ -67,7 +335,11 @@ void Sgemm<false, false>::apply(int M, int N, int K,
                                 float beta,
                                 float *C, int ldc) {
     INITIALIZE_SGEMM(M, N, beta);
-    sgemm_nn(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    if (USE_BLOCKED_SGEMM(M, N, K)) {
+        SgemmBlocked<false, false>(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    } else {
+        sgemm_nn(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    }
 }
 
 template <>
@@ -78,7 +350,11 @@ void Sgemm<true, false>::apply(int M, int N, int K,
                                float beta,
                                float *C, int ldc) {
     INITIALIZE_SGEMM(M, N, beta);
-    sgemm_tn(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    if (USE_BLOCKED_SGEMM(M, N, K)) {
+        SgemmBlocked<true, false>(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    } else {
+        sgemm_tn(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    }
 }
 
 template <>
@@ -89,7 +365,11 @@ void Sgemm<false, true>::apply(int M, int N, int K,
                                float beta,
                                float *C, int ldc) {
     INITIALIZE_SGEMM(M, N, beta);
-    sgemm_nt(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    if (USE_BLOCKED_SGEMM(M, N, K)) {
+        SgemmBlocked<false, true>(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    } else {
+        sgemm_nt(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    }
 }
 
 template <>
@@ -100,6 +380,61 @@ void Sgemm<true, true>::apply(int M, int N, int K,
                               float beta,
                               float *C, int ldc) {
     INITIALIZE_SGEMM(M, N, beta);
-    sgemm_tt(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    if (USE_BLOCKED_SGEMM(M, N, K)) {
+        SgemmBlocked<true, true>(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    } else {
+        sgemm_tt(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    }
+}
+
+template <bool TA, bool TB>
+void Sgemm<TA, TB>::apply_packed(int M, int N, int K,
+                                 float alpha,
+                                 const float *packed_a,
+                                 const float *B, int ldb,
+                                 float beta,
+                                 float *C, int ldc) {
+    INITIALIZE_SGEMM(M, N, beta);
+    SgemmBlocked<TA, TB>(M, N, K, alpha, nullptr, 0, B, ldb, C, ldc, packed_a);
+}
+
+template class Sgemm<false, false>;
+template class Sgemm<true, false>;
+template class Sgemm<false, true>;
+template class Sgemm<true, true>;
+
+size_t GetSgemmPackedSize(int M, int K) {
+    if (M < kMR) {
+        return 0;
+    }
+    return (size_t)GetPackedRows(M) * K;
+}
+
+template <bool TA>
+void SgemmPackA(int M, int K, const float *A, int lda, float *packed) {
+    // The same order as the loops of SgemmBlocked().
+    for (int pc = 0; pc < K; pc += kKC) {
+        const int kc = std::min(kKC, K - pc);
+        for (int ic = 0; ic < M; ic += kMC) {
+            const int mc = std::min(kMC, M - ic);
+            const float *a_block = TA ? A + pc * lda + ic : A + ic * lda + pc;
+            PackA<TA>(mc, kc, a_block, lda,
+                          packed + pc * GetPackedRows(M) + ic * kc);
+        }
+    }
 }
 
+template void SgemmPackA<false>(int, int, const float *, int, float *);
+template void SgemmPackA<true>(int, int, const float *, int, float *);
+
+std::string GetSgemmKernelName() {
+    if (kMicroKernel == MicroKernelScalar) {
+        return "scalar";
+    }
+#ifdef SGEMM_KERNEL_X86
+    if (kMicroKernel == MicroKernelAvx512) {
+        return "avx512";
+    }
+#endif
+    return "avx2";
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <string>
+
 template <bool TA, bool TB> 
 class Sgemm {
 public:
@@ -9,4 +12,26 @@ public:
                       const float *B, int ldb,
                       float beta,
                       float *C, int ldc);
+
+    // The same as apply(), but the A is already packed by
+    // SgemmPackA<TA>().
+    static void apply_packed(int M, int N, int K,
+                             float alpha,
+                             const float *packed_a,
+                             const float *B, int ldb,
+                             float beta,
+                             float *C, int ldc);
 };
+
+// Return the buffer size of the packed M x K op(A). Return zero if the
+// matrix has too few rows for the micro kernel.
+size_t GetSgemmPackedSize(int M, int K);
+
+// Pack op(A) into the panels of the blocked SGEMM. The constant matrix,
+// like the weights, can be packed only once, so every multiplication
+// skips the packing.
+template <bool TA>
+void SgemmPackA(int M, int K, const float *A, int lda, float *packed);
+
+// Return the name of the micro kernel selected for this CPU.
+std::string GetSgemmKernelName();
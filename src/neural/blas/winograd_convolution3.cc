@@ -1,6 +1,45 @@
 #include "neural/blas/winograd_convolution3.h"
 #include "neural/blas/blas.h"
+#include "neural/blas/bf16_convolution.h"
 #include "neural/winograd_helper.h"
+#include "utils/threadpool.h"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WINOGRAD_KERNEL_AVX2
+#include <immintrin.h>
+#endif
+
+// The intra-op threads. The calling thread computes one part too, so
+// the pool has one thread less.
+static std::unique_ptr<ThreadPool> intra_op_pool{nullptr};
+
+// The small convolutions are faster in one thread.
+constexpr long kMinIntraOpWork = 1 << 20;
+
+// Call the tiles_func(begin, end) for all tiles. The tiles are split
+// over the intra-op threads if the work is large enough.
+template <typename F>
+static void ForEachTiles(const long work, const F &tiles_func) {
+    if (!intra_op_pool || work < kMinIntraOpWork) {
+        tiles_func(0, kWinogradTile);
+        return;
+    }
+
+    // Every thread computes the contiguous tiles. The calling thread
+    // takes the first part.
+    const int parts = intra_op_pool->GetNumThreads() + 1;
+    auto group = ThreadGroup<void>(intra_op_pool.get());
+    for (int p = 1; p < parts; ++p) {
+        group.AddTask(tiles_func,
+                          p * kWinogradTile / parts, (p + 1) * kWinogradTile / parts);
+    }
+    tiles_func(0, kWinogradTile / parts);
+    group.WaitToJoin();
+}
 
 void ClearVector2D(std::vector<std::vector<float>> &vec2d) {
     for (auto &v: vec2d) {
@@ -8,13 +47,245 @@ void ClearVector2D(std::vector<std::vector<float>> &vec2d) {
     }
 }
 
+#ifdef WINOGRAD_KERNEL_AVX2
+// The vectorized transforms. Every lane computes one tile. The tiles
+// are contiguous in V and M, so the lanes read and write the full
+// vector. They are same as the scalar transforms.
+constexpr int kLanes = 8;
+
+static bool UseAvx2Transform() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") &&
+               __builtin_cpu_supports("fma");
+}
+
+static const bool kUseAvx2Transform = UseAvx2Transform();
+
+__attribute__((target("avx2,fma")))
+static inline void MultiplyBt8(__m256 *o, const __m256 *i) {
+    const __m256 sq2 = _mm256_set1_ps(kSqrt2);
+    const __m256 neg_sq2 = _mm256_set1_ps(-kSqrt2);
+    const __m256 half_sq2 = _mm256_set1_ps(kSqrt2 / 2.0f);
+    const __m256 neg_half_sq2 = _mm256_set1_ps(-kSqrt2 / 2.0f);
+    const __m256 neg_two = _mm256_set1_ps(-2.0f);
+    const __m256 neg_half = _mm256_set1_ps(-1.0f / 2.0f);
+    const __m256 neg_five_half = _mm256_set1_ps(-5.0f / 2.0f);
+
+    const __m256 i3m1 = _mm256_fmadd_ps(i[1], neg_sq2, _mm256_mul_ps(i[3], half_sq2));
+    const __m256 i4m2 = _mm256_fmadd_ps(i[2], neg_two, i[4]);
+
+    o[0] = _mm256_add_ps(_mm256_fmadd_ps(i[2], neg_five_half, i[0]), i[4]);
+    o[1] = _mm256_add_ps(i3m1, i4m2);
+    o[2] = _mm256_sub_ps(i4m2, i3m1);
+
+    const __m256 i3m1_2 = _mm256_fmadd_ps(i[3], sq2, _mm256_mul_ps(i[1], neg_half_sq2));
+    const __m256 i4m2_2 = _mm256_fmadd_ps(i[2], neg_half, i[4]);
+
+    o[3] = _mm256_add_ps(i3m1_2, i4m2_2);
+    o[4] = _mm256_sub_ps(i4m2_2, i3m1_2);
+
+    o[5] = _mm256_add_ps(_mm256_fmadd_ps(i[3], neg_five_half, i[1]), i[5]);
+}
+
+__attribute__((target("avx2,fma")))
+static inline void MultiplyAt8(__m256 *o, const __m256 *i) {
+    const __m256 half = _mm256_set1_ps(1.0f / 2.0f);
+    const __m256 quarter_sq2 = _mm256_set1_ps(kSqrt2 / 4.0f);
+    const __m256 sq2 = _mm256_set1_ps(kSqrt2);
+
+    const __m256 t1p2 = _mm256_mul_ps(_mm256_add_ps(i[1], i[2]), half);
+    const __m256 t1m2 = _mm256_mul_ps(_mm256_sub_ps(i[1], i[2]), quarter_sq2);
+    const __m256 t3p4 = _mm256_add_ps(i[3], i[4]);
+    const __m256 t3m4 = _mm256_mul_ps(_mm256_sub_ps(i[3], i[4]), sq2);
+
+    o[0] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(i[0], t1p2), t1p2), t3p4);
+    o[1] = _mm256_add_ps(_mm256_add_ps(t1m2, t1m2), t3m4);
+    o[2] = _mm256_add_ps(_mm256_add_ps(t1p2, t3p4), t3p4);
+    o[3] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(t1m2, t3m4), t3m4), i[5]);
+}
+
+// The SIZE is the board size known at compile time, or 0 for the
+// other sizes. The tile geometry of the common sizes is constant, so
+// the copy and the scatter loops are fully unrolled.
+template <int SIZE>
+__attribute__((target("avx2,fma")))
+static void TransformInAvx2(const int runtime_size,
+                            const std::vector<std::vector<float>>& in,
+                            std::vector<float>& V, const int C) {
+    const int board_size = SIZE > 0 ? SIZE : runtime_size;
+    const int W = board_size;
+    const int H = board_size;
+    const int WTILES = GetWinogradWTiles(board_size);
+    const int P = GetWinogradP(board_size);
+    const int batch_size = in.size();
+    const int BP = batch_size * P;
+
+    const int Wpad = 2 + kWinogradM * WTILES;
+    const int pad_area = Wpad * Wpad;
+
+    // The padded planes of all boards. The borders are always zero.
+    auto in_pad = std::vector<float>(batch_size * pad_area, 0.f);
+
+    // The offset of every tile in the padded planes. The tail lanes
+    // read the first tile and are never stored.
+    const int lanes_size = (BP + kLanes - 1) / kLanes * kLanes;
+    auto offsets = std::vector<int>(lanes_size, 0);
+    for (int batch = 0; batch < batch_size; ++batch) {
+        for (int block_y = 0; block_y < WTILES; ++block_y) {
+            for (int block_x = 0; block_x < WTILES; ++block_x) {
+                offsets[batch * P + block_y * WTILES + block_x] =
+                    batch * pad_area + kWinogradM * block_y * Wpad + kWinogradM * block_x;
+            }
+        }
+    }
+
+    alignas(32) float tail[kLanes];
+
+    for (int ch = 0; ch < C; ++ch) {
+        for (int batch = 0; batch < batch_size; ++batch) {
+            const float *plane = in[batch].data() + ch * (W * H);
+            float *pad = in_pad.data() + batch * pad_area;
+            for (int yin = 0; yin < H; ++yin) {
+                std::copy(plane + yin * W, plane + yin * W + W,
+                          pad + (yin + 1) * Wpad + 1);
+            }
+        }
+
+        for (int t = 0; t < BP; t += kLanes) {
+            const __m256i base = _mm256_loadu_si256(
+                                     reinterpret_cast<const __m256i *>(offsets.data() + t));
+            __m256 d[kWinogradAlpha][kWinogradAlpha];
+            for (int r = 0; r < kWinogradAlpha; ++r) {
+                for (int c = 0; c < kWinogradAlpha; ++c) {
+                    const __m256i idx = _mm256_add_epi32(base, _mm256_set1_epi32(r * Wpad + c));
+                    d[r][c] = _mm256_i32gather_ps(in_pad.data(), idx, 4);
+                }
+            }
+
+            // Calculates transpose(B).x.B
+            __m256 t1[kWinogradAlpha][kWinogradAlpha];
+            for (int c = 0; c < kWinogradAlpha; ++c) {
+                __m256 col_in[kWinogradAlpha], col_out[kWinogradAlpha];
+                for (int r = 0; r < kWinogradAlpha; ++r) {
+                    col_in[r] = d[r][c];
+                }
+                MultiplyBt8(col_out, col_in);
+                for (int r = 0; r < kWinogradAlpha; ++r) {
+                    t1[r][c] = col_out[r];
+                }
+            }
+
+            const int remaining = std::min(kLanes, BP - t);
+            for (int r = 0; r < kWinogradAlpha; ++r) {
+                __m256 out[kWinogradAlpha];
+                MultiplyBt8(out, t1[r]);
+                for (int c = 0; c < kWinogradAlpha; ++c) {
+                    float *dst = V.data() + (r * kWinogradAlpha + c) * C * BP + ch * BP + t;
+                    if (remaining == kLanes) {
+                        _mm256_storeu_ps(dst, out[c]);
+                    } else {
+                        _mm256_store_ps(tail, out[c]);
+                        std::copy(tail, tail + remaining, dst);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <int SIZE>
+__attribute__((target("avx2,fma")))
+static void TransformOutAvx2(const int runtime_size,
+                             const std::vector<float>& M,
+                             std::vector<std::vector<float>>& Y, const int K) {
+    const int board_size = SIZE > 0 ? SIZE : runtime_size;
+    const int W = board_size;
+    const int H = board_size;
+    const int WTILES = GetWinogradWTiles(board_size);
+    const int P = GetWinogradP(board_size);
+    const int batch_size = Y.size();
+    const int BP = batch_size * P;
+
+    alignas(32) float tile_m[kWinogradTile][kLanes];
+    alignas(32) float o[kWinogradM][kWinogradM][kLanes];
+
+    for (int k = 0; k < K; ++k) {
+        for (int t = 0; t < BP; t += kLanes) {
+            const int remaining = std::min(kLanes, BP - t);
+
+            __m256 m[kWinogradAlpha][kWinogradAlpha];
+            for (int xi = 0; xi < kWinogradAlpha; ++xi) {
+                for (int nu = 0; nu < kWinogradAlpha; ++nu) {
+                    const int i = xi * kWinogradAlpha + nu;
+                    const float *src = M.data() + i * K * BP + k * BP + t;
+                    if (remaining == kLanes) {
+                        m[xi][nu] = _mm256_loadu_ps(src);
+                    } else {
+                        std::fill(tile_m[i], tile_m[i] + kLanes, 0.f);
+                        std::copy(src, src + remaining, tile_m[i]);
+                        m[xi][nu] = _mm256_load_ps(tile_m[i]);
+                    }
+                }
+            }
+
+            // Calculates transpose(A).temp_m.A
+            __m256 temp[kWinogradM][kWinogradAlpha];
+            for (int j = 0; j < kWinogradAlpha; ++j) {
+                __m256 col_in[kWinogradAlpha], col_out[kWinogradM];
+                for (int xi = 0; xi < kWinogradAlpha; ++xi) {
+                    col_in[xi] = m[xi][j];
+                }
+                MultiplyAt8(col_out, col_in);
+                for (int i = 0; i < kWinogradM; ++i) {
+                    temp[i][j] = col_out[i];
+                }
+            }
+            for (int i = 0; i < kWinogradM; ++i) {
+                __m256 out[kWinogradM];
+                MultiplyAt8(out, temp[i]);
+                for (int j = 0; j < kWinogradM; ++j) {
+                    _mm256_store_ps(o[i][j], out[j]);
+                }
+            }
+
+            // Scatter the tiles to the output planes.
+            for (int l = 0; l < remaining; ++l) {
+                const int batch = (t + l) / P;
+                const int b = (t + l) % P;
+                const int y = kWinogradM * (b / WTILES);
+                const int x = kWinogradM * (b % WTILES);
+                float *dst = Y[batch].data() + k * H * W + y * W + x;
+                for (int i = 0; i < kWinogradM && y + i < H; ++i) {
+                    for (int j = 0; j < kWinogradM && x + j < W; ++j) {
+                        dst[i * W + j] = o[i][j][l];
+                    }
+                }
+            }
+        }
+    }
+}
+#endif
+
 void WinogradConvolution3::TransformIn(const int board_size,
-                                           const std::vector<float>& in,
+                                           const std::vector<std::vector<float>>& in,
                                            std::vector<float>& V, const int C) {
+#ifdef WINOGRAD_KERNEL_AVX2
+    if (kUseAvx2Transform) {
+        switch (board_size) {
+            case 9:  TransformInAvx2<9>(board_size, in, V, C); break;
+            case 13: TransformInAvx2<13>(board_size, in, V, C); break;
+            case 19: TransformInAvx2<19>(board_size, in, V, C); break;
+            default: TransformInAvx2<0>(board_size, in, V, C); break;
+        }
+        return;
+    }
+#endif
     const int W = board_size;
     const int H = board_size;
     const int WTILES = GetWinogradWTiles(board_size);
     const int P = GetWinogradP(board_size);
+    const int batch_size = in.size();
+    const int BP = batch_size * P;
     constexpr auto SQ2 = kSqrt2;
 
     const auto Wpad = 2 + kWinogradM * WTILES;
@@ -59,12 +330,16 @@ void WinogradConvolution3::TransformIn(const int board_size,
         o5 = i1 + i3 * (-5.0f / 2.0f) + i5;
     };
 
-    for (int ch = 0; ch < C; ch++) {
+    // The tiles of all boards are in the same row of V, so that
+    // one GEMM computes the whole batch.
+    for (int idx = 0; idx < C * batch_size; idx++) {
+        const int ch = idx / batch_size;
+        const int batch = idx % batch_size;
         ClearVector2D(in_pad);
 
         for (int yin = 0; yin < H; yin++) {
             for (int xin = 0; xin < W; xin++) {
-                in_pad[yin + 1][xin + 1] = in[ch * (W * H) + yin * W + xin];
+                in_pad[yin + 1][xin + 1] = in[batch][ch * (W * H) + yin * W + xin];
             }
         }
         for (int block_y = 0; block_y < WTILES; block_y++) {
@@ -117,17 +392,17 @@ void WinogradConvolution3::TransformIn(const int board_size,
                 MULTIPLY_B(5)
 
                 if (buffer_entries == 0) {
-                    buffer_offset = ch * P + block_y * WTILES + block_x;
+                    buffer_offset = ch * BP + batch * P + block_y * WTILES + block_x;
                 }
                 buffer_entries++;
 
                 if (buffer_entries >= buffersize
-                    || (ch == C - 1 && block_x == WTILES - 1
-                        && block_y == WTILES - 1)) {
+                    || (ch == C - 1 && batch == batch_size - 1
+                        && block_x == WTILES - 1 && block_y == WTILES - 1)) {
 
                     for (int i = 0; i < kWinogradAlpha * kWinogradAlpha; i++) {
                         for (int entry = 0; entry < buffer_entries; entry++) {
-                            V[i * C * P + buffer_offset + entry] =
+                            V[i * C * BP + buffer_offset + entry] =
                                 buffer[i * buffersize + entry];
                         }
                     }
@@ -139,37 +414,68 @@ void WinogradConvolution3::TransformIn(const int board_size,
 }
 
 void WinogradConvolution3::Sgemm(const int board_size,
+                                     const int batch_size,
                                      const std::vector<float>& U,
                                      const std::vector<float>& V,
                                      std::vector<float>& M,
-                                     const int C, const int K) {
+                                     const int C, const int K,
+                                     const float *packed_U) {
     //    [C, K, P] are [input_channels, output_channels, Ptiles]
     // U dimensions are [36,  input_channels, output_channels].
-    // V dimensions are [36,  input_channels, p_tiles].
-    // M dimensions are [36, output_channels, p_tiles].
+    // V dimensions are [36,  input_channels, batch_size * p_tiles].
+    // M dimensions are [36, output_channels, batch_size * p_tiles].
 
-    const int P = GetWinogradP(board_size);
-    for (int b = 0; b < kWinogradTile; b++) {
-        const int offset_u = b * K * C;
-        const int offset_v = b * C * P;
-        const int offset_m = b * K * P;
-        Blas::WinogradSgemm(offset_u, offset_v, offset_m,
-                                K, P, C,
-                                1.0f,
-                                U.data(), K,
-                                V.data(), P,
-                                0.0f,
-                                M.data(), P);
+    const int BP = batch_size * GetWinogradP(board_size);
+    const auto packed_size = packed_U ? Blas::GetPackedSize(K, C) : 0;
+    const auto tiles_sgemm = [&](const int begin, const int end) {
+        for (int b = begin; b < end; b++) {
+            const int offset_u = b * K * C;
+            const int offset_v = b * C * BP;
+            const int offset_m = b * K * BP;
+            Blas::WinogradSgemm(offset_u, offset_v, offset_m,
+                                    K, BP, C,
+                                    1.0f,
+                                    U.data(), K,
+                                    V.data(), BP,
+                                    0.0f,
+                                    M.data(), BP,
+                                    packed_U ? packed_U + b * packed_size : nullptr);
+        }
+    };
+
+    ForEachTiles((long)kWinogradTile * K * BP * C, tiles_sgemm);
+}
+
+void WinogradConvolution3::SetIntraOpThreads(const int threads) {
+    const int pool_threads = std::min(threads, kWinogradTile) - 1;
+    if (pool_threads <= 0) {
+        intra_op_pool.reset();
+    } else if (!intra_op_pool ||
+                   (int)intra_op_pool->GetNumThreads() != pool_threads) {
+        intra_op_pool = std::make_unique<ThreadPool>(pool_threads);
     }
 }
 
 void WinogradConvolution3::TransformOut(const int board_size,
                                             const std::vector<float>& M,
-                                            std::vector<float>& Y, const int K) {
+                                            std::vector<std::vector<float>>& Y, const int K) {
+#ifdef WINOGRAD_KERNEL_AVX2
+    if (kUseAvx2Transform) {
+        switch (board_size) {
+            case 9:  TransformOutAvx2<9>(board_size, M, Y, K); break;
+            case 13: TransformOutAvx2<13>(board_size, M, Y, K); break;
+            case 19: TransformOutAvx2<19>(board_size, M, Y, K); break;
+            default: TransformOutAvx2<0>(board_size, M, Y, K); break;
+        }
+        return;
+    }
+#endif
     const int W = board_size;
     const int H = board_size;
     const int WTILES = GetWinogradWTiles(board_size);
     const int P = GetWinogradP(board_size);
+    const int batch_size = Y.size();
+    const int BP = batch_size * P;
 
     constexpr auto SQ2 = kSqrt2;
 
@@ -194,7 +500,10 @@ void WinogradConvolution3::TransformOut(const int board_size,
         o3 = t1m2 + t3m4 + t3m4 + i5;
     };
 
-    for (int k = 0; k < K; k++) {
+    for (int idx = 0; idx < batch_size * K; idx++) {
+        const int batch = idx / K;
+        const int k = idx % K;
+        auto &Y_batch = Y[batch];
         for (int block_x = 0; block_x < WTILES; block_x++) {
             const auto x = kWinogradM * block_x;
             for (int block_y = 0; block_y < WTILES; block_y++) {
@@ -208,7 +517,7 @@ void WinogradConvolution3::TransformOut(const int board_size,
                 for (int xi = 0; xi < kWinogradAlpha; xi++) {
                     for (int nu = 0; nu < kWinogradAlpha; nu++) {
                         temp_m[xi][nu] =
-                            M[(xi * kWinogradAlpha + nu) * K * P + k * P + b];
+                            M[(xi * kWinogradAlpha + nu) * K * BP + k * BP + batch * P + b];
                     }
                 }
                 std::array<std::array<float, kWinogradAlpha>, kWinogradM> temp;
@@ -231,7 +540,7 @@ void WinogradConvolution3::TransformOut(const int board_size,
                 for (int i = 0; i < kWinogradM; i++) {
                     for (int j = 0; j < kWinogradM; j++) {
                         if (y + i < H && x + j < W) {
-                            Y[y_ind + i * W + j] = o[i][j];
+                            Y_batch[y_ind + i * W + j] = o[i][j];
                         }
                     }
                 }
@@ -243,17 +552,87 @@ void WinogradConvolution3::TransformOut(const int board_size,
 void WinogradConvolution3::Forward(const size_t board_size,
                                        const size_t input_channels,
                                        const size_t output_channels,
-                                       const std::vector<float>& input,
+                                       const std::vector<std::vector<float>>& inputs,
                                        const std::vector<float>& U,
                                        std::vector<float>& V,
                                        std::vector<float>& M,
-                                       std::vector<float>& output) {
-    TransformIn(board_size, input, V, input_channels);
-    Sgemm(board_size, U, V, M, input_channels, output_channels);
-    TransformOut(board_size, M, output, output_channels);
+                                       std::vector<std::vector<float>>& outputs,
+                                       const float *packed_U) {
+    TransformIn(board_size, inputs, V, input_channels);
+    Sgemm(board_size, inputs.size(), U, V, M, input_channels, output_channels, packed_U);
+    TransformOut(board_size, M, outputs, output_channels);
+}
+
+
+size_t WinogradConvolution3::GetWorkspaceSize(const size_t board_size,
+                                                  const size_t channels,
+                                                  const size_t batch_size) {
+    return kWinogradTile * channels * GetWinogradP(board_size) * batch_size;
+}
+
+size_t WinogradConvolution3::GetPackedSize(const size_t input_channels,
+                                              const size_t output_channels) {
+    return kWinogradTile * Blas::GetPackedSize(output_channels, input_channels);
 }
 
+void WinogradConvolution3::PackWeights(const size_t input_channels,
+                                           const size_t output_channels,
+                                           const std::vector<float>& U,
+                                           float *packed_U) {
+    const int C = input_channels;
+    const int K = output_channels;
+    const auto packed_size = Blas::GetPackedSize(K, C);
+    for (int b = 0; b < kWinogradTile; b++) {
+        Blas::PackWinogradA(K, C, U.data() + b * K * C, K,
+                                packed_U + b * packed_size);
+    }
+}
 
-size_t WinogradConvolution3::GetWorkspaceSize(const size_t board_size, const size_t channels) {
-    return kWinogradTile * channels * GetWinogradP(board_size);
+void WinogradConvolution3::ForwardBf16(const size_t board_size,
+                                           const size_t input_channels,
+                                           const size_t output_channels,
+                                           const std::vector<std::vector<float>>& inputs,
+                                           const std::vector<std::uint16_t>& U,
+                                           std::vector<float>& V,
+                                           std::vector<float>& M,
+                                           std::vector<std::vector<float>>& outputs) {
+    const int C = input_channels;
+    const int K = output_channels;
+    const int BP = inputs.size() * GetWinogradP(board_size);
+    const auto tile_size = Bf16Convolution::GetWeightsSize(K, C);
+
+    TransformIn(board_size, inputs, V, C);
+    ForEachTiles((long)kWinogradTile * K * BP * C, [&](const int begin, const int end) {
+        for (int b = begin; b < end; b++) {
+            Bf16Convolution::Gemm(K, BP, C,
+                                      U.data() + b * tile_size,
+                                      V.data() + b * C * BP,
+                                      M.data() + b * K * BP);
+        }
+    });
+    TransformOut(board_size, M, outputs, K);
+}
+
+void WinogradConvolution3::ConvertBf16Weights(const size_t input_channels,
+                                                  const size_t output_channels,
+                                                  const std::vector<float>& U,
+                                                  std::vector<std::uint16_t>& bf16_U) {
+    const int C = input_channels;
+    const int K = output_channels;
+    const auto tile_size = Bf16Convolution::GetWeightsSize(K, C);
+
+    // The U of every tile is [C, K]. Transpose it to [K, C].
+    auto tile = std::vector<float>(K * C);
+    auto bf16_tile = std::vector<std::uint16_t>{};
+    bf16_U.resize(kWinogradTile * tile_size);
+    for (int b = 0; b < kWinogradTile; b++) {
+        for (int c = 0; c < C; c++) {
+            for (int k = 0; k < K; k++) {
+                tile[k * C + c] = U[b * K * C + c * K + k];
+            }
+        }
+        Bf16Convolution::ConvertWeights(K, C, tile, bf16_tile);
+        std::copy(std::begin(bf16_tile), std::end(bf16_tile),
+                      std::begin(bf16_U) + b * tile_size);
+    }
 }
@@ -1,32 +1,77 @@
 #pragma once
 
 #include <vector>
+#include <cstddef>
+#include <cstdint>
 
 class WinogradConvolution3 {
 public:
+    // Compute the convolution of all boards. The tiles of all boards
+    // are multiplied in one GEMM, so the larger batch makes the better
+    // use of the BLAS library.
     static void Forward(const size_t board_size,
                             const size_t input_channels,
                             const size_t output_channels,
-                            const std::vector<float>& input,
+                            const std::vector<std::vector<float>>& inputs,
                             const std::vector<float>& U,
                             std::vector<float>& V,
                             std::vector<float>& M,
-                            std::vector<float>& output);
+                            std::vector<std::vector<float>>& outputs,
+                            const float *packed_U = nullptr);
 
-    static size_t GetWorkspaceSize(const size_t board_size, const size_t channels);
+    // The same as Forward(), but the tile GEMMs are computed with
+    // the bfloat16 weights and inputs. The weights are converted by
+    // ConvertBf16Weights().
+    static void ForwardBf16(const size_t board_size,
+                                const size_t input_channels,
+                                const size_t output_channels,
+                                const std::vector<std::vector<float>>& inputs,
+                                const std::vector<std::uint16_t>& U,
+                                std::vector<float>& V,
+                                std::vector<float>& M,
+                                std::vector<std::vector<float>>& outputs);
+
+    // Convert the transformed weights U of every tile to bfloat16.
+    static void ConvertBf16Weights(const size_t input_channels,
+                                       const size_t output_channels,
+                                       const std::vector<float>& U,
+                                       std::vector<std::uint16_t>& bf16_U);
+
+    static size_t GetWorkspaceSize(const size_t board_size,
+                                       const size_t channels,
+                                       const size_t batch_size = 1);
+
+    // Return the size of the U packed by PackWeights(). Return zero
+    // if it is not packed.
+    static size_t GetPackedSize(const size_t input_channels,
+                                    const size_t output_channels);
+
+    // Pack the transformed weights U of every tile for the GEMM.
+    static void PackWeights(const size_t input_channels,
+                                const size_t output_channels,
+                                const std::vector<float>& U,
+                                float *packed_U);
+
+    // Split the tile GEMMs of one convolution over this number of
+    // threads. The extra threads are in their own pool, apart from the
+    // search threads. It lowers the latency of one position. It is
+    // not thread safe, so set it before any forwarding.
+    static void SetIntraOpThreads(const int threads);
 
 private:
     static void TransformIn(const int board_size,
-                                const std::vector<float>& in,
+                                const std::vector<std::vector<float>>& in,
                                 std::vector<float>& V, int C);
 
     static void Sgemm(const int board_size,
+                          const int batch_size,
                           const std::vector<float>& U,
                           const std::vector<float>& V,
-                          std::vector<float>& M, int C, int K);
+                          std::vector<float>& M, int C, int K,
+                          const float *packed_U);
 
     static void TransformOut(const int board_size,
                                  const std::vector<float>& M,
-                                 std::vector<float>& Y, int K);
+                                 std::vector<std::vector<float>>& Y, int K);
 };
 
@@ -3,6 +3,7 @@
 #include "neural/cuda/cuda_common.h"
 #include <cstdio>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <stdexcept>
 #include <sstream>
@@ -70,12 +71,16 @@ void SetDevice(int n) {
     ReportCUDAErrors(cudaSetDevice(n));
 }
 
+std::string GetPciBusId(int n) {
+    char bus_id[64] = {0};
+    ReportCUDAErrors(cudaDeviceGetPCIBusId(bus_id, sizeof(bus_id), n));
+    return std::string{bus_id};
+}
+
 void WaitToFinish(cudaStream_t s) {
     ReportCUDAErrors(cudaStreamSynchronize(s));
 }
 
-static bool handles_init[kMaxSupportGPUs] = {false};
-
 void CudaHandles::ApplyOnCurrentDevice() {
     int i = GetDevice();
 
@@ -83,7 +88,7 @@ void CudaHandles::ApplyOnCurrentDevice() {
         throw std::runtime_error("Out of supported GPU number.");
     }
 
-    if (handles_init[i]) {
+    if (initialized) {
         return;
     }
 
@@ -94,17 +99,17 @@ void CudaHandles::ApplyOnCurrentDevice() {
     ReportCUDAErrors(cudaStreamCreate(&stream));
 
     gpu_id = i;
-    handles_init[i] = true;
+    initialized = true;
 }
 
 void CudaHandles::Release() {
-    if (handles_init[gpu_id]) {
+    if (initialized) {
         cudaStreamDestroy(stream);
         cublasDestroy(cublas_handle);
 #ifdef USE_CUDNN
         cudnnDestroy(cudnn_handle);
 #endif
-        handles_init[gpu_id] = false;
+        initialized = false;
     }
 }
 
@@ -190,6 +195,82 @@ std::string GetCurrentDeviceInfo() {
     return out.str();
 }
 
+std::string GetCurrentDeviceName() {
+    cudaDeviceProp dev_prop;
+    ReportCUDAErrors(cudaGetDeviceProperties(&dev_prop, GetDevice()));
+
+    // Keep the name in one word.
+    auto name = std::string{dev_prop.name};
+    for (auto &c : name) {
+        if (c == ' ') {
+            c = '_';
+        }
+    }
+    return name;
+}
+
+std::vector<int> GetBatchBuckets(const int max_batch) {
+    auto buckets = std::vector<int>{};
+    for (int b = 1; b < max_batch; b *= 2) {
+        buckets.emplace_back(b);
+    }
+    buckets.emplace_back(max_batch);
+    return buckets;
+}
+
+int GetBatchBucket(const std::vector<int> &buckets, const int batch) {
+    int idx = 0;
+    while (idx + 1 < (int)buckets.size() && buckets[idx] < batch) {
+        ++idx;
+    }
+    return idx;
+}
+
+#ifdef USE_CUDNN
+CudnnTuningCache &CudnnTuningCache::Get() {
+    static CudnnTuningCache cache;
+    return cache;
+}
+
+void CudnnTuningCache::Open(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (filename.empty() || filename == filename_) {
+        return;
+    }
+    filename_ = filename;
+
+    // One result per line, "<key> <algorithm>". The later line replaces
+    // the former one.
+    auto file = std::ifstream{filename_};
+    auto key = std::string{};
+    int algo;
+    while (file >> key >> algo) {
+        if (algo >= 0 && algo < CUDNN_CONVOLUTION_FWD_ALGO_COUNT) {
+            algos_[key] = algo;
+        }
+    }
+}
+
+bool CudnnTuningCache::Lookup(const std::string &key, cudnnConvolutionFwdAlgo_t &algo) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = algos_.find(key);
+    if (it == std::end(algos_)) {
+        return false;
+    }
+    algo = static_cast<cudnnConvolutionFwdAlgo_t>(it->second);
+    return true;
+}
+
+void CudnnTuningCache::Insert(const std::string &key, cudnnConvolutionFwdAlgo_t algo) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    algos_[key] = static_cast<int>(algo);
+    if (!filename_.empty()) {
+        auto file = std::ofstream{filename_, std::ios::app};
+        file << key << ' ' << static_cast<int>(algo) << '\n';
+    }
+}
+#endif
+
 } // namespace CUDA
 
 #endif
@@ -4,7 +4,7 @@
 
 #include <cstdio>
 #include <cuda_runtime.h>
-//#include <cuda_fp16.h>
+#include <cuda_fp16.h>
 #include <cublas_v2.h>
 #include <cuda.h>
 
@@ -14,6 +14,9 @@
 
 #include <string>
 #include <sstream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace CUDA {
 
@@ -34,6 +37,9 @@ void CudaError(cudaError_t status);
 int GetDeviceCount();
 int GetDevice();
 void SetDevice(int n);
+
+// Return the PCI bus id of the device, e.g. "0000:3B:00.0".
+std::string GetPciBusId(int n);
 void WaitToFinish(cudaStream_t s);
 
 inline static int DivUp(int a, int b) { return (a + b - 1) / b; }
@@ -48,6 +54,17 @@ struct CudaHandles {
 
     int gpu_id;
 
+    // Every graph owns its handles and its stream, so the graphs of
+    // the same device run concurrently.
+    bool initialized{false};
+
+    // Compute the convolutions with the half precision. The full
+    // precision path is kept for the accuracy check.
+    bool fp16{false};
+    bool full_precision{false};
+
+    bool UseHalf() const { return fp16 && !full_precision; }
+
     void ApplyOnCurrentDevice();
     void Release();
 };
@@ -55,6 +72,41 @@ struct CudaHandles {
 std::string GetBackendInfo();
 std::string GetCurrentDeviceInfo();
 
+// Return the model name of the current device.
+std::string GetCurrentDeviceName();
+
+// Return the batch buckets 1, 2, 4, ... and the max batch. The shapes
+// are prepared for every bucket, and a batch uses the smallest bucket
+// which fits it.
+std::vector<int> GetBatchBuckets(const int max_batch);
+
+// Return the index of the smallest bucket which is not less than the
+// batch.
+int GetBatchBucket(const std::vector<int> &buckets, const int batch);
+
+#ifdef USE_CUDNN
+// The convolution algorithms chosen by the benchmark. The key contains
+// the GPU model, the precision and the shape, so the layers of the same
+// shape are tuned only once. Every new result is appended to the file,
+// and the later startups skip the tuning.
+class CudnnTuningCache {
+public:
+    static CudnnTuningCache &Get();
+
+    // Load the results of the file. The empty name keeps the results
+    // in the memory only.
+    void Open(const std::string &filename);
+
+    bool Lookup(const std::string &key, cudnnConvolutionFwdAlgo_t &algo);
+    void Insert(const std::string &key, cudnnConvolutionFwdAlgo_t algo);
+
+private:
+    std::mutex mutex_;
+    std::string filename_;
+    std::unordered_map<std::string, int> algos_;
+};
+#endif
+
 } // namespace CUDA
 
 #endif
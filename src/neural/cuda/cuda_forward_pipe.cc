@@ -1,18 +1,28 @@
 #ifdef USE_CUDA
 
+#include <algorithm>
+#include <cmath>
 #include <sstream>
+#include <thread>
 
 #include "config.h"
 #include "neural/cuda/cuda_forward_pipe.h"
 #include "neural/cuda/cuda_common.h"
 #include "neural/cuda/cuda_kernels.h"
 #include "utils/log.h"
+#include "utils/numa.h"
 #include "utils/format.h"
+#include "utils/time.h"
+#include "utils/metrics.h"
 
 void CudaForwardPipe::Initialize(std::shared_ptr<DNNWeights> weights) {
     LOGGING << CUDA::GetBackendInfo();
+#ifdef USE_CUDNN
+    CUDA::CudnnTuningCache::Get().Open(GetOption<std::string>("cudnn_tuning_cache"));
+#endif
 
     dump_gpu_info_ = true;
+    batch_controller_.Reset(1000 * GetOption<int>("gpu_waittime"));
 
     Load(weights); // Will select max batch size.
 
@@ -20,53 +30,189 @@ void CudaForwardPipe::Initialize(std::shared_ptr<DNNWeights> weights) {
 }
 
 OutputResult CudaForwardPipe::Forward(const InputData &input) {
-    OutputResult output;
-    InputData reordered_input = input;
+    return ForwardAsync(input).get();
+}
+
+std::future<OutputResult> CudaForwardPipe::ForwardAsync(const InputData &input) {
+    return PushEntry(input, false);
+}
+
+std::string CudaForwardPipe::GetStatsString() {
+    return batch_controller_.GetStatsString();
+}
+
+float CudaForwardPipe::GetBatchFillRatio() {
+    return batch_controller_.GetFillRatio();
+}
+
+void CudaForwardPipe::ResetStats() {
+    batch_controller_.ResetStats();
+}
+
+size_t CudaForwardPipe::GetDeviceMemoryUsed() {
+    // The graphs of the lazy GPUs are zero until they are built.
+    size_t used = 0;
+    for (const auto &g : nngraphs_) {
+        used += g->GetBufferSize();
+    }
+    for (const auto &graphs : resident_nngraphs_) {
+        for (const auto &g : graphs) {
+            used += g->GetBufferSize();
+        }
+    }
+    return used;
+}
+
+bool CudaForwardPipe::ReducedPrecision() {
+    return GetOption<bool>("use_fp16");
+}
+
+OutputResult CudaForwardPipe::ForwardFullPrecision(const InputData &input) {
+    return PushEntry(input, true).get();
+}
+
+std::future<OutputResult> CudaForwardPipe::PushEntry(const InputData &input,
+                                                         const bool full_precision) {
+    const auto net_size = GetNetBoardSize(input.board_size);
+    auto entry = AcquireEntry();
+    PackInputs(input, net_size, entry->input);
+    entry->net_size = net_size;
+    entry->full_precision = full_precision;
+    entry->pushed = std::chrono::steady_clock::now();
+    entry->promise = std::promise<OutputResult>{};
+
+    // Take the future before pushing. The worker may give the entry
+    // back to the pool as soon as it is in the ring.
+    auto future = entry->promise.get_future();
+    auto &queue = *entry_queues_[node_queue_[Numa::GetCurrentNode() % node_queue_.size()]];
+    while (!queue.ring.TryPush(entry)) {
+        // The ring is full. Let the workers take some entries.
+        std::this_thread::yield();
+    }
+    const int queue_size = queue.size.fetch_add(1) + 1;
+    batch_controller_.OnArrival();
+
+    if (queue_size == 1 || queue_size >= max_batch_) {
+        // Wake up one worker if it is the first entry or there
+        // are enough batch size.
+        queue.cv.notify_one();
+    }
+
+    // The batch forwarding worker sets the result.
+    return future;
+}
+
+CudaForwardPipe::ForwawrdEntry *CudaForwardPipe::AcquireEntry() {
+    ForwawrdEntry *entry;
+    if (free_entries_.TryPop(entry)) {
+        return entry;
+    }
+    std::lock_guard<std::mutex> lock(entry_pool_mutex_);
+    entry_pool_.emplace_back(std::make_unique<ForwawrdEntry>());
+    return entry_pool_.back().get();
+}
+
+void CudaForwardPipe::ReleaseEntry(ForwawrdEntry *entry) {
+    // The entry is still owned by the pool if the free list is full. It
+    // is just not reused.
+    free_entries_.TryPush(entry);
+}
+
+void CudaForwardPipe::PackInputs(const InputData &input,
+                                 const int net_size,
+                                 PackedInputData &packed) const {
+    // The entry is reused, so clear the old bits.
+    packed.bits.fill(0);
+    packed.komi = input.komi;
+    packed.board_size = input.board_size;
+    packed.side_to_move = input.side_to_move;
+    packed.need_ownership = input.need_ownership;
+    packed.need_value = input.need_value;
 
-    // Reorder the inputs data.
     const int planes_bsize = input.board_size;
-    const bool should_reorder = planes_bsize != board_size_;
+    const int num_intersections = net_size * net_size;
+    int binary_plane = 0;
 
-    if (should_reorder) {
-        for (int c = 0; c < kInputChannels; ++c) {
-            int offset_r = c * board_size_ * board_size_;
-            int offset_p = c * planes_bsize * planes_bsize;
+    for (int c = 0; c < kInputChannels; ++c) {
+        const auto plane = std::begin(input.planes) + c * planes_bsize * planes_bsize;
 
-            for (int idx = 0; idx < board_size_ * board_size_; ++idx) {
-                const int x = idx % board_size_;
-                const int y = idx / board_size_;
-                if (x < planes_bsize && y < planes_bsize) {
-                    reordered_input.planes[offset_r++] = input.planes[offset_p++];
-                } else {
-                    reordered_input.planes[offset_r++] = 0.f;
-                }
+        if (c >= PackedInputData::kScalarBegin &&
+                c < PackedInputData::kScalarBegin + PackedInputData::kScalarPlanes) {
+            packed.scalars[c - PackedInputData::kScalarBegin] = plane[0];
+            continue;
+        }
+
+        // Set the bits in the order of the network board size.
+        auto words = packed.bits.data() + binary_plane * PackedInputData::kWordsPerPlane;
+        for (int idx = 0; idx < num_intersections; ++idx) {
+            const int x = idx % net_size;
+            const int y = idx / net_size;
+            if (x < planes_bsize && y < planes_bsize &&
+                    plane[y * planes_bsize + x] != 0.f) {
+                assert(plane[y * planes_bsize + x] == 1.f);
+                words[idx / 64] |= std::uint64_t{1} << (idx % 64);
+            }
+        }
+        ++binary_plane;
+    }
+}
+
+void CudaForwardPipe::RepackInputs(const PackedInputData &input,
+                                   const int from_size,
+                                   const int to_size,
+                                   PackedInputData &packed) const {
+    packed.komi = input.komi;
+    packed.board_size = input.board_size;
+    packed.side_to_move = input.side_to_move;
+    packed.need_ownership = input.need_ownership;
+    packed.need_value = input.need_value;
+    packed.scalars = input.scalars;
+    packed.bits.fill(0);
+
+    const int num_intersections = from_size * from_size;
+    for (int p = 0; p < PackedInputData::kBinaryPlanes; ++p) {
+        const auto from = input.bits.data() + p * PackedInputData::kWordsPerPlane;
+        auto to = packed.bits.data() + p * PackedInputData::kWordsPerPlane;
+        for (int idx = 0; idx < num_intersections; ++idx) {
+            if ((from[idx / 64] >> (idx % 64)) & 1) {
+                const int to_idx = (idx / from_size) * to_size + idx % from_size;
+                to[to_idx / 64] |= std::uint64_t{1} << (to_idx % 64);
             }
         }
     }
+}
 
-    auto entry = std::make_shared<ForwawrdEntry>(reordered_input, output);
-    std::unique_lock<std::mutex> lock(entry->mutex);
-    {
-        // Push the entry.
-        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
-        entry_queue_.emplace_back(entry);
+int CudaForwardPipe::GetNetBoardSize(const int board_size) const {
+    for (const auto size : resident_sizes_) {
+        if (size >= board_size) {
+            return size;
+        }
     }
+    return board_size_;
+}
 
-    if (entry_queue_.size() >= (size_t)max_batch_) {
-        cv_.notify_one(); // Wake up one worker if there are enough batch size.
+CudaForwardPipe::NNGraph *CudaForwardPipe::GetGraph(const int gpu, const int net_size) {
+    for (auto i = size_t{0}; i < resident_sizes_.size(); ++i) {
+        if (resident_sizes_[i] == net_size) {
+            return resident_nngraphs_[i][gpu].get();
+        }
     }
-    entry->cv.wait(lock); // Wait for batch forwarding worker.
-    entry->done.store(true, std::memory_order_relaxed);
+    return nngraphs_[gpu].get();
+}
 
+OutputResult CudaForwardPipe::ReorderOutputs(const OutputResult &output,
+                                                 const int planes_bsize,
+                                                 const int net_bsize) const {
     // Reorder the outputs data.
     OutputResult reordered_ouput = output;
+    const bool should_reorder = planes_bsize != net_bsize;
 
     if (should_reorder) {
         int offset_r = 0;
         int offset_p = 0;
-        for (int idx = 0; idx < board_size_ * board_size_; ++idx) {
-            const int x = idx % board_size_;
-            const int y = idx / board_size_;  
+        for (int idx = 0; idx < net_bsize * net_bsize; ++idx) {
+            const int x = idx % net_bsize;
+            const int y = idx / net_bsize;
             if (x < planes_bsize && y < planes_bsize) {
                 reordered_ouput.probabilities[offset_r] = output.probabilities[offset_p];
                 reordered_ouput.ownership[offset_r] = output.ownership[offset_p];
@@ -91,7 +237,22 @@ void CudaForwardPipe::Load(std::shared_ptr<DNNWeights> weights) {
 }
 
 void CudaForwardPipe::Reload(int board_size) {
-    if (board_size_ == board_size) {
+    // Select the matched size.
+    auto net_size = std::max(board_size, GetOption<int>("fixed_nn_boardsize"));
+
+    // The resident graphs are built once. The largest one computes
+    // every board size which is not resident.
+    auto resident_sizes = std::vector<int>{};
+    auto sizes_stream = std::istringstream{GetOption<std::string>("resident_boardsizes")};
+    int size;
+    while (sizes_stream >> size) {
+        if (size >= kMinGTPBoardSize && size <= kBoardSize) {
+            resident_sizes.emplace_back(size);
+            net_size = std::max(net_size, size);
+        }
+    }
+
+    if (board_size_ == net_size) {
         return;
     }
 
@@ -101,14 +262,7 @@ void CudaForwardPipe::Reload(int board_size) {
         return;
     }
 
-    // Select the matched size.
-    const int fixed_nn_boardsize =
-                  std::max(board_size, GetOption<int>("fixed_nn_boardsize"));
-    if (fixed_nn_boardsize > 0) {
-        board_size_ = fixed_nn_boardsize;
-    } else {
-        board_size_ = board_size;
-    }
+    board_size_ = net_size;
     max_batch_ = GetOption<int>("batch_size");
     const auto d_cnt = CUDA::GetDeviceCount();
 
@@ -139,32 +293,256 @@ void CudaForwardPipe::Reload(int board_size) {
         }
     }
 
-    for (size_t i = 0; i < gpus_list.size(); ++i) {
-        nngraphs_.emplace_back(std::make_unique<NNGraph>(io_mutex_));
+    const int num_gpus = gpus_list.size();
+    const int num_slots = std::max(1, GetOption<int>("gpu_pipeline"));
+    auto batch_sizes = std::vector<int>(num_gpus, max_batch_);
+
+    if (num_gpus >= 2) {
+        // Assign the the batch for each netork.
+        const int even_batch = std::max(
+            (max_batch_ / num_gpus) + bool(max_batch_ % num_gpus), 1);
+        std::fill(std::begin(batch_sizes), std::end(batch_sizes), even_batch);
+
+        // The calibration builds the graphs of all GPUs, so it is
+        // skipped if the GPUs are brought online lazily.
+        if (GetOption<bool>("gpu_balance") && !GetOption<bool>("lazy_gpus")) {
+            if (gpus_throughput_.size() != gpus_list.size()) {
+                gpus_throughput_ = Calibrate(gpus_list, even_batch);
+            }
+            batch_sizes = ShareBatches(max_batch_, gpus_throughput_);
+        }
     }
 
-    // TODO: Assign different batch size by device computing capability.
+    // Every device may run several workers. Each one has its own graphs
+    // and streams, so the device still has a queued batch while the
+    // other worker assembles or scatters its batch. From here on, the
+    // lists have one element for every worker.
+    const int workers_per_device = std::max(1, GetOption<int>("gpu_workers_per_device"));
+    if (workers_per_device > 1) {
+        auto workers_gpus = std::vector<int>{};
+        auto workers_batches = std::vector<int>{};
+        for (int i = 0; i < num_gpus; ++i) {
+            for (int w = 0; w < workers_per_device; ++w) {
+                workers_gpus.emplace_back(gpus_list[i]);
+                workers_batches.emplace_back(batch_sizes[i]);
+            }
+        }
+        gpus_list = workers_gpus;
+        batch_sizes = workers_batches;
+    }
+    const int num_workers = gpus_list.size();
 
-    if (gpus_list.size() >= 2) {
-        // Assign the the batch for each netork.
-        const int num_gpus = gpus_list.size();
-        max_batch_ = (max_batch_ / num_gpus) + bool(max_batch_ % num_gpus);
-        max_batch_ = std::max(max_batch_, 1);
+    for (int i = 0; i < num_workers; ++i) {
+        nngraphs_.emplace_back(std::make_unique<NNGraph>());
     }
+    PrepareQueues(gpus_list);
 
-    for (auto i = size_t{0}; i < gpus_list.size(); ++i) {
-        nngraphs_[i]->BuildGraph(
-            dump_gpu_info_, gpus_list[i], max_batch_, board_size_, weights_);
+    std::sort(std::begin(resident_sizes), std::end(resident_sizes));
+    for (const auto size : resident_sizes) {
+        if (size == board_size_ ||
+                (!resident_sizes_.empty() && resident_sizes_.back() == size)) {
+            continue;
+        }
+        resident_sizes_.emplace_back(size);
+        resident_nngraphs_.emplace_back();
+        for (auto i = size_t{0}; i < gpus_list.size(); ++i) {
+            resident_nngraphs_.back().emplace_back(std::make_unique<NNGraph>());
+        }
+    }
+
+    gpus_list_ = gpus_list;
+    batch_sizes_ = batch_sizes;
+    num_slots_ = num_slots;
+
+    // Only the workers of the first GPU are online at first if they are
+    // lazy. The others are built by their workers when the load increases.
+    const int online = GetOption<bool>("lazy_gpus") ? workers_per_device : num_workers;
+    online_gpus_.store(std::min(num_workers, std::max(online, online_gpus_.load())));
+
+    // Build the graphs of every online GPU on its own thread.
+    auto timer = Timer{};
+    auto builders = std::vector<std::thread>{};
+    for (int i = 0; i < online_gpus_.load(); ++i) {
+        builders.emplace_back([this, i]() { BuildGpuGraphs(i); });
+    }
+    for (auto &t : builders) {
+        t.join();
+    }
+    StartupProfile::Get().Add("graphs", timer.GetDurationMicroseconds() / 1000.f);
+
+    for (const auto size : resident_sizes_) {
+        LOGGING << Format("The %dx%d network graph is resident.\n", size, size);
     }
 
+    // Wake up the workers when the smallest batch is ready.
+    max_batch_ = *std::min_element(std::begin(batch_sizes), std::end(batch_sizes));
+
     dump_gpu_info_ = false; // don't show the GPU info next time.
 }
 
+void CudaForwardPipe::BuildGpuGraphs(const int gpu) {
+    // The graphs of one worker are built in order. Every graph has its
+    // own handles and streams.
+    nngraphs_[gpu]->BuildGraph(
+        dump_gpu_info_, gpus_list_[gpu], batch_sizes_[gpu], board_size_, num_slots_, weights_);
+    for (auto r = size_t{0}; r < resident_sizes_.size(); ++r) {
+        resident_nngraphs_[r][gpu]->BuildGraph(
+            false, gpus_list_[gpu], batch_sizes_[gpu], resident_sizes_[r], num_slots_, weights_);
+    }
+}
+
+void CudaForwardPipe::WarmUp(const int gpu) {
+    const int rounds = GetOption<int>("gpu_warmup");
+    if (rounds <= 0) {
+        return;
+    }
+
+    // Run the smallest and the largest batches of every graph, so the
+    // first search does not pay the lazy initialization of the kernels.
+    const auto Run = [rounds](NNGraph *graph, const int board_size) {
+        for (const int batch_size : {1, graph->GetMaxBatch()}) {
+            auto inputs = std::vector<PackedInputData>(batch_size);
+            for (auto &input : inputs) {
+                input.board_size = board_size;
+            }
+            for (int i = 0; i < rounds; ++i) {
+                graph->BatchForward(inputs);
+            }
+        }
+    };
+
+    auto timer = Timer{};
+    Run(nngraphs_[gpu].get(), board_size_);
+    for (auto r = size_t{0}; r < resident_sizes_.size(); ++r) {
+        Run(resident_nngraphs_[r][gpu].get(), resident_sizes_[r]);
+    }
+    LOGGING << Format("GPU %d is warmed up in %.1f (ms).\n",
+                          gpus_list_[gpu], timer.GetDurationMicroseconds() / 1000.f);
+}
+
+bool CudaForwardPipe::WaitOnline(const int gpu) {
+    std::unique_lock<std::mutex> lock(online_mutex_);
+    online_cv_.wait(lock, [this, gpu]() {
+                        return gpu < online_gpus_.load() ||
+                                   !worker_running_.load(std::memory_order_relaxed);
+                    });
+    return worker_running_.load(std::memory_order_relaxed);
+}
+
+void CudaForwardPipe::BringOnline() {
+    // Bring one GPU at a time. The next one waits until the last one
+    // is ready.
+    if (bringing_online_.exchange(true)) {
+        return;
+    }
+    int gpu;
+    {
+        std::lock_guard<std::mutex> lock(online_mutex_);
+        gpu = online_gpus_.load();
+        if (gpu >= (int)nngraphs_.size()) {
+            bringing_online_.store(false);
+            return;
+        }
+        online_gpus_.store(gpu + 1);
+    }
+    online_cv_.notify_all();
+    LOGGING << Format("Bring GPU %d online.\n", gpus_list_[gpu]);
+}
+
+void CudaForwardPipe::PrepareQueues(const std::vector<int> &gpus_list) {
+    if (!entry_queues_.empty()) {
+        return;
+    }
+
+    const auto &numa = Numa::Get();
+    const int num_nodes = numa.GetNumNodes();
+    const bool numa_gpus = GetOption<bool>("numa_gpus") && num_nodes > 1;
+
+    node_queue_.assign(num_nodes, 0);
+    gpu_queue_.assign(gpus_list.size(), 0);
+
+    if (!numa_gpus) {
+        entry_queues_.emplace_back(std::make_unique<EntryQueue>());
+        return;
+    }
+
+    auto queue_of_node = std::vector<int>(num_nodes, -1);
+    for (auto i = size_t{0}; i < gpus_list.size(); ++i) {
+        const int node = numa.GetDeviceNode(CUDA::GetPciBusId(gpus_list[i]));
+        if (queue_of_node[node] < 0) {
+            queue_of_node[node] = entry_queues_.size();
+            entry_queues_.emplace_back(std::make_unique<EntryQueue>());
+        }
+        gpu_queue_[i] = queue_of_node[node];
+        LOGGING << Format("GPU %d is on the NUMA node %d.\n", gpus_list[i], node);
+    }
+
+    // The nodes without any GPU use the first queue.
+    for (int node = 0; node < num_nodes; ++node) {
+        node_queue_[node] = std::max(queue_of_node[node], 0);
+    }
+}
+
+std::vector<double> CudaForwardPipe::Calibrate(const std::vector<int> &gpus_list,
+                                                   const int batch_size) {
+    static constexpr int kCalibrationRounds = 5;
+
+    auto inputs = std::vector<PackedInputData>(batch_size);
+    for (auto &input : inputs) {
+        input.board_size = board_size_;
+    }
+
+    auto throughput = std::vector<double>{};
+    for (auto gpu : gpus_list) {
+        auto graph = std::make_unique<NNGraph>();
+        graph->BuildGraph(false, gpu, batch_size, board_size_, 1, weights_);
+
+        // The first run pays for the lazy initialization.
+        graph->BatchForward(inputs);
+
+        auto timer = Timer{};
+        for (int i = 0; i < kCalibrationRounds; ++i) {
+            graph->BatchForward(inputs);
+        }
+        const auto elapsed = std::max(timer.GetDuration(), 1e-6f);
+        throughput.emplace_back(kCalibrationRounds * batch_size / elapsed);
+
+        LOGGING << Format("GPU %d throughput: %.1f positions/sec\n", gpu, throughput.back());
+        graph->DestroyGraph();
+    }
+    return throughput;
+}
+
+std::vector<int> CudaForwardPipe::ShareBatches(const int batch_size,
+                                                   const std::vector<double> &throughput) const {
+    auto total = 0.0;
+    for (auto t : throughput) {
+        total += t;
+    }
+
+    // The faster device computes the larger batch, so all devices
+    // finish their batches at about the same time.
+    auto batch_sizes = std::vector<int>{};
+    for (auto t : throughput) {
+        const auto share = std::lround(batch_size * t / total);
+        batch_sizes.emplace_back(std::max((int)share, 1));
+    }
+    return batch_sizes;
+}
+
 void CudaForwardPipe::Release() {
     for (auto &g : nngraphs_) {
         g->DestroyGraph();
     }
     nngraphs_.clear();
+
+    for (auto &graphs : resident_nngraphs_) {
+        for (auto &g : graphs) {
+            g->DestroyGraph();
+        }
+    }
+    resident_nngraphs_.clear();
+    resident_sizes_.clear();
 }
 
 void CudaForwardPipe::Destroy() {
@@ -176,6 +554,7 @@ void CudaForwardPipe::NNGraph::BuildGraph(bool dump_gpu_info,
                                           const int gpu,
                                           const int max_batch_size,
                                           const int board_size,
+                                          const int num_slots,
                                           std::shared_ptr<DNNWeights> weights) {
     if (graph_ != nullptr) {
         return;
@@ -187,6 +566,10 @@ void CudaForwardPipe::NNGraph::BuildGraph(bool dump_gpu_info,
     CUDA::SetDevice(gpu);
     handles_.ApplyOnCurrentDevice();
 
+    // The convolution layers convert their weights to half precision
+    // when loading, so set it before building the graph.
+    handles_.fp16 = GetOption<bool>("use_fp16");
+
     if (dump_gpu_info) {
         LOGGING << CUDA::GetCurrentDeviceInfo();
     }
@@ -194,6 +577,7 @@ void CudaForwardPipe::NNGraph::BuildGraph(bool dump_gpu_info,
     board_size_ = board_size;
     scratch_size_ = 0;
     max_batch_ = max_batch_size;
+    buckets_ = CUDA::GetBatchBuckets(max_batch_);
 
     const auto output_channels = weights_->residual_channels;
 
@@ -444,6 +828,9 @@ void CudaForwardPipe::NNGraph::BuildGraph(bool dump_gpu_info,
     const size_t num_intersections = board_size_ * board_size_;
 
     const size_t planes_size = factor * kInputChannels * num_intersections;
+    const size_t bits_size = max_batch_ * sizeof(std::uint64_t) *
+                                 PackedInputData::kBinaryPlanes * PackedInputData::kWordsPerPlane;
+    const size_t scalars_size = factor * PackedInputData::kScalarPlanes;
     const size_t spatia_size = factor * num_intersections;
     const size_t val_size = factor * kOuputValueMisc;
 
@@ -462,7 +849,6 @@ void CudaForwardPipe::NNGraph::BuildGraph(bool dump_gpu_info,
 
     CUDA::ReportCUDAErrors(cudaMalloc(&cuda_scratch_op_[0], scratch_size_));
     CUDA::ReportCUDAErrors(cudaMalloc(&cuda_scratch_op_[1], scratch_size_));
-    CUDA::ReportCUDAErrors(cudaMalloc(&cuda_input_planes_, planes_size));
 
     CUDA::ReportCUDAErrors(cudaMalloc(&cuda_conv_op_[0], conv_op_size));
     CUDA::ReportCUDAErrors(cudaMalloc(&cuda_conv_op_[1], conv_op_size));
@@ -476,16 +862,59 @@ void CudaForwardPipe::NNGraph::BuildGraph(bool dump_gpu_info,
     CUDA::ReportCUDAErrors(cudaMalloc(&cuda_val_op_[1], val_op2_size));
     CUDA::ReportCUDAErrors(cudaMalloc(&cuda_val_op_[2], val_op3_size));
 
-    CUDA::ReportCUDAErrors(cudaMalloc(&cuda_mask_op_[0], mask_op1_size));
-    CUDA::ReportCUDAErrors(cudaMalloc(&cuda_mask_op_[1], mask_op2_size));
+    slots_.resize(num_slots);
+    for (auto &slot : slots_) {
+        CUDA::ReportCUDAErrors(cudaMalloc(&slot.cuda_input_bits, bits_size));
+        CUDA::ReportCUDAErrors(cudaMalloc(&slot.cuda_input_scalars, scalars_size));
+        CUDA::ReportCUDAErrors(cudaMalloc(&slot.cuda_input_planes, planes_size));
+        CUDA::ReportCUDAErrors(cudaMalloc(&slot.cuda_mask_op[0], mask_op1_size));
+        CUDA::ReportCUDAErrors(cudaMalloc(&slot.cuda_mask_op[1], mask_op2_size));
+        CUDA::ReportCUDAErrors(cudaMalloc(&slot.cuda_output_prob_pass, factor));
+        CUDA::ReportCUDAErrors(cudaMalloc(&slot.cuda_output_prob, spatia_size));
+        CUDA::ReportCUDAErrors(cudaMalloc(&slot.cuda_output_ownership, spatia_size));
+        CUDA::ReportCUDAErrors(cudaMalloc(&slot.cuda_output_val, val_size));
+
+        // The asynchronous copy needs the page-locked memory.
+        CUDA::ReportCUDAErrors(cudaHostAlloc(&slot.host_input_bits, bits_size, cudaHostAllocDefault));
+        CUDA::ReportCUDAErrors(cudaHostAlloc(&slot.host_input_scalars, scalars_size, cudaHostAllocDefault));
+        CUDA::ReportCUDAErrors(cudaHostAlloc(&slot.host_mask_op[0], mask_op1_size, cudaHostAllocDefault));
+        CUDA::ReportCUDAErrors(cudaHostAlloc(&slot.host_mask_op[1], mask_op2_size, cudaHostAllocDefault));
+        CUDA::ReportCUDAErrors(cudaHostAlloc(&slot.host_output_prob_pass, factor, cudaHostAllocDefault));
+        CUDA::ReportCUDAErrors(cudaHostAlloc(&slot.host_output_prob, spatia_size, cudaHostAllocDefault));
+        CUDA::ReportCUDAErrors(cudaHostAlloc(&slot.host_output_ownership, spatia_size, cudaHostAllocDefault));
+        CUDA::ReportCUDAErrors(cudaHostAlloc(&slot.host_output_val, val_size, cudaHostAllocDefault));
+
+        CUDA::ReportCUDAErrors(cudaStreamCreateWithFlags(&slot.copy_stream, cudaStreamNonBlocking));
+        CUDA::ReportCUDAErrors(cudaEventCreateWithFlags(&slot.input_ready, cudaEventDisableTiming));
+        CUDA::ReportCUDAErrors(cudaEventCreateWithFlags(&slot.compute_done, cudaEventDisableTiming));
+        CUDA::ReportCUDAErrors(cudaEventCreateWithFlags(&slot.output_ready, cudaEventDisableTiming));
+    }
+
+    buffer_size_.store(2 * scratch_size_ +
+                           3 * conv_op_size +
+                           pol_op1_size + pol_op2_size + pol_op3_size +
+                           val_op1_size + val_op2_size + val_op3_size +
+                           num_slots * (bits_size + scalars_size + planes_size +
+                                            mask_op1_size + mask_op2_size + factor +
+                                            2 * spatia_size + val_size));
 
-    CUDA::ReportCUDAErrors(cudaMalloc(&cuda_output_prob_pass_, factor));
-    CUDA::ReportCUDAErrors(cudaMalloc(&cuda_output_prob_, spatia_size));
-    CUDA::ReportCUDAErrors(cudaMalloc(&cuda_output_ownership_, spatia_size));
-    CUDA::ReportCUDAErrors(cudaMalloc(&cuda_output_val_, val_size));
+    CaptureGraphs(GetOption<int>("cuda_graph_batches"));
 }
 
-bool CudaForwardPipe::NNGraph::ApplyMask(const std::vector<InputData> &inputs) {
+int CudaForwardPipe::NNGraph::GetNumSlots() const {
+    return slots_.size();
+}
+
+int CudaForwardPipe::NNGraph::GetMaxBatch() const {
+    return max_batch_;
+}
+
+size_t CudaForwardPipe::NNGraph::GetBufferSize() const {
+    return buffer_size_.load(std::memory_order_relaxed);
+}
+
+bool CudaForwardPipe::NNGraph::ApplyMask(IOSlot &slot,
+                                         const std::vector<const PackedInputData *> &inputs) {
     const int batch_size = inputs.size();
     if (batch_size == 0) {
         return false;
@@ -495,18 +924,18 @@ bool CudaForwardPipe::NNGraph::ApplyMask(const std::vector<InputData> &inputs) {
     bool should_apply_mask = false;
 
     for (int b = 0; b < batch_size; ++b) {
-        if (board_size_ != inputs[b].board_size) {
+        if (board_size_ != inputs[b]->board_size) {
             should_apply_mask = true;
             break;
         }
     }
 
     if (should_apply_mask) {
-        auto spat_mask = std::vector<float>(batch_size * num_intersections);
-        auto sqrt_mask = std::vector<float>(batch_size);
+        auto spat_mask = slot.host_mask_op[0];
+        auto sqrt_mask = slot.host_mask_op[1];
 
         for (int b = 0; b < batch_size; ++b) {
-            const int planes_bsize = inputs[b].board_size;
+            const int planes_bsize = inputs[b]->board_size;
             for (int idx = 0; idx < num_intersections; ++idx) {
                 const int x = idx % board_size_;
                 const int y = idx / board_size_;
@@ -520,61 +949,134 @@ bool CudaForwardPipe::NNGraph::ApplyMask(const std::vector<InputData> &inputs) {
         }
 
         // Copy the mask to device.
-        {
-            std::lock_guard<std::mutex> lock(io_mutex_);
-            CUDA::SetDevice(handles_.gpu_id);
-            CUDA::ReportCUDAErrors(cudaMemcpy(cuda_mask_op_[0],
-                                              spat_mask.data(),
-                                              spat_mask.size() * sizeof(float),
-                                              cudaMemcpyHostToDevice));
-            CUDA::ReportCUDAErrors(cudaMemcpy(cuda_mask_op_[1],
-                                              sqrt_mask.data(),
-                                              sqrt_mask.size() * sizeof(float),
-                                              cudaMemcpyHostToDevice));
-        }
+        CUDA::ReportCUDAErrors(cudaMemcpyAsync(slot.cuda_mask_op[0],
+                                               spat_mask,
+                                               batch_size * num_intersections * sizeof(float),
+                                               cudaMemcpyHostToDevice, slot.copy_stream));
+        CUDA::ReportCUDAErrors(cudaMemcpyAsync(slot.cuda_mask_op[1],
+                                               sqrt_mask,
+                                               batch_size * sizeof(float),
+                                               cudaMemcpyHostToDevice, slot.copy_stream));
     }
 
     return should_apply_mask;
 }
 
-std::vector<OutputResult> CudaForwardPipe::NNGraph::BatchForward(const std::vector<InputData> &inputs) {
+std::vector<OutputResult> CudaForwardPipe::NNGraph::BatchForward(const std::vector<PackedInputData> &inputs) {
+    auto pointers = std::vector<const PackedInputData *>(inputs.size());
+    for (auto b = size_t{0}; b < inputs.size(); ++b) {
+        pointers[b] = &inputs[b];
+    }
+    auto outputs = std::vector<OutputResult>{};
+    Enqueue(0, pointers, false);
+    Collect(0, outputs);
+    return outputs;
+}
+
+void CudaForwardPipe::NNGraph::Enqueue(const int slot_idx,
+                                       const std::vector<const PackedInputData *> &inputs,
+                                       const bool full_precision) {
     const auto batch_size = (int)inputs.size();
 
     assert(max_batch_ >= batch_size);
+    assert(slot_idx < (int)slots_.size());
+
+    auto &slot = slots_[slot_idx];
+    CUDA::SetDevice(handles_.gpu_id);
+    handles_.full_precision = full_precision;
 
-    const auto should_apply_mask = ApplyMask(inputs);
+    const auto should_apply_mask = ApplyMask(slot, inputs);
     const auto num_intersections = board_size_ * board_size_;
-    auto batch_planes = std::vector<float>(batch_size * kInputChannels * num_intersections);
+    const auto bits_size = PackedInputData::kBinaryPlanes * PackedInputData::kWordsPerPlane;
+    const auto scalars_size = PackedInputData::kScalarPlanes;
+
+    slot.board_sizes.resize(batch_size);
+    slot.komis.resize(batch_size);
+    slot.need_ownership = false;
+    slot.need_value = false;
 
     for (int b = 0; b < batch_size; ++b) {
-        const auto& input = inputs[b];
-        for (int idx = 0; idx < kInputChannels * num_intersections; ++idx) {
-            batch_planes[b * kInputChannels * num_intersections + idx] = input.planes[idx];
-        }
+        const auto &input = *inputs[b];
+        slot.need_value |= input.need_value;
+        slot.need_ownership |= input.need_value && input.need_ownership;
+        std::copy(std::begin(input.bits), std::end(input.bits),
+                      slot.host_input_bits + b * bits_size);
+        std::copy(std::begin(input.scalars), std::end(input.scalars),
+                      slot.host_input_scalars + b * scalars_size);
+        slot.board_sizes[b] = input.board_size;
+        slot.komis[b] = input.komi;
     }
 
-    std::array<float *, 2> mask_buf = cuda_mask_op_;
+    std::array<float *, 2> mask_buf = slot.cuda_mask_op;
     if (!should_apply_mask) {
         // Disable the mask.
         mask_buf[0] = mask_buf[1] = nullptr;
     }
 
-    // copy the inputs to device
-    {
-        std::lock_guard<std::mutex> lock(io_mutex_);
-        CUDA::SetDevice(handles_.gpu_id);
-        CUDA::ReportCUDAErrors(cudaMemcpy(cuda_input_planes_,
-                                          batch_planes.data(),
-                                          batch_planes.size() * sizeof(float),
-                                          cudaMemcpyHostToDevice));
+    // Copy the packed inputs to device on the copy stream. The main
+    // stream waits for it, so the copy may overlap with the computation
+    // of previous batch.
+    CUDA::ReportCUDAErrors(cudaMemcpyAsync(slot.cuda_input_bits,
+                                           slot.host_input_bits,
+                                           batch_size * bits_size * sizeof(std::uint64_t),
+                                           cudaMemcpyHostToDevice, slot.copy_stream));
+    CUDA::ReportCUDAErrors(cudaMemcpyAsync(slot.cuda_input_scalars,
+                                           slot.host_input_scalars,
+                                           batch_size * scalars_size * sizeof(float),
+                                           cudaMemcpyHostToDevice, slot.copy_stream));
+    CUDA::ReportCUDAErrors(cudaEventRecord(slot.input_ready, slot.copy_stream));
+    CUDA::ReportCUDAErrors(cudaStreamWaitEvent(handles_.stream, slot.input_ready, 0));
+
+    const auto graph_exec = GetGraphExec(slot, batch_size);
+    if (!should_apply_mask && !full_precision && graph_exec) {
+        // Replay the captured kernels of the bucket. The graph only
+        // supports the full board without the mask. It always computes
+        // the ownership and the value, but the copy is still skipped.
+        CUDA::ReportCUDAErrors(cudaGraphLaunch(graph_exec, handles_.stream));
+    } else {
+        Compute(slot, batch_size, mask_buf, slot.need_ownership, slot.need_value);
+    }
+
+    // Copy the results back to the host after the computation.
+    CUDA::ReportCUDAErrors(cudaEventRecord(slot.compute_done, handles_.stream));
+    CUDA::ReportCUDAErrors(cudaStreamWaitEvent(slot.copy_stream, slot.compute_done, 0));
+
+    CUDA::ReportCUDAErrors(cudaMemcpyAsync(slot.host_output_prob, slot.cuda_output_prob,
+                                           batch_size * num_intersections * sizeof(float),
+                                           cudaMemcpyDeviceToHost, slot.copy_stream));
+    CUDA::ReportCUDAErrors(cudaMemcpyAsync(slot.host_output_prob_pass, slot.cuda_output_prob_pass,
+                                           batch_size * sizeof(float),
+                                           cudaMemcpyDeviceToHost, slot.copy_stream));
+    if (slot.need_value) {
+        CUDA::ReportCUDAErrors(cudaMemcpyAsync(slot.host_output_val, slot.cuda_output_val,
+                                               batch_size * kOuputValueMisc * sizeof(float),
+                                               cudaMemcpyDeviceToHost, slot.copy_stream));
+    }
+    if (slot.need_ownership) {
+        CUDA::ReportCUDAErrors(cudaMemcpyAsync(slot.host_output_ownership, slot.cuda_output_ownership,
+                                               batch_size * num_intersections * sizeof(float),
+                                               cudaMemcpyDeviceToHost, slot.copy_stream));
     }
+    CUDA::ReportCUDAErrors(cudaEventRecord(slot.output_ready, slot.copy_stream));
+}
+
+void CudaForwardPipe::NNGraph::Compute(IOSlot &slot,
+                                       const int batch_size,
+                                       const std::array<float *, 2> &mask_buf,
+                                       const bool need_ownership,
+                                       const bool need_value) {
+    const auto num_intersections = board_size_ * board_size_;
+
+    // Expand the packed inputs.
+    CUDA::unpack_planes(slot.cuda_input_bits, slot.cuda_input_scalars, slot.cuda_input_planes,
+                        batch_size, kInputChannels, PackedInputData::kScalarBegin,
+                        PackedInputData::kScalarPlanes, PackedInputData::kWordsPerPlane,
+                        num_intersections, handles_.stream);
 
     graph_->input_conv.Forward(batch_size,
-                               cuda_input_planes_, cuda_conv_op_[0],
-                               cuda_scratch_op_[0], cuda_scratch_op_[1], scratch_size_);
-    graph_->input_bnorm.Forward(batch_size,
-                                cuda_conv_op_[0],
-                                nullptr, mask_buf[0]);
+                               slot.cuda_input_planes, cuda_conv_op_[0],
+                               cuda_scratch_op_[0], cuda_scratch_op_[1], scratch_size_,
+                               graph_->input_bnorm, nullptr, mask_buf[0]);
 
     // residual tower
     const auto residuals = weights_->residual_blocks;
@@ -584,25 +1086,22 @@ std::vector<OutputResult> CudaForwardPipe::NNGraph::BatchForward(const std::vect
 
         graph_->tower_conv[t_offset+0].Forward(batch_size,
                                                cuda_conv_op_[0], cuda_conv_op_[1],
-                                               cuda_scratch_op_[0], cuda_scratch_op_[1], scratch_size_);
-        graph_->tower_bnorm[t_offset+0].Forward(batch_size,
-                                                cuda_conv_op_[1],
-                                                nullptr, mask_buf[0]);
-
-        graph_->tower_conv[t_offset+1].Forward(batch_size,
-                                               cuda_conv_op_[1], cuda_conv_op_[2],
-                                               cuda_scratch_op_[0],  cuda_scratch_op_[1], scratch_size_);
+                                               cuda_scratch_op_[0], cuda_scratch_op_[1], scratch_size_,
+                                               graph_->tower_bnorm[t_offset+0], nullptr, mask_buf[0]);
+
         if (tower_ptr->apply_se) {
-            graph_->tower_bnorm[t_offset+1].Forward(batch_size,
-                                                    cuda_conv_op_[2],
-                                                    nullptr, mask_buf[0]);
+            graph_->tower_conv[t_offset+1].Forward(batch_size,
+                                                   cuda_conv_op_[1], cuda_conv_op_[2],
+                                                   cuda_scratch_op_[0], cuda_scratch_op_[1], scratch_size_,
+                                                   graph_->tower_bnorm[t_offset+1], nullptr, mask_buf[0]);
             graph_->tower_se[i].Forward(batch_size,
                                         cuda_conv_op_[2], cuda_conv_op_[0],
                                         mask_buf[0], mask_buf[1]);
         } else { 
-            graph_->tower_bnorm[t_offset+1].Forward(batch_size,
-                                                    cuda_conv_op_[2],
-                                                    cuda_conv_op_[0], mask_buf[0]);
+            graph_->tower_conv[t_offset+1].Forward(batch_size,
+                                                   cuda_conv_op_[1], cuda_conv_op_[2],
+                                                   cuda_scratch_op_[0], cuda_scratch_op_[1], scratch_size_,
+                                                   graph_->tower_bnorm[t_offset+1], cuda_conv_op_[0], mask_buf[0]);
             std::swap(cuda_conv_op_[0], cuda_conv_op_[2]);
         }
     }
@@ -632,12 +1131,15 @@ std::vector<OutputResult> CudaForwardPipe::NNGraph::BatchForward(const std::vect
                             num_intersections, handles_.stream);
     }
     graph_->p_prob.Forward(batch_size,
-                           cuda_pol_op_[0], cuda_output_prob_,
+                           cuda_pol_op_[0], slot.cuda_output_prob,
                            cuda_scratch_op_[0], cuda_scratch_op_[1], scratch_size_); 
     graph_->p_prob_pass.Forward(batch_size,
-                                cuda_pol_op_[2], cuda_output_prob_pass_);
+                                cuda_pol_op_[2], slot.cuda_output_prob_pass);
 
     // value head
+    if (!need_value) {
+        return;
+    }
     graph_->v_ex_conv.Forward(batch_size,
                               cuda_conv_op_[0], cuda_val_op_[0],
                               cuda_scratch_op_[0], cuda_scratch_op_[1], scratch_size_);
@@ -649,62 +1151,117 @@ std::vector<OutputResult> CudaForwardPipe::NNGraph::BatchForward(const std::vect
     graph_->v_inter.Forward(batch_size,
                             cuda_val_op_[1], cuda_val_op_[2]);
 
-    graph_->v_ownership.Forward(batch_size,
-                                cuda_val_op_[0], cuda_output_ownership_,
-                                cuda_scratch_op_[0], cuda_scratch_op_[1], scratch_size_);
+    if (need_ownership) {
+        graph_->v_ownership.Forward(batch_size,
+                                    cuda_val_op_[0], slot.cuda_output_ownership,
+                                    cuda_scratch_op_[0], cuda_scratch_op_[1], scratch_size_);
+    }
     graph_->v_misc.Forward(batch_size,
-                           cuda_val_op_[2], cuda_output_val_);
+                           cuda_val_op_[2], slot.cuda_output_val);
+}
 
-    auto batch_prob_pass = std::vector<float>(batch_size);
-    auto batch_prob = std::vector<float>(batch_size * num_intersections);
-    auto batch_ownership = std::vector<float>(batch_size * num_intersections);
-    auto batch_value_misc = std::vector<float>(batch_size * kOuputValueMisc);
+cudaGraphExec_t CudaForwardPipe::NNGraph::GetGraphExec(const IOSlot &slot,
+                                                        const int batch_size) const {
+    const int bucket = CUDA::GetBatchBucket(buckets_, batch_size);
+    if (bucket >= (int)slot.graph_execs.size()) {
+        return nullptr;
+    }
+    return slot.graph_execs[bucket];
+}
 
-    CUDA::WaitToFinish(handles_.stream);
+void CudaForwardPipe::NNGraph::CaptureGraphs(const int graph_batches) {
+    const auto max_graph_batch = std::min(graph_batches, max_batch_);
+    if (max_graph_batch <= 0) {
+        return;
+    }
 
-    {
-        std::lock_guard<std::mutex> lock(io_mutex_);
+    const auto no_mask = std::array<float *, 2>{nullptr, nullptr};
+    handles_.full_precision = false;
+    const auto bits_size = PackedInputData::kBinaryPlanes * PackedInputData::kWordsPerPlane;
+    const auto scalars_size = PackedInputData::kScalarPlanes;
+
+    for (auto &slot : slots_) {
+        CUDA::ReportCUDAErrors(cudaMemset(slot.cuda_input_bits, 0,
+                                          max_graph_batch * bits_size * sizeof(std::uint64_t)));
+        CUDA::ReportCUDAErrors(cudaMemset(slot.cuda_input_scalars, 0,
+                                          max_graph_batch * scalars_size * sizeof(float)));
+        slot.graph_execs.clear();
+
+        // Only the buckets are captured. The smaller batch replays the
+        // graph of its bucket, the padded rows are computed but never
+        // copied back.
+        for (const int b : buckets_) {
+            if (b > max_graph_batch) {
+                break;
+            }
+            slot.graph_execs.emplace_back(nullptr);
+
+            // Run it once before capturing. The libraries may allocate
+            // their workspace at the first call, which can not be
+            // captured.
+            Compute(slot, b, no_mask);
+            CUDA::WaitToFinish(handles_.stream);
+
+            cudaGraph_t graph;
+            CUDA::ReportCUDAErrors(cudaStreamBeginCapture(handles_.stream,
+                                                          cudaStreamCaptureModeThreadLocal));
+            Compute(slot, b, no_mask);
+            CUDA::ReportCUDAErrors(cudaStreamEndCapture(handles_.stream, &graph));
+#if CUDART_VERSION >= 11040
+            CUDA::ReportCUDAErrors(cudaGraphInstantiateWithFlags(&slot.graph_execs.back(), graph, 0));
+#else
+            CUDA::ReportCUDAErrors(cudaGraphInstantiate(&slot.graph_execs.back(), graph,
+                                                        nullptr, nullptr, 0));
+#endif
+            CUDA::ReportCUDAErrors(cudaGraphDestroy(graph));
+        }
+    }
+}
 
-        // copy the results to host memory
-        CUDA::SetDevice(handles_.gpu_id);
-        CUDA::ReportCUDAErrors(cudaMemcpy(batch_prob.data(), cuda_output_prob_,
-                                          batch_prob.size() * sizeof(float),
-                                          cudaMemcpyDeviceToHost));
+void CudaForwardPipe::NNGraph::Collect(const int slot_idx, std::vector<OutputResult> &outputs) {
+    auto &slot = slots_[slot_idx];
+    const auto batch_size = (int)slot.board_sizes.size();
+    const auto num_intersections = board_size_ * board_size_;
 
-        CUDA::ReportCUDAErrors(cudaMemcpy(batch_prob_pass.data(), cuda_output_prob_pass_,
-                                          batch_prob_pass.size() * sizeof(float),
-                                          cudaMemcpyDeviceToHost));
-     
-        CUDA::ReportCUDAErrors(cudaMemcpy(batch_value_misc.data(), cuda_output_val_,
-                                          batch_value_misc.size() * sizeof(float),
-                                          cudaMemcpyDeviceToHost));
+    CUDA::SetDevice(handles_.gpu_id);
+    CUDA::ReportCUDAErrors(cudaEventSynchronize(slot.output_ready));
 
-        CUDA::ReportCUDAErrors(cudaMemcpy(batch_ownership.data(), cuda_output_ownership_,
-                                          batch_ownership.size() * sizeof(float),
-                                          cudaMemcpyDeviceToHost));
-    }
+    const auto batch_prob = slot.host_output_prob;
+    const auto batch_prob_pass = slot.host_output_prob_pass;
+    const auto batch_value_misc = slot.host_output_val;
+    const auto batch_ownership = slot.host_output_ownership;
 
-    auto batch_output_result = std::vector<OutputResult>(batch_size);
+    outputs.resize(batch_size);
 
     for (int b = 0; b < batch_size; ++b) {
-        auto &output_result = batch_output_result[b];
+        auto &output_result = outputs[b];
         for (int idx = 0; idx < num_intersections; ++idx) {
             output_result.probabilities[idx] = batch_prob[b * num_intersections + idx];
-            output_result.ownership[idx] = batch_ownership[b * num_intersections + idx];
         }
+        if (slot.need_ownership) {
+            for (int idx = 0; idx < num_intersections; ++idx) {
+                output_result.ownership[idx] = batch_ownership[b * num_intersections + idx];
+            }
+        }
+        output_result.has_ownership = slot.need_ownership;
+        output_result.has_value = slot.need_value;
         output_result.pass_probability = batch_prob_pass[b];
 
-        output_result.wdl[0] = batch_value_misc[b * kOuputValueMisc + 0];
-        output_result.wdl[1] = batch_value_misc[b * kOuputValueMisc + 1];
-        output_result.wdl[2] = batch_value_misc[b * kOuputValueMisc + 2];
-        output_result.stm_winrate = batch_value_misc[b * kOuputValueMisc + 3];
-        output_result.final_score = batch_value_misc[b * kOuputValueMisc + 4];
+        if (slot.need_value) {
+            output_result.wdl[0] = batch_value_misc[b * kOuputValueMisc + 0];
+            output_result.wdl[1] = batch_value_misc[b * kOuputValueMisc + 1];
+            output_result.wdl[2] = batch_value_misc[b * kOuputValueMisc + 2];
+            output_result.stm_winrate = batch_value_misc[b * kOuputValueMisc + 3];
+            output_result.final_score = batch_value_misc[b * kOuputValueMisc + 4];
+        } else {
+            output_result.wdl.fill(0.f);
+            output_result.stm_winrate = 0.f;
+            output_result.final_score = 0.f;
+        }
 
-        output_result.board_size = inputs[b].board_size;
-        output_result.komi = inputs[b].komi;
+        output_result.board_size = slot.board_sizes[b];
+        output_result.komi = slot.komis[b];
     }
-
-    return batch_output_result;
 }
 
 void CudaForwardPipe::NNGraph::DestroyGraph() {
@@ -712,14 +1269,40 @@ void CudaForwardPipe::NNGraph::DestroyGraph() {
         return;
     }
 
+    buffer_size_.store(0);
     CUDA::ReportCUDAErrors(cudaFree(cuda_scratch_op_[0]));
     CUDA::ReportCUDAErrors(cudaFree(cuda_scratch_op_[1]));
 
-    CUDA::ReportCUDAErrors(cudaFree(cuda_input_planes_));
-    CUDA::ReportCUDAErrors(cudaFree(cuda_output_prob_));
-    CUDA::ReportCUDAErrors(cudaFree(cuda_output_prob_pass_));
-    CUDA::ReportCUDAErrors(cudaFree(cuda_output_val_));
-    CUDA::ReportCUDAErrors(cudaFree(cuda_output_ownership_));
+    for (auto &slot : slots_) {
+        CUDA::ReportCUDAErrors(cudaFree(slot.cuda_input_bits));
+        CUDA::ReportCUDAErrors(cudaFree(slot.cuda_input_scalars));
+        CUDA::ReportCUDAErrors(cudaFree(slot.cuda_input_planes));
+        CUDA::ReportCUDAErrors(cudaFree(slot.cuda_mask_op[0]));
+        CUDA::ReportCUDAErrors(cudaFree(slot.cuda_mask_op[1]));
+        CUDA::ReportCUDAErrors(cudaFree(slot.cuda_output_prob));
+        CUDA::ReportCUDAErrors(cudaFree(slot.cuda_output_prob_pass));
+        CUDA::ReportCUDAErrors(cudaFree(slot.cuda_output_val));
+        CUDA::ReportCUDAErrors(cudaFree(slot.cuda_output_ownership));
+
+        CUDA::ReportCUDAErrors(cudaFreeHost(slot.host_input_bits));
+        CUDA::ReportCUDAErrors(cudaFreeHost(slot.host_input_scalars));
+        CUDA::ReportCUDAErrors(cudaFreeHost(slot.host_mask_op[0]));
+        CUDA::ReportCUDAErrors(cudaFreeHost(slot.host_mask_op[1]));
+        CUDA::ReportCUDAErrors(cudaFreeHost(slot.host_output_prob));
+        CUDA::ReportCUDAErrors(cudaFreeHost(slot.host_output_prob_pass));
+        CUDA::ReportCUDAErrors(cudaFreeHost(slot.host_output_val));
+        CUDA::ReportCUDAErrors(cudaFreeHost(slot.host_output_ownership));
+
+        CUDA::ReportCUDAErrors(cudaEventDestroy(slot.input_ready));
+        CUDA::ReportCUDAErrors(cudaEventDestroy(slot.compute_done));
+        CUDA::ReportCUDAErrors(cudaEventDestroy(slot.output_ready));
+        CUDA::ReportCUDAErrors(cudaStreamDestroy(slot.copy_stream));
+
+        for (auto &graph_exec : slot.graph_execs) {
+            CUDA::ReportCUDAErrors(cudaGraphExecDestroy(graph_exec));
+        }
+    }
+    slots_.clear();
 
     CUDA::ReportCUDAErrors(cudaFree(cuda_conv_op_[0]));
     CUDA::ReportCUDAErrors(cudaFree(cuda_conv_op_[1]));
@@ -733,9 +1316,6 @@ void CudaForwardPipe::NNGraph::DestroyGraph() {
     CUDA::ReportCUDAErrors(cudaFree(cuda_val_op_[1]));
     CUDA::ReportCUDAErrors(cudaFree(cuda_val_op_[2]));
 
-    CUDA::ReportCUDAErrors(cudaFree(cuda_mask_op_[0]));
-    CUDA::ReportCUDAErrors(cudaFree(cuda_mask_op_[1]));
-
     handles_.Release();
 
     graph_.reset();
@@ -756,106 +1336,213 @@ void CudaForwardPipe::PrepareWorkers() {
 }
 
 void CudaForwardPipe::Worker(int gpu) {
+    if (!WaitOnline(gpu)) {
+        return;
+    }
+
+    // The lazy GPU builds its graphs now. The warm-up runs here
+    // before the worker takes any entry, so it does not block the
+    // startup.
+    BuildGpuGraphs(gpu);
+    WarmUp(gpu);
+    bringing_online_.store(false);
+
     const auto gpu_waittime_base = GetOption<int>("gpu_waittime");
-    waittime_.store(gpu_waittime_base, std::memory_order_relaxed);
+    const bool lazy_gpus = GetOption<bool>("lazy_gpus");
+
+    // Every worker takes its own batch size from the shared queue.
+    const int max_batch = nngraphs_[gpu]->GetMaxBatch();
+    auto &queue = *entry_queues_[gpu_queue_[gpu]];
 
-    const auto gether_batches = [this, gpu_waittime_base](){
-        auto entries = std::vector<std::shared_ptr<ForwawrdEntry>>{};
+    using EntryList = std::vector<ForwawrdEntry *>;
 
-        // Running the loop until there are enough entry size.
+    const auto gether_batches = [this, gpu, gpu_waittime_base, lazy_gpus, max_batch, &queue](EntryList &entries){
+        auto timer = Timer{};
+        bool waiting = false;
+        entries.clear();
+
+        // Running the loop until there are enough entry size or the
+        // controller decides to dispatch the current entries.
         while(true) {
             if (!worker_running_.load(std::memory_order_relaxed)) {
-                return entries;
+                return;
+            }
+
+            const int queue_size = queue.size.load(std::memory_order_acquire);
+            if (queue_size >= max_batch) {
+                break; // Finish the loop.
             }
 
-            bool narrow_pipe = narrow_pipe_.exchange(false, std::memory_order_relaxed);
-            int waittime = waittime_.load(std::memory_order_relaxed);
+            std::unique_lock<std::mutex> lock(queue.worker_mutex);
+            if (queue_size <= 0) {
+                // Sleep until the first entry arrives.
+                queue.cv.wait_for(lock, std::chrono::milliseconds(std::max(gpu_waittime_base, 1)),
+                                 [this, &queue](){ return queue.size.load(std::memory_order_acquire) > 0 ||
+                                                      !worker_running_.load(std::memory_order_relaxed); });
+                continue;
+            }
 
-            if ((int)entry_queue_.size() >= max_batch_) {
+            if (!waiting) {
+                timer.Clock();
+                waiting = true;
+            }
+            const int wait_us = batch_controller_.GetWaitMicroseconds(queue_size, max_batch) -
+                                    timer.GetDurationMicroseconds();
+            if (wait_us <= 0) {
                 break; // Finish the loop.
             }
+            queue.cv.wait_for(lock, std::chrono::microseconds(wait_us),
+                             [this, max_batch, &queue](){ return queue.size.load(std::memory_order_acquire) >= max_batch ||
+                                                             !worker_running_.load(std::memory_order_relaxed); });
+        }
 
-            // Wait some time in order to avoid busy waiting.
-            std::unique_lock<std::mutex> lock(worker_mutex_);
-            bool timeout = !cv_.wait_for(lock, std::chrono::milliseconds(waittime),
-                                             [this](){ return !((int)entry_queue_.size() < max_batch_); }
-                                         );
-
-            // Reset the waiting time.
-            if (!entry_queue_.empty()) {
-                waittime = std::min(waittime, gpu_waittime_base);
-
-                if (timeout && narrow_pipe) {
-                    // Set zero if there are still some(small than max batch size) entries
-                    // in the queue.
-                    waittime = 0;
-                } else if (waittime > 0) {
-                    // Decrease waiting time if it is time out.
-                    waittime -= 2;
-                }
+        // Gather the entries. The other worker of the same queue may
+        // take some of them first, so stop at the first failure.
+        const int count = std::min(queue.size.load(std::memory_order_acquire), max_batch);
+        ForwawrdEntry *entry;
+        while ((int)entries.size() < count && queue.ring.TryPop(entry)) {
+            entries.emplace_back(entry);
+        }
+        const int remaining = queue.size.fetch_sub(entries.size()) - (int)entries.size();
 
-                // Set the next waiting time.
-                waittime_.store(std::max(waittime, 0), std::memory_order_relaxed);
+        batch_controller_.OnDispatch(entries.size(), max_batch,
+                                     waiting ? timer.GetDurationMicroseconds() : 0);
 
-                // Finish the loop.
-                break;
-            } else {
-                if (waittime < gpu_waittime_base) {
-                    waittime_.store(waittime+1, std::memory_order_relaxed);
-                } else if (waittime < 20 * gpu_waittime_base) {
-                    waittime_.store(waittime+10, std::memory_order_relaxed);
-                }
-            }
+        if (lazy_gpus && remaining >= max_batch) {
+            // The next full batch is already waiting. The online GPUs
+            // can not keep up with the load.
+            BringOnline();
         }
 
-        // Gather the entries.
-        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
-        auto count = entry_queue_.size();
-        if (count > (size_t)max_batch_) {
-            count = max_batch_;
+        const auto now = std::chrono::steady_clock::now();
+        for (const auto &entry : entries) {
+            Metrics::AddQueueWait(std::chrono::duration_cast<std::chrono::microseconds>(
+                                      now - entry->pushed).count());
         }
+        Metrics::AddBatch(gpu, entries.size(), max_batch);
+    };
 
-        auto end = std::begin(entry_queue_);
-        std::advance(end, count);
-        std::move(std::begin(entry_queue_), end, std::back_inserter(entries));
-        entry_queue_.erase(std::begin(entry_queue_), end);
+    // All graphs have the same number of slots. The slots are taken in
+    // turn whatever the graph is, so one slot index is never in flight
+    // in two graphs.
+    struct InflightBatch {
+        NNGraph *graph;
+        int slot;
+        int net_size;
+        EntryList entries;
+    };
 
-        return entries;
+    const int num_slots = nngraphs_[gpu]->GetNumSlots();
+    auto inflight = std::deque<InflightBatch>{};
+    int next_slot = 0;
+
+    // The buffers are reused by every batch.
+    auto entries = EntryList{};
+    auto outputs = std::vector<OutputResult>{};
+    auto inputs = std::vector<const PackedInputData *>{};
+    auto repacked = std::vector<PackedInputData>(max_batch);
+    entries.reserve(max_batch);
+    outputs.reserve(max_batch);
+    inputs.reserve(max_batch);
+
+    const auto finish_oldest = [this, &inflight, &outputs]() {
+        auto &batch = inflight.front();
+        batch.graph->Collect(batch.slot, outputs);
+
+        // Scatter the results of the whole batch. Move them when there
+        // is nothing to reorder.
+        for (auto b = size_t{0}; b < batch.entries.size(); ++b) {
+            auto entry = batch.entries[b];
+            if (entry->input.board_size == batch.net_size) {
+                entry->promise.set_value(std::move(outputs[b]));
+            } else {
+                entry->promise.set_value(
+                    ReorderOutputs(outputs[b], entry->input.board_size, batch.net_size));
+            }
+            ReleaseEntry(entry);
+        }
+        inflight.pop_front();
     };
 
     while (true) {
-        if (!worker_running_.load(std::memory_order_relaxed)) return;
+        if (!worker_running_.load(std::memory_order_relaxed)) {
+            while (!inflight.empty()) {
+                finish_oldest();
+            }
+            return;
+        }
 
-        auto entries = gether_batches();
+        gether_batches(entries);
         const auto batch_size = entries.size();
 
         if (batch_size == 0) {
             continue;
         }
 
-        auto inputs = std::vector<InputData>(batch_size);
-        for (auto b = size_t{0}; b < batch_size; ++b) {
-            inputs[b] = entries[b]->input;
+        // The full precision entries are only used by the accuracy
+        // check. Compute them in their own batch.
+        auto groups = std::array<EntryList, 2>{};
+        for (auto entry : entries) {
+            groups[entry->full_precision].emplace_back(entry);
         }
 
-        auto outputs = nngraphs_[gpu]->BatchForward(inputs);
+        for (int full = 0; full < 2; ++full) {
+            auto &group = groups[full];
+            if (group.empty()) {
+                continue;
+            }
+            while ((int)inflight.size() >= num_slots) {
+                finish_oldest();
+            }
+
+            // Use the resident graph if all entries have the same size.
+            // Otherwise pad them to the largest graph.
+            auto net_size = group[0]->net_size;
+            for (const auto &entry : group) {
+                if (entry->net_size != net_size) {
+                    net_size = board_size_;
+                    break;
+                }
+            }
 
-        for (auto b = size_t{0}; b < batch_size; ++b) {
-            entries[b]->output = outputs[b];
-            while (!entries[b]->done.load(std::memory_order_relaxed)) {
-                entries[b]->cv.notify_all();
+            // Point at the packed inputs of the entries. Only the inputs
+            // of the smaller graph are copied.
+            inputs.resize(group.size());
+            for (auto b = size_t{0}; b < group.size(); ++b) {
+                if (group[b]->net_size == net_size) {
+                    inputs[b] = &group[b]->input;
+                } else {
+                    RepackInputs(group[b]->input, group[b]->net_size, net_size, repacked[b]);
+                    inputs[b] = &repacked[b];
+                }
             }
+
+            auto graph = GetGraph(gpu, net_size);
+            graph->Enqueue(next_slot, inputs, full);
+            inflight.push_back({graph, next_slot, net_size, std::move(group)});
+            next_slot = (next_slot + 1) % num_slots;
         }
 
-        if (batch_size <= (size_t)max_batch_) {
-            narrow_pipe_.store(false, std::memory_order_relaxed);
+        // Keep the batches in flight only if the next full batch is
+        // ready. Otherwise return the results now, so that the search
+        // threads do not wait for the time out.
+        while (!inflight.empty() &&
+                   ((int)inflight.size() >= num_slots ||
+                       queue.size.load(std::memory_order_acquire) < max_batch)) {
+            finish_oldest();
         }
     }
 }
 
 void CudaForwardPipe::QuitWorkers() {
     worker_running_.store(false);
-    cv_.notify_all();
+    for (auto &queue : entry_queues_) {
+        queue->cv.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(online_mutex_);
+        online_cv_.notify_all();
+    }
     for (auto &t : workers_) {
         t.join();
     }
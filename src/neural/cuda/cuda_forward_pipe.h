@@ -3,16 +3,20 @@
 #ifdef USE_CUDA
 #include <atomic>
 #include <memory>
-#include <list>
 #include <array>
 #include <vector>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
+#include <deque>
+#include <future>
+#include <string>
 
 #include "neural/cuda/cuda_layers.h"
 #include "neural/network_basic.h"
+#include "neural/batch_controller.h"
 #include "neural/description.h"
+#include "utils/mpmc_queue.h"
 
 class CudaForwardPipe : public NetworkForwardPipe {
 public:
@@ -20,6 +24,20 @@ public:
 
     virtual OutputResult Forward(const InputData &input);
 
+    virtual std::future<OutputResult> ForwardAsync(const InputData &input);
+
+    virtual std::string GetStatsString();
+
+    virtual float GetBatchFillRatio();
+
+    virtual void ResetStats();
+
+    virtual size_t GetDeviceMemoryUsed();
+
+    virtual bool ReducedPrecision();
+
+    virtual OutputResult ForwardFullPrecision(const InputData &input);
+
     virtual bool Valid();
 
     virtual void Load(std::shared_ptr<DNNWeights> weights);
@@ -63,75 +81,263 @@ private:
         };
 
     public:
-        NNGraph(std::mutex &mtx) : io_mutex_(mtx) {}
+        NNGraph() = default;
         ~NNGraph();
         void BuildGraph(bool dump_gpu_info,
                         const int gpu,
                         const int max_batch_size,
                         const int board_size,
+                        const int num_slots,
                         std::shared_ptr<DNNWeights> weights);
 
-        std::vector<OutputResult> BatchForward(const std::vector<InputData> &input);
+        std::vector<OutputResult> BatchForward(const std::vector<PackedInputData> &input);
+
+        // Copy the inputs into the pinned buffers of the slot and push
+        // the memory copy and the computation into the streams. Do not
+        // wait for the GPU. Skip the half precision path if the
+        // full_precision is true.
+        void Enqueue(const int slot,
+                     const std::vector<const PackedInputData *> &input,
+                     const bool full_precision);
+
+        // Wait for the slot and write the results into the outputs. The
+        // outputs vector is reused by the caller.
+        void Collect(const int slot, std::vector<OutputResult> &outputs);
+
+        // Return the number of in-flight batches.
+        int GetNumSlots() const;
+
+        int GetMaxBatch() const;
+
+        // Return the bytes of the device buffers allocated by
+        // BuildGraph.
+        size_t GetBufferSize() const;
 
         void DestroyGraph();
 
     private:
-        bool ApplyMask(const std::vector<InputData> &input);
+        // The input and output buffers of one in-flight batch. Every
+        // slot has its own copy stream, so that the copy of one batch
+        // overlaps with the computation of the other batch. The inner
+        // buffers are shared because all computation runs on the
+        // main stream.
+        struct IOSlot {
+            // The packed inputs are expanded into the input planes
+            // on the device.
+            std::uint64_t *cuda_input_bits;
+            float *cuda_input_scalars;
+            float *cuda_input_planes;
+            float *cuda_output_prob;
+            float *cuda_output_prob_pass;
+            float *cuda_output_val;
+            float *cuda_output_ownership;
+            std::array<float*, 2> cuda_mask_op;
+
+            // The pinned host buffers.
+            std::uint64_t *host_input_bits;
+            float *host_input_scalars;
+            float *host_output_prob;
+            float *host_output_prob_pass;
+            float *host_output_val;
+            float *host_output_ownership;
+            std::array<float*, 2> host_mask_op;
+
+            cudaStream_t copy_stream;
+            cudaEvent_t input_ready;
+            cudaEvent_t compute_done;
+            cudaEvent_t output_ready;
+
+            // The inputs information of the enqueued batch.
+            std::vector<int> board_sizes;
+            std::vector<float> komis;
+
+            // False if no entry of the batch needs the ownership. The
+            // ownership is not copied back then.
+            bool need_ownership{true};
+
+            // False if the batch only has the policy requests. The
+            // value head is skipped then.
+            bool need_value{true};
+
+            // The captured forward pass of every small batch bucket.
+            std::vector<cudaGraphExec_t> graph_execs;
+        };
+
+        bool ApplyMask(IOSlot &slot, const std::vector<const PackedInputData *> &input);
+
+        // Push all layers of the forward pass into the main stream.
+        void Compute(IOSlot &slot,
+                     const int batch_size,
+                     const std::array<float *, 2> &mask_buf,
+                     const bool need_ownership = true,
+                     const bool need_value = true);
+
+        // Capture the forward pass into the CUDA graphs for the batch
+        // buckets up to graph_batches. Replaying the graph saves the
+        // launch overhead of every kernel.
+        void CaptureGraphs(const int graph_batches);
+
+        // Return nullptr if there is no graph for the bucket of this
+        // batch size. The graph computes the whole bucket.
+        cudaGraphExec_t GetGraphExec(const IOSlot &slot, const int batch_size) const;
+
+        std::vector<IOSlot> slots_;
 
         CUDA::CudaHandles handles_;
 
         int board_size_{0};
         int max_batch_;
 
-        std::unique_ptr<Graph> graph_{nullptr};
+        // The batch buckets 1, 2, 4, ... and the max batch.
+        std::vector<int> buckets_;
 
-        float *cuda_input_planes_;
-        float *cuda_output_prob_;
-        float *cuda_output_prob_pass_;
-        float *cuda_output_val_;
-        float *cuda_output_ownership_;
+        std::unique_ptr<Graph> graph_{nullptr};
 
         std::array<float*, 2> cuda_scratch_op_;
         std::array<float*, 3> cuda_conv_op_;
         std::array<float*, 3> cuda_pol_op_;
         std::array<float*, 3> cuda_val_op_;
-        std::array<float*, 2> cuda_mask_op_;
-
-        std::mutex &io_mutex_;
 
         size_t scratch_size_;
+        std::atomic<size_t> buffer_size_{0};
         std::shared_ptr<DNNWeights> weights_{nullptr};
     };
 
+    // The entries are reused. The search thread packs its inputs into
+    // the entry directly, and the worker gives it back to the pool after
+    // setting the result.
     struct ForwawrdEntry {
-        std::atomic<bool> done{false};
-	    const InputData &input;
-        OutputResult &output;
+        // The reordered and packed inputs. The board size is still
+        // the original one.
+        PackedInputData input;
+        std::promise<OutputResult> promise;
 
-        std::condition_variable cv;
-        std::mutex mutex;
+        // The board size of the graph which the inputs are packed for.
+        int net_size{0};
+
+        // Compute it without the half precision path.
+        bool full_precision{false};
 
-        ForwawrdEntry(const InputData &in,
-                      OutputResult &out) :
-                      input(in), output(out) {}
+        // When it is pushed into the queue.
+        std::chrono::steady_clock::time_point pushed;
     };
 
+    // The capacity of the entry queues and of the free entries.
+    static constexpr int kEntryCapacity = 4096;
+
+    // Take one entry from the pool. Allocate a new one only if the
+    // pool is empty.
+    ForwawrdEntry *AcquireEntry();
+
+    void ReleaseEntry(ForwawrdEntry *entry);
+
+    // All allocated entries. The free ones are also in free_entries_.
+    std::vector<std::unique_ptr<ForwawrdEntry>> entry_pool_;
+    std::mutex entry_pool_mutex_;
+    MpmcQueue<ForwawrdEntry *> free_entries_{kEntryCapacity};
+
+    // Reorder the inputs to the board size of network and pack them
+    // into the packed.
+    void PackInputs(const InputData &input,
+                    const int net_size,
+                    PackedInputData &packed) const;
+
+    // Move the packed inputs into the layout of the larger graph.
+    void RepackInputs(const PackedInputData &input,
+                      const int from_size,
+                      const int to_size,
+                      PackedInputData &packed) const;
+
+    // Return the board size of the smallest graph which can compute
+    // this board size.
+    int GetNetBoardSize(const int board_size) const;
+
+    NNGraph *GetGraph(const int gpu, const int net_size);
+
+    std::future<OutputResult> PushEntry(const InputData &input,
+                                            const bool full_precision);
+
+    // Measure the throughput (positions per second) of every GPU
+    // with the given batch size.
+    std::vector<double> Calibrate(const std::vector<int> &gpus_list,
+                                      const int batch_size);
+
+    // Split the batch size by the throughput of every GPU.
+    std::vector<int> ShareBatches(const int batch_size,
+                                      const std::vector<double> &throughput) const;
+
+    // Reorder the outputs back to the board size of inputs.
+    OutputResult ReorderOutputs(const OutputResult &output,
+                                    const int planes_bsize,
+                                    const int net_bsize) const;
+
     std::shared_ptr<DNNWeights> weights_{nullptr};
 
-    std::list<std::shared_ptr<ForwawrdEntry>> entry_queue_;
-    std::mutex worker_mutex_;
-    std::mutex queue_mutex_;
-    std::mutex io_mutex_;
+    // The entries wait in the queue of their NUMA node, and the workers
+    // of the GPUs attached to that node take them. There is only one
+    // queue without the numa_gpus option.
+    // The search threads push the entries without any lock. The size is
+    // counted after the entry is in the ring, and the workers only sleep
+    // on the cv when the ring is not ready.
+    struct EntryQueue {
+        MpmcQueue<ForwawrdEntry *> ring{kEntryCapacity};
+        std::atomic<int> size{0};
+
+        std::mutex worker_mutex;
+        std::condition_variable cv;
+    };
+
+    // Build the queues for the GPUs. It is done only once, because the
+    // workers keep running after the reloading.
+    void PrepareQueues(const std::vector<int> &gpus_list);
+
+    std::vector<std::unique_ptr<EntryQueue>> entry_queues_;
 
-    std::condition_variable cv_;
+    // The queue index of every NUMA node and of every GPU.
+    std::vector<int> node_queue_;
+    std::vector<int> gpu_queue_;
 
-    std::atomic<int> waittime_{0};
     std::atomic<bool> worker_running_;
-    std::atomic<bool> narrow_pipe_;
+
+    BatchController batch_controller_;
 
     std::vector<std::unique_ptr<NNGraph>> nngraphs_;
+
+    // The resident graphs of the smaller board sizes, in ascending
+    // order. The nngraphs_ is the graph of the largest size, and it
+    // computes the batches of mixed sizes.
+    std::vector<int> resident_sizes_;
+    std::vector<std::vector<std::unique_ptr<NNGraph>>> resident_nngraphs_;
+
+    std::vector<double> gpus_throughput_;
     std::vector<std::thread> workers_;
 
+    // The device and the batch size of every worker, and the number of
+    // slots of the graphs. A device appears once for each of its
+    // workers. The lazy GPU builds its graphs with them later.
+    std::vector<int> gpus_list_;
+    std::vector<int> batch_sizes_;
+    int num_slots_;
+
+    // The GPUs of the index below it are online. The lazy GPUs are
+    // brought online in order when the load increases.
+    std::atomic<int> online_gpus_{0};
+    std::atomic<bool> bringing_online_{false};
+    std::mutex online_mutex_;
+    std::condition_variable online_cv_;
+
+    // Build all graphs of the GPU. The built graphs are skipped.
+    void BuildGpuGraphs(const int gpu);
+
+    // Run the dummy batches of the gpu_warmup option.
+    void WarmUp(const int gpu);
+
+    // Wait until the GPU is online. Return false if the workers quit.
+    bool WaitOnline(const int gpu);
+
+    // Bring the next GPU online.
+    void BringOnline();
+
     bool dump_gpu_info_;
     int max_batch_;
     int board_size_{0};
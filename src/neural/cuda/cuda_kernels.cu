@@ -398,6 +398,7 @@ void head_global_pooling(float *input, float *output,
 
 __global__ void se_scale_kernel(const float *input,
                                 const float *se_bias, float *data,
+                                const float *mask,
                                 int N, int C, int spatial) {
     int index = threadIdx.x + blockDim.x * blockIdx.x;
     int total_elements = N * C * spatial;
@@ -416,18 +417,21 @@ __global__ void se_scale_kernel(const float *input,
         float op = gamma * val + beta + res;
         if (op < 0)
             op = 0;
+        if (mask)
+            op *= mask[n * spatial + index % spatial];
         data[index] = op;
     }
 }
 
 void se_scale(const float *input, const float* se_bias, float* data,
+              const float *mask,
               int batch, int channels, int spatial, cudaStream_t stream) {
     const int total_elements = channels * spatial * batch;
     const int block_size = KBLOCKSIZE;
     const int blocks = DivUp(total_elements, block_size);
 
     se_scale_kernel<<<blocks, block_size, 0, stream>>>(
-        input, se_bias, data, batch, channels, spatial);
+        input, se_bias, data, mask, batch, channels, spatial);
 
     ReportCUDAErrors(cudaGetLastError());
 }
@@ -484,7 +488,16 @@ __device__ __forceinline__ void multiply_at(
     *o3 = o[3];
 }
 
-__global__ void transform_in_kernel(const float *in, float *V,
+__device__ inline void store_value(float *out, const float v) {
+    *out = v;
+}
+
+__device__ inline void store_value(half *out, const float v) {
+    *out = __float2half(v);
+}
+
+template <typename T>
+__global__ void transform_in_kernel(const float *in, T *V,
                                     const int C,
                                     const int Cpad, const int Ppad,
                                     const int board_size, const int batch_size) {
@@ -559,7 +572,7 @@ __global__ void transform_in_kernel(const float *in, float *V,
             #pragma unroll
             for (int j = 0; j < kWinogradAlpha; j++) {
                 // vstore_net_t(T2[i][j], (i*kWinogradAlpha + j)*CPpad + offset, V);
-                V[(i*kWinogradAlpha + j) * CPpad + offset] = T2[i][j];
+                store_value(V + (i*kWinogradAlpha + j) * CPpad + offset, T2[i][j]);
             }
         }
     }
@@ -567,6 +580,11 @@ __global__ void transform_in_kernel(const float *in, float *V,
 
 __global__ void transform_out_kernel(const float * M,
                                      float * Y,
+                                     const float *means,
+                                     const float *stddevs,
+                                     const float *eltwise,
+                                     const float *mask,
+                                     const bool relu,
                                      const int K,
                                      const int Kpad, const int Ppad,
                                      const int board_size, 
@@ -626,16 +644,34 @@ __global__ void transform_out_kernel(const float * M,
         const int y = kWinogradM * block_y;
         const int spatial = W * H;
 
+        // The batchnorm parameters of this channel.
+        const float mean = means ? means[k] : 0.f;
+        const float scale_stddev = means ? stddevs[k] : 1.f;
+
         #pragma unroll
         for (int i = 0; i < kWinogradM; i++) {
             #pragma unroll
             for (int j = 0; j < kWinogradM; j++) {
+                const int s_index = (y + i) * W + (x + j);
                 const int out_idx =
                     batch * K * spatial +
-                    k * spatial +
-                    (y + i) * W + (x + j);
+                    k * spatial + s_index;
                 if (y + i < H && x + j < W) {
-                    Y[out_idx] = o[i][j];
+                    float el = o[i][j];
+                    if (means) {
+                        el -= mean;
+                        el *= scale_stddev;
+                        if (eltwise) {
+                            el += eltwise[out_idx];
+                        }
+                        if (mask) {
+                            el *= mask[batch * spatial + s_index];
+                        }
+                        if (relu && el < 0) {
+                            el = 0;
+                        }
+                    }
+                    Y[out_idx] = el;
                 }
             }
         }
@@ -653,7 +689,24 @@ void winograd3_transform_in(const float *in, float *V,
     const int c_pad = channels;
     const int p_pad = batch * ptiles;
 
-    transform_in_kernel<<<blocks, block_size, 0, stream>>>(
+    transform_in_kernel<float><<<blocks, block_size, 0, stream>>>(
+        in, V, channels, c_pad, p_pad, board_size, batch);
+
+    ReportCUDAErrors(cudaGetLastError());
+}
+
+void winograd3_transform_in_half(const float *in, half *V,
+                                 int batch, int channels, int board_size, cudaStream_t stream) {
+    const int ptiles = GetWinogradP(board_size);
+    const int total_elements = channels * batch * ptiles;
+
+    const int block_size = KBLOCKSIZE;
+    const int blocks = DivUp(total_elements, block_size);
+
+    const int c_pad = channels;
+    const int p_pad = batch * ptiles;
+
+    transform_in_kernel<half><<<blocks, block_size, 0, stream>>>(
         in, V, channels, c_pad, p_pad, board_size, batch);
 
     ReportCUDAErrors(cudaGetLastError());
@@ -671,7 +724,29 @@ void winograd3_transform_out(const float *M, float *out,
     const int p_pad = batch * ptiles;
 
     transform_out_kernel<<<blocks, block_size, 0, stream>>>(
-        M, out, channels, k_pad, p_pad, board_size, batch);
+        M, out, nullptr, nullptr, nullptr, nullptr, false,
+        channels, k_pad, p_pad, board_size, batch);
+
+    ReportCUDAErrors(cudaGetLastError());
+}
+
+void winograd3_transform_out_batchnorm(const float *M, float *out,
+                                       const float *means, const float *stddevs,
+                                       const float *eltwise, const float *mask,
+                                       int batch, int channels, int board_size,
+                                       bool relu, cudaStream_t stream) {
+    const int ptiles = GetWinogradP(board_size);
+    const int total_elements = channels * batch * ptiles;
+
+    const int block_size = KBLOCKSIZE;
+    const int blocks = DivUp(total_elements, block_size);
+
+    const int k_pad = channels;
+    const int p_pad = batch * ptiles;
+
+    transform_out_kernel<<<blocks, block_size, 0, stream>>>(
+        M, out, means, stddevs, eltwise, mask, relu,
+        channels, k_pad, p_pad, board_size, batch);
 
     ReportCUDAErrors(cudaGetLastError());
 }
@@ -703,6 +778,61 @@ void conv_mul_mask(float * conv, const float *mask,
     ReportCUDAErrors(cudaGetLastError());
 }
 
+__global__ void copy_to_half_kernel(const float *input, half *output, int size) {
+    int index = threadIdx.x + blockDim.x * blockIdx.x;
+    if (index < size) {
+        output[index] = __float2half(input[index]);
+    }
+}
+
+void copy_to_half(const float *input, half *output, int size, cudaStream_t stream) {
+    const int block_size = KBLOCKSIZE;
+    const int blocks = DivUp(size, block_size);
+
+    copy_to_half_kernel<<<blocks, block_size, 0, stream>>>(
+        input, output, size);
+
+    ReportCUDAErrors(cudaGetLastError());
+}
+
+__global__ void unpack_planes_kernel(const std::uint64_t *bits, const float *scalars, float *planes,
+                                     int batch, int channels, int scalar_begin, int scalar_planes,
+                                     int words, int spatial) {
+    int index = threadIdx.x + blockDim.x * blockIdx.x;
+    if (index < batch * channels * spatial) {
+        const int s = index % spatial;
+        const int c = (index / spatial) % channels;
+        const int n = index / (spatial * channels);
+
+        const int binary_planes = channels - scalar_planes;
+        const std::uint64_t *b = bits + n * binary_planes * words;
+
+        float val;
+        if (c >= scalar_begin && c < scalar_begin + scalar_planes) {
+            const int ones_plane = binary_planes - 1;
+            const bool on_board = (b[ones_plane * words + s / 64] >> (s % 64)) & 1;
+            val = on_board ? scalars[n * scalar_planes + c - scalar_begin] : 0.f;
+        } else {
+            const int p = c < scalar_begin ? c : c - scalar_planes;
+            val = ((b[p * words + s / 64] >> (s % 64)) & 1) ? 1.f : 0.f;
+        }
+        planes[index] = val;
+    }
+}
+
+void unpack_planes(const std::uint64_t *bits, const float *scalars, float *planes,
+                   int batch, int channels, int scalar_begin, int scalar_planes,
+                   int words, int spatial, cudaStream_t stream) {
+    const int total_elements = batch * channels * spatial;
+    const int block_size = KBLOCKSIZE;
+    const int blocks = DivUp(total_elements, block_size);
+
+    unpack_planes_kernel<<<blocks, block_size, 0, stream>>>(
+        bits, scalars, planes, batch, channels, scalar_begin, scalar_planes, words, spatial);
+
+    ReportCUDAErrors(cudaGetLastError());
+}
+
 void gemm(bool TA, bool TB, int M, int N, int K, float ALPHA,
                const float *A_gpu, int lda, const float *B_gpu, int ldb,
                float BETA, float *C_gpu, int ldc, cublasHandle_t handle, cudaStream_t stream) {
@@ -736,5 +866,32 @@ void gemm_strided_batched(bool TA, bool TB, int M, int N, int K, float ALPHA,
                            batchsize));
 }
 
+void gemm_strided_batched_half(bool TA, bool TB, int M, int N, int K, float ALPHA,
+                                   const half *A_gpu, int lda, int strideA, const half *B_gpu, int ldb, int strideB,
+                                   float BETA, float *C_gpu, int ldc, int strideC, int batchsize, cublasHandle_t handle, cudaStream_t stream) {
+#if CUDART_VERSION >= 11000
+    const auto compute_type = CUBLAS_COMPUTE_32F;
+#else
+    const auto compute_type = CUDA_R_32F;
+#endif
+    // The inputs are half precision and the outputs are full
+    // precision. Accumulate with the full precision on the
+    // tensor cores.
+    ReportCUBLASErrors(cublasSetStream(handle, stream));
+    ReportCUBLASErrors(cublasGemmStridedBatchedEx(
+                           handle,
+                           (TB ? CUBLAS_OP_T : CUBLAS_OP_N),
+                           (TA ? CUBLAS_OP_T : CUBLAS_OP_N),
+                           N, M, K,
+                           &ALPHA,
+                           B_gpu, CUDA_R_16F, ldb, strideB,
+                           A_gpu, CUDA_R_16F, lda, strideA,
+                           &BETA,
+                           C_gpu, CUDA_R_32F, ldc, strideC,
+                           batchsize,
+                           compute_type,
+                           CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+}
+
 } // namespace CUDA
 #endif
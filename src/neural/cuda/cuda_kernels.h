@@ -2,6 +2,7 @@
 
 #ifdef USE_CUDA
 #include <cassert>
+#include <cstdint>
 
 #include "neural/cuda/cuda_common.h"
 namespace CUDA {
@@ -33,18 +34,42 @@ void head_global_pooling(float *input, float *output,
                          const float *sqrt_mask,
                          int batch, int channels, int spatial, cudaStream_t stream);
 
+// The SE scale and bias, the residual, the ReLU and the mask in one
+// pass. The mask may be nullptr.
 void se_scale(const float *input, const float* se_bias, float* data,
+              const float *mask,
               int batch, int channels, int spatial, cudaStream_t stream);
 
 void winograd3_transform_in(const float *in, float *V,
                             int batch, int channels, int board_size, cudaStream_t stream);
 
+// The input transform which writes the half precision tiles for the
+// half precision GEMM, without the extra conversion pass.
+void winograd3_transform_in_half(const float *in, half *V,
+                                 int batch, int channels, int board_size, cudaStream_t stream);
+
 void winograd3_transform_out(const float *M, float *out,
                              int batch, int channels, int board_size, cudaStream_t stream);
 
+// The output transform followed by the batchnorm, the residual, the
+// mask and the ReLU. It writes the output once.
+void winograd3_transform_out_batchnorm(const float *M, float *out,
+                                       const float *means, const float *stddevs,
+                                       const float *eltwise, const float *mask,
+                                       int batch, int channels, int board_size,
+                                       bool relu, cudaStream_t stream);
+
 void conv_mul_mask(float * conv, const float *mask,
                    int batch, int channels, int spatial, cudaStream_t stream);
 
+void copy_to_half(const float *input, half *output, int size, cudaStream_t stream);
+
+// Expand the bit-packed input planes. The scalar planes are the scalar
+// values masked by the last binary plane.
+void unpack_planes(const std::uint64_t *bits, const float *scalars, float *planes,
+                   int batch, int channels, int scalar_begin, int scalar_planes,
+                   int words, int spatial, cudaStream_t stream);
+
 void gemm(bool TA, bool TB, int M, int N, int K, float ALPHA,
           const float *A_gpu, int lda, const float *B_gpu, int ldb,
           float BETA, float *C_gpu, int ldc, cublasHandle_t handle, cudaStream_t stream);
@@ -53,6 +78,10 @@ void gemm_strided_batched(bool TA, bool TB, int M, int N, int K, float ALPHA,
                           const float *A_gpu, int lda, int strideA, const float *B_gpu, int ldb, int strideB,
                           float BETA, float *C_gpu, int ldc, int strideC, int batchsize, cublasHandle_t handle, cudaStream_t stream);
 
+void gemm_strided_batched_half(bool TA, bool TB, int M, int N, int K, float ALPHA,
+                               const half *A_gpu, int lda, int strideA, const half *B_gpu, int ldb, int strideB,
+                               float BETA, float *C_gpu, int ldc, int strideC, int batchsize, cublasHandle_t handle, cudaStream_t stream);
+
 } // namespace CUDA
 
 #endif
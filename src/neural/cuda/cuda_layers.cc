@@ -6,6 +6,7 @@
 #include <cassert>
 #include <iostream>
 #include <algorithm> 
+#include <sstream>
 #ifdef USE_CUDA
 
 namespace CUDA {
@@ -36,7 +37,7 @@ Batchnorm::~Batchnorm() {
 void Batchnorm::Forward(const int batch,
                         float *data,
                         const float *const eltwise,
-                        const float *const mask) {
+                        const float *const mask) const {
     if (!loaded_) {
         return;
     }
@@ -95,12 +96,21 @@ Convolution::Convolution(CudaHandles *handles,
 Convolution::~Convolution() {
     if (loaded_) {
         ReportCUDAErrors(cudaFree(cuda_weights_));
+        if (cuda_weights_half_) {
+            ReportCUDAErrors(cudaFree(cuda_weights_half_));
+        }
 
 #ifdef USE_CUDNN
         cudnnDestroyFilterDescriptor(filter_desc_);
         cudnnDestroyConvolutionDescriptor(conv_desc_);
         cudnnDestroyTensorDescriptor(in_tensor_desc_);
         cudnnDestroyTensorDescriptor(out_tensor_desc_);
+        for (auto desc : in_bucket_descs_) {
+            cudnnDestroyTensorDescriptor(desc);
+        }
+        for (auto desc : out_bucket_descs_) {
+            cudnnDestroyTensorDescriptor(desc);
+        }
         if (cuda_biases_) {
             cudnnDestroyTensorDescriptor(bias_desc_);
         }
@@ -115,11 +125,32 @@ Convolution::~Convolution() {
 
 void Convolution::Forward(const int batch, float *input, float *output,
                           void *scratch, void *scratch_other, size_t scratch_size) {
+    ForwardInternal(batch, input, output,
+                    scratch, scratch_other, scratch_size,
+                    nullptr, nullptr, nullptr);
+}
+
+void Convolution::Forward(const int batch, float *input, float *output,
+                          void *scratch, void *scratch_other, size_t scratch_size,
+                          const Batchnorm &bnorm,
+                          const float *const eltwise, const float *const mask) {
+    const auto fused = ForwardInternal(batch, input, output,
+                                       scratch, scratch_other, scratch_size,
+                                       &bnorm, eltwise, mask);
+    if (!fused) {
+        bnorm.Forward(batch, output, eltwise, mask);
+    }
+}
+
+bool Convolution::ForwardInternal(const int batch, float *input, float *output,
+                                  void *scratch, void *scratch_other, size_t scratch_size,
+                                  const Batchnorm *bnorm,
+                                  const float *const eltwise, const float *const mask) {
     if (!loaded_) {
-        return;
+        return false;
     }
     if (!scratch || !scratch_other) {
-        return;
+        return false;
     }
 
     assert(batch <= maxbatch_);
@@ -127,51 +158,90 @@ void Convolution::Forward(const int batch, float *input, float *output,
 
 #ifdef USE_CUDNN
     ReportCUDNNErrors(cudnnSetStream(handles_->cudnn_handle, handles_->stream));
-    ReportCUDNNErrors(cudnnSetTensor4dDescriptor(in_tensor_desc_,
-                                                 CUDNN_TENSOR_NCHW,
-                                                 CUDNN_DATA_FLOAT,
-                                                 batch, in_channels_, height_, width_));
-    ReportCUDNNErrors(cudnnSetTensor4dDescriptor(out_tensor_desc_,
-                                                 CUDNN_TENSOR_NCHW,
-                                                 CUDNN_DATA_FLOAT,
-                                                 batch, out_channels_, height_, width_));
-  
+    if (handles_->fp16) {
+        // Let cuDNN convert the data to half precision for the
+        // tensor cores. The accumulation is still full precision.
+        ReportCUDNNErrors(cudnnSetConvolutionMathType(conv_desc_,
+                              handles_->UseHalf() ? CUDNN_TENSOR_OP_MATH_ALLOW_CONVERSION : CUDNN_DEFAULT_MATH));
+    }
+
+    // Use the algorithm of the smallest bucket which fits the batch.
+    const int bucket = GetBatchBucket(buckets_, batch);
+    auto in_desc = in_bucket_descs_[bucket];
+    auto out_desc = out_bucket_descs_[bucket];
+    if (buckets_[bucket] != batch) {
+        in_desc = in_tensor_desc_;
+        out_desc = out_tensor_desc_;
+        ReportCUDNNErrors(cudnnSetTensor4dDescriptor(in_desc,
+                                                     CUDNN_TENSOR_NCHW,
+                                                     CUDNN_DATA_FLOAT,
+                                                     batch, in_channels_, height_, width_));
+        ReportCUDNNErrors(cudnnSetTensor4dDescriptor(out_desc,
+                                                     CUDNN_TENSOR_NCHW,
+                                                     CUDNN_DATA_FLOAT,
+                                                     batch, out_channels_, height_, width_));
+    }
+
     static constexpr float alpha = 1.0f, beta = 0.0f;
     ReportCUDNNErrors(cudnnConvolutionForward(
-                      handles_->cudnn_handle, &alpha, in_tensor_desc_, input, filter_desc_, cuda_weights_,
-                      conv_desc_, conv_algo_, scratch, scratch_size, &beta, out_tensor_desc_,
+                      handles_->cudnn_handle, &alpha, in_desc, input, filter_desc_, cuda_weights_,
+                      conv_desc_, conv_algos_[bucket], scratch, scratch_size, &beta, out_desc,
                       output));
 
 
     if (cuda_biases_) {
         ReportCUDNNErrors(cudnnAddTensor(handles_->cudnn_handle, &alpha, bias_desc_, cuda_biases_,
-                                         &alpha, out_tensor_desc_, output));
+                                         &alpha, out_desc, output));
     }
 
 #else
     (void) scratch_size;
     auto scratch_op = reinterpret_cast<float*>(scratch);
+    auto scratch_half = reinterpret_cast<half*>(scratch_op + half_offset_);
+    const bool use_half = handles_->UseHalf() && cuda_weights_half_;
 
     if (winograd_) {
-        // TODO: Merge batch norm layer with Winograd.
         auto scratch_op_other = reinterpret_cast<float*>(scratch_other);
         const int batch_ptiles = batch * GetWinogradP(board_size);
 
-        winograd3_transform_in(
-            input, scratch_op,
-            batch, in_channels_, board_size, handles_->stream);
-
-        gemm_strided_batched(
-            true, false,
-            out_channels_, batch_ptiles, in_channels_,
-            1.0f,
-            cuda_weights_, out_channels_, in_channels_ * out_channels_,
-            scratch_op, batch_ptiles, in_channels_ * batch_ptiles,
-            0.0f,
-            scratch_op_other, batch_ptiles, out_channels_ * batch_ptiles,
-            kWinogradTile,
-            handles_->cublas_handle, handles_->stream);
+        if (use_half) {
+            winograd3_transform_in_half(
+                input, scratch_half,
+                batch, in_channels_, board_size, handles_->stream);
+            gemm_strided_batched_half(
+                true, false,
+                out_channels_, batch_ptiles, in_channels_,
+                1.0f,
+                cuda_weights_half_, out_channels_, in_channels_ * out_channels_,
+                scratch_half, batch_ptiles, in_channels_ * batch_ptiles,
+                0.0f,
+                scratch_op_other, batch_ptiles, out_channels_ * batch_ptiles,
+                kWinogradTile,
+                handles_->cublas_handle, handles_->stream);
+        } else {
+            winograd3_transform_in(
+                input, scratch_op,
+                batch, in_channels_, board_size, handles_->stream);
+            gemm_strided_batched(
+                true, false,
+                out_channels_, batch_ptiles, in_channels_,
+                1.0f,
+                cuda_weights_, out_channels_, in_channels_ * out_channels_,
+                scratch_op, batch_ptiles, in_channels_ * batch_ptiles,
+                0.0f,
+                scratch_op_other, batch_ptiles, out_channels_ * batch_ptiles,
+                kWinogradTile,
+                handles_->cublas_handle, handles_->stream);
+        }
 
+        if (bnorm && bnorm->loaded_ && !cuda_biases_) {
+            // Apply the batchnorm layer when writing the output.
+            winograd3_transform_out_batchnorm(
+                scratch_op_other, output,
+                bnorm->cuda_means_, bnorm->cuda_stddevs_, eltwise, mask,
+                batch, out_channels_, board_size, bnorm->relu_, handles_->stream);
+            return true;
+        }
         winograd3_transform_out(
             scratch_op_other, output,
             batch, out_channels_, board_size, handles_->stream);
@@ -197,27 +267,57 @@ void Convolution::Forward(const int batch, float *input, float *output,
 #else
         if (filters_ != 1) {
             im2col_batched(filters_, batch, in_channels_, height_, width_, input, scratch_op, handles_->stream);
-            gemm_strided_batched(
-                false, false,
-                out_channels_, spatial_size_, filter_dim_,
-                1.0f,
-                cuda_weights_, filter_dim_, 0,
-                scratch_op, spatial_size_, filter_dim_ * spatial_size_,
-                0.f,
-                output, spatial_size_, out_channels_ * spatial_size_,
-                batch,
-                handles_->cublas_handle, handles_->stream);
+            if (use_half) {
+                copy_to_half(scratch_op, scratch_half,
+                             batch * filter_dim_ * spatial_size_, handles_->stream);
+                gemm_strided_batched_half(
+                    false, false,
+                    out_channels_, spatial_size_, filter_dim_,
+                    1.0f,
+                    cuda_weights_half_, filter_dim_, 0,
+                    scratch_half, spatial_size_, filter_dim_ * spatial_size_,
+                    0.f,
+                    output, spatial_size_, out_channels_ * spatial_size_,
+                    batch,
+                    handles_->cublas_handle, handles_->stream);
+            } else {
+                gemm_strided_batched(
+                    false, false,
+                    out_channels_, spatial_size_, filter_dim_,
+                    1.0f,
+                    cuda_weights_, filter_dim_, 0,
+                    scratch_op, spatial_size_, filter_dim_ * spatial_size_,
+                    0.f,
+                    output, spatial_size_, out_channels_ * spatial_size_,
+                    batch,
+                    handles_->cublas_handle, handles_->stream);
+            }
         } else {
-            gemm_strided_batched(
-                false, false,
-                out_channels_, spatial_size_, filter_dim_,
-                1.0f,
-                cuda_weights_, filter_dim_, 0,
-                input, spatial_size_, in_channels_ * spatial_size_,
-                0.f,
-                output, spatial_size_, out_channels_ * spatial_size_,
-                batch,
-                handles_->cublas_handle, handles_->stream);
+            if (use_half) {
+                copy_to_half(input, scratch_half,
+                             batch * in_channels_ * spatial_size_, handles_->stream);
+                gemm_strided_batched_half(
+                    false, false,
+                    out_channels_, spatial_size_, filter_dim_,
+                    1.0f,
+                    cuda_weights_half_, filter_dim_, 0,
+                    scratch_half, spatial_size_, in_channels_ * spatial_size_,
+                    0.f,
+                    output, spatial_size_, out_channels_ * spatial_size_,
+                    batch,
+                    handles_->cublas_handle, handles_->stream);
+            } else {
+                gemm_strided_batched(
+                    false, false,
+                    out_channels_, spatial_size_, filter_dim_,
+                    1.0f,
+                    cuda_weights_, filter_dim_, 0,
+                    input, spatial_size_, in_channels_ * spatial_size_,
+                    0.f,
+                    output, spatial_size_, out_channels_ * spatial_size_,
+                    batch,
+                    handles_->cublas_handle, handles_->stream);
+            }
         }
 #endif
     }
@@ -228,6 +328,7 @@ void Convolution::Forward(const int batch, float *input, float *output,
                     spatial_size_, false, handles_->stream);
     }
 #endif
+    return false;
 }
 
 void Convolution::LoadingWeight(const std::vector<float> &weights,
@@ -263,6 +364,17 @@ void Convolution::LoadingWeight(const std::vector<float> &weights,
     loaded_ = true;
     size_t apply_scratch_size = 0;
 
+#ifndef USE_CUDNN
+    if (handles_->fp16) {
+        // Convert the weights to half precision once. The full
+        // precision weights are kept for the accuracy check.
+        const int weights_count = weights_copy.size();
+        ReportCUDAErrors(cudaMalloc(&cuda_weights_half_, sizeof(half) * weights_count));
+        copy_to_half(cuda_weights_, cuda_weights_half_, weights_count, handles_->stream);
+        WaitToFinish(handles_->stream);
+    }
+#endif
+
 #ifdef USE_CUDNN
     cudnnCreateFilterDescriptor(&filter_desc_);
     cudnnCreateTensorDescriptor(&in_tensor_desc_);
@@ -288,37 +400,55 @@ void Convolution::LoadingWeight(const std::vector<float> &weights,
                                                  CUDNN_DATA_FLOAT,
                                                  maxbatch_, out_channels_, height_, width_));
 
-    ReportCUDNNErrors(cudnnSetConvolutionMathType(conv_desc_, CUDNN_DEFAULT_MATH));
-
-#if CUDNN_MAJOR >= 8
-    cudnnConvolutionFwdAlgoPerf_t  conv_perf;
-    int returned_cnt;
-    ReportCUDNNErrors(cudnnFindConvolutionForwardAlgorithm(handles_->cudnn_handle,
-                                                           in_tensor_desc_,
-                                                           filter_desc_,
-                                                           conv_desc_,
-                                                           out_tensor_desc_,
-                                                           1,
-                                                           &returned_cnt,
-                                                           &conv_perf));
-    conv_algo_ = conv_perf.algo;
-#else
-    ReportCUDNNErrors(cudnnGetConvolutionForwardAlgorithm(handles_->cudnn_handle,
-                                                          in_tensor_desc_,
-                                                          filter_desc_,
-                                                          conv_desc_,
-                                                          out_tensor_desc_,
-                                                          CUDNN_CONVOLUTION_FWD_PREFER_FASTEST,
-                                                          0,
-                                                          &conv_algo_));
-#endif
-    ReportCUDNNErrors(cudnnGetConvolutionForwardWorkspaceSize(handles_->cudnn_handle,
-                                                              in_tensor_desc_,
-                                                              filter_desc_,
-                                                              conv_desc_,
-                                                              out_tensor_desc_,
-                                                              conv_algo_,
-                                                              &apply_scratch_size));
+    buckets_ = GetBatchBuckets(maxbatch_);
+    for (const int batch : buckets_) {
+        cudnnTensorDescriptor_t in_desc;
+        cudnnTensorDescriptor_t out_desc;
+        cudnnCreateTensorDescriptor(&in_desc);
+        cudnnCreateTensorDescriptor(&out_desc);
+        ReportCUDNNErrors(cudnnSetTensor4dDescriptor(in_desc,
+                                                     CUDNN_TENSOR_NCHW,
+                                                     CUDNN_DATA_FLOAT,
+                                                     batch, in_channels_, height_, width_));
+        ReportCUDNNErrors(cudnnSetTensor4dDescriptor(out_desc,
+                                                     CUDNN_TENSOR_NCHW,
+                                                     CUDNN_DATA_FLOAT,
+                                                     batch, out_channels_, height_, width_));
+        in_bucket_descs_.emplace_back(in_desc);
+        out_bucket_descs_.emplace_back(out_desc);
+
+        ReportCUDNNErrors(cudnnSetConvolutionMathType(conv_desc_,
+                              handles_->fp16 ? CUDNN_TENSOR_OP_MATH_ALLOW_CONVERSION : CUDNN_DEFAULT_MATH));
+        const auto conv_algo = TuneAlgorithm(batch, in_desc, out_desc);
+        conv_algos_.emplace_back(conv_algo);
+
+        // The smaller batch of the bucket needs no larger workspace
+        // than the bucket size.
+        size_t algo_scratch_size = 0;
+        ReportCUDNNErrors(cudnnGetConvolutionForwardWorkspaceSize(handles_->cudnn_handle,
+                                                                  in_desc,
+                                                                  filter_desc_,
+                                                                  conv_desc_,
+                                                                  out_desc,
+                                                                  conv_algo,
+                                                                  &algo_scratch_size));
+        apply_scratch_size = std::max(apply_scratch_size, algo_scratch_size);
+
+        if (handles_->fp16) {
+            // The full precision path uses the same algorithm. Be sure
+            // that the scratch is large enough for it.
+            ReportCUDNNErrors(cudnnSetConvolutionMathType(conv_desc_, CUDNN_DEFAULT_MATH));
+            ReportCUDNNErrors(cudnnGetConvolutionForwardWorkspaceSize(handles_->cudnn_handle,
+                                                                      in_desc,
+                                                                      filter_desc_,
+                                                                      conv_desc_,
+                                                                      out_desc,
+                                                                      conv_algo,
+                                                                      &algo_scratch_size));
+            ReportCUDNNErrors(cudnnSetConvolutionMathType(conv_desc_, CUDNN_TENSOR_OP_MATH_ALLOW_CONVERSION));
+            apply_scratch_size = std::max(apply_scratch_size, algo_scratch_size);
+        }
+    }
 
     scratch_size = std::max(apply_scratch_size, scratch_size);
 #else
@@ -333,11 +463,71 @@ void Convolution::LoadingWeight(const std::vector<float> &weights,
         scratch_size_base = filter_dim_ * spatial_size_;
     }
     apply_scratch_size = maxbatch_ * scratch_size_base * sizeof(float);
+
+    if (handles_->fp16) {
+        // Put the half precision inputs after the full precision
+        // buffer. Keep the 256 bytes alignment for the tensor cores.
+        half_offset_ = DivUp(maxbatch_ * scratch_size_base, 64) * 64;
+        apply_scratch_size = half_offset_ * sizeof(float) +
+                                 maxbatch_ * scratch_size_base * sizeof(half);
+    }
     scratch_size = std::max(apply_scratch_size, scratch_size);
 #endif
 }
 
 
+#ifdef USE_CUDNN
+cudnnConvolutionFwdAlgo_t Convolution::TuneAlgorithm(const int batch,
+                                                     cudnnTensorDescriptor_t in_desc,
+                                                     cudnnTensorDescriptor_t out_desc) {
+    auto conv_algo = cudnnConvolutionFwdAlgo_t{};
+#if CUDNN_MAJOR >= 8
+    // Benchmark the algorithms only for the new shape.
+    auto tuning_key = std::ostringstream{};
+    tuning_key << GetCurrentDeviceName() << ':' << CUDNN_VERSION
+                   << ':' << (handles_->fp16 ? "fp16" : "fp32")
+                   << ':' << batch << 'x' << in_channels_ << 'x' << out_channels_
+                   << 'x' << filters_ << 'x' << height_ << 'x' << width_;
+
+    auto &tuning_cache = CudnnTuningCache::Get();
+    if (!tuning_cache.Lookup(tuning_key.str(), conv_algo)) {
+        cudnnConvolutionFwdAlgoPerf_t conv_perf[CUDNN_CONVOLUTION_FWD_ALGO_COUNT];
+        int returned_cnt = 0;
+        ReportCUDNNErrors(cudnnFindConvolutionForwardAlgorithm(handles_->cudnn_handle,
+                                                               in_desc,
+                                                               filter_desc_,
+                                                               conv_desc_,
+                                                               out_desc,
+                                                               CUDNN_CONVOLUTION_FWD_ALGO_COUNT,
+                                                               &returned_cnt,
+                                                               conv_perf));
+
+        // The results are sorted by the time. Some of them may fail,
+        // e.g. out of memory.
+        conv_algo = conv_perf[0].algo;
+        for (int i = 0; i < returned_cnt; ++i) {
+            if (conv_perf[i].status == CUDNN_STATUS_SUCCESS) {
+                conv_algo = conv_perf[i].algo;
+                break;
+            }
+        }
+        tuning_cache.Insert(tuning_key.str(), conv_algo);
+    }
+#else
+    (void) batch;
+    ReportCUDNNErrors(cudnnGetConvolutionForwardAlgorithm(handles_->cudnn_handle,
+                                                          in_desc,
+                                                          filter_desc_,
+                                                          conv_desc_,
+                                                          out_desc,
+                                                          CUDNN_CONVOLUTION_FWD_PREFER_FASTEST,
+                                                          0,
+                                                          &conv_algo));
+#endif
+    return conv_algo;
+}
+#endif
+
 void Convolution::LoadingWeight(const std::vector<float> &weights,
                                 const std::vector<float> &biases,
                                 size_t &scratch_size, bool winpgrad) {
@@ -553,12 +743,7 @@ void SEUnit::Forward(const int batch, float *input, float *ouput, float *mask, f
     add_vectors(cuda_op_[2], cuda_weights_b2_, cuda_op_[2],
                 fc2_output_size * batch, fc2_output_size, fc2_output_size * batch, fc2_relu, handles_->stream);
 
-    se_scale(input, cuda_op_[2], ouput, batch, channels_, spatial_size_, handles_->stream);
-
-    if (mask) {
-        conv_mul_mask(ouput, mask, batch, channels_,
-                      spatial_size_, handles_->stream);
-    }
+    se_scale(input, cuda_op_[2], ouput, mask, batch, channels_, spatial_size_, handles_->stream);
 }
 
 SEUnit::~SEUnit() {
@@ -29,11 +29,14 @@ public:
 
     void Forward(const int batch, float *data,
                  const float *const eltwise,
-                 const float *const mask);
+                 const float *const mask) const;
 
     void LoadingWeight(const std::vector<float> &means,
                        const std::vector<float> &stddevs);
 private:
+    // The convolution may fuse this layer into its output.
+    friend class Convolution;
+
     float *cuda_means_;
     float *cuda_stddevs_;
     int channels_;
@@ -50,6 +53,14 @@ public:
     void Forward(const int batch, float *input, float *output,
                  void *scratch, void *scratch_other, size_t scratch_size);
 
+    // Compute the convolution and the following batchnorm layer. The
+    // batchnorm, the residual and the ReLU are applied in the output
+    // transform if possible, so the output is written only once.
+    void Forward(const int batch, float *input, float *output,
+                 void *scratch, void *scratch_other, size_t scratch_size,
+                 const Batchnorm &bnorm,
+                 const float *const eltwise, const float *const mask);
+
     void LoadingWeight(const std::vector<float> &weights,
                        size_t &scratch_size,
                        bool winograd);
@@ -60,6 +71,12 @@ public:
                        bool winograd);
 
 private:
+    // Return true if the batchnorm is fused.
+    bool ForwardInternal(const int batch, float *input, float *output,
+                         void *scratch, void *scratch_other, size_t scratch_size,
+                         const Batchnorm *bnorm,
+                         const float *const eltwise, const float *const mask);
+
     int filter_dim_;
     int filters_;
     int in_channels_;
@@ -67,18 +84,36 @@ private:
     bool winograd_;
 
 #ifdef USE_CUDNN
+    // Tune the algorithm for the shape of one bucket.
+    cudnnConvolutionFwdAlgo_t TuneAlgorithm(const int batch,
+                                            cudnnTensorDescriptor_t in_desc,
+                                            cudnnTensorDescriptor_t out_desc);
+
     cudnnFilterDescriptor_t filter_desc_;
+
+    // The spare descriptors for the batch which is not a bucket size.
     cudnnTensorDescriptor_t in_tensor_desc_;
     cudnnTensorDescriptor_t out_tensor_desc_;
 
     cudnnConvolutionDescriptor_t conv_desc_;
 
     cudnnTensorDescriptor_t bias_desc_;
-    cudnnConvolutionFwdAlgo_t conv_algo_;
+
+    // The descriptors and the algorithm of every batch bucket, so a
+    // small batch does not run the algorithm tuned for the max batch.
+    std::vector<int> buckets_;
+    std::vector<cudnnTensorDescriptor_t> in_bucket_descs_;
+    std::vector<cudnnTensorDescriptor_t> out_bucket_descs_;
+    std::vector<cudnnConvolutionFwdAlgo_t> conv_algos_;
 #endif
 
     float *cuda_weights_;
     float *cuda_biases_{nullptr};
+
+    // The half precision weights. The half precision inputs are
+    // stored in the scratch after the offset.
+    half *cuda_weights_half_{nullptr};
+    size_t half_offset_{0};
 };
 
 class FullyConnect : public LayerBasic {
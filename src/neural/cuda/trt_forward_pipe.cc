@@ -0,0 +1,475 @@
+#ifdef USE_TENSORRT
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <sstream>
+
+#include <NvOnnxParser.h>
+
+#include "config.h"
+#include "neural/cuda/trt_forward_pipe.h"
+#include "neural/onnx_export.h"
+#include "utils/log.h"
+#include "utils/format.h"
+#include "utils/time.h"
+#include "utils/metrics.h"
+
+void TrtForwardPipe::Logger::log(Severity severity, const char *msg) noexcept {
+    if (severity <= Severity::kWARNING) {
+        LOGGING << "TensorRT: " << msg << '\n';
+    }
+}
+
+TrtForwardPipe::Engine::~Engine() {
+    // Destroy the context before its engine.
+    context.reset();
+    engine.reset();
+    runtime.reset();
+
+    ReportCUDAErrors(cudaFree(cuda_planes));
+    ReportCUDAErrors(cudaFree(cuda_policy));
+    ReportCUDAErrors(cudaFree(cuda_pass));
+    ReportCUDAErrors(cudaFree(cuda_ownership));
+    ReportCUDAErrors(cudaFree(cuda_misc));
+}
+
+void TrtForwardPipe::Initialize(std::shared_ptr<DNNWeights> weights) {
+    LOGGING << CUDA::GetBackendInfo();
+    LOGGING << Format("TensorRT version: %d.%d.%d\n",
+                          NV_TENSORRT_MAJOR, NV_TENSORRT_MINOR, NV_TENSORRT_PATCH);
+
+    // The engine runs on the first GPU of the list.
+    auto gpus = std::istringstream{GetOption<std::string>("gpus")};
+    if (!(gpus >> gpu_) || gpu_ >= CUDA::GetDeviceCount()) {
+        gpu_ = 0;
+    }
+    CUDA::SetDevice(gpu_);
+    LOGGING << CUDA::GetCurrentDeviceInfo();
+    ReportCUDAErrors(cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking));
+
+    max_batch_ = GetOption<int>("batch_size");
+    if (max_batch_ <= 0) {
+        max_batch_ = std::max(GetOption<int>("threads"), 1);
+    }
+    fp16_ = GetOption<bool>("use_fp16");
+
+    const auto planes_size = max_batch_ * kInputChannels * kNumIntersections;
+    const auto spatial_size = max_batch_ * kNumIntersections;
+    ReportCUDAErrors(cudaMallocHost(&host_planes_, planes_size * sizeof(float)));
+    ReportCUDAErrors(cudaMallocHost(&host_policy_, spatial_size * sizeof(float)));
+    ReportCUDAErrors(cudaMallocHost(&host_pass_, max_batch_ * sizeof(float)));
+    ReportCUDAErrors(cudaMallocHost(&host_ownership_, spatial_size * sizeof(float)));
+    ReportCUDAErrors(cudaMallocHost(&host_misc_, max_batch_ * kOuputValueMisc * sizeof(float)));
+
+    batch_controller_.Reset(1000 * GetOption<int>("gpu_waittime"));
+    Load(weights);
+    PrepareWorkers();
+}
+
+void TrtForwardPipe::Load(std::shared_ptr<DNNWeights> weights) {
+    {
+        // The old engines are for the old weights.
+        std::lock_guard<std::mutex> lock(engines_mutex_);
+        engines_.clear();
+    }
+    weights_ = weights;
+}
+
+std::string TrtForwardPipe::GetSerializedEngine(const int board_size) {
+    const auto model = GetOnnxModel(weights_, board_size);
+
+    // The engine is only valid for the same model, GPU model and
+    // settings.
+    auto cache_file = std::string{};
+    const auto cache_dir = GetOption<std::string>("tensorrt_cache");
+    if (!cache_dir.empty()) {
+        const auto key = std::hash<std::string>{}(
+                             model + CUDA::GetCurrentDeviceName() +
+                             std::to_string(NV_TENSORRT_VERSION));
+        cache_file = Format("%s/%016zx-%dx%d-b%d-%s.engine",
+                                cache_dir.c_str(), key, board_size, board_size,
+                                max_batch_, fp16_ ? "fp16" : "fp32");
+
+        auto file = std::ifstream{cache_file, std::ios::binary};
+        if (file.is_open()) {
+            auto plan = std::string{std::istreambuf_iterator<char>(file),
+                                        std::istreambuf_iterator<char>()};
+            if (!plan.empty()) {
+                LOGGING << Format("Load the TensorRT engine from %s.\n", cache_file.c_str());
+                return plan;
+            }
+        }
+    }
+
+    LOGGING << Format("Build the %dx%d TensorRT engine. It may take a few minutes.\n",
+                          board_size, board_size);
+    auto timer = Timer{};
+
+    auto builder = std::unique_ptr<nvinfer1::IBuilder>(
+                       nvinfer1::createInferBuilder(logger_));
+    const auto flags = 1U << static_cast<std::uint32_t>(
+                           nvinfer1::NetworkDefinitionCreationFlag::kEXPLICIT_BATCH);
+    auto network = std::unique_ptr<nvinfer1::INetworkDefinition>(
+                       builder->createNetworkV2(flags));
+    auto parser = std::unique_ptr<nvonnxparser::IParser>(
+                      nvonnxparser::createParser(*network, logger_));
+    if (!parser->parse(model.data(), model.size())) {
+        LOGGING << "Fail to parse the ONNX model.\n";
+        return std::string{};
+    }
+
+    auto config = std::unique_ptr<nvinfer1::IBuilderConfig>(
+                      builder->createBuilderConfig());
+    if (fp16_ && builder->platformHasFastFp16()) {
+        config->setFlag(nvinfer1::BuilderFlag::kFP16);
+    }
+
+    // One profile covers all batch sizes. It is tuned for the max
+    // batch size.
+    auto profile = builder->createOptimizationProfile();
+    const auto dims = [board_size](int batch) {
+        return nvinfer1::Dims4{batch, kInputChannels, board_size, board_size};
+    };
+    profile->setDimensions("planes", nvinfer1::OptProfileSelector::kMIN, dims(1));
+    profile->setDimensions("planes", nvinfer1::OptProfileSelector::kOPT, dims(max_batch_));
+    profile->setDimensions("planes", nvinfer1::OptProfileSelector::kMAX, dims(max_batch_));
+    config->addOptimizationProfile(profile);
+
+    auto serialized = std::unique_ptr<nvinfer1::IHostMemory>(
+                          builder->buildSerializedNetwork(*network, *config));
+    if (!serialized) {
+        LOGGING << "Fail to build the TensorRT engine.\n";
+        return std::string{};
+    }
+    auto plan = std::string(static_cast<const char *>(serialized->data()),
+                                serialized->size());
+    LOGGING << Format("Done! Built the engine in %.2f sec.\n", timer.GetDuration());
+
+    if (!cache_file.empty()) {
+        auto file = std::ofstream{cache_file, std::ios::binary};
+        if (!file.is_open() || !file.write(plan.data(), plan.size())) {
+            LOGGING << Format("Fail to write the TensorRT engine into %s.\n",
+                                  cache_file.c_str());
+        }
+    }
+    return plan;
+}
+
+std::unique_ptr<TrtForwardPipe::Engine> TrtForwardPipe::BuildEngine(const int board_size) {
+    const auto plan = GetSerializedEngine(board_size);
+    if (plan.empty()) {
+        return nullptr;
+    }
+
+    auto engine = std::make_unique<Engine>();
+    engine->runtime.reset(nvinfer1::createInferRuntime(logger_));
+    engine->engine.reset(engine->runtime->deserializeCudaEngine(plan.data(), plan.size()));
+    if (!engine->engine) {
+        LOGGING << "Fail to load the TensorRT engine.\n";
+        return nullptr;
+    }
+    engine->context.reset(engine->engine->createExecutionContext());
+
+    const auto num_intersections = board_size * board_size;
+    ReportCUDAErrors(cudaMalloc(&engine->cuda_planes,
+                                    max_batch_ * kInputChannels * num_intersections * sizeof(float)));
+    ReportCUDAErrors(cudaMalloc(&engine->cuda_policy, max_batch_ * num_intersections * sizeof(float)));
+    ReportCUDAErrors(cudaMalloc(&engine->cuda_pass, max_batch_ * sizeof(float)));
+    ReportCUDAErrors(cudaMalloc(&engine->cuda_ownership, max_batch_ * num_intersections * sizeof(float)));
+    ReportCUDAErrors(cudaMalloc(&engine->cuda_misc, max_batch_ * kOuputValueMisc * sizeof(float)));
+
+    auto context = engine->context.get();
+    context->setTensorAddress("planes", engine->cuda_planes);
+    context->setTensorAddress("policy", engine->cuda_policy);
+    context->setTensorAddress("pass", engine->cuda_pass);
+    context->setTensorAddress("ownership", engine->cuda_ownership);
+    context->setTensorAddress("value_misc", engine->cuda_misc);
+    return engine;
+}
+
+TrtForwardPipe::Engine *TrtForwardPipe::GetEngine(const int board_size) {
+    std::lock_guard<std::mutex> lock(engines_mutex_);
+    auto it = engines_.find(board_size);
+    if (it == std::end(engines_)) {
+        CUDA::SetDevice(gpu_);
+        it = engines_.emplace(board_size, BuildEngine(board_size)).first;
+    }
+    return it->second.get();
+}
+
+OutputResult TrtForwardPipe::Forward(const InputData &inpnt) {
+    return ForwardAsync(inpnt).get();
+}
+
+std::future<OutputResult> TrtForwardPipe::ForwardAsync(const InputData &inpnt) {
+    auto entry = std::make_shared<ForwardEntry>(inpnt);
+    auto future = entry->promise.get_future();
+    auto queue_size = size_t{0};
+    {
+        // Push the entry.
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        entry_queue_.emplace_back(entry);
+        queue_size = entry_queue_.size();
+    }
+    batch_controller_.OnArrival();
+
+    if (queue_size == 1 || queue_size >= (size_t)max_batch_) {
+        // Wake up the worker if it is the first entry or there are
+        // enough batch size.
+        cv_.notify_one();
+    }
+
+    // The batch forwarding worker sets the result.
+    return future;
+}
+
+void TrtForwardPipe::BatchForward(const int board_size,
+                                  std::vector<std::shared_ptr<ForwardEntry>> &entries) {
+    const int batch_size = entries.size();
+    const int num_intersections = board_size * board_size;
+    const int planes_size = kInputChannels * num_intersections;
+
+    auto engine = GetEngine(board_size);
+    if (engine == nullptr) {
+        // Do not block the search threads forever.
+        for (auto &entry : entries) {
+            entry->promise.set_value(OutputResult{});
+        }
+        return;
+    }
+
+    for (int b = 0; b < batch_size; ++b) {
+        std::copy(std::begin(entries[b]->input.planes),
+                  std::begin(entries[b]->input.planes) + planes_size,
+                  host_planes_ + b * planes_size);
+    }
+
+    auto context = engine->context.get();
+    context->setInputShape("planes",
+                               nvinfer1::Dims4{batch_size, kInputChannels, board_size, board_size});
+
+    ReportCUDAErrors(cudaMemcpyAsync(engine->cuda_planes, host_planes_,
+                                         batch_size * planes_size * sizeof(float),
+                                         cudaMemcpyHostToDevice, stream_));
+    if (!context->enqueueV3(stream_)) {
+        LOGGING << "Fail to run the TensorRT engine.\n";
+    }
+    ReportCUDAErrors(cudaMemcpyAsync(host_policy_, engine->cuda_policy,
+                                         batch_size * num_intersections * sizeof(float),
+                                         cudaMemcpyDeviceToHost, stream_));
+    ReportCUDAErrors(cudaMemcpyAsync(host_pass_, engine->cuda_pass,
+                                         batch_size * sizeof(float),
+                                         cudaMemcpyDeviceToHost, stream_));
+    ReportCUDAErrors(cudaMemcpyAsync(host_ownership_, engine->cuda_ownership,
+                                         batch_size * num_intersections * sizeof(float),
+                                         cudaMemcpyDeviceToHost, stream_));
+    ReportCUDAErrors(cudaMemcpyAsync(host_misc_, engine->cuda_misc,
+                                         batch_size * kOuputValueMisc * sizeof(float),
+                                         cudaMemcpyDeviceToHost, stream_));
+    CUDA::WaitToFinish(stream_);
+
+    for (int b = 0; b < batch_size; ++b) {
+        const auto &input = entries[b]->input;
+        const auto misc = host_misc_ + b * kOuputValueMisc;
+        auto result = OutputResult{};
+
+        result.board_size = board_size;
+        result.komi = input.komi;
+        result.wdl[0] = misc[0];
+        result.wdl[1] = misc[1];
+        result.wdl[2] = misc[2];
+        result.stm_winrate = misc[3];
+        result.final_score = misc[4];
+        result.pass_probability = host_pass_[b];
+
+        // The engine always computes the ownership.
+        result.has_ownership = true;
+        std::copy(host_policy_ + b * num_intersections,
+                  host_policy_ + (b+1) * num_intersections,
+                  std::begin(result.probabilities));
+        std::copy(host_ownership_ + b * num_intersections,
+                  host_ownership_ + (b+1) * num_intersections,
+                  std::begin(result.ownership));
+        entries[b]->promise.set_value(result);
+    }
+}
+
+std::string TrtForwardPipe::GetStatsString() {
+    return batch_controller_.GetStatsString();
+}
+
+float TrtForwardPipe::GetBatchFillRatio() {
+    return batch_controller_.GetFillRatio();
+}
+
+void TrtForwardPipe::ResetStats() {
+    batch_controller_.ResetStats();
+}
+
+bool TrtForwardPipe::ReducedPrecision() {
+    return fp16_;
+}
+
+bool TrtForwardPipe::Valid() {
+    return weights_ != nullptr;
+}
+
+void TrtForwardPipe::Reload(int board_size) {
+    if (weights_ != nullptr && board_size > 0) {
+        // Build the engine before the search needs it.
+        GetEngine(board_size);
+    }
+}
+
+void TrtForwardPipe::Release() {
+    std::lock_guard<std::mutex> lock(engines_mutex_);
+    engines_.clear();
+}
+
+void TrtForwardPipe::Destroy() {
+    QuitWorkers();
+    Release();
+
+    if (stream_ != nullptr) {
+        ReportCUDAErrors(cudaStreamDestroy(stream_));
+        stream_ = nullptr;
+    }
+    for (auto ptr : {&host_planes_, &host_policy_, &host_pass_,
+                         &host_ownership_, &host_misc_}) {
+        ReportCUDAErrors(cudaFreeHost(*ptr));
+        *ptr = nullptr;
+    }
+}
+
+void TrtForwardPipe::PrepareWorkers() {
+    worker_running_.store(true);
+    if (!worker_.joinable()) {
+        worker_ = std::thread([this](){ Worker(); });
+    }
+}
+
+void TrtForwardPipe::Worker() {
+    const auto waittime_base = GetOption<int>("gpu_waittime");
+    const int max_batch = max_batch_;
+
+    CUDA::SetDevice(gpu_);
+
+    const auto gether_batches = [this, waittime_base, max_batch](){
+        auto entries = std::vector<std::shared_ptr<ForwardEntry>>{};
+        auto timer = Timer{};
+        bool waiting = false;
+
+        // Running the loop until there are enough entry size or the
+        // controller decides to dispatch the current entries.
+        while(true) {
+            if (!worker_running_.load(std::memory_order_relaxed)) {
+                return entries;
+            }
+
+            const int queue_size = entry_queue_.size();
+            if (queue_size >= max_batch) {
+                break; // Finish the loop.
+            }
+
+            std::unique_lock<std::mutex> lock(worker_mutex_);
+            if (queue_size == 0) {
+                // Sleep until the first entry arrives.
+                cv_.wait_for(lock, std::chrono::milliseconds(std::max(waittime_base, 1)),
+                                 [this](){ return !entry_queue_.empty() ||
+                                                      !worker_running_.load(std::memory_order_relaxed); });
+                continue;
+            }
+
+            if (!waiting) {
+                timer.Clock();
+                waiting = true;
+            }
+            const int wait_us = batch_controller_.GetWaitMicroseconds(queue_size, max_batch) -
+                                    timer.GetDurationMicroseconds();
+            if (wait_us <= 0) {
+                break; // Finish the loop.
+            }
+            cv_.wait_for(lock, std::chrono::microseconds(wait_us),
+                             [this, max_batch](){ return !((int)entry_queue_.size() < max_batch) ||
+                                                             !worker_running_.load(std::memory_order_relaxed); });
+        }
+
+        // Gather the entries.
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        auto count = std::min(entry_queue_.size(), (size_t)max_batch);
+
+        auto end = std::begin(entry_queue_);
+        std::advance(end, count);
+        std::move(std::begin(entry_queue_), end, std::back_inserter(entries));
+        entry_queue_.erase(std::begin(entry_queue_), end);
+
+        batch_controller_.OnDispatch(entries.size(), max_batch,
+                                     waiting ? timer.GetDurationMicroseconds() : 0);
+
+        const auto now = std::chrono::steady_clock::now();
+        for (const auto &entry : entries) {
+            Metrics::AddQueueWait(std::chrono::duration_cast<std::chrono::microseconds>(
+                                      now - entry->pushed).count());
+        }
+        Metrics::AddBatch(0, entries.size(), max_batch);
+        return entries;
+    };
+
+    auto group = std::vector<std::shared_ptr<ForwardEntry>>{};
+    auto remaining = std::vector<std::shared_ptr<ForwardEntry>>{};
+
+    while (true) {
+        if (!worker_running_.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        auto entries = gether_batches();
+
+        // Every board size has its own engine, so compute every board
+        // size in its own batch.
+        while (!entries.empty()) {
+            const auto board_size = entries[0]->input.board_size;
+            group.clear();
+            remaining.clear();
+            for (auto &entry : entries) {
+                if (entry->input.board_size == board_size) {
+                    group.emplace_back(std::move(entry));
+                } else {
+                    remaining.emplace_back(std::move(entry));
+                }
+            }
+            std::swap(entries, remaining);
+            BatchForward(board_size, group);
+        }
+    }
+}
+
+void TrtForwardPipe::QuitWorkers() {
+    worker_running_.store(false);
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+
+    // Compute the remaining entries so that no thread waits for
+    // them forever.
+    std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+    while (!entry_queue_.empty()) {
+        const auto board_size = entry_queue_.front()->input.board_size;
+        auto group = std::vector<std::shared_ptr<ForwardEntry>>{};
+        for (auto it = std::begin(entry_queue_); it != std::end(entry_queue_) &&
+                 (int)group.size() < max_batch_;) {
+            if ((*it)->input.board_size == board_size) {
+                group.emplace_back(*it);
+                it = entry_queue_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        BatchForward(board_size, group);
+    }
+}
+
+#endif
@@ -0,0 +1,138 @@
+#pragma once
+
+#ifdef USE_TENSORRT
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <NvInfer.h>
+
+#include "neural/network_basic.h"
+#include "neural/batch_controller.h"
+#include "neural/description.h"
+#include "neural/cuda/cuda_common.h"
+
+// Compute the network with the TensorRT engine. The engine is built
+// from the ONNX model of the weights, so TensorRT fuses the layers
+// and picks the kernels itself. Every board size has its own engine
+// because the board size is fixed in the ONNX model. The serialized
+// engines are kept in the cache directory, so the later startups skip
+// the building.
+class TrtForwardPipe : public NetworkForwardPipe {
+public:
+    virtual void Initialize(std::shared_ptr<DNNWeights> weights);
+
+    virtual OutputResult Forward(const InputData &inpnt);
+
+    virtual std::future<OutputResult> ForwardAsync(const InputData &inpnt);
+
+    virtual std::string GetStatsString();
+
+    virtual float GetBatchFillRatio();
+
+    virtual void ResetStats();
+
+    virtual bool ReducedPrecision();
+
+    virtual bool Valid();
+
+    virtual void Load(std::shared_ptr<DNNWeights> weights);
+
+    virtual void Reload(int board_size);
+
+    virtual void Release();
+
+    virtual void Destroy();
+
+private:
+    class Logger : public nvinfer1::ILogger {
+    public:
+        void log(Severity severity, const char *msg) noexcept override;
+    };
+
+    // The engine of one board size and its device buffers.
+    struct Engine {
+        std::unique_ptr<nvinfer1::IRuntime> runtime;
+        std::unique_ptr<nvinfer1::ICudaEngine> engine;
+        std::unique_ptr<nvinfer1::IExecutionContext> context;
+
+        float *cuda_planes{nullptr};
+        float *cuda_policy{nullptr};
+        float *cuda_pass{nullptr};
+        float *cuda_ownership{nullptr};
+        float *cuda_misc{nullptr};
+
+        ~Engine();
+    };
+
+    struct ForwardEntry {
+        InputData input;
+        std::promise<OutputResult> promise;
+
+        // When it is pushed into the queue.
+        std::chrono::steady_clock::time_point pushed;
+
+        ForwardEntry(const InputData &in)
+            : input(in), pushed(std::chrono::steady_clock::now()) {}
+    };
+
+    // Return the engine of the board size. Build it or load it from
+    // the cache if it is not ready.
+    Engine *GetEngine(const int board_size);
+
+    std::unique_ptr<Engine> BuildEngine(const int board_size);
+
+    // Return the serialized engine, or empty if fail.
+    std::string GetSerializedEngine(const int board_size);
+
+    // Compute the entries in one batch. All inputs must be in the
+    // same board size.
+    void BatchForward(const int board_size,
+                      std::vector<std::shared_ptr<ForwardEntry>> &entries);
+
+    void PrepareWorkers();
+    void Worker();
+    void QuitWorkers();
+
+    std::shared_ptr<DNNWeights> weights_{nullptr};
+
+    Logger logger_;
+    std::map<int, std::unique_ptr<Engine>> engines_;
+    std::mutex engines_mutex_;
+
+    cudaStream_t stream_{nullptr};
+    int gpu_{0};
+    int max_batch_{1};
+    bool fp16_{false};
+
+    // The pinned host buffers of one batch.
+    float *host_planes_{nullptr};
+    float *host_policy_{nullptr};
+    float *host_pass_{nullptr};
+    float *host_ownership_{nullptr};
+    float *host_misc_{nullptr};
+
+    std::list<std::shared_ptr<ForwardEntry>> entry_queue_;
+    std::mutex worker_mutex_;
+    std::mutex queue_mutex_;
+
+    std::condition_variable cv_;
+
+    std::atomic<bool> worker_running_{false};
+
+    // Decide how long the worker waits for the entries.
+    BatchController batch_controller_;
+
+    std::thread worker_;
+};
+
+#endif
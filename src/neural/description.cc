@@ -109,3 +109,19 @@ std::vector<float>& ConvLayer::GetWeights() {
 std::vector<float>& ConvLayer::GetBiases() {
     return biases_;
 }
+
+std::vector<std::int8_t>& ConvLayer::GetInt8Weights() {
+    return int8_weights_;
+}
+
+std::vector<float>& ConvLayer::GetInt8Scales() {
+    return int8_scales_;
+}
+
+std::vector<std::uint16_t>& ConvLayer::GetBf16Weights() {
+    return bf16_weights_;
+}
+
+AlignedVector<float>& ConvLayer::GetPackedWeights() {
+    return packed_weights_;
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "utils/aligned_allocator.h"
+
 #include <cmath>
+#include <cstdint>
 #include <vector>
 
 class LinearLayer {
@@ -72,10 +75,31 @@ public:
     std::vector<float>& GetWeights();
     std::vector<float>& GetBiases();
 
+    // The quantized weights for the INT8 pipe. The layout is
+    // [outputs, padded (inputs * filter * filter)] and every output
+    // channel has its own scale.
+    std::vector<std::int8_t>& GetInt8Weights();
+    std::vector<float>& GetInt8Scales();
+
+    // The bfloat16 weights for the BF16 pipe. The layout is [outputs,
+    // padded (inputs * filter * filter)].
+    std::vector<std::uint16_t>& GetBf16Weights();
+
+    // The weights packed in the panels of the built-in SGEMM. It is
+    // empty if the layer is not packed.
+    AlignedVector<float>& GetPackedWeights();
+
 private:
     std::vector<float> weights_;
     std::vector<float> biases_;
 
+    std::vector<std::int8_t> int8_weights_;
+    std::vector<float> int8_scales_;
+
+    std::vector<std::uint16_t> bf16_weights_;
+
+    AlignedVector<float> packed_weights_;
+
     int inputs_{0};
     int outputs_{0};
     int filter_{0};
@@ -101,6 +125,7 @@ public:
     bool loaded{false};
     bool winograd{false};
     bool winograd_initialized{false};
+    bool sgemm_packed{false};
 
     int input_channels{0};
 
@@ -30,21 +30,124 @@ std::vector<float> Encoder::GetPlanes(const GameState &state, int symmetry) cons
     auto num_intersections = state.GetNumIntersections();
     auto plane_size = num_intersections * kPlaneChannels;
     auto planes = std::vector<float>(plane_size, 0.f);
-    auto it = std::begin(planes);
 
-    EncoderHistoryMove(state, kHistoryMoves, it);
-    it += kHistoryMoves * 3 * num_intersections;
+    auto past = std::min(state.GetMoveNumber()+1, kHistoryMoves);
+    auto history = std::vector<std::pair<std::uint64_t, int>>(past);
+    for (int p = 0; p < past; ++p) {
+        const auto board = state.GetPastBoard(p);
+        history[p] = {board->GetHash(), board->GetLastMove()};
+    }
+
+    if (!ReusePlanes(state, history, planes)) {
+        auto it = std::begin(planes);
+
+        EncoderHistoryMove(state, kHistoryMoves, it);
+        it += kHistoryMoves * 3 * num_intersections;
 
-    EncoderFeatures(state, it);
-    it += kNumFeatures * num_intersections;
+        EncoderFeatures(state, it);
+        it += kNumFeatures * num_intersections;
 
-    assert(it == std::end(planes));
+        assert(it == std::end(planes));
+    }
+    StorePlanes(state, history, planes);
 
-    SymmetryPlanes(state, planes, symmetry);
+    if (symmetry != Symmetry::kIdentitySymmetry) {
+        SymmetryPlanes(state, planes, symmetry);
+    }
 
     return planes;
 }
 
+std::array<Encoder::EncodedPosition,
+               Encoder::kRecentPositions>& Encoder::GetRecentPositions() {
+    static thread_local std::array<EncodedPosition, kRecentPositions> recent;
+    return recent;
+}
+
+bool Encoder::ReusePlanes(const GameState &state,
+                          const std::vector<std::pair<std::uint64_t, int>> &history,
+                          std::vector<float> &planes) const {
+    const auto board_size = state.GetBoardSize();
+    const auto num_intersections = state.GetNumIntersections();
+    const auto to_move = state.GetToMove();
+    const auto komi = state.GetKomi();
+    const auto past = (int)history.size();
+
+    for (auto &recent : GetRecentPositions()) {
+        if (recent.board_size != board_size || recent.komi != komi) {
+            continue;
+        }
+
+        if (recent.to_move == to_move && recent.history == history) {
+            // It is the same position.
+            std::copy(std::begin(recent.planes), std::end(recent.planes),
+                          std::begin(planes));
+            return true;
+        }
+
+        const auto parent_past = (int)recent.history.size();
+        if (recent.to_move == to_move ||
+                past < 2 || parent_past < past - 1 ||
+                !std::equal(std::begin(history) + 1, std::end(history),
+                                std::begin(recent.history))) {
+            continue;
+        }
+
+        // It is the parent position. Shift its history planes by one
+        // move. The side to move is changed, so swap the stones planes.
+        auto it = std::begin(planes);
+        const auto parent_it = std::begin(recent.planes);
+        for (int p = 1; p < past; ++p) {
+            const auto src = parent_it + 3 * (p-1) * num_intersections;
+            const auto dst = it + 3 * p * num_intersections;
+            std::copy(src + 1 * num_intersections,
+                          src + 2 * num_intersections, dst + 0 * num_intersections);
+            std::copy(src + 0 * num_intersections,
+                          src + 1 * num_intersections, dst + 1 * num_intersections);
+            std::copy(src + 2 * num_intersections,
+                          src + 3 * num_intersections, dst + 2 * num_intersections);
+        }
+
+        // Only encode the current board.
+        EncoderHistoryMove(state, 1, it);
+
+        const auto board = state.GetPastBoard(0);
+        const auto features_it = it + kHistoryMoves * 3 * num_intersections;
+        const auto parent_features_it = parent_it + kHistoryMoves * 3 * num_intersections;
+
+        if (board->GetLastMove() == kPass &&
+                std::all_of(parent_features_it, parent_features_it + num_intersections,
+                                [](float v) { return v == 0.f; })) {
+            // The pass move does not change the stones. The safe area,
+            // liberties and ladders are same as the parent position if
+            // there is no ko move.
+            std::copy(parent_features_it + 1 * num_intersections,
+                          parent_features_it + 10 * num_intersections,
+                          features_it + 1 * num_intersections);
+            FillKoMove(board.get(), features_it);
+            FillMisc(board.get(), to_move, komi, features_it + 10 * num_intersections);
+        } else {
+            EncoderFeatures(state, features_it);
+        }
+        return true;
+    }
+    return false;
+}
+
+void Encoder::StorePlanes(const GameState &state,
+                          std::vector<std::pair<std::uint64_t, int>> &history,
+                          const std::vector<float> &planes) const {
+    static thread_local int next = 0;
+    auto &recent = GetRecentPositions()[next];
+    next = (next + 1) % kRecentPositions;
+
+    recent.history.swap(history);
+    recent.board_size = state.GetBoardSize();
+    recent.to_move = state.GetToMove();
+    recent.komi = state.GetKomi();
+    recent.planes = planes;
+}
+
 std::string Encoder::GetPlanesString(const GameState &state, int symmetry) const {
     auto out = std::ostringstream{};
     auto boardsize = state.GetBoardSize();
@@ -109,22 +212,12 @@ void Encoder::FillColorStones(const Board* board,
 
 void Encoder::FillMove(const Board* board,
                        std::vector<float>::iterator move_it) const {
-    auto boardsize = board->GetBoardSize();
-    auto num_intersections = board->GetNumIntersections();
-
     auto last_move = board->GetLastMove();
     if (last_move == kNullVertex || last_move == kPass || last_move == kResign) {
         return;
     } else {
-        for (int index = 0; index < num_intersections; ++index) {
-            auto x = index % boardsize;
-            auto y = index / boardsize;
-            auto vtx = board->GetVertex(x, y);
-
-            if (vtx == last_move) {
-                move_it[index] = static_cast<float>(true);
-            }
-        }
+        auto index = board->GetIndex(board->GetX(last_move), board->GetY(last_move));
+        move_it[index] = static_cast<float>(true);
     }
 }
 
@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <array>
+#include <cstdint>
+#include <utility>
 #include "game/symmetry.h"
 #include "game/game_state.h"
 #include "neural/network_basic.h"
@@ -37,6 +39,33 @@ public:
     std::string GetPlanesString(const GameState &state, int symmetry = Symmetry::kIdentitySymmetry) const;
 
 private:
+    // The planes of a recently encoded position before applying the
+    // symmetry. The past boards are identified by their hash and last
+    // move.
+    struct EncodedPosition {
+        std::vector<std::pair<std::uint64_t, int>> history;
+        int board_size{-1};
+        int to_move{kInvalid};
+        float komi{0.f};
+        std::vector<float> planes;
+    };
+
+    // The number of recently encoded positions kept by every thread.
+    static constexpr int kRecentPositions = 4;
+
+    static std::array<EncodedPosition, kRecentPositions>& GetRecentPositions();
+
+    // Fill the planes from a recently encoded position. It is the
+    // same position or the parent position. Return false if there
+    // is no such position.
+    bool ReusePlanes(const GameState &state,
+                     const std::vector<std::pair<std::uint64_t, int>> &history,
+                     std::vector<float> &planes) const;
+
+    void StorePlanes(const GameState &state,
+                     std::vector<std::pair<std::uint64_t, int>> &history,
+                     const std::vector<float> &planes) const;
+
     void SymmetryPlanes(const GameState &state, std::vector<float> &planes, int symmetry) const;
 
     void FillColorStones(const Board* board,
@@ -0,0 +1,157 @@
+#include "neural/inference_server.h"
+#include "neural/remote_forward_pipe.h"
+#include "utils/log.h"
+#include "utils/format.h"
+#include "config.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+constexpr int InferenceServer::kMaxQueuedFrames;
+
+InferenceServer::InferenceServer() {
+    if (Initialize()) {
+        Loop();
+    }
+}
+
+bool InferenceServer::Initialize() {
+    // The clients keep their own cache.
+    SetOption("cache_memory_mib", 0);
+
+    network_.Initialize(GetOption<std::string>("weights_file"));
+    if (!network_.Valid()) {
+        LOGGING << "The inference server requires the weights file.\n";
+        return false;
+    }
+
+    // The smaller boards are masked in the network board size.
+    board_size_ = std::max(GetOption<int>("defualt_boardsize"),
+                               GetOption<int>("fixed_nn_boardsize"));
+    network_.Reload(board_size_);
+    return true;
+}
+
+void InferenceServer::Loop() {
+    const int port = GetOption<int>("server_port");
+    auto server = Socket{};
+
+    if (!server.Listen(port)) {
+        LOGGING << Format("Fail to listen on the port %d.\n", port);
+        return;
+    }
+    LOGGING << Format("The inference server is listening on the port %d, board size %d.\n",
+                          port, board_size_);
+
+    while (true) {
+        auto client = server.Accept();
+        if (!client.Valid()) {
+            continue;
+        }
+        std::thread([this, client = std::move(client)]() mutable {
+            ServeClient(std::move(client));
+        }).detach();
+    }
+}
+
+void InferenceServer::ServeClient(Socket socket) {
+    const auto hello = RemoteForwardPipe::GetHello();
+    auto client_hello = RemoteForwardPipe::Hello{};
+
+    if (!socket.RecvAll(&client_hello, sizeof(client_hello)) ||
+            !socket.SendAll(&hello, sizeof(hello)) ||
+            !RemoteForwardPipe::MatchHello(hello, client_hello)) {
+        return;
+    }
+    LOGGING << Format("The client is connected, %d clients.\n", num_clients_.fetch_add(1) + 1);
+
+    using Frame = std::vector<std::future<OutputResult>>;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Frame> frames;
+    bool closed = false;
+
+    // Send the results in the order of the frames. The next frames
+    // are already in the pipe when it waits for the current one.
+    auto writer = std::thread([&]() {
+        auto results = std::vector<OutputResult>{};
+        bool failed = false;
+
+        while (true) {
+            auto frame = Frame{};
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]() { return closed || !frames.empty(); });
+                if (frames.empty()) {
+                    break;
+                }
+                frame = std::move(frames.front());
+                frames.pop_front();
+            }
+            cv.notify_all();
+
+            results.clear();
+            for (auto &f : frame) {
+                results.emplace_back(f.get());
+            }
+            const std::uint32_t count = results.size();
+            if (!failed &&
+                    (!socket.SendAll(&count, sizeof(count)) ||
+                         !socket.SendAll(results.data(), count * sizeof(OutputResult)))) {
+                // Stop the reader. Keep draining the frames.
+                failed = true;
+                socket.Shutdown();
+            }
+        }
+    });
+
+    auto packed = std::vector<PackedInputData>{};
+    bool warned = false;
+
+    while (true) {
+        std::uint32_t count;
+        if (!socket.RecvAll(&count, sizeof(count)) ||
+                count > RemoteForwardPipe::kMaxFrameEntries) {
+            break;
+        }
+        packed.resize(count);
+        if (!socket.RecvAll(packed.data(), count * sizeof(PackedInputData))) {
+            break;
+        }
+
+        auto frame = Frame{};
+        for (const auto &p : packed) {
+            if (p.board_size <= 0 || p.board_size > board_size_) {
+                if (!warned) {
+                    LOGGING << Format("The board size %d is larger than the server network, set --fixed-nn-boardsize.\n",
+                                          p.board_size);
+                    warned = true;
+                }
+                auto promise = std::promise<OutputResult>{};
+                promise.set_value(OutputResult{});
+                frame.emplace_back(promise.get_future());
+                continue;
+            }
+            frame.emplace_back(network_.ForwardRawAsync(RemoteForwardPipe::UnpackInputs(p)));
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return (int)frames.size() < kMaxQueuedFrames; });
+        frames.emplace_back(std::move(frame));
+        lock.unlock();
+        cv.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    cv.notify_all();
+    writer.join();
+
+    LOGGING << Format("The client is disconnected, %d clients.\n", num_clients_.fetch_sub(1) - 1);
+}
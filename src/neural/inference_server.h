@@ -0,0 +1,28 @@
+#pragma once
+
+#include "neural/network.h"
+#include "utils/socket.h"
+
+#include <atomic>
+
+// Compute the inputs of the RemoteForwardPipe clients. All clients share
+// one network, so the forwarding pipe batches the inputs of all search
+// engines together.
+class InferenceServer {
+public:
+    InferenceServer();
+
+private:
+    // Load the network. Return false if fail.
+    bool Initialize();
+    void Loop();
+
+    // Answer the frames of one client until it is disconnected.
+    void ServeClient(Socket socket);
+
+    static constexpr int kMaxQueuedFrames = 64;
+
+    Network network_;
+    int board_size_;
+    std::atomic<int> num_clients_{0};
+};
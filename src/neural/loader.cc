@@ -1,11 +1,19 @@
 #include "neural/loader.h"
 #include "neural/network_basic.h"
+#include "neural/blas/bf16_convolution.h"
+#include "neural/blas/winograd_convolution3.h"
+#include "neural/winograd_helper.h"
 #include "utils/splitter.h"
 #include "utils/log.h"
 #include "utils/format.h"
 #include "utils/parse_float.h"
+#include "utils/mapped_file.h"
 #include "config.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 
@@ -13,6 +21,29 @@
 #include "fast_float.h"
 #endif 
 
+// The memory mapped weights format.
+//
+// [ 0,  8) magic "SAYURIMW"
+// [ 8, 12) uint32 format version
+// [12, 16) uint32 size of text header
+// [16, 24) uint64 offset of the parameters
+// [24, 32) uint64 number of parameter arrays
+// [32, 64) reserved
+// [64,  .) the text header, same as the info and struct scopes of
+//          the text weights file
+//
+// Every parameter array begins at the 64 bytes aligned offset. It
+// is a uint64 count of floats followed by the little endian float32
+// values at the next aligned offset.
+static constexpr char kMappedMagic[] = "SAYURIMW";
+static constexpr std::uint32_t kMappedVersion = 1;
+static constexpr size_t kMappedAlignment = 64;
+static constexpr size_t kMappedHeaderSize = 64;
+
+static size_t AlignMapped(size_t offset) {
+    return (offset + kMappedAlignment - 1) / kMappedAlignment * kMappedAlignment;
+}
+
 DNNLoder& DNNLoder::Get() {
     static DNNLoder lodaer;
     return lodaer;
@@ -35,11 +66,18 @@ void DNNLoder::FromFile(std::shared_ptr<DNNWeights> weights, std::string filenam
         return;
     }
 
-    char c;
-    while (file.get(c)) {
-        // Copy the file data to buffer.
-        buffer << c;
+    char magic[sizeof(kMappedMagic)] = {0};
+    file.read(magic, sizeof(kMappedMagic) - 1);
+    if (std::strcmp(magic, kMappedMagic) == 0) {
+        file.close();
+        FromMappedFile(weights, filename);
+        return;
     }
+    file.clear();
+    file.seekg(0, std::ios::beg);
+
+    // Copy the file data to buffer.
+    buffer << file.rdbuf();
 
     file.close();
 
@@ -86,6 +124,28 @@ void DNNLoder::Parse(std::shared_ptr<DNNWeights> weights, std::istream &buffer)
     auto netinfo = NetInfo{};
     auto netstruct = NetStruct{};
 
+    ParseHeader(netinfo, netstruct, buffer);
+
+    buffer.clear();
+    buffer.seekg(0, std::ios::beg);
+
+    CkeckMisc(netinfo);
+
+    // Now start to parse the weights.
+    while (std::getline(buffer, line)) {
+        const auto spt = Splitter(line);
+        if (spt.GetWord(0)->Get<>() == "get") {
+            if (spt.GetWord(1)->Get<>() == "parameters") {
+                FillWeights(netinfo, netstruct, weights, buffer);
+            }
+        }
+    }
+}
+
+void DNNLoder::ParseHeader(NetInfo &netinfo,
+                               NetStruct &netstruct,
+                               std::istream &buffer) const {
+    auto line = std::string{};
     while (std::getline(buffer, line)) {
         const auto spt = Splitter(line, 2);
         if (spt.GetWord(0)->Get<>() == "get") {
@@ -100,21 +160,154 @@ void DNNLoder::Parse(std::shared_ptr<DNNWeights> weights, std::istream &buffer)
             // do nothing...
         }
     }
+}
 
-    buffer.clear();
-    buffer.seekg(0, std::ios::beg);
+void DNNLoder::FromMappedFile(std::shared_ptr<DNNWeights> weights, std::string filename) {
+    MappedFile mapped;
+    if (!mapped.Open(filename)) {
+        LOGGING << "Couldn't map file:" << ' ' << filename << '!' << std::endl;
+        return;
+    }
 
-    CkeckMisc(netinfo);
+    const char *data = mapped.Data();
+    const auto size = mapped.Size();
 
-    // Now start to parse the weights.
+    try {
+        if (size < kMappedHeaderSize) {
+            throw "The memory mapped weights file is too small";
+        }
+
+        std::uint32_t format_version, text_size;
+        std::uint64_t data_offset, num_arrays;
+        std::memcpy(&format_version, data + 8, sizeof(format_version));
+        std::memcpy(&text_size, data + 12, sizeof(text_size));
+        std::memcpy(&data_offset, data + 16, sizeof(data_offset));
+        std::memcpy(&num_arrays, data + 24, sizeof(num_arrays));
+
+        if (format_version != kMappedVersion) {
+            throw "The memory mapped weights version is not supported";
+        }
+        if (kMappedHeaderSize + text_size > data_offset || data_offset > size) {
+            throw "The memory mapped weights header is broken";
+        }
+
+        // The parameters are read from the mapped memory, so only the
+        // closing lines follow the header.
+        auto buffer = std::stringstream{};
+        buffer.write(data + kMappedHeaderSize, text_size);
+        buffer << "get parameters\nend\nend\n";
+
+        mapped_cursor_ = data + data_offset;
+        mapped_end_ = data + size;
+
+        Parse(weights, buffer);
+    } catch (const char *err) {
+        LOGGING << "Fail to load the network file!" << std::endl
+                    << Format("    Cause: %s.", err) << std::endl;
+    }
+    mapped_cursor_ = nullptr;
+    mapped_end_ = nullptr;
+}
+
+std::string DNNLoder::ConvertToMapped(std::string input, std::string output) {
+    auto file = std::ifstream{};
+    file.open(input, std::ifstream::binary | std::ifstream::in);
+    if (!file.is_open()) {
+        return "couldn't open the input file";
+    }
+    auto buffer = std::stringstream{};
+    buffer << file.rdbuf();
+    file.close();
+
+    // Keep the text header as it is.
+    auto header = std::string{};
+    auto line = std::string{};
+    bool found_parameters = false;
     while (std::getline(buffer, line)) {
-        const auto spt = Splitter(line);
-        if (spt.GetWord(0)->Get<>() == "get") {
-            if (spt.GetWord(1)->Get<>() == "parameters") {
-                FillWeights(netinfo, netstruct, weights, buffer);
-            }
+        const auto spt = Splitter(line, 2);
+        if (spt.GetCount() >= 2 &&
+                spt.GetWord(0)->Get<>() == "get" &&
+                spt.GetWord(1)->Get<>() == "parameters") {
+            found_parameters = true;
+            break;
+        }
+        header += line + '\n';
+    }
+    if (!found_parameters) {
+        return "the input file is not a weights file";
+    }
+
+    auto netinfo = NetInfo{};
+    auto netstruct = NetStruct{};
+    auto arrays = std::vector<std::vector<float>>{};
+
+    try {
+        auto header_buffer = std::stringstream{header};
+        auto first = std::string{};
+        std::getline(header_buffer, first);
+        ParseHeader(netinfo, netstruct, header_buffer);
+        CkeckMisc(netinfo);
+
+        // Every layer has two parameter arrays.
+        for (auto i = size_t{0}; i < 2 * netstruct.size(); ++i) {
+            arrays.emplace_back();
+            GetWeightsFromBuffer(arrays.back(), buffer);
+        }
+    } catch (const char *err) {
+        return err;
+    }
+
+    // The parameters are always stored as float32 in the mapped file.
+    auto mapped_header = std::string{};
+    auto header_buffer = std::stringstream{header};
+    while (std::getline(header_buffer, line)) {
+        const auto spt = Splitter(line, 2);
+        if (spt.GetCount() >= 1 && spt.GetWord(0)->Get<>() == "FloatType") {
+            continue;
         }
+        mapped_header += line + '\n';
+    }
+
+    auto out = std::ofstream{};
+    out.open(output, std::ofstream::binary | std::ofstream::out);
+    if (!out.is_open()) {
+        return "couldn't open the output file";
     }
+
+    const auto write_padding = [&out](size_t offset) {
+        const auto aligned = AlignMapped(offset);
+        const auto zeros = std::string(aligned - offset, '\0');
+        out.write(zeros.data(), zeros.size());
+        return aligned;
+    };
+
+    const std::uint32_t format_version = kMappedVersion;
+    const std::uint32_t text_size = mapped_header.size();
+    const std::uint64_t data_offset = AlignMapped(kMappedHeaderSize + text_size);
+    const std::uint64_t num_arrays = arrays.size();
+
+    out.write(kMappedMagic, sizeof(kMappedMagic) - 1);
+    out.write(reinterpret_cast<const char *>(&format_version), sizeof(format_version));
+    out.write(reinterpret_cast<const char *>(&text_size), sizeof(text_size));
+    out.write(reinterpret_cast<const char *>(&data_offset), sizeof(data_offset));
+    out.write(reinterpret_cast<const char *>(&num_arrays), sizeof(num_arrays));
+    write_padding(32);
+    out.write(mapped_header.data(), mapped_header.size());
+
+    auto offset = write_padding(kMappedHeaderSize + text_size);
+    for (const auto &array : arrays) {
+        const std::uint64_t count = array.size();
+        out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+        offset = write_padding(offset + sizeof(count));
+        out.write(reinterpret_cast<const char *>(array.data()), count * sizeof(float));
+        offset = write_padding(offset + count * sizeof(float));
+    }
+    out.close();
+
+    if (!out) {
+        return "fail to write the output file";
+    }
+    return std::string{};
 }
 
 void DNNLoder::ParseInfo(NetInfo &netinfo, std::istream &buffer) const {
@@ -471,47 +664,138 @@ void DNNLoder::FillWeights(NetInfo &netinfo,
     }
     weights->loaded = true;
     DumpInfo(weights);
-    ProcessWeights(weights);
     weights->winograd = GetOption<bool>("winograd");
+    ProcessWeights(weights);
 }
 
 void DNNLoder::ProcessWeights(std::shared_ptr<DNNWeights> weights) const {
     // input layer
-    for (auto idx = size_t{0}; idx < weights->input_conv.GetBiases().size(); ++idx) {
-        weights->input_bn.GetMeans()[idx] -= weights->input_conv.GetBiases()[idx] *
-                                                 weights->input_bn.GetStddevs()[idx];
-        weights->input_conv.GetBiases()[idx] = 0.0f;
-    }
+    FuseBatchnorm(weights->input_conv, weights->input_bn);
+
     // residual tower
     for (auto &residual : weights->tower) {
-        for (auto idx = size_t{0}; idx < residual.conv1.GetBiases().size(); ++idx) {
-            residual.bn1.GetMeans()[idx] -= residual.conv1.GetBiases()[idx] *
-                                                residual.bn1.GetStddevs()[idx];
-            residual.conv1.GetBiases()[idx] = 0.0f;
+        FuseBatchnorm(residual.conv1, residual.bn1);
+        FuseBatchnorm(residual.conv2, residual.bn2);
+    }
+
+    // policy head
+    FuseBatchnorm(weights->p_ex_conv, weights->p_ex_bn);
+
+    // value head
+    FuseBatchnorm(weights->v_ex_conv, weights->v_ex_bn);
+
+    if (GetOption<bool>("use_int8")) {
+        // Only the residual tower is quantized. Its inputs are always
+        // positive after the ReLU.
+        for (auto &residual : weights->tower) {
+            QuantizeInt8(residual.conv1);
+            QuantizeInt8(residual.conv2);
         }
-        for (auto idx = size_t{0}; idx < residual.conv2.GetBiases().size(); ++idx) {
-            residual.bn2.GetMeans()[idx] -= residual.conv2.GetBiases()[idx] *
-                                                residual.bn2.GetStddevs()[idx];
-            residual.conv2.GetBiases()[idx] = 0.0f;
+    }
+
+    if (GetOption<bool>("use_bf16")) {
+        // The residual tower and the 1x1 extractors of the heads.
+        for (auto &residual : weights->tower) {
+            ConvertBf16(residual.conv1, weights->winograd);
+            ConvertBf16(residual.conv2, weights->winograd);
         }
+        ConvertBf16(weights->p_ex_conv, false);
+        ConvertBf16(weights->v_ex_conv, false);
     }
-    // policy head
-    for (auto idx = size_t{0}; idx < weights->p_ex_conv.GetBiases().size(); ++idx) {
-        weights->p_ex_bn.GetMeans()[idx] -= weights->p_ex_conv.GetBiases()[idx] *
-                                             weights->p_ex_bn.GetStddevs()[idx];
-        weights->p_ex_conv.GetBiases()[idx] = 0.0f;
+}
+
+void DNNLoder::FuseBatchnorm(ConvLayer &conv, BatchNormLayer &bn) const {
+    auto &conv_weights = conv.GetWeights();
+    auto &conv_biases = conv.GetBiases();
+    auto &means = bn.GetMeans();
+    auto &stddevs = bn.GetStddevs();
+
+    const auto outputs = conv_biases.size();
+    const auto filter_dim = conv_weights.size() / outputs;
+
+    // The batchnorm computes (conv(x) + bias - mean) * stddev. Move
+    // the stddev into the weights, so it becomes conv'(x) - mean'.
+    for (auto o = size_t{0}; o < outputs; ++o) {
+        for (auto idx = size_t{0}; idx < filter_dim; ++idx) {
+            conv_weights[o * filter_dim + idx] *= stddevs[o];
+        }
+        means[o] = (means[o] - conv_biases[o]) * stddevs[o];
+        stddevs[o] = 1.0f;
+        conv_biases[o] = 0.0f;
     }
-    // value head
-    for (auto idx = size_t{0}; idx < weights->v_ex_conv.GetBiases().size(); ++idx) {
-        weights->v_ex_bn.GetMeans()[idx] -= weights->v_ex_conv.GetBiases()[idx] *
-                                             weights->v_ex_bn.GetStddevs()[idx];
-        weights->v_ex_conv.GetBiases()[idx] = 0.0f;
+}
+
+void DNNLoder::QuantizeInt8(ConvLayer &conv) const {
+    const auto &conv_weights = conv.GetWeights();
+    auto &int8_weights = conv.GetInt8Weights();
+    auto &int8_scales = conv.GetInt8Scales();
+
+    const auto outputs = conv.GetOutputs();
+    const auto filter_dim = conv.GetInputs() * conv.GetFilter() * conv.GetFilter();
+
+    // The dot product kernels read four weights at once.
+    const auto padded_dim = (filter_dim + 3) / 4 * 4;
+
+    int8_weights.assign(outputs * padded_dim, 0);
+    int8_scales.assign(outputs, 0.f);
+
+    // The symmetric quantization with one scale per output channel.
+    for (int o = 0; o < outputs; ++o) {
+        auto max_abs = 0.f;
+        for (int idx = 0; idx < filter_dim; ++idx) {
+            max_abs = std::max(max_abs, std::abs(conv_weights[o * filter_dim + idx]));
+        }
+        const auto scale = max_abs > 0.f ? max_abs / 127.f : 1.f;
+        for (int idx = 0; idx < filter_dim; ++idx) {
+            const auto q = std::round(conv_weights[o * filter_dim + idx] / scale);
+            int8_weights[o * padded_dim + idx] =
+                static_cast<std::int8_t>(std::max(-127.f, std::min(127.f, q)));
+        }
+        int8_scales[o] = scale;
+    }
+}
+
+void DNNLoder::ConvertBf16(ConvLayer &conv, const bool winograd) const {
+    const auto inputs = conv.GetInputs();
+    const auto outputs = conv.GetOutputs();
+
+    if (winograd) {
+        // The float weights are transformed later by the pipe, so
+        // transform a copy here.
+        WinogradConvolution3::ConvertBf16Weights(
+            inputs, outputs,
+            WinogradTransformF(conv.GetWeights(), outputs, inputs),
+            conv.GetBf16Weights());
+    } else {
+        const auto filter_dim = inputs * conv.GetFilter() * conv.GetFilter();
+        Bf16Convolution::ConvertWeights(outputs, filter_dim,
+                                        conv.GetWeights(), conv.GetBf16Weights());
     }
 }
 
 void DNNLoder::GetWeightsFromBuffer(std::vector<float> &weights, std::istream &buffer) const {
     weights.clear();
 
+    if (mapped_cursor_) {
+        std::uint64_t count;
+        if (mapped_cursor_ + sizeof(count) > mapped_end_) {
+            throw "The memory mapped weights are truncated";
+        }
+        std::memcpy(&count, mapped_cursor_, sizeof(count));
+
+        const char *values = mapped_cursor_ + kMappedAlignment;
+        if (count > (std::uint64_t)(mapped_end_ - mapped_cursor_) / sizeof(float)  ||
+                values + count * sizeof(float) > mapped_end_) {
+            throw "The memory mapped weights are truncated";
+        }
+
+        const float *begin = reinterpret_cast<const float *>(values);
+        weights.assign(begin, begin + count);
+
+        mapped_cursor_ = values + AlignMapped(count * sizeof(float));
+        return;
+    }
+
     if (use_binary_) {
         while (true) {
             // Get the next float.
@@ -13,12 +13,21 @@ public:
 
     void FromFile(std::shared_ptr<DNNWeights> weights, std::string filename);
 
+    // Convert the text or binary weights file to the memory mapped
+    // format. Return the error message, or empty string if success.
+    std::string ConvertToMapped(std::string input, std::string output);
+
 private:
     using LayerShape = std::vector<int>;
     using NetStruct = std::vector<LayerShape>;
     using NetInfo = std::unordered_map<std::string, std::string>;
 
     void Parse(std::shared_ptr<DNNWeights> weights, std::istream &buffer);
+    void ParseHeader(NetInfo &netinfo, NetStruct &netstruct, std::istream &buffer) const;
+
+    // Load the memory mapped weights file. The parameters are copied
+    // from the mapped memory without parsing.
+    void FromMappedFile(std::shared_ptr<DNNWeights> weights, std::string filename);
     void ParseInfo(NetInfo &netinfo, std::istream &buffer) const;
     void ParseStruct(NetStruct &netstruct, std::istream &buffer) const;
     void CkeckMisc(NetInfo &netinfo);
@@ -30,6 +39,13 @@ private:
                          std::istream &buffer) const;
 
     void ProcessWeights(std::shared_ptr<DNNWeights> weights) const;
+
+    // Fold the convolution biases and the batchnorm scales into the
+    // convolution weights. Only the shift of batchnorm remains.
+    void FuseBatchnorm(ConvLayer &conv, BatchNormLayer &bn) const;
+
+    void QuantizeInt8(ConvLayer &conv) const;
+    void ConvertBf16(ConvLayer &conv, const bool winograd) const;
     void GetWeightsFromBuffer(std::vector<float> &weights, std::istream &buffer) const;
 
 
@@ -50,4 +66,9 @@ private:
 
     bool use_binary_;
     int version_;
+
+    // The next parameters in the memory mapped file. It is null if
+    // the weights are parsed from the stream.
+    mutable const char *mapped_cursor_{nullptr};
+    const char *mapped_end_{nullptr};
 };
@@ -0,0 +1,117 @@
+#pragma once
+
+#ifdef USE_METAL
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "neural/network_basic.h"
+#include "neural/batch_controller.h"
+#include "neural/description.h"
+
+// Compute the network with the Metal Performance Shaders Graph on the
+// Apple GPU. Every board size has its own graph, and the batch size
+// of the graphs is dynamic. The Objective-C objects are kept in the
+// source file, so the header is plain C++.
+class MetalForwardPipe : public NetworkForwardPipe {
+public:
+    MetalForwardPipe();
+    ~MetalForwardPipe();
+
+    virtual void Initialize(std::shared_ptr<DNNWeights> weights);
+
+    virtual OutputResult Forward(const InputData &inpnt);
+
+    virtual std::future<OutputResult> ForwardAsync(const InputData &inpnt);
+
+    virtual std::string GetStatsString();
+
+    virtual float GetBatchFillRatio();
+
+    virtual void ResetStats();
+
+    virtual bool ReducedPrecision();
+
+    virtual bool Valid();
+
+    virtual void Load(std::shared_ptr<DNNWeights> weights);
+
+    virtual void Reload(int board_size);
+
+    virtual void Release();
+
+    virtual void Destroy();
+
+private:
+    // The Metal device and its command queue.
+    struct Context;
+
+    // The graph of one board size.
+    struct Graph;
+
+    struct ForwardEntry {
+        InputData input;
+        std::promise<OutputResult> promise;
+
+        // When it is pushed into the queue.
+        std::chrono::steady_clock::time_point pushed;
+
+        ForwardEntry(const InputData &in)
+            : input(in), pushed(std::chrono::steady_clock::now()) {}
+    };
+
+    // Return the graph of the board size. Build it if it is not
+    // ready.
+    Graph *GetGraph(const int board_size);
+
+    std::unique_ptr<Graph> BuildGraph(const int board_size);
+
+    // Compute the entries in one batch. All inputs must be in the
+    // same board size.
+    void BatchForward(const int board_size,
+                      std::vector<std::shared_ptr<ForwardEntry>> &entries);
+
+    void PrepareWorkers();
+    void Worker();
+    void QuitWorkers();
+
+    std::shared_ptr<DNNWeights> weights_{nullptr};
+
+    std::unique_ptr<Context> context_;
+    std::map<int, std::unique_ptr<Graph>> graphs_;
+    std::mutex graphs_mutex_;
+
+    int max_batch_{1};
+    bool fp16_{false};
+
+    // The host buffers of one batch.
+    std::vector<float> host_planes_;
+    std::vector<float> host_policy_;
+    std::vector<float> host_pass_;
+    std::vector<float> host_ownership_;
+    std::vector<float> host_misc_;
+
+    std::list<std::shared_ptr<ForwardEntry>> entry_queue_;
+    std::mutex worker_mutex_;
+    std::mutex queue_mutex_;
+
+    std::condition_variable cv_;
+
+    std::atomic<bool> worker_running_{false};
+
+    // Decide how long the worker waits for the entries.
+    BatchController batch_controller_;
+
+    std::thread worker_;
+};
+
+#endif
@@ -0,0 +1,550 @@
+#ifdef USE_METAL
+
+#import <Foundation/Foundation.h>
+#import <Metal/Metal.h>
+#import <MetalPerformanceShadersGraph/MetalPerformanceShadersGraph.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include "config.h"
+#include "neural/metal/metal_forward_pipe.h"
+#include "utils/log.h"
+#include "utils/format.h"
+#include "utils/time.h"
+#include "utils/metrics.h"
+
+struct MetalForwardPipe::Context {
+    id<MTLDevice> device;
+    id<MTLCommandQueue> queue;
+    MPSGraphDevice *graph_device;
+};
+
+struct MetalForwardPipe::Graph {
+    MPSGraph *graph;
+    MPSGraphTensor *planes;
+
+    MPSGraphTensor *policy;
+    MPSGraphTensor *pass;
+    MPSGraphTensor *ownership;
+    MPSGraphTensor *misc;
+};
+
+// Build the layers of the network. They are the same as the ONNX
+// model. The batchnorm layers are folded into the convolutions. The
+// layers compute in the half precision if fp16 is set.
+class GraphBuilder {
+public:
+    GraphBuilder(MPSGraph *graph, const bool fp16)
+        : graph_(graph), fp16_(fp16) {}
+
+    MPSGraphTensor *Constant(const std::vector<float> &data, NSArray<NSNumber *> *shape) {
+        auto tensor = [graph_ constantWithData:[NSData dataWithBytes:data.data()
+                                                              length:data.size() * sizeof(float)]
+                                         shape:shape
+                                      dataType:MPSDataTypeFloat32];
+        return Cast(tensor);
+    }
+
+    MPSGraphTensor *Cast(MPSGraphTensor *x) {
+        return fp16_ ? [graph_ castTensor:x toType:MPSDataTypeFloat16 name:nil] : x;
+    }
+
+    MPSGraphTensor *Relu(MPSGraphTensor *x) {
+        return [graph_ reLUWithTensor:x name:nil];
+    }
+
+    MPSGraphTensor *Add(MPSGraphTensor *x, MPSGraphTensor *y) {
+        return [graph_ additionWithPrimaryTensor:x secondaryTensor:y name:nil];
+    }
+
+    // Reshape [batch, channels] to [batch, channels, 1, 1].
+    MPSGraphTensor *Spatial(MPSGraphTensor *x, const int channels) {
+        return [graph_ reshapeTensor:x withShape:@[@-1, @(channels), @1, @1] name:nil];
+    }
+
+    // The batchnorm computes (conv(x) + bias - mean) * stddev.
+    MPSGraphTensor *Convolution(MPSGraphTensor *x, ConvLayer &conv, BatchNormLayer *bn) {
+        const int outputs = conv.GetOutputs();
+        const int filter = conv.GetFilter();
+        const int filter_dim = conv.GetInputs() * filter * filter;
+
+        auto weights = conv.GetWeights();
+        auto biases = conv.GetBiases();
+        biases.resize(outputs, 0.f);
+
+        if (bn) {
+            const auto &means = bn->GetMeans();
+            const auto &stddevs = bn->GetStddevs();
+            for (int o = 0; o < outputs; ++o) {
+                for (int idx = 0; idx < filter_dim; ++idx) {
+                    weights[o * filter_dim + idx] *= stddevs[o];
+                }
+                biases[o] = (biases[o] - means[o]) * stddevs[o];
+            }
+        }
+
+        auto desc = [MPSGraphConvolution2DOpDescriptor
+                        descriptorWithStrideInX:1
+                                      strideInY:1
+                                dilationRateInX:1
+                                dilationRateInY:1
+                                         groups:1
+                                   paddingStyle:MPSGraphPaddingStyleTF_SAME
+                                     dataLayout:MPSGraphTensorNamedDataLayoutNCHW
+                                  weightsLayout:MPSGraphTensorNamedDataLayoutOIHW];
+        auto y = [graph_ convolution2DWithSourceTensor:x
+                                         weightsTensor:Constant(weights, @[@(outputs), @(conv.GetInputs()),
+                                                                           @(filter), @(filter)])
+                                            descriptor:desc
+                                                  name:nil];
+        return Add(y, Constant(biases, @[@1, @(outputs), @1, @1]));
+    }
+
+    // The fully connected layer of the rows [begin, end) of the
+    // weights. The weights are [outputs, inputs].
+    MPSGraphTensor *FullyConnect(MPSGraphTensor *x, LinearLayer &layer,
+                                 int begin = 0, int end = -1) {
+        const int inputs = layer.GetInputs();
+        if (end < 0) {
+            end = layer.GetOutputs();
+        }
+        const int rows = end - begin;
+        const auto &weights = layer.GetWeights();
+        const auto &biases = layer.GetBiases();
+
+        // The matrix multiplication needs [inputs, rows].
+        auto transposed = std::vector<float>(inputs * rows);
+        for (int r = 0; r < rows; ++r) {
+            for (int i = 0; i < inputs; ++i) {
+                transposed[i * rows + r] = weights[(begin + r) * inputs + i];
+            }
+        }
+        auto y = [graph_ matrixMultiplicationWithPrimaryTensor:x
+                                               secondaryTensor:Constant(transposed, @[@(inputs), @(rows)])
+                                                          name:nil];
+        return Add(y, Constant({std::begin(biases) + begin, std::begin(biases) + end}, @[@1, @(rows)]));
+    }
+
+    // The global pooling of GlobalPooling. It is the mean, the mean
+    // scaled by the board size and the max or the mean scaled by the
+    // board size variance.
+    MPSGraphTensor *GlobalPooling(MPSGraphTensor *x, const int channels,
+                                  const int board_size, const bool value_head) {
+        static constexpr float kAvgBSize = 14.f;
+        static constexpr float kBSizeVaraince = 0.1f;
+
+        const float b_diff = (float)board_size - kAvgBSize;
+        const float b_coeff0 = b_diff / 10.f;
+        const float b_coeff1 = b_diff * b_diff / 100.f - kBSizeVaraince;
+        const auto shape = @[@-1, @(channels)];
+
+        auto mean = [graph_ reshapeTensor:[graph_ meanOfTensor:x axes:@[@2, @3] name:nil]
+                                withShape:shape
+                                     name:nil];
+        auto scaled = [graph_ multiplicationWithPrimaryTensor:mean
+                                              secondaryTensor:Constant({b_coeff0}, @[@1])
+                                                         name:nil];
+        MPSGraphTensor *third = nil;
+        if (value_head) {
+            third = [graph_ multiplicationWithPrimaryTensor:mean
+                                            secondaryTensor:Constant({b_coeff1}, @[@1])
+                                                       name:nil];
+        } else {
+            third = [graph_ reshapeTensor:[graph_ reductionMaximumWithTensor:x axes:@[@2, @3] name:nil]
+                                withShape:shape
+                                     name:nil];
+        }
+        return [graph_ concatTensors:@[mean, scaled, third] dimension:1 name:nil];
+    }
+
+    // Flatten [batch, 1, size, size] to [batch, size * size] in the
+    // full precision.
+    MPSGraphTensor *Output(MPSGraphTensor *x, const int size) {
+        auto y = [graph_ reshapeTensor:x withShape:@[@-1, @(size)] name:nil];
+        return fp16_ ? [graph_ castTensor:y toType:MPSDataTypeFloat32 name:nil] : y;
+    }
+
+private:
+    MPSGraph *graph_;
+    bool fp16_;
+};
+
+MetalForwardPipe::MetalForwardPipe() = default;
+
+MetalForwardPipe::~MetalForwardPipe() = default;
+
+void MetalForwardPipe::Initialize(std::shared_ptr<DNNWeights> weights) {
+    context_ = std::make_unique<Context>();
+    context_->device = MTLCreateSystemDefaultDevice();
+    if (context_->device == nil) {
+        LOGGING << "Not found any Metal device!\n";
+        return;
+    }
+    context_->queue = [context_->device newCommandQueue];
+    context_->graph_device = [MPSGraphDevice deviceWithMTLDevice:context_->device];
+    LOGGING << Format("Metal device: %s\n", context_->device.name.UTF8String);
+
+    max_batch_ = std::max(GetOption<int>("batch_size"), 1);
+    fp16_ = GetOption<bool>("use_fp16");
+
+    host_planes_.resize(max_batch_ * kInputChannels * kNumIntersections);
+    host_policy_.resize(max_batch_ * kNumIntersections);
+    host_pass_.resize(max_batch_ * kOuputPassProbability);
+    host_ownership_.resize(max_batch_ * kNumIntersections);
+    host_misc_.resize(max_batch_ * kOuputValueMisc);
+
+    batch_controller_.Reset(1000 * GetOption<int>("gpu_waittime"));
+    Load(weights);
+    PrepareWorkers();
+}
+
+void MetalForwardPipe::Load(std::shared_ptr<DNNWeights> weights) {
+    {
+        // The old graphs are for the old weights.
+        std::lock_guard<std::mutex> lock(graphs_mutex_);
+        graphs_.clear();
+    }
+    weights_ = weights;
+}
+
+std::unique_ptr<MetalForwardPipe::Graph> MetalForwardPipe::BuildGraph(const int board_size) {
+    auto timer = Timer{};
+    auto out = std::make_unique<Graph>();
+    @autoreleasepool {
+        auto graph = [MPSGraph new];
+        auto builder = GraphBuilder(graph, fp16_);
+
+        out->graph = graph;
+        out->planes = [graph placeholderWithShape:@[@-1, @(kInputChannels), @(board_size), @(board_size)]
+                                         dataType:MPSDataTypeFloat32
+                                             name:@"planes"];
+
+        // The input layers.
+        auto x = builder.Relu(builder.Convolution(builder.Cast(out->planes),
+                                                  weights_->input_conv, &weights_->input_bn));
+
+        // The residual tower.
+        for (int i = 0; i < weights_->residual_blocks; ++i) {
+            auto &block = weights_->tower[i];
+            auto x1 = builder.Relu(builder.Convolution(x, block.conv1, &block.bn1));
+            auto x2 = builder.Convolution(x1, block.conv2, &block.bn2);
+
+            if (block.apply_se) {
+                const int channels = weights_->residual_channels;
+                auto pool = builder.GlobalPooling(x2, channels, board_size, false);
+                auto squeeze = builder.Relu(builder.FullyConnect(pool, block.squeeze));
+
+                // The first half of the excitation is the gamma, the
+                // second half is the beta.
+                auto gamma = [graph sigmoidWithTensor:builder.FullyConnect(squeeze, block.excite,
+                                                                           0, channels)
+                                                 name:nil];
+                auto beta = builder.FullyConnect(squeeze, block.excite, channels, 2 * channels);
+                x2 = [graph multiplicationWithPrimaryTensor:x2
+                                            secondaryTensor:builder.Spatial(gamma, channels)
+                                                       name:nil];
+                x2 = builder.Add(x2, builder.Spatial(beta, channels));
+            }
+            x = builder.Relu(builder.Add(x2, x));
+        }
+
+        const int num_intersections = board_size * board_size;
+
+        // The policy head.
+        const int policy_channels = weights_->policy_extract_channels;
+        auto policy = builder.Relu(builder.Convolution(x, weights_->p_ex_conv, &weights_->p_ex_bn));
+        auto p_pool = builder.GlobalPooling(policy, policy_channels, board_size, false);
+        auto p_inter = builder.Relu(builder.FullyConnect(p_pool, weights_->p_inter_fc));
+        auto policy_biased = builder.Add(policy, builder.Spatial(p_inter, policy_channels));
+        out->policy = builder.Output(builder.Convolution(policy_biased, weights_->prob_conv, nullptr),
+                                     num_intersections);
+        out->pass = builder.Output(builder.FullyConnect(p_inter, weights_->pass_fc),
+                                   kOuputPassProbability);
+
+        // The value head.
+        const int value_channels = weights_->value_extract_channels;
+        auto value = builder.Relu(builder.Convolution(x, weights_->v_ex_conv, &weights_->v_ex_bn));
+        auto v_pool = builder.GlobalPooling(value, value_channels, board_size, true);
+        auto v_inter = builder.Relu(builder.FullyConnect(v_pool, weights_->v_inter_fc));
+        out->ownership = builder.Output(builder.Convolution(value, weights_->v_ownership, nullptr),
+                                        num_intersections);
+        out->misc = builder.Output(builder.FullyConnect(v_inter, weights_->v_misc),
+                                   kOuputValueMisc);
+    }
+    LOGGING << Format("Built the %dx%d Metal graph in %.2f sec.\n",
+                          board_size, board_size, timer.GetDuration());
+    return out;
+}
+
+MetalForwardPipe::Graph *MetalForwardPipe::GetGraph(const int board_size) {
+    std::lock_guard<std::mutex> lock(graphs_mutex_);
+    auto it = graphs_.find(board_size);
+    if (it == std::end(graphs_)) {
+        it = graphs_.emplace(board_size, BuildGraph(board_size)).first;
+    }
+    return it->second.get();
+}
+
+OutputResult MetalForwardPipe::Forward(const InputData &inpnt) {
+    return ForwardAsync(inpnt).get();
+}
+
+std::future<OutputResult> MetalForwardPipe::ForwardAsync(const InputData &inpnt) {
+    auto entry = std::make_shared<ForwardEntry>(inpnt);
+    auto future = entry->promise.get_future();
+    auto queue_size = size_t{0};
+    {
+        // Push the entry.
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        entry_queue_.emplace_back(entry);
+        queue_size = entry_queue_.size();
+    }
+    batch_controller_.OnArrival();
+
+    if (queue_size == 1 || queue_size >= (size_t)max_batch_) {
+        // Wake up the worker if it is the first entry or there are
+        // enough batch size.
+        cv_.notify_one();
+    }
+
+    // The batch forwarding worker sets the result.
+    return future;
+}
+
+void MetalForwardPipe::BatchForward(const int board_size,
+                                    std::vector<std::shared_ptr<ForwardEntry>> &entries) {
+    const int batch_size = entries.size();
+    const int num_intersections = board_size * board_size;
+    const int planes_size = kInputChannels * num_intersections;
+
+    auto graph = GetGraph(board_size);
+    for (int b = 0; b < batch_size; ++b) {
+        std::copy(std::begin(entries[b]->input.planes),
+                  std::begin(entries[b]->input.planes) + planes_size,
+                  std::begin(host_planes_) + b * planes_size);
+    }
+
+    @autoreleasepool {
+        auto data = [NSData dataWithBytesNoCopy:host_planes_.data()
+                                         length:batch_size * planes_size * sizeof(float)
+                                   freeWhenDone:NO];
+        auto input = [[MPSGraphTensorData alloc] initWithDevice:context_->graph_device
+                                                           data:data
+                                                          shape:@[@(batch_size), @(kInputChannels),
+                                                                  @(board_size), @(board_size)]
+                                                       dataType:MPSDataTypeFloat32];
+        auto results = [graph->graph runWithMTLCommandQueue:context_->queue
+                                                      feeds:@{graph->planes: input}
+                                              targetTensors:@[graph->policy, graph->pass,
+                                                              graph->ownership, graph->misc]
+                                           targetOperations:nil];
+
+        [[results[graph->policy] mpsndarray] readBytes:host_policy_.data() strideBytes:nil];
+        [[results[graph->pass] mpsndarray] readBytes:host_pass_.data() strideBytes:nil];
+        [[results[graph->ownership] mpsndarray] readBytes:host_ownership_.data() strideBytes:nil];
+        [[results[graph->misc] mpsndarray] readBytes:host_misc_.data() strideBytes:nil];
+    }
+
+    for (int b = 0; b < batch_size; ++b) {
+        const auto &input = entries[b]->input;
+        const auto misc = host_misc_.data() + b * kOuputValueMisc;
+        auto result = OutputResult{};
+
+        result.board_size = board_size;
+        result.komi = input.komi;
+        result.wdl[0] = misc[0];
+        result.wdl[1] = misc[1];
+        result.wdl[2] = misc[2];
+        result.stm_winrate = misc[3];
+        result.final_score = misc[4];
+        result.pass_probability = host_pass_[b];
+
+        // The graph always computes the ownership.
+        result.has_ownership = true;
+        std::copy(std::begin(host_policy_) + b * num_intersections,
+                  std::begin(host_policy_) + (b+1) * num_intersections,
+                  std::begin(result.probabilities));
+        std::copy(std::begin(host_ownership_) + b * num_intersections,
+                  std::begin(host_ownership_) + (b+1) * num_intersections,
+                  std::begin(result.ownership));
+        entries[b]->promise.set_value(result);
+    }
+}
+
+std::string MetalForwardPipe::GetStatsString() {
+    return batch_controller_.GetStatsString();
+}
+
+float MetalForwardPipe::GetBatchFillRatio() {
+    return batch_controller_.GetFillRatio();
+}
+
+void MetalForwardPipe::ResetStats() {
+    batch_controller_.ResetStats();
+}
+
+bool MetalForwardPipe::ReducedPrecision() {
+    return fp16_;
+}
+
+bool MetalForwardPipe::Valid() {
+    return weights_ != nullptr &&
+               context_ != nullptr && context_->device != nil;
+}
+
+void MetalForwardPipe::Reload(int board_size) {
+    if (Valid() && board_size > 0) {
+        // Build the graph before the search needs it.
+        GetGraph(board_size);
+    }
+}
+
+void MetalForwardPipe::Release() {
+    std::lock_guard<std::mutex> lock(graphs_mutex_);
+    graphs_.clear();
+}
+
+void MetalForwardPipe::Destroy() {
+    QuitWorkers();
+    Release();
+    context_.reset();
+}
+
+void MetalForwardPipe::PrepareWorkers() {
+    if (!Valid()) {
+        return;
+    }
+    worker_running_.store(true);
+    if (!worker_.joinable()) {
+        worker_ = std::thread([this](){ Worker(); });
+    }
+}
+
+void MetalForwardPipe::Worker() {
+    const auto waittime_base = GetOption<int>("gpu_waittime");
+    const int max_batch = max_batch_;
+
+    const auto gether_batches = [this, waittime_base, max_batch](){
+        auto entries = std::vector<std::shared_ptr<ForwardEntry>>{};
+        auto timer = Timer{};
+        bool waiting = false;
+
+        // Running the loop until there are enough entry size or the
+        // controller decides to dispatch the current entries.
+        while(true) {
+            if (!worker_running_.load(std::memory_order_relaxed)) {
+                return entries;
+            }
+
+            const int queue_size = entry_queue_.size();
+            if (queue_size >= max_batch) {
+                break; // Finish the loop.
+            }
+
+            std::unique_lock<std::mutex> lock(worker_mutex_);
+            if (queue_size == 0) {
+                // Sleep until the first entry arrives.
+                cv_.wait_for(lock, std::chrono::milliseconds(std::max(waittime_base, 1)),
+                                 [this](){ return !entry_queue_.empty() ||
+                                                      !worker_running_.load(std::memory_order_relaxed); });
+                continue;
+            }
+
+            if (!waiting) {
+                timer.Clock();
+                waiting = true;
+            }
+            const int wait_us = batch_controller_.GetWaitMicroseconds(queue_size, max_batch) -
+                                    timer.GetDurationMicroseconds();
+            if (wait_us <= 0) {
+                break; // Finish the loop.
+            }
+            cv_.wait_for(lock, std::chrono::microseconds(wait_us),
+                             [this, max_batch](){ return !((int)entry_queue_.size() < max_batch) ||
+                                                             !worker_running_.load(std::memory_order_relaxed); });
+        }
+
+        // Gather the entries.
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        auto count = std::min(entry_queue_.size(), (size_t)max_batch);
+
+        auto end = std::begin(entry_queue_);
+        std::advance(end, count);
+        std::move(std::begin(entry_queue_), end, std::back_inserter(entries));
+        entry_queue_.erase(std::begin(entry_queue_), end);
+
+        batch_controller_.OnDispatch(entries.size(), max_batch,
+                                     waiting ? timer.GetDurationMicroseconds() : 0);
+
+        const auto now = std::chrono::steady_clock::now();
+        for (const auto &entry : entries) {
+            Metrics::AddQueueWait(std::chrono::duration_cast<std::chrono::microseconds>(
+                                      now - entry->pushed).count());
+        }
+        Metrics::AddBatch(0, entries.size(), max_batch);
+        return entries;
+    };
+
+    auto group = std::vector<std::shared_ptr<ForwardEntry>>{};
+    auto remaining = std::vector<std::shared_ptr<ForwardEntry>>{};
+
+    while (true) {
+        if (!worker_running_.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        auto entries = gether_batches();
+
+        // Every board size has its own graph, so compute every board
+        // size in its own batch.
+        while (!entries.empty()) {
+            const auto board_size = entries[0]->input.board_size;
+            group.clear();
+            remaining.clear();
+            for (auto &entry : entries) {
+                if (entry->input.board_size == board_size) {
+                    group.emplace_back(std::move(entry));
+                } else {
+                    remaining.emplace_back(std::move(entry));
+                }
+            }
+            std::swap(entries, remaining);
+            BatchForward(board_size, group);
+        }
+    }
+}
+
+void MetalForwardPipe::QuitWorkers() {
+    worker_running_.store(false);
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+
+    // Compute the remaining entries so that no thread waits for
+    // them forever.
+    std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+    while (!entry_queue_.empty()) {
+        const auto board_size = entry_queue_.front()->input.board_size;
+        auto group = std::vector<std::shared_ptr<ForwardEntry>>{};
+        for (auto it = std::begin(entry_queue_); it != std::end(entry_queue_) &&
+                 (int)group.size() < max_batch_;) {
+            if ((*it)->input.board_size == board_size) {
+                group.emplace_back(*it);
+                it = entry_queue_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (Valid()) {
+            BatchForward(board_size, group);
+        } else {
+            for (auto &entry : group) {
+                entry->promise.set_value(OutputResult{});
+            }
+        }
+    }
+}
+
+#endif
@@ -2,6 +2,18 @@
 #include "neural/cuda/cuda_forward_pipe.h"
 #endif
 
+#ifdef USE_TENSORRT
+#include "neural/cuda/trt_forward_pipe.h"
+#endif
+
+#ifdef USE_METAL
+#include "neural/metal/metal_forward_pipe.h"
+#endif
+
+#ifdef USE_OPENCL
+#include "neural/opencl/opencl_forward_pipe.h"
+#endif
+
 #ifdef USE_EIGEN
 #include <Eigen/Dense>
 #endif
@@ -18,17 +30,34 @@
 
 #include "config.h"
 #include "neural/blas/blas_forward_pipe.h"
+#include "neural/blas/int8_forward_pipe.h"
+#include "neural/blas/bf16_forward_pipe.h"
+#include "neural/remote_forward_pipe.h"
+#include "neural/blas/sgemm.h"
 #include "game/symmetry.h"
 #include "neural/loader.h"
 #include "neural/network.h"
+#include "utils/numa.h"
+#include "utils/huge_pages.h"
 #include "neural/encoder.h"
 #include "utils/log.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
 #include "utils/random.h"
 #include "utils/format.h"
+#include "utils/filesystem.h"
+#include "utils/half.h"
+#include "utils/komi.h"
 
+#include <algorithm>
+#include <cmath>
 #include <random>
 #include <sstream>
 #include <iomanip>
+#include <chrono>
+#include <thread>
+
+constexpr std::uint16_t Network::kNoOwnership;
 
 void Network::Initialize(const std::string &weightsfile) {
 #ifndef __APPLE__
@@ -52,13 +81,88 @@ void Network::Initialize(const std::string &weightsfile) {
                 << "library." << std::endl;
 #endif
 
+#if !defined(USE_BLAS) && !defined(USE_CUDA) && !defined(USE_METAL) && !defined(USE_OPENCL)
+    LOGGING << "BLAS Core: built-in" << ' '
+                << GetSgemmKernelName() << ' '
+                << "kernel." << std::endl;
+#endif
+
+    weights_file_ = weightsfile;
+    weights_time_ = GetFileTime(weightsfile);
+
+    std::atomic_store(&pipe_, CreatePipe(weightsfile, 0));
+
+    // The remote server only serves its own weights.
+    const auto policy_weights = GetOption<std::string>("policy_weights_file");
+    if (!policy_weights.empty() && GetOption<std::string>("remote_server").empty()) {
+        auto pipe = CreatePipe(policy_weights, 0);
+        if (pipe->Valid()) {
+            std::atomic_store(&policy_pipe_, pipe);
+        } else {
+            LOGGING << Format("Failed to load the policy weights %s, use the main network.\n",
+                                  policy_weights.c_str());
+        }
+    }
+    const auto deep_weights = GetOption<std::string>("deep_weights_file");
+    deep_plies_ = std::max(GetOption<int>("deep_net_plies"), 1);
+    if (!deep_weights.empty() && GetOption<std::string>("remote_server").empty()) {
+        auto pipe = CreatePipe(deep_weights, 0);
+        if (pipe->Valid()) {
+            std::atomic_store(&deep_pipe_, pipe);
+            LOGGING << Format("The deep network %s evaluates the leaves from %d plies below the root.\n",
+                                  deep_weights.c_str(), deep_plies_);
+        } else {
+            LOGGING << Format("Failed to load the deep weights %s, use the main network.\n",
+                                  deep_weights.c_str());
+        }
+    }
+    small_cache_ = ResultCache::UseSmall(std::max(GetOption<int>("defualt_boardsize"),
+                                                      GetOption<int>("fixed_nn_boardsize")));
+    SetCacheSize(GetOption<int>("cache_memory_mib"));
+    SetOpeningCache(GetOption<int>("opening_cache_plies"),
+                        GetOption<int>("opening_cache_memory_mib"));
+    SetSharedCache(GetOption<std::string>("shared_cache"),
+                       GetOption<int>("shared_cache_memory_mib"));
+    SetDiskCache(GetOption<std::string>("disk_cache"),
+                     GetOption<int>("disk_cache_mib"));
+}
+
+Network::PipePtr Network::CreatePipe(const std::string &weightsfile, int board_size) {
 #ifdef USE_CUDA
     using backend = CudaForwardPipe;
+#elif defined(USE_METAL)
+    using backend = MetalForwardPipe;
+#elif defined(USE_OPENCL)
+    using backend = OpenCLForwardPipe;
 #else
     using backend = BlasForwardPipe;
 #endif
 
-    pipe_ = std::make_unique<backend>();
+    // Destroy the pipe when the last user releases it.
+    const auto deleter = [](NetworkForwardPipe *p) {
+        p->Destroy();
+        delete p;
+    };
+
+    auto pipe = PipePtr{};
+    if (!GetOption<std::string>("remote_server").empty()) {
+        // The server loads the weights.
+        pipe = PipePtr(new RemoteForwardPipe, deleter);
+        pipe->Initialize(nullptr);
+        return pipe;
+    }
+#ifdef USE_TENSORRT
+    if (GetOption<bool>("use_tensorrt")) {
+        pipe = PipePtr(new TrtForwardPipe, deleter);
+    } else
+#endif
+    if (GetOption<bool>("use_int8")) {
+        pipe = PipePtr(new Int8ForwardPipe, deleter);
+    } else if (GetOption<bool>("use_bf16")) {
+        pipe = PipePtr(new Bf16ForwardPipe, deleter);
+    } else {
+        pipe = PipePtr(new backend, deleter);
+    }
     auto dnn_weights = std::make_shared<DNNWeights>();
 
     DNNLoder::Get().FromFile(dnn_weights, weightsfile);
@@ -68,8 +172,96 @@ void Network::Initialize(const std::string &weightsfile) {
         dnn_weights = nullptr;
     }
 
-    pipe_->Initialize(dnn_weights);
-    SetCacheSize(GetOption<int>("cache_memory_mib"));
+    pipe->Initialize(dnn_weights);
+    if (board_size > 0) {
+        pipe->Reload(board_size);
+    }
+    return pipe;
+}
+
+bool Network::LoadWeightsAsync(const std::string &weightsfile) {
+    std::lock_guard<std::mutex> lock(swap_mutex_);
+    return StartLoading(weightsfile);
+}
+
+bool Network::StartLoading(const std::string &weightsfile) {
+    if (pending_pipe_.valid()) {
+        return false;
+    }
+    pending_file_ = weightsfile;
+    pending_time_ = GetFileTime(weightsfile);
+    pending_pipe_ = std::async(std::launch::async,
+                        [weightsfile, board_size = board_size_.load()]() {
+                            return CreatePipe(weightsfile, board_size);
+                        });
+    return true;
+}
+
+bool Network::SwapPendingWeights() {
+    std::lock_guard<std::mutex> lock(swap_mutex_);
+
+    if (!pending_pipe_.valid() ||
+            pending_pipe_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return false;
+    }
+    auto pipe = pending_pipe_.get();
+
+    if (pending_file_ == weights_file_) {
+        // Do not watch the broken file again until it is changed.
+        weights_time_ = pending_time_;
+    }
+    if (!pipe->Valid()) {
+        LOGGING << Format("Failed to load the weights %s, keep the current network.\n",
+                              pending_file_.c_str());
+        return false;
+    }
+
+    // The board size may be changed during the loading.
+    const int board_size = board_size_.load();
+    if (board_size > 0) {
+        pipe->Reload(board_size);
+    }
+
+    // The old pipe is destroyed after its last forwarding.
+    generation_.fetch_add(1);
+    std::atomic_store(&pipe_, pipe);
+    ClearCache();
+
+    weights_file_ = pending_file_;
+    weights_time_ = pending_time_;
+    UpdateWeightsHash();
+    LOGGING << Format("Swapped in the weights %s.\n", weights_file_.c_str());
+
+    return true;
+}
+
+bool Network::UpdateWeights() {
+    if (GetOption<bool>("weights_watch")) {
+        std::lock_guard<std::mutex> lock(swap_mutex_);
+        const auto file_time = GetFileTime(weights_file_);
+
+        // Load it after the modification time is kept for a moment so
+        // that we do not read the file while it is being written.
+        const auto now = std::chrono::steady_clock::now();
+        if (file_time != 0 && file_time != weights_time_) {
+            if (file_time != watch_time_) {
+                watch_time_ = file_time;
+                watch_clock_ = now;
+            } else if (now - watch_clock_ >= std::chrono::seconds(2)) {
+                StartLoading(weights_file_);
+            }
+        }
+    }
+    return SwapPendingWeights();
+}
+
+int Network::GetGeneration() const {
+    return generation_.load(std::memory_order_relaxed);
+}
+
+std::time_t Network::GetWeightsTime() {
+    std::lock_guard<std::mutex> lock(swap_mutex_);
+    return weights_time_;
 }
 
 void Network::SetCacheSize(size_t MiB) {
@@ -77,19 +269,240 @@ void Network::SetCacheSize(size_t MiB) {
                                std::max(size_t{5}, MiB), // min:   5 MB
                                size_t{128 * 1024}        // max: 128 GB
                            );
+    cache_mib_ = MiB;
 
-    const size_t entry_byte = nn_cache_.GetEntrySize();
+    const size_t entry_byte = ResultCache::GetEntrySize(small_cache_);
     const size_t mem_byte = mem_mib * 1024 * 1024;
     size_t num_entries = mem_byte / entry_byte + 1;
 
-    nn_cache_.SetCapacity(num_entries);
+    // The deep network has the cache of the same size.
+    deep_cache_.SetCapacity(std::atomic_load(&deep_pipe_) ? num_entries : 0, small_cache_);
+
+    const int num_nodes = Numa::Get().GetNumNodes();
+    node_caches_.clear();
+
+    if (GetOption<bool>("numa_cache") && num_nodes > 1) {
+        // Every node has its own part of the memory. Allocate it on
+        // a thread of that node, so the pages are local to the node.
+        nn_cache_.SetCapacity(0, small_cache_);
+        for (int node = 0; node < num_nodes; ++node) {
+            node_caches_.emplace_back(std::make_unique<Cache>());
+            auto t = std::thread(
+                [this, node, num_entries, num_nodes](){
+                    Numa::Get().PinThread(node);
+                    node_caches_[node]->SetCapacity(num_entries / num_nodes + 1, small_cache_);
+                });
+            t.join();
+        }
+        const double mem_used = static_cast<double>(num_entries * entry_byte) / (1024.f * 1024.f);
+        LOGGING << Format("Allocated %.2f MiB memory for NN cache on %d NUMA nodes (%zu entries). \n",
+                              mem_used, num_nodes, num_entries);
+        if (HugePages::Enabled()) {
+            LOGGING << Format("The NN cache is on the %s pages.\n",
+                                  HugePages::GetPageSizeString(node_caches_[0]->GetPageSize()).c_str());
+        }
+        return;
+    }
+
+    nn_cache_.SetCapacity(num_entries, small_cache_);
 
     const double mem_used = static_cast<double>(num_entries * entry_byte) / (1024.f * 1024.f); 
-    LOGGING << Format("Allocated %.2f MiB memory for NN cache (%zu entries). \n", mem_used, num_entries);
+    LOGGING << Format("Allocated %.2f MiB memory for NN cache (%zu entries%s). \n",
+                          mem_used, num_entries,
+                          small_cache_ ?
+                              Format(" of the boards up to %dx%d", kSmallBoardSize, kSmallBoardSize).c_str() : "");
+    if (HugePages::Enabled()) {
+        LOGGING << Format("The NN cache is on the %s pages.\n",
+                              HugePages::GetPageSizeString(nn_cache_.GetPageSize()).c_str());
+    }
 }
 
 void Network::ClearCache() {
     nn_cache_.Clear();
+    for (auto &cache : node_caches_) {
+        cache->Clear();
+    }
+    opening_cache_.Clear();
+    deep_cache_.Clear();
+}
+
+void Network::SetOpeningCache(int plies, size_t MiB) {
+    opening_plies_ = std::max(plies, 0);
+    opening_cache_mib_ = MiB;
+    if (opening_plies_ == 0) {
+        opening_cache_.SetCapacity(0, small_cache_);
+        return;
+    }
+
+    const size_t entry_byte = ResultCache::GetEntrySize(small_cache_);
+    const size_t num_entries = std::max(size_t{1}, MiB) * 1024 * 1024 / entry_byte + 1;
+    opening_cache_.SetCapacity(num_entries, small_cache_);
+
+    LOGGING << Format("Allocated %.2f MiB memory for the opening cache of the first %d plies. \n",
+                          static_cast<double>(num_entries * entry_byte) / (1024.f * 1024.f), opening_plies_);
+}
+
+void Network::UpdateWeightsHash() {
+    // The results of the dummy network are never stored.
+    const auto pipe = std::atomic_load(&pipe_);
+    if ((shared_cache_.Valid() || disk_cache_.Valid()) &&
+            pipe && pipe->Valid()) {
+        weights_hash_.store(GetFileHash(weights_file_));
+    } else {
+        weights_hash_.store(0);
+    }
+}
+
+void Network::SetSharedCache(const std::string &name, size_t MiB) {
+    shared_cache_.Close();
+    UpdateWeightsHash();
+    if (name.empty()) {
+        return;
+    }
+
+    // The POSIX shared memory name starts with one slash.
+    const auto shm_name = name[0] == '/' ? name : '/' + name;
+    if (!shared_cache_.Open(shm_name, MiB)) {
+        LOGGING << Format("Fail to attach the shared NN cache %s.\n", shm_name.c_str());
+        return;
+    }
+
+    UpdateWeightsHash();
+
+    const double mem_used = (double)(shared_cache_.GetNumSlots() *
+                                         shared_cache_.GetSlotSize()) / (1024.f * 1024.f);
+    LOGGING << Format("%s the shared NN cache %s, %.2f MiB (%zu entries). \n",
+                          shared_cache_.Created() ? "Created" : "Attached to",
+                          shm_name.c_str(), mem_used, shared_cache_.GetNumSlots());
+}
+
+void Network::SetDiskCache(const std::string &filename, size_t MiB) {
+    disk_cache_.Close();
+    UpdateWeightsHash();
+    if (filename.empty()) {
+        return;
+    }
+
+    if (!disk_cache_.Open(filename, MiB)) {
+        LOGGING << Format("Fail to open the NN cache file %s. It may be written by the other version.\n",
+                              filename.c_str());
+        return;
+    }
+    UpdateWeightsHash();
+
+    LOGGING << Format("Opened the NN cache file %s with %zu entries. \n",
+                          filename.c_str(), disk_cache_.GetNumEntries());
+}
+
+void Network::PrefetchCache(const GameState &state) {
+    // The canonical hash is too expensive to compute twice.
+    if (GetOption<bool>("canonical_cache")) {
+        return;
+    }
+    auto &cache = UseDeepNetwork(state) ? deep_cache_ : SelectCache(state);
+    int symm;
+    cache.Prefetch(GetCacheHash(state, symm));
+}
+
+// The move number of the search root of the current thread.
+static thread_local int cache_root = -1;
+
+void Network::SetCacheRoot(int move_number) {
+    cache_root = move_number;
+}
+
+int Network::GetCacheWeight(const GameState &state) {
+    if (cache_root < 0) {
+        return 0;
+    }
+    constexpr int kMaxDistance = 8;
+    return std::max(kMaxDistance - (state.GetMoveNumber() - cache_root), 0);
+}
+
+bool Network::UseDeepNetwork(const GameState &state) const {
+    return cache_root >= 0 &&
+               state.GetMoveNumber() - cache_root >= deep_plies_ &&
+               std::atomic_load(&deep_pipe_) != nullptr;
+}
+
+Network::Cache &Network::SelectCache(const GameState &state) {
+    if (state.GetMoveNumber() < opening_plies_) {
+        return opening_cache_;
+    }
+    if (!node_caches_.empty()) {
+        return *node_caches_[Numa::GetCurrentNode() % node_caches_.size()];
+    }
+    return nn_cache_;
+}
+
+std::string Network::GetPipeStats() {
+    const auto pipe = std::atomic_load(&pipe_);
+    if (!pipe || !pipe->Valid()) {
+        return std::string{};
+    }
+    return pipe->GetStatsString();
+}
+
+Network::Stats Network::GetStats() const {
+    const auto pipe = std::atomic_load(&pipe_);
+    auto stats = Stats{};
+    stats.lookups = num_lookups_.load(std::memory_order_relaxed);
+    stats.hits = num_hits_.load(std::memory_order_relaxed);
+    stats.forwards = num_forwards_.load(std::memory_order_relaxed);
+    stats.deep_forwards = num_deep_forwards_.load(std::memory_order_relaxed);
+    stats.p50_latency_us = latency_.GetPercentile(0.5);
+    stats.p99_latency_us = latency_.GetPercentile(0.99);
+    stats.batch_fill = pipe ? pipe->GetBatchFillRatio() : -1.f;
+    return stats;
+}
+
+void Network::ResetStats() {
+    const auto pipe = std::atomic_load(&pipe_);
+    num_lookups_.store(0, std::memory_order_relaxed);
+    num_hits_.store(0, std::memory_order_relaxed);
+    num_forwards_.store(0, std::memory_order_relaxed);
+    num_deep_forwards_.store(0, std::memory_order_relaxed);
+    latency_.Reset();
+    if (pipe) {
+        pipe->ResetStats();
+    }
+}
+
+Network::MemoryUsage Network::GetMemoryUsage() {
+    const auto pipe = std::atomic_load(&pipe_);
+    const auto policy_pipe = std::atomic_load(&policy_pipe_);
+    const auto deep_pipe = std::atomic_load(&deep_pipe_);
+    const auto entry_byte = nn_cache_.GetEntrySize();
+    auto usage = MemoryUsage{};
+
+    if (node_caches_.empty()) {
+        usage.cache_entries = nn_cache_.GetCapacity();
+        usage.cache_used_entries = nn_cache_.GetNumUsed();
+    } else {
+        usage.cache_entries = 0;
+        usage.cache_used_entries = 0;
+        for (auto &cache : node_caches_) {
+            usage.cache_entries += cache->GetCapacity();
+            usage.cache_used_entries += cache->GetNumUsed();
+        }
+    }
+    usage.cache = usage.cache_entries * entry_byte;
+    usage.opening_cache = opening_plies_ > 0 ?
+                              opening_cache_.GetCapacity() * entry_byte : 0;
+    usage.deep_cache = deep_pipe ?
+                           deep_cache_.GetCapacity() * entry_byte : 0;
+
+    usage.device = 0;
+    for (const auto &p : {pipe, policy_pipe, deep_pipe}) {
+        if (p) {
+            usage.device += p->GetDeviceMemoryUsed();
+        }
+    }
+    return usage;
+}
+
+size_t Network::GetCacheEntrySize() const {
+    return nn_cache_.GetEntrySize();
 }
 
 Network::Result Network::DummyForward(const Network::Inputs& inputs) const {
@@ -115,21 +528,11 @@ Network::Result Network::DummyForward(const Network::Inputs& inputs) const {
 }
 
 Network::Result
-Network::GetOutputInternal(const GameState &state, const int symmetry) {
-    Network::Result out_result;
-    Network::Result result_buf;
-
-    // apply symmetry
-    auto inputs = Encoder::Get().GetInputs(state, symmetry);
-
-    if (pipe_->Valid()) {
-        result_buf = pipe_->Forward(inputs);
-    } else {
-        result_buf = DummyForward(inputs);
-    }
-    out_result = result_buf;
+Network::ProcessOutput(const Network::Result &result_buf,
+                       const int boardsize,
+                       const int symmetry) const {
+    Network::Result out_result = result_buf;
 
-    const auto boardsize = inputs.board_size;
     const auto num_intersections = boardsize * boardsize;
 
     auto probabilities_buffer = std::vector<float>(num_intersections);
@@ -169,10 +572,159 @@ Network::GetOutputInternal(const GameState &state, const int symmetry) {
     return out_result;
 }
 
+bool Network::LookupCompact(Cache &cache, std::uint64_t hash,
+                            CompactResult &compact) {
+    if (cache.Lookup(hash, compact)) {
+        return true;
+    }
+    const auto weights_hash = weights_hash_.load(std::memory_order_relaxed);
+    if (weights_hash == 0 || &cache == &deep_cache_) {
+        return false;
+    }
+    if (shared_cache_.Lookup(hash ^ weights_hash, compact)) {
+        // Keep it in the private cache too. The private lookup is
+        // faster.
+        cache.Insert(hash, compact);
+        return true;
+    }
+    if (disk_cache_.Lookup(hash ^ weights_hash, compact)) {
+        cache.Insert(hash, compact);
+        shared_cache_.Insert(hash ^ weights_hash, compact);
+        return true;
+    }
+    return false;
+}
+
+bool Network::LookupResult(Cache &cache, std::uint64_t hash,
+                           int symmetry, Network::Result &result) {
+    auto compact = CompactResult{};
+    if (!LookupCompact(cache, hash, compact)) {
+        return false;
+    }
+    const int num_intersections = compact.board_size * compact.board_size;
+
+    result.board_size = compact.board_size;
+    result.komi = compact.komi;
+    result.pass_probability = compact.pass_logit;
+    result.wdl_winrate = compact.wdl_winrate;
+    result.stm_winrate = compact.stm_winrate;
+    result.final_score = compact.final_score;
+    result.wdl = compact.wdl;
+    result.has_ownership = compact.ownership[0] != kNoOwnership;
+
+    // Apply the invert symmetry.
+    for (int idx = 0; idx < num_intersections; ++idx) {
+        const auto symm_index = Symmetry::Get().TransformIndex(compact.board_size, symmetry, idx);
+        result.probabilities[idx] = Half::ToFloat(compact.logits[symm_index]) + compact.max_logit;
+        result.ownership[idx] = result.has_ownership ?
+                                    Half::ToFloat(compact.ownership[symm_index]) : 0.f;
+    }
+    return true;
+}
+
+void Network::InsertResult(Cache &cache, std::uint64_t hash, int symmetry,
+                           const Network::Result &result, int weight) {
+    auto compact = CompactResult{};
+    const int num_intersections = result.board_size * result.board_size;
+
+    float max_logit = result.pass_probability;
+    for (int idx = 0; idx < num_intersections; ++idx) {
+        max_logit = std::max(max_logit, result.probabilities[idx]);
+    }
+
+    compact.board_size = result.board_size;
+    compact.komi = result.komi;
+    compact.max_logit = max_logit;
+    compact.pass_logit = result.pass_probability;
+    compact.wdl_winrate = result.wdl_winrate;
+    compact.stm_winrate = result.stm_winrate;
+    compact.final_score = result.final_score;
+    compact.wdl = result.wdl;
+
+    for (int idx = 0; idx < num_intersections; ++idx) {
+        const auto symm_index = Symmetry::Get().TransformIndex(result.board_size, symmetry, idx);
+        compact.logits[symm_index] = Half::FromFloat(result.probabilities[idx] - max_logit);
+        compact.ownership[symm_index] = Half::FromFloat(result.ownership[idx]);
+    }
+    if (!result.has_ownership) {
+        compact.ownership[0] = kNoOwnership;
+    }
+    cache.Insert(hash, compact, weight);
+
+    const auto weights_hash = weights_hash_.load(std::memory_order_relaxed);
+    if (weights_hash != 0 && &cache != &deep_cache_) {
+        shared_cache_.Insert(hash ^ weights_hash, compact);
+        disk_cache_.Insert(hash ^ weights_hash, compact);
+    }
+}
+
+std::uint64_t Network::GetCacheHash(const GameState &state, int &symmetry) const {
+    symmetry = Symmetry::kIdentitySymmetry;
+    auto hash = GetOption<bool>("canonical_cache") ?
+                    state.GetCanonicalHash(symmetry) : state.GetHash();
+    if (GetOption<bool>("komi_free_cache")) {
+        hash ^= state.GetKomiHash();
+    }
+    return hash;
+}
+
+void Network::AdjustResultKomi(const GameState &state, Network::Result &result) const {
+    const auto komi = state.GetKomi();
+
+    // The larger komi is the worse score of black.
+    const auto diff = komi - result.komi;
+    const auto score_diff = state.GetToMove() == kBlack ? -diff : diff;
+
+    // The winrate is about the logistic function of the score. Its
+    // scale grows with the board size.
+    const auto logit_diff = score_diff / (0.5f * state.GetBoardSize());
+    const auto Shift = [logit_diff](float p) {
+        p = std::min(std::max(p, 1e-4f), 1.f - 1e-4f);
+        const auto logit = std::log(p / (1.f - p)) + logit_diff;
+        return 1.f / (1.f + std::exp(-logit));
+    };
+
+    // Only the integer komi has the draws, and the draw rate of the
+    // half komi can not tell it.
+    const auto integer_komi = IsSameKomi(komi, std::round(komi));
+    const auto draw = integer_komi && IsSameKomi(result.komi, std::round(result.komi)) ?
+                          result.wdl[1] : 0.f;
+    const auto decisive = result.wdl[0] + result.wdl[2];
+    const auto win = Shift(decisive > 0.f ? result.wdl[0] / decisive : 0.5f);
+
+    result.wdl[0] = win * (1.f - draw);
+    result.wdl[1] = draw;
+    result.wdl[2] = (1.f - win) * (1.f - draw);
+    result.wdl_winrate = result.wdl[0] + 0.5f * draw;
+    result.stm_winrate = Shift(result.stm_winrate);
+    result.final_score += score_diff;
+    result.komi = komi;
+}
+
 bool Network::ProbeCache(const GameState &state,
+                         Cache &cache,
                          Network::Result &result) {
-    if (LookupCache(nn_cache_, state.GetHash(), result)) {
-        if (result.board_size == state.GetBoardSize()) {
+    const auto komi_free = GetOption<bool>("komi_free_cache");
+    const auto Found = [&]() {
+        if (result.board_size != state.GetBoardSize()) {
+            return false;
+        }
+        if (komi_free && !IsSameKomi(result.komi, state.GetKomi())) {
+            AdjustResultKomi(state, result);
+        }
+        return true;
+    };
+
+    if (GetOption<bool>("canonical_cache")) {
+        // The result is stored with the canonical symmetry.
+        int symm;
+        const auto hash = GetCacheHash(state, symm);
+        return LookupResult(cache, hash, symm, result) && Found();
+    }
+
+    const auto komi_hash = komi_free ? state.GetKomiHash() : 0;
+    if (LookupResult(cache, state.GetHash() ^ komi_hash, Symmetry::kIdentitySymmetry, result)) {
+        if (Found()) {
             return true;
         }
     }
@@ -180,33 +732,10 @@ bool Network::ProbeCache(const GameState &state,
     if (state.GetBoardSize() >= state.GetMoveNumber() &&
             GetOption<bool>("early_symm_cache")) {
         for (int symm = Symmetry::kIdentitySymmetry+1; symm < Symmetry::kNumSymmetris; ++symm) {
-            if (LookupCache(nn_cache_, state.ComputeSymmetryHash(symm), result)) {
-                if (result.board_size != state.GetBoardSize()) {
-                    break;
-                }
-                const int boardsize = result.board_size;
-                const int num_intersections = state.GetNumIntersections();
-                    
-                auto probabilities_buffer = std::vector<float>(num_intersections);
-                auto ownership_buffer = std::vector<float>(num_intersections);
-
-                // copy result to buffer
-                std::copy(std::begin(result.probabilities),
-                              std::begin(result.probabilities) + num_intersections,
-                              std::begin(probabilities_buffer));
-                std::copy(std::begin(result.ownership),
-                              std::begin(result.ownership) + num_intersections,
-                              std::begin(ownership_buffer));
-
-                // apply invert symmetry
-                for (int idx = 0; idx < num_intersections; ++idx) {
-                    const auto symm_index = Symmetry::Get().TransformIndex(boardsize, symm, idx);
-                    result.probabilities[idx] = probabilities_buffer[symm_index];
-                    result.ownership[idx] = ownership_buffer[symm_index];
-                }
-                return true;
+            if (LookupResult(cache, state.GetSymmetryHash(symm) ^ komi_hash, symm, result)) {
+                return Found();
             }
-        }         
+        }
     }
     return false;
 }
@@ -217,7 +746,24 @@ Network::GetOutput(const GameState &state,
                    const float temperature,
                    int symmetry,
                    const bool read_cache,
-                   const bool write_cache) {
+                   const bool write_cache,
+                   const bool need_ownership) {
+    return GetOutputAsync(state, ensemble, temperature,
+                              symmetry, read_cache, write_cache, need_ownership).get();
+}
+
+std::future<Network::Result>
+Network::GetOutputAsync(const GameState &state,
+                        const Ensemble ensemble,
+                        const float temperature,
+                        int symmetry,
+                        const bool read_cache,
+                        const bool write_cache,
+                        const bool need_ownership) {
+    if (ensemble == kAverage) {
+        return GetAverageOutputAsync(state, temperature, write_cache, need_ownership);
+    }
+
     Result result;
     if (ensemble == kNone) {
         symmetry = Symmetry::kIdentitySymmetry;
@@ -227,33 +773,254 @@ Network::GetOutput(const GameState &state,
         symmetry = Random<>::Get().RandFix<Symmetry::kNumSymmetris>();
     }
 
-    bool probed = false;
+    // The leaves far from the root use the deep network. The other
+    // ensembles are not of the search leaves.
+    const bool deep = ensemble == kRandom && UseDeepNetwork(state);
+    auto *cache = deep ? &deep_cache_ : &SelectCache(state);
 
     // Get result from cache, if it is in the cache memory.
     if (read_cache) {
-        if (ProbeCache(state, result)) {
-            probed = true;
+        num_lookups_.fetch_add(1, std::memory_order_relaxed);
+        auto hit = false;
+        {
+            TRACE_SCOPE("CacheProbe");
+            // The reduced result can not answer the full request.
+            hit = ProbeCache(state, *cache, result) &&
+                      (result.has_ownership || !need_ownership);
         }
+        if (hit) {
+            result.deep_net = deep;
+            num_hits_.fetch_add(1, std::memory_order_relaxed);
+            Metrics::Add(Metrics::kCacheHits);
+            ActivatePolicy(result, temperature);
+
+            auto promise = std::promise<Result>{};
+            promise.set_value(result);
+            return promise.get_future();
+        }
+        Metrics::Add(Metrics::kCacheMisses);
     }
 
-    if (!probed) {
-        result = GetOutputInternal(state, symmetry);
+    // apply symmetry
+    auto inputs = [&]() {
+        TRACE_SCOPE("Encode");
+        return Encoder::Get().GetInputs(state, symmetry);
+    }();
+    inputs.need_ownership = need_ownership;
+    auto forward = std::future<Result>{};
+
+    const auto pipe = deep ? std::atomic_load(&deep_pipe_) : std::atomic_load(&pipe_);
+    const auto generation = generation_.load();
+    const auto start = std::chrono::steady_clock::now();
+    num_forwards_.fetch_add(1, std::memory_order_relaxed);
+    if (deep) {
+        num_deep_forwards_.fetch_add(1, std::memory_order_relaxed);
+    }
+    Metrics::Add(Metrics::kNnEvals);
 
-        // Write result to cache, if it is not in the cache memory.
-        if (write_cache) {
-            nn_cache_.Insert(state.GetHash(), result);
+    if (pipe && pipe->Valid()) {
+        forward = pipe->ForwardAsync(inputs);
+    } else {
+        auto promise = std::promise<Result>{};
+        promise.set_value(DummyForward(inputs));
+        forward = promise.get_future();
+    }
+
+    const auto boardsize = inputs.board_size;
+    const auto komi = state.GetKomi();
+    auto cache_symm = Symmetry::kIdentitySymmetry;
+    const auto hash = GetCacheHash(state, cache_symm);
+    const auto cache_weight = GetCacheWeight(state);
+
+    // Post-process the result when the caller gets it.
+    return std::async(std::launch::deferred,
+               [this, pipe, forward = std::move(forward), generation, start, deep, komi,
+                   boardsize, symmetry, temperature, hash, cache_symm, cache, cache_weight, write_cache]() mutable {
+                   const auto output = [&forward]() {
+                       TRACE_SCOPE("NNWait");
+                       return forward.get();
+                   }();
+                   auto result = ProcessOutput(output, boardsize, symmetry);
+                   result.komi = komi;
+                   result.deep_net = deep;
+                   latency_.Add(std::chrono::duration_cast<std::chrono::microseconds>(
+                                    std::chrono::steady_clock::now() - start).count());
+
+                   // Write result to cache, if it is not in the cache memory
+                   // and the pipe is not swapped.
+                   if (write_cache && generation == generation_.load()) {
+                       InsertResult(*cache, hash, cache_symm, result, cache_weight);
+                   }
+                   ActivatePolicy(result, temperature);
+                   return result;
+               });
+}
+
+std::future<Network::Result>
+Network::GetAverageOutputAsync(const GameState &state,
+                               const float temperature,
+                               const bool write_cache,
+                               const bool need_ownership) {
+    const auto pipe = std::atomic_load(&pipe_);
+    const auto generation = generation_.load();
+    const auto start = std::chrono::steady_clock::now();
+
+    // Submit all symmetries before waiting for any of them.
+    auto forwards = std::vector<std::future<Result>>{};
+    auto boardsize = state.GetBoardSize();
+    for (int symm = 0; symm < Symmetry::kNumSymmetris; ++symm) {
+        auto inputs = [&]() {
+            TRACE_SCOPE("Encode");
+            return Encoder::Get().GetInputs(state, symm);
+        }();
+        inputs.need_ownership = need_ownership;
+        boardsize = inputs.board_size;
+        num_forwards_.fetch_add(1, std::memory_order_relaxed);
+        Metrics::Add(Metrics::kNnEvals);
+
+        if (pipe && pipe->Valid()) {
+            forwards.emplace_back(pipe->ForwardAsync(inputs));
+        } else {
+            auto promise = std::promise<Result>{};
+            promise.set_value(DummyForward(inputs));
+            forwards.emplace_back(promise.get_future());
         }
     }
 
-    ActivatePolicy(result, temperature);
+    const auto komi = state.GetKomi();
+    auto cache_symm = Symmetry::kIdentitySymmetry;
+    const auto hash = GetCacheHash(state, cache_symm);
+    auto *cache = &SelectCache(state);
+    const auto cache_weight = GetCacheWeight(state);
+
+    return std::async(std::launch::deferred,
+               [this, pipe, forwards = std::move(forwards), generation, start, komi,
+                   boardsize, temperature, hash, cache_symm, cache, cache_weight, write_cache]() mutable {
+                   const auto num_intersections = boardsize * boardsize;
+                   const auto size = (float)forwards.size();
+
+                   // Average the probabilities, not the logits, like the
+                   // other symmetric ensembles.
+                   auto result = Result{};
+                   auto probabilities = std::vector<float>(num_intersections+1, 0.f);
+                   for (int symm = 0; symm < (int)forwards.size(); ++symm) {
+                       const auto output = [&]() {
+                           TRACE_SCOPE("NNWait");
+                           return forwards[symm].get();
+                       }();
+                       auto symm_result = ProcessOutput(output, boardsize, symm);
+                       ActivatePolicy(symm_result, 1.f);
+
+                       if (symm == 0) {
+                           result = symm_result;
+                           result.komi = komi;
+                           result.wdl.fill(0.f);
+                           result.wdl_winrate = result.stm_winrate = result.final_score = 0.f;
+                           result.ownership.fill(0.f);
+                       }
+                       for (int idx = 0; idx < num_intersections; ++idx) {
+                           probabilities[idx] += symm_result.probabilities[idx] / size;
+                           result.ownership[idx] += symm_result.ownership[idx] / size;
+                       }
+                       probabilities[num_intersections] += symm_result.pass_probability / size;
+                       for (int i = 0; i < 3; ++i) {
+                           result.wdl[i] += symm_result.wdl[i] / size;
+                       }
+                       result.wdl_winrate += symm_result.wdl_winrate / size;
+                       result.stm_winrate += symm_result.stm_winrate / size;
+                       result.final_score += symm_result.final_score / size;
+                   }
+
+                   // Store the logits of the averaged policy so that the
+                   // cache and the temperature work as usual.
+                   for (int idx = 0; idx < num_intersections; ++idx) {
+                       result.probabilities[idx] = std::log(std::max(probabilities[idx], 1e-20f));
+                   }
+                   result.pass_probability = std::log(std::max(probabilities[num_intersections], 1e-20f));
+                   latency_.Add(std::chrono::duration_cast<std::chrono::microseconds>(
+                                    std::chrono::steady_clock::now() - start).count());
+
+                   if (write_cache && generation == generation_.load()) {
+                       InsertResult(*cache, hash, cache_symm, result, cache_weight);
+                   }
+                   ActivatePolicy(result, temperature);
+                   return result;
+               });
+}
+
+std::future<Network::Result> Network::ForwardRawAsync(const Inputs &inputs) {
+    const auto pipe = std::atomic_load(&pipe_);
+    if (!pipe || !pipe->Valid()) {
+        auto promise = std::promise<Result>{};
+        promise.set_value(DummyForward(inputs));
+        return promise.get_future();
+    }
+
+    // Keep the pipe alive until the result is taken.
+    auto forward = pipe->ForwardAsync(inputs);
+    return std::async(std::launch::deferred,
+               [pipe, forward = std::move(forward)]() mutable {
+                   return forward.get();
+               });
+}
 
+bool Network::ReducedPrecision() const {
+    const auto pipe = std::atomic_load(&pipe_);
+    return pipe && pipe->Valid() && pipe->ReducedPrecision();
+}
+
+Network::Result Network::GetFullPrecisionOutput(const GameState &state, int symmetry) {
+    const auto inputs = Encoder::Get().GetInputs(state, symmetry);
+    const auto pipe = std::atomic_load(&pipe_);
+    const auto forward = pipe && pipe->Valid() ?
+                             pipe->ForwardFullPrecision(inputs) :
+                             DummyForward(inputs);
+    auto result = ProcessOutput(forward, inputs.board_size, symmetry);
+    ActivatePolicy(result, 1.f);
     return result;
 }
 
+std::vector<Network::Result> Network::GetKomiOutputs(const GameState &state,
+                                                     const std::vector<float> &komis) {
+    const auto inputs = Encoder::Get().GetInputs(state);
+    const auto pipe = std::atomic_load(&pipe_);
+
+    auto forwards = std::vector<Result>{};
+    if (pipe && pipe->Valid()) {
+        forwards = pipe->ForwardKomis(inputs, komis);
+    } else {
+        for (const auto komi : komis) {
+            auto input = inputs;
+            input.SetKomi(komi);
+            forwards.emplace_back(DummyForward(input));
+        }
+    }
+    num_forwards_.fetch_add(komis.size(), std::memory_order_relaxed);
+
+    auto results = std::vector<Result>{};
+    for (int i = 0; i < (int)forwards.size(); ++i) {
+        auto result = ProcessOutput(forwards[i], inputs.board_size,
+                                        Symmetry::kIdentitySymmetry);
+        result.komi = komis[i];
+        ActivatePolicy(result, 1.f);
+        results.emplace_back(result);
+    }
+    return results;
+}
+
 std::string Network::GetOutputString(const GameState &state,
                                      const Ensemble ensemble,
                                      int symmetry) {
-    const auto result = GetOutput(state, ensemble, 1.f, symmetry, false, false);
+    // Fix the symmetry so that the full precision check uses the
+    // same inputs.
+    if (ensemble == kNone) {
+        symmetry = Symmetry::kIdentitySymmetry;
+    } else if (ensemble == kRandom) {
+        symmetry = Random<>::Get().RandFix<Symmetry::kNumSymmetris>();
+    }
+    const auto result = ensemble == kAverage ?
+                            GetOutput(state, kAverage, 1.f, -1, false, false) :
+                            GetOutput(state, kDirect, 1.f, symmetry, false, false);
     const auto bsize = result.board_size;
 
     auto out = std::ostringstream{};
@@ -283,6 +1050,28 @@ std::string Network::GetOutputString(const GameState &state,
     }
     out << std::endl;
 
+    if (ReducedPrecision() && ensemble != kAverage) {
+        // Compare the reduced precision outputs with the full
+        // precision outputs.
+        const auto full = GetFullPrecisionOutput(state, symmetry);
+
+        auto policy_diff = std::abs(full.pass_probability - result.pass_probability);
+        auto ownership_diff = 0.f;
+        for (int idx = 0; idx < bsize * bsize; ++idx) {
+            policy_diff = std::max(policy_diff,
+                              std::abs(full.probabilities[idx] - result.probabilities[idx]));
+            ownership_diff = std::max(ownership_diff,
+                                 std::abs(full.ownership[idx] - result.ownership[idx]));
+        }
+
+        out << "full precision check: " << std::endl;
+        out << Format("max policy difference: %.6f\n", policy_diff);
+        out << Format("max ownership difference: %.6f\n", ownership_diff);
+        out << Format("winrate difference: %.6f\n", std::abs(full.stm_winrate - result.stm_winrate));
+        out << Format("final score difference: %.6f\n", std::abs(full.final_score - result.final_score));
+        out << std::endl;
+    }
+
     return out.str();
 }
 
@@ -326,50 +1115,120 @@ void Network::ActivatePolicy(Result &result, const float temperature) const {
 
 int Network::GetBestPolicyVertex(const GameState &state,
                                  const bool allow_pass) {
-    const auto result = GetOutput(state, kRandom);
-    const auto boardsize = result.board_size;
-    const auto num_intersections = boardsize * boardsize;
+    return GetBestPolicyVertexAsync(state, allow_pass).get();
+}
 
-    int max_idx = -1;
-    int max_vtx = kPass;
+std::future<int> Network::GetBestPolicyVertexAsync(const GameState &state,
+                                                   const bool allow_pass) {
+    const auto symmetry = Random<>::Get().RandFix<Symmetry::kNumSymmetris>();
+    auto inputs = Encoder::Get().GetInputs(state, symmetry);
+    inputs.need_value = false;
+    inputs.need_ownership = false;
 
+    // The state may be changed before the result is taken, so keep
+    // the legal moves now.
+    const auto boardsize = inputs.board_size;
+    const auto num_intersections = boardsize * boardsize;
+    auto legal_vertices = std::vector<int>(num_intersections, kNullVertex);
     for (int idx = 0; idx < num_intersections; ++idx) {
-        if (max_idx == -1 ||
-                result.probabilities[max_idx] < result.probabilities[idx]) {
-            const auto x = idx % boardsize;
-            const auto y = idx / boardsize;
-            const auto vtx = state.GetVertex(x,y);
-
-            if (state.IsLegalMove(vtx)) {
-                max_idx = idx;
-                max_vtx = vtx;
-            }
+        const auto vtx = state.GetVertex(idx % boardsize, idx / boardsize);
+        if (state.IsLegalMove(vtx)) {
+            legal_vertices[idx] = vtx;
         }
     }
 
-    if (allow_pass &&
-            result.probabilities[max_idx] < result.pass_probability) {
-        return kPass;
+    auto pipe = std::atomic_load(&policy_pipe_);
+    if (!pipe) {
+        pipe = std::atomic_load(&pipe_);
+    }
+    num_forwards_.fetch_add(1, std::memory_order_relaxed);
+    Metrics::Add(Metrics::kNnEvals);
+
+    auto forward = std::future<Result>{};
+    if (pipe && pipe->Valid()) {
+        forward = pipe->ForwardAsync(inputs);
+    } else {
+        auto promise = std::promise<Result>{};
+        promise.set_value(DummyForward(inputs));
+        forward = promise.get_future();
     }
 
-    return max_vtx;
+    // The softmax keeps the order, so compare the raw logits. Only
+    // the best move is mapped back through the symmetry.
+    return std::async(std::launch::deferred,
+               [pipe, forward = std::move(forward), boardsize, symmetry,
+                   allow_pass, legal_vertices = std::move(legal_vertices)]() mutable {
+                   const auto result = forward.get();
+                   const auto num_intersections = boardsize * boardsize;
+
+                   int max_idx = -1;
+                   int max_vtx = kPass;
+                   for (int idx = 0; idx < num_intersections; ++idx) {
+                       const auto vtx = legal_vertices[
+                                            Symmetry::Get().TransformIndex(boardsize, symmetry, idx)];
+                       if (vtx != kNullVertex &&
+                               (max_idx == -1 ||
+                                   result.probabilities[max_idx] < result.probabilities[idx])) {
+                           max_idx = idx;
+                           max_vtx = vtx;
+                       }
+                   }
+
+                   if (allow_pass &&
+                           (max_idx == -1 ||
+                               result.probabilities[max_idx] < result.pass_probability)) {
+                       return int{kPass};
+                   }
+                   return max_vtx;
+               });
 }
 
 bool Network::Valid() const {
-    if (pipe_) {
-        return pipe_->Valid();
+    const auto pipe = std::atomic_load(&pipe_);
+    if (pipe) {
+        return pipe->Valid();
     }
     return false;
 }
 
 void Network::Destroy() {
-    if (pipe_) {
-        pipe_->Destroy();
+    {
+        // Wait for the loading pipe so that it is destroyed here.
+        std::lock_guard<std::mutex> lock(swap_mutex_);
+        if (pending_pipe_.valid()) {
+            pending_pipe_.get();
+        }
     }
+    std::atomic_store(&pipe_, PipePtr{nullptr});
+    std::atomic_store(&policy_pipe_, PipePtr{nullptr});
+    std::atomic_store(&deep_pipe_, PipePtr{nullptr});
+
+    // Write the buffered records.
+    disk_cache_.Close();
+    weights_hash_.store(0);
 }
 
 void Network::Reload(int board_size) {
-    if (pipe_) {
-        pipe_->Reload(board_size);
+    board_size_.store(board_size);
+
+    // The entries of the other board sizes can not be kept.
+    const auto small = ResultCache::UseSmall(board_size);
+    if (small != small_cache_) {
+        small_cache_ = small;
+        SetCacheSize(cache_mib_);
+        SetOpeningCache(opening_plies_, opening_cache_mib_);
+    }
+
+    const auto pipe = std::atomic_load(&pipe_);
+    if (pipe) {
+        pipe->Reload(board_size);
+    }
+    const auto policy_pipe = std::atomic_load(&policy_pipe_);
+    if (policy_pipe) {
+        policy_pipe->Reload(board_size);
+    }
+    const auto deep_pipe = std::atomic_load(&deep_pipe_);
+    if (deep_pipe) {
+        deep_pipe->Reload(board_size);
     }
 }
@@ -1,38 +1,98 @@
+#pragma once
+
 #include "neural/network_basic.h"
 #include "neural/description.h"
+#include "neural/result_cache.h"
 #include "game/game_state.h"
+#include "game/symmetry.h"
 #include "utils/cache.h"
+#include "utils/shared_cache.h"
+#include "utils/disk_cache.h"
+#include "utils/histogram.h"
 
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <array>
+#include <cstdint>
 #include <algorithm>
 #include <cmath>
+#include <future>
 #include <string>
+#include <ctime>
+#include <chrono>
 
 class Network {
 public:
+    // kAverage submits all symmetries at once, so the pipe computes
+    // them in one batch, and averages the results. It never reads the
+    // cache because the cache can not tell the averaged results.
     enum Ensemble {
-        kNone, kDirect, kRandom
+        kNone, kDirect, kRandom, kAverage
     };
 
     using Inputs = InputData;
     using Result = OutputResult;
-    using Cache = HashKeyCache<Result>;
+
+    // The compact result stored in the cache. The private caches keep
+    // the results of the small boards in the small entries.
+    using CompactResult = ResultCache::Result;
+
+    // The first ownership of the compact result which has no
+    // ownership. It is the half NaN, the network never outputs it.
+    static constexpr std::uint16_t kNoOwnership = 0xffff;
+
+    using Cache = ResultCache;
     using PolicyVertexPair = std::pair<float, int>;
 
     void Initialize(const std::string &weights);
     void Destroy();
     bool Valid() const;
 
+    // Return the best move of the policy head. It only computes the
+    // policy head, with the policy network if it is loaded, and skips
+    // the cache. The calls of the concurrent games share the batches.
     int GetBestPolicyVertex(const GameState &state, 
                             const bool allow_pass);
+    std::future<int> GetBestPolicyVertexAsync(const GameState &state,
+                                              const bool allow_pass);
 
+    // The pipe may skip the ownership head if need_ownership is false.
+    // Check has_ownership of the result.
     Result GetOutput(const GameState &state,
                      const Ensemble ensemble,
                      const float temperature = 1.f,
                      int symmetry = -1,
                      const bool read_cache = true,
-                     const bool write_cache = true);
+                     const bool write_cache = true,
+                     const bool need_ownership = true);
+
+    // Same as GetOutput() but do not wait for the forwarding pipe. The
+    // result is post-processed in the thread calling get().
+    std::future<Result> GetOutputAsync(const GameState &state,
+                                       const Ensemble ensemble,
+                                       const float temperature = 1.f,
+                                       int symmetry = -1,
+                                       const bool read_cache = true,
+                                       const bool write_cache = true,
+                                       const bool need_ownership = true);
+
+    // Forward the raw inputs without the cache and the post-processing.
+    // The inference server uses it.
+    std::future<Result> ForwardRawAsync(const Inputs &inputs);
+
+    // Return true if the pipe computes with the reduced precision.
+    bool ReducedPrecision() const;
+
+    // Compute the result with the full precision path of the pipe.
+    // It never uses the cache.
+    Result GetFullPrecisionOutput(const GameState &state,
+                                  int symmetry = Symmetry::kIdentitySymmetry);
+
+    // Compute the state with every komi. It never uses the cache. The
+    // pipe may compute the komi free layers only once.
+    std::vector<Result> GetKomiOutputs(const GameState &state,
+                                       const std::vector<float> &komis);
 
     std::string GetOutputString(const GameState &state,
                                 const Ensemble ensemble,
@@ -40,21 +100,202 @@ public:
 
     void Reload(int board_size);
 
+    // Load the weights into a new pipe in the background. The current
+    // pipe keeps working until SwapPendingWeights() swaps the new one
+    // in. Return false if the other loading is not finished yet.
+    bool LoadWeightsAsync(const std::string &weightsfile);
+
+    // Swap in the pipe loaded by LoadWeightsAsync() if it is ready
+    // and clear the cache. Call it between games. Return true if the
+    // pipe is swapped.
+    bool SwapPendingWeights();
+
+    // Start loading the weights file if it is changed on the disk
+    // and the watching is enabled. Then swap in the pending pipe if
+    // it is ready. Call it between games.
+    bool UpdateWeights();
+
+    // The modification time of the current weights file.
+    std::time_t GetWeightsTime();
+
+    // It is increased whenever the weights are swapped, so the values
+    // computed by the old network can be found out.
+    int GetGeneration() const;
+
+    // Set the size of the main cache. The deep cache has the same
+    // number of entries.
     void SetCacheSize(size_t MiB);
     void ClearCache();
 
+    // Prefetch the cache slots of the state before it is evaluated.
+    void PrefetchCache(const GameState &state);
+
+    // Set the move number of the search root of the current thread.
+    // The results near it are kept longer in the cache. Set it -1 if
+    // the thread does not search.
+    static void SetCacheRoot(int move_number);
+
+    // Set the size of the opening cache. The positions before the given
+    // plies are stored in it instead of the main cache. Set the plies
+    // 0 to disable it.
+    void SetOpeningCache(int plies, size_t MiB);
+
+    // Attach to the cache in the shared memory. Set the empty name to
+    // disable it.
+    void SetSharedCache(const std::string &name, size_t MiB);
+
+    // Open the persistent cache file. The results are kept between
+    // the runs. Set the empty name to disable it.
+    void SetDiskCache(const std::string &filename, size_t MiB);
+
+    std::string GetPipeStats();
+
+    // The counters of the evaluations since the last reset. The latency
+    // is from the submitting to the post-processing of the forwarding,
+    // so it includes the waiting in the batch queue.
+    struct Stats {
+        std::int64_t lookups;
+        std::int64_t hits;
+        std::int64_t forwards;
+        std::int64_t deep_forwards;
+        double p50_latency_us;
+        double p99_latency_us;
+
+        // It is negative if the pipe does not batch the inputs.
+        float batch_fill;
+    };
+    Stats GetStats() const;
+    void ResetStats();
+
+    // The memory of the caches and of the device buffers in bytes.
+    // The main cache counts all of its NUMA parts.
+    struct MemoryUsage {
+        size_t cache;
+        size_t cache_entries;
+        size_t cache_used_entries;
+        size_t opening_cache;
+        size_t deep_cache;
+        size_t device;
+    };
+    MemoryUsage GetMemoryUsage();
+
+    size_t GetCacheEntrySize() const;
+
     static std::vector<float> Softmax(std::vector<float> &input, const float temperature);
 
 private:
     void ActivatePolicy(Result &result, const float temperature) const;
 
-    bool ProbeCache(const GameState &state, Result &result);
+    bool ProbeCache(const GameState &state, Cache &cache, Result &result);
+
+    // The cache key of the state. It is of the canonical symmetry with
+    // --canonical-cache, and ignores the komi with --komi-free-cache.
+    std::uint64_t GetCacheHash(const GameState &state, int &symmetry) const;
+
+    // Move the values of the result, which is computed with the other
+    // komi, to the komi of the state. The policy and the ownership are
+    // kept.
+    void AdjustResultKomi(const GameState &state, Result &result) const;
+
+    // Return true if the deep network evaluates this state. It is
+    // the leaf which is far enough from the search root of the
+    // current thread.
+    bool UseDeepNetwork(const GameState &state) const;
+
+    // Return the cache which stores the result of this state.
+    Cache &SelectCache(const GameState &state);
 
-    Result GetOutputInternal(const GameState &state, const int symmetry);
+    // Convert the result to the compact type and back. The compact
+    // result is stored with the given symmetry.
+    bool LookupResult(Cache &cache, std::uint64_t hash, int symmetry, Result &result);
+    bool LookupCompact(Cache &cache, std::uint64_t hash, CompactResult &compact);
+
+    // Hash the current weights file if the shared or disk cache is
+    // used. It is zero for the dummy network.
+    void UpdateWeightsHash();
+    void InsertResult(Cache &cache, std::uint64_t hash, int symmetry,
+                      const Result &result, int weight);
+
+    // The cache weight of the state. It is larger if the state is
+    // closer to the search root of the current thread.
+    static int GetCacheWeight(const GameState &state);
+
+    Result ProcessOutput(const Result &result_buf,
+                         const int boardsize,
+                         const int symmetry) const;
 
     Network::Result DummyForward(const Network::Inputs& inputs) const;
 
-    std::unique_ptr<NetworkForwardPipe> pipe_{nullptr};
+    std::future<Result> GetAverageOutputAsync(const GameState &state,
+                                              const float temperature,
+                                              const bool write_cache,
+                                              const bool need_ownership);
+
+    using PipePtr = std::shared_ptr<NetworkForwardPipe>;
+
+    // Create the pipe and load the weights file into it.
+    static PipePtr CreatePipe(const std::string &weightsfile, int board_size);
+
+    // Start the background loading. The swap_mutex_ must be locked.
+    bool StartLoading(const std::string &weightsfile);
+
+    // The current pipe. The readers copy it with std::atomic_load() so
+    // that the swapped pipe lives until its last forwarding is finished.
+    PipePtr pipe_{nullptr};
     Cache nn_cache_;
+
+    // The smaller network of the policy only moves. It is nullptr if
+    // the main network answers them.
+    PipePtr policy_pipe_{nullptr};
+
+    // The small network of the deep leaves and its own cache. Its
+    // results are never shared with the other processes.
+    PipePtr deep_pipe_{nullptr};
+    Cache deep_cache_;
+    int deep_plies_{0};
+
+    // The cache of every NUMA node. The search threads only touch the
+    // cache of their own node. Empty if the cache is not split.
+    std::vector<std::unique_ptr<Cache>> node_caches_;
+
+    // The opening positions are shared by many games. Keep them out of
+    // the main cache so that the later positions never evict them.
+    Cache opening_cache_;
+    int opening_plies_{0};
+
+    // The private caches use the small entries if the largest board
+    // size is small. Reload() reallocates them when it changes.
+    bool small_cache_{false};
+    size_t cache_mib_{0};
+    size_t opening_cache_mib_{0};
+
+    // The cache shared by all processes on the host and the cache on
+    // the disk. Their keys are mixed with the hash of the weights file.
+    SharedKeyCache<CompactResult> shared_cache_;
+    DiskKeyCache<CompactResult> disk_cache_;
+    std::atomic<std::uint64_t> weights_hash_{0};
+
+    // It is increased at every swap. The results of an old pipe are
+    // not written into the cache.
+    std::atomic<int> generation_{0};
+
+    std::atomic<std::int64_t> num_lookups_{0};
+    std::atomic<std::int64_t> num_hits_{0};
+    std::atomic<std::int64_t> num_forwards_{0};
+    std::atomic<std::int64_t> num_deep_forwards_{0};
+    LatencyHistogram latency_;
+    std::atomic<int> board_size_{0};
+
+    std::mutex swap_mutex_;
+    std::future<PipePtr> pending_pipe_;
+    std::string pending_file_;
+    std::time_t pending_time_{0};
+
+    std::string weights_file_;
+    std::time_t weights_time_{0};
+
+    // The last seen modification time of watched file.
+    std::time_t watch_time_{0};
+    std::chrono::steady_clock::time_point watch_clock_;
 };
 
@@ -2,8 +2,13 @@
 
 #include "neural/description.h"
 #include "game/types.h"
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <future>
 #include <memory>
+#include <string>
+#include <vector>
 
 static constexpr int kInputChannels = 38; // 8 past moves * 3 
                                           // 12 binary features
@@ -14,17 +19,58 @@ static constexpr int kOuputProbabilitiesChannels = 1;
 static constexpr int kOuputOwnershipChannels = 1;
 
 struct InputData {
+    // The komi/20 plane, followed by the -komi/20 plane.
+    static constexpr int kKomiPlane = kInputChannels - 4;
+
     InputData() : komi(0.f), board_size(-1), side_to_move(kInvalid) {
         planes.fill(0.f);
     };
 
+    // Change the komi and its planes. The planes are of the side to
+    // move.
+    void SetKomi(float new_komi) {
+        const int num_intersections = board_size * board_size;
+        const auto stm_komi = side_to_move == kWhite ? -new_komi : new_komi;
+        auto it = std::begin(planes) + kKomiPlane * num_intersections;
+        std::fill(it, it + num_intersections, stm_komi/20.f);
+        std::fill(it + num_intersections, it + 2 * num_intersections, -stm_komi/20.f);
+        komi = new_komi;
+    }
+
     float komi;
     int board_size;
     int side_to_move;
 
+    // The pipe may skip the ownership head if it is false.
+    bool need_ownership{true};
+
+    // The pipe may skip the whole value head if it is false. The
+    // policy only requests use it.
+    bool need_value{true};
+
     std::array<float, kInputChannels * kNumIntersections> planes;
 };
 
+// The input planes packed into the bits. All planes are binary except
+// the komi and the intersections planes. They are stored as the scalars
+// and expanded by the ones plane, which is one on the board and zero
+// out of the board.
+struct PackedInputData {
+    static constexpr int kScalarBegin = kInputChannels - 4;
+    static constexpr int kScalarPlanes = 3;
+    static constexpr int kBinaryPlanes = kInputChannels - kScalarPlanes;
+    static constexpr int kWordsPerPlane = (kNumIntersections + 63) / 64;
+
+    float komi{0.f};
+    int board_size{-1};
+    int side_to_move{kInvalid};
+    bool need_ownership{true};
+    bool need_value{true};
+
+    std::array<float, kScalarPlanes> scalars{};
+    std::array<std::uint64_t, kBinaryPlanes * kWordsPerPlane> bits{};
+};
+
 struct OutputResult {
     OutputResult() : board_size(-1),
                      pass_probability(0.f),
@@ -44,6 +90,16 @@ struct OutputResult {
     float stm_winrate;
     float final_score;
 
+    // The ownership are zeros if the pipe skipped the ownership head.
+    bool has_ownership{true};
+
+    // The values are zeros if the pipe skipped the value head.
+    bool has_value{true};
+
+    // True if the small deep network computed it. The pipes never
+    // set it.
+    bool deep_net{false};
+
     std::array<float, 3> wdl;
     std::array<float, kNumIntersections> probabilities;
     std::array<float, kNumIntersections> ownership;
@@ -51,12 +107,65 @@ struct OutputResult {
 
 class NetworkForwardPipe {
 public:
+    virtual ~NetworkForwardPipe() = default;
+
     virtual void Initialize(std::shared_ptr<DNNWeights> weights) = 0;
 
     virtual OutputResult Forward(const InputData &inpnt) = 0;
 
+    // Submit the inputs and return immediately. The result is ready
+    // after the batch is computed. The default pipe computes it
+    // synchronously.
+    virtual std::future<OutputResult> ForwardAsync(const InputData &inpnt) {
+        auto promise = std::promise<OutputResult>{};
+        promise.set_value(Forward(inpnt));
+        return promise.get_future();
+    }
+
+    // Compute the same inputs with every komi. The default pipe
+    // submits them together, so they share the batches. The pipe which
+    // knows the layers may compute the komi free layers only once.
+    virtual std::vector<OutputResult> ForwardKomis(const InputData &inpnt,
+                                                   const std::vector<float> &komis) {
+        auto forwards = std::vector<std::future<OutputResult>>{};
+        for (const auto komi : komis) {
+            auto input = inpnt;
+            input.SetKomi(komi);
+            forwards.emplace_back(ForwardAsync(input));
+        }
+        auto results = std::vector<OutputResult>{};
+        for (auto &forward : forwards) {
+            results.emplace_back(forward.get());
+        }
+        return results;
+    }
+
     virtual bool Valid() = 0;
 
+    // Return the statistics of the batching. It is empty if the pipe
+    // does not batch the inputs.
+    virtual std::string GetStatsString() { return std::string{}; }
+
+    // Return the ratio of the batch entries to the batch capacity. It
+    // is negative if the pipe does not batch the inputs.
+    virtual float GetBatchFillRatio() { return -1.f; }
+
+    // Clear the statistics of the batching.
+    virtual void ResetStats() {}
+
+    // Return the bytes of the buffers on the devices. The weights
+    // are not counted. It is zero if the pipe computes on the host.
+    virtual size_t GetDeviceMemoryUsed() { return 0; }
+
+    // Return true if the pipe computes with the reduced precision.
+    virtual bool ReducedPrecision() { return false; }
+
+    // Compute the inputs with the full precision. It is used to check
+    // the accuracy of reduced precision path.
+    virtual OutputResult ForwardFullPrecision(const InputData &inpnt) {
+        return Forward(inpnt);
+    }
+
     virtual void Load(std::shared_ptr<DNNWeights> weights) = 0;
 
     virtual void Reload(int) = 0;
@@ -0,0 +1,400 @@
+#include "neural/onnx_export.h"
+#include "neural/loader.h"
+#include "neural/network_basic.h"
+#include "version.h"
+
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+// The protobuf wire format. Only the types of the ONNX messages are
+// written. The floats are in the native byte order, which is the little
+// endian of protobuf on all supported machines.
+static void PutVarint(std::string &out, std::uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+static void PutTag(std::string &out, const int field, const int wire_type) {
+    PutVarint(out, (static_cast<std::uint64_t>(field) << 3) | wire_type);
+}
+
+static void PutInt(std::string &out, const int field, const std::int64_t v) {
+    PutTag(out, field, 0);
+    PutVarint(out, static_cast<std::uint64_t>(v));
+}
+
+static void PutBytes(std::string &out, const int field, const std::string &v) {
+    PutTag(out, field, 2);
+    PutVarint(out, v.size());
+    out.append(v);
+}
+
+// Build the ONNX graph. Every node has one output, and the nodes are
+// added in the order of the forward pass.
+class OnnxGraph {
+public:
+    static constexpr int kOpsetVersion = 13;
+
+    // The dimension of the dynamic batch size.
+    static constexpr std::int64_t kBatchDim = -1;
+
+    std::string AddFloats(const std::string &name,
+                          const std::vector<std::int64_t> &dims,
+                          const std::vector<float> &data) {
+        AddTensor(name, dims, kFloat,
+                  std::string(reinterpret_cast<const char *>(data.data()),
+                              data.size() * sizeof(float)));
+        return name;
+    }
+
+    std::string AddInt64s(const std::string &name,
+                          const std::vector<std::int64_t> &data) {
+        AddTensor(name, {static_cast<std::int64_t>(data.size())}, kInt64,
+                  std::string(reinterpret_cast<const char *>(data.data()),
+                              data.size() * sizeof(std::int64_t)));
+        return name;
+    }
+
+    // Add the node and return the name of its output.
+    std::string AddNode(const std::string &op_type,
+                        const std::vector<std::string> &inputs,
+                        const std::string &output,
+                        const std::vector<std::string> &attributes = {}) {
+        auto node = std::string{};
+        for (const auto &in : inputs) {
+            PutBytes(node, 1, in);
+        }
+        PutBytes(node, 2, output);
+        PutBytes(node, 3, output);
+        PutBytes(node, 4, op_type);
+        for (const auto &attr : attributes) {
+            PutBytes(node, 5, attr);
+        }
+        PutBytes(nodes_, 1, node);
+        return output;
+    }
+
+    static std::string IntAttribute(const std::string &name, const std::int64_t v) {
+        auto attr = std::string{};
+        PutBytes(attr, 1, name);
+        PutInt(attr, 3, v);
+        PutInt(attr, 20, kAttrInt);
+        return attr;
+    }
+
+    static std::string IntsAttribute(const std::string &name,
+                                     const std::vector<std::int64_t> &v) {
+        auto attr = std::string{};
+        PutBytes(attr, 1, name);
+        for (const auto i : v) {
+            PutInt(attr, 8, i);
+        }
+        PutInt(attr, 20, kAttrInts);
+        return attr;
+    }
+
+    void AddInput(const std::string &name, const std::vector<std::int64_t> &dims) {
+        PutBytes(inputs_, 11, ValueInfo(name, dims));
+    }
+
+    void AddOutput(const std::string &name, const std::vector<std::int64_t> &dims) {
+        PutBytes(outputs_, 12, ValueInfo(name, dims));
+    }
+
+    std::string Serialize() const {
+        auto graph = nodes_;
+        PutBytes(graph, 2, GetProgramName());
+        graph.append(initializers_);
+        graph.append(inputs_);
+        graph.append(outputs_);
+
+        auto opset = std::string{};
+        PutBytes(opset, 1, std::string{});
+        PutInt(opset, 2, kOpsetVersion);
+
+        auto model = std::string{};
+        PutInt(model, 1, kIrVersion);
+        PutBytes(model, 2, GetProgramName());
+        PutBytes(model, 3, GetProgramVersion());
+        PutBytes(model, 7, graph);
+        PutBytes(model, 8, opset);
+        return model;
+    }
+
+private:
+    static constexpr int kIrVersion = 7;
+    static constexpr int kFloat = 1;
+    static constexpr int kInt64 = 7;
+    static constexpr int kAttrInt = 2;
+    static constexpr int kAttrInts = 7;
+
+    void AddTensor(const std::string &name,
+                   const std::vector<std::int64_t> &dims,
+                   const int data_type,
+                   const std::string &raw) {
+        auto tensor = std::string{};
+        for (const auto d : dims) {
+            PutInt(tensor, 1, d);
+        }
+        PutInt(tensor, 2, data_type);
+        PutBytes(tensor, 8, name);
+        PutBytes(tensor, 9, raw);
+        PutBytes(initializers_, 5, tensor);
+    }
+
+    static std::string ValueInfo(const std::string &name,
+                                 const std::vector<std::int64_t> &dims) {
+        auto shape = std::string{};
+        for (const auto d : dims) {
+            auto dim = std::string{};
+            if (d == kBatchDim) {
+                PutBytes(dim, 2, "batch");
+            } else {
+                PutInt(dim, 1, d);
+            }
+            PutBytes(shape, 1, dim);
+        }
+        auto tensor_type = std::string{};
+        PutInt(tensor_type, 1, kFloat);
+        PutBytes(tensor_type, 2, shape);
+
+        auto type = std::string{};
+        PutBytes(type, 1, tensor_type);
+
+        auto info = std::string{};
+        PutBytes(info, 1, name);
+        PutBytes(info, 2, type);
+        return info;
+    }
+
+    std::string nodes_;
+    std::string initializers_;
+    std::string inputs_;
+    std::string outputs_;
+};
+
+// Add the convolution. The batchnorm computes (conv(x) + bias - mean) * stddev,
+// so it is folded into the weights and the biases.
+static std::string AddConvolution(OnnxGraph &graph,
+                                  const std::string &name,
+                                  const std::string &input,
+                                  ConvLayer &conv,
+                                  BatchNormLayer *bn) {
+    const int outputs = conv.GetOutputs();
+    const int filter = conv.GetFilter();
+    const int filter_dim = conv.GetInputs() * filter * filter;
+
+    auto weights = conv.GetWeights();
+    auto biases = conv.GetBiases();
+    biases.resize(outputs, 0.f);
+
+    if (bn) {
+        const auto &means = bn->GetMeans();
+        const auto &stddevs = bn->GetStddevs();
+        for (int o = 0; o < outputs; ++o) {
+            for (int idx = 0; idx < filter_dim; ++idx) {
+                weights[o * filter_dim + idx] *= stddevs[o];
+            }
+            biases[o] = (biases[o] - means[o]) * stddevs[o];
+        }
+    }
+
+    const std::int64_t pad = filter / 2;
+    return graph.AddNode(
+               "Conv",
+               {input,
+                graph.AddFloats(name + ".weights", {outputs, conv.GetInputs(), filter, filter}, weights),
+                graph.AddFloats(name + ".biases", {outputs}, biases)},
+               name,
+               {OnnxGraph::IntsAttribute("kernel_shape", {filter, filter}),
+                OnnxGraph::IntsAttribute("pads", {pad, pad, pad, pad})});
+}
+
+// Add the fully connected layer of the rows [begin, end) of the weights.
+// The weights are [outputs, inputs].
+static std::string AddFullyConnect(OnnxGraph &graph,
+                                   const std::string &name,
+                                   const std::string &input,
+                                   LinearLayer &layer,
+                                   int begin = 0, int end = -1) {
+    const int inputs = layer.GetInputs();
+    if (end < 0) {
+        end = layer.GetOutputs();
+    }
+    const auto &weights = layer.GetWeights();
+    const auto &biases = layer.GetBiases();
+    const int rows = end - begin;
+
+    return graph.AddNode(
+               "Gemm",
+               {input,
+                graph.AddFloats(name + ".weights", {rows, inputs},
+                                {std::begin(weights) + begin * inputs,
+                                 std::begin(weights) + end * inputs}),
+                graph.AddFloats(name + ".biases", {rows},
+                                {std::begin(biases) + begin,
+                                 std::begin(biases) + end})},
+               name,
+               {OnnxGraph::IntAttribute("transB", 1)});
+}
+
+// The global pooling of GlobalPooling. It is the mean, the mean scaled by
+// the board size and the max or the mean scaled by the board size variance.
+static std::string AddGlobalPooling(OnnxGraph &graph,
+                                    const std::string &name,
+                                    const std::string &input,
+                                    const int board_size,
+                                    const bool value_head) {
+    static constexpr float kAvgBSize = 14.f;
+    static constexpr float kBSizeVaraince = 0.1f;
+
+    const float b_diff = (float)board_size - kAvgBSize;
+    const float b_coeff0 = b_diff / 10.f;
+    const float b_coeff1 = b_diff * b_diff / 100.f - kBSizeVaraince;
+    const auto axes = OnnxGraph::IntsAttribute("axes", {2, 3});
+    const auto keepdims = OnnxGraph::IntAttribute("keepdims", 0);
+
+    const auto mean = graph.AddNode("ReduceMean", {input}, name + ".mean", {axes, keepdims});
+    const auto scaled = graph.AddNode(
+                            "Mul", {mean, graph.AddFloats(name + ".coeff0", {}, {b_coeff0})},
+                            name + ".scaled");
+    auto third = std::string{};
+    if (value_head) {
+        third = graph.AddNode(
+                    "Mul", {mean, graph.AddFloats(name + ".coeff1", {}, {b_coeff1})},
+                    name + ".variance");
+    } else {
+        third = graph.AddNode("ReduceMax", {input}, name + ".max", {axes, keepdims});
+    }
+    return graph.AddNode("Concat", {mean, scaled, third}, name,
+                         {OnnxGraph::IntAttribute("axis", 1)});
+}
+
+std::string GetOnnxModel(std::shared_ptr<DNNWeights> weights, const int board_size) {
+    auto graph = OnnxGraph{};
+    const auto batch = OnnxGraph::kBatchDim;
+    const std::int64_t num_intersections = board_size * board_size;
+
+    // Reshape [batch, channels] to [batch, channels, 1, 1].
+    const auto spatial_shape = graph.AddInt64s("spatial_shape", {0, -1, 1, 1});
+
+    graph.AddInput("planes", {batch, kInputChannels, board_size, board_size});
+
+    // The input layers.
+    auto x = graph.AddNode(
+                 "Relu",
+                 {AddConvolution(graph, "input_conv", "planes",
+                                 weights->input_conv, &weights->input_bn)},
+                 "input_relu");
+
+    // The residual tower.
+    for (int i = 0; i < weights->residual_blocks; ++i) {
+        auto &block = weights->tower[i];
+        const auto prefix = "block" + std::to_string(i);
+
+        const auto x1 = graph.AddNode(
+                            "Relu",
+                            {AddConvolution(graph, prefix + ".conv1", x, block.conv1, &block.bn1)},
+                            prefix + ".relu1");
+        auto x2 = AddConvolution(graph, prefix + ".conv2", x1, block.conv2, &block.bn2);
+
+        if (block.apply_se) {
+            const int channels = weights->residual_channels;
+            const auto pool = AddGlobalPooling(graph, prefix + ".se_pool", x2, board_size, false);
+            const auto squeeze = graph.AddNode(
+                                     "Relu",
+                                     {AddFullyConnect(graph, prefix + ".squeeze", pool, block.squeeze)},
+                                     prefix + ".squeeze_relu");
+
+            // The first half of the excitation is the gamma, the second
+            // half is the beta.
+            const auto gamma = graph.AddNode(
+                                   "Sigmoid",
+                                   {AddFullyConnect(graph, prefix + ".gamma", squeeze,
+                                                    block.excite, 0, channels)},
+                                   prefix + ".gamma_sigmoid");
+            const auto beta = AddFullyConnect(graph, prefix + ".beta", squeeze,
+                                              block.excite, channels, 2 * channels);
+            x2 = graph.AddNode(
+                     "Mul",
+                     {x2, graph.AddNode("Reshape", {gamma, spatial_shape}, prefix + ".gamma_spatial")},
+                     prefix + ".scaled");
+            x2 = graph.AddNode(
+                     "Add",
+                     {x2, graph.AddNode("Reshape", {beta, spatial_shape}, prefix + ".beta_spatial")},
+                     prefix + ".shifted");
+        }
+        x = graph.AddNode("Relu",
+                          {graph.AddNode("Add", {x2, x}, prefix + ".residual")},
+                          prefix + ".relu2");
+    }
+
+    // The policy head.
+    const auto policy = graph.AddNode(
+                            "Relu",
+                            {AddConvolution(graph, "p_ex_conv", x, weights->p_ex_conv, &weights->p_ex_bn)},
+                            "p_ex_relu");
+    const auto p_pool = AddGlobalPooling(graph, "p_pool", policy, board_size, false);
+    const auto p_inter = graph.AddNode(
+                             "Relu",
+                             {AddFullyConnect(graph, "p_inter_fc", p_pool, weights->p_inter_fc)},
+                             "p_inter_relu");
+    const auto policy_biased = graph.AddNode(
+                                   "Add",
+                                   {policy, graph.AddNode("Reshape", {p_inter, spatial_shape},
+                                                          "p_inter_spatial")},
+                                   "p_biased");
+    graph.AddNode("Flatten",
+                  {AddConvolution(graph, "prob_conv", policy_biased, weights->prob_conv, nullptr)},
+                  "policy",
+                  {OnnxGraph::IntAttribute("axis", 1)});
+    AddFullyConnect(graph, "pass", p_inter, weights->pass_fc);
+
+    // The value head.
+    const auto value = graph.AddNode(
+                           "Relu",
+                           {AddConvolution(graph, "v_ex_conv", x, weights->v_ex_conv, &weights->v_ex_bn)},
+                           "v_ex_relu");
+    const auto v_pool = AddGlobalPooling(graph, "v_pool", value, board_size, true);
+    const auto v_inter = graph.AddNode(
+                             "Relu",
+                             {AddFullyConnect(graph, "v_inter_fc", v_pool, weights->v_inter_fc)},
+                             "v_inter_relu");
+    graph.AddNode("Flatten",
+                  {AddConvolution(graph, "v_ownership", value, weights->v_ownership, nullptr)},
+                  "ownership",
+                  {OnnxGraph::IntAttribute("axis", 1)});
+    AddFullyConnect(graph, "value_misc", v_inter, weights->v_misc);
+
+    graph.AddOutput("policy", {batch, num_intersections});
+    graph.AddOutput("pass", {batch, kOuputPassProbability});
+    graph.AddOutput("ownership", {batch, num_intersections});
+    graph.AddOutput("value_misc", {batch, kOuputValueMisc});
+
+    return graph.Serialize();
+}
+
+std::string ExportOnnx(std::string weights_file,
+                       std::string output_file,
+                       const int board_size) {
+    auto weights = std::make_shared<DNNWeights>();
+    DNNLoder::Get().FromFile(weights, weights_file);
+    if (!weights->loaded) {
+        return "fail to load the weights";
+    }
+
+    auto file = std::ofstream{output_file, std::ios::binary};
+    if (!file.is_open()) {
+        return "fail to open the output file";
+    }
+    const auto model = GetOnnxModel(weights, board_size);
+    file.write(model.data(), model.size());
+    if (!file) {
+        return "fail to write the output file";
+    }
+    return std::string{};
+}
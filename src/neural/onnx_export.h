@@ -0,0 +1,22 @@
+#pragma once
+
+#include "neural/description.h"
+
+#include <memory>
+#include <string>
+
+// Write the network as an ONNX model for the other inference engines,
+// e.g. TensorRT. The board size is fixed in the model and the batch size
+// is dynamic. The batchnorm layers are folded into the convolutions.
+//
+// The input is "planes" [batch, input channels, size, size], the same
+// planes as InputData. The outputs are the raw outputs of the forward
+// pipes. They are "policy" and "ownership" [batch, size * size], "pass"
+// [batch, 1] and "value_misc" [batch, 5].
+std::string GetOnnxModel(std::shared_ptr<DNNWeights> weights, const int board_size);
+
+// Load the weights file and write its ONNX model into the output file.
+// Return the error message, or empty string if success.
+std::string ExportOnnx(std::string weights_file,
+                       std::string output_file,
+                       const int board_size);
@@ -0,0 +1,162 @@
+#ifdef USE_OPENCL
+
+#include "neural/opencl/opencl_common.h"
+#include "neural/winograd_helper.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace OpenCL {
+
+void ClError(cl_int status) {
+    if (status != CL_SUCCESS) {
+        auto err = std::ostringstream{};
+        err << "OpenCL error: " << status;
+        throw std::runtime_error(err.str());
+    }
+}
+
+static std::string GetDeviceString(cl_device_id device, cl_device_info param) {
+    size_t size = 0;
+    ReportCLErrors(clGetDeviceInfo(device, param, 0, nullptr, &size));
+    auto str = std::string(size, '\0');
+    ReportCLErrors(clGetDeviceInfo(device, param, size, &str[0], nullptr));
+
+    // Remove the null terminator.
+    while (!str.empty() && str.back() == '\0') {
+        str.pop_back();
+    }
+    return str;
+}
+
+static std::vector<Device> GetDevices(cl_device_type type) {
+    auto devices = std::vector<Device>{};
+
+    cl_uint num_platforms = 0;
+    if (clGetPlatformIDs(0, nullptr, &num_platforms) != CL_SUCCESS) {
+        return devices;
+    }
+    auto platforms = std::vector<cl_platform_id>(num_platforms);
+    ReportCLErrors(clGetPlatformIDs(num_platforms, platforms.data(), nullptr));
+
+    for (auto platform : platforms) {
+        cl_uint num_devices = 0;
+        if (clGetDeviceIDs(platform, type, 0, nullptr, &num_devices) != CL_SUCCESS) {
+            continue;
+        }
+        auto ids = std::vector<cl_device_id>(num_devices);
+        ReportCLErrors(clGetDeviceIDs(platform, type, num_devices, ids.data(), nullptr));
+        for (auto id : ids) {
+            devices.push_back({platform, id, GetDeviceString(id, CL_DEVICE_NAME)});
+        }
+    }
+    return devices;
+}
+
+std::vector<Device> GetDevices() {
+    auto devices = GetDevices(CL_DEVICE_TYPE_GPU);
+    if (devices.empty()) {
+        devices = GetDevices(CL_DEVICE_TYPE_ALL);
+    }
+    return devices;
+}
+
+std::string GetDeviceInfo(const Device &device) {
+    cl_ulong memory = 0;
+    cl_uint units = 0;
+    ReportCLErrors(clGetDeviceInfo(device.id, CL_DEVICE_GLOBAL_MEM_SIZE,
+                                       sizeof(memory), &memory, nullptr));
+    ReportCLErrors(clGetDeviceInfo(device.id, CL_DEVICE_MAX_COMPUTE_UNITS,
+                                       sizeof(units), &units, nullptr));
+
+    auto out = std::ostringstream{};
+    out << "  Device: " << device.name << '\n';
+    out << "  Vendor: " << GetDeviceString(device.id, CL_DEVICE_VENDOR) << '\n';
+    out << "  Version: " << GetDeviceString(device.id, CL_DEVICE_VERSION) << '\n';
+    out << "  Compute units: " << units << '\n';
+    out << "  Global memory: " << (memory >> 20) << " MiB\n";
+    return out.str();
+}
+
+cl_program BuildProgram(cl_context context,
+                        cl_device_id device,
+                        const std::string &source,
+                        const std::string &options) {
+    cl_int err;
+    const char *src = source.c_str();
+    const size_t size = source.size();
+    auto program = clCreateProgramWithSource(context, 1, &src, &size, &err);
+    ReportCLErrors(err);
+
+    const auto build_options = options +
+        " -cl-mad-enable -cl-fast-relaxed-math" +
+        " -DWINOGRAD_M=" + std::to_string(kWinogradM) +
+        " -DWINOGRAD_ALPHA=" + std::to_string(kWinogradAlpha);
+    if (clBuildProgram(program, 1, &device, build_options.c_str(),
+                           nullptr, nullptr) != CL_SUCCESS) {
+        size_t log_size = 0;
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &log_size);
+        auto log = std::string(log_size, '\0');
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, &log[0], nullptr);
+        clReleaseProgram(program);
+        throw std::runtime_error("OpenCL build error: " + log);
+    }
+    return program;
+}
+
+std::string SgemmParameters::GetBuildOptions() const {
+    auto out = std::ostringstream{};
+    out << "-DMWI=" << mwi << " -DNWI=" << nwi;
+    return out.str();
+}
+
+TuningCache &TuningCache::Get() {
+    static TuningCache cache;
+    return cache;
+}
+
+void TuningCache::Open(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (filename.empty() || filename == filename_) {
+        return;
+    }
+    filename_ = filename;
+
+    // One result per line, "<key> <mwi> <nwi> <mdimc> <ndimc>". The
+    // later line replaces the former one.
+    auto file = std::ifstream{filename_};
+    auto key = std::string{};
+    auto params = SgemmParameters{};
+    while (file >> key >> params.mwi >> params.nwi >> params.mdimc >> params.ndimc) {
+        if (params.mwi > 0 && params.nwi > 0 &&
+                params.mdimc > 0 && params.ndimc > 0) {
+            params_[key] = params;
+        }
+    }
+}
+
+bool TuningCache::Lookup(const std::string &key, SgemmParameters &params) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = params_.find(key);
+    if (it == std::end(params_)) {
+        return false;
+    }
+    params = it->second;
+    return true;
+}
+
+void TuningCache::Insert(const std::string &key, const SgemmParameters &params) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    params_[key] = params;
+    if (!filename_.empty()) {
+        auto file = std::ofstream{filename_, std::ios::app};
+        file << key << ' '
+                 << params.mwi << ' ' << params.nwi << ' '
+                 << params.mdimc << ' ' << params.ndimc << '\n';
+    }
+}
+
+} // namespace OpenCL
+
+#endif
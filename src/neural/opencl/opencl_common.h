@@ -0,0 +1,78 @@
+#pragma once
+
+#ifdef USE_OPENCL
+
+#ifndef CL_TARGET_OPENCL_VERSION
+#define CL_TARGET_OPENCL_VERSION 120
+#endif
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include <array>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace OpenCL {
+
+void ClError(cl_int status);
+
+#define ReportCLErrors(status) OpenCL::ClError(status)
+
+struct Device {
+    cl_platform_id platform;
+    cl_device_id id;
+    std::string name;
+};
+
+// Return the GPU devices of all platforms. Return the other devices if
+// there is no GPU.
+std::vector<Device> GetDevices();
+
+std::string GetDeviceInfo(const Device &device);
+
+// Build the program of the source. Throw the build log if it fails.
+cl_program BuildProgram(cl_context context,
+                        cl_device_id device,
+                        const std::string &source,
+                        const std::string &options);
+
+inline static size_t DivUp(size_t a, size_t b) { return (a + b - 1) / b; }
+inline static size_t RoundUp(size_t a, size_t b) { return DivUp(a, b) * b; }
+
+// The parameters of the SGEMM kernel. The work item computes MWI x NWI
+// outputs and the work group is MDIMC x NDIMC work items.
+struct SgemmParameters {
+    int mwi{4};
+    int nwi{4};
+    int mdimc{8};
+    int ndimc{8};
+
+    std::string GetBuildOptions() const;
+};
+
+class TuningCache {
+public:
+    static TuningCache &Get();
+
+    // Load the results of the file. The empty name keeps the results
+    // in the memory only.
+    void Open(const std::string &filename);
+
+    bool Lookup(const std::string &key, SgemmParameters &params);
+    void Insert(const std::string &key, const SgemmParameters &params);
+
+private:
+    std::mutex mutex_;
+    std::string filename_;
+    std::unordered_map<std::string, SgemmParameters> params_;
+};
+
+} // namespace OpenCL
+
+#endif
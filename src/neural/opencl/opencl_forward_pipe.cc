@@ -0,0 +1,827 @@
+#ifdef USE_OPENCL
+
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <sstream>
+
+#include "config.h"
+#include "neural/opencl/opencl_forward_pipe.h"
+#include "neural/opencl/opencl_kernels.h"
+#include "neural/winograd_helper.h"
+#include "utils/log.h"
+#include "utils/format.h"
+#include "utils/time.h"
+#include "utils/metrics.h"
+
+// Set the kernel arguments in order. The null buffer is passed as the
+// null pointer.
+static void SetArgs(cl_kernel, cl_uint) {}
+
+template<typename T, typename... Args>
+static void SetArgs(cl_kernel kernel, cl_uint index, const T &arg, const Args &...args) {
+    ReportCLErrors(clSetKernelArg(kernel, index, sizeof(T), &arg));
+    SetArgs(kernel, index + 1, args...);
+}
+
+static cl_kernel CreateKernel(cl_program program, const char *name) {
+    cl_int err;
+    auto kernel = clCreateKernel(program, name, &err);
+    ReportCLErrors(err);
+    return kernel;
+}
+
+void OpenCLForwardPipe::Initialize(std::shared_ptr<DNNWeights> weights) {
+    OpenCL::TuningCache::Get().Open(GetOption<std::string>("opencl_tuning_cache"));
+
+    const auto all_devices = OpenCL::GetDevices();
+    const auto gpus_str = GetOption<std::string>("gpus");
+
+    devices_.clear();
+    if (!gpus_str.empty()) {
+        auto iss = std::istringstream{gpus_str};
+        int gpu_id;
+        while (iss >> gpu_id) {
+            if (gpu_id >= 0 && gpu_id < (int)all_devices.size()) {
+                devices_.emplace_back(all_devices[gpu_id]);
+            } else {
+                LOGGING << Format("Not found OpenCL device %d.\n", gpu_id);
+            }
+        }
+    }
+    if (devices_.empty()) {
+        devices_ = all_devices;
+    }
+    if (devices_.empty()) {
+        LOGGING << "Not found any OpenCL device!\n";
+    }
+
+    batch_controller_.Reset(1000 * GetOption<int>("gpu_waittime"));
+    Load(weights);
+}
+
+void OpenCLForwardPipe::Load(std::shared_ptr<DNNWeights> weights) {
+    weights_ = weights;
+    board_size_ = 0;
+    Reload(GetOption<int>("defualt_boardsize"));
+}
+
+void OpenCLForwardPipe::Reload(int board_size) {
+    const auto net_size = std::max(board_size, GetOption<int>("fixed_nn_boardsize"));
+    if (board_size_ == net_size) {
+        return;
+    }
+
+    // The workers compute the remaining entries with the old graphs.
+    QuitWorkers();
+    Release();
+
+    if (weights_ == nullptr || devices_.empty()) {
+        return;
+    }
+
+    board_size_ = net_size;
+    max_batch_ = std::max(GetOption<int>("batch_size"), 1);
+
+    for (size_t i = 0; i < devices_.size(); ++i) {
+        LOGGING << Format("OpenCL device %zu:\n", i)
+                    << OpenCL::GetDeviceInfo(devices_[i]);
+        nngraphs_.emplace_back(std::make_unique<NNGraph>());
+        nngraphs_.back()->BuildGraph(devices_[i], max_batch_, board_size_, weights_);
+    }
+    PrepareWorkers();
+}
+
+cl_mem OpenCLForwardPipe::NNGraph::CreateBuffer(const size_t size, const float *data) {
+    cl_int err;
+    const auto flags = data ? CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR : CL_MEM_READ_WRITE;
+    auto buffer = clCreateBuffer(context_, flags, std::max(size, size_t{1}) * sizeof(float),
+                                     const_cast<float *>(data), &err);
+    ReportCLErrors(err);
+    return buffer;
+}
+
+OpenCLForwardPipe::NNGraph::ConvWeights
+    OpenCLForwardPipe::NNGraph::CreateConvolution(ConvLayer &conv, BatchNormLayer *bn) {
+    const int outputs = conv.GetOutputs();
+    const int inputs = conv.GetInputs();
+    const int filter = conv.GetFilter();
+    const int filter_dim = inputs * filter * filter;
+
+    // The batchnorm computes (conv(x) + bias - mean) * stddev.
+    auto weights = conv.GetWeights();
+    auto biases = conv.GetBiases();
+    biases.resize(outputs, 0.f);
+    if (bn) {
+        const auto &means = bn->GetMeans();
+        const auto &stddevs = bn->GetStddevs();
+        for (int o = 0; o < outputs; ++o) {
+            for (int idx = 0; idx < filter_dim; ++idx) {
+                weights[o * filter_dim + idx] *= stddevs[o];
+            }
+            biases[o] = (biases[o] - means[o]) * stddevs[o];
+        }
+    }
+    if (filter == 3) {
+        weights = WinogradTransformF(weights, outputs, inputs);
+    }
+
+    auto out = ConvWeights{};
+    out.weights = CreateBuffer(weights.size(), weights.data());
+    out.biases = CreateBuffer(biases.size(), biases.data());
+    out.inputs = inputs;
+    out.outputs = outputs;
+    return out;
+}
+
+OpenCLForwardPipe::NNGraph::FullyConnectWeights
+    OpenCLForwardPipe::NNGraph::CreateFullyConnect(LinearLayer &layer) {
+    auto out = FullyConnectWeights{};
+    out.weights = CreateBuffer(layer.GetWeights().size(), layer.GetWeights().data());
+    out.biases = CreateBuffer(layer.GetBiases().size(), layer.GetBiases().data());
+    out.inputs = layer.GetInputs();
+    out.outputs = layer.GetOutputs();
+    return out;
+}
+
+OpenCL::SgemmParameters OpenCLForwardPipe::NNGraph::TuneSgemm(const int K, const int C, const int P) {
+    cl_device_id device;
+    ReportCLErrors(clGetCommandQueueInfo(queue_, CL_QUEUE_DEVICE,
+                                             sizeof(device), &device, nullptr));
+    size_t max_group_size = 0;
+    ReportCLErrors(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                                       sizeof(max_group_size), &max_group_size, nullptr));
+    size_t name_size = 0;
+    ReportCLErrors(clGetDeviceInfo(device, CL_DEVICE_NAME, 0, nullptr, &name_size));
+    auto device_name = std::string(name_size, '\0');
+    ReportCLErrors(clGetDeviceInfo(device, CL_DEVICE_NAME, name_size, &device_name[0], nullptr));
+    device_name.erase(std::remove(std::begin(device_name), std::end(device_name), '\0'),
+                          std::end(device_name));
+    std::replace(std::begin(device_name), std::end(device_name), ' ', '_');
+
+    const auto key = Format("%s-%dx%dx%d", device_name.c_str(), K, C, P);
+    auto best = OpenCL::SgemmParameters{};
+    if (OpenCL::TuningCache::Get().Lookup(key, best)) {
+        return best;
+    }
+
+    LOGGING << "Tuning the OpenCL SGEMM kernel...\n";
+
+    // Tune it with the random matrices of the same shapes.
+    auto rng = std::mt19937{1};
+    auto dist = std::uniform_real_distribution<float>(-1.f, 1.f);
+    auto u = std::vector<float>(kWinogradTile * C * K);
+    auto v = std::vector<float>(kWinogradTile * C * P);
+    std::generate(std::begin(u), std::end(u), [&](){ return dist(rng); });
+    std::generate(std::begin(v), std::end(v), [&](){ return dist(rng); });
+    auto u_buf = CreateBuffer(u.size(), u.data());
+    auto v_buf = CreateBuffer(v.size(), v.data());
+    auto m_buf = CreateBuffer(kWinogradTile * K * P);
+
+    constexpr int kRepeats = 4;
+    auto best_time = -1.f;
+
+    for (const int mwi : {2, 4, 8}) {
+        for (const int nwi : {2, 4, 8}) {
+            for (const int mdimc : {4, 8, 16}) {
+                for (const int ndimc : {4, 8, 16}) {
+                    if ((size_t)(mdimc * ndimc) > max_group_size) {
+                        continue;
+                    }
+                    auto params = OpenCL::SgemmParameters{};
+                    params.mwi = mwi;
+                    params.nwi = nwi;
+                    params.mdimc = mdimc;
+                    params.ndimc = ndimc;
+
+                    cl_program program = nullptr;
+                    try {
+                        program = OpenCL::BuildProgram(context_, device, kOpenCLKernels,
+                                                           params.GetBuildOptions());
+                    } catch (const std::exception &) {
+                        continue;
+                    }
+                    auto kernel = CreateKernel(program, "sgemm_batched");
+                    SetArgs(kernel, 0, u_buf, v_buf, m_buf, K, C, P);
+
+                    const size_t local[] = {(size_t)mdimc, (size_t)ndimc, 1};
+                    const size_t global[] = {
+                        OpenCL::RoundUp(OpenCL::DivUp(K, mwi), mdimc),
+                        OpenCL::RoundUp(OpenCL::DivUp(P, nwi), ndimc),
+                        (size_t)kWinogradTile};
+
+                    // Warm up once before timing.
+                    auto err = clEnqueueNDRangeKernel(queue_, kernel, 3, nullptr,
+                                                      global, local, 0, nullptr, nullptr);
+                    if (err == CL_SUCCESS) {
+                        ReportCLErrors(clFinish(queue_));
+                        auto timer = Timer{};
+                        for (int r = 0; r < kRepeats; ++r) {
+                            ReportCLErrors(clEnqueueNDRangeKernel(queue_, kernel, 3, nullptr,
+                                                                  global, local, 0, nullptr, nullptr));
+                        }
+                        ReportCLErrors(clFinish(queue_));
+                        const auto elapsed = timer.GetDuration();
+                        if (best_time < 0.f || elapsed < best_time) {
+                            best_time = elapsed;
+                            best = params;
+                        }
+                    }
+                    clReleaseKernel(kernel);
+                    clReleaseProgram(program);
+                }
+            }
+        }
+    }
+    clReleaseMemObject(u_buf);
+    clReleaseMemObject(v_buf);
+    clReleaseMemObject(m_buf);
+
+    LOGGING << Format("The best SGEMM parameters: MWI=%d NWI=%d MDIMC=%d NDIMC=%d\n",
+                          best.mwi, best.nwi, best.mdimc, best.ndimc);
+    OpenCL::TuningCache::Get().Insert(key, best);
+    return best;
+}
+
+void OpenCLForwardPipe::NNGraph::BuildGraph(const OpenCL::Device &device,
+                                            const int max_batch,
+                                            const int board_size,
+                                            std::shared_ptr<DNNWeights> weights) {
+    weights_ = weights;
+    board_size_ = board_size;
+    max_batch_ = max_batch;
+
+    cl_int err;
+    const cl_context_properties properties[] = {
+        CL_CONTEXT_PLATFORM, (cl_context_properties)device.platform, 0};
+    context_ = clCreateContext(properties, 1, &device.id, nullptr, nullptr, &err);
+    ReportCLErrors(err);
+    queue_ = clCreateCommandQueue(context_, device.id, 0, &err);
+    ReportCLErrors(err);
+
+    const int channels = weights_->residual_channels;
+    const int num_intersections = board_size_ * board_size_;
+    const int batch_ptiles = max_batch_ * GetWinogradP(board_size_);
+
+    sgemm_params_ = TuneSgemm(channels, channels, batch_ptiles);
+    program_ = OpenCL::BuildProgram(context_, device.id, kOpenCLKernels,
+                                        sgemm_params_.GetBuildOptions());
+
+    transform_in_ = CreateKernel(program_, "transform_in");
+    sgemm_ = CreateKernel(program_, "sgemm_batched");
+    transform_out_ = CreateKernel(program_, "transform_out");
+    convolution1_ = CreateKernel(program_, "convolution1");
+    global_pooling_ = CreateKernel(program_, "global_pooling");
+    fully_connect_ = CreateKernel(program_, "fully_connect");
+    se_scale_ = CreateKernel(program_, "se_scale");
+    add_spatial_ = CreateKernel(program_, "add_spatial");
+
+    // The weights.
+    input_conv_ = CreateConvolution(weights_->input_conv, &weights_->input_bn);
+    tower_.resize(weights_->residual_blocks);
+    for (int i = 0; i < weights_->residual_blocks; ++i) {
+        auto &block = weights_->tower[i];
+        tower_[i].conv1 = CreateConvolution(block.conv1, &block.bn1);
+        tower_[i].conv2 = CreateConvolution(block.conv2, &block.bn2);
+        tower_[i].apply_se = block.apply_se;
+        if (block.apply_se) {
+            tower_[i].squeeze = CreateFullyConnect(block.squeeze);
+            tower_[i].excite = CreateFullyConnect(block.excite);
+        }
+    }
+    p_ex_conv_ = CreateConvolution(weights_->p_ex_conv, &weights_->p_ex_bn);
+    p_inter_ = CreateFullyConnect(weights_->p_inter_fc);
+    prob_conv_ = CreateConvolution(weights_->prob_conv, nullptr);
+    pass_fc_ = CreateFullyConnect(weights_->pass_fc);
+    v_ex_conv_ = CreateConvolution(weights_->v_ex_conv, &weights_->v_ex_bn);
+    v_inter_ = CreateFullyConnect(weights_->v_inter_fc);
+    ownership_conv_ = CreateConvolution(weights_->v_ownership, nullptr);
+    misc_fc_ = CreateFullyConnect(weights_->v_misc);
+
+    // The buffers.
+    const int policy_channels = weights_->policy_extract_channels;
+    const int value_channels = weights_->value_extract_channels;
+    const int max_channels = std::max(channels, kInputChannels);
+
+    planes_ = CreateBuffer(max_batch_ * kInputChannels * num_intersections);
+    mask_ = CreateBuffer(max_batch_ * num_intersections);
+    sqrt_mask_ = CreateBuffer(max_batch_);
+    for (auto &buf : conv_op_) {
+        buf = CreateBuffer(max_batch_ * channels * num_intersections);
+    }
+    pol_op_[0] = CreateBuffer(max_batch_ * policy_channels * num_intersections);
+    pol_op_[1] = CreateBuffer(max_batch_ * 3 * policy_channels);
+    pol_op_[2] = CreateBuffer(max_batch_ * policy_channels);
+    val_op_[0] = CreateBuffer(max_batch_ * value_channels * num_intersections);
+    val_op_[1] = CreateBuffer(max_batch_ * 3 * value_channels);
+    val_op_[2] = CreateBuffer(max_batch_ * 3 * value_channels);
+    se_op_[0] = CreateBuffer(max_batch_ * 3 * channels);
+    se_op_[1] = CreateBuffer(max_batch_ * 3 * channels);
+    se_op_[2] = CreateBuffer(max_batch_ * 2 * channels);
+    winograd_v_ = CreateBuffer(kWinogradTile * max_channels * batch_ptiles);
+    winograd_m_ = CreateBuffer(kWinogradTile * channels * batch_ptiles);
+    output_prob_ = CreateBuffer(max_batch_ * num_intersections);
+    output_pass_ = CreateBuffer(max_batch_ * kOuputPassProbability);
+    output_ownership_ = CreateBuffer(max_batch_ * num_intersections);
+    output_misc_ = CreateBuffer(max_batch_ * kOuputValueMisc);
+
+    host_planes_.resize(max_batch_ * kInputChannels * num_intersections);
+    host_mask_.resize(max_batch_ * num_intersections);
+    host_sqrt_mask_.resize(max_batch_);
+    host_prob_.resize(max_batch_ * num_intersections);
+    host_pass_.resize(max_batch_ * kOuputPassProbability);
+    host_ownership_.resize(max_batch_ * num_intersections);
+    host_misc_.resize(max_batch_ * kOuputValueMisc);
+}
+
+void OpenCLForwardPipe::NNGraph::Enqueue(cl_kernel kernel,
+                                         const std::vector<size_t> &global,
+                                         const size_t *local) {
+    ReportCLErrors(clEnqueueNDRangeKernel(queue_, kernel, global.size(), nullptr,
+                                              global.data(), local, 0, nullptr, nullptr));
+}
+
+void OpenCLForwardPipe::NNGraph::Convolution3(const int batch_size,
+                                              cl_mem input, cl_mem output,
+                                              const ConvWeights &conv,
+                                              cl_mem eltwise, cl_mem mask, const bool relu) {
+    const int ptiles = batch_size * GetWinogradP(board_size_);
+    const int relu_flag = relu;
+
+    SetArgs(transform_in_, 0, input, winograd_v_, conv.inputs, board_size_, batch_size);
+    Enqueue(transform_in_, {(size_t)(conv.inputs * ptiles)});
+
+    const auto &params = sgemm_params_;
+    const size_t local[] = {(size_t)params.mdimc, (size_t)params.ndimc, 1};
+    SetArgs(sgemm_, 0, conv.weights, winograd_v_, winograd_m_, conv.outputs, conv.inputs, ptiles);
+    Enqueue(sgemm_,
+            {OpenCL::RoundUp(OpenCL::DivUp(conv.outputs, params.mwi), params.mdimc),
+             OpenCL::RoundUp(OpenCL::DivUp(ptiles, params.nwi), params.ndimc),
+             (size_t)kWinogradTile},
+            local);
+
+    SetArgs(transform_out_, 0, winograd_m_, output, conv.biases, eltwise, mask,
+            relu_flag, conv.outputs, board_size_, batch_size);
+    Enqueue(transform_out_, {(size_t)(conv.outputs * ptiles)});
+}
+
+void OpenCLForwardPipe::NNGraph::Convolution1(const int batch_size,
+                                              cl_mem input, cl_mem output,
+                                              const ConvWeights &conv,
+                                              cl_mem mask, const bool relu) {
+    const int spatial = board_size_ * board_size_;
+    const int relu_flag = relu;
+
+    SetArgs(convolution1_, 0, input, output, conv.weights, conv.biases, mask,
+            relu_flag, conv.inputs, conv.outputs, spatial);
+    Enqueue(convolution1_, {(size_t)spatial, (size_t)conv.outputs, (size_t)batch_size});
+}
+
+void OpenCLForwardPipe::NNGraph::FullyConnect(const int batch_size,
+                                              cl_mem input, cl_mem output,
+                                              const FullyConnectWeights &fc, const bool relu) {
+    const int relu_flag = relu;
+
+    SetArgs(fully_connect_, 0, input, output, fc.weights, fc.biases,
+            relu_flag, fc.inputs, fc.outputs);
+    Enqueue(fully_connect_, {(size_t)fc.outputs, (size_t)batch_size});
+}
+
+void OpenCLForwardPipe::NNGraph::GlobalPooling(const int batch_size,
+                                               cl_mem input, cl_mem output,
+                                               const int channels,
+                                               cl_mem mask, cl_mem sqrt_mask,
+                                               const bool value_head) {
+    const int value_flag = value_head;
+
+    SetArgs(global_pooling_, 0, input, output, mask, sqrt_mask,
+            value_flag, channels, board_size_);
+    Enqueue(global_pooling_, {(size_t)channels, (size_t)batch_size});
+}
+
+void OpenCLForwardPipe::NNGraph::BatchForward(const std::vector<const InputData *> &inputs,
+                                              std::vector<OutputResult> &outputs) {
+    const int batch_size = inputs.size();
+    const int num_intersections = board_size_ * board_size_;
+    const int planes_size = kInputChannels * num_intersections;
+
+    // Expand the planes into the network board size.
+    bool should_apply_mask = false;
+    std::fill(std::begin(host_planes_),
+              std::begin(host_planes_) + batch_size * planes_size, 0.f);
+    for (int b = 0; b < batch_size; ++b) {
+        const int planes_bsize = inputs[b]->board_size;
+        const auto from = std::begin(inputs[b]->planes);
+        auto to = std::begin(host_planes_) + b * planes_size;
+
+        for (int c = 0; c < kInputChannels; ++c) {
+            for (int y = 0; y < planes_bsize; ++y) {
+                std::copy(from + (c * planes_bsize + y) * planes_bsize,
+                          from + (c * planes_bsize + y + 1) * planes_bsize,
+                          to + (c * board_size_ + y) * board_size_);
+            }
+        }
+        if (planes_bsize != board_size_) {
+            should_apply_mask = true;
+        }
+    }
+    ReportCLErrors(clEnqueueWriteBuffer(queue_, planes_, CL_FALSE, 0,
+                                            batch_size * planes_size * sizeof(float),
+                                            host_planes_.data(), 0, nullptr, nullptr));
+
+    cl_mem mask = nullptr;
+    cl_mem sqrt_mask = nullptr;
+    if (should_apply_mask) {
+        for (int b = 0; b < batch_size; ++b) {
+            const int planes_bsize = inputs[b]->board_size;
+            for (int idx = 0; idx < num_intersections; ++idx) {
+                const int x = idx % board_size_;
+                const int y = idx / board_size_;
+                host_mask_[b * num_intersections + idx] =
+                    (x < planes_bsize && y < planes_bsize) ? 1.f : 0.f;
+            }
+            host_sqrt_mask_[b] = planes_bsize;
+        }
+        ReportCLErrors(clEnqueueWriteBuffer(queue_, mask_, CL_FALSE, 0,
+                                                batch_size * num_intersections * sizeof(float),
+                                                host_mask_.data(), 0, nullptr, nullptr));
+        ReportCLErrors(clEnqueueWriteBuffer(queue_, sqrt_mask_, CL_FALSE, 0,
+                                                batch_size * sizeof(float),
+                                                host_sqrt_mask_.data(), 0, nullptr, nullptr));
+        mask = mask_;
+        sqrt_mask = sqrt_mask_;
+    }
+
+    const int channels = weights_->residual_channels;
+    auto conv_op = conv_op_;
+
+    // The input layers.
+    Convolution3(batch_size, planes_, conv_op[0], input_conv_, nullptr, mask, true);
+
+    // The residual tower.
+    for (auto &block : tower_) {
+        Convolution3(batch_size, conv_op[0], conv_op[1], block.conv1, nullptr, mask, true);
+
+        if (block.apply_se) {
+            Convolution3(batch_size, conv_op[1], conv_op[2], block.conv2, nullptr, mask, false);
+            GlobalPooling(batch_size, conv_op[2], se_op_[0], channels, mask, sqrt_mask, false);
+            FullyConnect(batch_size, se_op_[0], se_op_[1], block.squeeze, true);
+            FullyConnect(batch_size, se_op_[1], se_op_[2], block.excite, false);
+
+            const int spatial = num_intersections;
+            SetArgs(se_scale_, 0, conv_op[2], se_op_[2], conv_op[0], mask, channels, spatial);
+            Enqueue(se_scale_, {(size_t)spatial, (size_t)channels, (size_t)batch_size});
+        } else {
+            Convolution3(batch_size, conv_op[1], conv_op[2], block.conv2, conv_op[0], mask, true);
+            std::swap(conv_op[0], conv_op[2]);
+        }
+    }
+
+    // The policy head.
+    const int policy_channels = weights_->policy_extract_channels;
+    Convolution1(batch_size, conv_op[0], pol_op_[0], p_ex_conv_, mask, true);
+    GlobalPooling(batch_size, pol_op_[0], pol_op_[1], policy_channels, mask, sqrt_mask, false);
+    FullyConnect(batch_size, pol_op_[1], pol_op_[2], p_inter_, true);
+
+    SetArgs(add_spatial_, 0, pol_op_[0], pol_op_[2], mask, policy_channels, num_intersections);
+    Enqueue(add_spatial_, {(size_t)num_intersections, (size_t)policy_channels, (size_t)batch_size});
+
+    Convolution1(batch_size, pol_op_[0], output_prob_, prob_conv_, nullptr, false);
+    FullyConnect(batch_size, pol_op_[2], output_pass_, pass_fc_, false);
+
+    // The value head. It is skipped if the batch only has the policy
+    // requests.
+    auto need_value = false;
+    auto need_ownership = false;
+    for (const auto input : inputs) {
+        need_value |= input->need_value;
+        need_ownership |= input->need_value && input->need_ownership;
+    }
+    if (need_value) {
+        const int value_channels = weights_->value_extract_channels;
+        Convolution1(batch_size, conv_op[0], val_op_[0], v_ex_conv_, mask, true);
+        GlobalPooling(batch_size, val_op_[0], val_op_[1], value_channels, mask, sqrt_mask, true);
+        FullyConnect(batch_size, val_op_[1], val_op_[2], v_inter_, true);
+
+        if (need_ownership) {
+            Convolution1(batch_size, val_op_[0], output_ownership_, ownership_conv_, nullptr, false);
+        }
+        FullyConnect(batch_size, val_op_[2], output_misc_, misc_fc_, false);
+    }
+
+    // Copy the outputs back.
+    ReportCLErrors(clEnqueueReadBuffer(queue_, output_prob_, CL_FALSE, 0,
+                                           batch_size * num_intersections * sizeof(float),
+                                           host_prob_.data(), 0, nullptr, nullptr));
+    ReportCLErrors(clEnqueueReadBuffer(queue_, output_pass_, CL_FALSE, 0,
+                                           batch_size * kOuputPassProbability * sizeof(float),
+                                           host_pass_.data(), 0, nullptr, nullptr));
+    if (need_ownership) {
+        ReportCLErrors(clEnqueueReadBuffer(queue_, output_ownership_, CL_FALSE, 0,
+                                               batch_size * num_intersections * sizeof(float),
+                                               host_ownership_.data(), 0, nullptr, nullptr));
+    }
+    if (need_value) {
+        ReportCLErrors(clEnqueueReadBuffer(queue_, output_misc_, CL_FALSE, 0,
+                                               batch_size * kOuputValueMisc * sizeof(float),
+                                               host_misc_.data(), 0, nullptr, nullptr));
+    } else {
+        std::fill(std::begin(host_misc_), std::begin(host_misc_) + batch_size * kOuputValueMisc, 0.f);
+    }
+    ReportCLErrors(clFinish(queue_));
+
+    outputs.resize(batch_size);
+    for (int b = 0; b < batch_size; ++b) {
+        const int planes_bsize = inputs[b]->board_size;
+        const auto misc = host_misc_.data() + b * kOuputValueMisc;
+        auto &result = outputs[b];
+
+        result.board_size = planes_bsize;
+        result.komi = inputs[b]->komi;
+        result.wdl[0] = misc[0];
+        result.wdl[1] = misc[1];
+        result.wdl[2] = misc[2];
+        result.stm_winrate = misc[3];
+        result.final_score = misc[4];
+        result.pass_probability = host_pass_[b];
+        result.has_ownership = inputs[b]->need_value && inputs[b]->need_ownership;
+        result.has_value = need_value;
+
+        // Remove the intersections out of the board.
+        for (int y = 0; y < planes_bsize; ++y) {
+            const auto prob = std::begin(host_prob_) + b * num_intersections + y * board_size_;
+            std::copy(prob, prob + planes_bsize,
+                      std::begin(result.probabilities) + y * planes_bsize);
+            if (result.has_ownership) {
+                const auto owner = std::begin(host_ownership_) + b * num_intersections + y * board_size_;
+                std::copy(owner, owner + planes_bsize,
+                          std::begin(result.ownership) + y * planes_bsize);
+            }
+        }
+        if (!result.has_ownership) {
+            std::fill(std::begin(result.ownership), std::end(result.ownership), 0.f);
+        }
+    }
+}
+
+void OpenCLForwardPipe::NNGraph::DestroyGraph() {
+    const auto release_mem = [](cl_mem &mem) {
+        if (mem) {
+            clReleaseMemObject(mem);
+            mem = nullptr;
+        }
+    };
+    const auto release_conv = [&](ConvWeights &conv) {
+        release_mem(conv.weights);
+        release_mem(conv.biases);
+    };
+    const auto release_fc = [&](FullyConnectWeights &fc) {
+        release_mem(fc.weights);
+        release_mem(fc.biases);
+    };
+
+    release_conv(input_conv_);
+    for (auto &block : tower_) {
+        release_conv(block.conv1);
+        release_conv(block.conv2);
+        release_fc(block.squeeze);
+        release_fc(block.excite);
+    }
+    tower_.clear();
+    release_conv(p_ex_conv_);
+    release_fc(p_inter_);
+    release_conv(prob_conv_);
+    release_fc(pass_fc_);
+    release_conv(v_ex_conv_);
+    release_fc(v_inter_);
+    release_conv(ownership_conv_);
+    release_fc(misc_fc_);
+
+    for (auto mem : {&planes_, &mask_, &sqrt_mask_,
+                         &winograd_v_, &winograd_m_,
+                         &output_prob_, &output_pass_, &output_ownership_, &output_misc_}) {
+        release_mem(*mem);
+    }
+    for (auto ops : {&conv_op_, &pol_op_, &val_op_, &se_op_}) {
+        for (auto &mem : *ops) {
+            release_mem(mem);
+        }
+    }
+
+    for (auto kernel : {&transform_in_, &sgemm_, &transform_out_, &convolution1_,
+                            &global_pooling_, &fully_connect_, &se_scale_, &add_spatial_}) {
+        if (*kernel) {
+            clReleaseKernel(*kernel);
+            *kernel = nullptr;
+        }
+    }
+    if (program_) {
+        clReleaseProgram(program_);
+        program_ = nullptr;
+    }
+    if (queue_) {
+        clReleaseCommandQueue(queue_);
+        queue_ = nullptr;
+    }
+    if (context_) {
+        clReleaseContext(context_);
+        context_ = nullptr;
+    }
+}
+
+OpenCLForwardPipe::NNGraph::~NNGraph() {
+    DestroyGraph();
+}
+
+OutputResult OpenCLForwardPipe::Forward(const InputData &inpnt) {
+    return ForwardAsync(inpnt).get();
+}
+
+std::future<OutputResult> OpenCLForwardPipe::ForwardAsync(const InputData &inpnt) {
+    auto entry = std::make_shared<ForwardEntry>(inpnt);
+    auto future = entry->promise.get_future();
+    auto queue_size = size_t{0};
+    {
+        // Push the entry.
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        entry_queue_.emplace_back(entry);
+        queue_size = entry_queue_.size();
+    }
+    batch_controller_.OnArrival();
+
+    if (queue_size == 1 || queue_size >= (size_t)max_batch_) {
+        // Wake up one worker if it is the first entry or there are
+        // enough batch size.
+        cv_.notify_one();
+    }
+
+    // The batch forwarding worker sets the result.
+    return future;
+}
+
+std::string OpenCLForwardPipe::GetStatsString() {
+    return batch_controller_.GetStatsString();
+}
+
+float OpenCLForwardPipe::GetBatchFillRatio() {
+    return batch_controller_.GetFillRatio();
+}
+
+void OpenCLForwardPipe::ResetStats() {
+    batch_controller_.ResetStats();
+}
+
+bool OpenCLForwardPipe::Valid() {
+    return weights_ != nullptr;
+}
+
+void OpenCLForwardPipe::Release() {
+    nngraphs_.clear();
+    board_size_ = 0;
+}
+
+void OpenCLForwardPipe::Destroy() {
+    QuitWorkers();
+    Release();
+}
+
+void OpenCLForwardPipe::PrepareWorkers() {
+    worker_running_.store(true);
+    if (workers_.empty()) {
+        for (int i = 0; i < (int)nngraphs_.size(); ++i) {
+            workers_.emplace_back([i, this](){ Worker(i); });
+        }
+    }
+}
+
+void OpenCLForwardPipe::Worker(int gpu) {
+    const auto waittime_base = GetOption<int>("gpu_waittime");
+    const int max_batch = max_batch_;
+
+    const auto gether_batches = [this, gpu, waittime_base, max_batch](){
+        auto entries = std::vector<std::shared_ptr<ForwardEntry>>{};
+        auto timer = Timer{};
+        bool waiting = false;
+
+        // Running the loop until there are enough entry size or the
+        // controller decides to dispatch the current entries.
+        while(true) {
+            if (!worker_running_.load(std::memory_order_relaxed)) {
+                return entries;
+            }
+
+            const int queue_size = entry_queue_.size();
+            if (queue_size >= max_batch) {
+                break; // Finish the loop.
+            }
+
+            std::unique_lock<std::mutex> lock(worker_mutex_);
+            if (queue_size == 0) {
+                // Sleep until the first entry arrives.
+                cv_.wait_for(lock, std::chrono::milliseconds(std::max(waittime_base, 1)),
+                                 [this](){ return !entry_queue_.empty() ||
+                                                      !worker_running_.load(std::memory_order_relaxed); });
+                continue;
+            }
+
+            if (!waiting) {
+                timer.Clock();
+                waiting = true;
+            }
+            const int wait_us = batch_controller_.GetWaitMicroseconds(queue_size, max_batch) -
+                                    timer.GetDurationMicroseconds();
+            if (wait_us <= 0) {
+                break; // Finish the loop.
+            }
+            cv_.wait_for(lock, std::chrono::microseconds(wait_us),
+                             [this, max_batch](){ return !((int)entry_queue_.size() < max_batch) ||
+                                                             !worker_running_.load(std::memory_order_relaxed); });
+        }
+
+        // Gather the entries.
+        std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+        auto count = std::min(entry_queue_.size(), (size_t)max_batch);
+
+        auto end = std::begin(entry_queue_);
+        std::advance(end, count);
+        std::move(std::begin(entry_queue_), end, std::back_inserter(entries));
+        entry_queue_.erase(std::begin(entry_queue_), end);
+
+        batch_controller_.OnDispatch(entries.size(), max_batch,
+                                     waiting ? timer.GetDurationMicroseconds() : 0);
+
+        const auto now = std::chrono::steady_clock::now();
+        for (const auto &entry : entries) {
+            Metrics::AddQueueWait(std::chrono::duration_cast<std::chrono::microseconds>(
+                                      now - entry->pushed).count());
+        }
+        Metrics::AddBatch(gpu, entries.size(), max_batch);
+        return entries;
+    };
+
+    // Reuse the batch lists of this worker.
+    auto inputs = std::vector<const InputData *>{};
+    auto outputs = std::vector<OutputResult>{};
+
+    while (true) {
+        if (!worker_running_.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        auto entries = gether_batches();
+        if (entries.empty()) {
+            continue;
+        }
+
+        // The boards larger than the network board size can not be
+        // computed. Their results are empty.
+        inputs.clear();
+        for (auto &entry : entries) {
+            inputs.emplace_back(&entry->input);
+            if (entry->input.board_size > board_size_) {
+                LOGGING << Format("The %dx%d board is larger than the network.\n",
+                                      entry->input.board_size, entry->input.board_size);
+                inputs.pop_back();
+            }
+        }
+        if (!inputs.empty()) {
+            nngraphs_[gpu]->BatchForward(inputs, outputs);
+        }
+
+        auto it = std::begin(outputs);
+        for (auto &entry : entries) {
+            if (entry->input.board_size > board_size_) {
+                entry->promise.set_value(OutputResult{});
+            } else {
+                entry->promise.set_value(*it++);
+            }
+        }
+    }
+}
+
+void OpenCLForwardPipe::QuitWorkers() {
+    worker_running_.store(false);
+    cv_.notify_all();
+    for (auto &t : workers_) {
+        t.join();
+    }
+    workers_.clear();
+
+    // Compute the remaining entries so that no thread waits for
+    // them forever.
+    std::lock_guard<std::mutex> queue_lock(queue_mutex_);
+    auto inputs = std::vector<const InputData *>(1);
+    auto outputs = std::vector<OutputResult>{};
+    for (auto &entry : entry_queue_) {
+        if (nngraphs_.empty() || entry->input.board_size > board_size_) {
+            entry->promise.set_value(OutputResult{});
+            continue;
+        }
+        inputs[0] = &entry->input;
+        nngraphs_[0]->BatchForward(inputs, outputs);
+        entry->promise.set_value(outputs[0]);
+    }
+    entry_queue_.clear();
+}
+
+#endif
@@ -0,0 +1,215 @@
+#pragma once
+
+#ifdef USE_OPENCL
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "neural/network_basic.h"
+#include "neural/batch_controller.h"
+#include "neural/description.h"
+#include "neural/opencl/opencl_common.h"
+
+// Compute the network with the OpenCL kernels, e.g. on the AMD and the
+// Intel GPUs. The 3x3 convolutions are the Winograd F(4x4, 3x3) with the
+// batched SGEMM, whose register tile is tuned per device. The graph is
+// built for the network board size, and the smaller boards in the same
+// batch are masked like the CUDA pipe.
+class OpenCLForwardPipe : public NetworkForwardPipe {
+public:
+    virtual void Initialize(std::shared_ptr<DNNWeights> weights);
+
+    virtual OutputResult Forward(const InputData &inpnt);
+
+    virtual std::future<OutputResult> ForwardAsync(const InputData &inpnt);
+
+    virtual std::string GetStatsString();
+
+    virtual float GetBatchFillRatio();
+
+    virtual void ResetStats();
+
+    virtual bool Valid();
+
+    virtual void Load(std::shared_ptr<DNNWeights> weights);
+
+    virtual void Reload(int board_size);
+
+    virtual void Release();
+
+    virtual void Destroy();
+
+private:
+    // The network on one device.
+    class NNGraph {
+    public:
+        ~NNGraph();
+
+        void BuildGraph(const OpenCL::Device &device,
+                        const int max_batch,
+                        const int board_size,
+                        std::shared_ptr<DNNWeights> weights);
+
+        // Compute the inputs in one batch. The boards may be smaller
+        // than the network board size.
+        void BatchForward(const std::vector<const InputData *> &inputs,
+                          std::vector<OutputResult> &outputs);
+
+        void DestroyGraph();
+
+    private:
+        struct ConvWeights {
+            cl_mem weights{nullptr};
+            cl_mem biases{nullptr};
+            int inputs{0};
+            int outputs{0};
+        };
+
+        struct FullyConnectWeights {
+            cl_mem weights{nullptr};
+            cl_mem biases{nullptr};
+            int inputs{0};
+            int outputs{0};
+        };
+
+        struct ResidualWeights {
+            ConvWeights conv1;
+            ConvWeights conv2;
+            bool apply_se{false};
+            FullyConnectWeights squeeze;
+            FullyConnectWeights excite;
+        };
+
+        cl_mem CreateBuffer(const size_t size, const float *data = nullptr);
+
+        // Fold the batchnorm into the convolution. The 3x3 weights are
+        // transformed for the Winograd.
+        ConvWeights CreateConvolution(ConvLayer &conv, BatchNormLayer *bn);
+        FullyConnectWeights CreateFullyConnect(LinearLayer &layer);
+
+        // Select the SGEMM parameters of the residual convolution. Tune
+        // them if they are not in the cache.
+        OpenCL::SgemmParameters TuneSgemm(const int K, const int C, const int P);
+
+        void Convolution3(const int batch_size,
+                          cl_mem input, cl_mem output,
+                          const ConvWeights &conv,
+                          cl_mem eltwise, cl_mem mask, const bool relu);
+        void Convolution1(const int batch_size,
+                          cl_mem input, cl_mem output,
+                          const ConvWeights &conv,
+                          cl_mem mask, const bool relu);
+        void FullyConnect(const int batch_size,
+                          cl_mem input, cl_mem output,
+                          const FullyConnectWeights &fc, const bool relu);
+        void GlobalPooling(const int batch_size,
+                           cl_mem input, cl_mem output,
+                           const int channels,
+                           cl_mem mask, cl_mem sqrt_mask,
+                           const bool value_head);
+        void Enqueue(cl_kernel kernel,
+                     const std::vector<size_t> &global,
+                     const size_t *local = nullptr);
+
+        std::shared_ptr<DNNWeights> weights_{nullptr};
+        int board_size_{0};
+        int max_batch_{0};
+
+        cl_context context_{nullptr};
+        cl_command_queue queue_{nullptr};
+        cl_program program_{nullptr};
+
+        cl_kernel transform_in_{nullptr};
+        cl_kernel sgemm_{nullptr};
+        cl_kernel transform_out_{nullptr};
+        cl_kernel convolution1_{nullptr};
+        cl_kernel global_pooling_{nullptr};
+        cl_kernel fully_connect_{nullptr};
+        cl_kernel se_scale_{nullptr};
+        cl_kernel add_spatial_{nullptr};
+
+        OpenCL::SgemmParameters sgemm_params_;
+
+        ConvWeights input_conv_;
+        std::vector<ResidualWeights> tower_;
+        ConvWeights p_ex_conv_;
+        FullyConnectWeights p_inter_;
+        ConvWeights prob_conv_;
+        FullyConnectWeights pass_fc_;
+        ConvWeights v_ex_conv_;
+        FullyConnectWeights v_inter_;
+        ConvWeights ownership_conv_;
+        FullyConnectWeights misc_fc_;
+
+        // The device buffers.
+        cl_mem planes_{nullptr};
+        cl_mem mask_{nullptr};
+        cl_mem sqrt_mask_{nullptr};
+        std::array<cl_mem, 3> conv_op_{};
+        std::array<cl_mem, 3> pol_op_{};
+        std::array<cl_mem, 3> val_op_{};
+        std::array<cl_mem, 3> se_op_{};
+        cl_mem winograd_v_{nullptr};
+        cl_mem winograd_m_{nullptr};
+        cl_mem output_prob_{nullptr};
+        cl_mem output_pass_{nullptr};
+        cl_mem output_ownership_{nullptr};
+        cl_mem output_misc_{nullptr};
+
+        // The host buffers of one batch.
+        std::vector<float> host_planes_;
+        std::vector<float> host_mask_;
+        std::vector<float> host_sqrt_mask_;
+        std::vector<float> host_prob_;
+        std::vector<float> host_pass_;
+        std::vector<float> host_ownership_;
+        std::vector<float> host_misc_;
+    };
+
+    struct ForwardEntry {
+        InputData input;
+        std::promise<OutputResult> promise;
+
+        // When it is pushed into the queue.
+        std::chrono::steady_clock::time_point pushed;
+
+        ForwardEntry(const InputData &in)
+            : input(in), pushed(std::chrono::steady_clock::now()) {}
+    };
+
+    void PrepareWorkers();
+    void Worker(int gpu);
+    void QuitWorkers();
+
+    std::shared_ptr<DNNWeights> weights_{nullptr};
+
+    std::vector<OpenCL::Device> devices_;
+    std::vector<std::unique_ptr<NNGraph>> nngraphs_;
+
+    int board_size_{0};
+    int max_batch_{1};
+
+    std::list<std::shared_ptr<ForwardEntry>> entry_queue_;
+    std::mutex worker_mutex_;
+    std::mutex queue_mutex_;
+
+    std::condition_variable cv_;
+
+    std::atomic<bool> worker_running_{false};
+
+    // Decide how long the workers wait for the entries.
+    BatchController batch_controller_;
+
+    std::vector<std::thread> workers_;
+};
+
+#endif
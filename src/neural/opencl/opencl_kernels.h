@@ -0,0 +1,396 @@
+#pragma once
+
+#ifdef USE_OPENCL
+
+// The OpenCL C kernels of the network. The Winograd tile geometry and
+// the register tile of the SGEMM are given by the build options:
+//
+//   WINOGRAD_M, WINOGRAD_ALPHA : the tile geometry of winograd_helper.h
+//   MWI, NWI                   : the outputs of one work item in the SGEMM
+//
+// The kernels do not use the local memory, so the same source works on
+// every device. The optional buffers, e.g. the mask, may be null.
+static const char *kOpenCLKernels = R"CLC(
+
+#define SQ2 1.4142135623730951f
+
+// Compute transpose(B) . x for one row of the input tile.
+inline void multiply_bt(float *o, const float i0, const float i1, const float i2,
+                        const float i3, const float i4, const float i5) {
+    const float i3m1 = i1 * -SQ2 + i3 * (SQ2 / 2.0f);
+    const float i4m2 = i2 * -2.0f + i4 * 1.0f;
+
+    o[0] = i0 + i2 * (-5.0f/2.0f) + i4;
+    o[1] = i3m1 + i4m2;
+    o[2] = -i3m1 + i4m2;
+
+    const float i3m1_2 = i3 * (SQ2) + i1 * (-SQ2/2.0f);
+    const float i4m2_2 = i2 * (-1.0f/2.0f) + i4;
+
+    o[3] = i3m1_2 + i4m2_2;
+    o[4] = -i3m1_2 + i4m2_2;
+
+    o[5] = i1 + i3 * (-5.0f/2.0f) + i5;
+}
+
+// Compute transpose(A) . m for one row of the output tile.
+inline void multiply_atv(float *o, const float i0, const float i1, const float i2,
+                         const float i3, const float i4, const float i5) {
+    const float t1p2 = (i1 + i2) * (1.0f / 2.0f);
+    const float t1m2 = (i1 - i2) * (SQ2/4.0f);
+    const float t3p4 = i3 + i4;
+    const float t3m4 = (i3 - i4) * (SQ2);
+
+    o[0] = i0 + t1p2 + t1p2 + t3p4;
+    o[1] = t1m2 + t1m2 + t3m4;
+    o[2] = t1p2 + t3p4 + t3p4;
+    o[3] = t1m2 + t3m4 + t3m4 + i5;
+}
+
+// The input tiles are V [alpha * alpha, C, batch * tiles].
+__kernel void transform_in(__global const float *in,
+                           __global float *V,
+                           const int C,
+                           const int board_size,
+                           const int batch_size) {
+    const int W = board_size;
+    const int H = board_size;
+    const int WTILES = (board_size + WINOGRAD_M - 1) / WINOGRAD_M;
+    const int P = WTILES * WTILES;
+    const int Ppad = batch_size * P;
+    const int spatial = W * H;
+
+    const int index = get_global_id(0);
+    const int block = index % Ppad;
+    const int ch = index / Ppad;
+    if (ch >= C) {
+        return;
+    }
+
+    const int batch = block / P;
+    const int block_x = (block - P * batch) % WTILES;
+    const int block_y = (block - P * batch) / WTILES;
+
+    // The 6x6 tiles overlap by 2.
+    const int yin = WINOGRAD_M * block_y - 1;
+    const int xin = WINOGRAD_M * block_x - 1;
+
+    float x[WINOGRAD_ALPHA][WINOGRAD_ALPHA];
+    for (int i = 0; i < WINOGRAD_ALPHA; i++) {
+        for (int j = 0; j < WINOGRAD_ALPHA; j++) {
+            const int a = xin + j;
+            const int b = yin + i;
+            // x is transposed here for better layout later
+            if (b >= 0 && a >= 0 && b < H && a < W) {
+                x[j][i] = in[batch * C * spatial + ch * spatial + b * W + a];
+            } else {
+                x[j][i] = 0.0f;
+            }
+        }
+    }
+
+    float T1[WINOGRAD_ALPHA][WINOGRAD_ALPHA];
+    float T2[WINOGRAD_ALPHA][WINOGRAD_ALPHA];
+    float o[WINOGRAD_ALPHA];
+
+    for (int j = 0; j < WINOGRAD_ALPHA; j++) {
+        multiply_bt(o, x[j][0], x[j][1], x[j][2], x[j][3], x[j][4], x[j][5]);
+        for (int i = 0; i < WINOGRAD_ALPHA; i++) {
+            T1[i][j] = o[i];
+        }
+    }
+    for (int i = 0; i < WINOGRAD_ALPHA; i++) {
+        multiply_bt(o, T1[i][0], T1[i][1], T1[i][2], T1[i][3], T1[i][4], T1[i][5]);
+        for (int j = 0; j < WINOGRAD_ALPHA; j++) {
+            T2[i][j] = o[j];
+        }
+    }
+
+    // Scatter each sub element in tile to separate matrices.
+    const int offset = ch * Ppad + block;
+    for (int i = 0; i < WINOGRAD_ALPHA; i++) {
+        for (int j = 0; j < WINOGRAD_ALPHA; j++) {
+            V[(i * WINOGRAD_ALPHA + j) * C * Ppad + offset] = T2[i][j];
+        }
+    }
+}
+
+// M[t, k, p] = sum_c U[t, c, k] * V[t, c, p] for the every tile element
+// t. Every work item computes MWI x NWI outputs in the registers.
+__kernel void sgemm_batched(__global const float *U,
+                            __global const float *V,
+                            __global float *M,
+                            const int K, const int C, const int P) {
+    const int k0 = get_global_id(0) * MWI;
+    const int p0 = get_global_id(1) * NWI;
+    const int t = get_global_id(2);
+    if (k0 >= K || p0 >= P) {
+        return;
+    }
+
+    U += t * C * K;
+    V += t * C * P;
+    M += t * K * P;
+
+    float acc[MWI][NWI];
+    for (int i = 0; i < MWI; ++i) {
+        for (int j = 0; j < NWI; ++j) {
+            acc[i][j] = 0.0f;
+        }
+    }
+
+    float a[MWI];
+    float b[NWI];
+    for (int c = 0; c < C; ++c) {
+        for (int i = 0; i < MWI; ++i) {
+            a[i] = k0 + i < K ? U[c * K + k0 + i] : 0.0f;
+        }
+        for (int j = 0; j < NWI; ++j) {
+            b[j] = p0 + j < P ? V[c * P + p0 + j] : 0.0f;
+        }
+        for (int i = 0; i < MWI; ++i) {
+            for (int j = 0; j < NWI; ++j) {
+                acc[i][j] = mad(a[i], b[j], acc[i][j]);
+            }
+        }
+    }
+
+    for (int i = 0; i < MWI; ++i) {
+        for (int j = 0; j < NWI; ++j) {
+            if (k0 + i < K && p0 + j < P) {
+                M[(k0 + i) * P + p0 + j] = acc[i][j];
+            }
+        }
+    }
+}
+
+// Transform the outputs back and apply the biases, the residual, the
+// mask and the ReLU in that order.
+__kernel void transform_out(__global const float *M,
+                            __global float *Y,
+                            __global const float *biases,
+                            __global const float *eltwise,
+                            __global const float *mask,
+                            const int relu,
+                            const int K,
+                            const int board_size,
+                            const int batch_size) {
+    const int W = board_size;
+    const int H = board_size;
+    const int WTILES = (board_size + WINOGRAD_M - 1) / WINOGRAD_M;
+    const int P = WTILES * WTILES;
+    const int Ppad = batch_size * P;
+    const int spatial = W * H;
+
+    const int index = get_global_id(0);
+    const int block = index % Ppad;
+    const int k = index / Ppad;
+    if (k >= K) {
+        return;
+    }
+
+    const int offset = k * Ppad + block;
+    float temp[WINOGRAD_M][WINOGRAD_ALPHA];
+    float r[WINOGRAD_M];
+
+    // Calculate transpose(A) . temp_m
+    for (int xn = 0; xn < WINOGRAD_ALPHA; xn++) {
+        multiply_atv(r,
+                     M[(0 * WINOGRAD_ALPHA + xn) * K * Ppad + offset],
+                     M[(1 * WINOGRAD_ALPHA + xn) * K * Ppad + offset],
+                     M[(2 * WINOGRAD_ALPHA + xn) * K * Ppad + offset],
+                     M[(3 * WINOGRAD_ALPHA + xn) * K * Ppad + offset],
+                     M[(4 * WINOGRAD_ALPHA + xn) * K * Ppad + offset],
+                     M[(5 * WINOGRAD_ALPHA + xn) * K * Ppad + offset]);
+        for (int i = 0; i < WINOGRAD_M; i++) {
+            temp[i][xn] = r[i];
+        }
+    }
+
+    const int batch = block / P;
+    const int block_x = (block - P * batch) % WTILES;
+    const int block_y = (block - P * batch) / WTILES;
+    const int x = WINOGRAD_M * block_x;
+    const int y = WINOGRAD_M * block_y;
+    const float bias = biases[k];
+
+    // Calculate temp . A
+    for (int i = 0; i < WINOGRAD_M; i++) {
+        multiply_atv(r, temp[i][0], temp[i][1], temp[i][2], temp[i][3], temp[i][4], temp[i][5]);
+
+        for (int j = 0; j < WINOGRAD_M; j++) {
+            if (y + i >= H || x + j >= W) {
+                continue;
+            }
+            const int s_index = (y + i) * W + (x + j);
+            const int out_idx = batch * K * spatial + k * spatial + s_index;
+
+            float el = r[j] + bias;
+            if (eltwise) {
+                el += eltwise[out_idx];
+            }
+            if (mask) {
+                el *= mask[batch * spatial + s_index];
+            }
+            if (relu && el < 0.0f) {
+                el = 0.0f;
+            }
+            Y[out_idx] = el;
+        }
+    }
+}
+
+// The 1x1 convolution with the biases, the mask and the ReLU. The
+// weights are [outputs, inputs].
+__kernel void convolution1(__global const float *in,
+                           __global float *out,
+                           __global const float *weights,
+                           __global const float *biases,
+                           __global const float *mask,
+                           const int relu,
+                           const int inputs,
+                           const int outputs,
+                           const int spatial) {
+    const int s = get_global_id(0);
+    const int o = get_global_id(1);
+    const int batch = get_global_id(2);
+    if (s >= spatial || o >= outputs) {
+        return;
+    }
+
+    in += batch * inputs * spatial + s;
+    weights += o * inputs;
+
+    float val = biases[o];
+    for (int c = 0; c < inputs; ++c) {
+        val = mad(weights[c], in[c * spatial], val);
+    }
+    if (mask) {
+        val *= mask[batch * spatial + s];
+    }
+    if (relu && val < 0.0f) {
+        val = 0.0f;
+    }
+    out[(batch * outputs + o) * spatial + s] = val;
+}
+
+// The global pooling of GlobalPooling. It is the mean, the mean scaled
+// by the board size and the max, or the mean scaled by the board size
+// variance for the value head. The sqrt_mask is the real board size of
+// every batch.
+__kernel void global_pooling(__global const float *in,
+                             __global float *out,
+                             __global const float *mask,
+                             __global const float *sqrt_mask,
+                             const int value_head,
+                             const int C,
+                             const int board_size) {
+    const int c = get_global_id(0);
+    const int n = get_global_id(1);
+    if (c >= C) {
+        return;
+    }
+
+    const int spatial = board_size * board_size;
+    __global const float *input_ptr = in + (n * C + c) * spatial;
+    const float vsqrt = sqrt_mask ? sqrt_mask[n] : (float)board_size;
+
+    float vsum = 0.0f;
+    float vmax = -5000.0f; // crazy negative value
+    for (int i = 0; i < spatial; ++i) {
+        const float val = input_ptr[i];
+        vsum += val;
+        if ((!mask || mask[n * spatial + i] != 0.0f) && val > vmax) {
+            vmax = val;
+        }
+    }
+
+    const float vmean = vsum / (vsqrt * vsqrt);
+    const float b_diff = vsqrt - 14.0f;
+    const int offset = c + n * 3 * C;
+
+    out[offset + 0 * C] = vmean;
+    out[offset + 1 * C] = vmean * b_diff * 0.1f;
+    out[offset + 2 * C] = value_head ? vmean * (b_diff * b_diff * 0.01f - 0.1f) : vmax;
+}
+
+// The fully connected layer. The weights are [outputs, inputs].
+__kernel void fully_connect(__global const float *in,
+                            __global float *out,
+                            __global const float *weights,
+                            __global const float *biases,
+                            const int relu,
+                            const int inputs,
+                            const int outputs) {
+    const int o = get_global_id(0);
+    const int n = get_global_id(1);
+    if (o >= outputs) {
+        return;
+    }
+
+    in += n * inputs;
+    weights += o * inputs;
+
+    float val = biases[o];
+    for (int i = 0; i < inputs; ++i) {
+        val = mad(weights[i], in[i], val);
+    }
+    if (relu && val < 0.0f) {
+        val = 0.0f;
+    }
+    out[n * outputs + o] = val;
+}
+
+// data = relu(sigmoid(gamma) * input + beta + data). The se_bias is
+// [batch, gamma and beta of C channels].
+__kernel void se_scale(__global const float *input,
+                       __global const float *se_bias,
+                       __global float *data,
+                       __global const float *mask,
+                       const int C,
+                       const int spatial) {
+    const int s = get_global_id(0);
+    const int c = get_global_id(1);
+    const int n = get_global_id(2);
+    if (s >= spatial || c >= C) {
+        return;
+    }
+
+    const int index = (n * C + c) * spatial + s;
+    const float gamma = 1.0f / (1.0f + exp(-se_bias[n * 2 * C + c]));
+    const float beta = se_bias[n * 2 * C + c + C];
+
+    float val = gamma * input[index] + beta + data[index];
+    if (val < 0.0f) {
+        val = 0.0f;
+    }
+    if (mask) {
+        val *= mask[n * spatial + s];
+    }
+    data[index] = val;
+}
+
+// Add the biases of every batch and channel to the spatial data.
+__kernel void add_spatial(__global float *data,
+                          __global const float *biases,
+                          __global const float *mask,
+                          const int C,
+                          const int spatial) {
+    const int s = get_global_id(0);
+    const int c = get_global_id(1);
+    const int n = get_global_id(2);
+    if (s >= spatial || c >= C) {
+        return;
+    }
+
+    const int index = (n * C + c) * spatial + s;
+    float val = data[index] + biases[n * C + c];
+    if (mask) {
+        val *= mask[n * spatial + s];
+    }
+    data[index] = val;
+}
+
+)CLC";
+
+#endif
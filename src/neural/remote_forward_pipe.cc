@@ -0,0 +1,299 @@
+#include "neural/remote_forward_pipe.h"
+#include "utils/log.h"
+#include "utils/format.h"
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+constexpr std::uint32_t RemoteForwardPipe::kMaxFrameEntries;
+
+RemoteForwardPipe::Hello RemoteForwardPipe::GetHello() {
+    auto hello = Hello{};
+    hello.magic = 0x53595249; // "SYRI"
+    hello.version = 2;
+    hello.input_size = sizeof(PackedInputData);
+    hello.output_size = sizeof(OutputResult);
+    return hello;
+}
+
+bool RemoteForwardPipe::MatchHello(const Hello &a, const Hello &b) {
+    return a.magic == b.magic &&
+               a.version == b.version &&
+               a.input_size == b.input_size &&
+               a.output_size == b.output_size;
+}
+
+PackedInputData RemoteForwardPipe::PackInputs(const InputData &input) {
+    auto packed = PackedInputData{};
+    packed.komi = input.komi;
+    packed.board_size = input.board_size;
+    packed.side_to_move = input.side_to_move;
+    packed.need_ownership = input.need_ownership;
+    packed.need_value = input.need_value;
+
+    const int num_intersections = input.board_size * input.board_size;
+    int binary_plane = 0;
+
+    for (int c = 0; c < kInputChannels; ++c) {
+        const auto plane = std::begin(input.planes) + c * num_intersections;
+
+        if (c >= PackedInputData::kScalarBegin &&
+                c < PackedInputData::kScalarBegin + PackedInputData::kScalarPlanes) {
+            packed.scalars[c - PackedInputData::kScalarBegin] = plane[0];
+            continue;
+        }
+
+        auto words = packed.bits.data() + binary_plane * PackedInputData::kWordsPerPlane;
+        for (int idx = 0; idx < num_intersections; ++idx) {
+            if (plane[idx] != 0.f) {
+                words[idx / 64] |= std::uint64_t{1} << (idx % 64);
+            }
+        }
+        ++binary_plane;
+    }
+    return packed;
+}
+
+InputData RemoteForwardPipe::UnpackInputs(const PackedInputData &packed) {
+    auto input = InputData{};
+    input.komi = packed.komi;
+    input.board_size = packed.board_size;
+    input.side_to_move = packed.side_to_move;
+    input.need_ownership = packed.need_ownership;
+    input.need_value = packed.need_value;
+
+    const int num_intersections = packed.board_size * packed.board_size;
+    int binary_plane = 0;
+
+    for (int c = 0; c < kInputChannels; ++c) {
+        const auto plane = std::begin(input.planes) + c * num_intersections;
+
+        if (c >= PackedInputData::kScalarBegin &&
+                c < PackedInputData::kScalarBegin + PackedInputData::kScalarPlanes) {
+            std::fill(plane, plane + num_intersections,
+                          packed.scalars[c - PackedInputData::kScalarBegin]);
+            continue;
+        }
+
+        const auto words = packed.bits.data() + binary_plane * PackedInputData::kWordsPerPlane;
+        for (int idx = 0; idx < num_intersections; ++idx) {
+            if ((words[idx / 64] >> (idx % 64)) & 1) {
+                plane[idx] = 1.f;
+            }
+        }
+        ++binary_plane;
+    }
+    return input;
+}
+
+void RemoteForwardPipe::Initialize(std::shared_ptr<DNNWeights>) {
+    const auto address = GetOption<std::string>("remote_server");
+    if (!SplitAddress(address, host_, port_)) {
+        LOGGING << Format("The remote server address %s is not host:port.\n", address.c_str());
+        return;
+    }
+    valid_.store(true);
+    running_ = true;
+    worker_ = std::thread([this]() { Worker(); });
+}
+
+OutputResult RemoteForwardPipe::Forward(const InputData &inpnt) {
+    return ForwardAsync(inpnt).get();
+}
+
+std::future<OutputResult> RemoteForwardPipe::ForwardAsync(const InputData &inpnt) {
+    auto entry = std::make_shared<ForwardEntry>();
+    entry->input = PackInputs(inpnt);
+    auto future = entry->promise.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            entry->promise.set_value(OutputResult{});
+            return future;
+        }
+        pending_.emplace_back(entry);
+    }
+    cv_.notify_all();
+    return future;
+}
+
+bool RemoteForwardPipe::Handshake(Socket &socket) {
+    const auto hello = GetHello();
+    auto server_hello = Hello{};
+
+    if (!socket.SendAll(&hello, sizeof(hello)) ||
+            !socket.RecvAll(&server_hello, sizeof(server_hello))) {
+        return false;
+    }
+    if (!MatchHello(hello, server_hello)) {
+        LOGGING << Format("The inference server %s:%d is not compatible. Check the BOARD_SIZE of both.\n",
+                              host_.c_str(), port_);
+        valid_.store(false);
+        return false;
+    }
+    return true;
+}
+
+void RemoteForwardPipe::Worker() {
+    int backoff_ms = 100;
+    bool connected_before = false;
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!running_) {
+                break;
+            }
+        }
+
+        auto socket = Socket{};
+        if (!socket.Connect(host_, port_) || !Handshake(socket)) {
+            if (!valid_.load()) {
+                break;
+            }
+            // Wait for the server.
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait_for(lock, std::chrono::milliseconds(backoff_ms),
+                             [this]() { return !running_; });
+            backoff_ms = std::min(2 * backoff_ms, 5000);
+            continue;
+        }
+        if (connected_before) {
+            reconnects_.fetch_add(1, std::memory_order_relaxed);
+            LOGGING << Format("Reconnected to the inference server %s:%d.\n", host_.c_str(), port_);
+        }
+        connected_before = true;
+        backoff_ms = 100;
+
+        bool broken = false;
+        auto receiver = std::thread([this, &socket, &broken]() { Receiver(socket, broken); });
+        auto buffer = std::vector<char>{};
+
+        while (true) {
+            std::uint32_t count = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this, &broken]() {
+                                   return !running_ || broken || !pending_.empty(); });
+                if (!running_ || broken) {
+                    break;
+                }
+
+                // Send all queued entries in one frame.
+                count = std::min((std::uint32_t)pending_.size(), kMaxFrameEntries);
+                buffer.resize(sizeof(count) + count * sizeof(PackedInputData));
+                std::copy((const char*)&count, (const char*)&count + sizeof(count), buffer.data());
+                for (std::uint32_t i = 0; i < count; ++i) {
+                    auto &entry = pending_.front();
+                    std::copy((const char*)&entry->input,
+                                  (const char*)&entry->input + sizeof(PackedInputData),
+                                  buffer.data() + sizeof(count) + i * sizeof(PackedInputData));
+                    inflight_.emplace_back(entry);
+                    pending_.pop_front();
+                }
+            }
+            if (!socket.SendAll(buffer.data(), buffer.size())) {
+                break;
+            }
+            frames_.fetch_add(1, std::memory_order_relaxed);
+            entries_.fetch_add(count, std::memory_order_relaxed);
+        }
+
+        // Stop the receiver.
+        socket.Shutdown();
+        receiver.join();
+
+        {
+            // Send the unanswered entries again after reconnecting.
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_.insert(std::begin(pending_), std::begin(inflight_), std::end(inflight_));
+            inflight_.clear();
+        }
+    }
+
+    // No one computes the remaining entries. Give them the empty
+    // results so that the search threads do not wait forever.
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &entry : pending_) {
+        entry->promise.set_value(OutputResult{});
+    }
+    pending_.clear();
+    running_ = false;
+}
+
+void RemoteForwardPipe::Receiver(Socket &socket, bool &broken) {
+    auto results = std::vector<OutputResult>{};
+
+    while (true) {
+        std::uint32_t count;
+        if (!socket.RecvAll(&count, sizeof(count)) || count > kMaxFrameEntries) {
+            break;
+        }
+        results.resize(count);
+        if (!socket.RecvAll(results.data(), count * sizeof(OutputResult))) {
+            break;
+        }
+
+        bool error = false;
+        for (std::uint32_t i = 0; i < count; ++i) {
+            auto entry = EntryPtr{};
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (inflight_.empty()) {
+                    error = true;
+                    break;
+                }
+                entry = inflight_.front();
+                inflight_.pop_front();
+            }
+            entry->promise.set_value(results[i]);
+        }
+        if (error) {
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        broken = true;
+    }
+    cv_.notify_all();
+}
+
+std::string RemoteForwardPipe::GetStatsString() {
+    const auto frames = frames_.load(std::memory_order_relaxed);
+    const auto entries = entries_.load(std::memory_order_relaxed);
+
+    return Format("Remote Server: %s:%d, Frames: %lld, Entries: %lld, Average: %.2f, Reconnects: %lld\n",
+                      host_.c_str(), port_, (long long)frames, (long long)entries,
+                      frames == 0 ? 0.f : (float)entries / frames,
+                      (long long)reconnects_.load(std::memory_order_relaxed));
+}
+
+bool RemoteForwardPipe::Valid() {
+    return valid_.load();
+}
+
+void RemoteForwardPipe::Load(std::shared_ptr<DNNWeights>) {
+    // The server owns the weights.
+}
+
+void RemoteForwardPipe::Reload(int) {
+    // The board size comes with every input.
+}
+
+void RemoteForwardPipe::Release() {}
+
+void RemoteForwardPipe::Destroy() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
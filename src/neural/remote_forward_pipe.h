@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "neural/network_basic.h"
+#include "neural/description.h"
+#include "utils/socket.h"
+
+// Send the inputs to the inference server and wait for the results.
+// The queued inputs are sent as one frame, and the next frames are
+// sent before the results of the last ones come back. The server
+// answers the frames in order. If the connection is broken, the pipe
+// reconnects and sends the unanswered inputs again. The server and the
+// clients must be built with the same BOARD_SIZE.
+class RemoteForwardPipe : public NetworkForwardPipe {
+public:
+    // The first message of both sides. They must be the same.
+    struct Hello {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t input_size;
+        std::uint32_t output_size;
+    };
+
+    static constexpr std::uint32_t kMaxFrameEntries = 256;
+
+    static Hello GetHello();
+    static bool MatchHello(const Hello &a, const Hello &b);
+
+    // Pack the planes in the order of their own board size.
+    static PackedInputData PackInputs(const InputData &input);
+    static InputData UnpackInputs(const PackedInputData &packed);
+
+    virtual void Initialize(std::shared_ptr<DNNWeights> weights);
+
+    virtual OutputResult Forward(const InputData &inpnt);
+
+    virtual std::future<OutputResult> ForwardAsync(const InputData &inpnt);
+
+    virtual std::string GetStatsString();
+
+    virtual bool Valid();
+
+    virtual void Load(std::shared_ptr<DNNWeights> weights);
+
+    virtual void Reload(int);
+
+    virtual void Release();
+
+    virtual void Destroy();
+
+private:
+    struct ForwardEntry {
+        PackedInputData input;
+        std::promise<OutputResult> promise;
+    };
+
+    using EntryPtr = std::shared_ptr<ForwardEntry>;
+
+    // Connect to the server, then send the frames until the
+    // connection is broken.
+    void Worker();
+
+    // Receive the results of sent entries.
+    void Receiver(Socket &socket, bool &broken);
+
+    bool Handshake(Socket &socket);
+
+    std::string host_;
+    int port_{0};
+
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    // The entries waiting for sending and the sent entries waiting
+    // for the results.
+    std::deque<EntryPtr> pending_;
+    std::deque<EntryPtr> inflight_;
+
+    bool running_{false};
+    std::atomic<bool> valid_{false};
+
+    std::atomic<std::int64_t> frames_{0};
+    std::atomic<std::int64_t> entries_{0};
+    std::atomic<std::int64_t> reconnects_{0};
+};
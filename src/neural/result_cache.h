@@ -0,0 +1,138 @@
+#pragma once
+
+#include "game/types.h"
+#include "utils/cache.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+// The compact network result of the boards up to N intersections. The
+// policy logits and the ownership are half precision floats. The
+// logits are stored as the offsets from the max logit to keep the
+// precision of the best moves.
+template<int N>
+struct CompactResultOf {
+    std::int16_t board_size;
+    float komi;
+    float max_logit;
+
+    float pass_logit;
+    float wdl_winrate;
+    float stm_winrate;
+    float final_score;
+
+    std::array<float, 3> wdl;
+    std::array<std::uint16_t, N> logits;
+    std::array<std::uint16_t, N> ownership;
+};
+
+// The boards up to this size are stored in the small entries.
+static constexpr int kSmallBoardSize = kBoardSize < 9 ? kBoardSize : 9;
+
+// The cache of the compact results with two entry sizes in the same
+// binary. The small mode only keeps the results of the small boards,
+// so a 9x9 game fits about four times more results into the memory
+// of a 19x19 build, and its clusters are much more likely to be in
+// the CPU cache. The results of the larger boards are not stored in
+// the small mode. The mode is chosen with the capacity, so change it
+// only when nobody searches.
+class ResultCache {
+public:
+    using Result = CompactResultOf<kNumIntersections>;
+    using SmallResult = CompactResultOf<kSmallBoardSize * kSmallBoardSize>;
+
+    // Return true if the boards up to this size use the small
+    // entries.
+    static bool UseSmall(int board_size) {
+        return board_size > 0 &&
+                   board_size <= kSmallBoardSize &&
+                   kSmallBoardSize < kBoardSize;
+    }
+
+    void SetCapacity(size_t size, bool small) {
+        small_ = small;
+        large_.SetCapacity(small_ ? 0 : size);
+        small_cache_.SetCapacity(small_ ? size : 0);
+    }
+
+    void Insert(std::uint64_t key, const Result &value, int weight = 0) {
+        if (!small_) {
+            large_.Insert(key, value, weight);
+        } else if (value.board_size <= kSmallBoardSize) {
+            auto small = SmallResult{};
+            Copy(value, small);
+            small_cache_.Insert(key, small, weight);
+        }
+    }
+
+    bool Lookup(std::uint64_t key, Result &value) {
+        if (!small_) {
+            return large_.Lookup(key, value);
+        }
+        auto small = SmallResult{};
+        if (!small_cache_.Lookup(key, small)) {
+            return false;
+        }
+        Copy(small, value);
+        return true;
+    }
+
+    void Prefetch(std::uint64_t key) {
+        if (small_) {
+            small_cache_.Prefetch(key);
+        } else {
+            large_.Prefetch(key);
+        }
+    }
+
+    void Clear() {
+        large_.Clear();
+        small_cache_.Clear();
+    }
+
+    bool IsSmall() const { return small_; }
+
+    size_t GetEntrySize() const {
+        return GetEntrySize(small_);
+    }
+
+    static size_t GetEntrySize(bool small) {
+        return small ? HashKeyCache<SmallResult>::GetEntrySize() :
+                           HashKeyCache<Result>::GetEntrySize();
+    }
+
+    size_t GetCapacity() const {
+        return small_ ? small_cache_.GetCapacity() : large_.GetCapacity();
+    }
+
+    size_t GetNumUsed() {
+        return small_ ? small_cache_.GetNumUsed() : large_.GetNumUsed();
+    }
+
+    size_t GetPageSize() {
+        return small_ ? small_cache_.GetPageSize() : large_.GetPageSize();
+    }
+
+private:
+    // Only copy the intersections of the board.
+    template<typename From, typename To>
+    static void Copy(const From &from, To &to) {
+        const int num_intersections = from.board_size * from.board_size;
+
+        to.board_size = from.board_size;
+        to.komi = from.komi;
+        to.max_logit = from.max_logit;
+        to.pass_logit = from.pass_logit;
+        to.wdl_winrate = from.wdl_winrate;
+        to.stm_winrate = from.stm_winrate;
+        to.final_score = from.final_score;
+        to.wdl = from.wdl;
+        std::copy_n(std::begin(from.logits), num_intersections, std::begin(to.logits));
+        std::copy_n(std::begin(from.ownership), num_intersections, std::begin(to.ownership));
+    }
+
+    bool small_{false};
+    HashKeyCache<Result> large_;
+    HashKeyCache<SmallResult> small_cache_;
+};
@@ -2,6 +2,7 @@
 #include "game/sgf.h"
 #include "game/types.h"
 #include "game/iterator.h"
+#include "game/symmetry.h"
 #include "neural/supervised.h"
 #include "neural/encoder.h"
 #include "utils/log.h"
@@ -16,6 +17,7 @@
 #include <fstream>
 #include <cassert>
 #include <cmath>
+#include <cstdio>
 #include <thread>
 
 Supervised &Supervised::Get() {
@@ -26,18 +28,30 @@ Supervised &Supervised::Get() {
 void Supervised::FromSgfs(bool general,
                               std::string sgf_name,
                               std::string out_name_prefix) {
+    // Resume from the last checkpoint if there is.
+    progress_name_ = out_name_prefix + ".progress";
+    progress_ = Progress{};
+    finished_offsets_.clear();
+
+    if (LoadProgress(progress_name_, progress_)) {
+        LOGGING << Format("[%s] Resume from the game %zu, the file offset is %zu.\n",
+                              CurrentDateTime().c_str(), progress_.games, progress_.offset);
+    }
+
     // Init all status.
-    file_cnt_.store(0, std::memory_order_relaxed);
+    file_cnt_.store(progress_.files, std::memory_order_relaxed);
     worker_cnt_.store(0, std::memory_order_relaxed);
     tot_games_.store(0, std::memory_order_relaxed);
     running_threads_.store(0, std::memory_order_relaxed);
     running_.store(true, std::memory_order_relaxed);
 
-    auto sgfs = SgfParser::Get().ChopAll(sgf_name);
+    auto threads = GetOption<int>("threads");
+    tasks_ = std::make_unique<MpmcQueue<Task>>(threads * 4);
 
     auto Worker = [this, general, out_name_prefix]() -> void {
         int games = 0;
         auto chunk = std::vector<Training>{};
+        auto chunk_tasks = std::vector<Task>{};
 
         running_threads_.fetch_add(1, std::memory_order_relaxed);
         int worker_cnt = worker_cnt_.fetch_add(1, std::memory_order_relaxed);
@@ -46,22 +60,14 @@ void Supervised::FromSgfs(bool general,
                               CurrentDateTime().c_str(), worker_cnt+1);
 
         while (true) {
-            if (!running_.load(std::memory_order_relaxed) && tasks_.empty()) {
-                break;
-            }
-
             // Get the SGF string from the queue.
-            auto sgf = std::string{};
+            auto task = Task{};
 
-            {
-                std::lock_guard<std::mutex> lk(mtx_);
-                if (!tasks_.empty()) {
-                    sgf = tasks_.front();
-                    tasks_.pop();
+            if (!tasks_->TryPop(task)) {
+                if (!running_.load(std::memory_order_acquire)) {
+                    // The reader is done and the queue is empty.
+                    break;
                 }
-            }
-
-            if (sgf.empty()) {
                 // Fail to get the SGF string from the queue.
                 std::this_thread::yield();
                 continue;
@@ -72,10 +78,12 @@ void Supervised::FromSgfs(bool general,
             // Parse the SGF string.
             bool success = false;
             if (general) {
-                success = GeneralSgfProcess(sgf, chunk);
+                success = GeneralSgfProcess(task.sgf, chunk);
             } else {
-                success = SgfProcess(sgf, chunk);
+                success = SgfProcess(task.sgf, chunk);
             }
+            task.sgf.clear();
+            chunk_tasks.emplace_back(std::move(task));
 
             if (success) {
                 games += 1;
@@ -85,6 +93,7 @@ void Supervised::FromSgfs(bool general,
                     if (!SaveChunk(out_name_prefix, chunk)) {
                         break;
                     }
+                    FinishTasks(chunk_tasks);
 
                     LOGGING << Format("[%s] Thread %d parsed %d games, totally parsed %d games.\n",
                                           CurrentDateTime().c_str(),
@@ -96,7 +105,11 @@ void Supervised::FromSgfs(bool general,
 
         // Save the remaining training data.
         if (!chunk.empty()) {
-            SaveChunk(out_name_prefix, chunk);
+            if (SaveChunk(out_name_prefix, chunk)) {
+                FinishTasks(chunk_tasks);
+            }
+        } else {
+            FinishTasks(chunk_tasks);
         }
 
         running_threads_.fetch_sub(1, std::memory_order_relaxed);
@@ -106,61 +119,127 @@ void Supervised::FromSgfs(bool general,
                          );
     };
 
-    auto threads = GetOption<int>("threads");
     auto group =  ThreadGroup<void>(&ThreadPool::Get(threads));
 
     for (int t = 0; t < threads; ++t) {
         group.AddTask(Worker);
     }
 
-    while (!sgfs.empty()) {
-        auto sgf = sgfs.back();
-        {
-            std::lock_guard<std::mutex> lk(mtx_);
-            if ((int)tasks_.size() <= threads * 4) {
-                tasks_.push(sgf);
-                sgfs.pop_back();
-            } else {
-                std::this_thread::yield();
-            }
-            if (running_threads_.load(std::memory_order_relaxed) < 0) {
-                // Can not open the storage file, stop running.
-                break;
-            }
-        }
+    // The reader scans the memory mapped file and feeds the
+    // workers through the bounded queue.
+    auto index = progress_.games;
+    try {
+        SgfParser::Get().ChopFile(sgf_name, progress_.offset,
+            [&](std::string &sgf, size_t end_offset) {
+                auto task = Task{std::move(sgf), index++, end_offset};
+                while (!tasks_->TryPush(task)) {
+                    if (running_threads_.load(std::memory_order_relaxed) < 0) {
+                        // Can not open the storage file, stop running.
+                        return false;
+                    }
+                    std::this_thread::yield();
+                }
+                return running_threads_.load(std::memory_order_relaxed) >= 0;
+            });
+    } catch (const char *err) {
+        LOGGING << Format("Fail to read the SGF file %s. Cause: %s.\n",
+                              sgf_name.c_str(), err);
     }
 
-    running_.store(false, std::memory_order_relaxed);
+    running_.store(false, std::memory_order_release);
     group.WaitToJoin();
 }
 
+bool Supervised::LoadProgress(std::string filename, Progress &progress) const {
+    auto file = std::ifstream{};
+    file.open(filename);
+    if (!file.is_open()) {
+        return false;
+    }
+    auto p = Progress{};
+    if (!(file >> p.offset >> p.games >> p.files)) {
+        return false;
+    }
+    progress = p;
+    return true;
+}
+
+void Supervised::SaveProgress(std::string filename, Progress &progress) const {
+    // Write the temporary file first, so the checkpoint is never
+    // broken if the program stops.
+    const auto temp_name = filename + ".tmp";
+    auto file = std::ofstream{};
+    file.open(temp_name);
+    if (!file.is_open()) {
+        return;
+    }
+    file << progress.offset << ' '
+             << progress.games << ' '
+             << progress.files << std::endl;
+    file.close();
+    std::rename(temp_name.c_str(), filename.c_str());
+}
+
+void Supervised::FinishTasks(std::vector<Task> &tasks) {
+    std::lock_guard<std::mutex> lk(progress_mtx_);
+
+    for (auto &task : tasks) {
+        finished_offsets_.emplace(task.index, task.end_offset);
+    }
+    tasks.clear();
+
+    bool advanced = false;
+    auto it = finished_offsets_.begin();
+    while (it != finished_offsets_.end() && it->first == progress_.games) {
+        progress_.offset = it->second;
+        progress_.games += 1;
+        it = finished_offsets_.erase(it);
+        advanced = true;
+    }
+
+    if (advanced) {
+        // The chunks of the later games may be saved too. They are
+        // parsed again after resuming, so keep their file names.
+        progress_.files = file_cnt_.load(std::memory_order_relaxed);
+        SaveProgress(progress_name_, progress_);
+    }
+}
+
 bool Supervised::SaveChunk(std::string out_name_prefix,
                                std::vector<Training> &chunk) {
-    auto out_name = Format("%s_%d.txt", 
+    const auto binary = GetOption<bool>("binary_chunk");
+    auto out_name = Format("%s_%d.%s", 
                                out_name_prefix.c_str(),
-                               file_cnt_.fetch_add(1));
+                               file_cnt_.fetch_add(1),
+                               binary ? "bin" : "txt");
 
-    auto oss = std::ostringstream{};
-    for (auto &data : chunk) {
-        data.StreamOut(oss);
-    }
+    const auto WriteChunk = [&](std::ostream &out) {
+        for (auto &data : chunk) {
+            if (binary) {
+                data.BinaryStreamOut(out);
+            } else {
+                data.StreamOut(out);
+            }
+        }
+    };
 
     bool is_open = true;
 
     try {
-        auto buf = oss.str();
-        SaveGzip(out_name, buf);
+        // Compress the records while writing them.
+        GzipOutputStream out(out_name);
+        WriteChunk(out);
+        out.Close();
     } catch (const char *err) {
         auto file = std::ofstream{};
-        file.open(out_name, std::ios_base::app);
+        file.open(out_name, binary ? std::ios_base::app | std::ios_base::binary
+                                   : std::ios_base::app);
         if (!file.is_open()) {
             LOGGING << "Fail to create the file: " << out_name << '!' << std::endl; 
             running_threads_.store(-1, std::memory_order_relaxed);
             is_open = false;
         } else {
-            for (auto &data : chunk) {
-                data.StreamOut(file);
-            }
+            WriteChunk(file);
             file.close();
         }
     }
@@ -213,6 +292,8 @@ bool Supervised::GeneralSgfProcess(std::string &sgfstring,
     // Remove the double pass moves in the middle.
     game_ite.RemoveUnusedDoublePass();
 
+    const auto write_symmetry = GetOption<bool>("write_symmetry");
+
     do {
         auto vtx = game_ite.GetVertex();
         auto aux_vtx = game_ite.GetNextVertex();
@@ -253,6 +334,9 @@ bool Supervised::GeneralSgfProcess(std::string &sgfstring,
             buf.final_score = zero_final_score;
         }
 
+        if (write_symmetry) {
+            buf.ApplySymmetry(Random<>::Get().RandFix<Symmetry::kNumSymmetris>());
+        }
         chunk.emplace_back(buf);
     } while (game_ite.Next());
 
@@ -330,6 +414,8 @@ bool Supervised::SgfProcess(std::string &sgfstring,
     // Remove the double pass moves in the middle.
     game_ite.RemoveUnusedDoublePass();
 
+    const auto write_symmetry = GetOption<bool>("write_symmetry");
+
     do {
         auto vtx = game_ite.GetVertex();
         auto aux_vtx = game_ite.GetNextVertex();
@@ -374,6 +460,9 @@ bool Supervised::SgfProcess(std::string &sgfstring,
             buf.final_score = buf.side_to_move == kBlack ? black_final_score : -black_final_score;
         }
 
+        if (write_symmetry) {
+            buf.ApplySymmetry(Random<>::Get().RandFix<Symmetry::kNumSymmetris>());
+        }
         chunk.emplace_back(buf);
     } while (game_ite.Next());
 
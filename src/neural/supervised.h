@@ -3,11 +3,13 @@
 #include <fstream>
 #include <vector>
 #include <string>
-#include <queue>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <atomic>
 
 #include "neural/training.h"
+#include "utils/mpmc_queue.h"
 
 class Supervised {
 public:
@@ -32,8 +34,38 @@ private:
     bool SaveChunk(std::string out_name_prefix,
                        std::vector<Training> &chunk);
 
-    std::queue<std::string> tasks_;
-    std::mutex mtx_;
+    struct Task {
+        std::string sgf;
+
+        // The game index in the SGF file.
+        size_t index;
+
+        // The file offset after this game.
+        size_t end_offset;
+    };
+
+    // The progress is saved in the checkpoint file. The games before
+    // the offset are already in the saved chunks, so the next run can
+    // resume from it.
+    struct Progress {
+        size_t offset{0};
+        size_t games{0};
+        int files{0};
+    };
+
+    bool LoadProgress(std::string filename, Progress &progress) const;
+    void SaveProgress(std::string filename, Progress &progress) const;
+
+    // Mark the games done after their chunk is saved. Advance the
+    // checkpoint over the continuous done games.
+    void FinishTasks(std::vector<Task> &tasks);
+
+    std::unique_ptr<MpmcQueue<Task>> tasks_;
+
+    std::mutex progress_mtx_;
+    std::string progress_name_;
+    Progress progress_;
+    std::map<size_t, size_t> finished_offsets_;
 
     std::atomic<int> tot_games_;
     std::atomic<int> file_cnt_;
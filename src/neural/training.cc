@@ -1,6 +1,16 @@
 #include "game/types.h"
+#include "game/symmetry.h"
 #include "neural/training.h"
 #include "neural/network_basic.h"
+#include "utils/half.h"
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+constexpr int Training::kFullSearchMode;
+constexpr int Training::kFastSearchMode;
 
 void ArrayStreamOut(std::ostream &out, const std::vector<float> &arr) {
     const auto size = arr.size();
@@ -8,7 +18,7 @@ void ArrayStreamOut(std::ostream &out, const std::vector<float> &arr) {
         out << arr[i];
         if (i != size-1) out << ' ';
     }
-    out << std::endl;
+    out << '\n';
 }
 
 void OwnershipStreamOut(std::ostream &out, const std::vector<int> &arr) {
@@ -23,7 +33,7 @@ void OwnershipStreamOut(std::ostream &out, const std::vector<int> &arr) {
             out << (1 + 2);
         }
     }
-    out << std::endl;
+    out << '\n';
 }
 
 void PlanesStreamOut(std::ostream &out, const std::vector<float> &arr, size_t planes) {
@@ -51,36 +61,232 @@ void PlanesStreamOut(std::ostream &out, const std::vector<float> &arr, size_t pl
             out << (bool)arr[spatial * (p+1) - 1];
         }
 
-        out << std::dec << std::endl;
+        out << std::dec << '\n';
     }
 }
 
 void Training::StreamOut(std::ostream &out) const {
-    out << version << std::endl;
-    out << mode << std::endl;
-    out << board_size << std::endl;
-    out << komi << std::endl;
+    out << version << '\n';
+    out << mode << '\n';
+    out << board_size << '\n';
+    out << komi << '\n';
 
     PlanesStreamOut(out, planes, kInputChannels);
-    out << (side_to_move == kBlack ? 1 : 0) << std::endl;
+    out << (side_to_move == kBlack ? 1 : 0) << '\n';
 
     if (probabilities_index == -1) {
         ArrayStreamOut(out, probabilities);
     } else {
-        out << probabilities_index << std::endl;
+        out << probabilities_index << '\n';
     }
 
     if (auxiliary_probabilities_index == -1) {
         ArrayStreamOut(out, auxiliary_probabilities);
     } else {
-        out << auxiliary_probabilities_index << std::endl;
+        out << auxiliary_probabilities_index << '\n';
     }
 
     OwnershipStreamOut(out, ownership);
 
-    out << result << std::endl;
-    out << q_value << std::endl;
-    out << final_score << std::endl;
+    out << result << '\n';
+    out << q_value << '\n';
+    out << final_score << '\n';
+}
+
+static bool ProbabilitiesStreamIn(const std::string &line, const size_t size,
+                                  std::vector<float> &arr, int &index) {
+    auto iss = std::istringstream{line};
+    arr.clear();
+
+    float v;
+    while (iss >> v) {
+        arr.emplace_back(v);
+    }
+    if (arr.size() == 1) {
+        // Only the index of the best move is stored.
+        index = (int)arr[0];
+        arr.assign(size, 0.f);
+        if (index < 0 || index >= (int)size) {
+            return false;
+        }
+        arr[index] = 1.f;
+        return true;
+    }
+    index = -1;
+    return arr.size() == size;
+}
+
+bool Training::StreamIn(std::istream &in) {
+    constexpr int kDataLines = 45;
+    auto lines = std::vector<std::string>(kDataLines);
+    for (auto &line : lines) {
+        if (!std::getline(in, line)) {
+            return false;
+        }
+    }
+
+    try {
+        version = std::stoi(lines[0]);
+        mode = std::stoi(lines[1]);
+        board_size = std::stoi(lines[2]);
+        komi = std::stof(lines[3]);
+    } catch (const std::exception &) {
+        return false;
+    }
+    if (board_size <= 0 || board_size > kBoardSize) {
+        return false;
+    }
+
+    const size_t num_intersections = board_size * board_size;
+    const size_t hex_size = num_intersections / 4;
+
+    planes.assign(kInputChannels * num_intersections, 0.f);
+    for (size_t p = 0; p < kInputChannels - 4; ++p) {
+        const auto &line = lines[4 + p];
+        if (line.size() < hex_size + (num_intersections % 4 != 0)) {
+            return false;
+        }
+        auto plane = std::begin(planes) + p * num_intersections;
+        for (size_t i = 0; i < hex_size; ++i) {
+            const auto c = line[i];
+            const int hex = c >= 'a' ? c - 'a' + 10 : c - '0';
+            for (int b = 0; b < 4; ++b) {
+                plane[4 * i + b] = (hex >> b) & 1;
+            }
+        }
+        if (num_intersections % 4 != 0) {
+            plane[num_intersections - 1] = line[hex_size] == '1';
+        }
+    }
+    side_to_move = lines[38] == "1" ? kBlack : kWhite;
+
+    if (!ProbabilitiesStreamIn(lines[39], num_intersections+1,
+                               probabilities, probabilities_index) ||
+            !ProbabilitiesStreamIn(lines[40], num_intersections+1,
+                                   auxiliary_probabilities, auxiliary_probabilities_index)) {
+        return false;
+    }
+
+    const auto &owner = lines[41];
+    if (owner.size() < num_intersections) {
+        return false;
+    }
+    ownership.resize(num_intersections);
+    for (size_t idx = 0; idx < num_intersections; ++idx) {
+        const auto v = owner[idx];
+        ownership[idx] = v == '1' ? 1 : (v == '3' ? -1 : 0);
+    }
+
+    try {
+        result = std::stoi(lines[42]);
+        q_value = std::stof(lines[43]);
+        final_score = std::stof(lines[44]);
+    } catch (const std::exception &) {
+        return false;
+    }
+    return true;
+}
+
+void Training::ApplySymmetry(int symm) {
+    if (symm == Symmetry::kIdentitySymmetry) {
+        symmetry = symm;
+        return;
+    }
+    const int num_intersections = board_size * board_size;
+
+    const auto transform = [&](auto &arr, const int offset) {
+        auto buf = std::vector<typename std::decay<decltype(arr)>::type::value_type>(
+                       std::begin(arr) + offset, std::begin(arr) + offset + num_intersections);
+        for (int idx = 0; idx < num_intersections; ++idx) {
+            const auto symm_idx = Symmetry::Get().TransformIndex(board_size, symm, idx);
+            arr[offset + symm_idx] = buf[idx];
+        }
+    };
+    const auto transform_index = [&](int &index) {
+        if (index >= 0 && index < num_intersections) {
+            index = Symmetry::Get().TransformIndex(board_size, symm, index);
+        }
+    };
+
+    for (int p = 0; p < kInputChannels; ++p) {
+        transform(planes, p * num_intersections);
+    }
+    transform(probabilities, 0);
+    transform(auxiliary_probabilities, 0);
+    transform(ownership, 0);
+    transform_index(probabilities_index);
+    transform_index(auxiliary_probabilities_index);
+
+    symmetry = symm;
+}
+
+void BinaryPutFloat(std::string &buf, float v) {
+    std::uint32_t x;
+    std::memcpy(&x, &v, sizeof(x));
+    for (int i = 0; i < 4; ++i) {
+        buf.push_back((char)((x >> (8 * i)) & 0xff));
+    }
+}
+
+void BinaryPutProbabilities(std::string &buf, const std::vector<float> &arr,
+                                const int index, const size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        float v;
+        if (index == -1) {
+            v = arr[i];
+        } else {
+            v = (int)i == index ? 1.f : 0.f;
+        }
+        const auto h = Half::FromFloat(v);
+        buf.push_back((char)(h & 0xff));
+        buf.push_back((char)(h >> 8));
+    }
+}
+
+void Training::BinaryStreamOut(std::ostream &out) const {
+    const size_t num_intersections = board_size * board_size;
+    const size_t plane_bytes = (num_intersections + 7) / 8;
+    const size_t binary_planes = kInputChannels - 4;
+
+    auto buf = std::string{};
+    buf.reserve(24 + binary_planes * plane_bytes +
+                    4 * (num_intersections + 1) + num_intersections);
+
+    // header
+    buf.append("SYBC", 4);
+    buf.push_back((char)GetBinaryChunkVersion());
+    buf.push_back((char)version);
+    buf.push_back((char)mode);
+    buf.push_back((char)board_size);
+    buf.push_back((char)(side_to_move == kBlack ? 1 : 0));
+    buf.push_back((char)result);
+    buf.push_back((char)(symmetry + 1));
+    buf.push_back('\0');
+    BinaryPutFloat(buf, komi);
+    BinaryPutFloat(buf, q_value);
+    BinaryPutFloat(buf, final_score);
+
+    // Last four channels are not binary features.
+    for (size_t p = 0; p < binary_planes; ++p) {
+        const auto offset = buf.size();
+        buf.append(plane_bytes, '\0');
+        for (size_t idx = 0; idx < num_intersections; ++idx) {
+            if ((int)planes[idx + num_intersections * p]) {
+                buf[offset + idx / 8] |= (char)(1 << (idx % 8));
+            }
+        }
+    }
+
+    BinaryPutProbabilities(buf, probabilities,
+                               probabilities_index, num_intersections+1);
+    BinaryPutProbabilities(buf, auxiliary_probabilities,
+                               auxiliary_probabilities_index, num_intersections+1);
+
+    for (size_t idx = 0; idx < num_intersections; ++idx) {
+        buf.push_back((char)ownership[idx]);
+    }
+
+    out.write(buf.data(), buf.size());
 }
 
 int GetTrainingVersion() {
@@ -90,3 +296,7 @@ int GetTrainingVersion() {
 int GetTrainingMode() {
     return 0;
 }
+
+int GetBinaryChunkVersion() {
+    return 1;
+}
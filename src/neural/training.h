@@ -4,6 +4,12 @@
 #include <iostream>
 
 struct Training {
+    // The training modes. The fast search of the playout cap
+    // randomization has no policy target, so its probabilities
+    // are all zeros.
+    static constexpr int kFullSearchMode = 0;
+    static constexpr int kFastSearchMode = 1;
+
     int version;
 
     int mode;
@@ -31,12 +37,20 @@ struct Training {
     float q_value;
 
     float final_score;
+
+    // The symmetry applied when writing it, or -1 if the record is not
+    // transformed. Only the binary format stores it.
+    int symmetry{-1};
+
+    // Transform the planes, the probabilities and the ownership with
+    // the symmetry. The reader does not need to augment it again.
+    void ApplySymmetry(int symm);
  /*
     Output format is here. EEvery data package are 45 lines .
 
     ------- claiming -------
      L1       : Version
-     L2       : Mode
+     L2       : Mode, 0 is the full search and 1 is the fast search
      
      ------- Inputs data -------
      L3       : Board size
@@ -53,8 +67,45 @@ struct Training {
      L45      : Final score
   */
     void StreamOut(std::ostream &out) const;
+
+    // Read one record of the text format. The last four planes are
+    // not stored, so they are zeros. Return false if the stream is
+    // end or the record is broken.
+    bool StreamIn(std::istream &in);
+
+ /*
+    The binary format is fixed width for the board size. All values are
+    little endian.
+
+    ------- header, 24 bytes -------
+     0  - 3  : Magic "SYBC"
+     4       : Binary format version
+     5       : Version
+     6       : Mode
+     7       : Board size
+     8       : Current Player
+     9       : Result (int8)
+     10      : The symmetry applied when writing plus one, zero if it
+               is not transformed
+     11      : Padding
+     12 - 15 : Komi (float)
+     16 - 19 : Q value (float)
+     20 - 23 : Final score (float)
+
+     ------- body -------
+     Binary features, 34 planes. Every plane is packed into
+     (N+7)/8 bytes, the lowest bit is the first intersection.
+     Probabilities, N+1 half floats.
+     Auxiliary probabilities, N+1 half floats.
+     Ownership, N int8.
+
+    N is the number of intersections.
+  */
+    void BinaryStreamOut(std::ostream &out) const;
 };
 
 int GetTrainingVersion();
 
 int GetTrainingMode();
+
+int GetBinaryChunkVersion();
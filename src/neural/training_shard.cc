@@ -0,0 +1,172 @@
+#include "neural/training_shard.h"
+
+#include <cstring>
+#include <sstream>
+
+#ifdef USE_ZLIB
+#include "zlib.h"
+#endif
+
+static constexpr char kShardMagic[] = "SYSH";
+static constexpr int kShardVersion = 1;
+static constexpr size_t kShardHeaderSize = 32;
+static constexpr size_t kIndexEntrySize = 16;
+
+static constexpr int kNoCompression = 0;
+static constexpr int kZlibCompression = 1;
+
+static void PutUint(std::string &buf, std::uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        buf.push_back((char)((v >> (8 * i)) & 0xff));
+    }
+}
+
+static std::uint64_t GetUint(const char *p, int bytes) {
+    std::uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i) {
+        v |= (std::uint64_t)(std::uint8_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+bool IsTrainingShard(const char *data, size_t size) {
+    return size >= kShardHeaderSize &&
+               std::memcmp(data, kShardMagic, 4) == 0;
+}
+
+bool TrainingShardWriter::Open(const std::string &filename, std::int64_t generation) {
+    file_.open(filename, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!file_.is_open()) {
+        return false;
+    }
+    generation_ = generation;
+#ifdef USE_ZLIB
+    compression_ = kZlibCompression;
+#else
+    compression_ = kNoCompression;
+#endif
+    offset_ = kShardHeaderSize;
+    index_.clear();
+
+    // The index offset is zero until the shard is closed.
+    file_.write(std::string(kShardHeaderSize, '\0').data(), kShardHeaderSize);
+    return file_.good();
+}
+
+bool TrainingShardWriter::Append(const Training &data) {
+    auto oss = std::ostringstream{};
+    data.BinaryStreamOut(oss);
+    const auto record = oss.str();
+
+    const char *out = record.data();
+    size_t out_size = record.size();
+#ifdef USE_ZLIB
+    if (compression_ == kZlibCompression) {
+        auto bound = compressBound(record.size());
+        compressed_.resize(bound);
+        if (compress2((Bytef *)&compressed_[0], &bound,
+                          (const Bytef *)record.data(), record.size(),
+                          Z_DEFAULT_COMPRESSION) != Z_OK) {
+            return false;
+        }
+        out = compressed_.data();
+        out_size = bound;
+    }
+#endif
+    file_.write(out, out_size);
+    index_.push_back({offset_, (std::uint32_t)out_size, (std::uint32_t)record.size()});
+    offset_ += out_size;
+    return file_.good();
+}
+
+bool TrainingShardWriter::Close() {
+    if (!file_.is_open()) {
+        return false;
+    }
+    auto buf = std::string{};
+    for (const auto &e : index_) {
+        PutUint(buf, e.offset, 8);
+        PutUint(buf, e.compressed_size, 4);
+        PutUint(buf, e.size, 4);
+    }
+    file_.write(buf.data(), buf.size());
+
+    // Fill the header at last, so the broken shard is never read.
+    buf.clear();
+    buf.append(kShardMagic, 4);
+    buf.push_back((char)kShardVersion);
+    buf.push_back((char)compression_);
+    buf.append(2, '\0');
+    PutUint(buf, (std::uint64_t)generation_, 8);
+    PutUint(buf, offset_, 8);
+    PutUint(buf, index_.size(), 4);
+    buf.append(4, '\0');
+    file_.seekp(0);
+    file_.write(buf.data(), buf.size());
+
+    const bool good = file_.good();
+    file_.close();
+    index_.clear();
+    return good && !file_.fail();
+}
+
+bool TrainingShardReader::Open(const std::string &filename) {
+    num_records_ = 0;
+    index_ = nullptr;
+    if (!file_.Open(filename)) {
+        return false;
+    }
+    const auto data = file_.Data();
+    const auto size = file_.Size();
+    if (!IsTrainingShard(data, size) ||
+            (int)(std::uint8_t)data[4] != kShardVersion) {
+        return false;
+    }
+    compression_ = (std::uint8_t)data[5];
+    generation_ = (std::int64_t)GetUint(data + 8, 8);
+
+    const auto index_offset = GetUint(data + 16, 8);
+    const auto num_records = GetUint(data + 24, 4);
+    if (index_offset < kShardHeaderSize ||
+            index_offset + num_records * kIndexEntrySize > size) {
+        return false;
+    }
+#ifndef USE_ZLIB
+    if (compression_ != kNoCompression) {
+        return false;
+    }
+#endif
+    index_ = data + index_offset;
+    num_records_ = num_records;
+    return true;
+}
+
+bool TrainingShardReader::ReadRecord(size_t i, std::string &record) const {
+    if (i >= num_records_) {
+        return false;
+    }
+    const auto entry = index_ + i * kIndexEntrySize;
+    const auto offset = GetUint(entry, 8);
+    const auto compressed_size = GetUint(entry + 8, 4);
+    const auto size = GetUint(entry + 12, 4);
+    if (offset + compressed_size > file_.Size()) {
+        return false;
+    }
+    const auto src = file_.Data() + offset;
+
+    if (compression_ == kNoCompression) {
+        record.assign(src, compressed_size);
+        return true;
+    }
+#ifdef USE_ZLIB
+    if (compression_ == kZlibCompression) {
+        record.resize(size);
+        auto dest_size = (uLongf)size;
+        return uncompress((Bytef *)&record[0], &dest_size,
+                              (const Bytef *)src, compressed_size) == Z_OK &&
+                   dest_size == size;
+    }
+#endif
+    (void)size;
+    return false;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "neural/training.h"
+#include "utils/mapped_file.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+    The indexed shard holds the binary records of Training::BinaryStreamOut.
+    Every record is compressed alone and the offset table is at the end, so
+    the reader decompresses any record without touching the others. All
+    values are little endian.
+
+    ------- header, 32 bytes -------
+     0  - 3  : Magic "SYSH"
+     4       : Shard version
+     5       : Compression, 0 is none and 1 is zlib
+     6  - 7  : Padding
+     8  - 15 : Generation (int64), the modification time of the weights
+               which played the games
+     16 - 23 : Offset of the index table (uint64), zero if the shard is
+               not closed
+     24 - 27 : Number of records (uint32)
+     28 - 31 : Padding
+
+    ------- body -------
+     The compressed records.
+
+    ------- index table -------
+     Offset (uint64), compressed size (uint32) and record size (uint32)
+     of every record.
+ */
+class TrainingShardWriter {
+public:
+    // Return false if fail to create the file. The records are stored
+    // as they are if there is no zlib.
+    bool Open(const std::string &filename, std::int64_t generation);
+
+    bool Append(const Training &data);
+
+    // Write the index table and the header. Return false if fail to
+    // write any part of the shard.
+    bool Close();
+
+private:
+    struct Entry {
+        std::uint64_t offset;
+        std::uint32_t compressed_size;
+        std::uint32_t size;
+    };
+
+    std::ofstream file_;
+    std::int64_t generation_{0};
+    int compression_{0};
+    std::uint64_t offset_{0};
+    std::vector<Entry> index_;
+    std::string compressed_;
+};
+
+class TrainingShardReader {
+public:
+    // Map the shard and check the header. Return false if it is not
+    // a closed shard.
+    bool Open(const std::string &filename);
+
+    size_t GetNumRecords() const { return num_records_; }
+    std::int64_t GetGeneration() const { return generation_; }
+
+    // Decompress the i-th record into the binary format. It may be
+    // called by many threads at the same time.
+    bool ReadRecord(size_t i, std::string &record) const;
+
+private:
+    MappedFile file_;
+    int compression_{0};
+    std::int64_t generation_{0};
+    size_t num_records_{0};
+    const char *index_{nullptr};
+};
+
+bool IsTrainingShard(const char *data, size_t size);
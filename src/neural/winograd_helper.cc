@@ -1,14 +1,5 @@
 #include "neural/winograd_helper.h"
 
-int GetWinogradWTiles(const int board_size) {
-    return board_size / kWinogradM + (board_size % kWinogradM != 0);
-}
-
-int GetWinogradP(const int board_size) {
-    const int wtiles = GetWinogradWTiles(board_size);
-    return wtiles * wtiles;
-}
-
 std::vector<float> WinogradTransformF(const std::vector<float>& f,
                                           const int outputs,
                                           const int channels) {
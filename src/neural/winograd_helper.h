@@ -9,9 +9,15 @@ static constexpr int kWinogradAlpha = kWinogradM + 3 - 1;
 static constexpr int kWinogradTile = kWinogradAlpha * kWinogradAlpha;
 static constexpr double kSqrt2 = 1.4142135623730951f; // Square root of 2
 
-int GetWinogradWTiles(const int board_size);
+// They are constexpr, so the transforms specialized for one board size
+// get the tile geometry at compile time.
+constexpr int GetWinogradWTiles(const int board_size) {
+    return board_size / kWinogradM + (board_size % kWinogradM != 0);
+}
 
-int GetWinogradP(const int board_size);
+constexpr int GetWinogradP(const int board_size) {
+    return GetWinogradWTiles(board_size) * GetWinogradWTiles(board_size);
+}
 
 std::vector<float> WinogradTransformF(const std::vector<float>& f,
                                           const int out_channels,
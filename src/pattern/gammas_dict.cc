@@ -2,7 +2,11 @@
 #include "pattern/gammas_dict.h"
 #include "pattern/pattern_gammas.h"
 #include "game/types.h"
+#include "game/game_state.h"
+#include "utils/format.h"
+#include "utils/time.h"
 
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <string>
@@ -68,40 +72,177 @@ void GammasDict::Initialize(std::string filename) {
             }
         }
     }
+
+    // Move the dictionaries into the flat tables. The maps are
+    // not needed after loading.
+    pattern_table_.Build(pattern_dict_);
+    feature_table_.Build(feature_dict_);
+    pattern_dict_.clear();
+    feature_dict_.clear();
 }
 
 bool GammasDict::ProbePattern(std::uint64_t hash, float &val) const {
-    auto it = pattern_dict_.find(hash);
-    if (it == std::end(pattern_dict_)) {
-        return false;
-    }
-    val = it->second;
-    return true;
+    return pattern_table_.Probe(hash, val);
 }
 
 bool GammasDict::ProbeFeature(std::uint64_t hash, float &val) const {
-    auto it = feature_dict_.find(hash);
-    if (it == std::end(feature_dict_)) {
-        return false;
-    }
-    val = it->second;
-    return true;
+    return feature_table_.Probe(hash, val);
 }
 
 bool GammasDict::InsertPattern(std::uint64_t hash, float val) {
-    float g;
-    if (ProbePattern(hash, g)) {
-        return false;
-    }
-    pattern_dict_.insert({hash, val});
-    return true;
+    return pattern_dict_.insert({hash, val}).second;
 }
 
 bool GammasDict::InsertFeature(std::uint64_t hash, float val) {
-    float g;
-    if (ProbeFeature(hash, g)) {
+    return feature_dict_.insert({hash, val}).second;
+}
+
+std::uint64_t GammasDict::FlatTable::Mix(std::uint64_t key) {
+    // The feature keys only use few low bits. Spread them by the
+    // splitmix64 finalizer.
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+void GammasDict::FlatTable::Build(const std::unordered_map<std::uint64_t, float> &dict) {
+    // Keep the load factor under 0.5, so the probe sequences
+    // are short.
+    size_t size = 16;
+    while (size < 2 * dict.size()) {
+        size <<= 1;
+    }
+    entries_.assign(size, Entry{0, 0.f, 0});
+    mask_ = size - 1;
+
+    // About 16 bits for every key.
+    size_t bloom_words = 1;
+    while (bloom_words * 64 < 16 * dict.size()) {
+        bloom_words <<= 1;
+    }
+    bloom_.assign(bloom_words, 0);
+    bloom_mask_ = bloom_words * 64 - 1;
+
+    for (const auto &it : dict) {
+        const auto h = Mix(it.first);
+        auto idx = h & mask_;
+        while (entries_[idx].used) {
+            idx = (idx + 1) & mask_;
+        }
+        entries_[idx] = Entry{it.first, it.second, 1};
+
+        const auto b1 = (h >> 32) & bloom_mask_;
+        const auto b2 = (h >> 48 | h << 16) & bloom_mask_;
+        bloom_[b1 >> 6] |= std::uint64_t{1} << (b1 & 63);
+        bloom_[b2 >> 6] |= std::uint64_t{1} << (b2 & 63);
+    }
+}
+
+bool GammasDict::FlatTable::Probe(std::uint64_t key, float &val) const {
+    if (entries_.empty()) {
+        return false;
+    }
+    const auto h = Mix(key);
+    const auto b1 = (h >> 32) & bloom_mask_;
+    const auto b2 = (h >> 48 | h << 16) & bloom_mask_;
+    if (!((bloom_[b1 >> 6] >> (b1 & 63)) & 1) ||
+            !((bloom_[b2 >> 6] >> (b2 & 63)) & 1)) {
         return false;
     }
-    feature_dict_.insert({hash, val});
-    return true;
+
+    auto idx = h & mask_;
+    while (entries_[idx].used) {
+        if (entries_[idx].key == key) {
+            val = entries_[idx].val;
+            return true;
+        }
+        idx = (idx + 1) & mask_;
+    }
+    return false;
+}
+
+std::string GammasDict::Benchmark(const GameState &state, int rounds) const {
+    // Collect the keys of GameState::GetGammaValue().
+    auto pattern_keys = std::vector<std::uint64_t>{};
+    auto feature_keys = std::vector<std::uint64_t>{};
+    const auto &board = state.board_;
+    const int board_size = state.GetBoardSize();
+
+    for (int color = kBlack; color <= kWhite; ++color) {
+        for (int idx = 0; idx < board_size * board_size; ++idx) {
+            const auto vtx = state.GetVertex(idx % board_size, idx / board_size);
+            if (board.GetState(vtx) != kEmpty) {
+                continue;
+            }
+            std::uint64_t hash = 0ULL;
+            for (int d = 2; d < kMaxPatternDist+1; ++d) {
+                hash = board.GetSurroundPatternHash(hash, vtx, color, d);
+                pattern_keys.emplace_back(hash);
+            }
+            for (int i = 0; i < Board::GetMaxFeatures(); ++i) {
+                if (board.GetFeatureWrapper(i, vtx, color, hash)) {
+                    feature_keys.emplace_back(hash);
+                }
+            }
+        }
+    }
+
+    // Rebuild the maps for the comparison.
+    auto pattern_map = std::unordered_map<std::uint64_t, float>{};
+    auto feature_map = std::unordered_map<std::uint64_t, float>{};
+    for (const auto &e : pattern_table_.entries_) {
+        if (e.used) pattern_map.insert({e.key, e.val});
+    }
+    for (const auto &e : feature_table_.entries_) {
+        if (e.used) feature_map.insert({e.key, e.val});
+    }
+
+    const auto num_probes = (double)rounds * (pattern_keys.size() + feature_keys.size());
+    int map_hits = 0, flat_hits = 0;
+    float map_acc = 0.f, flat_acc = 0.f;
+
+    Timer timer;
+    for (int r = 0; r < rounds; ++r) {
+        for (const auto key : pattern_keys) {
+            const auto it = pattern_map.find(key);
+            if (it != std::end(pattern_map)) {
+                map_acc += it->second;
+                map_hits += 1;
+            }
+        }
+        for (const auto key : feature_keys) {
+            const auto it = feature_map.find(key);
+            if (it != std::end(feature_map)) {
+                map_acc += it->second;
+                map_hits += 1;
+            }
+        }
+    }
+    const auto map_sec = std::max(timer.GetDurationMicroseconds(), 1) / 1e6;
+
+    timer.Clock();
+    for (int r = 0; r < rounds; ++r) {
+        float gamma;
+        for (const auto key : pattern_keys) {
+            if (ProbePattern(key, gamma)) {
+                flat_acc += gamma;
+                flat_hits += 1;
+            }
+        }
+        for (const auto key : feature_keys) {
+            if (ProbeFeature(key, gamma)) {
+                flat_acc += gamma;
+                flat_hits += 1;
+            }
+        }
+    }
+    const auto flat_sec = std::max(timer.GetDurationMicroseconds(), 1) / 1e6;
+
+    auto out = std::ostringstream{};
+    out << Format("Probe %zu keys %d times.\n",
+                      pattern_keys.size() + feature_keys.size(), rounds)
+            << Format("Node based maps: %.1f M probes per second.\n", num_probes / map_sec / 1e6)
+            << Format("Flat tables: %.1f M probes per second.\n", num_probes / flat_sec / 1e6)
+            << Format("Results are %s.", map_hits == flat_hits && map_acc == flat_acc ? "same" : "different");
+    return out.str();
 }
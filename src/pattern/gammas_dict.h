@@ -1,9 +1,11 @@
 #pragma once
 
 #include <unordered_map>
+#include <vector>
 #include <string>
 #include <cstdint>
 
+class GameState;
 
 class GammasDict {
 public:
@@ -14,10 +16,45 @@ public:
     bool ProbePattern(std::uint64_t hash, float &val) const;
     bool ProbeFeature(std::uint64_t hash, float &val) const;
 
+    // Probe all patterns and features of the empty points in this
+    // position many times. Compare the flat tables with the node
+    // based maps.
+    std::string Benchmark(const GameState &state, int rounds) const;
+
 private:
+    // The open addressing table built from the loaded dictionary. Most
+    // probes miss, so every probe tests the Bloom filter first. The
+    // missing keys rarely touch the table.
+    class FlatTable {
+    public:
+        void Build(const std::unordered_map<std::uint64_t, float> &dict);
+
+        bool Probe(std::uint64_t key, float &val) const;
+
+    private:
+        struct Entry {
+            std::uint64_t key;
+            float val;
+            std::uint32_t used;
+        };
+
+        static std::uint64_t Mix(std::uint64_t key);
+
+        friend class GammasDict;
+
+        std::vector<Entry> entries_;
+        std::vector<std::uint64_t> bloom_;
+        std::uint64_t mask_{0};
+        std::uint64_t bloom_mask_{0};
+    };
+
     bool InsertPattern(std::uint64_t hash, float val);
     bool InsertFeature(std::uint64_t hash, float val);
 
+    // Only used while loading the dictionary.
     std::unordered_map<std::uint64_t, float> pattern_dict_;
     std::unordered_map<std::uint64_t, float> feature_dict_;
+
+    FlatTable pattern_table_;
+    FlatTable feature_table_;
 };
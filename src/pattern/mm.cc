@@ -1,9 +1,11 @@
 #include "pattern/mm.h"
 
+#include <algorithm>
 #include <set>
 #include <cmath>
 #include <iostream>
 #include <fstream>
+#include <thread>
 
 void MinorizationMaximization::Initialize(std::vector<int> features,
                                               std::vector<std::string> names) {
@@ -26,26 +28,22 @@ void MinorizationMaximization::Initialize(std::vector<int> features,
     }
 
     num_gammas_ = 0;
-    mm_gammas_each_feature_.resize(num_features_);
     for (int i = 0; i < num_features_; ++i) {
-        auto &mm_gammas = mm_gammas_each_feature_[i];
-
-        const auto num_gammas_each_features = features_[i];
-        mm_gammas.resize(num_gammas_each_features);
-
-        for (int j = 0; j < num_gammas_each_features; ++j) {
-            auto &mm = mm_gammas[j];
-            mm.used = false;
-            mm.wins = 0;
-            mm.c = 0.f;
-            mm.sigma = 0.f;
-            mm.gamma = 1.f;
-
-            num_gammas_ += 1;
-        }
+        num_gammas_ += features_[i];
     }
 
-    participants_.clear();
+    auto init_gamma = MmGamma{};
+    init_gamma.used = false;
+    init_gamma.wins = 0;
+    init_gamma.c = 0.f;
+    init_gamma.sigma = 0.f;
+    init_gamma.gamma = 1.f;
+    gammas_.assign(num_gammas_, init_gamma);
+
+    group_offsets_.assign(1, 0);
+    team_offsets_.assign(1, 0);
+    winners_.clear();
+    team_gammas_.clear();
 
     if (names.size() != features.size()) {
         std::cerr << "Features Number: " << num_features_ << "\n";
@@ -76,14 +74,21 @@ void MinorizationMaximization::AppendParticipantGroup(ParticipantGroup &p) {
     }
 
     if (success) {
-        participants_.emplace_back(p);
+        for (const auto &team : p.all_teams) {
+            for (const auto loc : team) {
+                team_gammas_.emplace_back(GetLineIndex(loc.feature, loc.index));
+            }
+            team_offsets_.emplace_back(team_gammas_.size());
+        }
+        winners_.emplace_back(p.winner_team_idx);
+        group_offsets_.emplace_back(team_offsets_.size() - 1);
     } else {
         std::cerr << "Illegal participant group, discard it." << std::endl;
     }
 }
 
 void MinorizationMaximization::StartTraining() {
-    std::cerr << "Participant groups number: " << participants_.size() << std::endl;
+    std::cerr << "Participant groups number: " << GetNumGroups() << std::endl;
 
     ComputeVictories();
 
@@ -97,8 +102,6 @@ void MinorizationMaximization::StartTraining() {
                   << ", lose: " << std::exp(-log_likelihood)
                   << " (" << log_likelihood << ")" << std::endl;
 
-
-    // TODO: Accelerate the training pipe line by Multi-threads.
     for (int s = 0; s < kMaxNumSteps; ++s) {
         for (int i = 0; i < num_features_; ++i) {
             if (features_[i] > 0) {
@@ -120,105 +123,176 @@ void MinorizationMaximization::StartTraining() {
     }
 }
 
-void MinorizationMaximization::MmUpdate(int feature) {
-    for (const auto &p : participants_) {
-        double all_gammas = 0.f;
+void MinorizationMaximization::SetThreads(int threads) {
+    num_threads_ = std::max(threads, 1);
+}
 
-        // gather the C_ij and E_j
-        for (const auto &team : p.all_teams) {
-            double team_gamma = 1.f;
+size_t MinorizationMaximization::GetNumGroups() const {
+    return winners_.size();
+}
 
-            // compute team gamma
-            for (const auto loc : team) {
-                team_gamma *= GetMmGamma(loc.feature, loc.index).gamma;
-            }
+template<typename F>
+void MinorizationMaximization::ForEachGroupRange(F func) const {
+    const auto num_groups = GetNumGroups();
+    const auto num_threads = std::max<size_t>(
+                                 std::min<size_t>(num_threads_, num_groups), 1);
+    const auto chunk = (num_groups + num_threads - 1) / num_threads;
 
-            // gather the C_ij
-            for (const auto loc : team) {
-                auto &mm = GetMmGamma(loc.feature, loc.index);
-                if (feature == loc.feature) {
-                    mm.c += team_gamma/mm.gamma;
-                    mm.used = true;
-                }
-            }
+    if (num_threads == 1) {
+        func(0, size_t{0}, num_groups);
+        return;
+    }
 
-            // gather the E_j
-            all_gammas += team_gamma;
-        }
+    auto workers = std::vector<std::thread>{};
+    for (size_t t = 0; t < num_threads; ++t) {
+        const auto begin = std::min(t * chunk, num_groups);
+        const auto end = std::min(begin + chunk, num_groups);
+        workers.emplace_back([&func, t, begin, end](){ func(t, begin, end); });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+}
 
-        // update sigma
-        for (auto &mm_gammas: mm_gammas_each_feature_) {
-            for (auto &mm : mm_gammas) {
-                mm.sigma += mm.c/all_gammas;
-                mm.c = 0.f;
+void MinorizationMaximization::MmUpdate(int feature) {
+    // Only the gammas of this feature are updated. Their line
+    // indices are continuous.
+    const int base = features_acc_[feature];
+    const int size = features_[feature];
+
+    struct Accumulator {
+        std::vector<double> sigma;
+        std::vector<double> c;
+        std::vector<std::uint8_t> used;
+        std::vector<int> touched;
+    };
+    auto accumulators = std::vector<Accumulator>(num_threads_);
+
+    ForEachGroupRange(
+        [&](size_t t, size_t begin, size_t end) {
+            auto &acc = accumulators[t];
+            acc.sigma.assign(size, 0.f);
+            acc.c.assign(size, 0.f);
+            acc.used.assign(size, 0);
+
+            for (auto g = begin; g < end; ++g) {
+                double all_gammas = 0.f;
+                acc.touched.clear();
+
+                // gather the C_ij and E_j
+                for (auto team = group_offsets_[g]; team < group_offsets_[g+1]; ++team) {
+                    const auto first = team_offsets_[team];
+                    const auto last = team_offsets_[team+1];
+                    double team_gamma = 1.f;
+
+                    // compute team gamma
+                    for (auto i = first; i < last; ++i) {
+                        team_gamma *= gammas_[team_gammas_[i]].gamma;
+                    }
+
+                    // gather the C_ij
+                    for (auto i = first; i < last; ++i) {
+                        const int idx = team_gammas_[i] - base;
+                        if (idx >= 0 && idx < size) {
+                            if (!acc.used[idx]) {
+                                acc.used[idx] = 1;
+                            }
+                            if (acc.c[idx] == 0.f) {
+                                acc.touched.emplace_back(idx);
+                            }
+                            acc.c[idx] += team_gamma/gammas_[team_gammas_[i]].gamma;
+                        }
+                    }
+
+                    // gather the E_j
+                    all_gammas += team_gamma;
+                }
+
+                // update sigma
+                for (const auto idx : acc.touched) {
+                    acc.sigma[idx] += acc.c[idx]/all_gammas;
+                    acc.c[idx] = 0.f;
+                }
             }
         }
-    }
+    );
 
     // compute the new gammas
     constexpr double kPriorVictories = 1.f;
     constexpr double kPriorGames = 2.f;
     constexpr double kPriorOpponentGamma = 1.f;
 
-    for (auto &mm_gammas: mm_gammas_each_feature_) {
-        for (auto &mm : mm_gammas) {
-            if (mm.used) {
-                const double new_gamma = (mm.wins + kPriorVictories) /
-                                             (mm.sigma + kPriorGames / (mm.gamma + kPriorOpponentGamma));
-                mm.gamma = new_gamma;
+    for (int idx = 0; idx < size; ++idx) {
+        auto &mm = gammas_[base + idx];
+
+        // Sum the threads in order, so the result does not depend
+        // on the scheduling.
+        for (const auto &acc : accumulators) {
+            if (acc.used.empty()) {
+                continue;
             }
-            mm.used = false;
-            mm.sigma = 0.f;
+            mm.sigma += acc.sigma[idx];
+            mm.used |= bool(acc.used[idx]);
         }
+        if (mm.used) {
+            const double new_gamma = (mm.wins + kPriorVictories) /
+                                         (mm.sigma + kPriorGames / (mm.gamma + kPriorOpponentGamma));
+            mm.gamma = new_gamma;
+        }
+        mm.used = false;
+        mm.sigma = 0.f;
     }
 }
 
 double MinorizationMaximization::ComputeLogLikelihood() const {
-    double res = 0.f;
-
-    for (auto &p : participants_) {
-        int team_idx = 0;
+    auto partial = std::vector<double>(num_threads_, 0.f);
 
-        double winner_gammas = 0.f;
-        double all_gammas = 0.f;
+    ForEachGroupRange(
+        [&](size_t t, size_t begin, size_t end) {
+            double res = 0.f;
 
-        for (const auto &team : p.all_teams) {
+            for (auto g = begin; g < end; ++g) {
+                double winner_gammas = 0.f;
+                double all_gammas = 0.f;
 
-            double team_gamma = 1.f;
+                for (auto team = group_offsets_[g]; team < group_offsets_[g+1]; ++team) {
+                    double team_gamma = 1.f;
 
-            // compute team gamma
-            for (const auto loc : team) {
-                team_gamma *= mm_gammas_each_feature_[loc.feature][loc.index].gamma;
-            }
+                    // compute team gamma
+                    for (auto i = team_offsets_[team]; i < team_offsets_[team+1]; ++i) {
+                        team_gamma *= gammas_[team_gammas_[i]].gamma;
+                    }
 
-            if (team_idx == p.winner_team_idx) {
-                winner_gammas += team_gamma;
+                    if (team - group_offsets_[g] == (std::uint64_t)winners_[g]) {
+                        winner_gammas += team_gamma;
+                    }
+                    all_gammas += team_gamma;
+                }
+                res += std::log(winner_gammas);
+                res -= std::log(all_gammas);
             }
-            all_gammas += team_gamma;
-
-            team_idx += 1;
+            partial[t] = res;
         }
-        res += std::log(winner_gammas);
-        res -= std::log(all_gammas);
-    }
+    );
 
-    return res / participants_.size();
+    double res = 0.f;
+    for (const auto v : partial) {
+        res += v;
+    }
+    return res / GetNumGroups();
 }
 
 void MinorizationMaximization::ComputeVictories() {
-    int all_wins = 0;
-    for (auto &p : participants_) {
-        for (const auto loc : p.all_teams[p.winner_team_idx]) {
-            auto &mm = GetMmGamma(loc.feature, loc.index);
-            mm.wins += 1;
-            all_wins += 1;
+    for (size_t g = 0; g < GetNumGroups(); ++g) {
+        const auto team = group_offsets_[g] + winners_[g];
+        for (auto i = team_offsets_[team]; i < team_offsets_[team+1]; ++i) {
+            gammas_[team_gammas_[i]].wins += 1;
         }
     }
-    (void) all_wins;
 }
 
 MinorizationMaximization::MmGamma &MinorizationMaximization::GetMmGamma(int feature, int index) {
-    return mm_gammas_each_feature_[feature][index];
+    return gammas_[GetLineIndex(feature, index)];
 }
 
 int MinorizationMaximization::GetLineIndex(int feature, int index) const {
@@ -243,23 +317,20 @@ void MinorizationMaximization::SaveMmFIle(std::string filename) {
     }
     file << "!" << std::endl;
 
-    for (auto &p : participants_) {
-        file << "#" << std::endl;
-
-        int i = 0;
-        for (const auto loc : p.all_teams[p.winner_team_idx]) {
-            if (i++) file << " ";
-            file << GetLineIndex(loc.feature, loc.index);
+    const auto WriteTeam = [&file, this](std::uint64_t team) {
+        for (auto i = team_offsets_[team]; i < team_offsets_[team+1]; ++i) {
+            if (i != team_offsets_[team]) file << " ";
+            file << team_gammas_[i];
         }
         file << std::endl;
+    };
 
-        for (const auto &team : p.all_teams) {
-            int i = 0;
-            for (const auto loc : team) {
-                if (i++) file << " ";
-                file << GetLineIndex(loc.feature, loc.index);
-            }
-            file << std::endl;
+    for (size_t g = 0; g < GetNumGroups(); ++g) {
+        file << "#" << std::endl;
+
+        WriteTeam(group_offsets_[g] + winners_[g]);
+        for (auto team = group_offsets_[g]; team < group_offsets_[g+1]; ++team) {
+            WriteTeam(team);
         }
     }
 
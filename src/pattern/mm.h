@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <string>
 
@@ -26,11 +27,15 @@ public:
         double sigma;
         double gamma;
     };
-    using MmGammas = std::vector<MmGamma>;
 
     MmGamma &GetMmGamma(int feature, int index);
     void Initialize(std::vector<int> features,
                         std::vector<std::string> names = std::vector<std::string>{});
+
+    // Set the number of training threads. The result only depends on
+    // it by the rounding of the sums.
+    void SetThreads(int threads);
+
     void AppendParticipantGroup(ParticipantGroup &p);
     void StartTraining();
     void SaveMmFIle(std::string filename);
@@ -42,12 +47,29 @@ private:
     double ComputeLogLikelihood() const;
     int GetLineIndex(int feature, int index) const;
 
+    // Split the groups into the same number of ranges as the threads
+    // and run the function with (thread, begin, end) on every range.
+    template<typename F>
+    void ForEachGroupRange(F func) const;
+
+    size_t GetNumGroups() const;
+
     int num_features_;
     int num_nonzero_features_;
     int num_gammas_;
+    int num_threads_{1};
     std::vector<int> features_;
     std::vector<int> features_acc_;
 
-    std::vector<MmGammas> mm_gammas_each_feature_;
-    std::vector<ParticipantGroup> participants_;
+    // All gammas by the line index.
+    std::vector<MmGamma> gammas_;
+
+    // The participant groups in the flat arrays. The teams of group g
+    // are from group_offsets_[g] to group_offsets_[g+1]. The gammas of
+    // team t are from team_offsets_[t] to team_offsets_[t+1]. Every
+    // gamma is stored by its line index.
+    std::vector<std::uint64_t> group_offsets_;
+    std::vector<int> winners_;
+    std::vector<std::uint64_t> team_offsets_;
+    std::vector<int> team_gammas_;
 };
@@ -3,9 +3,11 @@
 #include "game/iterator.h"
 #include "utils/format.h"
 #include "utils/log.h"
+#include "config.h"
 
 #include <algorithm>
 #include <functional>
+#include <thread>
 
 constexpr int MmTrainer::kMmMaxPatternDist;
 constexpr int MmTrainer::kMmMinPatternDist;
@@ -16,7 +18,15 @@ MmTrainer& MmTrainer::Get() {
 }
 
 void MmTrainer::Run(std::string sgf_name, std::string out_name, int min_count) {
-    auto sgfs = SgfParser::Get().ChopAll(sgf_name);
+    // Stream the games from the file in both passes. Do not keep all
+    // SGF strings in the memory.
+    const auto ForEachGame = [&sgf_name](std::function<void(std::string &)> func) {
+        SgfParser::Get().ChopFile(sgf_name, 0,
+            [&func](std::string &sgf_string, size_t) {
+                func(sgf_string);
+                return true;
+            });
+    };
 
     num_patterns_ = 0;
     const int num_features = kMmMaxPatternDist + Board::GetMaxFeatures() + 1;
@@ -27,9 +37,9 @@ void MmTrainer::Run(std::string sgf_name, std::string out_name, int min_count) {
     feature_counters_.resize(num_features);
 
     // Gather the mm patterns.
-    for (const auto &sgf_string : sgfs) {
+    ForEachGame([this](std::string &sgf_string) {
         FillPatterns(sgf_string);
-    }
+    });
 
     if (num_patterns_ == 0) {
         return;
@@ -40,9 +50,9 @@ void MmTrainer::Run(std::string sgf_name, std::string out_name, int min_count) {
     InitMm();
 
     // Fill the mm participant.
-    for (const auto &sgf_string : sgfs) {
-       FillMmParticipant(sgf_string);
-    }
+    ForEachGame([this](std::string &sgf_string) {
+        FillMmParticipant(sgf_string);
+    });
 
     // Start training...
     mm_->StartTraining();
@@ -86,6 +96,9 @@ void MmTrainer::InitMm() {
 
     mm_ = std::make_unique<MinorizationMaximization>();
     mm_->Initialize(features, names);
+
+    const int threads = GetOption<int>("threads");
+    mm_->SetThreads(threads > 0 ? threads : std::thread::hardware_concurrency());
 }
 
 void MmTrainer::FilterPatterns(int select_min_count) {
@@ -0,0 +1,124 @@
+#include "selfplay/client.h"
+#include "utils/filesystem.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+// Refuse the broken header instead of allocating its size.
+static constexpr std::uint64_t kMaxPayloadSize = std::uint64_t{1} << 32;
+
+SelfPlayClient::Hello SelfPlayClient::GetHello() {
+    auto hello = Hello{};
+    hello.magic = 0x53595343; // "SYSC"
+    hello.version = 1;
+    return hello;
+}
+
+bool SelfPlayClient::MatchHello(const Hello &a, const Hello &b) {
+    return a.magic == b.magic &&
+               a.version == b.version;
+}
+
+bool SelfPlayClient::SendMessage(Socket &socket, std::uint32_t type, const std::string &payload) {
+    auto header = MessageHeader{};
+    header.type = type;
+    header.size = payload.size();
+    return socket.SendAll(&header, sizeof(header)) &&
+               socket.SendAll(payload.data(), payload.size());
+}
+
+bool SelfPlayClient::RecvMessage(Socket &socket, std::uint32_t &type, std::string &payload) {
+    auto header = MessageHeader{};
+    if (!socket.RecvAll(&header, sizeof(header)) ||
+            header.size > kMaxPayloadSize) {
+        return false;
+    }
+    type = header.type;
+    payload.resize(header.size);
+    return socket.RecvAll(&payload[0], payload.size());
+}
+
+SelfPlayClient::SelfPlayClient(const std::string &address) {
+    if (!SplitAddress(address, host_, port_)) {
+        port_ = 0;
+    }
+}
+
+bool SelfPlayClient::Request(std::uint32_t type, const std::string &payload,
+                             std::uint32_t reply_type, std::string &reply) {
+    if (!Valid()) {
+        return false;
+    }
+    auto socket = Socket{};
+    const auto hello = GetHello();
+    auto server_hello = Hello{};
+
+    if (!socket.Connect(host_, port_) ||
+            !socket.SendAll(&hello, sizeof(hello)) ||
+            !socket.RecvAll(&server_hello, sizeof(server_hello)) ||
+            !MatchHello(hello, server_hello)) {
+        return false;
+    }
+    auto type_got = std::uint32_t{0};
+    return SendMessage(socket, type, payload) &&
+               RecvMessage(socket, type_got, reply) &&
+               type_got == reply_type;
+}
+
+bool SelfPlayClient::FetchSettings(std::string &settings) {
+    return Request(kGetSettings, {}, kSettings, settings);
+}
+
+bool SelfPlayClient::FetchWeights(const std::string &filename) {
+    // Send the hash of the local file. The coordinator only answers
+    // the hash if it is the same.
+    const std::uint64_t local_hash = GetFileHash(filename);
+    auto payload = std::string(sizeof(local_hash), '\0');
+    std::memcpy(&payload[0], &local_hash, sizeof(local_hash));
+
+    auto reply = std::string{};
+    if (!Request(kGetWeights, payload, kWeights, reply) ||
+            reply.size() < sizeof(std::uint64_t)) {
+        return false;
+    }
+    std::uint64_t hash;
+    std::memcpy(&hash, reply.data(), sizeof(hash));
+
+    const auto data = reply.data() + sizeof(hash);
+    const auto size = reply.size() - sizeof(hash);
+    if (hash == 0 || hash == local_hash || size == 0 ||
+            GetDataHash(data, size) != hash) {
+        return false;
+    }
+
+    const auto tmp_name = filename + ".tmp";
+    auto file = std::ofstream{tmp_name, std::ios_base::binary | std::ios_base::trunc};
+    file.write(data, size);
+    file.close();
+    if (file.fail()) {
+        std::remove(tmp_name.c_str());
+        return false;
+    }
+    return std::rename(tmp_name.c_str(), filename.c_str()) == 0;
+}
+
+bool SelfPlayClient::Upload(std::uint32_t type, const std::string &name, const std::string &data) {
+    const std::uint32_t name_size = name.size();
+    auto payload = std::string(sizeof(name_size), '\0');
+    std::memcpy(&payload[0], &name_size, sizeof(name_size));
+    payload += name;
+    payload += data;
+
+    auto reply = std::string{};
+    return Request(type, payload, kAck, reply) &&
+               reply.size() == 1 && reply[0] == 1;
+}
+
+bool SelfPlayClient::UploadChunk(const std::string &name, const std::string &data) {
+    return Upload(kPutChunk, name, data);
+}
+
+bool SelfPlayClient::UploadSgf(const std::string &name, const std::string &data) {
+    return Upload(kPutSgf, name, data);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "utils/socket.h"
+
+#include <cstdint>
+#include <string>
+
+// The self-play clients on many hosts work for one coordinator. They
+// take the settings and the weights from it and upload the chunks and
+// the SGFs to it, so only the coordinator touches the training data
+// directory. Every request is one connection: both sides send the
+// Hello, then the client sends one message and the coordinator answers
+// one message.
+class SelfPlayClient {
+public:
+    enum MessageType : std::uint32_t {
+        kGetSettings = 1,
+        kSettings,
+        kGetWeights,
+        kWeights,
+        kPutChunk,
+        kPutSgf,
+        kAck
+    };
+
+    struct Hello {
+        std::uint32_t magic;
+        std::uint32_t version;
+    };
+
+    // Every message is the header and then the payload.
+    struct MessageHeader {
+        std::uint32_t type;
+        std::uint32_t reserved;
+        std::uint64_t size;
+    };
+
+    static Hello GetHello();
+    static bool MatchHello(const Hello &a, const Hello &b);
+
+    static bool SendMessage(Socket &socket, std::uint32_t type, const std::string &payload);
+    static bool RecvMessage(Socket &socket, std::uint32_t &type, std::string &payload);
+
+    // The address is "host:port".
+    explicit SelfPlayClient(const std::string &address);
+
+    // Fetch the command line options of the coordinator. They are the
+    // lines of the config file.
+    bool FetchSettings(std::string &settings);
+
+    // Download the current weights into the file if they differ from
+    // it. The file is replaced at once, so the network which watches
+    // it never reads the half file. Return true if it is replaced.
+    bool FetchWeights(const std::string &filename);
+
+    // Upload the chunk file or the part of the SGF file. The name is
+    // the file name on the coordinator.
+    bool UploadChunk(const std::string &name, const std::string &data);
+    bool UploadSgf(const std::string &name, const std::string &data);
+
+    bool Valid() const { return port_ > 0; }
+
+private:
+    bool Request(std::uint32_t type, const std::string &payload,
+                 std::uint32_t reply_type, std::string &reply);
+    bool Upload(std::uint32_t type, const std::string &name, const std::string &data);
+
+    std::string host_;
+    int port_{0};
+};
@@ -0,0 +1,222 @@
+#include "selfplay/coordinator.h"
+#include "selfplay/client.h"
+#include "utils/filesystem.h"
+#include "utils/log.h"
+#include "utils/time.h"
+#include "utils/format.h"
+#include "config.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+
+// Only the plain file names are saved, so the client can never write
+// out of the target directory.
+static bool IsValidName(const std::string &name) {
+    if (name.empty() || name.size() > 255 || name[0] == '.') {
+        return false;
+    }
+    for (const char c : name) {
+        if (!(std::isalnum((unsigned char)c) || c == '_' || c == '-' || c == '.')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SelfPlayCoordinator::SelfPlayCoordinator() {
+    if (Initialize()) {
+        Loop();
+    }
+}
+
+bool SelfPlayCoordinator::Initialize() {
+    weights_file_ = GetOption<std::string>("weights_file");
+    settings_file_ = GetOption<std::string>("client_config");
+
+    const auto target_directory = GetOption<std::string>("target_directory");
+    if (target_directory.empty() || !IsDirectoryExist(target_directory)) {
+        LOGGING << "Please give the existing target directory.\n";
+        return false;
+    }
+    if (weights_file_.empty()) {
+        LOGGING << "The coordinator requires the weights file.\n";
+        return false;
+    }
+
+    data_directory_ = ConnectPath(target_directory, "data");
+    sgf_directory_ = ConnectPath(target_directory, "sgf");
+    if (!IsDirectoryExist(data_directory_)) {
+        CreateDirectory(data_directory_);
+    }
+    if (!IsDirectoryExist(sgf_directory_)) {
+        CreateDirectory(sgf_directory_);
+    }
+    return true;
+}
+
+void SelfPlayCoordinator::Loop() {
+    const int port = GetOption<int>("server_port");
+    auto server = Socket{};
+
+    if (!server.Listen(port)) {
+        LOGGING << Format("Fail to listen on the port %d.\n", port);
+        return;
+    }
+    LOGGING << Format("The self-play coordinator is listening on the port %d.\n", port);
+
+    while (true) {
+        auto client = server.Accept();
+        if (!client.Valid()) {
+            continue;
+        }
+        std::thread([this, client = std::move(client)]() mutable {
+            ServeClient(std::move(client));
+        }).detach();
+    }
+}
+
+void SelfPlayCoordinator::ServeClient(Socket socket) {
+    const auto hello = SelfPlayClient::GetHello();
+    auto client_hello = SelfPlayClient::Hello{};
+
+    if (!socket.RecvAll(&client_hello, sizeof(client_hello)) ||
+            !socket.SendAll(&hello, sizeof(hello)) ||
+            !SelfPlayClient::MatchHello(hello, client_hello)) {
+        return;
+    }
+
+    auto type = std::uint32_t{0};
+    auto payload = std::string{};
+
+    while (SelfPlayClient::RecvMessage(socket, type, payload)) {
+        bool ok = true;
+
+        if (type == SelfPlayClient::kGetSettings) {
+            ok = SelfPlayClient::SendMessage(socket, SelfPlayClient::kSettings, GetSettings());
+        } else if (type == SelfPlayClient::kGetWeights) {
+            std::uint64_t client_hash = 0;
+            if (payload.size() >= sizeof(client_hash)) {
+                std::memcpy(&client_hash, payload.data(), sizeof(client_hash));
+            }
+            std::uint64_t hash = 0;
+            const auto weights = GetWeights(hash);
+
+            auto reply = std::string(sizeof(hash), '\0');
+            std::memcpy(&reply[0], &hash, sizeof(hash));
+            if (hash != 0 && hash != client_hash) {
+                reply += *weights;
+            }
+            ok = SelfPlayClient::SendMessage(socket, SelfPlayClient::kWeights, reply);
+        } else if (type == SelfPlayClient::kPutChunk ||
+                       type == SelfPlayClient::kPutSgf) {
+            std::uint32_t name_size = 0;
+            bool saved = false;
+            if (payload.size() >= sizeof(name_size)) {
+                std::memcpy(&name_size, payload.data(), sizeof(name_size));
+            }
+            if (name_size > 0 &&
+                    payload.size() >= sizeof(name_size) + name_size) {
+                const auto name = payload.substr(sizeof(name_size), name_size);
+                const auto data = payload.data() + sizeof(name_size) + name_size;
+                const auto size = payload.size() - sizeof(name_size) - name_size;
+                saved = type == SelfPlayClient::kPutChunk ?
+                            SaveChunk(name, data, size) : AppendSgf(name, data, size);
+            }
+            ok = SelfPlayClient::SendMessage(socket, SelfPlayClient::kAck,
+                                             std::string(1, saved ? 1 : 0));
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            break;
+        }
+    }
+}
+
+std::string SelfPlayCoordinator::GetSettings() const {
+    // Read it every time, so the settings can be changed while the
+    // clients are running. Only the new clients take them.
+    auto file = std::ifstream{settings_file_};
+    if (!file.is_open()) {
+        return std::string{};
+    }
+    return std::string(std::istreambuf_iterator<char>(file),
+                           std::istreambuf_iterator<char>());
+}
+
+std::shared_ptr<const std::string> SelfPlayCoordinator::GetWeights(std::uint64_t &hash) {
+    std::lock_guard<std::mutex> lock(weights_mutex_);
+
+    const auto file_time = GetFileTime(weights_file_);
+    if (file_time != 0 && file_time != weights_time_) {
+        auto file = std::ifstream{weights_file_, std::ios_base::binary};
+        auto data = std::string(std::istreambuf_iterator<char>(file),
+                                    std::istreambuf_iterator<char>());
+        if (file.is_open() && !data.empty()) {
+            weights_time_ = file_time;
+            weights_hash_ = GetDataHash(data.data(), data.size());
+            weights_ = std::make_shared<const std::string>(std::move(data));
+            LOGGING << Format("Serve the weights %s, hash %016llx.\n",
+                                  weights_file_.c_str(), (unsigned long long)weights_hash_);
+        }
+    }
+    hash = weights_ ? weights_hash_ : 0;
+    return weights_;
+}
+
+bool SelfPlayCoordinator::SaveChunk(const std::string &name, const char *data, size_t size) {
+    if (!IsValidName(name)) {
+        return false;
+    }
+
+    // Keep the layout of the local self-play, the chunks of one client
+    // are in the directory of its hash.
+    auto directory = data_directory_;
+    const auto pos = name.find('_');
+    if (pos != std::string::npos && pos > 0) {
+        directory = ConnectPath(data_directory_, name.substr(0, pos));
+        if (!IsDirectoryExist(directory)) {
+            try {
+                CreateDirectory(directory);
+            } catch (...) {
+                return false;
+            }
+        }
+    }
+    // The hidden file is skipped by the trainer until it is renamed.
+    const auto filename = ConnectPath(directory, name);
+    const auto tmp_name = ConnectPath(directory, "." + name + ".tmp");
+
+    auto file = std::ofstream{tmp_name, std::ios_base::binary | std::ios_base::trunc};
+    file.write(data, size);
+    file.close();
+    if (file.fail() || std::rename(tmp_name.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp_name.c_str());
+        return false;
+    }
+
+    const auto num_chunks = num_chunks_.fetch_add(1) + 1;
+    if (num_chunks % 100 == 0) {
+        LOGGING << Format("[%s] Received %lld chunks.\n",
+                              CurrentDateTime().c_str(), (long long)num_chunks);
+    }
+    return true;
+}
+
+bool SelfPlayCoordinator::AppendSgf(const std::string &name, const char *data, size_t size) {
+    if (!IsValidName(name)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(sgf_mutex_);
+
+    auto file = std::ofstream{ConnectPath(sgf_directory_, name),
+                                  std::ios_base::binary | std::ios_base::app};
+    file.write(data, size);
+    file.close();
+    return !file.fail();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "utils/socket.h"
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Serve the SelfPlayClient of many hosts. It hands out the settings
+// and the current weights, and saves the uploaded chunks and SGFs in
+// the target directory like the local self-play. The weights file is
+// read again when it is changed, so the clients follow the training.
+class SelfPlayCoordinator {
+public:
+    SelfPlayCoordinator();
+
+private:
+    bool Initialize();
+    void Loop();
+
+    // Answer the requests of one client until it is disconnected.
+    void ServeClient(Socket socket);
+
+    std::string GetSettings() const;
+
+    // Return the hash and the content of the current weights. The
+    // hash is zero if there are no weights.
+    std::shared_ptr<const std::string> GetWeights(std::uint64_t &hash);
+
+    // Save the uploaded file. The chunk is renamed after it is
+    // written, so the trainer never reads the half chunk.
+    bool SaveChunk(const std::string &name, const char *data, size_t size);
+    bool AppendSgf(const std::string &name, const char *data, size_t size);
+
+    std::string weights_file_;
+    std::string settings_file_;
+    std::string data_directory_;
+    std::string sgf_directory_;
+
+    std::mutex weights_mutex_;
+    std::time_t weights_time_{0};
+    std::uint64_t weights_hash_{0};
+    std::shared_ptr<const std::string> weights_;
+
+    std::mutex sgf_mutex_;
+
+    std::atomic<std::int64_t> num_chunks_{0};
+};
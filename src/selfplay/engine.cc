@@ -5,10 +5,12 @@
 #include "game/sgf.h"
 #include "config.h"
 
+#include <algorithm>
 #include <sstream>
 
 void Engine::Initialize() {
-    parallel_games_ = GetOption<int>("parallel_games");
+    parallel_games_ = std::max(GetOption<int>("parallel_games"), 1);
+    games_per_worker_ = GetOption<int>("games_per_worker");
 
     if (!network_) {
         network_ = std::make_unique<Network>();
@@ -22,13 +24,25 @@ void Engine::Initialize() {
                                 GetOption<float>("defualt_komi"));
     }
 
+    aborted_ = std::vector<std::atomic<bool>>(parallel_games_);
+    for (auto &aborted : aborted_) {
+        aborted.store(false);
+    }
+
     search_pool_.clear();
     for (int i = 0; i < parallel_games_; ++i) {
         search_pool_.emplace_back(std::make_unique<Search>(game_pool_[i], *network_));
     }
 
-    ThreadPool::Get(GetOption<int>("threads") * parallel_games_);
+    if (games_per_worker_ > 1) {
+        // The games played by turns do not use the search threads. The
+        // pool only releases the trees.
+        ThreadPool::Get((parallel_games_ + games_per_worker_ - 1) / games_per_worker_);
+    } else {
+        ThreadPool::Get(GetOption<int>("threads") * parallel_games_);
+    }
 
+    resign_stats_.Initialize();
     ParseQueries();
 }
 
@@ -103,16 +117,31 @@ void Engine::SaveSgf(std::string filename, int g) {
     Sgf::Get().ToFile(filename, game_pool_[g]);
 }
 
+std::string Engine::GetGameRecord(int g, bool compact) {
+    Handel(g);
+    return compact ? Sgf::Get().ToRecordString(game_pool_[g]) :
+                         Sgf::Get().ToString(game_pool_[g]);
+}
+
 void Engine::GatherTrainingData(std::vector<Training> &chunk, int g) {
     Handel(g);
     search_pool_[g]->GatherTrainingBuffer(chunk, game_pool_[g]);
+    resign_stats_.Add(search_pool_[g]->GetResignAnalysis());
 }
 
 void Engine::PrepareGame(int g) {
     Handel(g);
     auto &state = game_pool_[g];
 
+    // Swap in the new weights between games.
+    network_->UpdateWeights();
     state.ClearBoard();
+    search_pool_[g]->ClearTranspositionTable();
+    aborted_[g].store(false);
+
+    if (resign_stats_.Calibrating()) {
+        search_pool_[g]->SetResignThreshold(resign_stats_.GetThreshold());
+    }
 
     constexpr std::uint32_t kRange = 1000000;
     std::uint32_t rand = Random<>::Get().RandFix<kRange>();
@@ -142,11 +171,75 @@ void Engine::PrepareGame(int g) {
 void Engine::Selfplay(int g) {
     Handel(g);
     auto &state = game_pool_[g];
-    while (!state.IsGameOver()) {
+    while (!state.IsGameOver() && !aborted_[g].load()) {
         state.PlayMove(search_pool_[g]->GetSelfPlayMove());
     }
 }
 
+void Engine::SelfplayByTurns(std::vector<int> games,
+                             std::function<bool(int)> game_over) {
+    for (const int g : games) {
+        Handel(g);
+    }
+
+    // Start searching the next move of the game. Play the moves
+    // which are decided without searching. Return false if the
+    // slot is closed.
+    const auto BeginMove = [&](int g) -> bool {
+        auto &state = game_pool_[g];
+        while (true) {
+            if (state.IsGameOver() || aborted_[g].load()) {
+                if (!game_over(g)) {
+                    return false;
+                }
+                continue;
+            }
+            if (search_pool_[g]->BeginSelfPlayMove()) {
+                return true;
+            }
+            state.PlayMove(search_pool_[g]->EndSelfPlayMove());
+        }
+    };
+
+    auto searching = std::vector<int>{};
+    auto next_searching = std::vector<int>{};
+
+    for (const int g : games) {
+        if (BeginMove(g)) {
+            searching.emplace_back(g);
+        }
+    }
+
+    while (!searching.empty()) {
+        for (const int g : searching) {
+            search_pool_[g]->SubmitSelfPlayStep();
+        }
+
+        next_searching.clear();
+        for (const int g : searching) {
+            if (search_pool_[g]->CollectSelfPlayStep()) {
+                next_searching.emplace_back(g);
+                continue;
+            }
+            game_pool_[g].PlayMove(search_pool_[g]->EndSelfPlayMove());
+            if (BeginMove(g)) {
+                next_searching.emplace_back(g);
+            }
+        }
+        std::swap(searching, next_searching);
+    }
+}
+
+void Engine::AbortGame(int g) {
+    Handel(g);
+    aborted_[g].store(true);
+}
+
+void Engine::DiscardGame(int g) {
+    Handel(g);
+    search_pool_[g]->ClearTrainingBuffer();
+}
+
 void Engine::SetNormalGame(int g) {
     Handel(g);
     auto &state = game_pool_[g];
@@ -178,6 +271,56 @@ void Engine::SetFairKomi(int g) {
     Handel(g);
     auto &state = game_pool_[g];
 
+    // The games of the same board size and handicaps share the fair
+    // komi, so most games start without the search. When the weights
+    // are changed or the entry is old, only one game estimates it
+    // again. The other games keep the old komi meanwhile.
+    const auto key = std::make_pair(state.GetBoardSize(), state.GetHandicap());
+    const auto weights_time = network_->GetWeightsTime();
+    bool compute = true;
+    float komi = 0.f;
+    {
+        std::lock_guard<std::mutex> lock(fair_komi_mutex_);
+        auto it = fair_komi_table_.find(key);
+        if (it != std::end(fair_komi_table_)) {
+            auto &entry = it->second;
+            komi = entry.komi;
+            entry.games += 1;
+            compute = !entry.refreshing &&
+                          (entry.weights_time != weights_time ||
+                               entry.games >= kFairKomiRefreshGames);
+            entry.refreshing |= compute;
+        }
+    }
+
+    if (compute) {
+        const float fair_komi = ComputeFairKomi(g);
+
+        std::lock_guard<std::mutex> lock(fair_komi_mutex_);
+        auto it = fair_komi_table_.find(key);
+        if (it == std::end(fair_komi_table_)) {
+            fair_komi_table_[key] = FairKomiEntry{fair_komi, weights_time, 0, false};
+        } else {
+            auto &entry = it->second;
+            if (entry.weights_time == weights_time) {
+                // Smooth the noise of the single estimation.
+                entry.komi += 0.25f * (fair_komi - entry.komi);
+            } else {
+                entry.komi = fair_komi;
+            }
+            entry.weights_time = weights_time;
+            entry.games = 0;
+            entry.refreshing = false;
+        }
+        komi = fair_komi_table_[key].komi;
+    }
+    state.SetKomi(AdjustKomi<int>(komi));
+}
+
+float Engine::ComputeFairKomi(int g) {
+    Handel(g);
+    auto &state = game_pool_[g];
+
     auto result = search_pool_[g]->Computation(400, Search::kNoNoise);
     auto komi = state.GetKomi();
     auto score_lead = result.root_final_score;
@@ -185,8 +328,7 @@ void Engine::SetFairKomi(int g) {
     if (state.GetToMove() == kWhite) {
         score_lead = 0.0f - score_lead;
     }
-
-    state.SetKomi(AdjustKomi<int>(komi + score_lead));
+    return komi + score_lead;
 }
 
 int Engine::GetHandicaps(int g) {
@@ -207,6 +349,18 @@ int Engine::GetParallelGames() const {
     return parallel_games_;
 }
 
+int Engine::GetGamesPerWorker() const {
+    return games_per_worker_;
+}
+
+std::time_t Engine::GetWeightsTime() const {
+    return network_->GetWeightsTime();
+}
+
+std::string Engine::GetResignSummary() const {
+    return resign_stats_.GetSummary();
+}
+
 void Engine::Handel(int g) {
     if (g < 0 || g >= parallel_games_) {
         throw std::runtime_error("Selection is out of array.");
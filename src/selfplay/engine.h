@@ -3,21 +3,55 @@
 #include "game/game_state.h"
 #include "game/types.h"
 #include "mcts/search.h"
+#include "selfplay/resign_stats.h"
 
+#include <atomic>
+#include <functional>
 #include <vector>
 #include <memory>
+#include <map>
+#include <mutex>
+#include <utility>
 
 class Engine {
 public:
     void Initialize();
 
     void SaveSgf(std::string filename, int g);
+
+    // Return the SGF or the compact record of the game g.
+    std::string GetGameRecord(int g, bool compact);
     void GatherTrainingData(std::vector<Training> &chunk, int g);
     void PrepareGame(int g);
     void Selfplay(int g);
 
+    // Play the prepared games by turns in this thread. The leaves of
+    // all games are submitted before waiting for any of them, so they
+    // fill one network batch. The callback is called when a game is
+    // over. It prepares the next game of this slot and returns true,
+    // or returns false to close the slot.
+    void SelfplayByTurns(std::vector<int> games,
+                         std::function<bool(int)> game_over);
+
+    // Stop the game g after its current move. The game is over for
+    // the self-play loops. The next PrepareGame clears it.
+    void AbortGame(int g);
+
+    // Drop the training data of the game g.
+    void DiscardGame(int g);
+
     int GetParallelGames() const;
 
+    // Number of games played by turns in one thread. Zero or one
+    // means every game has its own thread.
+    int GetGamesPerWorker() const;
+
+    // The modification time of the weights which play the games.
+    std::time_t GetWeightsTime() const;
+
+    // The resign analysis of the finished games.
+    std::string GetResignSummary() const;
+
 private:
     struct BoardQuery {
         int board_size;
@@ -30,16 +64,30 @@ private:
         float probabilities;
     };
 
+    // The fair komi of the handicap games of one board size and
+    // handicaps, estimated by the current weights.
+    struct FairKomiEntry {
+        float komi;
+        std::time_t weights_time;
+        int games;
+        bool refreshing;
+    };
+
+    // Estimate the fair komi again after this many games.
+    static constexpr int kFairKomiRefreshGames = 50;
+
     void ParseQueries();
     void SetNormalGame(int g);
     void SetHandicapGame(int g, int handicaps);
 
     void SetFairKomi(int g);
+    float ComputeFairKomi(int g);
     int GetHandicaps(int g);
 
     void Handel(int g);
 
     int parallel_games_;
+    int games_per_worker_;
 
     std::vector<BoardQuery> board_queries_;
     std::vector<HandicapQuery> handicap_queries_;
@@ -47,4 +95,10 @@ private:
     std::unique_ptr<Network> network_{nullptr};
     std::vector<std::unique_ptr<Search>> search_pool_;
     std::vector<GameState> game_pool_;
+    std::vector<std::atomic<bool>> aborted_;
+
+    ResignStats resign_stats_;
+
+    std::mutex fair_komi_mutex_;
+    std::map<std::pair<int, int>, FairKomiEntry> fair_komi_table_;
 };
@@ -0,0 +1,301 @@
+#include "selfplay/match_pipe.h"
+#include "game/sgf.h"
+#include "utils/threadpool.h"
+#include "utils/filesystem.h"
+#include "utils/random.h"
+#include "utils/format.h"
+#include "utils/log.h"
+#include "utils/time.h"
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+MatchPipe::MatchPipe() {
+    if (Initialize()) {
+        Loop();
+    }
+    networks_[0].Destroy();
+    networks_[1].Destroy();
+}
+
+bool MatchPipe::Initialize() {
+    // Close search verbose.
+    SetOption("analysis_verbose", false);
+
+    // The games are played by turns, so they do not use the search
+    // threads.
+    SetOption("threads", 1);
+
+    const auto weights = GetOption<std::string>("weights_file");
+    const auto opponent_weights = GetOption<std::string>("opponent_weights_file");
+    if (weights.empty() || opponent_weights.empty()) {
+        LOGGING << "The match requires both --weights and --opponent-weights.\n";
+        return false;
+    }
+
+    networks_[0].Initialize(weights);
+    networks_[1].Initialize(opponent_weights);
+    if (!networks_[0].Valid() || !networks_[1].Valid()) {
+        LOGGING << "Fail to load the weights of the match.\n";
+        return false;
+    }
+
+    const int board_size = GetOption<int>("defualt_boardsize");
+    const int net_size = std::max(board_size, GetOption<int>("fixed_nn_boardsize"));
+    networks_[0].Reload(net_size);
+    networks_[1].Reload(net_size);
+
+    max_games_ = GetOption<int>("num_games");
+    parallel_games_ = std::max(1, std::min(GetOption<int>("parallel_games"), max_games_));
+    games_per_worker_ = std::max(1, GetOption<int>("games_per_worker"));
+
+    const auto alpha = GetOption<float>("sprt_alpha");
+    const auto beta = GetOption<float>("sprt_beta");
+    sprt_ = GetOption<bool>("sprt");
+    sprt_elo0_ = GetOption<float>("sprt_elo0");
+    sprt_elo1_ = GetOption<float>("sprt_elo1");
+    sprt_lower_ = std::log(beta / (1.0 - alpha));
+    sprt_upper_ = std::log((1.0 - beta) / alpha);
+    if (sprt_ && sprt_elo1_ <= sprt_elo0_) {
+        LOGGING << "The --sprt-elo1 must be greater than the --sprt-elo0.\n";
+        return false;
+    }
+
+    for (int g = 0; g < parallel_games_; ++g) {
+        auto game = std::make_unique<MatchGame>();
+        game->state.Reset(board_size, GetOption<float>("defualt_komi"));
+        game->searches[0] = std::make_unique<Search>(game->state, networks_[0]);
+        game->searches[1] = std::make_unique<Search>(game->state, networks_[1]);
+        games_.emplace_back(std::move(game));
+    }
+
+    // The pool only releases the trees.
+    ThreadPool::Get((parallel_games_ + games_per_worker_ - 1) / games_per_worker_);
+
+    const auto target_directory = GetOption<std::string>("target_directory");
+    if (!target_directory.empty()) {
+        if (!IsDirectoryExist(target_directory)) {
+            CreateDirectory(target_directory);
+        }
+        auto ss = std::ostringstream{};
+        ss << std::hex << std::uppercase << Random<>::Get().Generate();
+        sgf_filename_ = ConnectPath(target_directory, "match_" + ss.str() + ".sgf");
+    }
+    return true;
+}
+
+void MatchPipe::Loop() {
+    if (max_games_ <= 0) {
+        LOGGING << "The number of match games must be greater than zero.\n";
+        return;
+    }
+
+    LOGGING << "============================================\n";
+    LOGGING << Format("Match %s against %s, %d games.\n",
+                          GetOption<std::string>("weights_file").c_str(),
+                          GetOption<std::string>("opponent_weights_file").c_str(),
+                          max_games_);
+    if (!sgf_filename_.empty()) {
+        LOGGING << Format("Save the games in %s.\n", sgf_filename_.c_str());
+    }
+    if (sprt_) {
+        LOGGING << Format("SPRT of Elo %.1f against %.1f, the LLR bounds are [%.2f, %.2f].\n",
+                              sprt_elo0_, sprt_elo1_, sprt_lower_, sprt_upper_);
+    }
+    LOGGING << "Starting time is: " << CurrentDateTime() << std::endl;
+
+    auto workers = std::vector<std::thread>{};
+    for (int first = 0; first < parallel_games_; first += games_per_worker_) {
+        const int last = std::min(first + games_per_worker_, parallel_games_);
+        workers.emplace_back([this, first, last]() { Worker(first, last); });
+    }
+    for (auto &t : workers) {
+        t.join();
+    }
+
+    LOGGING << '[' << CurrentDateTime() << ']'
+                << " Finish the match. " << GetSummary() << std::endl;
+    if (sprt_) {
+        if (llr_ >= sprt_upper_) {
+            LOGGING << Format("SPRT accepts H1, the first network is stronger by Elo %.1f.\n", sprt_elo1_);
+        } else if (llr_ <= sprt_lower_) {
+            LOGGING << Format("SPRT accepts H0, the first network is not stronger than Elo %.1f.\n", sprt_elo0_);
+        } else {
+            LOGGING << "SPRT is not decided.\n";
+        }
+    }
+}
+
+void MatchPipe::Worker(int first, int last) {
+    // The search of the network to move.
+    const auto CurrentSearch = [this](int g) -> Search& {
+        auto &game = *games_[g];
+        const int net = game.state.GetToMove() == kBlack ?
+                            game.black_net : 1 - game.black_net;
+        return *game.searches[net];
+    };
+
+    // Start searching the next move of the game. Play the moves
+    // which are decided without searching. Return false if the
+    // slot is closed.
+    const auto BeginMove = [this, &CurrentSearch](int g) -> bool {
+        auto &game = *games_[g];
+        while (true) {
+            if (game.state.IsGameOver()) {
+                FinishGame(g);
+                if (!NextGame(g)) {
+                    return false;
+                }
+                continue;
+            }
+            auto &search = CurrentSearch(g);
+            if (search.BeginMatchMove()) {
+                return true;
+            }
+            game.state.PlayMove(search.EndMatchMove());
+        }
+    };
+
+    auto searching = std::vector<int>{};
+    auto next_searching = std::vector<int>{};
+
+    for (int g = first; g < last; ++g) {
+        if (NextGame(g) && BeginMove(g)) {
+            searching.emplace_back(g);
+        }
+    }
+
+    while (!searching.empty()) {
+        if (decided_.load(std::memory_order_relaxed)) {
+            // The running games can not change the decision.
+            for (const int g : searching) {
+                CurrentSearch(g).EndMatchMove();
+            }
+            break;
+        }
+        for (const int g : searching) {
+            CurrentSearch(g).SubmitSelfPlayStep();
+        }
+
+        next_searching.clear();
+        for (const int g : searching) {
+            auto &search = CurrentSearch(g);
+            if (search.CollectSelfPlayStep()) {
+                next_searching.emplace_back(g);
+                continue;
+            }
+            games_[g]->state.PlayMove(search.EndMatchMove());
+            if (BeginMove(g)) {
+                next_searching.emplace_back(g);
+            }
+        }
+        std::swap(searching, next_searching);
+    }
+}
+
+bool MatchPipe::NextGame(int g) {
+    if (decided_.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    const int index = started_games_.fetch_add(1);
+    if (index >= max_games_) {
+        return false;
+    }
+    auto &game = *games_[g];
+
+    // Take black by turns, so both networks play the same number of
+    // games of each color.
+    game.black_net = index % 2;
+    game.state.ClearBoard();
+    return true;
+}
+
+void MatchPipe::FinishGame(int g) {
+    auto &game = *games_[g];
+    auto &state = game.state;
+
+    if (state.GetWinner() == kUndecide) {
+        // The game is over by the passes. Score it.
+        const auto score = state.GetFinalScore();
+        if (std::abs(score) < 1e-4f) {
+            state.SetWinner(kDraw);
+        } else {
+            state.SetWinner(score > 0 ? kBlackWon : kWhiteWon);
+        }
+    }
+
+    const int winner = state.GetWinner();
+    const int first_color = game.black_net == 0 ? kBlack : kWhite;
+    const auto record = sgf_filename_.empty() ?
+                            std::string{} : Sgf::Get().ToString(state);
+
+    std::lock_guard<std::mutex> lock(result_mutex_);
+    if (decided_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (winner == kDraw) {
+        draws_ += 1;
+    } else if (winner == first_color) {
+        wins_ += 1;
+    } else {
+        losses_ += 1;
+    }
+    played_games_ += 1;
+
+    if (!record.empty()) {
+        auto file = std::ofstream{sgf_filename_, std::ios_base::app};
+        file << record << '\n';
+    }
+    if (sprt_ && UpdateSprt()) {
+        decided_.store(true, std::memory_order_relaxed);
+    }
+    if (played_games_ % 10 == 0) {
+        LOGGING << '[' << CurrentDateTime() << ']' << ' ' << GetSummary() << std::endl;
+    }
+}
+
+bool MatchPipe::UpdateSprt() {
+    // The normal approximation of the trinomial results, as the
+    // usual engine testing frameworks do.
+    const double n = played_games_;
+    const double mean = (wins_ + 0.5 * draws_) / n;
+    const double var = (wins_ * (1.0 - mean) * (1.0 - mean) +
+                            draws_ * (0.5 - mean) * (0.5 - mean) +
+                            losses_ * mean * mean) / n;
+    if (var <= 0.0) {
+        // All results are the same so far.
+        llr_ = 0.0;
+        return false;
+    }
+
+    const auto EloToScore = [](double elo) {
+        return 1.0 / (1.0 + std::pow(10.0, -elo / 400.0));
+    };
+    const double s0 = EloToScore(sprt_elo0_);
+    const double s1 = EloToScore(sprt_elo1_);
+    llr_ = n * (s1 - s0) * (2.0 * mean - s0 - s1) / (2.0 * var);
+    return llr_ <= sprt_lower_ || llr_ >= sprt_upper_;
+}
+
+std::string MatchPipe::GetSummary() const {
+    const int games = std::max(played_games_, 1);
+    const double score = (wins_ + 0.5 * draws_) / games;
+
+    // The Elo difference of the score. It is unbounded at the sweep.
+    auto elo = std::string{"inf"};
+    if (score <= 0.0) {
+        elo = "-inf";
+    } else if (score < 1.0) {
+        elo = Format("%+.1f", -400.0 * std::log10(1.0 / score - 1.0));
+    }
+    auto out = Format("Played %d games, %d wins, %d losses, %d draws, score %.3f, Elo %s.",
+                          played_games_, wins_, losses_, draws_, score, elo.c_str());
+    if (sprt_) {
+        out += Format(" LLR %.2f [%.2f, %.2f].", llr_, sprt_lower_, sprt_upper_);
+    }
+    return out;
+}
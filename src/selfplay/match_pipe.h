@@ -0,0 +1,87 @@
+#pragma once
+
+#include "game/game_state.h"
+#include "mcts/search.h"
+#include "neural/network.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Play the match games between two networks in one process, started
+// with --mode match. The --weights network plays against the
+// --opponent-weights network, and they take black by turns. Every
+// network has one pipe for all games, and every worker thread plays
+// its games by turns like the self-play games, so the leaves of all
+// games fill the same batches.
+//
+// With --sprt, the match is the sequential probability ratio test of
+// H0: the Elo difference is --sprt-elo0, against H1: it is --sprt-elo1.
+// The match stops as soon as the log likelihood ratio leaves the
+// bounds of --sprt-alpha and --sprt-beta, and the running games are
+// dropped.
+class MatchPipe {
+public:
+    MatchPipe();
+
+private:
+    struct MatchGame {
+        GameState state;
+
+        // The search of each network. Both of them search the same
+        // game state.
+        std::unique_ptr<Search> searches[2];
+
+        // The network which plays black.
+        int black_net{0};
+    };
+
+    // Load both networks. Return false if fail.
+    bool Initialize();
+    void Loop();
+
+    // Play the games of one worker by turns.
+    void Worker(int first, int last);
+
+    // Prepare the next game of the slot g. Return false if there are
+    // enough games.
+    bool NextGame(int g);
+
+    // Score the finished game, and save its SGF.
+    void FinishGame(int g);
+
+    std::string GetSummary() const;
+
+    // Update the log likelihood ratio with the current results. Return
+    // true if the test is decided.
+    bool UpdateSprt();
+
+    Network networks_[2];
+    std::vector<std::unique_ptr<MatchGame>> games_;
+
+    int max_games_;
+    int parallel_games_;
+    int games_per_worker_;
+    std::string sgf_filename_;
+
+    std::atomic<int> started_games_{0};
+
+    // The test is decided, so the workers drop their games.
+    std::atomic<bool> decided_{false};
+
+    bool sprt_;
+    double sprt_elo0_;
+    double sprt_elo1_;
+    double sprt_lower_;
+    double sprt_upper_;
+    double llr_{0.0};
+
+    // The results of the first network.
+    std::mutex result_mutex_;
+    int played_games_{0};
+    int wins_{0};
+    int losses_{0};
+    int draws_{0};
+};
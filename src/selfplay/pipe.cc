@@ -3,31 +3,64 @@
 #include "utils/filesystem.h"
 #include "utils/log.h"
 #include "utils/gzip_helper.h"
+#include "neural/training_shard.h"
 #include "config.h"
 
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <limits>
+
+constexpr int SelfPlayPipe::kGamesPerChunk;
+constexpr size_t SelfPlayPipe::kRecordFlushSize;
+constexpr int SelfPlayPipe::kGamesPerRecordFile;
+
+static std::string GetBaseName(const std::string &filename) {
+    const auto pos = filename.find_last_of("/\\");
+    return pos == std::string::npos ? filename : filename.substr(pos + 1);
+}
+
 SelfPlayPipe::SelfPlayPipe() {
-    Initialize();
-    Loop();
+    if (Initialize()) {
+        Loop();
+    }
 }
 
-void SelfPlayPipe::Initialize() {
+bool SelfPlayPipe::Initialize() {
     // Close search verbose.
     SetOption("analysis_verbose", false);
 
     // Force that one game use one thread.
     SetOption("threads", 1);
 
+    if (GetOption<std::string>("mode") == "selfplay-client" &&
+            !InitializeClient()) {
+        return false;
+    }
+
     engine_.Initialize();
 
     // TODO: Re-compute the NN cache size.
 
     target_directory_ = GetOption<std::string>("target_directory");
     max_games_ = GetOption<int>("num_games");
+    if (client_ && max_games_ == 0) {
+        // The client keeps playing until it is stopped.
+        max_games_ = std::numeric_limits<int>::max();
+    }
+    overflow_games_ = GetOption<bool>("overflow_games");
+    overflow_ = std::make_unique<std::atomic<bool>[]>(engine_.GetParallelGames());
+    for (int g = 0; g < engine_.GetParallelGames(); ++g) {
+        overflow_[g].store(false);
+    }
     accmulate_games_.store(0, std::memory_order_relaxed);
     played_games_.store(0, std::memory_order_relaxed);
     running_threads_.store(0, std::memory_order_relaxed);
 
     chunk_games_ = 0;
+    writer_running_ = false;
+    writer_failed_.store(false, std::memory_order_relaxed);
 
     auto ss = std::ostringstream();
     ss << std::hex << std::uppercase
@@ -37,47 +70,337 @@ void SelfPlayPipe::Initialize() {
     sgf_directory_ = ConnectPath(target_directory_, "sgf");
     data_directory_ = ConnectPath(target_directory_, "data");
     data_directory_hash_ = ConnectPath(data_directory_, filename_hash_);
+    compact_record_ = GetOption<bool>("compact_game_record");
+    sgf_games_ = 0;
+    sgf_file_index_ = 0;
+    sgf_filename_ = GetRecordFilename(sgf_file_index_);
+    sgf_upload_index_ = sgf_file_index_;
+    return true;
+}
+
+std::string SelfPlayPipe::GetRecordFilename(int index) const {
+    auto name = filename_hash_;
+    if (index > 0) {
+        name += "_" + std::to_string(index);
+    }
+    name += compact_record_ ? ".rec" : ".sgf";
+    return ConnectPath(sgf_directory_, name);
+}
+
+bool SelfPlayPipe::InitializeClient() {
+    client_ = std::make_unique<SelfPlayClient>(GetOption<std::string>("coordinator"));
+    if (!client_->Valid()) {
+        LOGGING << "Please give the coordinator address, <host:port>." << std::endl;
+        return false;
+    }
+
+    // The target directory only keeps the weights and the chunks which
+    // are not uploaded yet.
+    auto directory = GetOption<std::string>("target_directory");
+    if (directory.empty()) {
+        directory = "selfplay-client";
+        SetOption("target_directory", directory);
+    }
+    if (!IsDirectoryExist(directory)) {
+        CreateDirectory(directory);
+    }
+
+    const auto weights_file = ConnectPath(directory, "weights");
+    SetOption("weights_file", weights_file);
+    SetOption("weights_watch", true);
+
+    // Use the old weights if the coordinator is not ready, the poller
+    // replaces them later.
+    while (!client_->FetchWeights(weights_file) &&
+               GetFileSize(weights_file) == 0) {
+        LOGGING << "Waiting for the weights of the coordinator..." << std::endl;
+        std::this_thread::sleep_for(std::chrono::seconds(10));
+    }
+    return true;
 }
 
 bool SelfPlayPipe::SaveChunk(const int out_id,
-                                 std::vector<Training> &chunk) {
+                                 std::vector<Training> &chunk,
+                                 std::string &filename) {
+    if (GetOption<bool>("indexed_chunk")) {
+        return SaveShard(out_id, chunk, filename);
+    }
+
+    const auto binary = GetOption<bool>("binary_chunk");
     auto out_name = ConnectPath(
                         data_directory_hash_,
                         filename_hash_ +
                             "_" +
                             std::to_string(out_id) + 
-                            ".txt");
+                            (binary ? ".bin" : ".txt"));
 
-    auto oss = std::ostringstream{};
-    for (auto &data : chunk) {
-        data.StreamOut(oss);
-    }
+    const auto WriteChunk = [&](std::ostream &out) {
+        for (auto &data : chunk) {
+            if (binary) {
+                data.BinaryStreamOut(out);
+            } else {
+                data.StreamOut(out);
+            }
+        }
+    };
 
     bool is_open = true;
 
     try {
-        auto buf = oss.str();
-        SaveGzip(out_name, buf);
+        // Compress the records while writing them.
+        GzipOutputStream out(out_name);
+        WriteChunk(out);
+        out.Close();
+        filename = out_name + ".gz";
     } catch (const char *err) {
         LOGGING << err << "\n";
 
         auto file = std::ofstream{};
-        file.open(out_name, std::ios_base::app);
+        file.open(out_name, binary ? std::ios_base::app | std::ios_base::binary
+                                   : std::ios_base::app);
 
         if (!file.is_open()) {
             is_open = false;
             LOGGING << "Fail to create the file: " << out_name << '!' << std::endl; 
         } else {
-            for (auto &data : chunk) {
-                data.StreamOut(file);
-            }
+            WriteChunk(file);
             file.close();
+            filename = out_name;
         }
     }
     chunk.clear();
     return is_open;
 }
 
+bool SelfPlayPipe::SaveShard(const int out_id,
+                                 std::vector<Training> &chunk,
+                                 std::string &filename) {
+    const auto out_name = ConnectPath(
+                              data_directory_hash_,
+                              filename_hash_ +
+                                  "_" +
+                                  std::to_string(out_id) +
+                                  ".shard");
+
+    // The shard is tagged with the current weights, so the tools can
+    // window the data by the generation.
+    auto writer = TrainingShardWriter{};
+    bool success = writer.Open(out_name, engine_.GetWeightsTime());
+    for (auto &data : chunk) {
+        success = success && writer.Append(data);
+    }
+    success = writer.Close() && success;
+
+    if (!success) {
+        LOGGING << "Fail to save the shard: " << out_name << '!' << std::endl;
+    }
+    filename = out_name;
+    chunk.clear();
+    return success;
+}
+
+void SelfPlayPipe::UploadResults(const std::string &chunk_file) {
+    auto file = std::ifstream{chunk_file, std::ios_base::binary};
+    const auto data = std::string(std::istreambuf_iterator<char>(file),
+                                      std::istreambuf_iterator<char>());
+    file.close();
+
+    // Retry few times, the coordinator may be restarting. The game
+    // workers wait if too many chunks are pending.
+    constexpr int kMaxTries = 5;
+    bool uploaded = false;
+    for (int i = 0; i < kMaxTries; ++i) {
+        if ((uploaded = client_->UploadChunk(GetBaseName(chunk_file), data))) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(5 * (i + 1)));
+    }
+    if (uploaded) {
+        std::remove(chunk_file.c_str());
+    } else {
+        LOGGING << "Fail to upload the chunk, keep it in " << chunk_file << '.' << std::endl;
+    }
+
+    // Upload the SGFs which are saved after the last uploading. The
+    // games are flushed under the SGF lock, so they are complete.
+    const auto sgf_filename = GetRecordFilename(sgf_upload_index_);
+    auto sgf = std::string{};
+    auto switch_file = false;
+    {
+        std::lock_guard<std::mutex> lock(sgf_mutex_);
+        auto sgf_file = std::ifstream{sgf_filename, std::ios_base::binary};
+        sgf_file.seekg(sgf_uploaded_);
+        sgf.assign(std::istreambuf_iterator<char>(sgf_file),
+                       std::istreambuf_iterator<char>());
+
+        // The old file is never written again.
+        switch_file = sgf_upload_index_ != sgf_file_index_;
+    }
+    if (!sgf.empty() &&
+            !client_->UploadSgf(GetBaseName(sgf_filename), sgf)) {
+        return;
+    }
+    sgf_uploaded_ += sgf.size();
+    if (switch_file) {
+        sgf_upload_index_ += 1;
+        sgf_uploaded_ = 0;
+    }
+}
+
+void SelfPlayPipe::PollWeightsLoop() {
+    constexpr auto kPollInterval = std::chrono::seconds(30);
+    const auto weights_file = GetOption<std::string>("weights_file");
+
+    std::unique_lock<std::mutex> lock(poller_mutex_);
+    while (!poller_cv_.wait_for(lock, kPollInterval,
+                                    [this]() { return !poller_running_; })) {
+        lock.unlock();
+        if (client_->FetchWeights(weights_file)) {
+            LOGGING << '[' << CurrentDateTime() << ']' << " Downloaded the new weights." << std::endl;
+        }
+        lock.lock();
+    }
+}
+
+void SelfPlayPipe::PushChunk(const int out_id,
+                                 std::vector<Training> &&chunk) {
+    // Every chunk holds the planes of 25 games, so only keep few
+    // of them in the queue.
+    constexpr size_t kMaxPendingChunks = 4;
+
+    std::unique_lock<std::mutex> lock(writer_mutex_);
+    writer_cv_.wait(lock, [this]() {
+        return pending_chunks_.size() < kMaxPendingChunks;
+    });
+    pending_chunks_.emplace_back(out_id, std::move(chunk));
+    lock.unlock();
+    writer_cv_.notify_all();
+}
+
+void SelfPlayPipe::WriterLoop() {
+    while (true) {
+        auto pending = PendingChunk{};
+        {
+            std::unique_lock<std::mutex> lock(writer_mutex_);
+            writer_cv_.wait(lock, [this]() {
+                return !pending_chunks_.empty() || !writer_running_;
+            });
+            if (pending_chunks_.empty()) {
+                // No more chunks and the game workers are finished.
+                return;
+            }
+            pending = std::move(pending_chunks_.front());
+            pending_chunks_.pop_front();
+        }
+        writer_cv_.notify_all();
+
+        auto filename = std::string{};
+        if (!SaveChunk(pending.first, pending.second, filename)) {
+            writer_failed_.store(true, std::memory_order_relaxed);
+        } else if (client_) {
+            UploadResults(filename);
+        }
+    }
+}
+
+bool SelfPlayPipe::NextGame(const int g) {
+    if (writer_failed_.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    if (accmulate_games_.fetch_add(1) < max_games_) {
+        overflow_[g].store(false);
+        engine_.PrepareGame(g);
+        return true;
+    }
+    if (!overflow_games_ || played_games_.load() >= max_games_) {
+        return false;
+    }
+
+    // Mark it before preparing it. The last counted game aborts
+    // all the marked games.
+    overflow_[g].store(true);
+    engine_.PrepareGame(g);
+    return played_games_.load() < max_games_;
+}
+
+void SelfPlayPipe::FinishGame(const int g, RecordBuffer &records) {
+    if (overflow_[g].load()) {
+        engine_.DiscardGame(g);
+        return;
+    }
+
+    auto out_id = -1;
+    auto full_chunk = std::vector<Training>{};
+    {
+        std::lock_guard<std::mutex> lock(data_mutex_);
+
+        engine_.GatherTrainingData(chunk_, g);
+
+        if ((chunk_games_+1) % kGamesPerChunk == 0) {
+            out_id = chunk_games_/kGamesPerChunk;
+            full_chunk = std::move(chunk_);
+            chunk_.clear();
+        }
+        chunk_games_ += 1;
+    }
+
+    // Only this worker touches the game, so it is serialized out of
+    // the locks.
+    records.data += engine_.GetGameRecord(g, compact_record_);
+    records.data += '\n';
+    records.games += 1;
+    if (records.data.size() >= kRecordFlushSize) {
+        FlushRecords(records);
+    }
+
+    if (out_id >= 0) {
+        // Save the current chunk in the writer thread, out
+        // of the data lock.
+        PushChunk(out_id, std::move(full_chunk));
+    }
+
+    const auto played_games = played_games_.fetch_add(1) + 1;
+
+    if (overflow_games_ && played_games >= max_games_) {
+        // Nothing is waiting for the extra games.
+        for (int i = 0; i < engine_.GetParallelGames(); ++i) {
+            if (overflow_[i].load()) {
+                engine_.AbortGame(i);
+            }
+        }
+    }
+
+    if (played_games % 100 == 0) {
+        // One message, so the lines of the other threads never
+        // split it.
+        LOGGING << '[' << CurrentDateTime() << ']' << " Played " << played_games << " games." << std::endl
+                    << engine_.GetResignSummary() << std::endl;
+    }
+}
+
+void SelfPlayPipe::FlushRecords(RecordBuffer &records) {
+    if (records.games == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(sgf_mutex_);
+
+    auto file = std::ofstream{sgf_filename_, std::ios_base::binary | std::ios_base::app};
+    file.write(records.data.data(), records.data.size());
+    file.close();
+    if (file.fail()) {
+        LOGGING << "Fail to save the games in " << sgf_filename_ << '.' << std::endl;
+    }
+
+    sgf_games_ += records.games;
+    if (sgf_games_ >= kGamesPerRecordFile) {
+        sgf_games_ = 0;
+        sgf_file_index_ += 1;
+        sgf_filename_ = GetRecordFilename(sgf_file_index_);
+    }
+    records.data.clear();
+    records.games = 0;
+}
+
 void SelfPlayPipe::Loop() {
     // Be sure that all data are ready.
     if (target_directory_.size() == 0) {
@@ -110,43 +433,49 @@ void SelfPlayPipe::Loop() {
         CreateDirectory(sgf_directory_);
     }
 
-    constexpr int kGamesPerChunk = 25;
+    writer_running_ = true;
+    writer_ = std::thread([this]() { WriterLoop(); });
 
-    for (int g = 0; g < engine_.GetParallelGames(); ++g) {
-        workers_.emplace_back(
-            [this, g]() -> void {
-                auto sgf_filename = ConnectPath(
-                                        sgf_directory_, filename_hash_ + ".sgf");
-                running_threads_.fetch_add(1, std::memory_order_relaxed);
-
-                while (accmulate_games_.fetch_add(1) < max_games_) {
-                    engine_.PrepareGame(g);
-                    engine_.Selfplay(g);
+    if (client_) {
+        poller_running_ = true;
+        poller_ = std::thread([this]() { PollWeightsLoop(); });
+    }
 
-                    {
-                        // Save the current chunk.
-                        std::lock_guard<std::mutex> lock(data_mutex_);
+    const int parallel_games = engine_.GetParallelGames();
+    const int games_per_worker = std::max(1, engine_.GetGamesPerWorker());
 
-                        engine_.GatherTrainingData(chunk_, g);
+    for (int w = 0; w * games_per_worker < parallel_games; ++w) {
+        workers_.emplace_back(
+            [this, w, parallel_games, games_per_worker]() -> void {
+                auto records = RecordBuffer{};
+                running_threads_.fetch_add(1, std::memory_order_relaxed);
 
-                        if ((chunk_games_+1) % kGamesPerChunk == 0) {
-                            if (!SaveChunk(chunk_games_/kGamesPerChunk, chunk_)) {
-                                break;
-                            }
-                        }
-                        engine_.SaveSgf(sgf_filename, g);
-                        chunk_games_ += 1;
+                if (games_per_worker == 1) {
+                    const int g = w;
+                    while (NextGame(g)) {
+                        engine_.Selfplay(g);
+                        FinishGame(g, records);
                     }
-
-                    played_games_.fetch_add(1);
-                    auto played_games = played_games_.load(std::memory_order_relaxed);
-
-                    if (played_games % 100 == 0) {
-                        std::lock_guard<std::mutex> lock(log_mutex_);
-                        LOGGING << '[' << CurrentDateTime() << ']' << " Played " << played_games << " games." << std::endl;
+                } else {
+                    // This thread plays its games by turns.
+                    auto games = std::vector<int>{};
+                    for (int g = w * games_per_worker;
+                             g < std::min((w+1) * games_per_worker, parallel_games); ++g) {
+                        if (NextGame(g)) {
+                            games.emplace_back(g);
+                        }
                     }
+                    engine_.SelfplayByTurns(games,
+                        [this, &records](int g) {
+                            FinishGame(g, records);
+                            return NextGame(g);
+                        });
                 }
 
+                // Before the last chunk, so the client uploads these
+                // games with it.
+                FlushRecords(records);
+
                 {
                     std::lock_guard<std::mutex> lock(data_mutex_);
                     running_threads_.fetch_sub(1, std::memory_order_relaxed);
@@ -154,7 +483,8 @@ void SelfPlayPipe::Loop() {
                     // The last thread saves the remaining training data.
                     if (!chunk_.empty() &&
                             running_threads_.load(std::memory_order_relaxed) == 0) {
-                        SaveChunk(chunk_games_/kGamesPerChunk, chunk_);
+                        PushChunk(chunk_games_/kGamesPerChunk, std::move(chunk_));
+                        chunk_.clear();
                         chunk_games_ += 1;
                     }
                 }
@@ -165,6 +495,24 @@ void SelfPlayPipe::Loop() {
     for (auto &t : workers_) {
         t.join();
     }
+
+    // Wait for the writer to save the remaining chunks.
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        writer_running_ = false;
+    }
+    writer_cv_.notify_all();
+    writer_.join();
+
+    if (client_) {
+        {
+            std::lock_guard<std::mutex> lock(poller_mutex_);
+            poller_running_ = false;
+        }
+        poller_cv_.notify_all();
+        poller_.join();
+    }
+
     LOGGING << '[' << CurrentDateTime() << ']'
                 << " Finish the self-play loop. Totally played "
                 << played_games_.load(std::memory_order_relaxed) << " games." << std::endl;
@@ -1,25 +1,86 @@
 #pragma once
 
 #include "selfplay/engine.h"
+#include "selfplay/client.h"
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <thread>
 #include <string>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
 
 class SelfPlayPipe {
 public:
     SelfPlayPipe();
 
 private:
-    void Initialize();
+    static constexpr int kGamesPerChunk = 25;
+
+    // Every worker buffers the game records and appends them to the
+    // shared file at once. Start a new file after many games, so no
+    // file is gigantic.
+    static constexpr size_t kRecordFlushSize = 64 * 1024;
+    static constexpr int kGamesPerRecordFile = 10000;
+
+    struct RecordBuffer {
+        std::string data;
+        int games{0};
+    };
+
+    // Return false if the client can not take the weights.
+    bool Initialize();
     void Loop();
 
+    // Fetch the first weights of the coordinator into the target
+    // directory, which keeps the unsent chunks.
+    bool InitializeClient();
+
+    // Prepare the next game of the slot g. Return false if there are
+    // enough games. With the overflow games, the slot keeps playing
+    // the extra game until the last counted game is over.
+    bool NextGame(const int g);
+
+    // Save the training data and buffer the SGF of the finished game.
+    void FinishGame(const int g, RecordBuffer &records);
+
+    // Append the buffered game records to the current file.
+    void FlushRecords(RecordBuffer &records);
+
+    std::string GetRecordFilename(int index) const;
+
+    // Save the chunk and return the saved file name.
     bool SaveChunk(const int out_id,
-                       std::vector<Training> &chunk);
+                       std::vector<Training> &chunk,
+                       std::string &filename);
+
+    // Save the chunk as one indexed shard of the binary records.
+    bool SaveShard(const int out_id,
+                       std::vector<Training> &chunk,
+                       std::string &filename);
+
+    // Upload the saved chunk and the new SGFs to the coordinator. The
+    // chunk is removed after it is uploaded.
+    void UploadResults(const std::string &chunk_file);
+
+    // Fetch the new weights from the coordinator now and then. The
+    // network watches the weights file and swaps them in between the
+    // games.
+    void PollWeightsLoop();
+
+    // Hand off the chunk to the writer thread. Block if there are
+    // too many chunks waiting for writing.
+    void PushChunk(const int out_id,
+                       std::vector<Training> &&chunk);
+
+    // Compress and save the chunks in the background.
+    void WriterLoop();
 
     std::mutex data_mutex_;
-    std::mutex log_mutex_;
 
     std::vector<Training> chunk_;
 
@@ -29,6 +90,11 @@ private:
 
     int chunk_games_;
     int max_games_;
+
+    // The extra games only fill the network batches of the tail. They
+    // are aborted and dropped after the last counted game.
+    bool overflow_games_;
+    std::unique_ptr<std::atomic<bool>[]> overflow_;
     Engine engine_;
 
     std::string target_directory_;
@@ -36,6 +102,29 @@ private:
     std::string data_directory_;
     std::string data_directory_hash_;
     std::string filename_hash_;
+    std::string sgf_filename_;
+
+    std::mutex sgf_mutex_;
+    bool compact_record_;
+    int sgf_games_;
+    int sgf_file_index_;
 
     std::vector<std::thread> workers_;
+
+    using PendingChunk = std::pair<int, std::vector<Training>>;
+
+    std::mutex writer_mutex_;
+    std::condition_variable writer_cv_;
+    std::deque<PendingChunk> pending_chunks_;
+    bool writer_running_;
+    std::atomic<bool> writer_failed_;
+    std::thread writer_;
+
+    std::unique_ptr<SelfPlayClient> client_;
+    int sgf_upload_index_{0};
+    std::uint64_t sgf_uploaded_{0};
+    std::mutex poller_mutex_;
+    std::condition_variable poller_cv_;
+    bool poller_running_{false};
+    std::thread poller_;
 };
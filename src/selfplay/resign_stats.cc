@@ -0,0 +1,77 @@
+#include "selfplay/resign_stats.h"
+#include "utils/format.h"
+#include "config.h"
+
+#include <algorithm>
+#include <vector>
+
+void ResignStats::Initialize() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    target_rate_ = GetOption<float>("resign_target_rate");
+    threshold_.store(GetOption<float>("resign_threshold"));
+}
+
+void ResignStats::Add(const ResignAnalysis &analysis) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    num_games_ += 1;
+    num_moves_ += analysis.num_moves;
+    if (analysis.decided_move >= 0) {
+        decided_games_ += 1;
+        moves_after_decision_ += analysis.num_moves - analysis.decided_move;
+        if (analysis.false_positive) {
+            false_positive_games_ += 1;
+        }
+    }
+
+    if (!analysis.draw) {
+        winner_min_evals_.emplace_back(analysis.winner_min_eval);
+        if ((int)winner_min_evals_.size() > kMaxWindowGames) {
+            winner_min_evals_.pop_front();
+        }
+        if (target_rate_ > 0.f) {
+            Calibrate();
+        }
+    }
+}
+
+void ResignStats::Calibrate() {
+    const int size = winner_min_evals_.size();
+    if (size < kMinWindowGames) {
+        return;
+    }
+
+    // The winners whose lowest eval is below the threshold would
+    // resign. Pick the threshold so that the target rate of them
+    // are below it.
+    auto evals = std::vector<float>(std::begin(winner_min_evals_),
+                                        std::end(winner_min_evals_));
+    const int idx = std::min(size-1, int(target_rate_ * size));
+    std::nth_element(std::begin(evals), std::begin(evals) + idx, std::end(evals));
+
+    // Never decide the balanced game.
+    threshold_.store(std::min(evals[idx], 0.5f));
+}
+
+float ResignStats::GetThreshold() const {
+    return threshold_.load();
+}
+
+bool ResignStats::Calibrating() const {
+    return target_rate_ > 0.f;
+}
+
+std::string ResignStats::GetSummary() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const auto Rate = [](std::int64_t a, std::int64_t b) {
+        return b == 0 ? 0.f : 100.f * a / b;
+    };
+    return Format("Resign threshold %.4f: %.2f%% games are played out without decision, "
+                      "%.2f%% decided games are false positive, %.2f%% moves are after the decision.",
+                      GetThreshold(),
+                      Rate(num_games_ - decided_games_, num_games_),
+                      Rate(false_positive_games_, decided_games_),
+                      Rate(moves_after_decision_, num_moves_));
+}
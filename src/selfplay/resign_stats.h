@@ -0,0 +1,50 @@
+#pragma once
+
+#include "mcts/search.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+// Collect the resign analysis of the finished self-play games. The
+// games are always played out, because the ownership and the final
+// score targets need the end boards. The threshold only cuts the
+// playouts of the decided moves, so it is worth to know how many moves
+// are played after the decision and how often the decision is wrong.
+// If the target rate is given, the threshold is calibrated so that
+// about this rate of the winners would resign.
+class ResignStats {
+public:
+    void Initialize();
+
+    void Add(const ResignAnalysis &analysis);
+
+    // The current resign threshold for the next games.
+    float GetThreshold() const;
+
+    bool Calibrating() const;
+
+    std::string GetSummary() const;
+
+private:
+    // Keep the recent games for the calibration.
+    static constexpr int kMaxWindowGames = 1000;
+    static constexpr int kMinWindowGames = 100;
+
+    void Calibrate();
+
+    mutable std::mutex mutex_;
+
+    float target_rate_{0.f};
+    std::atomic<float> threshold_{0.f};
+
+    std::deque<float> winner_min_evals_;
+
+    std::int64_t num_games_{0};
+    std::int64_t decided_games_{0};
+    std::int64_t false_positive_games_{0};
+    std::int64_t num_moves_{0};
+    std::int64_t moves_after_decision_{0};
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// The allocator of the STL containers which aligns the memory, e.g. to
+// the cache line for the SIMD loads.
+template <typename T, std::size_t kAlignment>
+class AlignedAllocator {
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, kAlignment>;
+    };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, kAlignment> &) {}
+
+    T *allocate(std::size_t n) {
+        // The size of aligned_alloc() must be a multiple of the alignment.
+        const auto bytes = (n * sizeof(T) + kAlignment - 1) / kAlignment * kAlignment;
+        void *ptr = nullptr;
+#ifdef _WIN32
+        ptr = _aligned_malloc(bytes, kAlignment);
+#else
+        if (posix_memalign(&ptr, kAlignment, bytes) != 0) {
+            ptr = nullptr;
+        }
+#endif
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, std::size_t) {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        std::free(ptr);
+#endif
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, kAlignment> &) const { return true; }
+
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, kAlignment> &) const { return false; }
+};
+
+// The vector aligned to the cache line.
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T, 64>>;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 
 template <typename T> 
 void AtomicFetchAdd(std::atomic<T> &f, T d,
@@ -8,3 +9,53 @@ void AtomicFetchAdd(std::atomic<T> &f, T d,
     T old = f.load(std::memory_order_relaxed);
     while (!f.compare_exchange_weak(old, old + d, order)) {}
 }
+
+// The fixed-point accumulator. The floating-point fetch-add is a
+// compare-exchange loop which retries heavily if many threads update
+// the same value, like the root node. The integer fetch-add is always
+// done by one atomic instruction. The value keeps kFracBits fraction
+// bits, so the range is about +-2^(63-kFracBits).
+template <int kFracBits>
+class AtomicFixedPoint {
+public:
+    AtomicFixedPoint(double v = 0.0) : value_(ToFixed(v)) {}
+
+    void Add(double d,
+                 std::memory_order order = std::memory_order_relaxed) {
+        value_.fetch_add(ToFixed(d), order);
+    }
+
+    double Load(std::memory_order order = std::memory_order_relaxed) const {
+        return FromFixed(value_.load(order));
+    }
+
+    void Store(double v,
+                   std::memory_order order = std::memory_order_relaxed) {
+        value_.store(ToFixed(v), order);
+    }
+
+    // The raw fixed-point value. The other integer storage may keep
+    // a copy of it and add the same raw increments, so that both
+    // are always equal.
+    std::int64_t LoadRaw(std::memory_order order = std::memory_order_relaxed) const {
+        return value_.load(order);
+    }
+
+    static constexpr int kFractionBits = kFracBits;
+
+    static std::int64_t ToFixed(double v) {
+        // Round to the nearest value.
+        v *= kScale;
+        return static_cast<std::int64_t>(v >= 0.0 ? v + 0.5 : v - 0.5);
+    }
+
+    static double FromFixed(std::int64_t v) {
+        return static_cast<double>(v) / kScale;
+    }
+
+private:
+    static constexpr double kScale =
+        static_cast<double>(std::int64_t{1} << kFracBits);
+
+    std::atomic<std::int64_t> value_;
+};
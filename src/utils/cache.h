@@ -1,145 +1,281 @@
 #pragma once
 
 #include "utils/mutex.h"
+#include "utils/huge_pages.h"
+#include "utils/prefetch.h"
 
 #include <memory>
 #include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <vector>
 
+// The hash table is split into the shards. Every shard has its own lock,
+// so the search threads rarely wait for each other. The values are stored
+// inline in the entries. They are copied out under the lock.
+//
+// The tags and the stamps of one cluster are packed into one cache line,
+// so the lookup only touches the entry when the tag matches. The stamp is
+// the generation of the last use and the weight of the entry. The full
+// cluster evicts the oldest entry, but the heavy entries, e.g. the ones
+// near the root or the ones hit many times, look younger.
 template<typename V>
 class HashKeyCache {
 public:
     HashKeyCache() {
-        capacity_ = 0;
-        generation_ = 0;
+        SetCapacity(0);
     }
 
     HashKeyCache(size_t capacity) {
         SetCapacity(capacity);
-        generation_ = 0;
     }
 
     HashKeyCache(HashKeyCache&& cache) {
         SetCapacity(cache.capacity_);
-        generation_ = cache.generation_;
     }
 
     // Set the capacity.
     void SetCapacity(size_t size);
 
-    // Insert the new item to the cache.
-    void Insert(std::uint64_t key, const V &value);
+    // Insert the new item to the cache. The weight, from 0 to 15, is
+    // how much the item is worth keeping.
+    void Insert(std::uint64_t key, const V &value, int weight = 0);
 
-    // Lookup the item.
-    V* LookupItem(std::uint64_t key);
+    // Lookup the item and copy it. Return false if it is not in
+    // the cache. The hit refreshes the item and raises its weight.
+    bool Lookup(std::uint64_t key, V &value);
+
+    // Prefetch the cluster of the key, so the later lookup does not
+    // wait for the memory. Skip it if the shard is locked.
+    void Prefetch(std::uint64_t key);
 
     // Clear the hash.
     void Clear();
 
-    size_t GetEntrySize() const;
+    static size_t GetEntrySize();
+
+    // The number of entries the tables hold.
+    size_t GetCapacity() const;
+
+    // The number of the filled entries. It locks every shard, so do
+    // not call it while searching.
+    size_t GetNumUsed();
+
+    // Return the smallest page size of the tables.
+    size_t GetPageSize();
 
 private:
     struct Entry {
-        Entry() : generation{0} {}
         std::uint64_t key;
-        std::uint64_t generation;
-        std::unique_ptr<V> value;
+        V value;
     };
 
-    SpinLock mutex_;
-
     static constexpr size_t kClusterSize = 8;
-    static constexpr size_t kEntrySize = sizeof(Entry) + sizeof(V);
+    static constexpr size_t kNumShards = 64;
+
+    // The stamp is (generation << kWeightBits) | weight. Zero means
+    // the empty slot, so the generation never is zero.
+    static constexpr int kWeightBits = 4;
+    static constexpr std::uint32_t kMaxWeight = (1u << kWeightBits) - 1;
+    static constexpr std::uint32_t kGenerationMask = 0xffffffffu >> kWeightBits;
 
-    std::vector<Entry> table_ GUARDED_BY(mutex_);
+    struct alignas(64) ClusterMeta {
+        std::uint32_t tags[kClusterSize];
+        std::uint32_t stamps[kClusterSize];
+    };
+    static_assert(sizeof(ClusterMeta) == 64, "The metadata should fill one cache line.");
+
+    struct Shard {
+        SpinLock mutex;
+        std::vector<Entry, HugePageAllocator<Entry>> table GUARDED_BY(mutex);
+        std::vector<ClusterMeta, HugePageAllocator<ClusterMeta>> meta GUARDED_BY(mutex);
+        size_t blocks GUARDED_BY(mutex);
+        std::uint32_t generation GUARDED_BY(mutex);
+
+        // Keep the locks of shards out of the same cache line.
+        char padding[64];
+    };
+
+    static constexpr size_t kEntrySize = sizeof(Entry) + sizeof(ClusterMeta) / kClusterSize;
+
+    Shard &GetShard(std::uint64_t key) {
+        // The low bits select the cluster, so use the high bits here.
+        return shards_[(key >> 58) % kNumShards];
+    }
 
-    size_t capacity_ GUARDED_BY(mutex_);
-    size_t blocks_ GUARDED_BY(mutex_);
-    std::uint64_t generation_ GUARDED_BY(mutex_);
+    static std::uint32_t GetTag(std::uint64_t key) {
+        return static_cast<std::uint32_t>(key >> 32);
+    }
+
+    static std::uint32_t NextGeneration(Shard &shard) {
+        shard.generation = (shard.generation + 1) & kGenerationMask;
+        if (shard.generation == 0) {
+            shard.generation = 1;
+        }
+        return shard.generation;
+    }
+
+    std::unique_ptr<Shard[]> shards_{new Shard[kNumShards]};
+    size_t capacity_;
 };
 
 template<typename V>
 void HashKeyCache<V>::SetCapacity(size_t size) {
-    if (size % kClusterSize) {
-        auto t = size / kClusterSize;
-        size = (t+1) * kClusterSize;
-    }
+    // Every shard has at least one cluster.
+    const auto shard_size = std::max(
+        (size + kNumShards * kClusterSize - 1) / (kNumShards * kClusterSize), size_t{1}) * kClusterSize;
 
-    SpinLock::Lock lock(mutex_);
+    capacity_ = shard_size * kNumShards;
 
-    blocks_ = size / kClusterSize;
-    capacity_ = size;
-    table_.resize(size);
-    table_.shrink_to_fit();
+    for (size_t i = 0; i < kNumShards; ++i) {
+        auto &shard = shards_[i];
+        SpinLock::Lock lock(shard.mutex);
+
+        shard.blocks = shard_size / kClusterSize;
+        shard.generation = 0;
+        shard.table.clear();
+        shard.table.resize(shard_size);
+        shard.table.shrink_to_fit();
+        shard.meta.clear();
+        shard.meta.resize(shard.blocks, ClusterMeta{});
+        shard.meta.shrink_to_fit();
+    }
 }
 
 template<typename V>
-void HashKeyCache<V>::Insert(std::uint64_t key, const V &value) {
-    const auto idx = (key % blocks_) * kClusterSize;
-    Entry *entry = table_.data() + idx;
-
-    SpinLock::Lock lock(mutex_);
-
-    size_t min_i = 0;
-    size_t min_g = entry->generation;
-    for (size_t offset = 1; offset < kClusterSize; ++offset) {
-        Entry *e = entry + offset;
-        if (min_g > e->generation) {
-            min_g = e->generation;
-            min_i = offset;
+void HashKeyCache<V>::Insert(std::uint64_t key, const V &value, int weight) {
+    auto &shard = GetShard(key);
+    SpinLock::Lock lock(shard.mutex);
+
+    const auto block = key % shard.blocks;
+    Entry *entry = shard.table.data() + block * kClusterSize;
+    ClusterMeta &meta = shard.meta[block];
+    const auto tag = GetTag(key);
+    const auto generation = NextGeneration(shard);
+
+    // Take the slot of the same key or the empty slot first. Or else
+    // evict the one whose age minus its weight bonus is the largest.
+    // One point of the weight is worth one new entry in every cluster
+    // of the shard.
+    size_t victim = 0;
+    std::int64_t victim_score = std::numeric_limits<std::int64_t>::lowest();
+    for (size_t i = 0; i < kClusterSize; ++i) {
+        const auto stamp = meta.stamps[i];
+        if (stamp == 0 ||
+                (meta.tags[i] == tag && entry[i].key == key)) {
+            victim = i;
+            break;
+        }
+        const std::int64_t age = (generation - (stamp >> kWeightBits)) & kGenerationMask;
+        const std::int64_t score = age - std::int64_t(stamp & kMaxWeight) * shard.blocks;
+        if (score > victim_score) {
+            victim_score = score;
+            victim = i;
         }
     }
 
-    ++generation_;
-
-    Entry *new_entry = entry + min_i;
-    new_entry->key = key;
-    new_entry->generation = generation_;
-    new_entry->value = std::make_unique<V>(value);
+    const auto w = std::min<std::uint32_t>(std::max(weight, 0), kMaxWeight);
+    entry[victim].key = key;
+    entry[victim].value = value;
+    meta.tags[victim] = tag;
+    meta.stamps[victim] = (generation << kWeightBits) | w;
 }
 
 template<typename V>
-V* HashKeyCache<V>::LookupItem(std::uint64_t key) {
-    const auto idx = (key % blocks_) * kClusterSize;
-    Entry *entry = table_.data() + idx;
+bool HashKeyCache<V>::Lookup(std::uint64_t key, V &value) {
+    auto &shard = GetShard(key);
+    SpinLock::Lock lock(shard.mutex);
 
-    SpinLock::Lock lock(mutex_);
+    const auto block = key % shard.blocks;
+    const Entry *entry = shard.table.data() + block * kClusterSize;
+    ClusterMeta &meta = shard.meta[block];
+    const auto tag = GetTag(key);
 
-    for (size_t offset = 0; offset < kClusterSize; ++offset) {
-        Entry *e = entry + offset;
-        if (e->key == key && e->generation != 0) {
-            return e->value.get();
+    for (size_t i = 0; i < kClusterSize; ++i) {
+        const auto stamp = meta.stamps[i];
+        if (meta.tags[i] == tag && stamp != 0 &&
+                entry[i].key == key) {
+            value = entry[i].value;
+            const auto w = std::min((stamp & kMaxWeight) + 1, kMaxWeight);
+            meta.stamps[i] = (NextGeneration(shard) << kWeightBits) | w;
+            return true;
         }
     }
 
-    return nullptr;
+    return false;
+}
+
+template<typename V>
+void HashKeyCache<V>::Prefetch(std::uint64_t key) {
+    auto &shard = GetShard(key);
+    if (!shard.mutex.try_lock()) {
+        return;
+    }
+    const auto block = key % shard.blocks;
+    PrefetchRead(shard.meta.data() + block);
+
+    // The keys are at the front of the entries.
+    const Entry *entry = shard.table.data() + block * kClusterSize;
+    for (size_t i = 0; i < kClusterSize; ++i) {
+        PrefetchRead(entry + i);
+    }
+    shard.mutex.unlock();
 }
 
 template<typename V>
 void HashKeyCache<V>::Clear() {
-    SpinLock::Lock lock(mutex_);
-
-    generation_ = 0;
-    std::for_each(std::begin(table_), std::end(table_),
-                     [](auto &e){
-                         e.generation = 0;
-                         e.value.reset(nullptr);
-                     }
-                 );
-    
+    for (size_t i = 0; i < kNumShards; ++i) {
+        auto &shard = shards_[i];
+        SpinLock::Lock lock(shard.mutex);
+
+        shard.generation = 0;
+        std::for_each(std::begin(shard.meta), std::end(shard.meta),
+                         [](auto &m){
+                             std::fill(std::begin(m.stamps), std::end(m.stamps), 0u);
+                         }
+                     );
+    }
 }
 
 template<typename V>
-size_t HashKeyCache<V>::GetEntrySize() const {
+size_t HashKeyCache<V>::GetEntrySize() {
     return kEntrySize;
 }
 
 template<typename V>
-bool LookupCache(HashKeyCache<V> &cache, std::uint64_t key, V& val) {
-    auto result = cache.LookupItem(key);
-    if (result) {
-        val = *result;
-        return true;
+size_t HashKeyCache<V>::GetCapacity() const {
+    return capacity_;
+}
+
+template<typename V>
+size_t HashKeyCache<V>::GetNumUsed() {
+    size_t used = 0;
+    for (size_t i = 0; i < kNumShards; ++i) {
+        auto &shard = shards_[i];
+        SpinLock::Lock lock(shard.mutex);
+
+        for (const auto &m : shard.meta) {
+            used += std::count_if(std::begin(m.stamps), std::end(m.stamps),
+                                      [](std::uint32_t stamp) { return stamp != 0u; });
+        }
     }
-    return false;
+    return used;
+}
+
+template<typename V>
+size_t HashKeyCache<V>::GetPageSize() {
+    size_t page_size = 0;
+    for (size_t i = 0; i < kNumShards; ++i) {
+        auto &shard = shards_[i];
+        SpinLock::Lock lock(shard.mutex);
+
+        const auto size = HugePages::GetPageSize(shard.table.data());
+        page_size = page_size == 0 ? size : std::min(page_size, size);
+    }
+    return page_size;
+}
+
+template<typename V>
+bool LookupCache(HashKeyCache<V> &cache, std::uint64_t key, V& val) {
+    return cache.Lookup(key, val);
 }
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// The persistent hash table on the disk. The file is a log of the
+// records, one key and one value. The new records are appended at the
+// end, so the later records are the recently used. The hit in the older
+// half of the log is appended again. The log is compacted when it is
+// two times larger than the limit, and only the recently used records
+// are kept. The index of keys is in the memory. The value must be
+// trivially copyable.
+template<typename V>
+class DiskKeyCache {
+public:
+    static_assert(std::is_trivially_copyable<V>::value,
+                      "The disk value must be trivially copyable.");
+
+    DiskKeyCache() = default;
+    ~DiskKeyCache();
+
+    DiskKeyCache(const DiskKeyCache&) = delete;
+    DiskKeyCache& operator=(const DiskKeyCache&) = delete;
+
+    // Open the log file, or create it. The size of log is limited by
+    // the given MiB. Return false if fail.
+    bool Open(const std::string &filename, size_t MiB);
+    void Close();
+
+    bool Valid() const { return file_ != nullptr; }
+
+    // Insert the new item to the log.
+    void Insert(std::uint64_t key, const V &value);
+
+    // Lookup the item and copy it. Return false if it is not in the
+    // log.
+    bool Lookup(std::uint64_t key, V &value);
+
+    size_t GetNumEntries();
+
+    size_t GetRecordSize() const { return kRecordSize; }
+
+private:
+    struct Header {
+        char magic[8];
+        std::uint64_t value_size;
+    };
+
+    struct IndexEntry {
+        std::uint64_t offset;
+        std::uint64_t tick;
+    };
+
+    static constexpr size_t kRecordSize = sizeof(std::uint64_t) + sizeof(V);
+    static constexpr char kMagic[8] = {'S', 'A', 'Y', 'D', 'I', 'S', 'K', '1'};
+
+    bool AppendLocked(std::uint64_t key, const V &value);
+    bool ReadLocked(std::uint64_t offset, V &value);
+
+    // Rewrite the log with the recently used records.
+    void CompactLocked();
+    void CloseLocked();
+
+    std::mutex mutex_;
+    std::string filename_;
+    std::FILE *file_{nullptr};
+
+    std::unordered_map<std::uint64_t, IndexEntry> index_;
+    std::uint64_t file_size_{0};
+    std::uint64_t num_records_{0};
+    std::uint64_t tick_{0};
+    size_t max_entries_{0};
+};
+
+template<typename V>
+constexpr char DiskKeyCache<V>::kMagic[8];
+
+template<typename V>
+DiskKeyCache<V>::~DiskKeyCache() {
+    Close();
+}
+
+template<typename V>
+bool DiskKeyCache<V>::Open(const std::string &filename, size_t MiB) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CloseLocked();
+
+    filename_ = filename;
+    max_entries_ = std::max(MiB * 1024 * 1024 / kRecordSize, size_t{1});
+
+    file_ = std::fopen(filename_.c_str(), "r+b");
+    if (!file_) {
+        file_ = std::fopen(filename_.c_str(), "w+b");
+        if (!file_) {
+            return false;
+        }
+    }
+
+    std::fseek(file_, 0, SEEK_END);
+    file_size_ = std::ftell(file_);
+    std::fseek(file_, 0, SEEK_SET);
+
+    // Scan the keys. The broken tail is dropped by the compaction.
+    bool rewrite = false;
+    Header header;
+    if (file_size_ == 0) {
+        rewrite = true;
+    } else if (std::fread(&header, sizeof(Header), 1, file_) != 1 ||
+                   !std::equal(std::begin(kMagic), std::end(kMagic), header.magic) ||
+                   header.value_size != sizeof(V)) {
+        // It is not our log. Do not touch it.
+        CloseLocked();
+        return false;
+    } else {
+        std::uint64_t offset = sizeof(Header);
+        std::uint64_t key;
+        while (offset + kRecordSize <= file_size_ &&
+                   std::fseek(file_, offset, SEEK_SET) == 0 &&
+                   std::fread(&key, sizeof(key), 1, file_) == 1) {
+            index_[key] = IndexEntry{offset, tick_++};
+            offset += kRecordSize;
+            ++num_records_;
+        }
+        if (offset != file_size_) {
+            rewrite = true;
+        }
+    }
+
+    if (rewrite || num_records_ >= 2 * max_entries_) {
+        CompactLocked();
+    }
+    return file_ != nullptr;
+}
+
+template<typename V>
+void DiskKeyCache<V>::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CloseLocked();
+}
+
+template<typename V>
+void DiskKeyCache<V>::CloseLocked() {
+    if (file_) {
+        std::fclose(file_);
+    }
+    file_ = nullptr;
+    index_.clear();
+    file_size_ = 0;
+    num_records_ = 0;
+    tick_ = 0;
+}
+
+template<typename V>
+void DiskKeyCache<V>::Insert(std::uint64_t key, const V &value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!file_) {
+        return;
+    }
+    auto it = index_.find(key);
+    if (it != std::end(index_)) {
+        // The same key gives the same value.
+        it->second.tick = tick_++;
+        return;
+    }
+    AppendLocked(key, value);
+}
+
+template<typename V>
+bool DiskKeyCache<V>::Lookup(std::uint64_t key, V &value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!file_) {
+        return false;
+    }
+    auto it = index_.find(key);
+    if (it == std::end(index_) ||
+            !ReadLocked(it->second.offset, value)) {
+        return false;
+    }
+    it->second.tick = tick_++;
+
+    if (it->second.offset < file_size_ / 2) {
+        // Move it forward so that the next compaction keeps it even
+        // if the process is killed before.
+        AppendLocked(key, value);
+    }
+    return true;
+}
+
+template<typename V>
+size_t DiskKeyCache<V>::GetNumEntries() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.size();
+}
+
+template<typename V>
+bool DiskKeyCache<V>::ReadLocked(std::uint64_t offset, V &value) {
+    std::uint64_t key;
+    return std::fseek(file_, offset, SEEK_SET) == 0 &&
+               std::fread(&key, sizeof(key), 1, file_) == 1 &&
+               std::fread(&value, sizeof(V), 1, file_) == 1;
+}
+
+template<typename V>
+bool DiskKeyCache<V>::AppendLocked(std::uint64_t key, const V &value) {
+    if (std::fseek(file_, file_size_, SEEK_SET) != 0 ||
+            std::fwrite(&key, sizeof(key), 1, file_) != 1 ||
+            std::fwrite(&value, sizeof(V), 1, file_) != 1) {
+        return false;
+    }
+    index_[key] = IndexEntry{file_size_, tick_++};
+    file_size_ += kRecordSize;
+    ++num_records_;
+
+    if (num_records_ >= 2 * max_entries_) {
+        CompactLocked();
+    }
+    return true;
+}
+
+template<typename V>
+void DiskKeyCache<V>::CompactLocked() {
+    // Keep the recently used records, the oldest first.
+    auto entries = std::vector<std::pair<std::uint64_t, std::uint64_t>>{};
+    for (const auto &it: index_) {
+        entries.emplace_back(it.second.tick, it.first);
+    }
+    std::sort(std::begin(entries), std::end(entries));
+    if (entries.size() > max_entries_) {
+        entries.erase(std::begin(entries), std::end(entries) - max_entries_);
+    }
+
+    const auto tmp_name = filename_ + ".tmp";
+    std::FILE *out = std::fopen(tmp_name.c_str(), "wb");
+    if (!out) {
+        CloseLocked();
+        return;
+    }
+
+    Header header;
+    std::copy(std::begin(kMagic), std::end(kMagic), header.magic);
+    header.value_size = sizeof(V);
+    std::fwrite(&header, sizeof(Header), 1, out);
+
+    auto index = std::unordered_map<std::uint64_t, IndexEntry>{};
+    std::uint64_t offset = sizeof(Header);
+    std::uint64_t tick = 0;
+    V value;
+
+    for (const auto &e: entries) {
+        const auto key = e.second;
+        if (!ReadLocked(index_[key].offset, value)) {
+            continue;
+        }
+        std::fwrite(&key, sizeof(key), 1, out);
+        std::fwrite(&value, sizeof(V), 1, out);
+        index[key] = IndexEntry{offset, tick++};
+        offset += kRecordSize;
+    }
+    std::fclose(out);
+    std::fclose(file_);
+
+    // The rename() can not replace the file on some systems.
+    std::remove(filename_.c_str());
+    if (std::rename(tmp_name.c_str(), filename_.c_str()) != 0) {
+        file_ = nullptr;
+        CloseLocked();
+        return;
+    }
+
+    file_ = std::fopen(filename_.c_str(), "r+b");
+    if (!file_) {
+        CloseLocked();
+        return;
+    }
+    index_ = std::move(index);
+    file_size_ = offset;
+    num_records_ = index_.size();
+    tick_ = tick;
+}
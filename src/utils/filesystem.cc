@@ -1,6 +1,8 @@
 #include <stdexcept>
 #include <algorithm>
+#include <cstring>
 #include "utils/filesystem.h"
+#include "utils/mapped_file.h"
 
 #ifdef WIN32
 #include <windows.h>
@@ -197,3 +199,32 @@ time_t GetFileTime(const std::string& filename) {
 #endif
 #endif
 }
+
+uint64_t GetFileHash(const std::string& filename) {
+    MappedFile mapped;
+    if (!mapped.Open(filename)) {
+        return 0;
+    }
+    return GetDataHash(mapped.Data(), mapped.Size());
+}
+
+uint64_t GetDataHash(const void *buf, size_t size) {
+    const auto *data = reinterpret_cast<const unsigned char *>(buf);
+
+    // Mix the eight bytes words, then the tail bytes.
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash == 0 ? 1 : hash;
+}
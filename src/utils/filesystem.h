@@ -30,3 +30,10 @@ uint64_t GetFileSize(const std::string& filename);
 
 // Returns modification time of a file, 0 if file doesn't exist or can't be read.
 time_t GetFileTime(const std::string& filename);
+
+// Returns 64 bits hash of the file content, 0 if file doesn't exist or
+// can't be read.
+uint64_t GetFileHash(const std::string& filename);
+
+// Returns the same hash as GetFileHash() of the data in the memory.
+uint64_t GetDataHash(const void *data, size_t size);
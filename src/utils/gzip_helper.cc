@@ -1,26 +1,103 @@
 #include "utils/gzip_helper.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <memory>
 #include <cstring>
+#include <vector>
 
 #ifdef USE_ZLIB
 
 #include "zlib.h"
 
 void SaveGzip(std::string filename, std::string &buffer) {
+    GzipOutputStream out(filename);
+    out.write(buffer.data(), buffer.size());
+    out.Close();
+}
+
+class GzipOutputStream::GzipStreamBuf : public std::streambuf {
+public:
+    GzipStreamBuf(std::string filename, int level) : buffer_(kBufferSize) {
+        char mode[] = "wb9";
+        mode[2] = '0' + std::min(std::max(level, 1), 9);
+
+        file_ = gzopen(filename.c_str(), mode);
+        if (!file_) {
+            throw "Error opening gzip file";
+        }
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+    ~GzipStreamBuf() {
+        Close();
+    }
+
+    bool Close() {
+        if (!file_) {
+            return !failed_;
+        }
+        Drain();
+        failed_ |= (gzclose(file_) != Z_OK);
+        file_ = nullptr;
+        return !failed_;
+    }
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (!Drain()) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    int sync() override {
+        // Only hand the data to zlib. Flushing the deflate stream
+        // here would hurt the compression.
+        return Drain() ? 0 : -1;
+    }
+
+private:
+    static constexpr size_t kBufferSize = 256 * 1024;
+
+    bool Drain() {
+        const auto size = pptr() - pbase();
+        if (size > 0 && file_) {
+            if (gzwrite(file_, pbase(), size) != size) {
+                failed_ = true;
+            }
+        }
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+        return !failed_;
+    }
+
+    gzFile file_{nullptr};
+    bool failed_{false};
+    std::vector<char> buffer_;
+};
+
+GzipOutputStream::GzipOutputStream(std::string filename, int level)
+    : std::ostream(nullptr) {
     filename += ".gz";
-    auto out = gzopen(filename.c_str(), "wb9");
+    buf_ = std::make_unique<GzipStreamBuf>(filename, level);
+    rdbuf(buf_.get());
+}
 
-    auto in_buff_size = buffer.size();
-    auto in_buff = std::make_unique<char[]>(in_buff_size);
-    std::memcpy(in_buff.get(), buffer.data(), in_buff_size);
+GzipOutputStream::~GzipOutputStream() {
+    if (buf_) {
+        buf_->Close();
+    }
+}
 
-    auto comp_size = gzwrite(out, in_buff.get(), in_buff_size);
-    if (!comp_size) {
+void GzipOutputStream::Close() {
+    flush();
+    if (!buf_->Close() || fail()) {
         throw "Error in gzip output";
     }
-    gzclose(out);
 }
 
 #else
@@ -29,4 +106,15 @@ void SaveGzip(std::string /* filename */, std::string & /* buffer */ ) {
     throw "No gzip library";
 }
 
+class GzipOutputStream::GzipStreamBuf : public std::streambuf {};
+
+GzipOutputStream::GzipOutputStream(std::string /* filename */, int /* level */)
+    : std::ostream(nullptr) {
+    throw "No gzip library";
+}
+
+GzipOutputStream::~GzipOutputStream() {}
+
+void GzipOutputStream::Close() {}
+
 #endif
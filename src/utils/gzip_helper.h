@@ -1,6 +1,27 @@
 #pragma once
 
+#include <memory>
+#include <ostream>
+#include <streambuf>
 #include <string>
 
 void SaveGzip(std::string filename, std::string &buffer);
 
+// The output stream which compresses the data into the gzip file
+// while writing, so the whole data is never kept in the memory. The
+// ".gz" is appended to the file name. It throws if there is no gzip
+// library or the file can not be opened.
+class GzipOutputStream : public std::ostream {
+public:
+    // The level is from 1 (fastest) to 9 (smallest).
+    GzipOutputStream(std::string filename, int level = 9);
+    ~GzipOutputStream();
+
+    // Flush the remaining data and close the file. Throw if fail
+    // to write it.
+    void Close();
+
+private:
+    class GzipStreamBuf;
+    std::unique_ptr<GzipStreamBuf> buf_;
+};
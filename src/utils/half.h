@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// The IEEE 754 half precision float conversion on the CPU. The
+// conversion rounds to the nearest even value.
+class Half {
+public:
+    static std::uint16_t FromFloat(float f);
+
+    static float ToFloat(std::uint16_t h);
+};
+
+inline std::uint16_t Half::FromFloat(float f) {
+    std::uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+
+    const std::uint32_t sign = (x >> 16) & 0x8000;
+    const std::uint32_t abs = x & 0x7fffffff;
+
+    if (abs >= 0x7f800000) {
+        // Inf or NaN.
+        return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+    }
+    if (abs >= 0x477ff000) {
+        // Overflow, it is inf after rounding.
+        return sign | 0x7c00;
+    }
+    if (abs < 0x38800000) {
+        // Subnormal or zero. Shift the mantissa with the implicit bit
+        // into the subnormal position.
+        if (abs < 0x33000000) {
+            return sign;
+        }
+        const std::uint32_t e = abs >> 23;
+        const std::uint32_t m = (abs & 0x7fffff) | 0x800000;
+        const std::uint32_t shift = 126 - e;
+        std::uint32_t h = m >> shift;
+        const std::uint32_t rem = m & ((1u << shift) - 1);
+        const std::uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1))) {
+            ++h;
+        }
+        return sign | h;
+    }
+
+    // Normal number. Rebias the exponent and round the mantissa.
+    std::uint32_t h = ((abs - 0x38000000) >> 13);
+    const std::uint32_t rem = abs & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) {
+        ++h;
+    }
+    return sign | h;
+}
+
+inline float Half::ToFloat(std::uint16_t h) {
+    const std::uint32_t sign = (std::uint32_t)(h & 0x8000) << 16;
+    const std::uint32_t e = (h >> 10) & 0x1f;
+    const std::uint32_t m = h & 0x3ff;
+    std::uint32_t x;
+
+    if (e == 0x1f) {
+        // Inf or NaN.
+        x = sign | 0x7f800000 | (m << 13);
+    } else if (e != 0) {
+        x = sign | ((e + 112) << 23) | (m << 13);
+    } else if (m == 0) {
+        x = sign;
+    } else {
+        // Subnormal. The value is m * 2^-24, which is exact in float.
+        const float f = static_cast<float>(m) * 5.9604644775390625e-8f;
+        return sign ? -f : f;
+    }
+
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+// The histogram of the latencies in microseconds. The bucket bounds grow
+// by the factor 2^(1/4), so a percentile is within 19% of the real value.
+// The buckets are atomic, so many threads can add the samples together.
+class LatencyHistogram {
+public:
+    void Add(std::int64_t us) {
+        buckets_[GetBucket(us)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Reset() {
+        for (auto &b : buckets_) {
+            b.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    std::int64_t GetCount() const {
+        auto count = std::int64_t{0};
+        for (const auto &b : buckets_) {
+            count += b.load(std::memory_order_relaxed);
+        }
+        return count;
+    }
+
+    // Return the upper bound of the bucket which contains the given
+    // quantile, e.g. 0.99 for p99. Return 0 if it is empty.
+    double GetPercentile(double q) const {
+        const auto count = GetCount();
+        if (count == 0) {
+            return 0.0;
+        }
+        const auto target = std::max<std::int64_t>(1, std::ceil(q * count));
+        auto accumulated = std::int64_t{0};
+        for (int i = 0; i < kNumBuckets; ++i) {
+            accumulated += buckets_[i].load(std::memory_order_relaxed);
+            if (accumulated >= target) {
+                return GetUpperBound(i);
+            }
+        }
+        return GetUpperBound(kNumBuckets - 1);
+    }
+
+private:
+    static constexpr int kStepsPerOctave = 4;
+    static constexpr int kNumBuckets = 40 * kStepsPerOctave;
+
+    // The bucket 0 is for zero. The bucket i covers the range from
+    // 2^((i-1)/4) to 2^(i/4).
+    static int GetBucket(std::int64_t us) {
+        if (us <= 0) {
+            return 0;
+        }
+        const int b = kStepsPerOctave * std::log2(static_cast<double>(us)) + 1;
+        return std::min(b, kNumBuckets - 1);
+    }
+
+    static double GetUpperBound(int bucket) {
+        return bucket == 0 ? 0.0 :
+                   std::pow(2.0, static_cast<double>(bucket) / kStepsPerOctave);
+    }
+
+    std::array<std::atomic<std::int64_t>, kNumBuckets> buckets_{};
+};
@@ -0,0 +1,238 @@
+#include "utils/huge_pages.h"
+#include "utils/filesystem.h"
+#include "utils/format.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr size_t kAlignment = 64;
+constexpr size_t kNormalPageSize = 4 * 1024;
+constexpr size_t k2MiBPageSize = 2 * 1024 * 1024;
+constexpr size_t k1GiBPageSize = 1024 * 1024 * 1024;
+
+struct Region {
+    size_t size;
+    size_t page_size;
+
+    // The memory is mapped, or it comes from the heap.
+    bool mapped;
+};
+
+std::atomic<bool> g_enabled{false};
+
+// All allocated memory. The tables are few and large, so the map
+// is cheap.
+std::mutex g_mutex;
+std::map<const void *, Region> g_regions;
+
+size_t RoundUp(size_t bytes, size_t page_size) {
+    return (bytes + page_size - 1) / page_size * page_size;
+}
+
+// Round up to the huge page only if it wastes at most 1/8 of the size.
+bool FitHugePage(size_t bytes, size_t page_size) {
+    return bytes >= page_size &&
+               RoundUp(bytes, page_size) - bytes <= bytes / 8;
+}
+
+#ifdef __linux__
+void *MapHugeTlb(size_t size, size_t page_size) {
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    const int shift = page_size == k1GiBPageSize ? 30 : 21;
+    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT),
+                     -1, 0);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+#else
+    (void) size;
+    (void) page_size;
+    return nullptr;
+#endif
+}
+
+bool TransparentEnabled() {
+    auto file = std::ifstream{"/sys/kernel/mm/transparent_hugepage/enabled"};
+    auto line = std::string{};
+    if (!file.is_open() || !std::getline(file, line)) {
+        return false;
+    }
+    return line.find("[never]") == std::string::npos;
+}
+
+// Map the memory on the 2 MiB boundary and advise the kernel to back
+// it with the transparent huge pages.
+void *MapTransparent(size_t size) {
+    const size_t map_size = size + k2MiBPageSize;
+    void *ptr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+
+    // Trim the unaligned head and the rest of the tail.
+    const auto addr = reinterpret_cast<std::uintptr_t>(ptr);
+    const auto aligned = RoundUp(addr, k2MiBPageSize);
+    const size_t head = aligned - addr;
+    const size_t tail = map_size - head - size;
+    if (head > 0) {
+        munmap(ptr, head);
+    }
+    if (tail > 0) {
+        munmap(reinterpret_cast<char *>(aligned + size), tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(reinterpret_cast<void *>(aligned), size, MADV_HUGEPAGE);
+#endif
+    return reinterpret_cast<void *>(aligned);
+}
+#endif
+
+void *AllocateHeap(size_t bytes, size_t alignment) {
+    alignment = std::max(alignment, kAlignment);
+    const auto size = RoundUp(std::max(bytes, size_t{1}), alignment);
+    void *ptr = nullptr;
+#ifdef _WIN32
+    ptr = _aligned_malloc(size, alignment);
+#else
+    if (posix_memalign(&ptr, alignment, size) != 0) {
+        ptr = nullptr;
+    }
+#endif
+    return ptr;
+}
+
+void FreeHeap(void *ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+} // namespace
+
+void HugePages::SetEnabled(bool enabled) {
+    g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool HugePages::Enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void *HugePages::Allocate(size_t bytes, size_t alignment) {
+    void *ptr = nullptr;
+    auto region = Region{bytes, kNormalPageSize, false};
+
+#ifdef __linux__
+    // The mapped memory is aligned to 2 MiB at least.
+    if (Enabled() && bytes >= k2MiBPageSize && alignment <= k2MiBPageSize) {
+        for (const auto page_size : {k1GiBPageSize, k2MiBPageSize}) {
+            if (!FitHugePage(bytes, page_size)) {
+                continue;
+            }
+            const auto size = RoundUp(bytes, page_size);
+            ptr = MapHugeTlb(size, page_size);
+            if (ptr) {
+                region = Region{size, page_size, true};
+                break;
+            }
+        }
+        if (!ptr && TransparentEnabled()) {
+            const auto size = RoundUp(bytes, k2MiBPageSize);
+            ptr = MapTransparent(size);
+            if (ptr) {
+                region = Region{size, k2MiBPageSize, true};
+            }
+        }
+    }
+#endif
+
+    if (!ptr) {
+        ptr = AllocateHeap(bytes, alignment);
+        if (!ptr) {
+            return nullptr;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_regions.emplace(ptr, region);
+    return ptr;
+}
+
+void HugePages::Free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    auto region = Region{};
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        const auto it = g_regions.find(ptr);
+        if (it == std::end(g_regions)) {
+            return;
+        }
+        region = it->second;
+        g_regions.erase(it);
+    }
+
+#ifdef __linux__
+    if (region.mapped) {
+        munmap(ptr, region.size);
+        return;
+    }
+#endif
+    FreeHeap(ptr);
+}
+
+size_t HugePages::GetPageSize(const void *ptr) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    const auto it = g_regions.find(ptr);
+    if (it == std::end(g_regions)) {
+        return kNormalPageSize;
+    }
+    return it->second.page_size;
+}
+
+std::string HugePages::GetPageSizeString(size_t page_size) {
+    if (page_size >= k1GiBPageSize) {
+        return Format("%zu GiB", page_size / k1GiBPageSize);
+    }
+    if (page_size >= 1024 * 1024) {
+        return Format("%zu MiB", page_size / (1024 * 1024));
+    }
+    return Format("%zu KiB", page_size / 1024);
+}
+
+std::string HugePages::GetSystemInfo() {
+    auto out = std::ostringstream{};
+#ifdef __linux__
+    // Every directory is one pool of the hugetlbfs, like
+    // "hugepages-2048kB".
+    for (const auto page_size : {k2MiBPageSize, k1GiBPageSize}) {
+        const auto dir = Format("/sys/kernel/mm/hugepages/hugepages-%zukB", page_size / 1024);
+        auto file = std::ifstream{ConnectPath(dir, "free_hugepages")};
+        size_t free_pages = 0;
+        if (file >> free_pages) {
+            out << Format("%zu free %s pages, ",
+                              free_pages, GetPageSizeString(page_size).c_str());
+        }
+    }
+    out << Format("transparent huge pages %s",
+                      TransparentEnabled() ? "enabled" : "disabled");
+#else
+    out << "no huge pages on this platform";
+#endif
+    return out.str();
+}
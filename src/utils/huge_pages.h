@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <string>
+
+// Allocate the large random access tables, e.g. the NN cache and the
+// node arena, on the huge pages, so they need far fewer TLB entries.
+// It tries the 1 GiB and the 2 MiB pages of the hugetlbfs pool first,
+// then asks the transparent huge pages, and then falls back to the
+// normal pages. Only works on Linux. The other platforms always use
+// the normal pages.
+class HugePages {
+public:
+    // Enable it before the tables are allocated. It is disabled by
+    // default.
+    static void SetEnabled(bool enabled);
+    static bool Enabled();
+
+    // Allocate the memory aligned to the cache line at least, or to
+    // the given power of two alignment. Return nullptr if fail. The
+    // memory is not cleared.
+    static void *Allocate(size_t bytes, size_t alignment = 64);
+    static void Free(void *ptr);
+
+    // Return the page size of the allocated memory. The transparent
+    // huge pages are counted as 2 MiB, but the kernel may still give
+    // some normal pages.
+    static size_t GetPageSize(const void *ptr);
+
+    // Return the string like "2 MiB".
+    static std::string GetPageSizeString(size_t page_size);
+
+    // Return the huge pages which the system offers.
+    static std::string GetSystemInfo();
+};
+
+// The allocator of the STL containers which uses the huge pages.
+template <typename T>
+class HugePageAllocator {
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = HugePageAllocator<U>;
+    };
+
+    HugePageAllocator() = default;
+
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U> &) {}
+
+    T *allocate(std::size_t n) {
+        auto ptr = HugePages::Allocate(n * sizeof(T));
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, std::size_t) {
+        HugePages::Free(ptr);
+    }
+
+    template <typename U>
+    bool operator==(const HugePageAllocator<U> &) const { return true; }
+
+    template <typename U>
+    bool operator!=(const HugePageAllocator<U> &) const { return false; }
+};
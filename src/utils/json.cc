@@ -0,0 +1,240 @@
+#include "utils/json.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+constexpr int Json::kMaxDepth;
+
+namespace {
+
+void AppendUtf8(std::string &out, unsigned int code) {
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    } else if (code < 0x800) {
+        out += static_cast<char>(0xc0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+        out += static_cast<char>(0xe0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    } else {
+        out += static_cast<char>(0xf0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+}
+
+unsigned int ParseHex4(const std::string &text, size_t pos) {
+    if (pos + 4 > text.size()) {
+        throw "The unicode escape is too short.";
+    }
+    unsigned int code = 0;
+    for (size_t i = pos; i < pos + 4; ++i) {
+        const char c = text[i];
+        code <<= 4;
+        if (c >= '0' && c <= '9') {
+            code |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            code |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            code |= c - 'A' + 10;
+        } else {
+            throw "The unicode escape is not hex.";
+        }
+    }
+    return code;
+}
+
+} // namespace
+
+Json Json::Parse(const std::string &text) {
+    size_t pos = 0;
+    auto value = ParseValue(text, pos, 0);
+    SkipSpaces(text, pos);
+    if (pos != text.size()) {
+        throw "There are characters after the JSON value.";
+    }
+    return value;
+}
+
+std::string Json::Quote(const std::string &str) {
+    auto out = std::string{"\""};
+    for (const char c : str) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+    return out;
+}
+
+const Json *Json::Find(const std::string &key) const {
+    for (const auto &it : object_) {
+        if (it.first == key) {
+            return &it.second;
+        }
+    }
+    return nullptr;
+}
+
+void Json::SkipSpaces(const std::string &text, size_t &pos) {
+    while (pos < text.size() &&
+               std::isspace(static_cast<unsigned char>(text[pos]))) {
+        ++pos;
+    }
+}
+
+std::string Json::ParseString(const std::string &text, size_t &pos) {
+    // The current character is the opening quote.
+    auto out = std::string{};
+    ++pos;
+    while (true) {
+        if (pos >= text.size()) {
+            throw "The string is not closed.";
+        }
+        const char c = text[pos++];
+        if (c == '"') {
+            break;
+        }
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+        if (pos >= text.size()) {
+            throw "The string is not closed.";
+        }
+        const char e = text[pos++];
+        switch (e) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                auto code = ParseHex4(text, pos);
+                pos += 4;
+                if (code >= 0xd800 && code < 0xdc00 &&
+                        pos + 6 <= text.size() &&
+                        text[pos] == '\\' && text[pos+1] == 'u') {
+                    // The surrogate pair.
+                    const auto low = ParseHex4(text, pos + 2);
+                    if (low >= 0xdc00 && low < 0xe000) {
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                        pos += 6;
+                    }
+                }
+                AppendUtf8(out, code);
+                break;
+            }
+            default:
+                throw "The string has an invalid escape.";
+        }
+    }
+    return out;
+}
+
+Json Json::ParseValue(const std::string &text, size_t &pos, int depth) {
+    if (depth > kMaxDepth) {
+        throw "The JSON value is nested too deeply.";
+    }
+    SkipSpaces(text, pos);
+    if (pos >= text.size()) {
+        throw "The JSON value is missing.";
+    }
+
+    auto value = Json{};
+    const char c = text[pos];
+
+    if (c == '{') {
+        value.type_ = Type::kObject;
+        ++pos;
+        SkipSpaces(text, pos);
+        if (pos < text.size() && text[pos] == '}') {
+            ++pos;
+            return value;
+        }
+        while (true) {
+            SkipSpaces(text, pos);
+            if (pos >= text.size() || text[pos] != '"') {
+                throw "The object key must be a string.";
+            }
+            auto key = ParseString(text, pos);
+            SkipSpaces(text, pos);
+            if (pos >= text.size() || text[pos] != ':') {
+                throw "The object key is not followed by ':'.";
+            }
+            ++pos;
+            auto item = ParseValue(text, pos, depth + 1);
+            value.object_.emplace_back(std::move(key), std::move(item));
+            SkipSpaces(text, pos);
+            if (pos < text.size() && text[pos] == ',') {
+                ++pos;
+            } else if (pos < text.size() && text[pos] == '}') {
+                ++pos;
+                break;
+            } else {
+                throw "The object is not closed.";
+            }
+        }
+    } else if (c == '[') {
+        value.type_ = Type::kArray;
+        ++pos;
+        SkipSpaces(text, pos);
+        if (pos < text.size() && text[pos] == ']') {
+            ++pos;
+            return value;
+        }
+        while (true) {
+            value.array_.emplace_back(ParseValue(text, pos, depth + 1));
+            SkipSpaces(text, pos);
+            if (pos < text.size() && text[pos] == ',') {
+                ++pos;
+            } else if (pos < text.size() && text[pos] == ']') {
+                ++pos;
+                break;
+            } else {
+                throw "The array is not closed.";
+            }
+        }
+    } else if (c == '"') {
+        value.type_ = Type::kString;
+        value.string_ = ParseString(text, pos);
+    } else if (text.compare(pos, 4, "true") == 0) {
+        value.type_ = Type::kBool;
+        value.bool_ = true;
+        pos += 4;
+    } else if (text.compare(pos, 5, "false") == 0) {
+        value.type_ = Type::kBool;
+        value.bool_ = false;
+        pos += 5;
+    } else if (text.compare(pos, 4, "null") == 0) {
+        pos += 4;
+    } else {
+        const char *begin = text.c_str() + pos;
+        char *end = nullptr;
+        value.number_ = std::strtod(begin, &end);
+        if (end == begin) {
+            throw "The JSON value is invalid.";
+        }
+        value.type_ = Type::kNumber;
+        pos += end - begin;
+    }
+    return value;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// The minimal JSON value for the line based protocols. The numbers are
+// stored in double and the object keeps the order of keys. Parse() throws
+// the const char* if the text is not valid.
+class Json {
+public:
+    enum class Type {
+        kNull, kBool, kNumber, kString, kArray, kObject
+    };
+
+    Json() = default;
+
+    static Json Parse(const std::string &text);
+
+    // Escape the string and quote it.
+    static std::string Quote(const std::string &str);
+
+    Type GetType() const { return type_; }
+
+    bool IsNull() const { return type_ == Type::kNull; }
+    bool IsBool() const { return type_ == Type::kBool; }
+    bool IsNumber() const { return type_ == Type::kNumber; }
+    bool IsString() const { return type_ == Type::kString; }
+    bool IsArray() const { return type_ == Type::kArray; }
+    bool IsObject() const { return type_ == Type::kObject; }
+
+    bool GetBool() const { return bool_; }
+    double GetNumber() const { return number_; }
+    const std::string &GetString() const { return string_; }
+    const std::vector<Json> &GetArray() const { return array_; }
+
+    // Return nullptr if it is not the object or has no such key.
+    const Json *Find(const std::string &key) const;
+
+private:
+    static constexpr int kMaxDepth = 64;
+
+    static Json ParseValue(const std::string &text, size_t &pos, int depth);
+    static std::string ParseString(const std::string &text, size_t &pos);
+    static void SkipSpaces(const std::string &text, size_t &pos);
+
+    Type type_{Type::kNull};
+    bool bool_{false};
+    double number_{0};
+    std::string string_;
+    std::vector<Json> array_;
+    std::vector<std::pair<std::string, Json>> object_;
+};
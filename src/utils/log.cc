@@ -2,12 +2,32 @@
 
 #include "utils/log.h"
 
+constexpr size_t LogWriter::kQueueSize;
+
 LogWriter& LogWriter::Get() {
     static LogWriter writer;
     return writer;
 }
 
+LogWriter::LogWriter() {
+    running_.store(true);
+    flusher_ = std::thread([this]() { FlushLoop(); });
+}
+
+LogWriter::~LogWriter() {
+    {
+        std::lock_guard<std::mutex> lk(wake_mutex_);
+        running_.store(false);
+    }
+    wake_cv_.notify_one();
+    if (flusher_.joinable()) {
+        flusher_.join();
+    }
+}
+
 void LogWriter::SetFilename(std::string filename) {
+    Flush();
+
     std::lock_guard<std::mutex> lk(mutex_);
     if (filename_ == filename) {
         return;
@@ -22,16 +42,85 @@ void LogWriter::SetFilename(std::string filename) {
     file_.open(filename_, std::ios_base::app);
 }
 
-void LogWriter::WriteString(std::string data) {
+void LogWriter::Flush() {
+    while (running_.load(std::memory_order_relaxed) &&
+               pending_.load(std::memory_order_acquire) != 0) {
+        wake_cv_.notify_one();
+        std::this_thread::yield();
+    }
+}
+
+void LogWriter::Push(std::string &&data, Target target) {
+    auto msg = Message{std::move(data), target};
+
+    if (!running_.load(std::memory_order_relaxed)) {
+        // The writer is stopping, write it here.
+        WriteMessage(msg);
+        return;
+    }
+
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    if (!queue_.TryPush(msg)) {
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    wake_cv_.notify_one();
+}
+
+void LogWriter::WriteMessage(const Message &msg) {
     std::lock_guard<std::mutex> lk(mutex_);
 
-    auto stm = std::istringstream(data);
-    auto line = std::string{};
+    if (msg.target == kStderr) {
+        std::cerr << msg.data << std::flush;
+    } else if (msg.target == kStdout) {
+        std::cout << msg.data << std::flush;
+    }
+    WriteFile(msg.data);
+}
 
+void LogWriter::WriteFile(const std::string &data) {
     if (!filename_.empty()) {
         // TODO: Print more verbose for every lines.
-        while (std::getline(stm, line)) {
-            file_ << line << std::endl;
+        file_ << data;
+        if (!data.empty() && data.back() != '\n') {
+            file_ << '\n';
+        }
+        file_.flush();
+    }
+}
+
+void LogWriter::FlushLoop() {
+    auto msg = Message{};
+
+    while (true) {
+        bool written = false;
+        while (queue_.TryPop(msg)) {
+            WriteMessage(msg);
+            pending_.fetch_sub(1, std::memory_order_release);
+            written = true;
+        }
+
+        const auto dropped = dropped_.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            auto report = Message{};
+            report.data = "[" + std::to_string(dropped) + " log messages are dropped]\n";
+            report.target = kStderr;
+            WriteMessage(report);
+        }
+
+        if (!running_.load()) {
+            if (pending_.load(std::memory_order_acquire) == 0) {
+                return;
+            }
+            continue;
+        }
+        if (!written) {
+            std::unique_lock<std::mutex> lk(wake_mutex_);
+            wake_cv_.wait_for(lk, std::chrono::milliseconds(10), [this]() {
+                return pending_.load(std::memory_order_acquire) != 0 ||
+                           !running_.load();
+            });
         }
     }
 }
@@ -45,6 +134,20 @@ void LogOptions::SetQuiet(bool q) {
     quiet_ = q;
 }
 
+bool LogRateLimiter::Allow(double seconds) {
+    const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now().time_since_epoch()).count();
+    auto next = next_time_.load(std::memory_order_relaxed);
+
+    if (now < next) {
+        return false;
+    }
+    // Only one thread wins the interval.
+    return next_time_.compare_exchange_strong(
+               next, now + static_cast<std::int64_t>(seconds * 1000),
+               std::memory_order_relaxed);
+}
+
 Logging::Logging(const char* file, int line, bool err, bool write_only, bool use_options) {
     file_ = std::string{file};
     line_ = line;
@@ -54,12 +157,21 @@ Logging::Logging(const char* file, int line, bool err, bool write_only, bool use
 }
 
 Logging::~Logging() {
-    if (!write_only_ && (!use_options_ || !LogOptions::Get().quiet_)) {
-        if (err_) {
-            std::cerr << str() << std::flush;
-        } else {
-            std::cout << str() << std::flush;
-        }
+    auto &writer = LogWriter::Get();
+    const auto print = !write_only_ && (!use_options_ || !LogOptions::Get().quiet_);
+
+    if (!use_options_) {
+        // It is the GTP response. Write the queued logs first and
+        // answer at once, so the controller never waits for it.
+        writer.Flush();
+        writer.WriteMessage(LogWriter::Message{str(), print ?
+                                LogWriter::kStdout : LogWriter::kFileOnly});
+        return;
+    }
+
+    auto target = LogWriter::kFileOnly;
+    if (print) {
+        target = err_ ? LogWriter::kStderr : LogWriter::kStdout;
     }
-    LogWriter::Get().WriteString(str());
+    writer.Push(str(), target);
 }
@@ -1,25 +1,68 @@
 #pragma once
 
+#include "utils/mpmc_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <sstream>
 #include <fstream>
 #include <string>
 #include <deque>
 #include <mutex>
+#include <thread>
 
+// Write the logs in the background thread. The threads which log only
+// push the message into the lock-free queue, so they never wait for
+// the terminal or the log file. If the queue is full, the message is
+// dropped and counted instead of blocking.
 class LogWriter {
 public:
     static LogWriter& Get();
 
     void SetFilename(std::string filename);
 
+    // Wait until all the queued messages are written.
+    void Flush();
+
+    ~LogWriter();
+
 private:
-    void WriteString(std::string data);
+    enum Target : std::uint8_t {
+        kFileOnly = 0,
+        kStdout,
+        kStderr
+    };
+
+    struct Message {
+        std::string data;
+        Target target{kFileOnly};
+    };
+
+    static constexpr size_t kQueueSize = 8192;
+
+    LogWriter();
+
+    void Push(std::string &&data, Target target);
+    void WriteMessage(const Message &msg);
+    void WriteFile(const std::string &data);
+    void FlushLoop();
 
     std::mutex mutex_;
 
     std::string filename_{};
     std::ofstream file_;
 
+    MpmcQueue<Message> queue_{kQueueSize};
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> dropped_{0};
+
+    std::atomic<bool> running_{false};
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::thread flusher_;
+
     friend class Logging;
 };
 
@@ -48,6 +91,32 @@ private:
     int line_;
 };
 
+// Allow one message in every interval. Every call site of the
+// LOGGING_EVERY has its own limiter.
+class LogRateLimiter {
+public:
+    bool Allow(double seconds);
+
+private:
+    std::atomic<std::int64_t> next_time_{0};
+};
+
 #define LOGGING (::Logging(__FILE__, __LINE__, true,  false, true))
 #define WRITING (::Logging(__FILE__, __LINE__, false, true,  true))
 #define DUMPING (::Logging(__FILE__, __LINE__, false, false, false))
+
+// The debug logs are compiled out in the release build.
+#ifdef NDEBUG
+#define DEBUG_LOGGING while (false) LOGGING
+#else
+#define DEBUG_LOGGING LOGGING
+#endif
+
+// Log at most once in every given seconds. The other messages of this
+// line are skipped without formatting them.
+#define LOGGING_EVERY(seconds)                                       \
+    for (bool log_allowed_ = []() -> ::LogRateLimiter& {             \
+                 static ::LogRateLimiter limiter;                    \
+                 return limiter;                                     \
+             }().Allow(seconds);                                     \
+         log_allowed_; log_allowed_ = false) LOGGING
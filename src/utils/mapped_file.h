@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A read-only memory mapped file. The mapping is released when
+// the object is destroyed.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map the whole file. Return false if fail.
+    bool Open(const std::string &filename);
+    void Close();
+
+    const char *Data() const { return data_; }
+    size_t Size() const { return size_; }
+
+private:
+    const char *data_{nullptr};
+    size_t size_{0};
+
+#ifdef WIN32
+    void *file_{nullptr};
+    void *mapping_{nullptr};
+#endif
+};
@@ -0,0 +1,207 @@
+#include "utils/metrics.h"
+#include "utils/format.h"
+#include "utils/socket.h"
+
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+constexpr int Metrics::kMaxWorkers;
+
+namespace {
+
+// The counters of one thread. Only the owner writes them, so it uses
+// the plain load and store instead of the locked add.
+struct ThreadSlots {
+    alignas(64) std::array<std::atomic<std::int64_t>, Metrics::kNumCounters> counters{};
+};
+
+// All living slots and the sums of the finished threads.
+struct Registry {
+    std::mutex mutex;
+    std::vector<const ThreadSlots*> slots;
+    std::array<std::int64_t, Metrics::kNumCounters> retired{};
+
+    static Registry &Get() {
+        static Registry registry;
+        return registry;
+    }
+};
+
+struct ThreadHolder {
+    ThreadSlots slots;
+
+    ThreadHolder() {
+        auto &registry = Registry::Get();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.slots.emplace_back(&slots);
+    }
+
+    ~ThreadHolder() {
+        auto &registry = Registry::Get();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (int i = 0; i < Metrics::kNumCounters; ++i) {
+            registry.retired[i] += slots.counters[i].load(std::memory_order_relaxed);
+        }
+        registry.slots.erase(std::remove(std::begin(registry.slots),
+                                             std::end(registry.slots), &slots),
+                                 std::end(registry.slots));
+    }
+};
+
+ThreadSlots &GetThreadSlots() {
+    thread_local ThreadHolder holder;
+    return holder.slots;
+}
+
+void AppendMetric(std::ostringstream &out,
+                      const char *name, const char *type, const char *help) {
+    out << "# HELP " << name << ' ' << help << '\n'
+        << "# TYPE " << name << ' ' << type << '\n';
+}
+
+} // namespace
+
+void Metrics::Add(Counter counter, std::int64_t value) {
+    auto &c = GetThreadSlots().counters[counter];
+    c.store(c.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+std::int64_t Metrics::GetCounter(Counter counter) {
+    auto &registry = Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    auto sum = registry.retired[counter];
+    for (const auto *s : registry.slots) {
+        sum += s->counters[counter].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+Metrics::Gauges &Metrics::GetGauges() {
+    static Gauges gauges;
+    return gauges;
+}
+
+void Metrics::AddBatch(int worker, int batch_size, int max_batch) {
+    auto &slots = GetGauges().workers[std::max(0, std::min(worker, kMaxWorkers - 1))];
+    slots.batches.fetch_add(1, std::memory_order_relaxed);
+    slots.entries.fetch_add(batch_size, std::memory_order_relaxed);
+    slots.capacity.fetch_add(max_batch, std::memory_order_relaxed);
+}
+
+void Metrics::AddQueueWait(std::int64_t us) {
+    auto &gauges = GetGauges();
+    gauges.queue_wait_sum_us.fetch_add(us, std::memory_order_relaxed);
+    gauges.queue_wait.Add(us);
+}
+
+void Metrics::SetSearch(int playouts, double seconds, size_t tree_memory) {
+    auto &gauges = GetGauges();
+    gauges.searches.fetch_add(1, std::memory_order_relaxed);
+    gauges.playouts_per_second.store(playouts / std::max(seconds, 1e-3),
+                                         std::memory_order_relaxed);
+    gauges.tree_memory.store(tree_memory, std::memory_order_relaxed);
+}
+
+std::string Metrics::GetPrometheusString() {
+    auto &gauges = GetGauges();
+    auto out = std::ostringstream{};
+
+    AppendMetric(out, "sayuri_nodes_inflated_total", "counter", "The number of inflated tree nodes.");
+    out << "sayuri_nodes_inflated_total " << GetCounter(kNodesInflated) << '\n';
+    AppendMetric(out, "sayuri_playouts_total", "counter", "The number of finished playouts.");
+    out << "sayuri_playouts_total " << GetCounter(kPlayouts) << '\n';
+    AppendMetric(out, "sayuri_nn_evals_total", "counter", "The number of network forwards.");
+    out << "sayuri_nn_evals_total " << GetCounter(kNnEvals) << '\n';
+    AppendMetric(out, "sayuri_cache_hits_total", "counter", "The number of network cache hits.");
+    out << "sayuri_cache_hits_total " << GetCounter(kCacheHits) << '\n';
+    AppendMetric(out, "sayuri_cache_misses_total", "counter", "The number of network cache misses.");
+    out << "sayuri_cache_misses_total " << GetCounter(kCacheMisses) << '\n';
+
+    AppendMetric(out, "sayuri_ponders_total", "counter", "The number of the pondering searches followed by a move.");
+    out << "sayuri_ponders_total " << GetCounter(kPonders) << '\n';
+    AppendMetric(out, "sayuri_ponder_hits_total", "counter", "The number of the opponent moves which are pondered.");
+    out << "sayuri_ponder_hits_total " << GetCounter(kPonderHits) << '\n';
+    AppendMetric(out, "sayuri_ponder_hit_seconds_total", "counter", "The pondering time before the hits.");
+    out << Format("sayuri_ponder_hit_seconds_total %.3f\n", GetCounter(kPonderHitMilliseconds) / 1000.0);
+    AppendMetric(out, "sayuri_ponder_reused_visits_total", "counter", "The root visits reused after the pondering.");
+    out << "sayuri_ponder_reused_visits_total " << GetCounter(kPonderReusedVisits) << '\n';
+
+    AppendMetric(out, "sayuri_batches_total", "counter", "The number of dispatched batches per worker.");
+    for (int i = 0; i < kMaxWorkers; ++i) {
+        const auto batches = gauges.workers[i].batches.load(std::memory_order_relaxed);
+        if (batches > 0) {
+            out << Format("sayuri_batches_total{worker=\"%d\"} %lld\n", i, (long long)batches);
+        }
+    }
+    AppendMetric(out, "sayuri_batch_fill_ratio", "gauge", "The average batch size over the maximum batch size per worker.");
+    for (int i = 0; i < kMaxWorkers; ++i) {
+        const auto &w = gauges.workers[i];
+        const auto capacity = w.capacity.load(std::memory_order_relaxed);
+        if (capacity > 0) {
+            out << Format("sayuri_batch_fill_ratio{worker=\"%d\"} %.4f\n", i,
+                              (double)w.entries.load(std::memory_order_relaxed) / capacity);
+        }
+    }
+
+    AppendMetric(out, "sayuri_queue_wait_microseconds", "summary", "The time which the entries waited in the forward queue.");
+    for (const double q : {0.5, 0.9, 0.99}) {
+        out << Format("sayuri_queue_wait_microseconds{quantile=\"%.2f\"} %.1f\n",
+                          q, gauges.queue_wait.GetPercentile(q));
+    }
+    out << "sayuri_queue_wait_microseconds_sum "
+            << gauges.queue_wait_sum_us.load(std::memory_order_relaxed) << '\n'
+        << "sayuri_queue_wait_microseconds_count " << gauges.queue_wait.GetCount() << '\n';
+
+    AppendMetric(out, "sayuri_searches_total", "counter", "The number of finished searches.");
+    out << "sayuri_searches_total " << gauges.searches.load(std::memory_order_relaxed) << '\n';
+    AppendMetric(out, "sayuri_playouts_per_second", "gauge", "The speed of the last search.");
+    out << Format("sayuri_playouts_per_second %.1f\n",
+                      gauges.playouts_per_second.load(std::memory_order_relaxed));
+    AppendMetric(out, "sayuri_tree_memory_bytes", "gauge", "The tree memory at the end of the last search.");
+    out << "sayuri_tree_memory_bytes " << gauges.tree_memory.load(std::memory_order_relaxed) << '\n';
+
+    return out.str();
+}
+
+bool Metrics::StartHttpServer(int port) {
+    auto server = Socket{};
+    if (!server.Listen(port)) {
+        return false;
+    }
+
+    // It serves until the process exits. Every request gets the
+    // metrics, whatever the path is.
+    std::thread([server = std::move(server)]() mutable {
+        while (true) {
+            auto client = server.Accept();
+            if (!client.Valid()) {
+                continue;
+            }
+
+            // Read the request head. The body is not used.
+            auto request = std::string{};
+            char buf[1024];
+            while (request.find("\r\n\r\n") == std::string::npos &&
+                       request.size() < 8192) {
+                const auto n = client.Recv(buf, sizeof(buf));
+                if (n <= 0) {
+                    break;
+                }
+                request.append(buf, n);
+            }
+
+            const auto body = GetPrometheusString();
+            const auto response =
+                Format("HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/plain; version=0.0.4\r\n"
+                       "Content-Length: %zu\r\n"
+                       "Connection: close\r\n\r\n", body.size()) + body;
+            client.SendAll(response.data(), response.size());
+        }
+    }).detach();
+    return true;
+}
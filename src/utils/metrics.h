@@ -0,0 +1,71 @@
+#pragma once
+
+#include "utils/histogram.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The process wide counters for the monitoring. Every thread adds to
+// its own slots, so the hot paths never share the cache lines and they
+// are cheap enough to leave on. The reader sums the slots of all
+// threads. The output is in the Prometheus text format.
+class Metrics {
+public:
+    enum Counter : int {
+        kNodesInflated = 0,
+        kPlayouts,
+        kNnEvals,
+        kCacheHits,
+        kCacheMisses,
+        kPonders,
+        kPonderHits,
+        kPonderHitMilliseconds,
+        kPonderReusedVisits,
+        kNumCounters
+    };
+
+    // The batch workers, e.g. one per GPU. The larger indices are
+    // counted in the last worker.
+    static constexpr int kMaxWorkers = 16;
+
+    static void Add(Counter counter, std::int64_t value = 1);
+    static std::int64_t GetCounter(Counter counter);
+
+    // Record one dispatched batch of the worker.
+    static void AddBatch(int worker, int batch_size, int max_batch);
+
+    // Record the time which the entry waited in the queue.
+    static void AddQueueWait(std::int64_t us);
+
+    // Record the last search.
+    static void SetSearch(int playouts, double seconds, size_t tree_memory);
+
+    static std::string GetPrometheusString();
+
+    // Serve the metrics by HTTP on the port in the background thread.
+    // Return false if it fails to listen.
+    static bool StartHttpServer(int port);
+
+private:
+    struct WorkerSlots {
+        std::atomic<std::int64_t> batches{0};
+        std::atomic<std::int64_t> entries{0};
+        std::atomic<std::int64_t> capacity{0};
+    };
+
+    struct Gauges {
+        std::array<WorkerSlots, kMaxWorkers> workers;
+
+        std::atomic<std::int64_t> queue_wait_sum_us{0};
+        LatencyHistogram queue_wait;
+
+        std::atomic<std::int64_t> searches{0};
+        std::atomic<double> playouts_per_second{0.0};
+        std::atomic<std::int64_t> tree_memory{0};
+    };
+
+    static Gauges &GetGauges();
+};
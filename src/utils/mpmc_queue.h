@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// The bounded lock-free queue for many producers and many consumers. Every
+// cell has its own sequence number, so the producers and the consumers
+// only race on the head and the tail indices. The capacity is rounded up
+// to a power of two.
+template<typename T>
+class MpmcQueue {
+public:
+    explicit MpmcQueue(size_t capacity);
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    // Push the item. Return false if the queue is full, the item
+    // is not moved in this case.
+    bool TryPush(T &item);
+
+    // Pop the item. Return false if the queue is empty.
+    bool TryPop(T &item);
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+
+    // Keep the indices on the different cache lines.
+    std::atomic<size_t> tail_{0};
+    char padding_[64];
+    std::atomic<size_t> head_{0};
+};
+
+template<typename T>
+MpmcQueue<T>::MpmcQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    mask_ = size - 1;
+    cells_ = std::make_unique<Cell[]>(size);
+    for (size_t i = 0; i < size; ++i) {
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+bool MpmcQueue<T>::TryPush(T &item) {
+    auto pos = tail_.load(std::memory_order_relaxed);
+    Cell *cell;
+
+    while (true) {
+        cell = &cells_[pos & mask_];
+        const auto seq = cell->sequence.load(std::memory_order_acquire);
+        const auto diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+
+        if (diff == 0) {
+            // The cell is free. Try to take it.
+            if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The consumers did not release this cell yet, it is full.
+            return false;
+        } else {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->data = std::move(item);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+bool MpmcQueue<T>::TryPop(T &item) {
+    auto pos = head_.load(std::memory_order_relaxed);
+    Cell *cell;
+
+    while (true) {
+        cell = &cells_[pos & mask_];
+        const auto seq = cell->sequence.load(std::memory_order_acquire);
+        const auto diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1);
+
+        if (diff == 0) {
+            // The cell is filled. Try to take it.
+            if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The producers did not fill this cell yet, it is empty.
+            return false;
+        } else {
+            pos = head_.load(std::memory_order_relaxed);
+        }
+    }
+
+    item = std::move(cell->data);
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+}
@@ -86,6 +86,13 @@ public:
         owner_.store(0, std::memory_order_release);
     }
 
+    // Take the lock only if it is free now.
+    bool try_lock() TRY_ACQUIRE(true) {
+        auto old_val = 0;
+        return owner_.load(std::memory_order_relaxed) == 0 &&
+                   owner_.compare_exchange_strong(old_val, 1, std::memory_order_acq_rel);
+    }
+
     SpinLock() = default;
     ~SpinLock() = default;
 
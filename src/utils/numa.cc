@@ -0,0 +1,133 @@
+#include "utils/numa.h"
+#include "utils/filesystem.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// Parse the sysfs cpu list, e.g. "0-15,32-47".
+std::vector<int> ParseCpuList(const std::string &list) {
+    auto cpus = std::vector<int>{};
+    auto iss = std::istringstream{list};
+    auto range = std::string{};
+
+    while (std::getline(iss, range, ',')) {
+        const auto dash = range.find('-');
+        try {
+            if (dash == std::string::npos) {
+                cpus.emplace_back(std::stoi(range));
+            } else {
+                const int first = std::stoi(range.substr(0, dash));
+                const int last = std::stoi(range.substr(dash + 1));
+                for (int c = first; c <= last; ++c) {
+                    cpus.emplace_back(c);
+                }
+            }
+        } catch (...) {
+            // Skip the broken range.
+        }
+    }
+    return cpus;
+}
+
+std::string ReadLine(const std::string &filename) {
+    auto file = std::ifstream{filename};
+    auto line = std::string{};
+    std::getline(file, line);
+    return line;
+}
+
+} // namespace
+
+const Numa &Numa::Get() {
+    static Numa numa;
+    return numa;
+}
+
+Numa::Numa() {
+#if defined(__linux__)
+    for (int node = 0; ; ++node) {
+        const auto path = ConnectPath(
+                              "/sys/devices/system/node", "node" + std::to_string(node));
+        if (!IsDirectoryExist(path)) {
+            break;
+        }
+        auto cpus = ParseCpuList(ReadLine(ConnectPath(path, "cpulist")));
+        if (cpus.empty()) {
+            // The memory only node.
+            continue;
+        }
+        cpus_.emplace_back(std::move(cpus));
+        node_ids_.emplace_back(node);
+    }
+#endif
+    if (cpus_.empty()) {
+        const int cores = std::max(1u, std::thread::hardware_concurrency());
+        cpus_.emplace_back(cores);
+        for (int c = 0; c < cores; ++c) {
+            cpus_[0][c] = c;
+        }
+    }
+}
+
+int Numa::GetNumNodes() const {
+    return cpus_.size();
+}
+
+const std::vector<int> &Numa::GetCpus(int node) const {
+    return cpus_[node % cpus_.size()];
+}
+
+void Numa::PinThread(size_t index) const {
+    const int node = index % cpus_.size();
+    const auto &cpus = cpus_[node];
+    CurrentNode() = node;
+#if defined(__linux__)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpus[(index / cpus_.size()) % cpus.size()], &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+#else
+    (void) cpus;
+#endif
+}
+
+int &Numa::CurrentNode() {
+    thread_local int node = 0;
+    return node;
+}
+
+int Numa::GetCurrentNode() {
+    return CurrentNode();
+}
+
+int Numa::GetDeviceNode(const std::string &pci_bus_id) const {
+#if defined(__linux__)
+    auto id = pci_bus_id;
+    std::transform(std::begin(id), std::end(id), std::begin(id),
+                       [](unsigned char c){ return std::tolower(c); });
+    const auto line = ReadLine(ConnectPath({"/sys/bus/pci/devices", id, "numa_node"}));
+    try {
+        // The sysfs gives -1 if the machine has only one node.
+        const auto it = std::find(std::begin(node_ids_), std::end(node_ids_), std::stoi(line));
+        if (it != std::end(node_ids_)) {
+            return it - std::begin(node_ids_);
+        }
+    } catch (...) {
+        // Fall through.
+    }
+    return 0;
+#else
+    (void) pci_bus_id;
+    return 0;
+#endif
+}
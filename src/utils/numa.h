@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// The NUMA nodes of this machine and the CPU cores of every node. The
+// layout is read from the sysfs on Linux. The other platforms, or the
+// machine without the sysfs, have one node with all cores.
+class Numa {
+public:
+    static const Numa &Get();
+
+    int GetNumNodes() const;
+
+    // Return the CPU cores of the node.
+    const std::vector<int> &GetCpus(int node) const;
+
+    // Pin current thread on one core. The workers are spread over the
+    // nodes in turn, so that the first threads use all nodes. Remember
+    // the node for GetCurrentNode().
+    void PinThread(size_t index) const;
+
+    // Return the node of current thread. It is 0 if the thread
+    // is not pinned.
+    static int GetCurrentNode();
+
+    // Return the node of the PCI device, e.g. "0000:3b:00.0". Return
+    // 0 if it is unknown.
+    int GetDeviceNode(const std::string &pci_bus_id) const;
+
+private:
+    Numa();
+
+    static int &CurrentNode();
+
+    std::vector<std::vector<int>> cpus_;
+
+    // The sysfs number of every node. The memory only nodes are
+    // skipped, so it may differ from the index.
+    std::vector<int> node_ids_;
+};
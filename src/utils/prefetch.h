@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+// Ask the CPU to load the cache line of the address in the background.
+// It is only a hint, so the invalid address is fine.
+inline void PrefetchRead(const void *addr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(addr, 0, 3);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_prefetch(static_cast<const char *>(addr), _MM_HINT_T0);
+#else
+    (void) addr;
+#endif
+}
+
+// Prefetch the first lines of the memory.
+inline void PrefetchRead(const void *addr, std::size_t bytes) {
+    constexpr std::size_t kCacheLine = 64;
+    const auto ptr = static_cast<const char *>(addr);
+    for (std::size_t offset = 0; offset < bytes; offset += kCacheLine) {
+        PrefetchRead(ptr + offset);
+    }
+}
@@ -1,5 +1,9 @@
 #include "utils/random.h"
+#include "utils/threadpool.h"
+
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 
 namespace random_utils {
 
@@ -31,6 +35,21 @@ inline std::uint64_t GetSeed(std::uint64_t seed) {
 }
 } // namespace random_utils
 
+std::atomic<std::uint32_t> FixedSeed::epoch_{0};
+std::atomic<std::uint64_t> FixedSeed::seed_{0};
+
+void FixedSeed::Set(std::uint64_t seed) {
+    // Store the seed first, so the new epoch always sees it.
+    seed_.store(seed);
+    epoch_.fetch_add(1);
+}
+
+std::uint64_t FixedSeed::GetThreadSeed() {
+    // The main thread is not a worker, its index is -1.
+    const auto index = ThreadPool::GetWorkerIndex() + 1;
+    return random_utils::SplitMix64(seed_.load() + index);
+}
+
 
 #define RANDOM_INIT__(TYPE__, CNT__)                \
 template<>                                          \
@@ -81,3 +100,140 @@ std::uint64_t Random<RandomType::kXoroShiro128Plus>::Generate() {
 
     return result;
 }
+
+RandomBatch::Streams &RandomBatch::GetStreams() {
+    const auto Seed = [](Streams &s) {
+        auto seed = Random<>::Get().Generate();
+        for (size_t i = 0; i < kLanes; ++i) {
+            seed = random_utils::SplitMix64(seed);
+            s.s0[i] = seed;
+            seed = random_utils::SplitMix64(seed);
+            s.s1[i] = seed;
+        }
+    };
+    static thread_local Streams streams;
+    static thread_local std::uint32_t epoch = 0;
+    static thread_local bool seeded = false;
+
+    // Restart with the generator of the thread if the seed is fixed
+    // again.
+    const auto current = FixedSeed::GetEpoch();
+    if (!seeded || epoch != current) {
+        Seed(streams);
+        epoch = current;
+        seeded = true;
+    }
+    return streams;
+}
+
+void RandomBatch::Generate(Streams &streams, std::uint64_t *out, size_t size) {
+    // The same steps as Random<kXoroShiro128Plus>::Generate(). The
+    // lanes are independent, so the inner loop is vectorized. Keep
+    // the states in the local arrays, so they never alias the output.
+    std::uint64_t s0[kLanes];
+    std::uint64_t s1[kLanes];
+    std::copy(streams.s0, streams.s0 + kLanes, s0);
+    std::copy(streams.s1, streams.s1 + kLanes, s1);
+
+    for (size_t i = 0; i < size; i += kLanes) {
+        for (size_t l = 0; l < kLanes; ++l) {
+            const std::uint64_t a = s0[l];
+            const std::uint64_t b = s1[l] ^ a;
+            out[i + l] = a + s1[l];
+            s0[l] = random_utils::rotl(a, 55) ^ b ^ (b << 14);
+            s1[l] = random_utils::rotl(b, 36);
+        }
+    }
+    std::copy(s0, s0 + kLanes, streams.s0);
+    std::copy(s1, s1 + kLanes, streams.s1);
+}
+
+void RandomBatch::FillUniform(float *buffer, size_t size) {
+    constexpr size_t kChunk = 64;
+    static_assert(kChunk % kLanes == 0, "");
+
+    auto &streams = GetStreams();
+    std::uint64_t bits[kChunk];
+    for (size_t i = 0; i < size; i += kChunk) {
+        const auto n = std::min(kChunk, size - i);
+        Generate(streams, bits, (n + kLanes - 1) / kLanes * kLanes);
+
+        // Take the high 23 bits and the half step, so it is in (0, 1).
+        // The float keeps the half step of 23 bits exactly.
+        for (size_t j = 0; j < n; ++j) {
+            buffer[i + j] = ((bits[j] >> 41) + 0.5f) * (1.0f / 8388608.0f);
+        }
+    }
+}
+
+void RandomBatch::FillGumbel(float *buffer, size_t size) {
+    FillUniform(buffer, size);
+    for (size_t i = 0; i < size; ++i) {
+        buffer[i] = -std::log(-std::log(buffer[i]));
+    }
+}
+
+void RandomBatch::FillNormal(float *buffer, size_t size) {
+    // The Box-Muller transform. Every pair of uniforms gives two
+    // normal samples.
+    constexpr size_t kChunk = 64;
+    float u1[kChunk / 2];
+    float u2[kChunk / 2];
+    for (size_t i = 0; i < size; i += kChunk) {
+        const auto n = std::min(kChunk, size - i);
+        const auto half = (n + 1) / 2;
+        FillUniform(u1, half);
+        FillUniform(u2, half);
+
+        float out[kChunk];
+        for (size_t j = 0; j < half; ++j) {
+            const float r = std::sqrt(-2.0f * std::log(u1[j]));
+            const float t = 6.2831853f * u2[j];
+            out[2 * j] = r * std::cos(t);
+            out[2 * j + 1] = r * std::sin(t);
+        }
+        std::copy(out, out + n, buffer + i);
+    }
+}
+
+void RandomBatch::FillGamma(float *buffer, size_t size, float alpha) {
+    // Marsaglia and Tsang's method. The alpha below 1 is boosted,
+    // Gamma(a) = Gamma(a + 1) * U^(1/a).
+    const bool boost = alpha < 1.0f;
+    const float d = (boost ? alpha + 1.0f : alpha) - 1.0f / 3.0f;
+    const float c = 1.0f / std::sqrt(9.0f * d);
+
+    // Test a chunk of candidates at once, then keep the accepted
+    // ones. Only a few percent are rejected.
+    constexpr size_t kChunk = 64;
+    float x[kChunk];
+    float u[kChunk];
+    float samples[kChunk];
+    size_t filled = 0;
+    while (filled < size) {
+        FillNormal(x, kChunk);
+        FillUniform(u, kChunk);
+        for (size_t j = 0; j < kChunk; ++j) {
+            const float v = 1.0f + c * x[j];
+            const float v3 = std::max(v * v * v, 1e-30f);
+            const bool accept = v > 0.0f &&
+                std::log(u[j]) < 0.5f * x[j] * x[j] + d * (1.0f - v3 + std::log(v3));
+            samples[j] = accept ? d * v3 : -1.0f;
+        }
+        for (size_t j = 0; j < kChunk && filled < size; ++j) {
+            if (samples[j] >= 0.0f) {
+                buffer[filled++] = samples[j];
+            }
+        }
+    }
+
+    if (boost) {
+        for (size_t i = 0; i < size; i += kChunk) {
+            const auto n = std::min(kChunk, size - i);
+            FillUniform(u, n);
+            for (size_t j = 0; j < n; ++j) {
+                buffer[i + j] *= std::exp(std::log(u[j]) / alpha);
+            }
+        }
+    }
+}
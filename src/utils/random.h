@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <limits>
 #include <random>
@@ -10,6 +11,28 @@
 static constexpr std::uint64_t kThreadSeed = 0;
 static constexpr std::uint64_t kTimeSeed = 1;
 
+// The fixed seed of the reproducible runs. Every change of the seed
+// starts a new epoch, and the generators of every thread restart at
+// their next draw. A thread takes its seed by its worker index in the
+// thread pool, so the same thread draws the same numbers in every run.
+class FixedSeed {
+public:
+    static void Set(std::uint64_t seed);
+
+    // Zero if the seed is never fixed. The threads keep their own
+    // seeds then.
+    static std::uint32_t GetEpoch() {
+        return epoch_.load(std::memory_order_relaxed);
+    }
+
+    // The seed of the current thread in the current epoch.
+    static std::uint64_t GetThreadSeed();
+
+private:
+    static std::atomic<std::uint32_t> epoch_;
+    static std::atomic<std::uint64_t> seed_;
+};
+
 // Select the different random generator that you want.
 enum RandomType {
     kSplitMix64,
@@ -63,6 +86,37 @@ private:
     void InitSeed(std::uint64_t);
 };
 
+// Draw many samples at once. It runs several xoroshiro128+ streams side
+// by side, so the compiler vectorizes the generator. Every thread has
+// its own streams, seeded from Random<>::Get(). Use it if the samples
+// of all children are needed, e.g. the root noise.
+class RandomBatch {
+public:
+    // The uniform floats in (0, 1). Never 0 or 1, so the log is safe.
+    static void FillUniform(float *buffer, size_t size);
+
+    // The standard Gumbel samples, -log(-log(u)).
+    static void FillGumbel(float *buffer, size_t size);
+
+    // The Gamma(alpha, 1) samples. The alpha must be positive.
+    static void FillGamma(float *buffer, size_t size, float alpha);
+
+private:
+    static constexpr size_t kLanes = 8;
+
+    struct Streams {
+        alignas(64) std::uint64_t s0[kLanes];
+        alignas(64) std::uint64_t s1[kLanes];
+    };
+
+    static Streams &GetStreams();
+
+    static void FillNormal(float *buffer, size_t size);
+
+    // Fill the raw bits. The size must be a multiple of kLanes.
+    static void Generate(Streams &streams, std::uint64_t *out, size_t size);
+};
+
 template<RandomType T>
 Random<T>::Random(std::uint64_t seed) {
     InitSeed(seed);
@@ -71,5 +125,12 @@ Random<T>::Random(std::uint64_t seed) {
 template<RandomType T>
 Random<T> &Random<T>::Get(const std::uint64_t seed) {
     static thread_local Random s_rng{seed};
+    static thread_local std::uint32_t s_epoch{0};
+
+    const auto epoch = FixedSeed::GetEpoch();
+    if (epoch != s_epoch) {
+        s_epoch = epoch;
+        s_rng.InitSeed(FixedSeed::GetThreadSeed());
+    }
     return s_rng;
 }
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "utils/shared_memory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+// The hash table in the shared memory. All processes on the host which
+// open the same name use the same table. There is no lock. Every slot
+// has a sequence number which is odd while one process writes it. The
+// readers copy the slot and check the number again, so they never get
+// a torn value. The writer skips the slot if other writer owns it. The
+// value must be trivially copyable.
+template<typename V>
+class SharedKeyCache {
+public:
+    static_assert(std::is_trivially_copyable<V>::value,
+                      "The shared value must be trivially copyable.");
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+                      "The shared table requires the lock free atomic.");
+
+    // Attach to the named table, or create it with the given size.
+    // Return false if fail, e.g. the existing table stores the other
+    // type.
+    bool Open(const std::string &name, size_t MiB);
+    void Close();
+
+    bool Valid() const { return num_clusters_ > 0; }
+
+    // Return true if this process created the table.
+    bool Created() const { return memory_.Created(); }
+
+    // Insert the new item to the table.
+    void Insert(std::uint64_t key, const V &value);
+
+    // Lookup the item and copy it. Return false if it is not in the
+    // table.
+    bool Lookup(std::uint64_t key, V &value) const;
+
+    size_t GetNumSlots() const { return num_clusters_ * kClusterSize; }
+
+    size_t GetSlotSize() const { return sizeof(Slot); }
+
+private:
+    struct Header {
+        std::atomic<std::uint64_t> ready;
+        std::uint64_t value_size;
+        std::uint64_t num_slots;
+    };
+
+    struct Slot {
+        // Zero if the slot is empty.
+        std::atomic<std::uint64_t> sequence;
+        std::atomic<std::uint64_t> key;
+        V value;
+    };
+
+    static constexpr size_t kClusterSize = 4;
+    static constexpr size_t kHeaderSize = 64;
+
+    // Change it if the layout is changed.
+    static constexpr std::uint64_t kReadyMagic = 0x5359534843303031ULL;
+
+    Slot *GetCluster(std::uint64_t key) const {
+        return slots_ + (key % num_clusters_) * kClusterSize;
+    }
+
+    SharedMemory memory_;
+    Slot *slots_{nullptr};
+    size_t num_clusters_{0};
+};
+
+template<typename V>
+bool SharedKeyCache<V>::Open(const std::string &name, size_t MiB) {
+    Close();
+
+    const size_t num_slots = std::max(
+        MiB * 1024 * 1024 / sizeof(Slot) / kClusterSize, size_t{1}) * kClusterSize;
+    if (!memory_.Open(name, kHeaderSize + num_slots * sizeof(Slot))) {
+        return false;
+    }
+
+    auto *header = reinterpret_cast<Header *>(memory_.Data());
+    if (memory_.Created()) {
+        // The new segment is filled with zeros, so all slots are
+        // empty. Publish the header last.
+        header->value_size = sizeof(V);
+        header->num_slots = num_slots;
+        header->ready.store(kReadyMagic, std::memory_order_release);
+    } else {
+        for (int i = 0; i < 100; ++i) {
+            if (header->ready.load(std::memory_order_acquire) == kReadyMagic) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if (header->ready.load(std::memory_order_acquire) != kReadyMagic ||
+                header->value_size != sizeof(V) ||
+                header->num_slots % kClusterSize != 0 ||
+                memory_.Size() < kHeaderSize + header->num_slots * sizeof(Slot)) {
+            Close();
+            return false;
+        }
+    }
+
+    slots_ = reinterpret_cast<Slot *>(memory_.Data() + kHeaderSize);
+    num_clusters_ = header->num_slots / kClusterSize;
+    return true;
+}
+
+template<typename V>
+void SharedKeyCache<V>::Close() {
+    memory_.Close();
+    slots_ = nullptr;
+    num_clusters_ = 0;
+}
+
+template<typename V>
+void SharedKeyCache<V>::Insert(std::uint64_t key, const V &value) {
+    if (!Valid()) {
+        return;
+    }
+    Slot *cluster = GetCluster(key);
+
+    // Replace the same key first, then the empty slot. The others
+    // are chosen by the high bits of key.
+    Slot *slot = cluster + (key >> 60) % kClusterSize;
+    for (size_t i = 0; i < kClusterSize; ++i) {
+        Slot *s = cluster + i;
+        const auto seq = s->sequence.load(std::memory_order_relaxed);
+        if (seq == 0) {
+            slot = s;
+        } else if (s->key.load(std::memory_order_relaxed) == key) {
+            slot = s;
+            break;
+        }
+    }
+
+    auto seq = slot->sequence.load(std::memory_order_relaxed);
+    if ((seq & 1) ||
+            !slot->sequence.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+        // Other writer owns it.
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->key.store(key, std::memory_order_relaxed);
+    std::memcpy(&slot->value, &value, sizeof(V));
+
+    slot->sequence.store(seq + 2, std::memory_order_release);
+}
+
+template<typename V>
+bool SharedKeyCache<V>::Lookup(std::uint64_t key, V &value) const {
+    if (!Valid()) {
+        return false;
+    }
+    const Slot *cluster = GetCluster(key);
+
+    for (size_t i = 0; i < kClusterSize; ++i) {
+        const Slot *s = cluster + i;
+        const auto seq = s->sequence.load(std::memory_order_acquire);
+        if (seq == 0 || (seq & 1) ||
+                s->key.load(std::memory_order_relaxed) != key) {
+            continue;
+        }
+        std::memcpy(&value, &s->value, sizeof(V));
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (s->sequence.load(std::memory_order_relaxed) == seq) {
+            return true;
+        }
+    }
+    return false;
+}
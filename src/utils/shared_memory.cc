@@ -0,0 +1,99 @@
+#include "utils/shared_memory.h"
+
+#include <chrono>
+#include <thread>
+
+#ifndef WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SharedMemory::~SharedMemory() {
+    Close();
+}
+
+bool SharedMemory::Open(const std::string &name, size_t size) {
+    Close();
+
+#ifdef WIN32
+    (void) name;
+    (void) size;
+    return false;
+#else
+    if (size == 0) {
+        return false;
+    }
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd >= 0) {
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+        created_ = true;
+    } else {
+        if (errno != EEXIST) {
+            return false;
+        }
+        fd = shm_open(name.c_str(), O_RDWR, 0666);
+        if (fd < 0) {
+            return false;
+        }
+
+        // The creator may not set the size yet. Wait for it.
+        struct stat st;
+        for (int i = 0; i < 100; ++i) {
+            if (fstat(fd, &st) != 0) {
+                close(fd);
+                return false;
+            }
+            if (st.st_size > 0) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if (st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        size = st.st_size;
+    }
+
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // The mapping keeps the segment alive.
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        created_ = false;
+        return false;
+    }
+    data_ = static_cast<char *>(addr);
+    size_ = size;
+    return true;
+#endif
+}
+
+void SharedMemory::Close() {
+#ifndef WIN32
+    if (data_) {
+        munmap(data_, size_);
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    created_ = false;
+}
+
+bool SharedMemory::Unlink(const std::string &name) {
+#ifdef WIN32
+    (void) name;
+    return false;
+#else
+    return shm_unlink(name.c_str()) == 0;
+#endif
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A named shared memory segment. All processes on the host which open
+// the same name map the same pages. The segment lives until Unlink()
+// is called or the host reboots.
+class SharedMemory {
+public:
+    SharedMemory() = default;
+    ~SharedMemory();
+
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+
+    // Create the segment with the given size, or attach to it if
+    // other process already created it. The attached segment keeps
+    // its own size. The new segment is filled with zeros. Return
+    // false if fail.
+    bool Open(const std::string &name, size_t size);
+    void Close();
+
+    // Remove the name. The mapped processes keep their pages.
+    static bool Unlink(const std::string &name);
+
+    char *Data() const { return data_; }
+    size_t Size() const { return size_; }
+
+    // Return true if this process created the segment.
+    bool Created() const { return created_; }
+
+private:
+    char *data_{nullptr};
+    size_t size_{0};
+    bool created_{false};
+};
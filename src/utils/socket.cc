@@ -0,0 +1,215 @@
+#include "utils/socket.h"
+
+#include <utility>
+
+#ifndef WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Do not raise the SIGPIPE if the peer is closed. The macOS sets it
+// on the socket instead.
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+} // namespace
+
+Socket::~Socket() {
+    Close();
+}
+
+Socket::Socket(Socket &&other) : fd_(other.fd_) {
+    other.fd_ = -1;
+}
+
+Socket& Socket::operator=(Socket &&other) {
+    if (this != &other) {
+        Close();
+        std::swap(fd_, other.fd_);
+    }
+    return *this;
+}
+
+bool Socket::Connect(const std::string &host, int port) {
+    Close();
+#ifdef WIN32
+    (void) host;
+    (void) port;
+    return false;
+#else
+    struct addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) {
+        return false;
+    }
+    for (auto *ai = result; ai; ai = ai->ai_next) {
+        const int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            fd_ = fd;
+            break;
+        }
+        close(fd);
+    }
+    freeaddrinfo(result);
+
+    if (fd_ >= 0) {
+        SetOptions();
+    }
+    return fd_ >= 0;
+#endif
+}
+
+bool Socket::Listen(int port) {
+    Close();
+#ifdef WIN32
+    (void) port;
+    return false;
+#else
+    const int fd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    // Accept the IPv4 clients too.
+    int off = 0;
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+    struct sockaddr_in6 addr{};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(fd, 64) != 0) {
+        close(fd);
+        return false;
+    }
+    fd_ = fd;
+    return true;
+#endif
+}
+
+Socket Socket::Accept() {
+#ifdef WIN32
+    return Socket{};
+#else
+    const int fd = accept(fd_, nullptr, nullptr);
+    auto client = Socket(fd);
+    if (client.Valid()) {
+        client.SetOptions();
+    }
+    return client;
+#endif
+}
+
+bool Socket::SendAll(const void *data, size_t size) {
+#ifdef WIN32
+    (void) data;
+    (void) size;
+    return false;
+#else
+    const char *p = static_cast<const char *>(data);
+    while (size > 0) {
+        const auto n = send(fd_, p, size, kSendFlags);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+#endif
+}
+
+bool Socket::RecvAll(void *data, size_t size) {
+#ifdef WIN32
+    (void) data;
+    (void) size;
+    return false;
+#else
+    char *p = static_cast<char *>(data);
+    while (size > 0) {
+        const auto n = recv(fd_, p, size, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+#endif
+}
+
+long Socket::Recv(void *data, size_t size) {
+#ifdef WIN32
+    (void) data;
+    (void) size;
+    return -1;
+#else
+    return recv(fd_, data, size, 0);
+#endif
+}
+
+void Socket::Shutdown() {
+#ifndef WIN32
+    if (fd_ >= 0) {
+        shutdown(fd_, SHUT_RDWR);
+    }
+#endif
+}
+
+void Socket::Close() {
+#ifndef WIN32
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+#endif
+    fd_ = -1;
+}
+
+void Socket::SetOptions() {
+#ifndef WIN32
+    // The requests are small and the clients wait for them.
+    int on = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd_, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+#endif
+}
+
+bool SplitAddress(const std::string &address, std::string &host, int &port) {
+    const auto pos = address.rfind(':');
+    if (pos == std::string::npos || pos + 1 >= address.size()) {
+        return false;
+    }
+    try {
+        port = std::stoi(address.substr(pos + 1));
+    } catch (...) {
+        return false;
+    }
+    host = pos == 0 ? std::string{"localhost"} : address.substr(0, pos);
+
+    // The IPv6 address is in the brackets, e.g. "[::1]:5000".
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A blocking TCP socket. Only the POSIX sockets are supported. The
+// other platforms always fail to connect or listen.
+class Socket {
+public:
+    Socket() = default;
+    ~Socket();
+
+    Socket(Socket &&other);
+    Socket& operator=(Socket &&other);
+
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    // Connect to the server, e.g. "localhost". Return false if fail.
+    bool Connect(const std::string &host, int port);
+
+    // Listen on the port of all interfaces. Return false if fail.
+    bool Listen(int port);
+
+    // Wait for the next client. The socket is invalid if fail.
+    Socket Accept();
+
+    // Send or receive all bytes. Return false if the connection
+    // is closed or broken.
+    bool SendAll(const void *data, size_t size);
+    bool RecvAll(void *data, size_t size);
+
+    // Receive the bytes which are ready, at most the size. Return the
+    // number of bytes, zero if the connection is closed or negative
+    // if it is broken.
+    long Recv(void *data, size_t size);
+
+    // Stop the blocking calls of the other threads. The socket
+    // should be closed later.
+    void Shutdown();
+    void Close();
+
+    bool Valid() const { return fd_ >= 0; }
+
+private:
+    explicit Socket(int fd) : fd_(fd) {}
+
+    void SetOptions();
+
+    int fd_{-1};
+};
+
+// Split the "host:port" address. Return false if there is no port.
+bool SplitAddress(const std::string &address, std::string &host, int &port);
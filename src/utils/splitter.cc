@@ -1,47 +1,64 @@
 #include "utils/splitter.h"
 
+#include <cctype>
+
+#ifdef USE_FAST_PARSER
+#include "fast_float.h"
+#endif
+
 constexpr size_t Splitter::kMaxBufferSize;
 
-Splitter::Splitter(std::string &input) {
-    Parse(std::forward<std::string>(input), kMaxBufferSize);
+Splitter::Splitter(std::string &input) : buffer_(input) {
+    Parse(kMaxBufferSize);
 }
 
-Splitter::Splitter(std::string &input, const size_t max) {
-    Parse(std::forward<std::string>(input), std::min(max, kMaxBufferSize));
+Splitter::Splitter(std::string &input, const size_t max) : buffer_(input) {
+    Parse(std::min(max, kMaxBufferSize));
 }
 
 Splitter::Splitter(int argc, char** argv) {
-    auto oss = std::ostringstream{};
     for (int i = 0; i < argc; ++i) {
-        oss << argv[i] << " ";
+        buffer_ += argv[i];
+        buffer_ += ' ';
     }
-    Parse(std::forward<std::string>(oss.str()), kMaxBufferSize);
+    Parse(kMaxBufferSize);
 }
 
 bool Splitter::Valid() const {
     return count_ != 0;
 }
 
-void Splitter::Parse(std::string &input, const size_t max) {
+void Splitter::Parse(const size_t max) {
     count_ = 0;
-    auto stream = std::istringstream{input};
-    auto in = std::string{};
-    while (stream >> in) {
-        bufffer_.emplace_back(std::make_shared<std::string>(in));
+    words_.clear();
+
+    const auto size = buffer_.size();
+    auto i = size_t{0};
+    while (count_ < max) {
+        while (i < size && std::isspace((unsigned char)buffer_[i])) {
+            ++i;
+        }
+        if (i >= size) {
+            break;
+        }
+        const auto begin = i;
+        while (i < size && !std::isspace((unsigned char)buffer_[i])) {
+            ++i;
+        }
+        words_.emplace_back(Word{begin, i - begin});
         count_++;
-        if (count_ >= max) break;
     }
 }
 
-void Splitter::Parse(std::string &&input, const size_t max) {
-    count_ = 0;
-    auto stream = std::istringstream{input};
-    auto in = std::string{};
-    while (stream >> in) {
-        bufffer_.emplace_back(std::make_shared<std::string>(in));
-        count_++;
-        if (count_ >= max) break;
-    }
+bool Splitter::WordEqual(size_t id, const std::string &input) const {
+    const auto &word = words_[id];
+    return word.size == input.size() &&
+               buffer_.compare(word.offset, word.size, input) == 0;
+}
+
+std::string Splitter::GetString(size_t id) const {
+    const auto &word = words_[id];
+    return buffer_.substr(word.offset, word.size);
 }
 
 size_t Splitter::GetCount() const {
@@ -52,7 +69,7 @@ std::shared_ptr<Splitter::Reuslt> Splitter::GetWord(size_t id) const {
     if (!Valid() || id >= count_) {
         return nullptr;
     }
-    return std::make_shared<Reuslt>(Reuslt(*bufffer_[id], (int)id));
+    return std::make_shared<Reuslt>(Reuslt(GetString(id), (int)id));
 }
 
 std::shared_ptr<Splitter::Reuslt> Splitter::GetSlice(size_t b) const {
@@ -67,18 +84,15 @@ std::shared_ptr<Splitter::Reuslt> Splitter::GetSlice(size_t b, size_t e) const {
          return nullptr;
      }
 
-     auto out = std::ostringstream{};
-     auto begin = std::next(std::begin(bufffer_), b);
-     auto end = std::next(std::begin(bufffer_), e);
-     auto stop = std::prev(end, 1);
-
-     if (begin != end) {
-         std::for_each(begin, stop,
-             [&](auto in) { out << *in << " "; });
+     auto out = std::string{};
+     for (auto i = b; i < e; ++i) {
+         if (i != b) {
+             out += ' ';
+         }
+         const auto &word = words_[i];
+         out.append(buffer_, word.offset, word.size);
      }
-
-     out << **stop;
-     return std::make_shared<Reuslt>(Reuslt(out.str(), -1));
+     return std::make_shared<Reuslt>(Reuslt(std::move(out), -1));
 }
 
 std::shared_ptr<Splitter::Reuslt> Splitter::Find(const std::string input, int id) const {
@@ -88,15 +102,12 @@ std::shared_ptr<Splitter::Reuslt> Splitter::Find(const std::string input, int id
 
     if (id < 0) {
         for (auto i = size_t{0}; i < GetCount(); ++i) {
-            const auto res = GetWord(i);
-            if (res->str_ == input) {
-                return res;
+            if (WordEqual(i, input)) {
+                return GetWord(i);
             }
         }
-    } else {
-        if (const auto res = GetWord((size_t)id)) {
-            return res->str_ == input ? res : nullptr;
-        }
+    } else if ((size_t)id < GetCount() && WordEqual((size_t)id, input)) {
+        return GetWord((size_t)id);
     }
     return nullptr;
 }
@@ -122,15 +133,12 @@ std::shared_ptr<Splitter::Reuslt> Splitter::FindLower(const std::string input, i
 
     if (id < 0) {
         for (auto i = size_t{0}; i < GetCount(); ++i) {
-            const auto res = GetWord(i);
-            if (res->str_ == lower) {
-                return res;
+            if (WordEqual(i, lower)) {
+                return GetWord(i);
             }
         }
-    } else {
-        if (const auto res = GetWord((size_t)id)) {
-            return res->str_ == lower ? res : nullptr;
-        }
+    } else if ((size_t)id < GetCount() && WordEqual((size_t)id, lower)) {
+        return GetWord((size_t)id);
     }
     return nullptr;
 }
@@ -183,15 +191,15 @@ std::shared_ptr<Splitter::Reuslt> Splitter::FindDigit(int id) const {
 }
 
 std::shared_ptr<Splitter::Reuslt> Splitter::RemoveWord(size_t id) {
-    if (id > GetCount()) {
+    if (id >= GetCount()) {
         return nullptr;
     }
 
-    const auto str_ = *bufffer_[id];
-    bufffer_.erase(std::begin(bufffer_)+id);
+    const auto str = GetString(id);
+    words_.erase(std::begin(words_)+id);
     count_--;
 
-    return std::make_shared<Reuslt>(Reuslt(str_, -1));
+    return std::make_shared<Reuslt>(Reuslt(str, -1));
 }
 
 std::shared_ptr<Splitter::Reuslt> Splitter::RemoveSlice(size_t b, size_t e) {
@@ -202,7 +210,7 @@ std::shared_ptr<Splitter::Reuslt> Splitter::RemoveSlice(size_t b, size_t e) {
         return RemoveWord(e);
     }
     auto out = GetSlice(b, e);
-    bufffer_.erase(std::begin(bufffer_)+b, std::begin(bufffer_)+e);
+    words_.erase(std::begin(words_)+b, std::begin(words_)+e);
     count_ -= (e-b);
     return out;
 }
@@ -244,6 +252,16 @@ int Splitter::Reuslt::Get<int>() const {
 
 template<>
 float Splitter::Reuslt::Get<float>() const{
+#ifdef USE_FAST_PARSER
+    // The std::stof is still the fallback, so the invalid number
+    // throws the same exception.
+    const auto begin = str_.data() + (!str_.empty() && str_[0] == '+');
+    auto val = float{};
+    const auto res = fast_float::from_chars(begin, str_.data() + str_.size(), val);
+    if (res.ec == std::errc() && res.ptr != begin) {
+        return val;
+    }
+#endif
     return std::stof(str_);
 }
 
@@ -6,6 +6,9 @@
 #include <algorithm>
 #include <sstream>
 
+// Split the input into the words. The words are the views of one
+// buffer, so the input is copied only once and the searching never
+// allocates until it finds the word.
 class Splitter {
 public:
     class Reuslt {
@@ -53,9 +56,18 @@ public:
     std::shared_ptr<Reuslt> RemoveSlice(size_t begin, size_t end);
 
 private:
-    std::vector<std::shared_ptr<const std::string>> bufffer_;
+    // The view of one word in the buffer.
+    struct Word {
+        size_t offset;
+        size_t size;
+    };
+
+    std::string buffer_;
+    std::vector<Word> words_;
     size_t count_;
 
-    void Parse(std::string &input, const size_t max);
-    void Parse(std::string &&input, const size_t max);
+    void Parse(const size_t max);
+
+    bool WordEqual(size_t id, const std::string &input) const;
+    std::string GetString(size_t id) const;
 };
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// The reusable output buffer. Clear() keeps the capacity, so the
+// buffer stops allocating after the first few outputs. The numbers are
+// written by hand instead of snprintf.
+class TextBuffer {
+public:
+    void Clear() {
+        buffer_.clear();
+    }
+
+    void Reserve(size_t size) {
+        buffer_.reserve(size);
+    }
+
+    const std::string &Get() const {
+        return buffer_;
+    }
+
+    size_t Size() const {
+        return buffer_.size();
+    }
+
+    TextBuffer &Append(const char *str, size_t size) {
+        buffer_.append(str, size);
+        return *this;
+    }
+
+    TextBuffer &Append(const char *str) {
+        return Append(str, std::strlen(str));
+    }
+
+    TextBuffer &Append(const std::string &str) {
+        return Append(str.data(), str.size());
+    }
+
+    TextBuffer &Append(char c) {
+        buffer_.push_back(c);
+        return *this;
+    }
+
+    TextBuffer &AppendInt(std::int64_t v) {
+        char buf[24];
+        char *end = buf + sizeof(buf);
+        char *p = end;
+
+        auto u = v < 0 ? 0 - static_cast<std::uint64_t>(v) :
+                             static_cast<std::uint64_t>(v);
+        do {
+            *--p = '0' + static_cast<char>(u % 10);
+            u /= 10;
+        } while (u != 0);
+        if (v < 0) {
+            *--p = '-';
+        }
+        return Append(p, end - p);
+    }
+
+    // It gives the same text as printf "%.*f" for the float values. The
+    // tie is rounded to even like glibc. The large and non-finite values
+    // fall back to snprintf.
+    TextBuffer &AppendFixed(double v, int precision) {
+        const auto scale = precision >= 0 && precision <= kMaxPrecision ?
+                               Pow10(precision) : 0;
+        const auto scaled = std::abs(v) * static_cast<double>(scale);
+
+        // Be sure that the scaled value is exact in double.
+        if (scale == 0 || !(scaled < 1e15)) {
+            char buf[512];
+            const int size = std::snprintf(buf, sizeof(buf), "%.*f", precision, v);
+            return Append(buf, std::min(size, static_cast<int>(sizeof(buf)) - 1));
+        }
+
+        auto r = static_cast<std::uint64_t>(scaled);
+        const auto remain = scaled - static_cast<double>(r);
+        if (remain > 0.5 || (remain == 0.5 && (r & 1))) {
+            r += 1;
+        }
+
+        if (std::signbit(v)) {
+            Append('-');
+        }
+        AppendInt(static_cast<std::int64_t>(r / scale));
+        if (precision > 0) {
+            char buf[kMaxPrecision + 1];
+            auto frac = r % scale;
+            buf[0] = '.';
+            for (int i = precision; i >= 1; --i) {
+                buf[i] = '0' + static_cast<char>(frac % 10);
+                frac /= 10;
+            }
+            Append(buf, precision + 1);
+        }
+        return *this;
+    }
+
+    // Write the raw bytes of the value in the native byte order.
+    template<typename T>
+    TextBuffer &AppendBinary(T v) {
+        return Append(reinterpret_cast<const char *>(&v), sizeof(T));
+    }
+
+    // Overwrite the raw bytes at the offset, e.g. the count which is
+    // only known at the end.
+    template<typename T>
+    void WriteBinary(size_t offset, T v) {
+        std::memcpy(&buffer_[offset], &v, sizeof(T));
+    }
+
+private:
+    static constexpr int kMaxPrecision = 9;
+
+    static std::uint64_t Pow10(int p) {
+        static constexpr std::uint64_t kTable[kMaxPrecision + 1] = {
+            1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL,
+            1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL
+        };
+        return kTable[p];
+    }
+
+    std::string buffer_;
+};
@@ -27,9 +27,10 @@
 
 # pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <vector>
-#include <queue>
+#include <deque>
 #include <memory>
 #include <thread>
 #include <mutex>
@@ -39,6 +40,12 @@
 #include <stdexcept>
 #include <iostream>
 
+#include "utils/numa.h"
+
+// Every worker has its own task deque. The worker pops the newest task
+// from its deque and steals the oldest task from the other deques if its
+// own one is empty. The task added by a worker goes to its own deque, so
+// the tasks of one search rarely touch the other locks.
 class ThreadPool {
 public:
     ThreadPool(size_t threads);
@@ -52,22 +59,73 @@ public:
     
     size_t GetNumThreads() const;
 
+    // The worker index of current thread, or -1 if it is not a worker.
+    static int GetWorkerIndex();
+
+    // Pin the new threads on the CPU cores one by one. The threads
+    // are spread over the NUMA nodes in turn. Only works on Linux.
+    // Call it before adding the threads.
+    void SetThreadAffinity(bool pin);
+
 private:
+    struct TaskBase {
+        virtual ~TaskBase() = default;
+        virtual void Run() = 0;
+    };
+
+    template<class F>
+    struct Task final : TaskBase {
+        explicit Task(F &&f) : func(std::move(f)) {}
+        void Run() override { func(); }
+        F func;
+    };
+
+    using TaskPtr = std::unique_ptr<TaskBase>;
+
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<TaskPtr> tasks;
+    };
+
+    // The worker index of current thread in this pool, or -1.
+    struct WorkerInfo {
+        const ThreadPool *pool{nullptr};
+        int index{-1};
+    };
+    static WorkerInfo &GetWorkerInfo();
+
     void AddThread(std::function<void()> initializer);
 
+    void PushTask(TaskPtr task);
+    TaskPtr PopTask(size_t index);
+
+    void PinThread(size_t index) const;
+
     bool IsStopRunning() const;
     std::atomic<bool> stop_running_{false};
 
     // Number of allocated threads.
     std::atomic<size_t> num_threads_{0};
-  
+
+    // Number of the tasks in all deques.
+    std::atomic<size_t> pending_tasks_{0};
+
+    // Number of the workers waiting for the tasks.
+    std::atomic<size_t> sleeping_workers_{0};
+
+    std::atomic<size_t> next_queue_{0};
+
+    bool pin_threads_{false};
+
     // Need to keep track of threads so we can join them.
     std::vector<std::thread> workers_;
 
-    // The task queue.
-    std::queue<std::function<void(void)>> tasks_;
+    // The deques never move, so the workers can steal from them while
+    // the new threads are added.
+    static constexpr size_t kMaxQueues = 1024;
+    std::unique_ptr<TaskQueue[]> queues_{new TaskQueue[kMaxQueues]};
 
-    std::mutex queue_mutex_;
+    std::mutex sleep_mutex_;
 
     std::condition_variable cv_;
 };
@@ -85,6 +143,15 @@ inline ThreadPool& ThreadPool::Get(size_t threads) {
     return pool;
 }
 
+inline ThreadPool::WorkerInfo &ThreadPool::GetWorkerInfo() {
+    thread_local WorkerInfo info;
+    return info;
+}
+
+inline int ThreadPool::GetWorkerIndex() {
+    return GetWorkerInfo().index;
+}
+
 // The constructor just launches some amount of workers
 inline ThreadPool::ThreadPool(size_t threads) {
     stop_running_.store(false);
@@ -95,27 +162,100 @@ inline ThreadPool::ThreadPool(size_t threads) {
     std::this_thread::sleep_for(std::chrono::milliseconds(20));
 }
 
+inline void ThreadPool::SetThreadAffinity(bool pin) {
+    pin_threads_ = pin;
+}
+
+inline void ThreadPool::PinThread(size_t index) const {
+    Numa::Get().PinThread(index);
+}
+
 inline void ThreadPool::AddThread(std::function<void()> initializer) {
-    num_threads_.fetch_add(1);
+    const auto index = num_threads_.fetch_add(1);
     workers_.emplace_back(
-        [this, initializer]() -> void {
+        [this, initializer, index]() -> void {
+            if (pin_threads_) {
+                PinThread(index);
+            }
+            auto &info = GetWorkerInfo();
+            info.pool = this;
+            info.index = index;
+
             initializer();
             while (true) {
-                auto task = std::function<void(void)>{};
-                {
-                    std::unique_lock<std::mutex> lock(queue_mutex_);
-                    cv_.wait(lock,
-                        [this](){ return IsStopRunning() || !tasks_.empty(); });
-                    if (IsStopRunning() && tasks_.empty()) break;
-                    task = std::move(tasks_.front());
-                    tasks_.pop();
+                auto task = PopTask(index);
+                if (task) {
+                    task->Run();
+                    continue;
                 }
-                task();
+
+                std::unique_lock<std::mutex> lock(sleep_mutex_);
+                sleeping_workers_.fetch_add(1);
+                cv_.wait(lock,
+                    [this](){ return IsStopRunning() || pending_tasks_.load() > 0; });
+                sleeping_workers_.fetch_sub(1);
+                if (IsStopRunning() && pending_tasks_.load() == 0) break;
             }
         }
     );
 }
 
+inline void ThreadPool::PushTask(TaskPtr task) {
+    const auto &info = GetWorkerInfo();
+    const auto num_queues = std::min(std::max(num_threads_.load(), size_t{1}), kMaxQueues);
+
+    // The worker pushes the task to its own deque, the other threads
+    // spread the tasks over all deques.
+    const auto index = info.pool == this ?
+                           info.index % kMaxQueues : next_queue_.fetch_add(1) % num_queues;
+    pending_tasks_.fetch_add(1);
+    {
+        auto &queue = queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.emplace_back(std::move(task));
+    }
+
+    // The sleeping counter is increased before checking the pending
+    // tasks, so no worker misses this task.
+    if (sleeping_workers_.load() > 0) {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+        }
+        cv_.notify_one();
+    }
+}
+
+inline ThreadPool::TaskPtr ThreadPool::PopTask(size_t index) {
+    if (pending_tasks_.load() == 0) {
+        return nullptr;
+    }
+
+    const auto num_queues = std::min(num_threads_.load(), kMaxQueues);
+    index %= kMaxQueues;
+
+    for (size_t i = 0; i < num_queues; ++i) {
+        // Take the newest task of own deque first, then steal the
+        // oldest tasks of the others.
+        const auto qidx = (index + i) % num_queues;
+        auto &queue = queues_[qidx];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        auto task = TaskPtr{};
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        pending_tasks_.fetch_sub(1);
+        return task;
+    }
+    return nullptr;
+}
+
 inline size_t ThreadPool::GetNumThreads() const {
     return num_threads_.load();
 }
@@ -129,24 +269,24 @@ template<class F, class... Args>
 auto ThreadPool::AddTask(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type> {
     using return_type = typename std::result_of<F(Args...)>::type;
+    using task_type = std::packaged_task<return_type()>;
 
-    auto task = std::make_shared<std::packaged_task<return_type()>>(
+    auto task = task_type(
             std::bind(std::forward<F>(f), std::forward<Args>(args)...)
         );
         
-    std::future<return_type> res = task->get_future();
-    {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        tasks_.emplace([task](){ (*task)(); });
-    }
-    cv_.notify_one();
+    std::future<return_type> res = task.get_future();
+    PushTask(std::make_unique<Task<task_type>>(std::move(task)));
     return res;
 }
 
 // The destructor joins all threads.
 inline ThreadPool::~ThreadPool()
 {
-    stop_running_.store(true);
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_running_.store(true);
+    }
     cv_.notify_all();
     for(auto &worker: workers_) {
         worker.join();
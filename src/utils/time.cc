@@ -1,6 +1,8 @@
 #include <iostream>
 #include <cstdio>
 #include <ctime>
+#include <sstream>
+#include <iomanip>
 #include "utils/time.h"
 
 const std::string CurrentDateTime() {
@@ -48,3 +50,38 @@ float Timer::GetDuration() const {
         return static_cast<float>(seconds);
     }
 }
+
+StartupProfile& StartupProfile::Get() {
+    static StartupProfile profile;
+    return profile;
+}
+
+void StartupProfile::Add(std::string name, float milliseconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    times_.emplace_back(name, milliseconds);
+}
+
+void StartupProfile::Run(std::string name, std::function<void()> init) {
+    auto timer = Timer{};
+    init();
+    Add(name, timer.GetDurationMicroseconds() / 1000.f);
+}
+
+std::future<void> StartupProfile::Launch(std::string name, std::function<void()> init) {
+    return std::async(std::launch::async, [this, name, init]() {
+                          Run(name, init);
+                      });
+}
+
+std::string StartupProfile::ToString() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto out = std::ostringstream{};
+
+    out << "Startup time:" << std::fixed << std::setprecision(1);
+    for (const auto &t : times_) {
+        out << ' ' << t.first << ' ' << t.second << ',';
+    }
+    out << " total " << timer_.GetDurationMicroseconds() / 1000.f << " (ms)";
+
+    return out.str();
+}
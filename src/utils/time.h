@@ -3,6 +3,10 @@
 #include <string>
 #include <vector>
 #include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <utility>
 
 // Get current date/time, format is YYYY-MM-DD-HH:mm:ss
 const std::string CurrentDateTime();
@@ -21,3 +25,27 @@ public:
 private:
     std::chrono::steady_clock::time_point clock_time_;
 };
+
+// The startup time of every subsystem. The subsystems may be initialized
+// on many threads, so Add() is locked. The total time is counted from
+// the first Get().
+class StartupProfile {
+public:
+    static StartupProfile& Get();
+
+    // Add the time of one subsystem in milliseconds.
+    void Add(std::string name, float milliseconds);
+
+    // Initialize the subsystem and add its time. Launch() runs it on
+    // a new thread.
+    void Run(std::string name, std::function<void()> init);
+    std::future<void> Launch(std::string name, std::function<void()> init);
+
+    // Return the breakdown in one line.
+    std::string ToString();
+
+private:
+    std::mutex mutex_;
+    Timer timer_;
+    std::vector<std::pair<std::string, float>> times_;
+};
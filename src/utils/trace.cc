@@ -0,0 +1,107 @@
+#include "utils/trace.h"
+#include "utils/format.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+constexpr size_t Trace::kRingSize;
+
+namespace {
+
+struct RingBuffer {
+    int tid;
+
+    // The number of recorded events. Only the owner writes it.
+    std::atomic<std::uint64_t> count{0};
+    std::array<Trace::Event, Trace::kRingSize> events;
+};
+
+// The buffers are kept after the threads exit, so the events of the
+// finished threads are in the dump too.
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<RingBuffer>> buffers;
+    Trace::Clock::time_point base{Trace::Clock::now()};
+
+    static Registry &Get() {
+        static Registry registry;
+        return registry;
+    }
+};
+
+RingBuffer &GetRingBuffer() {
+    thread_local RingBuffer *buffer = nullptr;
+    if (!buffer) {
+        auto &registry = Registry::Get();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.buffers.emplace_back(std::make_unique<RingBuffer>());
+        buffer = registry.buffers.back().get();
+        buffer->tid = registry.buffers.size();
+    }
+    return *buffer;
+}
+
+} // namespace
+
+bool Trace::Enabled() {
+#ifdef USE_TRACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Trace::Record(const char *name,
+                       Clock::time_point begin,
+                       Clock::time_point end) {
+    auto &buffer = GetRingBuffer();
+    const auto base = Registry::Get().base;
+    const auto count = buffer.count.load(std::memory_order_relaxed);
+
+    auto &e = buffer.events[count % kRingSize];
+    e.name = name;
+    e.begin_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - base).count();
+    e.duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+
+    buffer.count.store(count + 1, std::memory_order_release);
+}
+
+bool Trace::DumpChromeJson(const std::string &filename) {
+    std::FILE *file = std::fopen(filename.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+
+    auto &registry = Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    bool first = true;
+    std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
+    for (const auto &buffer : registry.buffers) {
+        const auto count = buffer->count.load(std::memory_order_acquire);
+        const auto begin = count > kRingSize ? count - kRingSize : 0;
+        for (auto i = begin; i < count; ++i) {
+            const auto &e = buffer->events[i % kRingSize];
+
+            // The complete events in microseconds.
+            std::fputs(Format("%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                                  first ? "" : ",\n", e.name, buffer->tid,
+                                  e.begin_ns / 1000.0, e.duration_ns / 1000.0).c_str(),
+                       file);
+            first = false;
+        }
+    }
+    std::fputs("]}\n", file);
+    return std::fclose(file) == 0;
+}
+
+void Trace::Clear() {
+    auto &registry = Registry::Get();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (auto &buffer : registry.buffers) {
+        buffer->count.store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// The scoped timers of the hot paths. They are compiled only with
+// USE_TRACE, so the normal build has no cost. Every thread writes the
+// events into its own ring buffer, and the newest events are kept. The
+// buffers are dumped in the Chrome trace JSON, which Perfetto and
+// chrome://tracing can open.
+class Trace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t kRingSize = 1 << 16;
+
+    struct Event {
+        // The name must be the string literal.
+        const char *name;
+        std::int64_t begin_ns;
+        std::int64_t duration_ns;
+    };
+
+    static bool Enabled();
+
+    static void Record(const char *name,
+                           Clock::time_point begin,
+                           Clock::time_point end);
+
+    // Write all buffers into the file. Call it when the search is not
+    // running, because the buffers are not locked. Return false if it
+    // fails to write.
+    static bool DumpChromeJson(const std::string &filename);
+
+    // Drop all recorded events. Call it when the search is not running
+    // too.
+    static void Clear();
+};
+
+class ScopedTrace {
+public:
+    explicit ScopedTrace(const char *name)
+        : name_(name), begin_(Trace::Clock::now()) {}
+
+    ~ScopedTrace() {
+        Trace::Record(name_, begin_, Trace::Clock::now());
+    }
+
+    ScopedTrace(const ScopedTrace&) = delete;
+    ScopedTrace& operator=(const ScopedTrace&) = delete;
+
+private:
+    const char *name_;
+    Trace::Clock::time_point begin_;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef USE_TRACE
+#define TRACE_SCOPE(name) ::ScopedTrace TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) do {} while (0)
+#endif
@@ -0,0 +1,85 @@
+#include "training_loader.h"
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace py = pybind11;
+
+using FloatArray = py::array_t<float, py::array::c_style>;
+
+// Check the shape of the output array and return its buffer.
+static float *GetBuffer(FloatArray &arr, const char *name,
+                        const std::vector<py::ssize_t> &shape) {
+    auto ok = arr.ndim() == (py::ssize_t)shape.size();
+    for (size_t i = 0; ok && i < shape.size(); ++i) {
+        ok = arr.shape(i) == shape[i];
+    }
+    if (!ok) {
+        throw std::invalid_argument(std::string{"The shape of "} + name + " is not correct.");
+    }
+    return arr.mutable_data();
+}
+
+PYBIND11_MODULE(sayuri_loader, m) {
+    m.doc() = "The C++ training data loader of Sayuri.";
+
+    py::class_<TrainingLoader>(m, "Loader")
+        .def(py::init([](std::vector<std::string> filenames,
+                         int board_size,
+                         int input_channels,
+                         int num_workers,
+                         size_t buffer_size,
+                         int down_sample_rate) {
+                 auto config = TrainingLoader::Config{};
+                 config.filenames = std::move(filenames);
+                 config.board_size = board_size;
+                 config.input_channels = input_channels;
+                 config.num_workers = num_workers;
+                 config.buffer_size = buffer_size;
+                 config.down_sample_rate = down_sample_rate;
+                 return new TrainingLoader(config);
+             }),
+             py::arg("filenames"),
+             py::arg("board_size"),
+             py::arg("input_channels"),
+             py::arg("num_workers"),
+             py::arg("buffer_size"),
+             py::arg("down_sample_rate") = 1)
+
+        // Fill the float32 arrays in place, e.g. the numpy views of the
+        // pinned torch tensors. The arrays are never converted, so the
+        // wrong types raise the error instead of filling a copy.
+        .def("next_batch",
+             [](TrainingLoader &self,
+                FloatArray planes, FloatArray prob, FloatArray aux_prob,
+                FloatArray ownership, FloatArray wdl, FloatArray stm, FloatArray score) {
+                 const auto batch_size = planes.ndim() > 0 ? planes.shape(0) : 0;
+                 const py::ssize_t board_size = self.GetBoardSize();
+                 const auto num_intersections = board_size * board_size;
+
+                 auto batch = TrainingLoader::Batch{};
+                 batch.planes = GetBuffer(planes, "planes",
+                                          {batch_size, self.GetInputChannels(), board_size, board_size});
+                 batch.prob = GetBuffer(prob, "prob", {batch_size, num_intersections + 1});
+                 batch.aux_prob = GetBuffer(aux_prob, "aux_prob", {batch_size, num_intersections + 1});
+                 batch.ownership = GetBuffer(ownership, "ownership", {batch_size, num_intersections});
+                 batch.wdl = GetBuffer(wdl, "wdl", {batch_size, 3});
+                 batch.stm = GetBuffer(stm, "stm", {batch_size, 1});
+                 batch.score = GetBuffer(score, "score", {batch_size, 1});
+
+                 py::gil_scoped_release release;
+                 return self.NextBatch(batch_size, batch);
+             },
+             py::arg("planes").noconvert(),
+             py::arg("prob").noconvert(),
+             py::arg("aux_prob").noconvert(),
+             py::arg("ownership").noconvert(),
+             py::arg("wdl").noconvert(),
+             py::arg("stm").noconvert(),
+             py::arg("score").noconvert());
+}
@@ -0,0 +1,370 @@
+#include "training_loader.h"
+
+#include "game/symmetry.h"
+#include "neural/network_basic.h"
+#include "neural/training.h"
+#include "neural/training_shard.h"
+#include "utils/half.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+static constexpr char kBinaryMagic[] = "SYBC";
+static constexpr size_t kHeaderSize = 24;
+static constexpr size_t kBinaryPlanes = 34;
+
+static size_t GetRecordSize(const int board_size) {
+    const size_t num_intersections = board_size * board_size;
+    const size_t plane_bytes = (num_intersections + 7) / 8;
+    return kHeaderSize + kBinaryPlanes * plane_bytes +
+               4 * (num_intersections + 1) + num_intersections;
+}
+
+static float GetFloat(const char *p) {
+    float v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static std::uint16_t GetHalf(const char *p) {
+    return (std::uint8_t)p[0] | ((std::uint8_t)p[1] << 8);
+}
+
+// The eight floats of every byte, the lowest bit first. Unpacking
+// a byte is one 32 bytes copy, which the compiler vectorizes.
+static const std::array<std::array<float, 8>, 256> &GetBitsTable() {
+    static const auto table = [](){
+        auto t = std::array<std::array<float, 8>, 256>{};
+        for (int v = 0; v < 256; ++v) {
+            for (int b = 0; b < 8; ++b) {
+                t[v][b] = (v >> b) & 1;
+            }
+        }
+        return t;
+    }();
+    return table;
+}
+
+// Read the whole file. The zlib reads the plain file as it is.
+static bool ReadChunk(const std::string &filename, std::string &buf) {
+    auto file = gzopen(filename.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    buf.clear();
+
+    char tmp[1 << 16];
+    int size;
+    while ((size = gzread(file, tmp, sizeof(tmp))) > 0) {
+        buf.append(tmp, size);
+    }
+    gzclose(file);
+    return size == 0;
+}
+
+TrainingLoader::TrainingLoader(const Config &config) : config_(config) {
+    if (config_.filenames.empty()) {
+        throw std::invalid_argument("There is no training chunk.");
+    }
+    if (config_.board_size <= 0 || config_.board_size > kBoardSize) {
+        throw std::invalid_argument("The board size is not supported.");
+    }
+    if (config_.input_channels != kInputChannels) {
+        throw std::invalid_argument("The input channels must be " +
+                                        std::to_string(kInputChannels) + ".");
+    }
+    if (config_.num_workers <= 0 || config_.buffer_size == 0) {
+        throw std::invalid_argument("The workers and the buffer size must be greater than zero.");
+    }
+
+    Symmetry::Get().Initialize();
+    GetBitsTable();
+
+    // Precompute the remap of all supported boards, so decoding a
+    // sample is only the table lookups.
+    const int nn_board_size = config_.board_size;
+    remap_.resize((size_t)(nn_board_size + 1) *
+                      Symmetry::kNumSymmetris * kNumIntersections);
+    for (int bsize = 1; bsize <= nn_board_size; ++bsize) {
+        for (int symm = 0; symm < Symmetry::kNumSymmetris; ++symm) {
+            auto remap = remap_.data() +
+                             ((size_t)bsize * Symmetry::kNumSymmetris + symm) * kNumIntersections;
+            for (int idx = 0; idx < bsize * bsize; ++idx) {
+                const auto symm_idx = Symmetry::Get().TransformIndex(bsize, symm, idx);
+                remap[idx] = (symm_idx / bsize) * nn_board_size + symm_idx % bsize;
+            }
+        }
+    }
+
+    rng_.seed(std::random_device{}());
+    buffer_.reserve(config_.buffer_size);
+
+    running_workers_ = config_.num_workers;
+    for (int i = 0; i < config_.num_workers; ++i) {
+        workers_.emplace_back([this, i](){ Worker(i); });
+    }
+}
+
+TrainingLoader::~TrainingLoader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_.store(false);
+    }
+    push_cv_.notify_all();
+    pop_cv_.notify_all();
+    for (auto &t : workers_) {
+        t.join();
+    }
+}
+
+void TrainingLoader::Worker(int id) {
+    auto rng = std::mt19937_64{std::random_device{}() + id};
+    auto filenames = config_.filenames;
+    auto buf = std::string{};
+
+    while (running_.load()) {
+        // Visit all chunks once in the random order.
+        std::shuffle(std::begin(filenames), std::end(filenames), rng);
+
+        size_t num_records = 0;
+        for (const auto &filename : filenames) {
+            if (!running_.load()) {
+                break;
+            }
+            auto shard = TrainingShardReader{};
+            if (shard.Open(filename)) {
+                num_records += PushShard(shard, rng);
+            } else if (ReadChunk(filename, buf)) {
+                num_records += PushChunk(buf, rng);
+            }
+        }
+        if (num_records == 0) {
+            // No chunk has any record. Stop it so that the batch does
+            // not wait forever.
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    --running_workers_;
+    pop_cv_.notify_all();
+}
+
+size_t TrainingLoader::PushChunk(const std::string &buf, std::mt19937_64 &rng) {
+    const int rate = config_.down_sample_rate;
+    const auto keep = [&rng, rate](){
+        return rate <= 1 || std::uniform_int_distribution<int>(0, rate-1)(rng) == 0;
+    };
+    size_t num_records = 0;
+
+    if (buf.compare(0, 4, kBinaryMagic) == 0) {
+        // The binary records are fixed width, so skip the down-sampled
+        // records without decoding them.
+        size_t offset = 0;
+        while (running_.load() && offset + kHeaderSize <= buf.size()) {
+            const int board_size = (std::uint8_t)buf[offset + 7];
+            const auto size = GetRecordSize(board_size);
+            if (buf.compare(offset, 4, kBinaryMagic) != 0 ||
+                    offset + size > buf.size()) {
+                break; // The record is broken.
+            }
+            ++num_records;
+            if (board_size <= config_.board_size && keep()) {
+                Push(buf.substr(offset, size));
+            }
+            offset += size;
+        }
+        return num_records;
+    }
+
+    // Convert the text records into the binary format.
+    auto iss = std::istringstream{buf};
+    auto data = Training{};
+    auto oss = std::ostringstream{};
+    while (running_.load() && data.StreamIn(iss)) {
+        ++num_records;
+        if (data.board_size > config_.board_size || !keep()) {
+            continue;
+        }
+        oss.str({});
+        data.BinaryStreamOut(oss);
+        Push(oss.str());
+    }
+    return num_records;
+}
+
+size_t TrainingLoader::PushShard(const TrainingShardReader &shard, std::mt19937_64 &rng) {
+    const int rate = config_.down_sample_rate;
+    const auto num_records = shard.GetNumRecords();
+
+    // Visit the records in the random order and only decompress the
+    // kept ones.
+    auto order = std::vector<size_t>(num_records);
+    for (size_t i = 0; i < num_records; ++i) {
+        order[i] = i;
+    }
+    std::shuffle(std::begin(order), std::end(order), rng);
+
+    auto record = std::string{};
+    for (const auto i : order) {
+        if (!running_.load()) {
+            break;
+        }
+        if (rate > 1 && std::uniform_int_distribution<int>(0, rate-1)(rng) != 0) {
+            continue;
+        }
+        if (shard.ReadRecord(i, record) &&
+                record.size() >= kHeaderSize &&
+                record.compare(0, 4, kBinaryMagic) == 0 &&
+                (std::uint8_t)record[7] <= config_.board_size &&
+                record.size() == GetRecordSize((std::uint8_t)record[7])) {
+            Push(std::move(record));
+        }
+    }
+    return num_records;
+}
+
+void TrainingLoader::Push(std::string &&record) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    push_cv_.wait(lock, [this](){
+        return buffer_.size() < config_.buffer_size || !running_.load();
+    });
+    if (!running_.load()) {
+        return;
+    }
+    buffer_.emplace_back(std::move(record));
+    if (buffer_.size() == config_.buffer_size) {
+        pop_cv_.notify_all();
+    }
+}
+
+std::string TrainingLoader::Pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // Wait until the buffer is full, like the shuffle buffer of the
+    // lazy loader. Use the remaining records if all workers stop.
+    pop_cv_.wait(lock, [this](){
+        return buffer_.size() >= config_.buffer_size ||
+                   running_workers_ == 0 || !running_.load();
+    });
+    if (buffer_.empty()) {
+        throw std::runtime_error("There is no training data.");
+    }
+
+    // Take a random record out.
+    const auto idx = std::uniform_int_distribution<size_t>(0, buffer_.size()-1)(rng_);
+    std::swap(buffer_[idx], buffer_.back());
+    auto record = std::move(buffer_.back());
+    buffer_.pop_back();
+    lock.unlock();
+
+    push_cv_.notify_one();
+    return record;
+}
+
+std::vector<int> TrainingLoader::NextBatch(const int batch_size, Batch batch) {
+    auto board_sizes = std::vector<int>(batch_size);
+    for (int b = 0; b < batch_size; ++b) {
+        const auto record = Pop();
+
+        // The nonzero byte 10 is the symmetry which the engine applied
+        // already. Keep it as it is.
+        const int symmetry = (std::uint8_t)record[10] != 0 ?
+                                 Symmetry::kIdentitySymmetry :
+                                 std::uniform_int_distribution<int>(
+                                     0, Symmetry::kNumSymmetris-1)(rng_);
+        Decode(record, symmetry, batch, b);
+        board_sizes[b] = (std::uint8_t)record[7];
+    }
+    return board_sizes;
+}
+
+void TrainingLoader::Decode(const std::string &record, const int symmetry,
+                            Batch &batch, const int index) const {
+    const int nn_board_size = config_.board_size;
+    const int nn_num_intersections = nn_board_size * nn_board_size;
+    const int channels = config_.input_channels;
+
+    const auto data = record.data();
+    const int board_size = (std::uint8_t)data[7];
+    const int side_to_move = data[8];
+    const int result = (std::int8_t)data[9];
+    const float komi = GetFloat(data + 12);
+    const float q_value = GetFloat(data + 16);
+    const float final_score = GetFloat(data + 20);
+
+    const int num_intersections = board_size * board_size;
+    const int plane_bytes = (num_intersections + 7) / 8;
+
+    const auto nn_index = GetRemap(board_size, symmetry);
+
+    auto planes = batch.planes + (size_t)index * channels * nn_num_intersections;
+    auto prob = batch.prob + (size_t)index * (nn_num_intersections + 1);
+    auto aux_prob = batch.aux_prob + (size_t)index * (nn_num_intersections + 1);
+    auto ownership = batch.ownership + (size_t)index * nn_num_intersections;
+    auto wdl = batch.wdl + (size_t)index * 3;
+
+    std::fill(planes, planes + channels * nn_num_intersections, 0.f);
+    std::fill(prob, prob + nn_num_intersections + 1, 0.f);
+    std::fill(aux_prob, aux_prob + nn_num_intersections + 1, 0.f);
+    std::fill(ownership, ownership + nn_num_intersections, 0.f);
+    std::fill(wdl, wdl + 3, 0.f);
+
+    // The binary planes.
+    const auto &bits_table = GetBitsTable();
+    float unpacked[kNumIntersections + 8];
+    auto ptr = data + kHeaderSize;
+    for (int p = 0; p < (int)kBinaryPlanes; ++p) {
+        for (int i = 0; i < plane_bytes; ++i) {
+            std::memcpy(unpacked + 8 * i,
+                            bits_table[(std::uint8_t)ptr[i]].data(), 8 * sizeof(float));
+        }
+        auto plane = planes + p * nn_num_intersections;
+        for (int idx = 0; idx < num_intersections; ++idx) {
+            plane[nn_index[idx]] = unpacked[idx];
+        }
+        ptr += plane_bytes;
+    }
+
+    // The komi, the board size and the ones planes. They are the same
+    // as the BatchGenerator of train.py.
+    const float komi_plane = side_to_move == 1 ? komi / 20.f : -komi / 20.f;
+    const float values[4] = {
+        komi_plane, -komi_plane, (float)num_intersections / 361.f, 1.f};
+    for (int p = 0; p < 4; ++p) {
+        auto plane = planes + (channels - 4 + p) * nn_num_intersections;
+        for (int idx = 0; idx < num_intersections; ++idx) {
+            plane[nn_index[idx]] = values[p];
+        }
+    }
+
+    // The probabilities.
+    for (auto out : {prob, aux_prob}) {
+        for (int idx = 0; idx < num_intersections; ++idx) {
+            out[nn_index[idx]] = Half::ToFloat(GetHalf(ptr + 2 * idx));
+        }
+        out[nn_num_intersections] = Half::ToFloat(GetHalf(ptr + 2 * num_intersections));
+        ptr += 2 * (num_intersections + 1);
+    }
+
+    // The ownership.
+    for (int idx = 0; idx < num_intersections; ++idx) {
+        ownership[nn_index[idx]] = (std::int8_t)ptr[idx];
+    }
+
+    if (result >= -1 && result <= 1) {
+        wdl[1 - result] = 1.f;
+    }
+    batch.stm[index] = q_value;
+    batch.score[index] = final_score;
+}
+
+const int *TrainingLoader::GetRemap(const int board_size, const int symmetry) const {
+    return remap_.data() +
+               ((size_t)board_size * Symmetry::kNumSymmetris + symmetry) * kNumIntersections;
+}
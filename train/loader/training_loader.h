@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TrainingShardReader;
+
+// Load the training chunks for train/torch. The workers decompress
+// the chunks and push the records into the shuffle buffer. Every
+// record is kept in the binary format of Training::BinaryStreamOut,
+// so the text chunks are converted once and the indexed shards are
+// decompressed record by record. The batch is decoded from
+// the buffer straight into the caller's arrays with a random symmetry,
+// unless the engine already transformed the record when writing it.
+class TrainingLoader {
+public:
+    struct Config {
+        std::vector<std::string> filenames;
+
+        // The network board size and input channels. The smaller
+        // boards are padded with zeros.
+        int board_size{19};
+        int input_channels{38};
+
+        int num_workers{1};
+        size_t buffer_size{1};
+
+        // Keep one of every rate records. Keep all of them if it is
+        // not greater than one.
+        int down_sample_rate{1};
+    };
+
+    // The output arrays of one batch. They are C-contiguous:
+    //
+    //   planes    : [batch, input_channels, board_size, board_size]
+    //   prob      : [batch, board_size * board_size + 1]
+    //   aux_prob  : [batch, board_size * board_size + 1]
+    //   ownership : [batch, board_size * board_size]
+    //   wdl       : [batch, 3]
+    //   stm       : [batch, 1]
+    //   score     : [batch, 1]
+    struct Batch {
+        float *planes;
+        float *prob;
+        float *aux_prob;
+        float *ownership;
+        float *wdl;
+        float *stm;
+        float *score;
+    };
+
+    explicit TrainingLoader(const Config &config);
+    ~TrainingLoader();
+
+    // Fill the batch and return the board size of every sample. It
+    // blocks until the shuffle buffer is full.
+    std::vector<int> NextBatch(const int batch_size, Batch batch);
+
+    int GetBoardSize() const { return config_.board_size; }
+    int GetInputChannels() const { return config_.input_channels; }
+
+private:
+    void Worker(int id);
+
+    // Push the records of one chunk. Return the number of records.
+    size_t PushChunk(const std::string &buf, std::mt19937_64 &rng);
+    size_t PushShard(const TrainingShardReader &shard, std::mt19937_64 &rng);
+    void Push(std::string &&record);
+    std::string Pop();
+
+    void Decode(const std::string &record, const int symmetry,
+                Batch &batch, const int index) const;
+
+    // The padded index of every intersection after the symmetry, in
+    // [board_size][symmetry][index].
+    const int *GetRemap(const int board_size, const int symmetry) const;
+
+    Config config_;
+    std::vector<int> remap_;
+
+    std::vector<std::string> buffer_;
+    std::mutex mutex_;
+    std::condition_variable push_cv_;
+    std::condition_variable pop_cv_;
+    std::mt19937_64 rng_;
+
+    std::atomic<bool> running_{true};
+    int running_workers_{0};
+    std::vector<std::thread> workers_;
+};
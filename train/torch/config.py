@@ -32,6 +32,7 @@ class Config:
         self.boardsize = None
         self.value_misc = None
         self.num_chunks = None
+        self.native_loader = None
 
 def parse_training_config(json_data, config):
     train = json_data.get("Train", None)
@@ -57,6 +58,7 @@ def parse_training_config(json_data, config):
     config.fixup_batch_norm = train.get("FixUpBatchNorm", False)
     config.down_sample_rate = train.get("DownSampleRate", 16)
     config.num_chunks  = train.get("NumberChunks", None)
+    config.native_loader = train.get("NativeLoader", True)
 
     assert config.train_dir != None, ""
     assert config.store_path != None, ""
@@ -1,13 +1,21 @@
 import numpy as np
-from symmetry import numpy_symmetry_planes, numpy_symmetry_plane, numpy_symmetry_prob
+import struct
+from symmetry import numpy_symmetry_index
 
 FIXED_DATA_VERSION = 1
 DATA_LINES = 45
 
+BINARY_CHUNK_MAGIC = b'SYBC'
+BINARY_CHUNK_VERSION = 1
+BINARY_HEADER = struct.Struct('<4sBBBBBbBxfff')
+BINARY_PLANES = 34
+
 '''
 ------- claiming -------
  L1       : Version
- L2       : Mode
+ L2       : Mode, 0 is the full search and 1 is the fast search. The
+            probabilities of the fast search are zeros, so they have
+            no policy loss.
  
  ------- Inputs data -------
  L3       : Board size
@@ -42,6 +50,10 @@ class Data():
         self.q_value = None
         self.final_score = None
 
+        # The symmetry applied by the engine, or None if the data is
+        # not transformed.
+        self.symmetry = None
+
     def hex_to_int(self, h):
         if h == '0':
             return [0, 0, 0, 0]
@@ -147,6 +159,50 @@ class Data():
         elif linecnt == 44:
             self.final_score = float(readline)
 
+    @staticmethod
+    def get_binary_size(board_size):
+        num_intersections = board_size * board_size
+        plane_bytes = (num_intersections + 7) // 8
+        return BINARY_HEADER.size + \
+                   BINARY_PLANES * plane_bytes + \
+                   4 * (num_intersections + 1) + \
+                   num_intersections
+
+    def fill_binary(self, buf):
+        # The binary record. See the neural/training.h.
+        magic, fmt, v, m, bsize, stm, res, symm, komi, q, score = \
+            BINARY_HEADER.unpack_from(buf, 0)
+        assert magic == BINARY_CHUNK_MAGIC, "The data is not a binary record."
+        assert fmt == BINARY_CHUNK_VERSION, "The binary record is not correct version."
+        assert v == FIXED_DATA_VERSION, "The data is not correct version."
+
+        num_intersections = bsize * bsize
+        plane_bytes = (num_intersections + 7) // 8
+
+        self.board_size = bsize
+        self.to_move = stm
+        self.komi = komi
+        self.result = res
+        self.q_value = q
+        self.final_score = score
+        self.symmetry = symm - 1 if symm > 0 else None
+
+        offset = BINARY_HEADER.size
+        size = BINARY_PLANES * plane_bytes
+        planes = np.frombuffer(buf, dtype=np.uint8, count=size, offset=offset)
+        planes = np.unpackbits(np.reshape(planes, (BINARY_PLANES, plane_bytes)),
+                                   axis=1, bitorder='little')
+        self.planes = planes[:, :num_intersections].astype(np.int8)
+        offset += size
+
+        size = num_intersections + 1
+        self.prob = np.frombuffer(buf, dtype='<f2', count=size, offset=offset).astype(np.float32)
+        offset += 2 * size
+        self.aux_prob = np.frombuffer(buf, dtype='<f2', count=size, offset=offset).astype(np.float32)
+        offset += 2 * size
+
+        self.ownership = np.frombuffer(buf, dtype=np.int8, count=num_intersections, offset=offset).copy()
+
     @staticmethod
     def get_datalines(version):
         if version == 1:
@@ -154,19 +210,16 @@ class Data():
         return 0
 
     def apply_symmetry(self, symm):
-        channels       = self.planes.shape[0]
+        # Remap all arrays with one precomputed index. The pass move
+        # is the last one and it is not moved.
         bsize          = self.board_size
+        index          = numpy_symmetry_index(symm, bsize)
+        prob_index     = numpy_symmetry_index(symm, bsize, True)
 
-        self.planes    = np.reshape(self.planes, (channels, bsize, bsize))
-        self.planes    = numpy_symmetry_planes(symm, self.planes)
-        self.planes    = np.reshape(self.planes, (channels, bsize * bsize))
-
-        self.ownership = np.reshape(self.ownership, (bsize, bsize))
-        self.ownership = numpy_symmetry_plane(symm, self.ownership)
-        self.ownership = np.reshape(self.ownership, (bsize * bsize))
-
-        self.prob      = numpy_symmetry_prob(symm, self.prob)
-        self.aux_prob  = numpy_symmetry_prob(symm, self.aux_prob)
+        self.planes    = self.planes[:, index]
+        self.ownership = self.ownership[index]
+        self.prob      = self.prob[prob_index]
+        self.aux_prob  = self.aux_prob[prob_index]
 
     def __str__(self):
         out = str()
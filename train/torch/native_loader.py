@@ -0,0 +1,60 @@
+import torch
+
+try:
+    import sayuri_loader
+except ImportError:
+    sayuri_loader = None
+
+def native_loader_available():
+    return sayuri_loader is not None
+
+def NativeLoader(*args, **kwargs):
+    # The C++ version of the LazyLoader with the StreamParser and the
+    # BatchGenerator. Build it in train/loader. It yields the same
+    # batches as the LazyLoader.
+    filenames = kwargs.get("filenames", list())
+    board_size = kwargs.get("board_size", 19)
+    input_channels = kwargs.get("input_channels", 38)
+    num_workers = kwargs.get("num_workers", 0)
+    buffer_size = kwargs.get("buffer_size", 0)
+    batch_size = kwargs.get("batch_size", 0)
+    down_sample_rate = kwargs.get("down_sample_rate", 0)
+    pin_memory = kwargs.get("pin_memory", False)
+
+    loader = sayuri_loader.Loader(
+                 filenames = filenames,
+                 board_size = board_size,
+                 input_channels = input_channels,
+                 num_workers = num_workers,
+                 buffer_size = buffer_size,
+                 down_sample_rate = down_sample_rate
+             )
+    num_intersections = board_size * board_size
+
+    def empty(*shape):
+        return torch.empty(shape, dtype=torch.float32, pin_memory=pin_memory)
+
+    while True:
+        # Allocate the new tensors every batch because the former
+        # batch may be still in use. The loader fills them in place.
+        planes = empty(batch_size, input_channels, board_size, board_size)
+        prob = empty(batch_size, num_intersections+1)
+        aux_prob = empty(batch_size, num_intersections+1)
+        ownership = empty(batch_size, num_intersections)
+        wdl = empty(batch_size, 3)
+        stm = empty(batch_size, 1)
+        score = empty(batch_size, 1)
+
+        batch_bsize = loader.next_batch(
+                          planes.numpy(), prob.numpy(), aux_prob.numpy(),
+                          ownership.numpy(), wdl.numpy(), stm.numpy(), score.numpy())
+        yield (
+            batch_bsize,
+            planes,
+            prob,
+            aux_prob,
+            ownership,
+            wdl,
+            stm,
+            score
+        )
@@ -0,0 +1,93 @@
+import argparse, glob, os, random, struct, time, zlib
+
+# The indexed shard of the binary records. See the training_shard.h
+# of the engine for the format.
+SHARD_MAGIC = b'SYSH'
+SHARD_VERSION = 1
+SHARD_HEADER = struct.Struct('<4sBBxxqQIxxxx')
+SHARD_INDEX = struct.Struct('<QII')
+
+NO_COMPRESSION = 0
+ZLIB_COMPRESSION = 1
+
+def is_shard(buf):
+    return buf[:len(SHARD_MAGIC)] == SHARD_MAGIC
+
+class ShardReader:
+    def __init__(self, buf):
+        magic, version, compression, generation, index_offset, num_records = \
+            SHARD_HEADER.unpack_from(buf, 0)
+        assert magic == SHARD_MAGIC, "The data is not the shard."
+        assert version == SHARD_VERSION, "The shard is not correct version."
+        assert index_offset >= SHARD_HEADER.size, "The shard is not closed."
+
+        self.buf = buf
+        self.compression = compression
+        self.generation = generation
+        self.index_offset = index_offset
+        self.num_records = num_records
+
+    @staticmethod
+    def read_header(filename):
+        # Only read the header, so windowing many shards is cheap.
+        with open(filename, 'rb') as f:
+            return ShardReader(f.read(SHARD_HEADER.size))
+
+    def __len__(self):
+        return self.num_records
+
+    def read(self, i):
+        # Return the i-th binary record.
+        offset, compressed_size, size = \
+            SHARD_INDEX.unpack_from(self.buf, self.index_offset + i * SHARD_INDEX.size)
+        record = self.buf[offset:offset+compressed_size]
+        if self.compression == ZLIB_COMPRESSION:
+            record = zlib.decompress(record)
+        return record
+
+class ShardStream:
+    # Visit the records of one shard in the random order.
+    def __init__(self, buf):
+        self.reader = ShardReader(buf)
+        self.order = list(range(len(self.reader)))
+        random.shuffle(self.order)
+
+    def next_index(self):
+        if len(self.order) == 0:
+            return None
+        return self.order.pop()
+
+    def read(self, i):
+        return self.reader.read(i)
+
+def gather_shards(root, min_generation=None, max_generation=None):
+    # Return the shards whose generation is in the window.
+    shards = list()
+    for name in glob.glob(os.path.join(root, "**", "*.shard"), recursive=True):
+        try:
+            reader = ShardReader.read_header(name)
+        except (AssertionError, struct.error):
+            continue
+        if min_generation is not None and reader.generation < min_generation:
+            continue
+        if max_generation is not None and reader.generation > max_generation:
+            continue
+        shards.append((name, reader.generation, reader.num_records))
+    shards.sort(key=lambda s: s[1])
+    return shards
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-d", "--dir", metavar="<string>",
+                        help="The directory of the shards.", type=str, required=True)
+    parser.add_argument("--min-generation", metavar="<integer>",
+                        help="Skip the shards played by the older weights.", type=int)
+    parser.add_argument("--max-generation", metavar="<integer>",
+                        help="Skip the shards played by the newer weights.", type=int)
+    args = parser.parse_args()
+
+    shards = gather_shards(args.dir, args.min_generation, args.max_generation)
+    for name, generation, num_records in shards:
+        date = time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(generation))
+        print("{} {} ({}) {}".format(name, generation, date, num_records))
+    print("{} shards, {} records".format(len(shards), sum(s[2] for s in shards)))
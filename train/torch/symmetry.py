@@ -1,6 +1,7 @@
 import torch
 import numpy as np
 import math
+import functools
 
 # input shape must [batch, channel, x, y]
 def torch_symmetry(symm, planes, invert=False):
@@ -59,6 +60,17 @@ def numpy_symmetry_prob(symm, prob):
 
     return outs
 
+# Return the index which remaps the flat [x^2] array, or the flat
+# [x^2+1] array with the pass move, by the symmetry. It is the same as
+# numpy_symmetry_plane and numpy_symmetry_prob.
+@functools.lru_cache(maxsize=None)
+def numpy_symmetry_index(symm, size, with_pass=False):
+    index = np.arange(size * size).reshape((size, size))
+    index = numpy_symmetry_plane(symm, index).reshape(size * size)
+    if with_pass:
+        index = np.append(index, size * size)
+    return np.ascontiguousarray(index)
+
 def __get_direction(symm):
     use_flip = False
     if symm // 4 != 0:
@@ -4,10 +4,12 @@ import numpy as np
 import random, time, math, os, glob, io, gzip
 
 from network import Network
-from data import Data, FIXED_DATA_VERSION
+from data import Data, FIXED_DATA_VERSION, BINARY_CHUNK_MAGIC, BINARY_HEADER
 
 from torch.nn import DataParallel
 from lazy_loader import LazyLoader
+from native_loader import NativeLoader, native_loader_available
+from shard import ShardStream, is_shard
 
 def gather_filenames(root, num_chunks=None, sort_key_fn=None):
     def gather_recursive_files(root):
@@ -40,11 +42,20 @@ class StreamLoader:
             return stream
 
         if filename.find(".gz") >= 0:
-            with gzip.open(filename, 'rt') as f:
-                stream = io.StringIO(f.read())
+            with gzip.open(filename, 'rb') as f:
+                buf = f.read()
         else:
-            with open(filename, 'r') as f:
-                stream = io.StringIO(f.read())
+            with open(filename, 'rb') as f:
+                buf = f.read()
+
+        # The binary chunk and the shard start with the magic,
+        # otherwise it is the text chunk.
+        if is_shard(buf):
+            stream = ShardStream(buf)
+        elif buf[:len(BINARY_CHUNK_MAGIC)] == BINARY_CHUNK_MAGIC:
+            stream = io.BytesIO(buf)
+        else:
+            stream = io.StringIO(buf.decode())
         return stream
 
 class StreamParser:
@@ -57,6 +68,11 @@ class StreamParser:
         if stream is None:
             return None
 
+        if isinstance(stream, io.BytesIO):
+            return self.__parse_binary(stream)
+        if isinstance(stream, ShardStream):
+            return self.__parse_shard(stream)
+
         datalines = Data.get_datalines(FIXED_DATA_VERSION);
         data_str = []
 
@@ -84,6 +100,49 @@ class StreamParser:
 
         return data
 
+    def __parse_binary(self, stream):
+        # The records are fixed width, so skip the down-sampled records
+        # without parsing them.
+        while True:
+            header = stream.read(BINARY_HEADER.size)
+            if len(header) < BINARY_HEADER.size:
+                return None # stream is end
+            board_size = header[7]
+            body = stream.read(Data.get_binary_size(board_size) - BINARY_HEADER.size)
+            if len(body) < Data.get_binary_size(board_size) - BINARY_HEADER.size:
+                return None # the record is broken
+
+            if self.down_sample_rate > 1:
+                if random.randint(0, self.down_sample_rate-1) != 0:
+                    continue
+            break
+
+        data = Data()
+        data.fill_binary(header + body)
+        if data.symmetry is None:
+            data.apply_symmetry(random.randint(0, 7))
+
+        return data
+
+    def __parse_shard(self, stream):
+        # Only decompress the kept records.
+        while True:
+            i = stream.next_index()
+            if i is None:
+                return None # stream is end
+
+            if self.down_sample_rate > 1:
+                if random.randint(0, self.down_sample_rate-1) != 0:
+                    continue
+            break
+
+        data = Data()
+        data.fill_binary(stream.read(i))
+        if data.symmetry is None:
+            data.apply_symmetry(random.randint(0, 7))
+
+        return data
+
 class BatchGenerator:
     def __init__(self, boardsize, input_channels):
         self.nn_board_size = boardsize
@@ -219,6 +278,7 @@ class TrainingPipe():
         self.train_buffer_size = self.cfg.buffersize
         self.validation_buffer_size = self.cfg.buffersize // 10
         self.down_sample_rate = cfg.down_sample_rate
+        self.native_loader = cfg.native_loader
 
         # Max steps per training task.
         self.max_steps =  cfg.max_steps
@@ -348,12 +408,43 @@ class TrainingPipe():
         opt_name = os.path.join(opt_path, "s{}.pt".format(steps))
         torch.save(self.opt.state_dict(), opt_name)
 
+    def __init_native_loader(self, chunks, sort_fn):
+        kwargs = {
+            "board_size" : self.cfg.boardsize,
+            "input_channels" : self.cfg.input_channels,
+            "num_workers" : self.num_workers,
+            "batch_size" : self.macrobatchsize,
+            "down_sample_rate" : self.down_sample_rate,
+            "pin_memory" : bool(self.use_gpu)
+        }
+        self.train_lazy_loader = NativeLoader(
+            filenames = chunks,
+            buffer_size = self.train_buffer_size,
+            **kwargs
+        )
+        batch = next(self.train_lazy_loader)
+
+        if self.validation_dir is not None:
+            self.validation_lazy_loader = NativeLoader(
+                filenames = gather_filenames(self.validation_dir, len(chunks)//10, sort_fn),
+                buffer_size = self.validation_buffer_size,
+                **kwargs
+            )
+            batch = next(self.validation_lazy_loader)
+        else:
+            self.validation_lazy_loader = None
+
     def __init_loader(self):
+        sort_fn = os.path.getmtime
+        if self.native_loader and native_loader_available():
+            chunks = gather_filenames(self.train_dir, self.num_chunks, sort_fn)
+            self.__init_native_loader(chunks, sort_fn)
+            return
+
         self.__stream_loader = StreamLoader()
         self.__stream_parser = StreamParser(self.down_sample_rate)
         self.__batch_gen = BatchGenerator(self.cfg.boardsize, self.cfg.input_channels)
 
-        sort_fn = os.path.getmtime
         chunks = gather_filenames(self.train_dir, self.num_chunks, sort_fn)
 
         self.train_lazy_loader = LazyLoader(
@@ -409,13 +500,13 @@ class TrainingPipe():
 
         # Move the data to the current device.
         if self.use_gpu:
-            planes = planes.to(self.device)
-            target_prob = target_prob.to(self.device)
-            target_aux_prob = target_aux_prob.to(self.device)
-            target_ownership = target_ownership.to(self.device)
-            target_wdl = target_wdl.to(self.device)
-            target_stm = target_stm.to(self.device)
-            target_score = target_score.to(self.device)
+            planes = planes.to(self.device, non_blocking=True)
+            target_prob = target_prob.to(self.device, non_blocking=True)
+            target_aux_prob = target_aux_prob.to(self.device, non_blocking=True)
+            target_ownership = target_ownership.to(self.device, non_blocking=True)
+            target_wdl = target_wdl.to(self.device, non_blocking=True)
+            target_stm = target_stm.to(self.device, non_blocking=True)
+            target_score = target_score.to(self.device, non_blocking=True)
 
         # Gather batch data
         target = (target_prob, target_aux_prob, target_ownership, target_wdl, target_stm, target_score)